@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Number of tables used to fold in 8 bytes at a time
+ */
+#define AIS_CRC16_TABLES                8
+
+/**
+ * Starting value of the running CRC
+ */
+#define AIS_CRC16_INIT                  0xffffu
+
+/**
+ * Value of the running CRC after a packet and its own FCS have gone through it, if the FCS
+ * is good
+ */
+#define AIS_CRC16_GOOD_RESIDUE          0xf0b8u
+
+extern const uint16_t ais_crc16_table[AIS_CRC16_TABLES][256];
+
+/**
+ * Add a byte to a running CRC. Start with AIS_CRC16_INIT.
+ */
+static inline
+uint16_t ais_crc16_update_byte(uint16_t crc, uint8_t byte)
+{
+    return (crc >> 8) ^ ais_crc16_table[0][(crc ^ byte) & 0xff];
+}
+
+/**
+ * Add a buffer to a running CRC, 8 bytes at a time.
+ *
+ * \param crc The running CRC. Start with AIS_CRC16_INIT.
+ * \param data The bytes to add
+ * \param len The number of bytes
+ *
+ * \return The updated running CRC
+ */
+uint16_t ais_crc16_update(uint16_t crc, const uint8_t *data, size_t len);
+
+/**
+ * Calculate the FCS for a packet, as it appears on the air, least significant byte first.
+ */
+static inline
+uint16_t ais_crc16(const uint8_t *data, size_t len)
+{
+    return (uint16_t)~ais_crc16_update(AIS_CRC16_INIT, data, len);
+}
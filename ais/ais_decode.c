@@ -1,6 +1,10 @@
 #include <ais/ais_decode.h>
+#include <ais/ais_dedup.h>
 #include <ais/ais_demod.h>
 #include <ais/ais_msg_format.h>
+#include <ais/ais_vessel_cache.h>
+
+#include <filter/cycle_counter.h>
 
 #include <tsl/safe_alloc.h>
 #include <tsl/errors.h>
@@ -8,13 +12,31 @@
 #include <tsl/assert.h>
 
 #include <string.h>
+#include <time.h>
+
+/**
+ * The most payload characters in one NMEA sentence, so a sentence fits in the 82 characters
+ * NMEA 0183 allows
+ */
+#define AIS_DECODE_NMEA_PAYLOAD_CHARS   60
 
 struct ais_decode {
     struct ais_demod *demod;
+    struct ais_dedup *dedup;
+    uint64_t nr_duplicates;
+    struct ais_vessel_cache *vessels;
+    uint64_t nr_unchanged;
     uint32_t freq;
+    uint64_t types;
     ais_decode_on_position_report_func_t on_position_report;
     ais_decode_on_base_station_report_func_t on_base_station_report;
     ais_decode_on_static_voyage_data_func_t on_static_voyage_data;
+    ais_decode_on_nmea_func_t on_nmea;
+
+    /**
+     * Sequential message ID for the next message that takes more than one sentence
+     */
+    unsigned nmea_seq_id;
 };
 
 #define DUMP(...)
@@ -71,39 +93,25 @@ void _ais_decode_get_string(const uint8_t *packet, size_t packet_len,
 }
 
 static
-aresult_t _ais_decode_position_report(struct ais_decode *decode, const uint8_t *packet, size_t packet_len,
-        unsigned msg_id, unsigned repeat, uint32_t mmsi, const char *raw_msg)
+void _ais_decode_get_position_report(const uint8_t *packet, size_t packet_len, uint32_t mmsi,
+        struct ais_position_report *rpt)
 {
-    aresult_t ret = A_OK;
-
-    struct ais_position_report rpt;
-
-    TSL_ASSERT_ARG(NULL != decode);
-    TSL_ASSERT_ARG(NULL != packet);
-    TSL_ASSERT_ARG(0 != packet_len);
-
-    memset(&rpt, 0, sizeof(rpt));
-
-    rpt.mmsi = mmsi;
-    rpt.nav_stat = _ais_decode_get_bitfield(packet, packet_len, 38, 4);
-    rpt.rate_of_turn = _ais_decode_get_bitfield_signed(packet, packet_len, 42, 8);
-    rpt.speed_over_ground = (float)_ais_decode_get_bitfield(packet, packet_len, 50, 10)/10.0;
-    rpt.position_acc = _ais_decode_get_bitfield(packet, packet_len, 60, 1);
-    rpt.longitude = (float)_ais_decode_get_bitfield_signed(packet, packet_len, 61, 28)/600000.0;
-    rpt.latitude = (float)_ais_decode_get_bitfield_signed(packet, packet_len, 89, 27)/600000.0;
-    rpt.course = _ais_decode_get_bitfield(packet, packet_len, 116, 12);
-    rpt.heading = _ais_decode_get_bitfield(packet, packet_len, 128, 9);
-    rpt.timestamp = _ais_decode_get_bitfield(packet, packet_len, 137, 6);
+    memset(rpt, 0, sizeof(*rpt));
+
+    rpt->mmsi = mmsi;
+    rpt->nav_stat = _ais_decode_get_bitfield(packet, packet_len, 38, 4);
+    rpt->rate_of_turn = _ais_decode_get_bitfield_signed(packet, packet_len, 42, 8);
+    rpt->speed_over_ground = (float)_ais_decode_get_bitfield(packet, packet_len, 50, 10)/10.0;
+    rpt->position_acc = _ais_decode_get_bitfield(packet, packet_len, 60, 1);
+    rpt->longitude = (float)_ais_decode_get_bitfield_signed(packet, packet_len, 61, 28)/600000.0;
+    rpt->latitude = (float)_ais_decode_get_bitfield_signed(packet, packet_len, 89, 27)/600000.0;
+    rpt->course = _ais_decode_get_bitfield(packet, packet_len, 116, 12);
+    rpt->heading = _ais_decode_get_bitfield(packet, packet_len, 128, 9);
+    rpt->timestamp = _ais_decode_get_bitfield(packet, packet_len, 137, 6);
 
     DUMP("  Nav Stat = %1u RoT = %3f SoG = %4.2f (%9.6f, %9.6f), CoG = %u Heading = %u Timestamp = %u\n",
-            rpt.nav_stat, (double)rpt.rate_of_turn, (double)rpt.speed_over_ground, (double)rpt.latitude,
-            (double)rpt.longitude, rpt.course, rpt.heading, rpt.timestamp);
-
-    if (NULL != decode->on_position_report) {
-        decode->on_position_report(decode, NULL, &rpt, raw_msg);
-    }
-
-    return ret;
+            rpt->nav_stat, (double)rpt->rate_of_turn, (double)rpt->speed_over_ground, (double)rpt->latitude,
+            (double)rpt->longitude, rpt->course, rpt->heading, rpt->timestamp);
 }
 
 static
@@ -224,6 +232,113 @@ char _ais_decode_to_ascii_armor(uint8_t in)
     }
 }
 
+/**
+ * Write a packet out as !AIVDM sentences, straight from the packet bytes. The payload is split
+ * across as many sentences as it takes.
+ *
+ * \return The length of the sentences, in bytes
+ */
+static
+size_t _ais_decode_nmea(struct ais_decode *decode, const uint8_t *packet, size_t packet_len,
+        char *out, size_t out_len)
+{
+    char payload[(AIS_DECODE_MAX_PACKET_BYTES * 8 + 5) / 6];
+    size_t nr_bits = packet_len * 8,
+           nr_chars = (nr_bits + 5) / 6,
+           nr_fill = nr_chars * 6 - nr_bits,
+           nr_sentences = (nr_chars + AIS_DECODE_NMEA_PAYLOAD_CHARS - 1) / AIS_DECODE_NMEA_PAYLOAD_CHARS,
+           len = 0;
+    uint32_t accum = 0;
+    unsigned accum_bits = 0;
+    char channel[2] = { '\0', '\0' },
+         seq_id[2] = { '\0', '\0' };
+
+    TSL_BUG_ON(AIS_DECODE_MAX_PACKET_BYTES < packet_len);
+
+    /* 6 bits per character, the last one padded out with 0's */
+    for (size_t i = 0, offs = 0; i < nr_chars; i++) {
+        if (accum_bits < 6) {
+            accum = (accum << 8) | (offs < packet_len ? packet[offs] : 0);
+            accum_bits += 8;
+            offs++;
+        }
+        accum_bits -= 6;
+        payload[i] = _ais_decode_to_ascii_armor((accum >> accum_bits) & 0x3f);
+    }
+
+    if (161975000ul == decode->freq) {
+        channel[0] = 'A';
+    } else if (162025000ul == decode->freq) {
+        channel[0] = 'B';
+    }
+
+    if (1 < nr_sentences) {
+        seq_id[0] = '0' + decode->nmea_seq_id;
+        decode->nmea_seq_id = (decode->nmea_seq_id + 1) % 10;
+    }
+
+    for (size_t i = 0; i < nr_sentences; i++) {
+        size_t start = i * AIS_DECODE_NMEA_PAYLOAD_CHARS,
+               chunk = BL_MIN2(nr_chars - start, (size_t)AIS_DECODE_NMEA_PAYLOAD_CHARS),
+               sentence = len;
+        uint8_t csum = 0;
+        int nr_written = 0;
+
+        nr_written = snprintf(out + len, out_len - len, "!AIVDM,%zu,%zu,%s,%s,%.*s,%zu", nr_sentences, i + 1,
+                seq_id, channel, (int)chunk, payload + start, i + 1 == nr_sentences ? nr_fill : 0);
+        TSL_BUG_ON(nr_written < 0 || (size_t)nr_written >= out_len - len);
+        len += nr_written;
+
+        /* The checksum covers everything between the ! and the * */
+        for (size_t j = sentence + 1; j < len; j++) {
+            csum ^= (uint8_t)out[j];
+        }
+
+        nr_written = snprintf(out + len, out_len - len, "*%02X\r\n", csum);
+        TSL_BUG_ON(nr_written < 0 || (size_t)nr_written >= out_len - len);
+        len += nr_written;
+    }
+
+    return len;
+}
+
+static
+uint64_t _ais_decode_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static
+bool _ais_decode_is_position_report(unsigned msg_id)
+{
+    return AIS_MESSAGE_POSITION_REPORT_SOTDMA == msg_id || AIS_MESSAGE_POSITION_REPORT_SOTDMA2 == msg_id ||
+        AIS_MESSAGE_POSITION_REPORT_ITDMA == msg_id;
+}
+
+/**
+ * Check if anything wants the decoded fields of a message
+ */
+static
+bool _ais_decode_wants_fields(struct ais_decode *decode, unsigned msg_id)
+{
+    switch (msg_id) {
+    case AIS_MESSAGE_POSITION_REPORT_SOTDMA:
+    case AIS_MESSAGE_POSITION_REPORT_SOTDMA2:
+    case AIS_MESSAGE_POSITION_REPORT_ITDMA:
+        return NULL != decode->on_position_report;
+    case AIS_MESSAGE_BASE_STATION_REPORT:
+        return NULL != decode->on_base_station_report;
+    case AIS_MESSAGE_SHIP_STATIC_INFO:
+        return NULL != decode->on_static_voyage_data;
+    }
+
+    return false;
+}
+
 
 static
 aresult_t _ais_decode_demod_on_msg(struct ais_demod *demod, void *state, const uint8_t *packet,
@@ -237,12 +352,66 @@ aresult_t _ais_decode_demod_on_msg(struct ais_demod *demod, void *state, const u
     size_t offs = 0;
     struct ais_decode *decode = state;
     char msg_ascii_6[(168+(4*256)+5)/6];
+    struct ais_position_report rpt;
+    bool have_rpt = false;
 
     TSL_ASSERT_ARG(NULL != demod);
     TSL_ASSERT_ARG(NULL != state);
     TSL_ASSERT_ARG(NULL != packet);
     TSL_ASSERT_ARG(0 != packet_len);
 
+    /* Extract the message type */
+    msg_id = (packet[0] >> 2) & 0x3f;
+
+    /* Extract repeat indicator */
+    repeat = packet[0] & 0x3;
+
+    /* Extract the MMSI from the packet */
+    mmsi  = (uint32_t)packet[1] << 22;
+    mmsi |= (uint32_t)packet[2] << 14;
+    mmsi |= (uint32_t)packet[3] << 6;
+    mmsi |= ((uint32_t)packet[4] >> 2) & 0x3f;
+
+    /* Nobody subscribed to this type, so don't bother with it */
+    if (0 == (decode->types & AIS_DECODE_TYPE_BIT(msg_id))) {
+        goto done;
+    }
+
+    if (NULL != decode->dedup) {
+        /* The FCS, as received, follows the packet */
+        uint16_t fcs = (uint16_t)packet[packet_len] | (uint16_t)packet[packet_len + 1] << 8;
+
+        if (ais_dedup_check(decode->dedup, fcs, mmsi, _ais_decode_now_ns())) {
+            decode->nr_duplicates++;
+            goto done;
+        }
+    }
+
+    /* Position reports that say nothing new about the vessel go no further, in any form */
+    if (NULL != decode->vessels && _ais_decode_is_position_report(msg_id)) {
+        _ais_decode_get_position_report(packet, packet_len, mmsi, &rpt);
+        have_rpt = true;
+
+        if (false == ais_vessel_cache_check(decode->vessels, &rpt, _ais_decode_now_ns())) {
+            decode->nr_unchanged++;
+            goto done;
+        }
+    }
+
+    if (NULL != decode->on_nmea) {
+        char nmea[AIS_DECODE_NMEA_BYTES];
+        size_t nmea_len = _ais_decode_nmea(decode, packet, packet_len, nmea, sizeof(nmea));
+
+        if (FAILED(ret = decode->on_nmea(decode, NULL, mmsi, nmea, nmea_len))) {
+            goto done;
+        }
+    }
+
+    /* Only pick the fields apart if someone is going to look at them */
+    if (false == _ais_decode_wants_fields(decode, msg_id)) {
+        goto done;
+    }
+
     memset(msg_ascii_6, 0, sizeof(msg_ascii_6));
 
     /* Convert the raw message to ASCII for storage */
@@ -258,25 +427,16 @@ aresult_t _ais_decode_demod_on_msg(struct ais_demod *demod, void *state, const u
         }
     }
 
-    /* Extract the message type */
-    msg_id = (packet[0] >> 2) & 0x3f;
-
-    /* Extract repeat indicator */
-    repeat = packet[0] & 0x3;
-
-    /* Extract the MMSI from the packet */
-    mmsi  = (uint32_t)packet[1] << 22;
-    mmsi |= (uint32_t)packet[2] << 14;
-    mmsi |= (uint32_t)packet[3] << 6;
-    mmsi |= ((uint32_t)packet[4] >> 2) & 0x3f;
-
     DUMP("MsgId: %02u Rpt: %1u MMSI: %9u (Len: %zu bytes)\n", msg_id, repeat, mmsi, packet_len);
 
     switch (msg_id) {
     case AIS_MESSAGE_POSITION_REPORT_SOTDMA:
     case AIS_MESSAGE_POSITION_REPORT_SOTDMA2:
     case AIS_MESSAGE_POSITION_REPORT_ITDMA:
-        _ais_decode_position_report(decode, packet, packet_len, msg_id, repeat, mmsi, msg_ascii_6);
+        if (false == have_rpt) {
+            _ais_decode_get_position_report(packet, packet_len, mmsi, &rpt);
+        }
+        decode->on_position_report(decode, NULL, &rpt, msg_ascii_6);
         break;
     case AIS_MESSAGE_BASE_STATION_REPORT:
         _ais_decode_base_station_report(decode, packet, packet_len, msg_id, repeat, mmsi, msg_ascii_6);
@@ -286,6 +446,7 @@ aresult_t _ais_decode_demod_on_msg(struct ais_demod *demod, void *state, const u
         break;
     }
 
+done:
     return ret;
 }
 
@@ -310,6 +471,7 @@ aresult_t ais_decode_new(struct ais_decode **pdecode, uint32_t freq, ais_decode_
     decode->on_position_report = on_position_report;
     decode->on_base_station_report = on_base_station_report;
     decode->on_static_voyage_data = on_static_voyage_data;
+    decode->types = AIS_DECODE_ALL_TYPES;
 
     *pdecode = decode;
 
@@ -349,9 +511,71 @@ aresult_t ais_decode_delete(struct ais_decode **pdecode)
 
 aresult_t ais_decode_on_pcm(struct ais_decode *decode, const int16_t *samples, size_t nr_samples)
 {
+    aresult_t ret = A_OK;
+
+    CYCLE_COUNT_START(cycles);
+
     TSL_ASSERT_ARG(NULL != decode);
     TSL_ASSERT_ARG(NULL != samples);
     TSL_ASSERT_ARG(0 != nr_samples);
-    return ais_demod_on_pcm(decode->demod, samples, nr_samples);
+
+    ret = ais_demod_on_pcm(decode->demod, samples, nr_samples);
+
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_AIS_ON_PCM, cycles);
+
+    return ret;
 }
 
+aresult_t ais_decode_get_stats(struct ais_decode *decode, struct ais_demod_stats *stats)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != decode);
+    TSL_ASSERT_ARG(NULL != stats);
+
+    if (FAILED(ret = ais_demod_get_stats(decode->demod, stats))) {
+        goto done;
+    }
+
+    stats->nr_duplicates = decode->nr_duplicates;
+    stats->nr_unchanged = decode->nr_unchanged;
+
+done:
+    return ret;
+}
+
+aresult_t ais_decode_set_dedup(struct ais_decode *decode, struct ais_dedup *dedup)
+{
+    TSL_ASSERT_ARG(NULL != decode);
+
+    decode->dedup = dedup;
+
+    return A_OK;
+}
+
+aresult_t ais_decode_set_nmea(struct ais_decode *decode, ais_decode_on_nmea_func_t on_nmea)
+{
+    TSL_ASSERT_ARG(NULL != decode);
+
+    decode->on_nmea = on_nmea;
+
+    return A_OK;
+}
+
+aresult_t ais_decode_set_types(struct ais_decode *decode, uint64_t types)
+{
+    TSL_ASSERT_ARG(NULL != decode);
+
+    decode->types = types;
+
+    return A_OK;
+}
+
+aresult_t ais_decode_set_vessel_cache(struct ais_decode *decode, struct ais_vessel_cache *vessels)
+{
+    TSL_ASSERT_ARG(NULL != decode);
+
+    decode->vessels = vessels;
+
+    return A_OK;
+}
@@ -2,7 +2,29 @@
 
 #include <tsl/result.h>
 
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The longest packet handed over by the demodulator, in bytes, not counting the FCS
+ */
+#define AIS_DECODE_MAX_PACKET_BYTES     158
+
+/**
+ * Enough space for the NMEA sentences for the longest packet
+ */
+#define AIS_DECODE_NMEA_BYTES           512
+
+/**
+ * Bit in a subscription mask for the AIS message type x (1 to 63)
+ */
+#define AIS_DECODE_TYPE_BIT(x)          (1ull << (x))
+#define AIS_DECODE_ALL_TYPES            (~0ull)
+
 struct ais_decode;
+struct ais_dedup;
+struct ais_vessel_cache;
+struct ais_demod_stats;
 
 struct ais_position_report {
     uint32_t mmsi;
@@ -60,7 +82,41 @@ typedef aresult_t (*ais_decode_on_position_report_func_t)(struct ais_decode *dec
 typedef aresult_t (*ais_decode_on_base_station_report_func_t)(struct ais_decode *decode, void *state, struct ais_base_station_report *bsr, const char *raw_msg);
 typedef aresult_t (*ais_decode_on_static_voyage_data_func_t)(struct ais_decode *decode, void *state, struct ais_static_voyage_data *svd, const char *raw_msg);
 
+/**
+ * Called with the !AIVDM sentences for every packet of a subscribed type, whether or not its
+ * fields are decoded. The sentences are each terminated with CR LF, and the buffer isn't NUL
+ * terminated.
+ */
+typedef aresult_t (*ais_decode_on_nmea_func_t)(struct ais_decode *decode, void *state, uint32_t mmsi, const char *sentences, size_t len);
+
 aresult_t ais_decode_new(struct ais_decode **pdecode, uint32_t freq, ais_decode_on_position_report_func_t on_position_report, ais_decode_on_base_station_report_func_t on_base_station_report, ais_decode_on_static_voyage_data_func_t on_static_voyage_data);
 aresult_t ais_decode_delete(struct ais_decode **pdecode);
 aresult_t ais_decode_on_pcm(struct ais_decode *decode, const int16_t *samples, size_t nr_samples);
+aresult_t ais_decode_get_stats(struct ais_decode *decode, struct ais_demod_stats *stats);
+
+/**
+ * Drop packets the given filter has already seen, before any callback is called. The filter can
+ * be shared with the decoders for the other AIS channel. Pass NULL to stop filtering.
+ */
+aresult_t ais_decode_set_dedup(struct ais_decode *decode, struct ais_dedup *dedup);
+
+/**
+ * Write every packet out as NMEA sentences, straight from the packet. Fields are only decoded
+ * for the message types with a callback passed to ais_decode_new, which can all be NULL. Pass
+ * NULL to stop.
+ */
+aresult_t ais_decode_set_nmea(struct ais_decode *decode, ais_decode_on_nmea_func_t on_nmea);
+
+/**
+ * Only handle the message types in the given mask of AIS_DECODE_TYPE_BIT's. Anything else is
+ * dropped before it's decoded. Every type is handled by default.
+ */
+aresult_t ais_decode_set_types(struct ais_decode *decode, uint64_t types);
+
+/**
+ * Drop position reports that don't differ enough from the last one reported for the vessel, as
+ * recorded in the given table, which can be shared with the decoders for other channels. The
+ * reports are dropped before any callback, NMEA included. Pass NULL to stop.
+ */
+aresult_t ais_decode_set_vessel_cache(struct ais_decode *decode, struct ais_vessel_cache *vessels);
 
@@ -0,0 +1,116 @@
+#include <ais/ais_dedup.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+
+#include <pthread.h>
+#include <string.h>
+
+/**
+ * Number of packets remembered. A packet landing in a slot that's in use pushes out whatever
+ * was there, which at worst lets a copy through.
+ */
+#define AIS_DEDUP_NR_SLOTS          256
+
+struct ais_dedup_slot {
+    uint64_t seen_ns;
+    uint32_t mmsi;
+    uint16_t fcs;
+    bool valid;
+};
+
+struct ais_dedup {
+    /**
+     * Protects the slots, since each channel is serviced on its own thread
+     */
+    pthread_mutex_t lock;
+
+    uint64_t window_ns;
+
+    struct ais_dedup_slot slots[AIS_DEDUP_NR_SLOTS];
+};
+
+static
+size_t _ais_dedup_slot(uint16_t fcs, uint32_t mmsi)
+{
+    /* The FCS is already well mixed, so just stir in the MMSI */
+    return ((uint32_t)fcs ^ (mmsi * 2654435761ul)) & (AIS_DEDUP_NR_SLOTS - 1);
+}
+
+aresult_t ais_dedup_new(struct ais_dedup **pdedup, uint64_t window_ns)
+{
+    aresult_t ret = A_OK;
+
+    struct ais_dedup *dedup = NULL;
+
+    TSL_ASSERT_ARG(NULL != pdedup);
+    TSL_ASSERT_ARG(0 != window_ns);
+
+    *pdedup = NULL;
+
+    if (FAILED(ret = TZAALLOC(dedup, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    pthread_mutex_init(&dedup->lock, NULL);
+    dedup->window_ns = window_ns;
+
+    *pdedup = dedup;
+
+done:
+    return ret;
+}
+
+aresult_t ais_dedup_delete(struct ais_dedup **pdedup)
+{
+    aresult_t ret = A_OK;
+
+    struct ais_dedup *dedup = NULL;
+
+    TSL_ASSERT_ARG(NULL != pdedup);
+
+    if (NULL == *pdedup) {
+        goto done;
+    }
+
+    dedup = *pdedup;
+
+    pthread_mutex_destroy(&dedup->lock);
+
+    TFREE(dedup);
+
+    *pdedup = NULL;
+
+done:
+    return ret;
+}
+
+bool ais_dedup_check(struct ais_dedup *dedup, uint16_t fcs, uint32_t mmsi, uint64_t now_ns)
+{
+    struct ais_dedup_slot *slot = NULL;
+    uint64_t age_ns = 0;
+    bool dup = false;
+
+    TSL_BUG_ON(NULL == dedup);
+
+    slot = &dedup->slots[_ais_dedup_slot(fcs, mmsi)];
+
+    pthread_mutex_lock(&dedup->lock);
+
+    /* The copy on the other channel can get here first, with a slightly later timestamp */
+    age_ns = now_ns > slot->seen_ns ? now_ns - slot->seen_ns : slot->seen_ns - now_ns;
+
+    if (true == slot->valid && slot->fcs == fcs && slot->mmsi == mmsi && age_ns < dedup->window_ns) {
+        dup = true;
+    } else {
+        slot->fcs = fcs;
+        slot->mmsi = mmsi;
+        slot->seen_ns = now_ns;
+        slot->valid = true;
+    }
+
+    pthread_mutex_unlock(&dedup->lock);
+
+    return dup;
+}
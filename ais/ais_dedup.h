@@ -0,0 +1,41 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct ais_dedup;
+
+/**
+ * Create a filter for AIS packets heard more than once, for example on both AIS channels, or
+ * through a repeater. Packets are identified by their FCS and the MMSI of the sender, and are
+ * remembered for a short window. The filter can be shared by decoders on different threads.
+ *
+ * \param pdedup The new filter, returned by reference
+ * \param window_ns How long a packet is remembered for, in nanoseconds
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t ais_dedup_new(struct ais_dedup **pdedup, uint64_t window_ns);
+
+/**
+ * Destroy a filter. Every decoder sharing the filter must have been deleted first.
+ *
+ * \param pdedup The filter, passed by reference. Set to NULL.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t ais_dedup_delete(struct ais_dedup **pdedup);
+
+/**
+ * Check if a packet has been seen within the window, remembering it if it hasn't.
+ *
+ * \param dedup The filter
+ * \param fcs The FCS of the packet, as received
+ * \param mmsi The MMSI of the packet's sender
+ * \param now_ns The current time, in nanoseconds, on a clock that doesn't go backwards
+ *
+ * \return true if the packet is a copy of one seen within the window, false otherwise
+ */
+bool ais_dedup_check(struct ais_dedup *dedup, uint16_t fcs, uint32_t mmsi, uint64_t now_ns);
@@ -1,3 +1,4 @@
+#include <ais/ais_crc16.h>
 #include <ais/ais_demod.h>
 #include <ais/ais_demod_priv.h>
 
@@ -15,38 +16,12 @@
 #define STATE_TRANSITION(...)
 #endif /* defined(AIS_DEBUG_STATE) */
 
-static
-uint16_t _ais_crc16(const uint8_t *data, size_t len)
-{
-    uint16_t crc = 0xffffu;
-    const uint16_t poly = 0x8408u;
-
-    for (size_t i = 0; i < len; i++) {
-        crc ^= (uint16_t)data[i];
-        for (size_t j = 0; j < 8; j++) {
-            if (crc & 1) {
-                crc = (crc >> 1) ^ poly;
-            } else {
-                crc >>= 1;
-            }
-        }
-    }
-
-    return ~crc;
-}
-
-static
-bool _ais_demod_compare(uint32_t x, uint32_t y, unsigned diff)
-{
-    return __builtin_popcountll(x ^ y) <= diff;
-}
-
 static
 void _ais_demod_detect_reset(struct ais_demod_detect *detect)
 {
-    memset(detect->preambles, 0, sizeof(detect->preambles));
-    memset(detect->prior_sample, 0, sizeof(detect->prior_sample));
-    detect->next_field = 0;
+    memset(detect->nrzi, 0, sizeof(detect->nrzi));
+    detect->sliced = 0;
+    detect->matches = 0;
 }
 
 static
@@ -56,6 +31,7 @@ void _ais_demod_rx_reset(struct ais_demod_rx *rx)
     rx->raw_shr = 0;
     rx->current_bit = 0;
     rx->nr_ones = 0;
+    rx->crc = AIS_CRC16_INIT;
 }
 
 aresult_t ais_demod_new(struct ais_demod **pdemod, void *state, ais_demod_on_message_callback_func_t cb, uint32_t freq)
@@ -110,50 +86,127 @@ aresult_t ais_demod_delete(struct ais_demod **pdemod)
     return ret;
 }
 
+/**
+ * Get the 64 bits starting at bit offset in an array of words, LSB first
+ */
 static inline
-void _ais_demod_detect_handle_sample(struct ais_demod *demod, int16_t sample)
+uint64_t _ais_demod_bits_at(const uint64_t *words, size_t offset)
+{
+    size_t word = offset / 64,
+           shift = offset % 64;
+
+    if (0 == shift) {
+        return words[word];
+    }
+
+    return (words[word] >> shift) | (words[word + 1] << (64 - shift));
+}
+
+/**
+ * Search a block of samples for the preamble. Every phase at every sample in the block is checked
+ * at once: the mismatches against each bit of the preamble are counted in parallel, one lane per
+ * sample. A lane matches with no more than 2 errors, so the counts only go up to 3, plus a flag
+ * for anything past that.
+ *
+ * \param demod The demodulator
+ * \param samples The block of samples
+ * \param nr_samples The number of samples in the block, at most AIS_DETECT_BLOCK_SAMPLES
+ *
+ * \return The number of samples consumed: all of them, or up to the end of the preamble, if it was
+ *         found.
+ */
+static
+size_t _ais_demod_detect_handle_block(struct ais_demod *demod, const int16_t *samples, size_t nr_samples)
 {
     struct ais_demod_detect *detector = NULL;
 
-    uint8_t sample_slice = 0,
-            nr_match = 0,
-            last_bit = 0;
+    /* History, then the block, as one run of bits */
+    uint64_t nrzi[AIS_DETECT_HISTORY_WORDS + 1];
+    uint64_t sliced = 0,
+             valid = 0,
+             once = 0,
+             twice = 0,
+             over = 0,
+             matches = 0,
+             pending = 0;
+    size_t consumed = nr_samples;
 
     TSL_BUG_ON(NULL == demod);
+    TSL_BUG_ON(0 == nr_samples || AIS_DETECT_BLOCK_SAMPLES < nr_samples);
 
     detector = &demod->detector;
 
-    /* Slice our new sample */
-    sample_slice = sample > 0;
+    valid = 64 == nr_samples ? ~0ull : (1ull << nr_samples) - 1;
+
+    /* Slice the samples */
+    for (size_t i = 0; i < nr_samples; i++) {
+        sliced |= (uint64_t)(samples[i] > 0) << i;
+    }
+
+    /* NRZI decode against the sample one bit period back */
+    memcpy(nrzi, detector->nrzi, sizeof(detector->nrzi));
+    nrzi[AIS_DETECT_HISTORY_WORDS] = ~(sliced ^ ((sliced << AIS_DECIMATION_RATE) |
+                (detector->sliced >> (64 - AIS_DECIMATION_RATE)))) & valid;
+
+    /* Count the bit errors for the preamble ending at each sample, newest bit first */
+    for (size_t j = 0; j < AIS_DETECT_PREAMBLE_BITS; j++) {
+        uint64_t expect = (AIS_DETECT_PREAMBLE >> j) & 1 ? ~0ull : 0,
+                 wrong = _ais_demod_bits_at(nrzi, AIS_DETECT_HISTORY_WORDS * 64 - j * AIS_DECIMATION_RATE) ^ expect,
+                 carry = once & wrong;
+
+        over |= twice & carry;
+        twice |= carry;
+        once ^= wrong;
+
+        /* Most of the time, nothing is left in the running by the end of the flag */
+        matches = ~over & ~(once & twice) & valid;
+        if (0 == matches) {
+            break;
+        }
+    }
+
+    /* Any sample where enough of the current phases match is the end of the preamble */
+    pending = matches;
+    while (0 != pending) {
+        size_t k = __builtin_ctzll(pending);
+        uint64_t window = (matches << (64 - k - 1)) >> (64 - AIS_DECIMATION_RATE);
 
-    /* Grab our prior sample */
-    last_bit = detector->prior_sample[detector->next_field];
+        if (k + 1 < AIS_DECIMATION_RATE) {
+            window |= detector->matches >> (64 - (AIS_DECIMATION_RATE - k - 1));
+        }
 
-    /* Record this sample */
-    detector->prior_sample[detector->next_field] = sample_slice;
+        if (AIS_DETECT_MIN_PHASES <= __builtin_popcountll(window)) {
+            STATE_TRANSITION("SEARCH_SYNC -> RECEIVING (%d matches)", (int)__builtin_popcountll(window));
 
-    detector->preambles[detector->next_field] <<= 1;
-    detector->preambles[detector->next_field] |= !(last_bit ^ sample_slice);
+            demod->state = AIS_DEMOD_STATE_RECEIVING;
+            demod->stats.nr_syncs++;
+            demod->sample_skip = 2;
+            _ais_demod_rx_reset(&demod->packet_rx);
+            demod->packet_rx.last_sample = (sliced >> k) & 1;
 
-    for (size_t i = 0; i < AIS_DECIMATION_RATE; i++) {
-        if (_ais_demod_compare(detector->preambles[i], 0x5555557eul, 2)) {
-#ifdef AIS_PACKET_DEBUG
-            DIAG("   Preamble [%zu]: 0x%08x", i, detector->preambles[i]);
-#endif /* define(AIS_PACKET_DEBUG) */
-            nr_match++;
+            /* The detector is reset when the packet is done, so the history doesn't matter */
+            consumed = k + 1;
+            goto done;
         }
+
+        pending &= pending - 1;
     }
 
-    if (nr_match >= 3) {
-        STATE_TRANSITION("SEARCH_SYNC -> RECEIVING (%d matches)", (int)nr_match);
+    /* Keep the most recent samples for the next block */
+    for (size_t i = 0; i < AIS_DETECT_HISTORY_WORDS; i++) {
+        detector->nrzi[i] = _ais_demod_bits_at(nrzi, nr_samples + i * 64);
+    }
 
-        demod->state = AIS_DEMOD_STATE_RECEIVING;
-        demod->sample_skip = 2;
-        _ais_demod_rx_reset(&demod->packet_rx);
-        demod->packet_rx.last_sample = detector->prior_sample[detector->next_field];
+    if (64 == nr_samples) {
+        detector->sliced = sliced;
+        detector->matches = matches;
+    } else {
+        detector->sliced = (detector->sliced >> nr_samples) | (sliced << (64 - nr_samples));
+        detector->matches = (detector->matches >> nr_samples) | (matches << (64 - nr_samples));
     }
 
-    detector->next_field = (detector->next_field + 1) % AIS_DECIMATION_RATE;
+done:
+    return consumed;
 }
 
 static inline
@@ -180,6 +233,11 @@ void _ais_demod_packet_rx_sample(struct ais_demod *demod, int16_t sample)
     if (rx->nr_ones < 5) {
         rx->packet[rx->current_bit / 8] |= bit << (rx->current_bit % 8);
         rx->current_bit++;
+
+        /* Keep the CRC up to date a byte at a time, so it's ready when the end flag arrives */
+        if (0 == rx->current_bit % 8) {
+            rx->crc = ais_crc16_update_byte(rx->crc, rx->packet[rx->current_bit / 8 - 1]);
+        }
     }
 
     if (0 == bit) {
@@ -192,15 +250,16 @@ void _ais_demod_packet_rx_sample(struct ais_demod *demod, int16_t sample)
         /* We have a packet or some horrible corruption */
         size_t packet_bytes = rx->current_bit / 8;
         if (4 <= packet_bytes) {
-            uint16_t crc = _ais_crc16(rx->packet, packet_bytes - 2),
-                     rx_crc = (uint16_t)rx->packet[packet_bytes - 2] | (uint16_t)rx->packet[packet_bytes - 1] << 8;
-
-            if (rx_crc == crc) {
+            /* The FCS is the last 2 complete bytes, so the CRC over everything has to leave the residue */
+            if (AIS_CRC16_GOOD_RESIDUE == rx->crc) {
+                demod->stats.nr_packets++;
                 TSL_BUG_IF_FAILED(demod->on_msg_cb(demod, demod->caller_state, rx->packet, packet_bytes - 2, true));
             } else {
-                demod->crc_rejects++;
+                demod->stats.nr_crc_rejects++;
 #ifdef AIS_PACKET_DEBUG
-                DIAG("Failed CRC match, raw packet (calculated %04x, received %04x):", crc, rx_crc);
+                DIAG("Failed CRC match, raw packet (calculated %04x, received %04x):",
+                        ais_crc16(rx->packet, packet_bytes - 2),
+                        (uint16_t)rx->packet[packet_bytes - 2] | (uint16_t)rx->packet[packet_bytes - 1] << 8);
                 hexdump_dump_hex(rx->packet, packet_bytes);
 #endif /* defined(_TSL_DEBUG) */
             }
@@ -212,6 +271,18 @@ void _ais_demod_packet_rx_sample(struct ais_demod *demod, int16_t sample)
     }
 }
 
+aresult_t ais_demod_get_stats(struct ais_demod *demod, struct ais_demod_stats *stats)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != demod);
+    TSL_ASSERT_ARG(NULL != stats);
+
+    *stats = demod->stats;
+
+    return ret;
+}
+
 aresult_t ais_demod_on_pcm(struct ais_demod *demod, const int16_t *samples, size_t nr_samples)
 {
     aresult_t ret = A_OK;
@@ -223,15 +294,15 @@ aresult_t ais_demod_on_pcm(struct ais_demod *demod, const int16_t *samples, size
 
     while (nr_samples > cur_sample) {
         if (demod->state == AIS_DEMOD_STATE_SEARCH_SYNC) {
-            for (size_t i = cur_sample; i < nr_samples; i++, cur_sample++) {
-                /* Process this sample */
-                _ais_demod_detect_handle_sample(demod, samples[i]);
+            while (nr_samples > cur_sample) {
+                size_t block = BL_MIN2(nr_samples - cur_sample, (size_t)AIS_DETECT_BLOCK_SAMPLES);
+
+                cur_sample += _ais_demod_detect_handle_block(demod, &samples[cur_sample], block);
                 if (demod->state == AIS_DEMOD_STATE_RECEIVING) {
                     /* Preamble was found, break. */
 #ifdef  AIS_PACKET_DEBUG
-                    fprintf(stderr, "   %zu, %d       %% last preamble bit\n", i, samples[i]);
+                    fprintf(stderr, "   %zu, %d       %% last preamble bit\n", cur_sample - 1, samples[cur_sample - 1]);
 #endif
-                    cur_sample = i + 1;
                     break;
                 }
             }
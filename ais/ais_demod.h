@@ -3,16 +3,49 @@
 #include <tsl/result.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct ais_demod;
 
+/**
+ * Counters kept by an AIS demodulator. Only updated by the thread feeding it samples.
+ */
+struct ais_demod_stats {
+    /**
+     * Number of preambles found
+     */
+    uint64_t nr_syncs;
+
+    /**
+     * Number of packets received with a good FCS
+     */
+    uint64_t nr_packets;
+
+    /**
+     * Number of packets thrown away for a bad FCS
+     */
+    uint64_t nr_crc_rejects;
+
+    /**
+     * Number of packets thrown away as copies of one already heard, by an ais_decode with a
+     * duplicate filter. The demodulator itself leaves this at 0.
+     */
+    uint64_t nr_duplicates;
+
+    /**
+     * Number of position reports thrown away by an ais_decode with a vessel cache, for not saying
+     * anything new. The demodulator itself leaves this at 0.
+     */
+    uint64_t nr_unchanged;
+};
+
 /**
  * Callback called whenever a packet has been received.
  *
  * \param demod The demodulator state
  * \param state The state passed to the demodulator on creation
- * \param packet The raw packet, packed as binary
- * \param packet_len The length of the raw packet, in bytes
+ * \param packet The raw packet, packed as binary. The 2 bytes of FCS, as received, follow it.
+ * \param packet_len The length of the raw packet, in bytes, not counting the FCS
  * \param fcs_valid Boolean value indicating if the FCS is valid or not
  */
 typedef aresult_t (*ais_demod_on_message_callback_func_t)(struct ais_demod *demod, void *state, const uint8_t *packet, size_t packet_len, bool fcs_valid);
@@ -47,3 +80,12 @@ aresult_t ais_demod_delete(struct ais_demod **pdemod);
  */
 aresult_t ais_demod_on_pcm(struct ais_demod *demod, const int16_t *samples, size_t nr_samples);
 
+/**
+ * Get a copy of the demodulator's counters.
+ *
+ * \param demod The demodulator state
+ * \param stats The counters, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t ais_demod_get_stats(struct ais_demod *demod, struct ais_demod_stats *stats);
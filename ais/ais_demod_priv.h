@@ -18,24 +18,57 @@
 #define AIS_DECIMATION_RATE         (AIS_INPUT_SAMPLE_RATE/AIS_BIT_RATE)
 
 /**
- * Structure to track detecting the preamble for AIS
+ * The preamble and start flag, NRZI decoded, as it appears in a detector shift register, most
+ * recent bit in the LSB
+ */
+#define AIS_DETECT_PREAMBLE             0x5555557eul
+
+/**
+ * Number of bits in the preamble and start flag
+ */
+#define AIS_DETECT_PREAMBLE_BITS        32
+
+/**
+ * Number of the last AIS_DECIMATION_RATE phases that have to match for the packet to be
+ * considered found
+ */
+#define AIS_DETECT_MIN_PHASES           3
+
+/**
+ * Samples are sliced, and searched for the preamble, this many at a time
+ */
+#define AIS_DETECT_BLOCK_SAMPLES        64
+
+/**
+ * Number of words of NRZI-decoded history needed to check every phase of a block against the
+ * whole preamble
+ */
+#define AIS_DETECT_HISTORY_WORDS        ((AIS_DETECT_PREAMBLE_BITS * AIS_DECIMATION_RATE + 63) / 64)
+
+/**
+ * Structure to track detecting the preamble for AIS. Rather than keeping a shift register for each
+ * phase, the detector keeps one bit per sample, so a whole block of samples can be checked at
+ * once: the register for the phase ending at sample k is every AIS_DECIMATION_RATE'th bit,
+ * counting back from k.
+ *
+ * In each word, the LSB is the oldest sample.
  */
 struct ais_demod_detect {
     /**
-     * Preamble detection shift registers
+     * NRZI-decoded bits for the most recent samples, oldest word first. A sample's bit is set if
+     * it was sliced the same as the sample one bit period before it.
      */
-    uint32_t preambles[AIS_DECIMATION_RATE];
+    uint64_t nrzi[AIS_DETECT_HISTORY_WORDS];
 
     /**
-     * The last sample we saw (for NRZI decoding)
+     * The most recent sliced samples, for NRZI decoding the next block
      */
-    uint8_t prior_sample[AIS_DECIMATION_RATE];
+    uint64_t sliced;
 
     /**
-     * Next preamble decimation field to update
+     * Whether each of the most recent phases matched the preamble
      */
-    size_t next_field;
-
+    uint64_t matches;
 };
 
 #define AIS_PACKET_BITS                 256
@@ -82,6 +115,11 @@ struct ais_demod_rx {
      * Number of 1's in a row (to deal with bit stuffing)
      */
     size_t nr_ones;
+
+    /**
+     * Running CRC over every complete byte received so far, FCS included
+     */
+    uint16_t crc;
 };
 
 /**
@@ -102,7 +140,7 @@ struct ais_demod {
     ais_demod_on_message_callback_func_t on_msg_cb;
     uint32_t freq;
     size_t sample_skip;
-    size_t crc_rejects;
+    struct ais_demod_stats stats;
     void *caller_state;
 };
 
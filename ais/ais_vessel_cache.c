@@ -0,0 +1,376 @@
+#include <ais/ais_vessel_cache.h>
+#include <ais/ais_decode.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+/**
+ * Marks an empty hash table slot, or the end of the LRU list
+ */
+#define AIS_VESSEL_CACHE_NONE           UINT32_MAX
+
+/**
+ * Values meaning a field isn't available, as sent
+ */
+#define AIS_VESSEL_LON_NA               181.0f
+#define AIS_VESSEL_LAT_NA               91.0f
+#define AIS_VESSEL_COURSE_NA            3600
+#define AIS_VESSEL_HEADING_NA           511
+
+/**
+ * Metres per degree of latitude
+ */
+#define AIS_VESSEL_METRES_PER_DEG       111195.0f
+
+/**
+ * The last position reported for a vessel
+ */
+struct ais_vessel {
+    uint32_t mmsi;
+
+    /**
+     * Neighbours in the LRU list, most recently heard from first
+     */
+    uint32_t prev;
+    uint32_t next;
+
+    uint32_t nav_stat;
+    uint32_t course;
+    uint32_t heading;
+    float longitude;
+    float latitude;
+    float speed_over_ground;
+
+    /**
+     * When the vessel was last reported
+     */
+    uint64_t reported_ns;
+};
+
+struct ais_vessel_cache {
+    /**
+     * Protects everything below, since each channel is serviced on its own thread
+     */
+    pthread_mutex_t lock;
+
+    struct ais_vessel_cache_params params;
+
+    /**
+     * The vessels, nr_used of nr_vessels of which are in use
+     */
+    struct ais_vessel *vessels;
+    size_t nr_vessels;
+    size_t nr_used;
+
+    /**
+     * The ends of the LRU list
+     */
+    uint32_t lru_head;
+    uint32_t lru_tail;
+
+    /**
+     * Open addressed hash table of indices into vessels, by MMSI, probed linearly
+     */
+    uint32_t *slots;
+    uint32_t slot_mask;
+    unsigned slot_shift;
+};
+
+static
+uint32_t _ais_vessel_cache_hash(struct ais_vessel_cache *cache, uint32_t mmsi)
+{
+    return (uint32_t)(mmsi * 2654435761ul) >> cache->slot_shift;
+}
+
+/**
+ * Find the slot for a vessel, or the empty slot it would go in
+ */
+static
+uint32_t _ais_vessel_cache_find(struct ais_vessel_cache *cache, uint32_t mmsi)
+{
+    uint32_t slot = _ais_vessel_cache_hash(cache, mmsi);
+
+    while (AIS_VESSEL_CACHE_NONE != cache->slots[slot] && cache->vessels[cache->slots[slot]].mmsi != mmsi) {
+        slot = (slot + 1) & cache->slot_mask;
+    }
+
+    return slot;
+}
+
+/**
+ * Remove a vessel from the hash table, moving back any vessels probed past it so they can still
+ * be found
+ */
+static
+void _ais_vessel_cache_unhash(struct ais_vessel_cache *cache, uint32_t mmsi)
+{
+    uint32_t hole = _ais_vessel_cache_find(cache, mmsi),
+             slot = hole;
+
+    TSL_BUG_ON(AIS_VESSEL_CACHE_NONE == cache->slots[hole]);
+
+    cache->slots[hole] = AIS_VESSEL_CACHE_NONE;
+
+    for (;;) {
+        uint32_t home = 0;
+
+        slot = (slot + 1) & cache->slot_mask;
+
+        if (AIS_VESSEL_CACHE_NONE == cache->slots[slot]) {
+            break;
+        }
+
+        home = _ais_vessel_cache_hash(cache, cache->vessels[cache->slots[slot]].mmsi);
+
+        /* Leave it be if its home is cyclically between the hole and where it is now */
+        if (((slot - home) & cache->slot_mask) < ((slot - hole) & cache->slot_mask)) {
+            continue;
+        }
+
+        cache->slots[hole] = cache->slots[slot];
+        cache->slots[slot] = AIS_VESSEL_CACHE_NONE;
+        hole = slot;
+    }
+}
+
+static
+void _ais_vessel_cache_lru_unlink(struct ais_vessel_cache *cache, uint32_t idx)
+{
+    struct ais_vessel *vessel = &cache->vessels[idx];
+
+    if (AIS_VESSEL_CACHE_NONE != vessel->prev) {
+        cache->vessels[vessel->prev].next = vessel->next;
+    } else {
+        cache->lru_head = vessel->next;
+    }
+
+    if (AIS_VESSEL_CACHE_NONE != vessel->next) {
+        cache->vessels[vessel->next].prev = vessel->prev;
+    } else {
+        cache->lru_tail = vessel->prev;
+    }
+}
+
+static
+void _ais_vessel_cache_lru_push(struct ais_vessel_cache *cache, uint32_t idx)
+{
+    struct ais_vessel *vessel = &cache->vessels[idx];
+
+    vessel->prev = AIS_VESSEL_CACHE_NONE;
+    vessel->next = cache->lru_head;
+
+    if (AIS_VESSEL_CACHE_NONE != cache->lru_head) {
+        cache->vessels[cache->lru_head].prev = idx;
+    } else {
+        cache->lru_tail = idx;
+    }
+
+    cache->lru_head = idx;
+}
+
+/**
+ * Check if an angle, in degrees, has changed by more than delta. A change to or from not
+ * available always counts.
+ */
+static
+bool _ais_vessel_angle_changed(uint32_t from, uint32_t to, uint32_t not_avail, float scale, float delta)
+{
+    float diff = 0.0f;
+
+    if (from == not_avail || to == not_avail) {
+        return from != to;
+    }
+
+    diff = fabsf((float)from - (float)to) / scale;
+    if (diff > 180.0f) {
+        diff = 360.0f - diff;
+    }
+
+    return diff > delta;
+}
+
+static
+bool _ais_vessel_moved(const struct ais_vessel *vessel, const struct ais_position_report *rpt, float delta_m)
+{
+    float dlat = 0.0f,
+          dlon = 0.0f;
+
+    if (vessel->longitude == AIS_VESSEL_LON_NA || vessel->latitude == AIS_VESSEL_LAT_NA ||
+            rpt->longitude == AIS_VESSEL_LON_NA || rpt->latitude == AIS_VESSEL_LAT_NA)
+    {
+        return vessel->longitude != rpt->longitude || vessel->latitude != rpt->latitude;
+    }
+
+    /* Flat earth is plenty for distances this short */
+    dlat = (rpt->latitude - vessel->latitude) * AIS_VESSEL_METRES_PER_DEG;
+    dlon = fabsf(rpt->longitude - vessel->longitude);
+    if (dlon > 180.0f) {
+        dlon = 360.0f - dlon;
+    }
+    dlon *= AIS_VESSEL_METRES_PER_DEG * cosf(rpt->latitude * (float)M_PI / 180.0f);
+
+    return dlat * dlat + dlon * dlon > delta_m * delta_m;
+}
+
+static
+void _ais_vessel_cache_record(struct ais_vessel *vessel, const struct ais_position_report *rpt, uint64_t now_ns)
+{
+    vessel->mmsi = rpt->mmsi;
+    vessel->nav_stat = rpt->nav_stat;
+    vessel->course = rpt->course;
+    vessel->heading = rpt->heading;
+    vessel->longitude = rpt->longitude;
+    vessel->latitude = rpt->latitude;
+    vessel->speed_over_ground = rpt->speed_over_ground;
+    vessel->reported_ns = now_ns;
+}
+
+aresult_t ais_vessel_cache_new(struct ais_vessel_cache **pcache, size_t nr_vessels,
+        const struct ais_vessel_cache_params *params)
+{
+    aresult_t ret = A_OK;
+
+    struct ais_vessel_cache *cache = NULL;
+    size_t nr_slots = 2;
+    unsigned slot_bits = 1;
+
+    TSL_ASSERT_ARG(NULL != pcache);
+    TSL_ASSERT_ARG(0 != nr_vessels && nr_vessels < (1ul << 30));
+    TSL_ASSERT_ARG(NULL != params);
+
+    *pcache = NULL;
+
+    /* Keep the table no more than half full, so probes stay short */
+    while (nr_slots < 2 * nr_vessels) {
+        nr_slots <<= 1;
+        slot_bits++;
+    }
+
+    if (FAILED(ret = TZAALLOC(cache, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&cache->vessels, nr_vessels, sizeof(struct ais_vessel), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&cache->slots, nr_slots, sizeof(uint32_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    memset(cache->slots, 0xff, nr_slots * sizeof(uint32_t));
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->params = *params;
+    cache->nr_vessels = nr_vessels;
+    cache->lru_head = AIS_VESSEL_CACHE_NONE;
+    cache->lru_tail = AIS_VESSEL_CACHE_NONE;
+    cache->slot_mask = nr_slots - 1;
+    cache->slot_shift = 32 - slot_bits;
+
+    *pcache = cache;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != cache) {
+            if (NULL != cache->vessels) {
+                TFREE(cache->vessels);
+            }
+            TFREE(cache);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t ais_vessel_cache_delete(struct ais_vessel_cache **pcache)
+{
+    aresult_t ret = A_OK;
+
+    struct ais_vessel_cache *cache = NULL;
+
+    TSL_ASSERT_ARG(NULL != pcache);
+
+    if (NULL == *pcache) {
+        goto done;
+    }
+
+    cache = *pcache;
+
+    pthread_mutex_destroy(&cache->lock);
+
+    TFREE(cache->slots);
+    TFREE(cache->vessels);
+    TFREE(cache);
+
+    *pcache = NULL;
+
+done:
+    return ret;
+}
+
+bool ais_vessel_cache_check(struct ais_vessel_cache *cache, const struct ais_position_report *rpt, uint64_t now_ns)
+{
+    const struct ais_vessel_cache_params *params = NULL;
+    struct ais_vessel *vessel = NULL;
+    uint32_t slot = 0,
+             idx = 0;
+    bool report = true;
+
+    TSL_BUG_ON(NULL == cache);
+    TSL_BUG_ON(NULL == rpt);
+
+    params = &cache->params;
+
+    pthread_mutex_lock(&cache->lock);
+
+    slot = _ais_vessel_cache_find(cache, rpt->mmsi);
+
+    if (AIS_VESSEL_CACHE_NONE != cache->slots[slot]) {
+        idx = cache->slots[slot];
+        vessel = &cache->vessels[idx];
+
+        _ais_vessel_cache_lru_unlink(cache, idx);
+        _ais_vessel_cache_lru_push(cache, idx);
+
+        /* Compare against what was last reported, so a slow drift is caught eventually */
+        report = vessel->nav_stat != rpt->nav_stat ||
+            now_ns - vessel->reported_ns >= params->heartbeat_ns ||
+            fabsf(vessel->speed_over_ground - rpt->speed_over_ground) > params->speed_delta_kn ||
+            _ais_vessel_angle_changed(vessel->course, rpt->course, AIS_VESSEL_COURSE_NA, 10.0f, params->course_delta_deg) ||
+            _ais_vessel_angle_changed(vessel->heading, rpt->heading, AIS_VESSEL_HEADING_NA, 1.0f, params->course_delta_deg) ||
+            _ais_vessel_moved(vessel, rpt, params->position_delta_m);
+
+        if (true == report) {
+            _ais_vessel_cache_record(vessel, rpt, now_ns);
+        }
+
+        goto done;
+    }
+
+    /* A vessel we don't know about, so make room for it if need be */
+    if (cache->nr_used < cache->nr_vessels) {
+        idx = cache->nr_used++;
+    } else {
+        idx = cache->lru_tail;
+        _ais_vessel_cache_lru_unlink(cache, idx);
+        _ais_vessel_cache_unhash(cache, cache->vessels[idx].mmsi);
+
+        /* Removing the old vessel can move things around */
+        slot = _ais_vessel_cache_find(cache, rpt->mmsi);
+    }
+
+    _ais_vessel_cache_record(&cache->vessels[idx], rpt, now_ns);
+    _ais_vessel_cache_lru_push(cache, idx);
+    cache->slots[slot] = idx;
+
+done:
+    pthread_mutex_unlock(&cache->lock);
+
+    return report;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ais_position_report;
+struct ais_vessel_cache;
+
+/**
+ * How much a vessel's position report has to change before it's reported again
+ */
+struct ais_vessel_cache_params {
+    /**
+     * Distance moved, in metres
+     */
+    float position_delta_m;
+
+    /**
+     * Change in speed over ground, in knots
+     */
+    float speed_delta_kn;
+
+    /**
+     * Change in course over ground, or in heading, in degrees
+     */
+    float course_delta_deg;
+
+    /**
+     * Report the vessel anyway if nothing has been reported for it for this long, in nanoseconds
+     */
+    uint64_t heartbeat_ns;
+};
+
+/**
+ * Create a table of the last position reported for each vessel, so reports that don't say
+ * anything new can be dropped. A change in navigational status is always reported. When the
+ * table is full, the vessel heard from least recently is forgotten. The table can be shared by
+ * decoders on different threads.
+ *
+ * \param pcache The new table, returned by reference
+ * \param nr_vessels The most vessels remembered
+ * \param params How much a report has to change to be reported. Copied.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t ais_vessel_cache_new(struct ais_vessel_cache **pcache, size_t nr_vessels,
+        const struct ais_vessel_cache_params *params);
+
+/**
+ * Destroy a table. Every decoder sharing the table must have been deleted first.
+ *
+ * \param pcache The table, passed by reference. Set to NULL.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t ais_vessel_cache_delete(struct ais_vessel_cache **pcache);
+
+/**
+ * Check if a position report should be reported, remembering it as the vessel's last reported
+ * position if so.
+ *
+ * \param cache The table
+ * \param rpt The position report
+ * \param now_ns The current time, in nanoseconds, on a clock that doesn't go backwards
+ *
+ * \return true if the report should be passed on, false if it can be dropped
+ */
+bool ais_vessel_cache_check(struct ais_vessel_cache *cache, const struct ais_position_report *rpt, uint64_t now_ns);
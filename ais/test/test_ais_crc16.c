@@ -0,0 +1,100 @@
+#include <ais/ais_crc16.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The CRC, one bit at a time, as the demodulator used to calculate it
+ */
+static
+uint16_t _test_ais_crc16_bitwise(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xffffu;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i];
+        for (size_t j = 0; j < 8; j++) {
+            if (crc & 1) {
+                crc = (crc >> 1) ^ 0x8408u;
+            } else {
+                crc >>= 1;
+            }
+        }
+    }
+
+    return ~crc;
+}
+
+static
+aresult_t test_ais_crc16_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_ais_crc16_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_check_value, ais_crc16)
+{
+    /* The standard check value for CRC-16/X-25 */
+    TEST_ASSERT_EQUALS(ais_crc16((const uint8_t *)"123456789", 9), 0x906e);
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_tables, ais_crc16)
+{
+    uint8_t packet[160];
+    uint32_t seed = 1;
+
+    for (size_t i = 0; i < sizeof(packet); i++) {
+        seed = seed * 1103515245ul + 12345ul;
+        packet[i] = seed >> 16;
+    }
+
+    /* Every length, so every split between 8 byte folds and single bytes is covered */
+    for (size_t len = 0; len <= sizeof(packet); len++) {
+        TEST_ASSERT_EQUALS(ais_crc16(packet, len), _test_ais_crc16_bitwise(packet, len));
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_running, ais_crc16)
+{
+    uint8_t packet[23];
+    uint16_t fcs = 0,
+             crc = AIS_CRC16_INIT;
+
+    for (size_t i = 0; i < 21; i++) {
+        packet[i] = i * 37 + 5;
+    }
+
+    fcs = ais_crc16(packet, 21);
+    packet[21] = fcs & 0xff;
+    packet[22] = fcs >> 8;
+
+    /* Byte by byte, over the packet and its FCS, as the demodulator does */
+    for (size_t i = 0; i < sizeof(packet); i++) {
+        crc = ais_crc16_update_byte(crc, packet[i]);
+    }
+
+    TEST_ASSERT_EQUALS(crc, AIS_CRC16_GOOD_RESIDUE);
+
+    /* Any single bit flipped breaks it */
+    for (size_t i = 0; i < 8 * sizeof(packet); i++) {
+        packet[i / 8] ^= 1 << (i % 8);
+        TEST_ASSERT_EQUALS(ais_crc16_update(AIS_CRC16_INIT, packet, sizeof(packet)) != AIS_CRC16_GOOD_RESIDUE, true);
+        packet[i / 8] ^= 1 << (i % 8);
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(ais_crc16, test_ais_crc16_cleanup, test_ais_crc16_setup, NULL, NULL);
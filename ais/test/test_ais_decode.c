@@ -0,0 +1,181 @@
+#include <ais/ais_crc16.h>
+#include <ais/ais_decode.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_AIS_SAMPLES_PER_BIT        5
+#define TEST_AIS_NR_SAMPLES             8192
+
+static
+int16_t test_samples[TEST_AIS_NR_SAMPLES];
+
+static
+size_t test_nr_samples = 0;
+
+static
+int16_t test_level = 8000;
+
+static
+char test_nmea[1024];
+
+static
+size_t test_nmea_len = 0;
+
+static
+void _test_ais_send_bit(unsigned bit)
+{
+    /* NRZI: a 0 is sent as a change in level */
+    if (0 == bit) {
+        test_level = -test_level;
+    }
+
+    for (size_t i = 0; i < TEST_AIS_SAMPLES_PER_BIT; i++) {
+        test_samples[test_nr_samples++] = test_level;
+    }
+}
+
+/**
+ * Modulate a packet the way a transponder would: preamble, start flag, bit stuffed data and FCS,
+ * each byte least significant bit first, then the end flag.
+ */
+static
+void _test_ais_modulate(const uint8_t *data, size_t len)
+{
+    uint8_t frame[64];
+    uint16_t fcs = ais_crc16(data, len);
+    unsigned nr_ones = 0;
+
+    memcpy(frame, data, len);
+    frame[len] = fcs & 0xff;
+    frame[len + 1] = fcs >> 8;
+
+    test_nr_samples = 0;
+
+    for (size_t i = 0; i < 64; i++) {
+        test_samples[test_nr_samples++] = 0;
+    }
+
+    for (size_t i = 0; i < 24; i++) {
+        _test_ais_send_bit(i & 1);
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        _test_ais_send_bit((0x7e >> i) & 1);
+    }
+
+    for (size_t i = 0; i < len + 2; i++) {
+        for (size_t j = 0; j < 8; j++) {
+            unsigned bit = (frame[i] >> j) & 1;
+
+            _test_ais_send_bit(bit);
+
+            nr_ones = bit ? nr_ones + 1 : 0;
+            if (5 == nr_ones) {
+                _test_ais_send_bit(0);
+                nr_ones = 0;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        _test_ais_send_bit((0x7e >> i) & 1);
+    }
+
+    for (size_t i = 0; i < 64; i++) {
+        _test_ais_send_bit(0);
+    }
+}
+
+static
+aresult_t _test_ais_on_nmea(struct ais_decode *decode, void *state, uint32_t mmsi, const char *sentences, size_t len)
+{
+    TEST_ASSERT_EQUALS(test_nmea_len + len < sizeof(test_nmea), true);
+
+    memcpy(test_nmea + test_nmea_len, sentences, len);
+    test_nmea_len += len;
+    test_nmea[test_nmea_len] = '\0';
+
+    return A_OK;
+}
+
+/* 177KQJ5000G?tO`K>RA1wUbN0TKH, a position report */
+static
+const uint8_t test_position_report[] = {
+    0x04, 0x71, 0xdb, 0x85, 0xa1, 0x40, 0x00, 0x05, 0xcf, 0xf1, 0xfa, 0x1b, 0x3a, 0x24, 0x41, 0xfe,
+    0x5a, 0x9e, 0x02, 0x46, 0xd8,
+};
+
+/* A message 5 sized packet, long enough to need two sentences */
+static
+const uint8_t test_static_voyage_data[] = {
+    0x14, 0x82, 0xb7, 0x0e, 0xee, 0x7f, 0x1a, 0x50, 0x39, 0xbe, 0xf0, 0x7e, 0xc2, 0x34, 0x7f, 0x06,
+    0x6e, 0xd0, 0x8f, 0x5d, 0xc7, 0x51, 0x24, 0x47, 0xe3, 0x40, 0x43, 0x00, 0x02, 0x6b, 0x6e, 0x54,
+    0x55, 0x94, 0xa0, 0x65, 0x68, 0x5d, 0x64, 0xc4, 0x98, 0x0b, 0xb8, 0xd4, 0x54, 0x4a, 0x87, 0x21,
+    0xa9, 0x9a, 0x01, 0xad, 0x21,
+};
+
+static
+aresult_t test_ais_decode_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_ais_decode_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_nmea, ais_decode)
+{
+    struct ais_decode *decode = NULL;
+
+    TEST_ASSERT_OK(ais_decode_new(&decode, 162025000ul, NULL, NULL, NULL));
+    TEST_ASSERT_OK(ais_decode_set_nmea(decode, _test_ais_on_nmea));
+
+    test_nmea_len = 0;
+    _test_ais_modulate(test_position_report, sizeof(test_position_report));
+    TEST_ASSERT_OK(ais_decode_on_pcm(decode, test_samples, test_nr_samples));
+    TEST_ASSERT_EQUALS(strcmp(test_nmea, "!AIVDM,1,1,,B,177KQJ5000G?tO`K>RA1wUbN0TKH,0*5C\r\n"), 0);
+
+    test_nmea_len = 0;
+    _test_ais_modulate(test_static_voyage_data, sizeof(test_static_voyage_data));
+    TEST_ASSERT_OK(ais_decode_on_pcm(decode, test_samples, test_nr_samples));
+    TEST_ASSERT_EQUALS(strcmp(test_nmea,
+                "!AIVDM,2,1,0,B,58:o3fqw6U0qgg1vhSAw1Vs@Smo7DBA7pl13009cKUAEU:1UJ5mTi9P;f=AD,0*41\r\n"
+                "!AIVDM,2,2,0,B,B`LQbI`1cB4,2*47\r\n"), 0);
+
+    TEST_ASSERT_OK(ais_decode_delete(&decode));
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_type_mask, ais_decode)
+{
+    struct ais_decode *decode = NULL;
+
+    TEST_ASSERT_OK(ais_decode_new(&decode, 161975000ul, NULL, NULL, NULL));
+    TEST_ASSERT_OK(ais_decode_set_nmea(decode, _test_ais_on_nmea));
+    TEST_ASSERT_OK(ais_decode_set_types(decode, AIS_DECODE_TYPE_BIT(5)));
+
+    /* Position reports aren't wanted */
+    test_nmea_len = 0;
+    test_nmea[0] = '\0';
+    _test_ais_modulate(test_position_report, sizeof(test_position_report));
+    TEST_ASSERT_OK(ais_decode_on_pcm(decode, test_samples, test_nr_samples));
+    TEST_ASSERT_EQUALS(test_nmea_len, 0);
+
+    _test_ais_modulate(test_static_voyage_data, sizeof(test_static_voyage_data));
+    TEST_ASSERT_OK(ais_decode_on_pcm(decode, test_samples, test_nr_samples));
+    TEST_ASSERT_EQUALS(strncmp(test_nmea, "!AIVDM,2,1,0,A,", 15), 0);
+
+    TEST_ASSERT_OK(ais_decode_delete(&decode));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(ais_decode, test_ais_decode_cleanup, test_ais_decode_setup, NULL, NULL);
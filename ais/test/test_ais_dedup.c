@@ -0,0 +1,52 @@
+#include <ais/ais_dedup.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TEST_AIS_DEDUP_WINDOW_NS        1000000000ull
+
+static
+aresult_t test_ais_dedup_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_ais_dedup_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_window, ais_dedup)
+{
+    struct ais_dedup *dedup = NULL;
+    uint64_t now_ns = 5 * TEST_AIS_DEDUP_WINDOW_NS;
+
+    TEST_ASSERT_OK(ais_dedup_new(&dedup, TEST_AIS_DEDUP_WINDOW_NS));
+    TEST_ASSERT_NOT_NULL(dedup);
+
+    /* First time is new, the copy from the other channel isn't */
+    TEST_ASSERT_EQUALS(ais_dedup_check(dedup, 0x1234, 366123456ul, now_ns), false);
+    TEST_ASSERT_EQUALS(ais_dedup_check(dedup, 0x1234, 366123456ul, now_ns + 1000), true);
+
+    /* The other channel's thread can stamp its copy a little earlier */
+    TEST_ASSERT_EQUALS(ais_dedup_check(dedup, 0x1234, 366123456ul, now_ns - 1000), true);
+
+    /* A different FCS or a different sender is a different packet */
+    TEST_ASSERT_EQUALS(ais_dedup_check(dedup, 0x1235, 366123456ul, now_ns), false);
+    TEST_ASSERT_EQUALS(ais_dedup_check(dedup, 0x1234, 366123457ul, now_ns), false);
+
+    /* Once the window has passed, the same packet is reported again */
+    TEST_ASSERT_EQUALS(ais_dedup_check(dedup, 0x1235, 366123456ul, now_ns + TEST_AIS_DEDUP_WINDOW_NS), false);
+    TEST_ASSERT_EQUALS(ais_dedup_check(dedup, 0x1235, 366123456ul, now_ns + TEST_AIS_DEDUP_WINDOW_NS + 1), true);
+
+    TEST_ASSERT_OK(ais_dedup_delete(&dedup));
+    TEST_ASSERT_EQUALS(dedup, NULL);
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(ais_dedup, test_ais_dedup_cleanup, test_ais_dedup_setup, NULL, NULL);
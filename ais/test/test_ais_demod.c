@@ -1,5 +1,6 @@
 #include <ais/ais_demod.h>
 #include <ais/ais_decode.h>
+#include <ais/ais_dedup.h>
 
 #include <test/assert.h>
 #include <test/framework.h>
@@ -9,6 +10,7 @@
 #include <tsl/assert.h>
 #include <tsl/hexdump.h>
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -192,6 +194,40 @@ TEST_DECLARE_UNIT(test_one_shot_decoder, ais_demod)
     return A_OK;
 }
 
+TEST_DECLARE_UNIT(test_dual_channel_decoder, ais_demod)
+{
+    struct ais_decode *decoder_a = NULL,
+                      *decoder_b = NULL;
+    struct ais_dedup *dedup = NULL;
+    struct ais_demod_stats stats_a,
+                           stats_b;
+
+    /* The same packets heard on both channels are only reported by the first to hear them */
+    TEST_ASSERT_OK(ais_dedup_new(&dedup, 60ull * 1000ull * 1000ull * 1000ull));
+    TEST_ASSERT_OK(ais_decode_new(&decoder_a, 161975000ul, NULL, NULL, NULL));
+    TEST_ASSERT_OK(ais_decode_new(&decoder_b, 162025000ul, NULL, NULL, NULL));
+    TEST_ASSERT_OK(ais_decode_set_dedup(decoder_a, dedup));
+    TEST_ASSERT_OK(ais_decode_set_dedup(decoder_b, dedup));
+
+    TEST_ASSERT_OK(ais_decode_on_pcm(decoder_a, samples, nr_samples));
+    TEST_ASSERT_OK(ais_decode_on_pcm(decoder_b, samples, nr_samples));
+
+    TEST_ASSERT_OK(ais_decode_get_stats(decoder_a, &stats_a));
+    TEST_ASSERT_OK(ais_decode_get_stats(decoder_b, &stats_b));
+
+    TEST_INF("Channel A: %" PRIu64 " packets, %" PRIu64 " duplicates; channel B: %" PRIu64 " packets, %" PRIu64 " duplicates",
+            stats_a.nr_packets, stats_a.nr_duplicates, stats_b.nr_packets, stats_b.nr_duplicates);
+
+    TEST_ASSERT_EQUALS(stats_a.nr_packets, stats_b.nr_packets);
+    TEST_ASSERT_EQUALS(stats_b.nr_duplicates, stats_b.nr_packets);
+
+    TEST_ASSERT_OK(ais_decode_delete(&decoder_a));
+    TEST_ASSERT_OK(ais_decode_delete(&decoder_b));
+    TEST_ASSERT_OK(ais_dedup_delete(&dedup));
+
+    return A_OK;
+}
+
 TEST_DECLARE_UNIT(test_one_shot, ais_demod)
 {
     struct ais_demod *demod = NULL;
@@ -0,0 +1,129 @@
+#include <ais/ais_vessel_cache.h>
+#include <ais/ais_decode.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_SECOND_NS                  1000000000ull
+
+static
+const struct ais_vessel_cache_params test_params = {
+    .position_delta_m = 10.0f,
+    .speed_delta_kn = 0.5f,
+    .course_delta_deg = 5.0f,
+    .heartbeat_ns = 60 * TEST_SECOND_NS,
+};
+
+static
+void _test_vessel_report(struct ais_position_report *rpt, uint32_t mmsi)
+{
+    memset(rpt, 0, sizeof(*rpt));
+    rpt->mmsi = mmsi;
+    rpt->nav_stat = 5;
+    rpt->latitude = 49.2827f;
+    rpt->longitude = -123.1207f;
+    rpt->speed_over_ground = 0.1f;
+    rpt->course = 3595;
+    rpt->heading = 511;
+}
+
+static
+aresult_t test_ais_vessel_cache_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_ais_vessel_cache_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_changes, ais_vessel_cache)
+{
+    struct ais_vessel_cache *cache = NULL;
+    struct ais_position_report rpt;
+    uint64_t now_ns = 1000 * TEST_SECOND_NS;
+
+    TEST_ASSERT_OK(ais_vessel_cache_new(&cache, 16, &test_params));
+    TEST_ASSERT_NOT_NULL(cache);
+
+    /* A new vessel is always reported, the same report again isn't */
+    _test_vessel_report(&rpt, 316001234ul);
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns), true);
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + TEST_SECOND_NS), false);
+
+    /* About 5 metres north isn't far enough, another 10 is */
+    rpt.latitude += 0.000045f;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 2 * TEST_SECOND_NS), false);
+    rpt.latitude += 0.00009f;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 3 * TEST_SECOND_NS), true);
+
+    /* Course wraps around north */
+    rpt.course = 10;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 4 * TEST_SECOND_NS), false);
+    rpt.course = 100;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 5 * TEST_SECOND_NS), true);
+
+    /* Heading becoming available counts */
+    rpt.heading = 10;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 6 * TEST_SECOND_NS), true);
+
+    rpt.speed_over_ground = 0.5f;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 7 * TEST_SECOND_NS), false);
+    rpt.speed_over_ground = 1.0f;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 8 * TEST_SECOND_NS), true);
+
+    /* Any change in status is reported */
+    rpt.nav_stat = 0;
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 9 * TEST_SECOND_NS), true);
+
+    /* Nothing new, but the heartbeat is due */
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 68 * TEST_SECOND_NS), false);
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, now_ns + 69 * TEST_SECOND_NS), true);
+
+    TEST_ASSERT_OK(ais_vessel_cache_delete(&cache));
+    TEST_ASSERT_EQUALS(cache, NULL);
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_eviction, ais_vessel_cache)
+{
+    struct ais_vessel_cache *cache = NULL;
+    struct ais_position_report rpt;
+
+    TEST_ASSERT_OK(ais_vessel_cache_new(&cache, 64, &test_params));
+
+    /* Fill the table, and then some, keeping vessel 0 fresh */
+    for (uint32_t i = 0; i < 1000; i++) {
+        _test_vessel_report(&rpt, 200000000ul + i);
+        TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, TEST_SECOND_NS), true);
+
+        _test_vessel_report(&rpt, 200000000ul);
+        TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, TEST_SECOND_NS), false);
+    }
+
+    /* The most recent vessels are all still known, with vessel 0 */
+    for (uint32_t i = 1000 - 63; i < 1000; i++) {
+        _test_vessel_report(&rpt, 200000000ul + i);
+        TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, TEST_SECOND_NS), false);
+    }
+
+    _test_vessel_report(&rpt, 200000000ul);
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, TEST_SECOND_NS), false);
+
+    /* And an old one was forgotten */
+    _test_vessel_report(&rpt, 200000000ul + 500);
+    TEST_ASSERT_EQUALS(ais_vessel_cache_check(cache, &rpt, TEST_SECOND_NS), true);
+
+    TEST_ASSERT_OK(ais_vessel_cache_delete(&cache));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(ais_vessel_cache, test_ais_vessel_cache_cleanup, test_ais_vessel_cache_setup, NULL, NULL);
@@ -19,15 +19,29 @@
  *  along with this program; if not, write to the Free Software
  *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
+#include <decoder/decoder_output.h>
+#include <decoder/decoder_batch.h>
+#include <decoder/decoder_stats.h>
+
 #include <pager/pager_flex.h>
 #include <pager/pager_pocsag.h>
+#include <pager/pager_stats.h>
+#include <pager/pager_capcode_filter.h>
+#include <pager/pager_decode_pool.h>
 
 #include <ais/ais_decode.h>
+#include <ais/ais_dedup.h>
+#include <ais/ais_vessel_cache.h>
+#include <ais/ais_demod.h>
 
 #include <filter/filter.h>
 #include <filter/sample_buf.h>
 #include <filter/complex.h>
-#include <filter/dc_blocker.h>
+#include <filter/post_filter.h>
+#include <filter/pcm_ring.h>
+#include <filter/pcm_udp.h>
+#include <filter/sample_trace.h>
+#include <filter/cycle_counter.h>
 
 #include <app/app.h>
 
@@ -36,15 +50,21 @@
 #include <tsl/diag.h>
 #include <tsl/errors.h>
 #include <tsl/assert.h>
+#include <tsl/safe_alloc.h>
+#include <tsl/worker_thread.h>
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <ctype.h>
 #include <time.h>
 #include <inttypes.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define DEC_MSG(sev, sys, msg, ...) MESSAGE("DECODER", sev, sys, msg, ##__VA_ARGS__)
 
@@ -54,8 +74,177 @@ enum decoder_decoder_type {
     DECODER_PROTO_TYPE_AIS = 2,
 };
 
+/**
+ * A set of protocols is kept as a mask of these
+ */
+#define DECODER_TYPE_BIT(_t)        (1u << (_t))
+
+/**
+ * The default number of samples read before they're handed to the resampler, and the range a
+ * channel's batches can adapt over with a latency target
+ */
+#define DECODER_DEFAULT_BATCH_SAMPLES   1024
+#define DECODER_MIN_BATCH_SAMPLES       64
+#define DECODER_MAX_BATCH_SAMPLES       (64 * 1024)
+
+/**
+ * How long an idle channel worker waits for input before checking if it should exit, in
+ * milliseconds
+ */
+#define DECODER_IDLE_TIMEOUT_MS     100
+
+/**
+ * The most reads a worker will do for a channel before giving other channels a turn
+ */
+#define DECODER_MAX_READS_PER_WAKEUP    8
+
+/**
+ * How much of a recording each chunk is responsible for in batch mode, in seconds
+ */
+#define DECODER_BATCH_CHUNK_SECS        60
+
+/**
+ * How far ahead of its start each chunk begins decoding in batch mode, in seconds. Covers sync
+ * acquisition plus the longest FLEX frame (1.875 seconds) or a POCSAG batch (about a second at
+ * 512 baud), with room to spare. POCSAG messages running longer than this across a chunk
+ * boundary can be lost.
+ */
+#define DECODER_BATCH_OVERLAP_SECS      4
+
+/**
+ * A single stream of PCM samples, and everything needed to resample and decode it. Only one
+ * thread touches a channel at a time.
+ */
+struct decoder_channel {
+    /**
+     * The input FIFO, or -1 if reading from a shared memory ring or UDP
+     */
+    int in_fifo;
+
+    /**
+     * A write end of our own input FIFO, held open so we never see end of file while the
+     * producer is away. Only used in multi-channel mode, otherwise -1.
+     */
+    int hold_fifo;
+
+    /**
+     * The input shared memory PCM ring, if not reading from a FIFO
+     */
+    struct pcm_ring *in_ring;
+
+    /**
+     * The input UDP receiver, for a udp://host:port[/id] input
+     */
+    struct pcm_udp_receiver *in_udp;
+
+    /**
+     * How long a UDP read may wait for datagrams. 0 in multi-channel mode, where epoll does
+     * the waiting.
+     */
+    int in_udp_timeout_ms;
+
+    /**
+     * The number of lost datagrams we've already warned about
+     */
+    uint64_t in_udp_nr_lost;
+
+    /**
+     * The protocols being decoded, a mask of DECODER_TYPE_BIT. Every protocol decoder is fed the
+     * same resampled samples.
+     */
+    unsigned types;
+
+    /**
+     * The frequency of the channel, in Hz
+     */
+    unsigned freq;
+
+    struct polyphase_fir *pfir;
+
+    /**
+     * Inversion, gain and DC blocking, applied to the resampled samples
+     */
+    struct post_filter post;
+
+    struct pager_flex *flex;
+    struct pager_pocsag *pocsag;
+    struct ais_decode *ais_decode;
+
+    /**
+     * The sample buffer currently being filled, if any
+     */
+    struct sample_buf *read_buf;
+
+    /**
+     * The number of samples read so far
+     */
+    size_t sample_count;
+
+    /**
+     * When the last read of samples returned, in nanoseconds
+     */
+    uint64_t last_read_ns;
+
+    /**
+     * The number of reads that returned samples, numbering them when tracing
+     */
+    uint64_t nr_reads;
+
+    /**
+     * Timing, reject counts and latencies for this channel
+     */
+    struct decoder_stats stats;
+
+    /**
+     * In batch mode, the chunk of the recording this channel is decoding, which collects its
+     * messages. Otherwise NULL.
+     */
+    struct decoder_batch_chunk *batch;
+
+    /**
+     * How many samples to read before handing them to the resampler. Only changes if there's a
+     * latency target.
+     */
+    size_t batch_samples;
+
+    /**
+     * When the first samples in read_buf were read
+     */
+    uint64_t read_buf_start_ns;
+
+    /**
+     * Resampled output, waiting to be decoded. Room for read_batch_samples.
+     */
+    int16_t *output_buf;
+};
+
+/**
+ * A worker thread servicing channels in multi-channel mode
+ */
+struct decoder_worker {
+    struct worker_thread wthr;
+
+    /**
+     * The index of this worker
+     */
+    size_t id;
+
+    /**
+     * The number of times this worker was woken up to service a channel
+     */
+    size_t nr_wakeups;
+
+    /**
+     * Whether or not the worker thread was started
+     */
+    bool started;
+};
+
+/**
+ * The protocols to decode in single channel mode. FLEX, if none are specified.
+ */
 static
-enum decoder_decoder_type _decoder_type = DECODER_PAGER_TYPE_FLEX;
+unsigned _decoder_types = 0;
 
 static
 unsigned interpolate = 1;
@@ -63,20 +252,37 @@ unsigned interpolate = 1;
 static
 unsigned decimate = 1;
 
+/**
+ * The output to input sample rate ratio, if resampling with a fractional resampler rather than
+ * a polyphase FIR. 0 otherwise.
+ */
+static
+double resample_ratio = 0.0;
+
 static
 unsigned input_sample_rate = 0;
 
+/**
+ * The sample rate out of the resampler, if POCSAG is to be decoded at other than 38400 Hz.
+ * 0 otherwise.
+ */
+static
+unsigned pocsag_sample_rate = 0;
+
+/**
+ * The input FIFO or shared memory ring, in single channel mode
+ */
 static
-int in_fifo = -1;
+const char *in_path = NULL;
 
 static
-int16_t *filter_coeffs = NULL;
+bool _in_shm = false;
 
 static
-size_t nr_filter_coeffs = 0;
+int16_t *filter_coeffs = NULL;
 
 static
-struct polyphase_fir *pfir = NULL;
+size_t nr_filter_coeffs = 0;
 
 static
 bool dc_blocker = false;
@@ -84,14 +290,132 @@ bool dc_blocker = false;
 static
 unsigned center_freq = 0;
 
+/**
+ * Every channel being decoded. Just one, unless a channel configuration was given.
+ */
+static
+struct decoder_channel **channels = NULL;
+
+static
+size_t nr_channels = 0;
+
+/**
+ * The JSON file listing the channels to decode, for multi-channel mode
+ */
+static
+const char *channel_file = NULL;
+
+/**
+ * The number of worker threads to service channels with, in multi-channel mode. 0 picks one per
+ * CPU, up to the number of channels.
+ */
+static
+size_t nr_workers = 0;
+
+/**
+ * The epoll instance all the channel FIFOs are registered with, in multi-channel mode
+ */
+static
+int channel_epoll_fd = -1;
+
+/**
+ * The number of channels still being serviced, in multi-channel mode
+ */
+static
+atomic_size_t nr_live_channels;
+
+/**
+ * The capcodes to decode pager messages for, shared by every channel. NULL for all of them.
+ */
+static
+struct pager_capcode_filter *capcode_filter = NULL;
+
+/**
+ * The most fragmented FLEX messages to reassemble at once, per channel. 0 to write out each
+ * fragment as it arrives.
+ */
+static
+size_t flex_reasm_messages = 0;
+
+/**
+ * How many frames to wait for the next fragment of a FLEX message (about 15 seconds)
+ */
+#define DECODER_FLEX_REASM_TIMEOUT_FRAMES   8
+
+/**
+ * The number of threads decoding FLEX frames and correcting POCSAG batches for every channel,
+ * off the threads receiving samples. 0 to decode on the receiving threads.
+ */
+static
+size_t nr_decode_workers = 0;
+
+/**
+ * The pool of decode threads, shared by every channel, if there is one
+ */
+static
+struct pager_decode_pool *decode_pool = NULL;
+
+/**
+ * The most frames and batches, across every channel, that can wait for a decode thread. Any
+ * beyond that are decoded on the receiving thread.
+ */
+#define DECODER_DECODE_POOL_JOBS            256
+
+/**
+ * Whether AIS packets are written out as !AIVDM sentences, rather than decoded
+ */
+static
+bool ais_nmea = false;
+
+/**
+ * The AIS message types to handle, as a mask of AIS_DECODE_TYPE_BIT's
+ */
+static
+uint64_t ais_types = AIS_DECODE_ALL_TYPES;
+
+/**
+ * Filter for AIS packets heard on more than one channel, shared by every AIS channel in
+ * multi-channel mode
+ */
+static
+struct ais_dedup *ais_dedup = NULL;
+
+/**
+ * How long an AIS packet is remembered for, so copies from the other channel, or a repeater, are
+ * dropped. Anything that changes between reports, like the timestamp, changes the FCS too.
+ */
+#define DECODER_AIS_DEDUP_WINDOW_NS         (2ull * 1000ull * 1000ull * 1000ull)
+
+/**
+ * Last position reported for each vessel, shared by every AIS channel, if -V was given
+ */
 static
-struct pager_flex *flex = NULL;
+struct ais_vessel_cache *ais_vessels = NULL;
+
+/**
+ * Whether -V was given, and the changes it asked for. Defaults for anything not given.
+ */
+static
+bool ais_vessel_filter = false;
 
 static
-struct pager_pocsag *pocsag = NULL;
+struct ais_vessel_cache_params ais_vessel_params = {
+    .position_delta_m = 10.0f,
+    .speed_delta_kn = 0.5f,
+    .course_delta_deg = 5.0f,
+    .heartbeat_ns = 60ull * 1000ull * 1000ull * 1000ull,
+};
 
+/**
+ * The most vessels remembered
+ */
+#define DECODER_AIS_VESSELS                 4096
+
+/**
+ * Where to write the sample trace when we're done, if -L was given
+ */
 static
-struct ais_decode *ais_decode = NULL;
+const char *trace_path = NULL;
 
 static
 int sample_debug_fd = -1;
@@ -102,72 +426,243 @@ double dc_block_pole = 0.9999;
 static
 bool _invert = false;
 
+static
+double _gain = 1.0;
+
+/**
+ * Whether to decode a recording in parallel chunks, rather than a stream
+ */
+static
+bool _batch = false;
+
+/**
+ * In batch mode, the recording, mapped into memory, and the chunks it's split into
+ */
+static
+const int16_t *batch_samples = NULL;
+
+static
+struct decoder_batch_chunk *batch_chunks = NULL;
+
+static
+size_t nr_batch_chunks = 0;
+
+/**
+ * The next chunk to decode, and the number of chunks finished, in batch mode
+ */
+static
+atomic_size_t batch_next_chunk;
+
+static
+atomic_size_t batch_chunks_done;
+
+/**
+ * The counters of every chunk decoded so far, in batch mode
+ */
+static
+struct decoder_stats batch_stats;
+
+/**
+ * How often to write the channel counters to stderr, in seconds. 0 to only write them when
+ * asked to with SIGUSR1.
+ */
+static
+unsigned stats_interval_secs = 0;
+
+/**
+ * When the channel counters were last written out
+ */
+static
+uint64_t stats_last_ns = 0;
+
+/**
+ * The number of samples read before they're handed to the resampler, and the most the resampler
+ * produces at once
+ */
+static
+size_t read_batch_samples = DECODER_DEFAULT_BATCH_SAMPLES;
+
+/**
+ * If not 0, the longest samples wait for a batch to fill before it's resampled anyway, in
+ * nanoseconds. Each channel's batches then grow while reads find a backlog, and shrink when
+ * they have to be cut short.
+ */
+static
+uint64_t read_latency_ns = 0;
+
+/**
+ * Set by SIGUSR1, to ask for the channel counters to be written out
+ */
+static
+volatile sig_atomic_t stats_requested = 0;
+
+static
+atomic_bool batch_failed;
+
+/**
+ * The channel decoding a chunk on this thread, in batch mode. Chunk channels come and go while
+ * other workers are decoding, so they can't be looked up through the channel table.
+ */
+static __thread
+struct decoder_channel *_decoder_batch_channel = NULL;
+
 static
 void _usage(const char *appname)
 {
-    DEC_MSG(SEV_INFO, "USAGE", "%s -I [interpolate] -D [decimate] -F [filter file] -d [sample_debug_file] -S [input sample rate] -f [center freq] [-c] [-o output JSON file] [-b] [-i] [in_fifo]",
+    DEC_MSG(SEV_INFO, "USAGE", "%s -I [interpolate] -D [decimate] -F [filter file] -d [sample_debug_file] -S [input sample rate] -f [center freq] [-c] [-o output file] [-B] [-b] [-i] [-s] [in_fifo]",
+            appname);
+    DEC_MSG(SEV_INFO, "USAGE", "%s -I [interpolate] -D [decimate] -F [filter file] -S [input sample rate] -C [channel file] [-t workers] [-c] [-o output file] [-B] [-b]",
+            appname);
+    DEC_MSG(SEV_INFO, "USAGE", "%s -I [interpolate] -D [decimate] -F [filter file] -S [input sample rate] -f [center freq] -O [-t workers] [-c] [-o output file] [-B] [-b] [-i] [recording]",
             appname);
+    DEC_MSG(SEV_INFO, "USAGE", "        -R [ratio] Resample by an arbitrary ratio of  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  output to input rate, such as       ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  38400/25000, in place of -I, -D, -F ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -P [rate] The resampled rate, if decoding     ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  POCSAG at other than 38400 Hz.      ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  Down to 4800 Hz.                    ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -a [file] Only decode pages for the capcodes  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  listed in file, one per line        ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -x [file] Drop pages for the capcodes listed  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  in file                             ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -r [nr]   Reassemble up to nr fragmented FLEX ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  messages at once, per channel       ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -N        Write AIS packets as !AIVDM NMEA    ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  sentences, without decoding them    ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -A [list] Only handle the AIS message types   ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  in the comma separated list         ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -V [spec] Only report AIS vessels that move,  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  change speed, course or status, or  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  every so often. secs[,m[,kn[,deg]]] ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  with defaults of 60,10,0.5,5        ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -L [file] Trace reads and decoded messages,   ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  written to file as Chrome trace     ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  JSON on exit                        ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -n [nr]   Samples to read before resampling  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  them (default 1024)                 ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -l [ms]   Resample samples that have waited   ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  this long, adapting how much is     ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  read at once to the input rate      ");
     DEC_MSG(SEV_INFO, "USAGE", "        -b        Enable DC blocking filter          ");
-    DEC_MSG(SEV_INFO, "USAGE", "        -c        Create JSON output file            ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -c        Create output file                 ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -B        Write binary records, not JSON     ");
     DEC_MSG(SEV_INFO, "USAGE", "        -i        Invert input sample stream         ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -g [gain] Scale the resampled samples        ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -s        Input is a shared memory PCM ring  ");
+    DEC_MSG(SEV_INFO, "USAGE", "        An input of udp://host:port[/id] receives     ");
+    DEC_MSG(SEV_INFO, "USAGE", "        PCM datagrams from multifm, for channel id    ");
+    DEC_MSG(SEV_INFO, "USAGE", "        (default the center frequency, 0 for any).   ");
+    DEC_MSG(SEV_INFO, "USAGE", "        A multicast host joins the group.             ");
     DEC_MSG(SEV_INFO, "USAGE", "        -m [type] Specify protocol to decode         ");
     DEC_MSG(SEV_INFO, "USAGE", "           POCSAG - the POCSAG pager protocol        ");
     DEC_MSG(SEV_INFO, "USAGE", "           FLEX   - Motorola FLEX pager protocol     ");
     DEC_MSG(SEV_INFO, "USAGE", "           AIS    - Automatic Identification System  ");
+    DEC_MSG(SEV_INFO, "USAGE", "           Repeat, or separate with commas, to run   ");
+    DEC_MSG(SEV_INFO, "USAGE", "           several protocols on the same samples     ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -C [file] Decode every channel listed in file");
+    DEC_MSG(SEV_INFO, "USAGE", "                  AIS packets heard on more than one  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  channel are only reported once      ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -O        Decode a recording in parallel chunks");
+    DEC_MSG(SEV_INFO, "USAGE", "        -t [nr]   Worker threads for multi-channel or   ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  batch mode                          ");
+    DEC_MSG(SEV_INFO, "USAGE", "        -W [nr]   Threads to decode pager frames on,  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  off the sample threads (not with -O)");
+    DEC_MSG(SEV_INFO, "USAGE", "        -T [secs] Write channel stats to stderr this  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  often, and on exit. SIGUSR1 always  ");
+    DEC_MSG(SEV_INFO, "USAGE", "                  writes them.                        ");
     exit(EXIT_SUCCESS);
 }
 
-static const
-char phase_id[] = {
-    [0] = 'A',
-    [1] = 'B',
-    [2] = 'C',
-    [3] = 'D',
-};
-
+/**
+ * Find the channel a protocol decoder belongs to
+ */
 static
-FILE *out_file = NULL;
-
-static inline
-void _decoder_put_alnum_char(FILE *fp, char ch)
-{
-    switch (ch) {
-    case '\n':
-        fprintf(fp, "\\n");
-        break;
-    case '\r':
-        fprintf(fp, "\\n");
-        break;
-    case '\"':
-        fprintf(fp, "\\\"");
-        break;
-    case '\\':
-        fprintf(fp, "\\\\");
-        break;
-    case '/':
-        fprintf(fp, "\\/");
-        break;
-    case '\b':
-        fprintf(fp, "<BKSP>");
-        break;
-    case '\f':
-        fprintf(fp, "<FF>");
-        break;
-    case '\t':
-        fprintf(fp, "\\t");
-        break;
-    case 0x03:
-    case 0x04:
-    case 0x17:
-        fprintf(fp, " ");
-        break;
-    default:
-        if (isprint(ch)) {
-            fprintf(fp, "%c", ch);
-        } else {
-            fprintf(fp, "\\u%04x", (unsigned)ch);
+struct decoder_channel *_decoder_channel_of(const void *proto)
+{
+    if (NULL != _decoder_batch_channel) {
+        return _decoder_batch_channel;
+    }
+
+    for (size_t i = 0; i < nr_channels; i++) {
+        struct decoder_channel *ch = channels[i];
+
+        if ((const void *)ch->flex == proto || (const void *)ch->pocsag == proto ||
+                (const void *)ch->ais_decode == proto)
+        {
+            return ch;
         }
     }
+
+    PANIC("Protocol decoder %p does not belong to any channel", proto);
+}
+
+/**
+ * Start a message decoded by the given protocol state, filling in the details every message
+ * carries: when it was decoded, how long ago the samples behind it were captured, if the
+ * producer of the PCM ring stamps them, measured to the most recently read sample (i.e. the end
+ * of the message), and the channel frequency in multi-channel mode.
+ */
+static
+void _decoder_msg_init(const void *proto, enum decoder_msg_type type, struct decoder_msg *msg)
+{
+    struct decoder_channel *ch = _decoder_channel_of(proto);
+    uint64_t capture_ns = 0,
+             now_ns = sample_buf_now_ns();
+
+    memset(msg, 0, sizeof(*msg));
+
+    /* TODO: this sucks, should move it closer to the capture clock */
+    msg->type = type;
+    msg->timestamp = time(NULL);
+
+    if (NULL != channel_file) {
+        msg->freq_hz = ch->freq;
+    }
+
+    if (NULL == ch->in_ring || 0 == input_sample_rate ||
+            FAILED(pcm_ring_read_time(ch->in_ring, input_sample_rate, &capture_ns)))
+    {
+        return;
+    }
+
+    msg->has_latency = true;
+    msg->capture_latency_us = now_ns > capture_ns ? (now_ns - capture_ns) / 1000 : 0;
+}
+
+static
+struct decoder_output *decoder_out = NULL;
+
+static
+int out_fd = -1;
+
+/**
+ * Hand a message over to be written, or in batch mode to be held until the whole recording has
+ * been decoded, positioned at the last sample pushed into the resampler.
+ */
+static
+aresult_t _decoder_msg_put(const void *proto, const struct decoder_msg *msg)
+{
+    struct decoder_channel *ch = _decoder_channel_of(proto);
+    uint64_t now_ns = 0;
+
+    decoder_stats_add(&ch->stats.nr_msgs, 1);
+
+    if (true == msg->has_latency) {
+        decoder_stats_latency(ch->stats.capture_latency, msg->capture_latency_us);
+    }
+
+    if (NULL != ch->batch) {
+        return decoder_batch_chunk_add(ch->batch, msg, ch->batch->base + ch->sample_count);
+    }
+
+    now_ns = decoder_stats_now_ns();
+    decoder_stats_latency(ch->stats.decode_latency, (now_ns - ch->last_read_ns) / 1000);
+
+    /* Back to the capture of the samples, if we know it, so it lines up with the producer's trace */
+    sample_trace_record(SAMPLE_TRACE_MESSAGE, ch->nr_reads,
+            true == msg->has_latency ? now_ns - msg->capture_latency_us * 1000ull : ch->last_read_ns, now_ns);
+
+    return decoder_output_put(decoder_out, msg);
 }
 
 static
@@ -184,25 +679,21 @@ aresult_t _on_flex_alnum_msg(
         const char *message_bytes,
         size_t message_len)
 {
-    /* TODO: this sucks, should move it closer to the capture clock */
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
-
-    fprintf(out_file, "{\"proto\":\"flex\",\"type\":\"alphanumeric\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-            "\"baud\":%i,\"syncLevel\":%i,\"frameNo\":%u,\"cycleNo\":%u,\"phaseNo\":\"%c\",\"capCode\":%"PRIu64",\"fragment\":%s,"
-            "\"maildrop\":%s,\"fragSeq\":%u,\"message\":\"",
-            gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-            baud, 0, frame_no, cycle_no, phase_id[phase], cap_code,
-            fragmented ? "true" : "false", maildrop ? "true" : "false", seq_num);
-
-    for (size_t i = 0; i < message_len; i++) {
-        _decoder_put_alnum_char(out_file, message_bytes[i]);
-    }
-
-    fprintf(out_file, "\"}\n");
-    fflush(out_file);
-
-    return A_OK;
+    struct decoder_msg msg;
+
+    _decoder_msg_init(f, DECODER_MSG_FLEX_ALNUM, &msg);
+    msg.baud = baud;
+    msg.phase = phase;
+    msg.cycle_no = cycle_no;
+    msg.frame_no = frame_no;
+    msg.address = cap_code;
+    msg.fragmented = fragmented;
+    msg.maildrop = maildrop;
+    msg.seq_num = seq_num;
+    msg.body = message_bytes;
+    msg.body_len = message_len;
+
+    return _decoder_msg_put(f, &msg);
 }
 
 static
@@ -216,23 +707,18 @@ aresult_t _on_flex_num_msg(
         const char *message_bytes,
         size_t message_len)
 {
-    /* TODO: this sucks, should move it closer to the capture clock */
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
-
-    fprintf(out_file, "{\"proto\":\"flex\",\"type\":\"numeric\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-            "\"baud\":%i,\"syncLevel\":%i,\"frameNo\":%u,\"cycleNo\":%u,\"phaseNo\":\"%c\",\"capCode\":%"PRIu64",\"message\":\"",
-            gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-            baud, 0, frame_no, cycle_no, phase_id[phase], cap_code);
-
-    for (size_t i = 0; i < message_len; i++) {
-        _decoder_put_alnum_char(out_file, message_bytes[i]);
-    }
-
-    fprintf(out_file, "\"}\n");
-    fflush(out_file);
-
-    return A_OK;
+    struct decoder_msg msg;
+
+    _decoder_msg_init(f, DECODER_MSG_FLEX_NUM, &msg);
+    msg.baud = baud;
+    msg.phase = phase;
+    msg.cycle_no = cycle_no;
+    msg.frame_no = frame_no;
+    msg.address = cap_code;
+    msg.body = message_bytes;
+    msg.body_len = message_len;
+
+    return _decoder_msg_put(f, &msg);
 }
 
 static
@@ -246,19 +732,22 @@ aresult_t _on_flex_siv_msg(
         uint8_t siv_msg_type,
         uint32_t data)
 {
-    /* TODO: this sucks, should move it closer to the capture clock */
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
+    struct decoder_msg msg;
 
-    switch (siv_msg_type) {
-    case PAGER_FLEX_SIV_TEMP_ADDRESS_ACTIVATION:
-        fprintf(out_file, "{\"proto\":\"flex\",\"type\":\"tempAddrActivation\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-                "\"baud\":%i,\"syncLevel\":%i,\"frameNo\":%u,\"cycleNo\":%u,\"phaseNo\":\"%c\",\"capCode\":%"PRIu64",\"startFrameNo\":%u,\"tempAddressId\":%u}\n",
-                gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-                baud, 0, frame_no, cycle_no, phase_id[phase], cap_code, data & 0x7f, (data >> 7) & 0xf);
-        break;
+    /* Only temporary address activations are reported */
+    if (PAGER_FLEX_SIV_TEMP_ADDRESS_ACTIVATION != siv_msg_type) {
+        return A_OK;
     }
-    return A_OK;
+
+    _decoder_msg_init(f, DECODER_MSG_FLEX_TEMP_ADDR_ACTIVATION, &msg);
+    msg.baud = baud;
+    msg.phase = phase;
+    msg.cycle_no = cycle_no;
+    msg.frame_no = frame_no;
+    msg.address = cap_code;
+    msg.siv_data = data;
+
+    return _decoder_msg_put(f, &msg);
 }
 
 static
@@ -270,23 +759,16 @@ aresult_t _on_pocsag_alnum_msg(
         size_t data_len,
         uint8_t function)
 {
-    /* TODO: this sucks, should move it closer to the capture clock */
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
-
-    fprintf(out_file, "{\"proto\":\"pocsag\",\"type\":\"alphanumeric\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-            "\"baud\":%i,\"capCode\":%u,\"function\":%u,\"message\":\"",
-            gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-            baud_rate, capcode, (unsigned)function);
-
-    for (size_t i = 0; i < data_len; i++) {
-        _decoder_put_alnum_char(out_file, data[i]);
-    }
+    struct decoder_msg msg;
 
-    fprintf(out_file, "\"}\n");
-    fflush(out_file);
+    _decoder_msg_init(p, DECODER_MSG_POCSAG_ALNUM, &msg);
+    msg.baud = baud_rate;
+    msg.address = capcode;
+    msg.function = function;
+    msg.body = data;
+    msg.body_len = data_len;
 
-    return A_OK;
+    return _decoder_msg_put(p, &msg);
 }
 
 static
@@ -298,99 +780,181 @@ aresult_t _on_pocsag_num_msg(
         size_t data_len,
         uint8_t function)
 {
-    /* TODO: this sucks, should move it closer to the capture clock */
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
-
-    fprintf(out_file, "{\"proto\":\"pocsag\",\"type\":\"numeric\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-            "\"baud\":%i,\"capCode\":%u,\"function\":%u,\"message\":\"",
-            gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-            baud_rate, capcode, (unsigned)function);
+    struct decoder_msg msg;
 
-    for (size_t i = 0; i < data_len; i++) {
-        _decoder_put_alnum_char(out_file, data[i]);
-    }
-
-    fprintf(out_file, "\"}\n");
-    fflush(out_file);
+    _decoder_msg_init(p, DECODER_MSG_POCSAG_NUM, &msg);
+    msg.baud = baud_rate;
+    msg.address = capcode;
+    msg.function = function;
+    msg.body = data;
+    msg.body_len = data_len;
 
-    return A_OK;
+    return _decoder_msg_put(p, &msg);
 }
 
 static
 aresult_t _on_ais_position_report(struct ais_decode *decode, void *state, struct ais_position_report *pr, const char *raw_msg)
 {
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
+    struct decoder_msg msg;
 
-    fprintf(out_file,
-            "{\"proto\":\"ais\",\"type\":\"positionReport\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-            "\"mmsi\":%u,\"navStat\":%u,\"rateOfTurn\":%d,\"speedOverGround\":%f,\"positionAcc\":%u,"
-            "\"geoPosition\":{\"lon\":%f,\"lat\":%f},\"course\":%u,\"heading\":%u,\"seconds\":%u,\"rawAscii\":\"",
-            gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-            pr->mmsi, pr->nav_stat, pr->rate_of_turn, (double)pr->speed_over_ground, pr->position_acc,
-            (double)pr->longitude, (double)pr->latitude, pr->course, pr->heading, pr->timestamp);
+    _decoder_msg_init(decode, DECODER_MSG_AIS_POSITION_REPORT, &msg);
+    msg.address = pr->mmsi;
+    msg.ais = pr;
+    msg.body = raw_msg;
+    msg.body_len = strlen(raw_msg);
 
-    for (size_t i = 0; i < strlen(raw_msg); i++) {
-        _decoder_put_alnum_char(out_file, raw_msg[i]);
-    }
+    return _decoder_msg_put(decode, &msg);
+}
+
+static
+aresult_t _on_ais_base_station_report(struct ais_decode *decode, void *state, struct ais_base_station_report *br,
+        const char *raw_msg)
+{
+    struct decoder_msg msg;
 
-    fprintf(out_file, "\"}\n");
+    _decoder_msg_init(decode, DECODER_MSG_AIS_BASE_STATION_REPORT, &msg);
+    msg.address = br->mmsi;
+    msg.ais = br;
+    msg.body = raw_msg;
+    msg.body_len = strlen(raw_msg);
 
-    return A_OK;
+    return _decoder_msg_put(decode, &msg);
 }
 
 static
-aresult_t _on_ais_base_station_report(struct ais_decode *decode, void *state, struct ais_base_station_report *br,
+aresult_t _on_ais_static_voyage_data(struct ais_decode *decode, void *state, struct ais_static_voyage_data *svd,
         const char *raw_msg)
 {
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
+    struct decoder_msg msg;
 
-    fprintf(out_file,
-            "{\"proto\":\"ais\",\"type\":\"baseStationReport\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-            "\"mmsi\":%u,\"baseStationDate\":\"%04u-%02u-%02u %02u:%02u:%02u UTC\","
-            "\"geoPosition\":{\"lon\":%f,\"lat\":%f},\"fixType\":\"%s\",\"rawAscii\":\"",
-            gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-            br->mmsi, br->year, br->month, br->day, br->hour, br->minute, br->second,
-            (double)br->longitude, (double)br->latitude, br->epfd_name);
+    _decoder_msg_init(decode, DECODER_MSG_AIS_STATIC_VOYAGE_DATA, &msg);
+    msg.address = svd->mmsi;
+    msg.ais = svd;
+    msg.body = raw_msg;
+    msg.body_len = strlen(raw_msg);
 
-    for (size_t i = 0; i < strlen(raw_msg); i++) {
-        _decoder_put_alnum_char(out_file, raw_msg[i]);
-    }
+    return _decoder_msg_put(decode, &msg);
+}
+
+static
+aresult_t _on_ais_nmea(struct ais_decode *decode, void *state, uint32_t mmsi, const char *sentences, size_t len)
+{
+    struct decoder_msg msg;
 
-    fprintf(out_file, "\"}\n");
+    _decoder_msg_init(decode, DECODER_MSG_AIS_NMEA, &msg);
+    msg.address = mmsi;
+    msg.body = sentences;
+    msg.body_len = len;
 
-    return A_OK;
+    return _decoder_msg_put(decode, &msg);
 }
 
+/**
+ * Parse a comma separated list of AIS message types into a mask of AIS_DECODE_TYPE_BIT's
+ */
 static
-aresult_t _on_ais_static_voyage_data(struct ais_decode *decode, void *state, struct ais_static_voyage_data *svd,
-        const char *raw_msg)
+aresult_t _decoder_parse_ais_types(const char *list, uint64_t *ptypes)
+{
+    aresult_t ret = A_OK;
+
+    const char *type = list;
+
+    *ptypes = 0;
+
+    do {
+        char *end = NULL;
+        unsigned long msg_id = strtoul(type, &end, 10);
+
+        if (end == type || (',' != *end && '\0' != *end) || 0 == msg_id || 63 < msg_id) {
+            DEC_MSG(SEV_ERROR, "UNKNOWN-AIS-TYPE", "Bad AIS message type in list: %s", list);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        *ptypes |= AIS_DECODE_TYPE_BIT(msg_id);
+
+        type = end;
+    } while ('\0' != *type++);
+
+done:
+    return ret;
+}
+
+/**
+ * Parse the -V argument: the heartbeat interval in seconds, optionally followed by how far a
+ * vessel has to move in metres, how much its speed has to change in knots, and how much its
+ * course or heading has to change in degrees, separated by commas.
+ */
+static
+aresult_t _decoder_parse_vessel_params(const char *arg, struct ais_vessel_cache_params *params)
 {
-    time_t now = time(NULL);
-    struct tm *gmt = gmtime(&now);
+    aresult_t ret = A_OK;
+
+    const char *field = arg;
+    double values[4] = { 0.0, params->position_delta_m, params->speed_delta_kn, params->course_delta_deg };
+
+    for (size_t i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+        char *end = NULL;
+
+        values[i] = strtod(field, &end);
+        if (end == field || values[i] < 0.0 || (',' != *end && '\0' != *end)) {
+            DEC_MSG(SEV_ERROR, "BAD-VESSEL-FILTER", "Bad vessel filter '%s', need secs[,metres[,knots[,degrees]]]", arg);
+            ret = A_E_INVAL;
+            goto done;
+        }
 
-    /* TODO: Ensure we escape the callsign, ship name and destination */
+        if ('\0' == *end) {
+            break;
+        }
 
-    fprintf(out_file,
-            "{\"proto\":\"ais\",\"type\":\"staticAndVoyageData\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
-            "\"mmsi\":%u,\"version\":%u,\"imoNumber\":%u,\"callsign\":\"%s\",\"shipName\":\"%s\","
-            "\"shipType\":%u,\"dimensions\":{\"toBow\":%u,\"toStern\":%u,\"toPort\":%u,\"toStarboard\":%u},"
-            "\"fixType\":\"%s\",\"eta\":\"%02u-%02u %02u:%02u\",\"draught\":%f,\"destination\":\"%s\","
-            "\"rawAscii\":\"",
-            gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec,
-            svd->mmsi, svd->version, svd->imo_number, svd->callsign, svd->ship_name,
-            svd->ship_type, svd->dim_to_bow, svd->dim_to_stern, svd->dim_to_port, svd->dim_to_starboard,
-            svd->epfd_name, svd->eta_month, svd->eta_day, svd->eta_hour, svd->eta_minute, svd->draught, svd->destination);
+        field = end + 1;
+    }
 
-    for (size_t i = 0; i < strlen(raw_msg); i++) {
-        _decoder_put_alnum_char(out_file, raw_msg[i]);
+    if (0.0 == values[0]) {
+        DEC_MSG(SEV_ERROR, "BAD-VESSEL-FILTER", "The vessel heartbeat interval must be more than 0 seconds.");
+        ret = A_E_INVAL;
+        goto done;
     }
 
-    fprintf(out_file, "\"}\n");
+    params->heartbeat_ns = (uint64_t)(values[0] * 1e9);
+    params->position_delta_m = values[1];
+    params->speed_delta_kn = values[2];
+    params->course_delta_deg = values[3];
 
-    return A_OK;
+done:
+    return ret;
+}
+
+/**
+ * Look up a comma separated list of protocols by name, adding them to a mask of protocols
+ */
+static
+aresult_t _decoder_parse_types(const char *names, unsigned *ptypes)
+{
+    aresult_t ret = A_OK;
+
+    const char *name = names;
+
+    do {
+        size_t len = strcspn(name, ",");
+
+        if (len == 6 && !strncasecmp(name, "pocsag", 6)) {
+            *ptypes |= DECODER_TYPE_BIT(DECODER_PAGER_TYPE_POCSAG);
+        } else if (len == 4 && !strncasecmp(name, "flex", 4)) {
+            *ptypes |= DECODER_TYPE_BIT(DECODER_PAGER_TYPE_FLEX);
+        } else if (len == 3 && !strncasecmp(name, "ais", 3)) {
+            *ptypes |= DECODER_TYPE_BIT(DECODER_PROTO_TYPE_AIS);
+        } else {
+            DEC_MSG(SEV_ERROR, "UNKNOWN-PROTOCOL-TYPE", "Unknown protocol type specified: %.*s", (int)len, name);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        name += len;
+    } while ('\0' != *name++);
+
+done:
+    return ret;
 }
 
 static
@@ -402,8 +966,9 @@ void _set_options(int argc, char * const argv[])
     struct config *cfg CAL_CLEANUP(config_delete) = NULL;
     double *filter_coeffs_f = NULL;
     bool create_out = false;
+    enum decoder_output_format out_format = DECODER_OUTPUT_FORMAT_JSON;
 
-    while ((arg = getopt(argc, argv, "co:I:D:S:F:f:d:p:m:bih")) != -1) {
+    while ((arg = getopt(argc, argv, "co:I:D:R:S:P:F:f:d:p:g:m:C:t:T:W:a:x:r:A:V:L:n:l:NbBisOh")) != -1) {
         switch (arg) {
         case 'o':
             out_file_name = optarg;
@@ -411,6 +976,9 @@ void _set_options(int argc, char * const argv[])
         case 'c':
             create_out = true;
             break;
+        case 'B':
+            out_format = DECODER_OUTPUT_FORMAT_BINARY;
+            break;
         case 'f':
             center_freq = strtoll(optarg, NULL, 0);
             break;
@@ -420,9 +988,24 @@ void _set_options(int argc, char * const argv[])
         case 'D':
             decimate = strtoll(optarg, NULL, 0);
             break;
-        case 'S':
+        case 'R':
+            if (FAILED(polyphase_fir_parse_ratio(optarg, &resample_ratio))) {
+                DEC_MSG(SEV_FATAL, "BAD-RATIO", "Resampling ratio must be between %f and %f, got '%s'",
+                        POLYPHASE_FIR_FRAC_RATIO_MIN, POLYPHASE_FIR_FRAC_RATIO_MAX, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
             input_sample_rate = strtoll(optarg, NULL, 0);
             break;
+        case 'P':
+            pocsag_sample_rate = strtoul(optarg, NULL, 0);
+            if (pocsag_sample_rate < PAGER_POCSAG_SAMPLE_RATE_MIN || pocsag_sample_rate > PAGER_POCSAG_SAMPLE_RATE_MAX) {
+                DEC_MSG(SEV_FATAL, "BAD-POCSAG-RATE", "POCSAG sample rate must be between %u and %u Hz, got '%s'",
+                        PAGER_POCSAG_SAMPLE_RATE_MIN, PAGER_POCSAG_SAMPLE_RATE_MAX, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'F':
             filter_file = optarg;
             break;
@@ -441,14 +1024,7 @@ void _set_options(int argc, char * const argv[])
             break;
 
         case 'm':
-            if (!strncasecmp(optarg, "pocsag", 6)) {
-                _decoder_type = DECODER_PAGER_TYPE_POCSAG;
-            } else if (!strncasecmp(optarg, "flex", 4)) {
-                _decoder_type = DECODER_PAGER_TYPE_FLEX;
-            } else if (!strncasecmp(optarg, "ais", 3)) {
-                _decoder_type = DECODER_PROTO_TYPE_AIS;
-            } else {
-                DEC_MSG(SEV_ERROR, "UNKNOWN-PROTOCOL-TYPE", "Unknown protocol type specified: %s", optarg);
+            if (FAILED(_decoder_parse_types(optarg, &_decoder_types))) {
                 exit(EXIT_FAILURE);
             }
             break;
@@ -458,18 +1034,104 @@ void _set_options(int argc, char * const argv[])
             DEC_MSG(SEV_INFO, "DC-BLOCK-POLE", "Setting DC Blocker pole to %f", dc_block_pole);
             break;
 
+        case 'g':
+            _gain = strtod(optarg, NULL);
+            if (!(_gain > 0.0 && _gain < POST_FILTER_GAIN_MAX)) {
+                DEC_MSG(SEV_FATAL, "BAD-GAIN", "Gain must be greater than 0 and less than %f", POST_FILTER_GAIN_MAX);
+                exit(EXIT_FAILURE);
+            }
+            DEC_MSG(SEV_INFO, "GAIN", "Applying a gain of %f to the resampled samples", _gain);
+            break;
+
         case 'i':
             _invert = true;
             DEC_MSG(SEV_INFO, "INVERTING", "Inverting input sample stream, due to a non-phase correcting input source.");
             break;
 
+        case 'O':
+            _batch = true;
+            break;
+
+        case 's':
+            _in_shm = true;
+            DEC_MSG(SEV_INFO, "SHM-INPUT", "Reading input samples from a shared memory PCM ring.");
+            break;
+
+        case 'C':
+            channel_file = optarg;
+            break;
+
+        case 't':
+            nr_workers = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'T':
+            stats_interval_secs = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'W':
+            nr_decode_workers = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'a':
+        case 'x':
+            if (NULL != capcode_filter) {
+                DEC_MSG(SEV_FATAL, "BAD-CAPCODE-FILTER", "Only one of -a or -x can be given, once.");
+                exit(EXIT_FAILURE);
+            }
+            if (FAILED(pager_capcode_filter_load(&capcode_filter, optarg, 'x' == arg))) {
+                DEC_MSG(SEV_FATAL, "BAD-CAPCODE-FILE", "Capcode file '%s' cannot be read, aborting.", optarg);
+                exit(EXIT_FAILURE);
+            }
+            DEC_MSG(SEV_INFO, "CAPCODE-FILTER", "%s messages for the %zu capcodes in '%s'",
+                    'x' == arg ? "Dropping" : "Only decoding", capcode_filter->nr_capcodes, optarg);
+            break;
+
+        case 'r':
+            flex_reasm_messages = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'A':
+            if (FAILED(_decoder_parse_ais_types(optarg, &ais_types))) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'N':
+            ais_nmea = true;
+            break;
+
+        case 'V':
+            if (FAILED(_decoder_parse_vessel_params(optarg, &ais_vessel_params))) {
+                exit(EXIT_FAILURE);
+            }
+            ais_vessel_filter = true;
+            break;
+
+        case 'L':
+            trace_path = optarg;
+            TSL_BUG_IF_FAILED(sample_trace_enable("decoder", SAMPLE_TRACE_DEFAULT_EVENTS));
+            break;
+
+        case 'n':
+            read_batch_samples = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'l':
+            read_latency_ns = strtoull(optarg, NULL, 0) * 1000000ull;
+            break;
+
         case 'h':
             _usage(argv[0]);
             break;
         }
     }
 
-    if (optind > argc) {
+    if (0 == _decoder_types) {
+        _decoder_types = DECODER_TYPE_BIT(DECODER_PAGER_TYPE_FLEX);
+    }
+
+    if (NULL == channel_file && optind >= argc) {
         DEC_MSG(SEV_FATAL, "MISSING-SRC-DEST", "Missing source/destination file");
         exit(EXIT_FAILURE);
     }
@@ -479,24 +1141,41 @@ void _set_options(int argc, char * const argv[])
         exit(EXIT_FAILURE);
     }
 
-    if (0 == decimate) {
+    if (0 == interpolate) {
         DEC_MSG(SEV_FATAL, "BAD-INTERPOLATION", "Interpolation factor must be a non-zero integer.");
         exit(EXIT_FAILURE);
     }
 
-    if (0 == center_freq) {
+    if (DECODER_MIN_BATCH_SAMPLES > read_batch_samples || DECODER_MAX_BATCH_SAMPLES < read_batch_samples) {
+        DEC_MSG(SEV_FATAL, "BAD-BATCH-SIZE", "Batches must be between %d and %d samples.",
+                DECODER_MIN_BATCH_SAMPLES, DECODER_MAX_BATCH_SAMPLES);
+        exit(EXIT_FAILURE);
+    }
+
+    if (NULL == channel_file && 0 == center_freq) {
         DEC_MSG(SEV_FATAL, "BAD-PAGER-FREQ", "Pager frequency must be non-zero");
         exit(EXIT_FAILURE);
     }
 
-    if (NULL == filter_file) {
-        DEC_MSG(SEV_FATAL, "BAD-FILTER-FILE", "Need to specify a filter JSON file.");
+    if (NULL != channel_file && (true == _in_shm || -1 != sample_debug_fd)) {
+        DEC_MSG(SEV_FATAL, "BAD-MULTI-CHANNEL", "Shared memory input and sample debug files only work with a single channel.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (true == _batch && (NULL != channel_file || true == _in_shm || -1 != sample_debug_fd || 0 == input_sample_rate)) {
+        DEC_MSG(SEV_FATAL, "BAD-BATCH", "Batch mode decodes a single recording file, and needs its sample rate. "
+                "Channel files, shared memory input and sample debug files can't be used with it.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (NULL == filter_file && 0.0 == resample_ratio) {
+        DEC_MSG(SEV_FATAL, "BAD-FILTER-FILE", "Need to specify a filter JSON file, or a resampling ratio.");
         exit(EXIT_FAILURE);
     }
 
     if (NULL == out_file_name) {
         DEC_MSG(SEV_INFO, "WRITE-TO-STDOUT", "Output decoded data is going to stdout.");
-        out_file = stdout;
+        out_fd = STDOUT_FILENO;
     } else {
         if (create_out) {
             DEC_MSG(SEV_INFO, "CREATING-OUTPUT", "Creating output file '%s', will overwrite if it exists",
@@ -505,13 +1184,24 @@ void _set_options(int argc, char * const argv[])
             DEC_MSG(SEV_INFO, "OPENING-OUTPUT", "Opening output file '%s', will append to end if it exists",
                     out_file_name);
         }
-        if (NULL == (out_file = fopen(out_file_name, create_out ? "w+" : "a"))) {
+        if (0 > (out_fd = open(out_file_name, O_WRONLY | O_CREAT | (create_out ? O_TRUNC : O_APPEND), 0666))) {
             DEC_MSG(SEV_INFO, "BAD-OUTPUT-FILE", "Failed to open output file '%s', aborting.",
                     out_file_name);
             exit(EXIT_FAILURE);
         }
     }
 
+    if (FAILED(decoder_output_new(&decoder_out, out_fd, out_format))) {
+        DEC_MSG(SEV_FATAL, "BAD-OUTPUT", "Failed to set up message output, aborting.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (0.0 != resample_ratio) {
+        DEC_MSG(SEV_INFO, "CONFIG", "Resampling: fractional %f from %u to %f", resample_ratio, input_sample_rate,
+                resample_ratio * (double)input_sample_rate);
+        goto done;
+    }
+
     DEC_MSG(SEV_INFO, "CONFIG", "Resampling: %u/%u from %u to %f", interpolate, decimate, input_sample_rate,
             ((double)interpolate/(double)decimate)*(double)input_sample_rate);
     DEC_MSG(SEV_INFO, "CONFIG", "Loading filter coefficients from '%s'", filter_file);
@@ -532,200 +1222,1197 @@ void _set_options(int argc, char * const argv[])
         filter_coeffs[i] = (int16_t)(filter_coeffs_f[i] * q15);
     }
 
-    if (0 > (in_fifo = open(argv[optind], O_RDONLY))) {
-        DEC_MSG(SEV_INFO, "BAD-INPUT", "Bad input - cannot open %s", argv[optind]);
-        exit(EXIT_FAILURE);
+done:
+    if (NULL == channel_file) {
+        in_path = argv[optind];
     }
 }
 
+/**
+ * Prefix of an input that is received as PCM datagrams, rather than read from a FIFO or ring
+ */
+#define DECODER_UDP_PREFIX              "udp://"
+
+/**
+ * Start receiving PCM datagrams for a channel, from an input of udp://host:port[/id]
+ */
 static
-aresult_t _free_sample_buf(struct sample_buf *buf)
+aresult_t _decoder_channel_open_udp(struct decoder_channel *ch, const char *path, bool multi_channel)
 {
-    TSL_BUG_ON(NULL == buf);
-    TFREE(buf);
-    return A_OK;
-}
+    aresult_t ret = A_OK;
+
+    char addr[128];
+    char *id_sep = NULL,
+         *end = NULL;
+    unsigned long channel_id = ch->freq;
+
+    if (strlen(path) - strlen(DECODER_UDP_PREFIX) >= sizeof(addr)) {
+        DEC_MSG(SEV_FATAL, "BAD-INPUT", "UDP input address %s is too long", path);
+        ret = A_E_INVAL;
+        goto done;
+    }
 
-#define NR_SAMPLES                  1024
+    strcpy(addr, path + strlen(DECODER_UDP_PREFIX));
 
+    if (NULL != (id_sep = strrchr(addr, '/'))) {
+        *id_sep = '\0';
+        channel_id = strtoul(id_sep + 1, &end, 0);
+
+        if ('\0' == id_sep[1] || '\0' != *end || UINT32_MAX < channel_id) {
+            DEC_MSG(SEV_FATAL, "BAD-INPUT", "Bad channel ID in UDP input %s", path);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    if (FAILED(ret = pcm_udp_receiver_new(&ch->in_udp, addr, channel_id, PCM_UDP_FORMAT_S16))) {
+        DEC_MSG(SEV_FATAL, "BAD-INPUT", "Bad input - cannot receive PCM datagrams on %s", addr);
+        goto done;
+    }
+
+    ch->in_udp_timeout_ms = true == multi_channel ? 0 : 100;
+
+    DEC_MSG(SEV_INFO, "UDP-INPUT", "Receiving PCM datagrams on %s for channel ID %lu", addr, channel_id);
+
+done:
+    return ret;
+}
+
+/**
+ * Open the input for a channel. In multi-channel mode, FIFOs are opened non-blocking, so one
+ * channel whose producer hasn't started yet doesn't hold up the rest.
+ */
 static
-aresult_t _alloc_sample_buf(struct sample_buf **pbuf)
+aresult_t _decoder_channel_open(struct decoder_channel *ch, const char *path, bool shm, bool multi_channel)
 {
     aresult_t ret = A_OK;
 
-    struct sample_buf *buf = NULL;
+    if (!strncmp(path, DECODER_UDP_PREFIX, strlen(DECODER_UDP_PREFIX))) {
+        ret = _decoder_channel_open_udp(ch, path, multi_channel);
+        goto done;
+    }
 
-    TSL_ASSERT_ARG(NULL != pbuf);
+    if (true == shm) {
+        bool waiting = false;
+
+        /* multifm might not have created the ring yet */
+        while (A_E_BUSY == (ret = pcm_ring_attach(&ch->in_ring, path)) && app_running()) {
+            if (false == waiting) {
+                DEC_MSG(SEV_INFO, "WAITING-FOR-INPUT", "Waiting for shared memory ring %s to be created", path);
+                waiting = true;
+            }
+            sleep(1);
+        }
+
+        if (FAILED(ret)) {
+            DEC_MSG(SEV_INFO, "BAD-INPUT", "Bad input - cannot attach to shared memory ring %s", path);
+        }
 
-    if (FAILED(ret = TCALLOC((void **)&buf, NR_SAMPLES * sizeof(int16_t) + sizeof(struct sample_buf), 1ul))) {
         goto done;
     }
 
-    buf->refcount = 1;
-    buf->sample_type = COMPLEX_INT_16;
-    buf->sample_buf_bytes = NR_SAMPLES * sizeof(int16_t);
-    buf->nr_samples = 0;
-    buf->release = _free_sample_buf;
-    buf->priv = NULL;
+    if (0 > (ch->in_fifo = open(path, O_RDONLY | (true == multi_channel ? O_NONBLOCK : 0)))) {
+        DEC_MSG(SEV_INFO, "BAD-INPUT", "Bad input - cannot open %s", path);
+        ret = A_E_INVAL;
+        goto done;
+    }
 
-    *pbuf = buf;
+    /*
+     * With no writer, a FIFO reads as end of file (and is always ready to epoll). Holding a write
+     * end ourselves means we just wait for the producer to come back instead.
+     */
+    if (true == multi_channel && 0 > (ch->hold_fifo = open(path, O_WRONLY | O_NONBLOCK))) {
+        int errnum = errno;
+        DEC_MSG(SEV_ERROR, "BAD-INPUT", "Cannot hold %s open for writing: %s (%d)", path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
 
 done:
     return ret;
 }
 
 static
-int16_t output_buf[NR_SAMPLES];
-
-static
-aresult_t process_samples(void)
+void _decoder_channel_delete(struct decoder_channel **pch)
 {
-    int ret = A_OK;
+    struct decoder_channel *ch = *pch;
 
-    struct dc_blocker blck;
-    struct sample_buf *read_buf = NULL;
-    size_t sample_count = 0;
+    if (NULL != ch->flex) {
+        pager_flex_delete(&ch->flex);
+    }
 
-    TSL_BUG_IF_FAILED(dc_blocker_init(&blck, dc_block_pole));
+    if (NULL != ch->pocsag) {
+        pager_pocsag_delete(&ch->pocsag);
+    }
 
-    do {
-        int op_ret = 0;
-        size_t new_samples = 0;
-        bool full = false;
+    if (NULL != ch->ais_decode) {
+        ais_decode_delete(&ch->ais_decode);
+    }
+
+    if (NULL != ch->pfir) {
+        polyphase_fir_delete(&ch->pfir);
+    }
 
-        TSL_BUG_IF_FAILED(polyphase_fir_full(pfir, &full));
+    if (NULL != ch->read_buf) {
+        TSL_BUG_IF_FAILED(sample_buf_decref(ch->read_buf));
+        ch->read_buf = NULL;
+    }
 
-        if (false == full) {
-            size_t nr_sample_bytes = 0;
+    if (NULL != ch->in_ring) {
+        pcm_ring_delete(&ch->in_ring);
+    }
 
-            if (NULL == read_buf) {
-                /* Allocate a new buffer */
-                TSL_BUG_IF_FAILED(_alloc_sample_buf(&read_buf));
-            }
+    if (NULL != ch->in_udp) {
+        pcm_udp_receiver_delete(&ch->in_udp);
+    }
 
-            nr_sample_bytes = read_buf->nr_samples * sizeof(int16_t);
+    if (NULL != ch->output_buf) {
+        TFREE(ch->output_buf);
+    }
 
-            if (0 >= (op_ret = read(in_fifo, (uint8_t *)read_buf->data_buf + nr_sample_bytes, read_buf->sample_buf_bytes - nr_sample_bytes))) {
-                int errnum = errno;
-                ret = A_E_INVAL;
-                DEC_MSG(SEV_FATAL, "READ-FIFO-FAIL", "Failed to read from input fifo: %s (%d)",
-                        strerror(errnum), errnum);
-                goto done;
-            }
+    if (0 <= ch->in_fifo) {
+        close(ch->in_fifo);
+    }
 
-            TSL_BUG_ON((1 & op_ret) != 0);
+    if (0 <= ch->hold_fifo) {
+        close(ch->hold_fifo);
+    }
 
-            read_buf->nr_samples += op_ret/sizeof(int16_t);
-            sample_count += op_ret/sizeof(int16_t);
+    TFREE(ch);
+    *pch = NULL;
+}
 
-            if (true == _invert) {
-                int16_t *samp = (int16_t *)read_buf->data_buf;
-                for (size_t i = 0; i < read_buf->nr_samples; i++) {
-                    samp[i] *= -1;
-                }
-            }
+/**
+ * Set up a channel: its input, resampler, DC blocker and protocol decoder. A channel with no input
+ * path has samples pushed into its resampler directly, as in batch mode.
+ */
+static
+aresult_t _decoder_channel_new(struct decoder_channel **pch, const char *path, bool shm, bool multi_channel,
+        unsigned types, unsigned freq, bool invert)
+{
+    aresult_t ret = A_OK;
 
-            if (read_buf->nr_samples == NR_SAMPLES) {
-                TSL_BUG_IF_FAILED(polyphase_fir_push_sample_buf(pfir, read_buf));
-                read_buf = NULL;
-            }
-        }
+    struct decoder_channel *ch = NULL;
 
-        /* Filter the samples, decimating as appropriate */
-        TSL_BUG_IF_FAILED(polyphase_fir_process(pfir, output_buf, NR_SAMPLES, &new_samples));
+    TSL_ASSERT_ARG(NULL != pch);
+    TSL_ASSERT_ARG(0 != types);
 
-        if (0 == new_samples) {
-            /* Skip further sample processing */
-            continue;
-        }
+    *pch = NULL;
 
-        /* Apply DC blocker, if asked */
-        if (true == dc_blocker) {
-            TSL_BUG_IF_FAILED(dc_blocker_apply(&blck, output_buf, new_samples));
-        }
+    if (FAILED(ret = TZAALLOC(ch, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    ch->in_fifo = -1;
+    ch->hold_fifo = -1;
+    ch->types = types;
+    ch->freq = freq;
+    ch->batch_samples = read_batch_samples;
+
+    if (FAILED(ret = TACALLOC((void **)&ch->output_buf, read_batch_samples, sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (NULL != path && FAILED(ret = _decoder_channel_open(ch, path, shm, multi_channel))) {
+        goto done;
+    }
+
+    /* Create the resampling filter */
+    if (0.0 != resample_ratio) {
+        TSL_BUG_IF_FAILED(polyphase_fir_new_fractional(&ch->pfir, resample_ratio));
+    } else {
+        TSL_BUG_IF_FAILED(polyphase_fir_new(&ch->pfir, nr_filter_coeffs, filter_coeffs, interpolate, decimate));
+    }
+    TSL_BUG_IF_FAILED(post_filter_init(&ch->post, invert, _gain, dc_blocker, dc_block_pole));
+
+    /* Set up each of the protocol decoders asked for */
+    if (types & DECODER_TYPE_BIT(DECODER_PAGER_TYPE_FLEX)) {
+        DEC_MSG(SEV_INFO, "PROTOCOL", "Using the Motorola FLEX pager protocol on %u Hz.", freq);
+        TSL_BUG_IF_FAILED(pager_flex_new(&ch->flex, freq, _on_flex_alnum_msg, _on_flex_num_msg, _on_flex_siv_msg));
+        TSL_BUG_IF_FAILED(pager_flex_set_capcode_filter(ch->flex, capcode_filter));
+        TSL_BUG_IF_FAILED(pager_flex_set_reassembly(ch->flex, flex_reasm_messages,
+                    DECODER_FLEX_REASM_TIMEOUT_FRAMES));
+        TSL_BUG_IF_FAILED(pager_flex_set_decode_pool(ch->flex, decode_pool));
+    }
 
-        /* Process with the protocol object */
-        if (_decoder_type == DECODER_PAGER_TYPE_FLEX) {
-            TSL_BUG_IF_FAILED(pager_flex_on_pcm(flex, output_buf, new_samples));
-        } else if (_decoder_type == DECODER_PAGER_TYPE_POCSAG) {
-            TSL_BUG_IF_FAILED(pager_pocsag_on_pcm(pocsag, output_buf, new_samples));
-        } else if (_decoder_type == DECODER_PROTO_TYPE_AIS) {
-            TSL_BUG_IF_FAILED(ais_decode_on_pcm(ais_decode, output_buf, new_samples));
+    if (types & DECODER_TYPE_BIT(DECODER_PAGER_TYPE_POCSAG)) {
+        DEC_MSG(SEV_INFO, "PROTOCOL", "Using the POCSAG Pager Protocol on %u Hz.", freq);
+        if (0 != pocsag_sample_rate) {
+            DEC_MSG(SEV_INFO, "POCSAG-RATE", "Decoding POCSAG at %u Hz.", pocsag_sample_rate);
+            TSL_BUG_IF_FAILED(pager_pocsag_new_rate(&ch->pocsag, freq, pocsag_sample_rate, _on_pocsag_num_msg,
+                        _on_pocsag_alnum_msg, false));
         } else {
-            PANIC("Unknown decoder type, aborting");
+            TSL_BUG_IF_FAILED(pager_pocsag_new(&ch->pocsag, freq, _on_pocsag_num_msg, _on_pocsag_alnum_msg, false));
         }
+        TSL_BUG_IF_FAILED(pager_pocsag_set_capcode_filter(ch->pocsag, capcode_filter));
+        TSL_BUG_IF_FAILED(pager_pocsag_set_decode_pool(ch->pocsag, decode_pool));
+    }
 
-        /* If a sample debug file was specified, write to the sample debug file */
-        if (-1 != sample_debug_fd) {
-            if (0 > write(sample_debug_fd, output_buf, new_samples * sizeof(int16_t))) {
-                int errnum = errno;
-                DEC_MSG(SEV_FATAL, "WRITE-DEBUG-FAIL", "Failed to write to output debug file: %s (%d)",
-                        strerror(errnum), errnum);
-            }
+    if (types & DECODER_TYPE_BIT(DECODER_PROTO_TYPE_AIS)) {
+        DEC_MSG(SEV_INFO, "PROTOCOL", "Using the AIS Message Format on %u Hz.", freq);
+        if (true == ais_nmea) {
+            /* Nothing is decoded past the message type, the packet goes straight out */
+            TSL_BUG_IF_FAILED(ais_decode_new(&ch->ais_decode, freq, NULL, NULL, NULL));
+            TSL_BUG_IF_FAILED(ais_decode_set_nmea(ch->ais_decode, _on_ais_nmea));
+        } else {
+            TSL_BUG_IF_FAILED(ais_decode_new(&ch->ais_decode, freq, _on_ais_position_report, _on_ais_base_station_report, _on_ais_static_voyage_data));
         }
+        TSL_BUG_IF_FAILED(ais_decode_set_types(ch->ais_decode, ais_types));
+        TSL_BUG_IF_FAILED(ais_decode_set_dedup(ch->ais_decode, ais_dedup));
+        TSL_BUG_IF_FAILED(ais_decode_set_vessel_cache(ch->ais_decode, ais_vessels));
+    }
 
-        /* Release the sample buffer */
-    } while (app_running());
+    *pch = ch;
 
 done:
-    DEC_MSG(SEV_INFO, "TERMINATING", "Terminating processing loop, processed %zu samples", sample_count);
+    if (FAILED(ret)) {
+        if (NULL != ch) {
+            _decoder_channel_delete(&ch);
+        }
+    }
+
     return ret;
 }
 
-int main(int argc, char * const argv[])
+/**
+ * Read the channel list for multi-channel mode. Each entry names the input FIFO, the protocol,
+ * and the frequency of the channel, and can optionally ask for the input to be inverted:
+ *
+ *   { "channels": [ { "input": "/tmp/ch0", "protocol": "flex", "frequency": 929612500, "invert": false } ] }
+ *
+ * List both AIS channels, 161975000 and 162025000, to decode them together. A packet heard on
+ * both is only reported once.
+ */
+static
+aresult_t _decoder_channels_load(const char *file_name)
 {
-    int ret = EXIT_FAILURE;
+    aresult_t ret = A_OK;
 
-    TSL_BUG_IF_FAILED(app_init("resampler", NULL));
-    TSL_BUG_IF_FAILED(app_sigint_catch(NULL));
+    struct config *cfg CAL_CLEANUP(config_delete) = NULL;
+    struct config channel_list = CONFIG_INIT_EMPTY,
+                  channel = CONFIG_INIT_EMPTY;
+    size_t arr_ctr = 0;
 
-    _set_options(argc, argv);
+    TSL_BUG_IF_FAILED(config_new(&cfg));
 
-    /* Create the polyphase resampling filter */
-    TSL_BUG_IF_FAILED(polyphase_fir_new(&pfir, nr_filter_coeffs, filter_coeffs, interpolate, decimate));
+    if (FAILED(ret = config_add(cfg, file_name))) {
+        DEC_MSG(SEV_FATAL, "BAD-CONFIG", "Channel file '%s' cannot be processed, aborting.", file_name);
+        goto done;
+    }
 
-    /* Set up the appropriate protocol decoder */
-    if (_decoder_type == DECODER_PAGER_TYPE_FLEX) {
-        DEC_MSG(SEV_INFO, "PROTOCOL", "Using the Motorola FLEX pager protocol.");
-        TSL_BUG_IF_FAILED(pager_flex_new(&flex, center_freq, _on_flex_alnum_msg, _on_flex_num_msg, _on_flex_siv_msg));
-    } else if (_decoder_type == DECODER_PAGER_TYPE_POCSAG) {
-        DEC_MSG(SEV_INFO, "PROTOCOL", "Using the POCSAG Pager Protocol.");
-        TSL_BUG_IF_FAILED(pager_pocsag_new(&pocsag, center_freq, _on_pocsag_num_msg, _on_pocsag_alnum_msg, false));
-    } else if (_decoder_type == DECODER_PROTO_TYPE_AIS) {
-        DEC_MSG(SEV_INFO, "PROTOCOL", "Using the AIS Message Format.");
-        TSL_BUG_IF_FAILED(ais_decode_new(&ais_decode, center_freq, _on_ais_position_report, _on_ais_base_station_report, _on_ais_static_voyage_data));
+    if (FAILED(ret = config_get(cfg, &channel_list, "channels"))) {
+        DEC_MSG(SEV_FATAL, "MISSING-CHANNELS", "Need to specify at least one channel to decode.");
+        goto done;
     }
 
-    DEC_MSG(SEV_INFO, "STARTING", "Starting message decoder on frequency %u Hz.", center_freq);
+    CONFIG_ARRAY_FOR_EACH(channel, &channel_list, ret, arr_ctr) {
+        const char *input = NULL,
+                   *protocol = NULL;
+        int freq = 0;
+        bool invert = false;
+        unsigned types = 0;
+        struct decoder_channel **new_channels = NULL;
+
+        if (FAILED(ret = config_get_string(&channel, &input, "input")) ||
+                FAILED(ret = config_get_string(&channel, &protocol, "protocol")) ||
+                FAILED(ret = config_get_integer(&channel, &freq, "frequency")))
+        {
+            DEC_MSG(SEV_FATAL, "MALFORMED-CHANNEL", "Channel %zu needs an input, a protocol and a frequency.", arr_ctr);
+            goto done;
+        }
+
+        if (FAILED(config_get_boolean(&channel, &invert, "invert"))) {
+            invert = false;
+        }
+
+        if (FAILED(ret = _decoder_parse_types(protocol, &types))) {
+            goto done;
+        }
+
+        if (FAILED(ret = TCALLOC((void **)&new_channels, nr_channels + 1, sizeof(struct decoder_channel *)))) {
+            goto done;
+        }
+
+        if (NULL != channels) {
+            memcpy(new_channels, channels, nr_channels * sizeof(struct decoder_channel *));
+            TFREE(channels);
+        }
+
+        channels = new_channels;
+
+        if (FAILED(ret = _decoder_channel_new(&channels[nr_channels], input, false, true, types, freq, invert))) {
+            goto done;
+        }
+
+        nr_channels++;
+    }
 
-    if (FAILED(process_samples())) {
-        DEC_MSG(SEV_FATAL, "FIR-FAILED", "Failed during message processing, aborting.");
+    if (FAILED(ret)) {
+        DEC_MSG(SEV_FATAL, "CHANNEL-SETUP-FAILURE", "Error reading array of channels, aborting.");
         goto done;
     }
 
-    ret = EXIT_SUCCESS;
+    if (0 == nr_channels) {
+        DEC_MSG(SEV_FATAL, "MISSING-CHANNELS", "Need to specify at least one channel to decode.");
+        ret = A_E_INVAL;
+        goto done;
+    }
 
 done:
-    if (NULL != out_file && stdout != out_file) {
-        fclose(out_file);
-    }
+    return ret;
+}
 
-    if (NULL != flex) {
-        pager_flex_delete(&flex);
-    }
+/**
+ * Get the file descriptor to wait on for a channel's input
+ */
+static
+int _decoder_channel_fd(struct decoder_channel *ch)
+{
+    return NULL != ch->in_udp ? pcm_udp_receiver_fd(ch->in_udp) : ch->in_fifo;
+}
 
-    if (NULL != pocsag) {
-        pager_pocsag_delete(&pocsag);
+/**
+ * Read up to nr_bytes of samples from the channel's input FIFO, shared memory ring or UDP socket.
+ * Reading from a ring or socket can time out, and a non-blocking FIFO can run dry, returning 0
+ * bytes, so the caller gets a chance to check if we're shutting down.
+ */
+static
+aresult_t _read_samples(struct decoder_channel *ch, void *buf, size_t nr_bytes, size_t *pnr_read)
+{
+    aresult_t ret = A_OK;
+
+    ssize_t op_ret = 0;
+
+    *pnr_read = 0;
+
+    if (NULL != ch->in_ring) {
+        size_t nr_samples = 0;
+        TSL_BUG_IF_FAILED(pcm_ring_read(ch->in_ring, buf, nr_bytes / sizeof(int16_t), &nr_samples, 100));
+        *pnr_read = nr_samples * sizeof(int16_t);
+        goto done;
     }
 
-    if (NULL != ais_decode) {
-        ais_decode_delete(&ais_decode);
+    if (NULL != ch->in_udp) {
+        size_t nr_samples = 0;
+        uint64_t nr_lost = 0;
+
+        if (FAILED(ret = pcm_udp_receiver_read(ch->in_udp, buf, nr_bytes / sizeof(int16_t), &nr_samples,
+                        ch->in_udp_timeout_ms)))
+        {
+            DEC_MSG(SEV_FATAL, "READ-UDP-FAIL", "Failed to receive PCM datagrams for channel on %u Hz", ch->freq);
+            goto done;
+        }
+
+        if ((nr_lost = pcm_udp_receiver_nr_lost(ch->in_udp)) != ch->in_udp_nr_lost) {
+            if (0 == ch->in_udp_nr_lost) {
+                DEC_MSG(SEV_WARNING, "UDP-INPUT-LOST", "Channel on %u Hz is losing PCM datagrams; decoding "
+                        "will suffer.", ch->freq);
+            }
+            ch->in_udp_nr_lost = nr_lost;
+        }
+
+        *pnr_read = nr_samples * sizeof(int16_t);
+        goto done;
     }
 
-    if (NULL != pfir) {
-        polyphase_fir_delete(&pfir);
+    if (0 >= (op_ret = read(ch->in_fifo, buf, nr_bytes))) {
+        int errnum = errno;
+
+        /* Interrupted by SIGUSR1, asking for stats */
+        if (0 > op_ret && (EAGAIN == errnum || EWOULDBLOCK == errnum || EINTR == errnum)) {
+            goto done;
+        }
+
+        ret = A_E_INVAL;
+        DEC_MSG(SEV_FATAL, "READ-FIFO-FAIL", "Failed to read from input fifo: %s (%d)",
+                strerror(errnum), errnum);
+        goto done;
     }
 
+    *pnr_read = op_ret;
+
+done:
     return ret;
 }
 
+static
+aresult_t _free_sample_buf(struct sample_buf *buf)
+{
+    TSL_BUG_ON(NULL == buf);
+    TFREE(buf);
+    return A_OK;
+}
+
+static
+aresult_t _alloc_sample_buf(struct sample_buf **pbuf, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    TSL_ASSERT_ARG(NULL != pbuf);
+
+    if (FAILED(ret = TCALLOC((void **)&buf, nr_samples * sizeof(int16_t) + sizeof(struct sample_buf), 1ul))) {
+        goto done;
+    }
+
+    buf->refcount = 1;
+    buf->sample_type = COMPLEX_INT_16;
+    buf->sample_buf_bytes = nr_samples * sizeof(int16_t);
+    buf->nr_samples = 0;
+    buf->release = _free_sample_buf;
+    buf->priv = NULL;
+
+    *pbuf = buf;
+
+done:
+    return ret;
+}
+
+/**
+ * Mirror the protocol decoders' counters in the channel stats, where other threads can read them
+ */
+static
+void _decoder_channel_publish_stats(struct decoder_channel *ch)
+{
+    struct pager_stats pst;
+    struct ais_demod_stats ast;
+
+    if (NULL != ch->flex) {
+        TSL_BUG_IF_FAILED(pager_flex_get_stats(ch->flex, &pst));
+        decoder_stats_set_pager(&ch->stats.flex, &pst);
+    }
+
+    if (NULL != ch->pocsag) {
+        TSL_BUG_IF_FAILED(pager_pocsag_get_stats(ch->pocsag, &pst));
+        decoder_stats_set_pager(&ch->stats.pocsag, &pst);
+    }
+
+    if (NULL != ch->ais_decode) {
+        TSL_BUG_IF_FAILED(ais_decode_get_stats(ch->ais_decode, &ast));
+        decoder_stats_set_ais(&ch->stats.ais, &ast);
+    }
+}
+
+/**
+ * Resample and decode everything the resampler can produce for a channel.
+ */
+static
+aresult_t _decoder_channel_decode(struct decoder_channel *ch)
+{
+    struct decoder_stats *st = &ch->stats;
+
+    /* Filter the samples, decimating as appropriate, until the resampler needs more input */
+    do {
+        size_t new_samples = 0;
+        uint64_t start_ns = decoder_stats_now_ns();
+
+        TSL_BUG_IF_FAILED(polyphase_fir_process(ch->pfir, ch->output_buf, read_batch_samples, &new_samples));
+
+        if (0 == new_samples) {
+            break;
+        }
+
+        start_ns = decoder_stats_stage_end(st, DECODER_STATS_STAGE_RESAMPLE, start_ns);
+        decoder_stats_add(&st->nr_samples_resampled, new_samples);
+
+        /* Invert, scale and block DC, as asked. The resampler is linear, so inverting here is
+         * the same as inverting its input, but only touches each sample once. */
+        TSL_BUG_IF_FAILED(post_filter_apply(&ch->post, ch->output_buf, new_samples));
+        start_ns = decoder_stats_stage_end(st, DECODER_STATS_STAGE_POST_FILTER, start_ns);
+
+        /* Hand the same samples to every protocol object */
+        if (NULL != ch->flex) {
+            TSL_BUG_IF_FAILED(pager_flex_on_pcm(ch->flex, ch->output_buf, new_samples));
+            start_ns = decoder_stats_stage_end(st, DECODER_STATS_STAGE_FLEX, start_ns);
+        }
+
+        if (NULL != ch->pocsag) {
+            TSL_BUG_IF_FAILED(pager_pocsag_on_pcm(ch->pocsag, ch->output_buf, new_samples));
+            start_ns = decoder_stats_stage_end(st, DECODER_STATS_STAGE_POCSAG, start_ns);
+        }
+
+        if (NULL != ch->ais_decode) {
+            TSL_BUG_IF_FAILED(ais_decode_on_pcm(ch->ais_decode, ch->output_buf, new_samples));
+            decoder_stats_stage_end(st, DECODER_STATS_STAGE_AIS, start_ns);
+        }
+
+        /* If a sample debug file was specified, write to the sample debug file */
+        if (-1 != sample_debug_fd) {
+            if (0 > write(sample_debug_fd, ch->output_buf, new_samples * sizeof(int16_t))) {
+                int errnum = errno;
+                DEC_MSG(SEV_FATAL, "WRITE-DEBUG-FAIL", "Failed to write to output debug file: %s (%d)",
+                        strerror(errnum), errnum);
+            }
+        }
+    } while (true);
+
+    _decoder_channel_publish_stats(ch);
+
+    return A_OK;
+}
+
+/**
+ * Hand the samples read so far to the resampler. With a latency target, the next batch is bigger
+ * if the reads are finding a backlog, or smaller if this one had to be cut short.
+ */
+static
+void _decoder_channel_push_read_buf(struct decoder_channel *ch, bool backlog)
+{
+    struct sample_buf *read_buf = ch->read_buf;
+    bool cut_short = read_buf->nr_samples * sizeof(int16_t) < read_buf->sample_buf_bytes;
+
+    TSL_BUG_IF_FAILED(polyphase_fir_push_sample_buf(ch->pfir, read_buf));
+    ch->read_buf = NULL;
+
+    if (0 == read_latency_ns) {
+        return;
+    }
+
+    if (true == cut_short) {
+        ch->batch_samples = BL_MAX2(ch->batch_samples / 2, DECODER_MIN_BATCH_SAMPLES);
+    } else if (true == backlog) {
+        ch->batch_samples = BL_MIN2(ch->batch_samples * 2, DECODER_MAX_BATCH_SAMPLES);
+    }
+}
+
+/**
+ * Read a batch of samples for a channel, if the resampler has room, then resample and decode
+ * everything the resampler can produce.
+ *
+ * \param ch The channel
+ * \param pnr_read The number of bytes read, returned by reference. 0 if there was nothing to
+ *                 read (or no room to read into).
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+static
+aresult_t _decoder_channel_service(struct decoder_channel *ch, size_t *pnr_read)
+{
+    aresult_t ret = A_OK;
+
+    size_t op_ret = 0;
+    bool full = false;
+
+    *pnr_read = 0;
+
+    TSL_BUG_IF_FAILED(polyphase_fir_full(ch->pfir, &full));
+
+    if (false == full) {
+        struct sample_buf *read_buf = NULL;
+        size_t nr_sample_bytes = 0;
+        uint64_t start_ns = 0;
+
+        if (NULL == ch->read_buf) {
+            /* Allocate a new buffer */
+            TSL_BUG_IF_FAILED(_alloc_sample_buf(&ch->read_buf, ch->batch_samples));
+        }
+
+        read_buf = ch->read_buf;
+        nr_sample_bytes = read_buf->nr_samples * sizeof(int16_t);
+        start_ns = decoder_stats_now_ns();
+
+        if (FAILED(ret = _read_samples(ch, (uint8_t *)read_buf->data_buf + nr_sample_bytes,
+                        read_buf->sample_buf_bytes - nr_sample_bytes, &op_ret)))
+        {
+            goto done;
+        }
+
+        ch->last_read_ns = decoder_stats_stage_end(&ch->stats, DECODER_STATS_STAGE_READ, start_ns);
+
+        if (0 != op_ret) {
+            sample_trace_record(SAMPLE_TRACE_READ, ++ch->nr_reads, start_ns, ch->last_read_ns);
+
+            TSL_BUG_ON((1 & op_ret) != 0);
+
+            if (0 == read_buf->nr_samples) {
+                ch->read_buf_start_ns = ch->last_read_ns;
+            }
+
+            *pnr_read = op_ret;
+            read_buf->nr_samples += op_ret/sizeof(int16_t);
+            ch->sample_count += op_ret/sizeof(int16_t);
+            decoder_stats_add(&ch->stats.nr_samples_read, op_ret/sizeof(int16_t));
+        }
+
+        if (read_buf->nr_samples * sizeof(int16_t) == read_buf->sample_buf_bytes) {
+            /* Getting everything we asked for in one read means more is probably waiting */
+            _decoder_channel_push_read_buf(ch, read_buf->sample_buf_bytes - nr_sample_bytes == op_ret);
+        } else if (0 != read_latency_ns && 0 != read_buf->nr_samples &&
+                ch->last_read_ns - ch->read_buf_start_ns >= read_latency_ns)
+        {
+            /* These samples have waited long enough for the rest of the batch */
+            _decoder_channel_push_read_buf(ch, false);
+        }
+
+        if (0 == op_ret && NULL != ch->read_buf) {
+            /* Timed out waiting for samples, check if we're still running */
+            goto done;
+        }
+    }
+
+    ret = _decoder_channel_decode(ch);
+
+done:
+    return ret;
+}
+
+/**
+ * Write the counters for every channel to stderr, as a single line of JSON. In batch mode, the
+ * totals for the chunks decoded so far are written as a single channel.
+ */
+static
+void _decoder_stats_dump(void)
+{
+    fprintf(stderr, "{\"channels\":[");
+
+    if (true == _batch) {
+        decoder_stats_dump(stderr, center_freq, &batch_stats);
+    } else {
+        for (size_t i = 0; i < nr_channels; i++) {
+            if (0 != i) {
+                fprintf(stderr, ",");
+            }
+            decoder_stats_dump(stderr, channels[i]->freq, &channels[i]->stats);
+        }
+    }
+
+    fprintf(stderr, "]}\n");
+    fflush(stderr);
+}
+
+/**
+ * Write out the counters if SIGUSR1 asked for them, or if it's time to
+ */
+static
+void _decoder_stats_poll(void)
+{
+    uint64_t now_ns = 0;
+
+    if (0 == stats_requested && 0 == stats_interval_secs) {
+        return;
+    }
+
+    now_ns = decoder_stats_now_ns();
+
+    if (0 != stats_requested ||
+            now_ns - stats_last_ns >= stats_interval_secs * 1000000000ull)
+    {
+        stats_requested = 0;
+        stats_last_ns = now_ns;
+        _decoder_stats_dump();
+        cycle_counter_dump(stderr);
+    }
+}
+
+static
+void _decoder_on_sigusr1(int signum)
+{
+    stats_requested = 1;
+}
+
+static
+aresult_t process_samples(void)
+{
+    int ret = A_OK;
+
+    struct decoder_channel *ch = channels[0];
+
+    do {
+        size_t nr_read = 0;
+
+        if (FAILED(ret = _decoder_channel_service(ch, &nr_read))) {
+            goto done;
+        }
+
+        _decoder_stats_poll();
+    } while (app_running());
+
+done:
+    DEC_MSG(SEV_INFO, "TERMINATING", "Terminating processing loop, processed %zu samples", ch->sample_count);
+    return ret;
+}
+
+/**
+ * Wait for any channel to have samples, and service it. Every FIFO is registered one-shot, so a
+ * channel belongs to the worker that was woken for it until that worker re-arms it; its state is
+ * never touched by two workers at once.
+ */
+static
+aresult_t _decoder_worker(struct worker_thread *wthr)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_worker *wkr = BL_CONTAINER_OF(wthr, struct decoder_worker, wthr);
+
+    while (worker_thread_is_running(wthr)) {
+        struct epoll_event evt;
+        struct decoder_channel *ch = NULL;
+        int nr_events = 0;
+
+        if (0 > (nr_events = epoll_wait(channel_epoll_fd, &evt, 1, DECODER_IDLE_TIMEOUT_MS))) {
+            int errnum = errno;
+            if (EINTR != errnum) {
+                PANIC("Failed to wait for channel input. Reason: %s (%d)", strerror(errnum), errnum);
+            }
+            continue;
+        }
+
+        if (0 == nr_events) {
+            continue;
+        }
+
+        ch = evt.data.ptr;
+        wkr->nr_wakeups++;
+
+        /* Drain what's there, but don't let a busy channel starve the others */
+        for (size_t i = 0; i < DECODER_MAX_READS_PER_WAKEUP; i++) {
+            size_t nr_read = 0;
+
+            if (FAILED(ret = _decoder_channel_service(ch, &nr_read))) {
+                DEC_MSG(SEV_ERROR, "CHANNEL-FAILED", "Channel on %u Hz failed, no longer decoding it.", ch->freq);
+                atomic_fetch_sub(&nr_live_channels, 1);
+                ch = NULL;
+                break;
+            }
+
+            if (0 == nr_read) {
+                break;
+            }
+        }
+
+        if (NULL != ch) {
+            evt.events = EPOLLIN | EPOLLONESHOT;
+            evt.data.ptr = ch;
+            if (0 > epoll_ctl(channel_epoll_fd, EPOLL_CTL_MOD, _decoder_channel_fd(ch), &evt)) {
+                int errnum = errno;
+                PANIC("Failed to re-arm channel on %u Hz. Reason: %s (%d)", ch->freq, strerror(errnum), errnum);
+            }
+        }
+    }
+
+    DIAG("Decoder worker %zu: woken %zu times before termination.", wkr->id, wkr->nr_wakeups);
+
+    return A_OK;
+}
+
+/**
+ * Service every channel with a small pool of worker threads, until we're asked to exit or every
+ * channel has failed.
+ */
+static
+aresult_t process_channels(void)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_worker *workers = NULL;
+    size_t nr_started = 0;
+
+    if (0 == nr_workers) {
+        long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nr_workers = 0 < nr_cpus ? (size_t)nr_cpus : 1;
+    }
+
+    /* More workers than channels would just leave threads idle */
+    nr_workers = BL_MIN2(nr_workers, nr_channels);
+
+    if (0 > (channel_epoll_fd = epoll_create1(EPOLL_CLOEXEC))) {
+        int errnum = errno;
+        DEC_MSG(SEV_FATAL, "CANT-CREATE-EPOLL", "Failed to create epoll instance: %s (%d)", strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_channels; i++) {
+        struct epoll_event evt = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = channels[i] };
+
+        if (0 > epoll_ctl(channel_epoll_fd, EPOLL_CTL_ADD, _decoder_channel_fd(channels[i]), &evt)) {
+            int errnum = errno;
+            DEC_MSG(SEV_FATAL, "CANT-ADD-EPOLL", "Failed to watch channel input: %s (%d)", strerror(errnum), errnum);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    atomic_store(&nr_live_channels, nr_channels);
+
+    if (FAILED(ret = TACALLOC((void **)&workers, nr_workers, sizeof(struct decoder_worker), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    DEC_MSG(SEV_INFO, "STARTING", "Decoding %zu channels with %zu worker threads.", nr_channels, nr_workers);
+
+    for (size_t i = 0; i < nr_workers; i++) {
+        workers[i].id = i;
+
+        if (FAILED(ret = worker_thread_new(&workers[i].wthr, _decoder_worker, WORKER_THREAD_CPU_MASK_ANY))) {
+            DEC_MSG(SEV_FATAL, "THREAD-START-FAIL", "Failed to start decoder worker thread %zu, aborting.", i);
+            goto done;
+        }
+
+        workers[i].started = true;
+        nr_started++;
+    }
+
+    while (app_running() && 0 != atomic_load(&nr_live_channels)) {
+        sleep(1);
+        _decoder_stats_poll();
+    }
+
+    if (0 == atomic_load(&nr_live_channels)) {
+        DEC_MSG(SEV_ERROR, "NO-CHANNELS", "Every channel has failed, terminating.");
+        ret = A_E_INVAL;
+    }
+
+done:
+    if (NULL != workers) {
+        for (size_t i = 0; i < nr_started; i++) {
+            TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&workers[i].wthr));
+            TSL_BUG_IF_FAILED(worker_thread_delete(&workers[i].wthr));
+        }
+
+        TFREE(workers);
+    }
+
+    for (size_t i = 0; i < nr_channels; i++) {
+        DEC_MSG(SEV_INFO, "TERMINATING", "Channel on %u Hz processed %zu samples", channels[i]->freq,
+                channels[i]->sample_count);
+    }
+
+    if (0 <= channel_epoll_fd) {
+        close(channel_epoll_fd);
+        channel_epoll_fd = -1;
+    }
+
+    return ret;
+}
+
+/**
+ * Decode one chunk of a recording, on a channel of its own, collecting its messages in the chunk.
+ */
+static
+aresult_t _decoder_batch_decode_chunk(struct worker_thread *wthr, struct decoder_batch_chunk *chunk)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_channel *ch = NULL;
+    uint64_t pos = chunk->base;
+
+    if (FAILED(ret = _decoder_channel_new(&ch, NULL, false, false, _decoder_types, center_freq, _invert))) {
+        goto done;
+    }
+
+    ch->batch = chunk;
+    _decoder_batch_channel = ch;
+
+    while (pos < chunk->end && worker_thread_is_running(wthr)) {
+        struct sample_buf *buf = NULL;
+        size_t nr_samples = BL_MIN2(chunk->end - pos, (uint64_t)read_batch_samples);
+        bool full = false;
+
+        /* Everything pushed so far has been decoded, so there's always room */
+        TSL_BUG_IF_FAILED(polyphase_fir_full(ch->pfir, &full));
+        TSL_BUG_ON(true == full);
+
+        if (FAILED(ret = _alloc_sample_buf(&buf, read_batch_samples))) {
+            goto done;
+        }
+
+        memcpy(buf->data_buf, batch_samples + pos, nr_samples * sizeof(int16_t));
+        buf->nr_samples = nr_samples;
+        decoder_stats_add(&ch->stats.nr_samples_read, nr_samples);
+
+        TSL_BUG_IF_FAILED(polyphase_fir_push_sample_buf(ch->pfir, buf));
+
+        pos += nr_samples;
+        ch->sample_count += nr_samples;
+
+        if (FAILED(ret = _decoder_channel_decode(ch))) {
+            goto done;
+        }
+    }
+
+done:
+    _decoder_batch_channel = NULL;
+
+    if (NULL != ch) {
+        decoder_stats_accumulate(&batch_stats, &ch->stats);
+        _decoder_channel_delete(&ch);
+    }
+
+    return ret;
+}
+
+/**
+ * Take chunks of the recording off the list until there are none left.
+ */
+static
+aresult_t _decoder_batch_worker(struct worker_thread *wthr)
+{
+    struct decoder_worker *wkr = BL_CONTAINER_OF(wthr, struct decoder_worker, wthr);
+    size_t nr_chunks = 0;
+
+    while (worker_thread_is_running(wthr)) {
+        size_t chunk_id = atomic_fetch_add(&batch_next_chunk, 1);
+
+        if (chunk_id >= nr_batch_chunks) {
+            break;
+        }
+
+        if (FAILED(_decoder_batch_decode_chunk(wthr, &batch_chunks[chunk_id]))) {
+            DEC_MSG(SEV_ERROR, "CHUNK-FAILED", "Failed to decode chunk %zu of the recording.", chunk_id);
+            atomic_store(&batch_failed, true);
+        }
+
+        nr_chunks++;
+        atomic_fetch_add(&batch_chunks_done, 1);
+    }
+
+    DIAG("Batch worker %zu: decoded %zu chunks.", wkr->id, nr_chunks);
+
+    return A_OK;
+}
+
+/**
+ * Decode a whole recording, split into overlapping chunks decoded in parallel, then write out
+ * everything found in the order it was received. Messages are timestamped by their position in
+ * the recording, taking the file's modification time as the end of the capture.
+ */
+static
+aresult_t process_recording(void)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_worker *workers = NULL;
+    size_t nr_started = 0;
+    int fd = -1;
+    void *map = MAP_FAILED;
+    struct stat st;
+    uint64_t nr_samples = 0;
+    time_t start_time = 0;
+
+    if (NULL == in_path) {
+        DEC_MSG(SEV_FATAL, "NO-RECORDING", "Batch mode needs a recording to decode.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 > (fd = open(in_path, O_RDONLY)) || 0 > fstat(fd, &st)) {
+        int errnum = errno;
+        DEC_MSG(SEV_FATAL, "BAD-RECORDING", "Cannot open recording %s: %s (%d)", in_path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 == (nr_samples = (uint64_t)st.st_size / sizeof(int16_t))) {
+        DEC_MSG(SEV_FATAL, "EMPTY-RECORDING", "Recording %s holds no samples.", in_path);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (MAP_FAILED == (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+        int errnum = errno;
+        DEC_MSG(SEV_FATAL, "BAD-RECORDING", "Cannot map recording %s: %s (%d)", in_path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    batch_samples = map;
+    start_time = st.st_mtime - (time_t)(nr_samples / input_sample_rate);
+
+    if (FAILED(ret = decoder_batch_plan(&batch_chunks, &nr_batch_chunks, nr_samples,
+                    (uint64_t)DECODER_BATCH_CHUNK_SECS * input_sample_rate,
+                    (uint64_t)DECODER_BATCH_OVERLAP_SECS * input_sample_rate)))
+    {
+        goto done;
+    }
+
+    if (0 == nr_workers) {
+        long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nr_workers = 0 < nr_cpus ? (size_t)nr_cpus : 1;
+    }
+
+    nr_workers = BL_MIN2(nr_workers, nr_batch_chunks);
+
+    atomic_store(&batch_next_chunk, 0);
+    atomic_store(&batch_chunks_done, 0);
+    atomic_store(&batch_failed, false);
+
+    if (FAILED(ret = TACALLOC((void **)&workers, nr_workers, sizeof(struct decoder_worker), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    DEC_MSG(SEV_INFO, "STARTING", "Decoding %" PRIu64 " samples from %s in %zu chunks with %zu worker threads.",
+            nr_samples, in_path, nr_batch_chunks, nr_workers);
+
+    for (size_t i = 0; i < nr_workers; i++) {
+        workers[i].id = i;
+
+        if (FAILED(ret = worker_thread_new(&workers[i].wthr, _decoder_batch_worker, WORKER_THREAD_CPU_MASK_ANY))) {
+            DEC_MSG(SEV_FATAL, "THREAD-START-FAIL", "Failed to start decoder worker thread %zu, aborting.", i);
+            goto done;
+        }
+
+        workers[i].started = true;
+        nr_started++;
+    }
+
+    while (app_running() && atomic_load(&batch_chunks_done) < nr_batch_chunks) {
+        sleep(1);
+        _decoder_stats_poll();
+    }
+
+    if (atomic_load(&batch_chunks_done) < nr_batch_chunks) {
+        DEC_MSG(SEV_ERROR, "INTERRUPTED", "Interrupted before the whole recording was decoded, nothing written.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (true == atomic_load(&batch_failed)) {
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* Anything decoded twice either side of a boundary is completed at about the same sample */
+    ret = decoder_batch_merge(batch_chunks, nr_batch_chunks, input_sample_rate, input_sample_rate, start_time,
+            decoder_out);
+
+done:
+    if (NULL != workers) {
+        for (size_t i = 0; i < nr_started; i++) {
+            TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&workers[i].wthr));
+            TSL_BUG_IF_FAILED(worker_thread_delete(&workers[i].wthr));
+        }
+
+        TFREE(workers);
+    }
+
+    decoder_batch_chunks_delete(&batch_chunks, nr_batch_chunks);
+    nr_batch_chunks = 0;
+
+    if (MAP_FAILED != map) {
+        munmap(map, st.st_size);
+        batch_samples = NULL;
+    }
+
+    if (0 <= fd) {
+        close(fd);
+    }
+
+    return ret;
+}
+
+int main(int argc, char * const argv[])
+{
+    int ret = EXIT_FAILURE;
+    struct sigaction sa = { .sa_flags = 0 };
+
+    TSL_BUG_IF_FAILED(app_init("resampler", NULL));
+    TSL_BUG_IF_FAILED(app_sigint_catch(NULL));
+
+    _set_options(argc, argv);
+
+    /* No SA_RESTART, so a blocking read is interrupted and the stats are written right away */
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = _decoder_on_sigusr1;
+    sigaction(SIGUSR1, &sa, NULL);
+    stats_last_ns = decoder_stats_now_ns();
+
+    if (0 != nr_decode_workers) {
+        if (true == _batch) {
+            /* Chunks are already decoded in parallel, a whole chunk per worker */
+            DEC_MSG(SEV_WARNING, "DECODE-WORKERS", "Ignoring -W in batch mode, use -t for more workers.");
+        } else {
+            if (FAILED(pager_decode_pool_new(&decode_pool, nr_decode_workers, DECODER_DECODE_POOL_JOBS))) {
+                DEC_MSG(SEV_FATAL, "DECODE-WORKERS", "Failed to start %zu decode threads, aborting.", nr_decode_workers);
+                goto done;
+            }
+            DEC_MSG(SEV_INFO, "DECODE-WORKERS", "Decoding pager frames on %zu threads.", nr_decode_workers);
+        }
+    }
+
+    if (true == ais_vessel_filter) {
+        if (true == _batch) {
+            /* Chunks are decoded out of order, and far faster than real time */
+            DEC_MSG(SEV_WARNING, "VESSEL-FILTER", "Ignoring -V in batch mode.");
+        } else if (FAILED(ais_vessel_cache_new(&ais_vessels, DECODER_AIS_VESSELS, &ais_vessel_params))) {
+            DEC_MSG(SEV_FATAL, "VESSEL-FILTER", "Failed to create the AIS vessel table, aborting.");
+            goto done;
+        }
+    }
+
+    if (true == _batch) {
+        if (FAILED(process_recording())) {
+            DEC_MSG(SEV_FATAL, "BATCH-FAILED", "Failed to decode recording, aborting.");
+            goto done;
+        }
+    } else if (NULL != channel_file) {
+        /* Both AIS channels can be decoded by this one process, so only report each packet once */
+        if (FAILED(ais_dedup_new(&ais_dedup, DECODER_AIS_DEDUP_WINDOW_NS))) {
+            DEC_MSG(SEV_FATAL, "AIS-DEDUP", "Failed to create the AIS duplicate filter, aborting.");
+            goto done;
+        }
+
+        if (FAILED(_decoder_channels_load(channel_file))) {
+            goto done;
+        }
+
+        if (FAILED(process_channels())) {
+            DEC_MSG(SEV_FATAL, "FIR-FAILED", "Failed during message processing, aborting.");
+            goto done;
+        }
+    } else {
+        TSL_BUG_IF_FAILED(TCALLOC((void **)&channels, 1, sizeof(struct decoder_channel *)));
+
+        if (FAILED(_decoder_channel_new(&channels[0], in_path, _in_shm, false, _decoder_types, center_freq, _invert))) {
+            exit(EXIT_FAILURE);
+        }
+
+        nr_channels = 1;
+
+        DEC_MSG(SEV_INFO, "STARTING", "Starting message decoder on frequency %u Hz.", center_freq);
+
+        if (FAILED(process_samples())) {
+            DEC_MSG(SEV_FATAL, "FIR-FAILED", "Failed during message processing, aborting.");
+            goto done;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    if (0 != stats_interval_secs) {
+        _decoder_stats_dump();
+    }
+
+    for (size_t i = 0; i < nr_channels; i++) {
+        _decoder_channel_delete(&channels[i]);
+    }
+
+    if (NULL != channels) {
+        TFREE(channels);
+    }
+
+    /* Every channel has finished with the pool now */
+    pager_decode_pool_delete(&decode_pool);
+    ais_dedup_delete(&ais_dedup);
+    ais_vessel_cache_delete(&ais_vessels);
+
+    pager_capcode_filter_delete(&capcode_filter);
+
+    cycle_counter_dump(stderr);
+
+    if (NULL != trace_path && FAILED(sample_trace_dump(trace_path))) {
+        DEC_MSG(SEV_WARNING, "TRACE-FAILED", "Failed to write the sample trace to '%s'.", trace_path);
+    }
+
+    /* Everything decoded is written out before the output goes away */
+    decoder_output_delete(&decoder_out);
+
+    if (-1 != out_fd && STDOUT_FILENO != out_fd) {
+        close(out_fd);
+    }
+
+    return ret;
+}
@@ -0,0 +1,299 @@
+/*
+ *  decoder_batch.c - Split a recording into overlapping chunks, and merge what they decode
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <decoder/decoder_batch.h>
+
+#include <ais/ais_decode.h>
+
+#include <tsl/diag.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/safe_alloc.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A message held until every chunk is decoded
+ */
+struct decoder_batch_msg {
+    struct list_entry node;
+
+    /**
+     * The sample the message was completed at
+     */
+    uint64_t position;
+
+    /**
+     * The index of the chunk, and of the message within it, to break ties when sorting
+     */
+    size_t chunk_id;
+    size_t msg_id;
+
+    /**
+     * The message. ais and body are pointed back at the copies below when it is written.
+     */
+    struct decoder_msg msg;
+
+    union {
+        struct ais_position_report pr;
+        struct ais_base_station_report br;
+        struct ais_static_voyage_data svd;
+    } ais;
+
+    char body[];
+};
+
+aresult_t decoder_batch_plan(struct decoder_batch_chunk **pchunks, size_t *pnr_chunks, uint64_t nr_samples,
+        uint64_t chunk_samples, uint64_t overlap_samples)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_batch_chunk *chunks = NULL;
+    size_t nr_chunks = 0;
+
+    TSL_ASSERT_ARG(NULL != pchunks);
+    TSL_ASSERT_ARG(NULL != pnr_chunks);
+    TSL_ASSERT_ARG(0 != nr_samples);
+    TSL_ASSERT_ARG(0 != chunk_samples);
+
+    *pchunks = NULL;
+    *pnr_chunks = 0;
+
+    nr_chunks = (nr_samples + chunk_samples - 1) / chunk_samples;
+
+    if (FAILED(ret = TACALLOC((void **)&chunks, nr_chunks, sizeof(struct decoder_batch_chunk),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_chunks; i++) {
+        struct decoder_batch_chunk *chunk = &chunks[i];
+
+        chunk->start = i * chunk_samples;
+        chunk->base = chunk->start > overlap_samples ? chunk->start - overlap_samples : 0;
+        chunk->end = BL_MIN2(chunk->start + chunk_samples, nr_samples);
+        list_init(&chunk->msgs);
+    }
+
+    *pchunks = chunks;
+    *pnr_chunks = nr_chunks;
+
+done:
+    return ret;
+}
+
+aresult_t decoder_batch_chunk_add(struct decoder_batch_chunk *chunk, const struct decoder_msg *msg,
+        uint64_t position)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_batch_msg *bmsg = NULL;
+    size_t ais_len = 0;
+
+    TSL_ASSERT_ARG(NULL != chunk);
+    TSL_ASSERT_ARG(NULL != msg);
+
+    /* Completed in the overlap, so the chunk before got it already */
+    if (0 != chunk->start && position <= chunk->start) {
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&bmsg, sizeof(*bmsg) + msg->body_len, 1ul))) {
+        goto done;
+    }
+
+    bmsg->position = position;
+    bmsg->msg_id = chunk->nr_msgs;
+    bmsg->msg = *msg;
+
+    switch (msg->type) {
+    case DECODER_MSG_AIS_POSITION_REPORT:
+        ais_len = sizeof(bmsg->ais.pr);
+        break;
+    case DECODER_MSG_AIS_BASE_STATION_REPORT:
+        ais_len = sizeof(bmsg->ais.br);
+        break;
+    case DECODER_MSG_AIS_STATIC_VOYAGE_DATA:
+        ais_len = sizeof(bmsg->ais.svd);
+        break;
+    default:
+        break;
+    }
+
+    if (0 != ais_len) {
+        memcpy(&bmsg->ais, msg->ais, ais_len);
+    }
+
+    if (0 != msg->body_len) {
+        memcpy(bmsg->body, msg->body, msg->body_len);
+    }
+
+    list_append(&chunk->msgs, &bmsg->node);
+    chunk->nr_msgs++;
+
+done:
+    return ret;
+}
+
+static
+int _decoder_batch_msg_compare(const void *a, const void *b)
+{
+    const struct decoder_batch_msg *ma = *(const struct decoder_batch_msg * const *)a,
+                                   *mb = *(const struct decoder_batch_msg * const *)b;
+
+    if (ma->position != mb->position) {
+        return ma->position < mb->position ? -1 : 1;
+    }
+
+    if (ma->chunk_id != mb->chunk_id) {
+        return ma->chunk_id < mb->chunk_id ? -1 : 1;
+    }
+
+    return ma->msg_id < mb->msg_id ? -1 : (ma->msg_id > mb->msg_id);
+}
+
+/**
+ * Whether two messages carry the same thing. Their timestamps are ignored, since they aren't
+ * set yet.
+ */
+static
+bool _decoder_batch_msg_same(const struct decoder_batch_msg *a, const struct decoder_batch_msg *b)
+{
+    return a->msg.type == b->msg.type &&
+        a->msg.address == b->msg.address &&
+        a->msg.function == b->msg.function &&
+        a->msg.siv_data == b->msg.siv_data &&
+        a->msg.body_len == b->msg.body_len &&
+        0 == memcmp(a->body, b->body, a->msg.body_len);
+}
+
+aresult_t decoder_batch_merge(struct decoder_batch_chunk *chunks, size_t nr_chunks, uint64_t window,
+        unsigned sample_rate, time_t start_time, struct decoder_output *out)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_batch_msg **msgs = NULL;
+    size_t nr_msgs = 0,
+           nr_kept = 0,
+           nr_dups = 0;
+
+    TSL_ASSERT_ARG(NULL != chunks);
+    TSL_ASSERT_ARG(0 != sample_rate);
+    TSL_ASSERT_ARG(NULL != out);
+
+    for (size_t i = 0; i < nr_chunks; i++) {
+        nr_msgs += chunks[i].nr_msgs;
+    }
+
+    if (0 == nr_msgs) {
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&msgs, nr_msgs, sizeof(struct decoder_batch_msg *)))) {
+        goto done;
+    }
+
+    nr_msgs = 0;
+
+    for (size_t i = 0; i < nr_chunks; i++) {
+        struct decoder_batch_msg *bmsg = NULL;
+
+        list_for_each_type(bmsg, &chunks[i].msgs, node) {
+            bmsg->chunk_id = i;
+            msgs[nr_msgs++] = bmsg;
+        }
+    }
+
+    qsort(msgs, nr_msgs, sizeof(struct decoder_batch_msg *), _decoder_batch_msg_compare);
+
+    for (size_t i = 0; i < nr_msgs; i++) {
+        struct decoder_batch_msg *bmsg = msgs[i];
+        bool dup = false;
+
+        /* Look back over the messages already kept, near enough to be the same one */
+        for (size_t j = nr_kept; j > 0; j--) {
+            struct decoder_batch_msg *prior = msgs[j - 1];
+
+            if (bmsg->position - prior->position > window) {
+                break;
+            }
+
+            if (prior->chunk_id != bmsg->chunk_id && true == _decoder_batch_msg_same(prior, bmsg)) {
+                dup = true;
+                break;
+            }
+        }
+
+        if (true == dup) {
+            nr_dups++;
+            continue;
+        }
+
+        msgs[nr_kept++] = bmsg;
+    }
+
+    for (size_t i = 0; i < nr_kept; i++) {
+        struct decoder_batch_msg *bmsg = msgs[i];
+
+        bmsg->msg.timestamp = start_time + (time_t)(bmsg->position / sample_rate);
+        bmsg->msg.body = bmsg->body;
+        bmsg->msg.ais = &bmsg->ais;
+
+        if (FAILED(ret = decoder_output_put(out, &bmsg->msg))) {
+            goto done;
+        }
+    }
+
+    DIAG("Merged %zu messages from %zu chunks, dropping %zu duplicates", nr_kept, nr_chunks, nr_dups);
+
+done:
+    if (NULL != msgs) {
+        TFREE(msgs);
+    }
+
+    return ret;
+}
+
+void decoder_batch_chunks_delete(struct decoder_batch_chunk **pchunks, size_t nr_chunks)
+{
+    struct decoder_batch_chunk *chunks = NULL;
+
+    if (NULL == pchunks || NULL == *pchunks) {
+        return;
+    }
+
+    chunks = *pchunks;
+
+    for (size_t i = 0; i < nr_chunks; i++) {
+        struct decoder_batch_msg *bmsg = NULL,
+                                 *tmp = NULL;
+
+        list_for_each_type_safe(bmsg, tmp, &chunks[i].msgs, node) {
+            list_del(&bmsg->node);
+            TFREE(bmsg);
+        }
+    }
+
+    TFREE(chunks);
+    *pchunks = NULL;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <decoder/decoder_output.h>
+
+#include <tsl/list.h>
+#include <tsl/result.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * A slice of a recording, decoded on its own. Each chunk starts decoding a little before the
+ * part of the recording it is responsible for, so the protocol decoders have acquired sync by
+ * the time they get there and can decode messages that straddle the boundary with the chunk
+ * before it.
+ *
+ * Positions are in input samples from the start of the recording.
+ */
+struct decoder_batch_chunk {
+    /**
+     * The first sample decoded
+     */
+    uint64_t base;
+
+    /**
+     * The first sample this chunk is responsible for. Messages completed at or before this
+     * sample belong to the chunk before.
+     */
+    uint64_t start;
+
+    /**
+     * One past the last sample decoded
+     */
+    uint64_t end;
+
+    /**
+     * The messages this chunk is responsible for, in the order they were decoded
+     */
+    struct list_entry msgs;
+    size_t nr_msgs;
+};
+
+/**
+ * Split a recording into chunks.
+ *
+ * \param pchunks The chunks, returned by reference. Freed with decoder_batch_chunks_delete.
+ * \param pnr_chunks The number of chunks, returned by reference
+ * \param nr_samples The length of the recording
+ * \param chunk_samples The number of samples each chunk is responsible for
+ * \param overlap_samples How far ahead of its start each chunk begins decoding
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t decoder_batch_plan(struct decoder_batch_chunk **pchunks, size_t *pnr_chunks, uint64_t nr_samples,
+        uint64_t chunk_samples, uint64_t overlap_samples);
+
+/**
+ * Keep a copy of a message decoded in a chunk, if the chunk is responsible for it.
+ *
+ * \param chunk The chunk the message was decoded in
+ * \param msg The message
+ * \param position The sample the message was completed at
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t decoder_batch_chunk_add(struct decoder_batch_chunk *chunk, const struct decoder_msg *msg,
+        uint64_t position);
+
+/**
+ * Merge the messages from every chunk in the order they were completed, drop any message decoded
+ * twice either side of a chunk boundary, and write them out. Messages are timestamped by where
+ * they fall in the recording.
+ *
+ * \param chunks The chunks
+ * \param nr_chunks The number of chunks
+ * \param window Messages with the same contents completed within this many samples of each
+ *               other are the same message
+ * \param sample_rate The sample rate of the recording
+ * \param start_time When the recording started
+ * \param out Where to write the messages
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t decoder_batch_merge(struct decoder_batch_chunk *chunks, size_t nr_chunks, uint64_t window,
+        unsigned sample_rate, time_t start_time, struct decoder_output *out);
+
+/**
+ * Free a set of chunks, and any messages they still hold.
+ *
+ * \param pchunks The chunks, passed by reference. Set to NULL.
+ * \param nr_chunks The number of chunks
+ */
+void decoder_batch_chunks_delete(struct decoder_batch_chunk **pchunks, size_t nr_chunks);
@@ -0,0 +1,549 @@
+/*
+ *  decoder_output.c - Format decoded messages, and write them from a thread of their own
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <decoder/decoder_output.h>
+
+#include <ais/ais_decode.h>
+
+#include <tsl/diag.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/safe_alloc.h>
+
+#include <ctype.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define DEC_OUT_MSG(sev, sys, msg, ...) MESSAGE("DECODER", sev, sys, msg, ##__VA_ARGS__)
+
+/**
+ * Room kept at the end of a JSON record for everything after the message body
+ */
+#define DECODER_OUTPUT_TAIL_RESERVE     128
+
+/**
+ * How long the writer thread sleeps waiting for records before checking if it should exit,
+ * in milliseconds
+ */
+#define DECODER_OUTPUT_IDLE_MS          100
+
+static const
+char phase_id[] = {
+    [0] = 'A',
+    [1] = 'B',
+    [2] = 'C',
+    [3] = 'D',
+};
+
+/**
+ * A record being formatted
+ */
+struct decoder_output_fmt {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+static
+void _decoder_output_printf(struct decoder_output_fmt *fmt, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static
+void _decoder_output_printf(struct decoder_output_fmt *fmt, const char *format, ...)
+{
+    va_list ap;
+    int nr_bytes = 0;
+
+    va_start(ap, format);
+    nr_bytes = vsnprintf(fmt->buf + fmt->len, fmt->cap - fmt->len, format, ap);
+    va_end(ap);
+
+    if (0 > nr_bytes) {
+        return;
+    }
+
+    /* Anything that didn't fit is dropped; the tail reserve makes this vanishingly unlikely */
+    fmt->len += BL_MIN2((size_t)nr_bytes, fmt->cap - fmt->len - 1);
+}
+
+/**
+ * Escape a message body for a JSON string, in a single pass, stopping short of the tail reserve.
+ */
+static
+void _decoder_output_escape(struct decoder_output_fmt *fmt, const char *str, size_t len)
+{
+    const size_t limit = fmt->cap - DECODER_OUTPUT_TAIL_RESERVE;
+
+    for (size_t i = 0; i < len; i++) {
+        const char *esc = NULL;
+        char uesc[8];
+        size_t esc_len = 1;
+        char ch = str[i];
+
+        switch (ch) {
+        case '\n':
+        case '\r':
+            esc = "\\n";
+            break;
+        case '\"':
+            esc = "\\\"";
+            break;
+        case '\\':
+            esc = "\\\\";
+            break;
+        case '/':
+            esc = "\\/";
+            break;
+        case '\b':
+            esc = "<BKSP>";
+            break;
+        case '\f':
+            esc = "<FF>";
+            break;
+        case '\t':
+            esc = "\\t";
+            break;
+        case 0x03:
+        case 0x04:
+        case 0x17:
+            esc = " ";
+            break;
+        default:
+            if (!isprint(ch)) {
+                snprintf(uesc, sizeof(uesc), "\\u%04x", (unsigned)(uint8_t)ch);
+                esc = uesc;
+            }
+        }
+
+        if (NULL != esc) {
+            esc_len = strlen(esc);
+        }
+
+        if (fmt->len + esc_len > limit) {
+            break;
+        }
+
+        if (NULL == esc) {
+            fmt->buf[fmt->len++] = ch;
+        } else {
+            memcpy(fmt->buf + fmt->len, esc, esc_len);
+            fmt->len += esc_len;
+        }
+    }
+}
+
+static
+void _decoder_output_json(struct decoder_output_fmt *fmt, const struct decoder_msg *msg)
+{
+    struct tm gmt_tm,
+              *gmt = gmtime_r(&msg->timestamp, &gmt_tm);
+    const struct ais_position_report *pr = msg->ais;
+    const struct ais_base_station_report *br = msg->ais;
+    const struct ais_static_voyage_data *svd = msg->ais;
+
+    /* The sentences are their own format, and already end in a newline */
+    if (DECODER_MSG_AIS_NMEA == msg->type) {
+        size_t len = BL_MIN2(msg->body_len, fmt->cap);
+
+        memcpy(fmt->buf, msg->body, len);
+        fmt->len = len;
+        return;
+    }
+
+#define TS_ARGS gmt->tm_year + 1900, gmt->tm_mon + 1, gmt->tm_mday, gmt->tm_hour, gmt->tm_min, gmt->tm_sec
+
+    switch (msg->type) {
+    case DECODER_MSG_FLEX_ALNUM:
+        _decoder_output_printf(fmt, "{\"proto\":\"flex\",\"type\":\"alphanumeric\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
+                "\"baud\":%i,\"syncLevel\":%i,\"frameNo\":%u,\"cycleNo\":%u,\"phaseNo\":\"%c\",\"capCode\":%"PRIu64",\"fragment\":%s,"
+                "\"maildrop\":%s,\"fragSeq\":%u,\"message\":\"",
+                TS_ARGS, msg->baud, 0, msg->frame_no, msg->cycle_no, phase_id[msg->phase & 3], msg->address,
+                msg->fragmented ? "true" : "false", msg->maildrop ? "true" : "false", msg->seq_num);
+        break;
+    case DECODER_MSG_FLEX_NUM:
+        _decoder_output_printf(fmt, "{\"proto\":\"flex\",\"type\":\"numeric\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
+                "\"baud\":%i,\"syncLevel\":%i,\"frameNo\":%u,\"cycleNo\":%u,\"phaseNo\":\"%c\",\"capCode\":%"PRIu64",\"message\":\"",
+                TS_ARGS, msg->baud, 0, msg->frame_no, msg->cycle_no, phase_id[msg->phase & 3], msg->address);
+        break;
+    case DECODER_MSG_FLEX_TEMP_ADDR_ACTIVATION:
+        _decoder_output_printf(fmt, "{\"proto\":\"flex\",\"type\":\"tempAddrActivation\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
+                "\"baud\":%i,\"syncLevel\":%i,\"frameNo\":%u,\"cycleNo\":%u,\"phaseNo\":\"%c\",\"capCode\":%"PRIu64",\"startFrameNo\":%u,\"tempAddressId\":%u",
+                TS_ARGS, msg->baud, 0, msg->frame_no, msg->cycle_no, phase_id[msg->phase & 3], msg->address,
+                msg->siv_data & 0x7f, (msg->siv_data >> 7) & 0xf);
+        break;
+    case DECODER_MSG_POCSAG_ALNUM:
+    case DECODER_MSG_POCSAG_NUM:
+        _decoder_output_printf(fmt, "{\"proto\":\"pocsag\",\"type\":\"%s\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
+                "\"baud\":%i,\"capCode\":%u,\"function\":%u,\"message\":\"",
+                DECODER_MSG_POCSAG_ALNUM == msg->type ? "alphanumeric" : "numeric",
+                TS_ARGS, msg->baud, (unsigned)msg->address, (unsigned)msg->function);
+        break;
+    case DECODER_MSG_AIS_POSITION_REPORT:
+        _decoder_output_printf(fmt,
+                "{\"proto\":\"ais\",\"type\":\"positionReport\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
+                "\"mmsi\":%u,\"navStat\":%u,\"rateOfTurn\":%d,\"speedOverGround\":%f,\"positionAcc\":%u,"
+                "\"geoPosition\":{\"lon\":%f,\"lat\":%f},\"course\":%u,\"heading\":%u,\"seconds\":%u,\"rawAscii\":\"",
+                TS_ARGS, pr->mmsi, pr->nav_stat, pr->rate_of_turn, (double)pr->speed_over_ground, pr->position_acc,
+                (double)pr->longitude, (double)pr->latitude, pr->course, pr->heading, pr->timestamp);
+        break;
+    case DECODER_MSG_AIS_BASE_STATION_REPORT:
+        _decoder_output_printf(fmt,
+                "{\"proto\":\"ais\",\"type\":\"baseStationReport\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
+                "\"mmsi\":%u,\"baseStationDate\":\"%04u-%02u-%02u %02u:%02u:%02u UTC\","
+                "\"geoPosition\":{\"lon\":%f,\"lat\":%f},\"fixType\":\"%s\",\"rawAscii\":\"",
+                TS_ARGS, br->mmsi, br->year, br->month, br->day, br->hour, br->minute, br->second,
+                (double)br->longitude, (double)br->latitude, br->epfd_name);
+        break;
+    case DECODER_MSG_AIS_STATIC_VOYAGE_DATA:
+        /* TODO: Ensure we escape the callsign, ship name and destination */
+        _decoder_output_printf(fmt,
+                "{\"proto\":\"ais\",\"type\":\"staticAndVoyageData\",\"timestamp\":\"%04i-%02i-%02i %02i:%02i:%02i UTC\","
+                "\"mmsi\":%u,\"version\":%u,\"imoNumber\":%u,\"callsign\":\"%s\",\"shipName\":\"%s\","
+                "\"shipType\":%u,\"dimensions\":{\"toBow\":%u,\"toStern\":%u,\"toPort\":%u,\"toStarboard\":%u},"
+                "\"fixType\":\"%s\",\"eta\":\"%02u-%02u %02u:%02u\",\"draught\":%f,\"destination\":\"%s\","
+                "\"rawAscii\":\"",
+                TS_ARGS, svd->mmsi, svd->version, svd->imo_number, svd->callsign, svd->ship_name,
+                svd->ship_type, svd->dim_to_bow, svd->dim_to_stern, svd->dim_to_port, svd->dim_to_starboard,
+                svd->epfd_name, svd->eta_month, svd->eta_day, svd->eta_hour, svd->eta_minute, svd->draught,
+                svd->destination);
+        break;
+    case DECODER_MSG_AIS_NMEA:
+        /* Written out as is, above */
+        break;
+    }
+
+#undef TS_ARGS
+
+    /* Everything but a temporary address activation carries a body */
+    if (DECODER_MSG_FLEX_TEMP_ADDR_ACTIVATION != msg->type) {
+        _decoder_output_escape(fmt, msg->body, msg->body_len);
+        _decoder_output_printf(fmt, "\"");
+    }
+
+    if (0 != msg->freq_hz) {
+        _decoder_output_printf(fmt, ",\"frequency\":%u", msg->freq_hz);
+    }
+
+    if (true == msg->has_latency) {
+        _decoder_output_printf(fmt, ",\"captureLatencyUs\":%" PRIu64, msg->capture_latency_us);
+    }
+
+    _decoder_output_printf(fmt, "}\n");
+}
+
+static
+void _decoder_output_binary(struct decoder_output_fmt *fmt, const struct decoder_msg *msg)
+{
+    struct decoder_output_bin_record *rec = (struct decoder_output_bin_record *)fmt->buf;
+    size_t body_len = BL_MIN2(msg->body_len, fmt->cap - sizeof(*rec));
+    uint8_t flags = 0;
+
+    if (true == msg->fragmented) {
+        flags |= DECODER_OUTPUT_BIN_FLAG_FRAGMENTED;
+    }
+
+    if (true == msg->maildrop) {
+        flags |= DECODER_OUTPUT_BIN_FLAG_MAILDROP;
+    }
+
+    if (body_len != msg->body_len) {
+        flags |= DECODER_OUTPUT_BIN_FLAG_TRUNCATED;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->len = htole16((uint16_t)(sizeof(*rec) + body_len));
+    rec->type = (uint8_t)msg->type;
+    rec->flags = flags;
+    rec->freq_hz = htole32(msg->freq_hz);
+    rec->timestamp = (int64_t)htole64((uint64_t)msg->timestamp);
+    rec->address = htole64(msg->address);
+    rec->capture_latency_us = htole32(true == msg->has_latency ?
+            (uint32_t)BL_MIN2(msg->capture_latency_us, (uint64_t)UINT32_MAX - 1) : UINT32_MAX);
+    rec->siv_data = htole32(msg->siv_data);
+    rec->baud = htole16(msg->baud);
+    rec->phase = msg->phase;
+    rec->cycle_no = msg->cycle_no;
+    rec->frame_no = msg->frame_no;
+    rec->function = msg->function;
+    rec->seq_num = msg->seq_num;
+    rec->body_len = htole16((uint16_t)body_len);
+
+    if (0 != body_len) {
+        memcpy(rec->body, msg->body, body_len);
+    }
+
+    fmt->len = sizeof(*rec) + body_len;
+}
+
+aresult_t decoder_output_put(struct decoder_output *out, const struct decoder_msg *msg)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_output_record *rec = NULL;
+    struct decoder_output_fmt fmt;
+    uint32_t slot = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != msg);
+
+    pthread_mutex_lock(&out->lock);
+
+    /* The writer has fallen a long way behind, so wait for it to catch up */
+    while (0 == out->nr_free) {
+        pthread_cond_wait(&out->space, &out->lock);
+    }
+
+    slot = out->free_slots[--out->nr_free];
+
+    pthread_mutex_unlock(&out->lock);
+
+    /* Format the record outside the lock, straight into its slot */
+    rec = &out->records[slot];
+    fmt.buf = (char *)rec->data;
+    fmt.len = 0;
+    fmt.cap = sizeof(rec->data);
+
+    if (DECODER_OUTPUT_FORMAT_BINARY == out->format) {
+        _decoder_output_binary(&fmt, msg);
+    } else {
+        _decoder_output_json(&fmt, msg);
+    }
+
+    rec->len = fmt.len;
+
+    pthread_mutex_lock(&out->lock);
+    out->pending[(out->pending_head + out->nr_pending) % DECODER_OUTPUT_NR_RECORDS] = slot;
+    out->nr_pending++;
+    pthread_cond_signal(&out->wake);
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
+}
+
+/**
+ * Write out a whole I/O vector, picking up after short writes.
+ */
+static
+aresult_t _decoder_output_writev(struct decoder_output *out, struct iovec *iov, int nr_iov)
+{
+    aresult_t ret = A_OK;
+
+    while (0 < nr_iov) {
+        ssize_t written = writev(out->fd, iov, nr_iov);
+
+        if (0 > written) {
+            int errnum = errno;
+
+            if (EINTR == errnum) {
+                continue;
+            }
+
+            if (false == out->write_failed) {
+                DEC_OUT_MSG(SEV_ERROR, "OUTPUT-WRITE-FAILED", "Failed to write decoded messages: %s (%d), "
+                        "dropping messages from now on", strerror(errnum), errnum);
+                out->write_failed = true;
+            }
+
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        while (0 < nr_iov && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            nr_iov--;
+        }
+
+        if (0 < nr_iov) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Write out up to a batch of pending records, waiting a little while for some if asked to.
+ *
+ * \return The number of records written
+ */
+static
+size_t _decoder_output_drain(struct decoder_output *out, bool wait)
+{
+    struct iovec iov[DECODER_OUTPUT_BATCH];
+    uint32_t slots[DECODER_OUTPUT_BATCH];
+    size_t nr_slots = 0;
+
+    pthread_mutex_lock(&out->lock);
+
+    if (0 == out->nr_pending && true == wait) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += DECODER_OUTPUT_IDLE_MS * 1000000l;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+        deadline.tv_nsec %= 1000000000l;
+
+        pthread_cond_timedwait(&out->wake, &out->lock, &deadline);
+    }
+
+    while (0 != out->nr_pending && nr_slots < DECODER_OUTPUT_BATCH) {
+        slots[nr_slots++] = out->pending[out->pending_head];
+        out->pending_head = (out->pending_head + 1) % DECODER_OUTPUT_NR_RECORDS;
+        out->nr_pending--;
+    }
+
+    pthread_mutex_unlock(&out->lock);
+
+    if (0 == nr_slots) {
+        goto done;
+    }
+
+    if (false == out->write_failed) {
+        for (size_t i = 0; i < nr_slots; i++) {
+            iov[i].iov_base = out->records[slots[i]].data;
+            iov[i].iov_len = out->records[slots[i]].len;
+        }
+
+        _decoder_output_writev(out, iov, nr_slots);
+    }
+
+    pthread_mutex_lock(&out->lock);
+
+    for (size_t i = 0; i < nr_slots; i++) {
+        out->free_slots[out->nr_free++] = slots[i];
+    }
+
+    pthread_cond_broadcast(&out->space);
+    pthread_mutex_unlock(&out->lock);
+
+done:
+    return nr_slots;
+}
+
+static
+aresult_t _decoder_output_thread(struct worker_thread *wthr)
+{
+    struct decoder_output *out = BL_CONTAINER_OF(wthr, struct decoder_output, wthr);
+
+    while (worker_thread_is_running(wthr)) {
+        _decoder_output_drain(out, true);
+    }
+
+    return A_OK;
+}
+
+aresult_t decoder_output_new(struct decoder_output **pout, int fd, enum decoder_output_format format)
+{
+    aresult_t ret = A_OK;
+
+    struct decoder_output *out = NULL;
+
+    TSL_ASSERT_ARG(NULL != pout);
+    TSL_ASSERT_ARG(0 <= fd);
+
+    *pout = NULL;
+
+    if (FAILED(ret = TZAALLOC(out, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    out->fd = fd;
+    out->format = format;
+
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->wake, NULL);
+    pthread_cond_init(&out->space, NULL);
+
+    if (FAILED(ret = TACALLOC((void **)&out->records, DECODER_OUTPUT_NR_RECORDS, sizeof(struct decoder_output_record),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < DECODER_OUTPUT_NR_RECORDS; i++) {
+        out->free_slots[i] = DECODER_OUTPUT_NR_RECORDS - 1 - i;
+    }
+
+    out->nr_free = DECODER_OUTPUT_NR_RECORDS;
+
+    if (FAILED(ret = worker_thread_new(&out->wthr, _decoder_output_thread, WORKER_THREAD_CPU_MASK_ANY))) {
+        DEC_OUT_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start output writer thread.");
+        goto done;
+    }
+
+    out->started = true;
+
+    *pout = out;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != out) {
+            decoder_output_delete(&out);
+        }
+    }
+
+    return ret;
+}
+
+void decoder_output_delete(struct decoder_output **pout)
+{
+    struct decoder_output *out = NULL;
+
+    if (NULL == pout || NULL == *pout) {
+        return;
+    }
+
+    out = *pout;
+
+    if (true == out->started) {
+        TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&out->wthr));
+
+        pthread_mutex_lock(&out->lock);
+        pthread_cond_signal(&out->wake);
+        pthread_mutex_unlock(&out->lock);
+
+        TSL_BUG_IF_FAILED(worker_thread_delete(&out->wthr));
+        out->started = false;
+    }
+
+    /* Whatever is left goes out now */
+    if (NULL != out->records) {
+        while (0 != _decoder_output_drain(out, false));
+        TFREE(out->records);
+    }
+
+    pthread_cond_destroy(&out->space);
+    pthread_cond_destroy(&out->wake);
+    pthread_mutex_destroy(&out->lock);
+
+    TFREE(out);
+
+    *pout = NULL;
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <tsl/result.h>
+#include <tsl/worker_thread.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * The largest formatted record. Message bodies that would not fit are truncated.
+ */
+#define DECODER_OUTPUT_RECORD_BYTES     4096
+
+/**
+ * The number of records that can be waiting to be written. Decoders wait for space if the
+ * output falls this far behind.
+ */
+#define DECODER_OUTPUT_NR_RECORDS       256
+
+/**
+ * The most records written by one system call
+ */
+#define DECODER_OUTPUT_BATCH            64
+
+/**
+ * How records are written out
+ */
+enum decoder_output_format {
+    /**
+     * A JSON object per line
+     */
+    DECODER_OUTPUT_FORMAT_JSON = 0,
+
+    /**
+     * A struct decoder_output_bin_record per message, followed by the unescaped message body
+     */
+    DECODER_OUTPUT_FORMAT_BINARY = 1,
+};
+
+/**
+ * The kinds of message the decoders produce
+ */
+enum decoder_msg_type {
+    DECODER_MSG_FLEX_ALNUM = 0,
+    DECODER_MSG_FLEX_NUM = 1,
+    DECODER_MSG_FLEX_TEMP_ADDR_ACTIVATION = 2,
+    DECODER_MSG_POCSAG_ALNUM = 3,
+    DECODER_MSG_POCSAG_NUM = 4,
+    DECODER_MSG_AIS_POSITION_REPORT = 5,
+    DECODER_MSG_AIS_BASE_STATION_REPORT = 6,
+    DECODER_MSG_AIS_STATIC_VOYAGE_DATA = 7,
+
+    /**
+     * AIS packet as !AIVDM sentences, in the body. Written out as is, in place of JSON.
+     */
+    DECODER_MSG_AIS_NMEA = 8,
+};
+
+/**
+ * A decoded message, as handed over by a protocol callback. Only the fields that make sense
+ * for the message type are used.
+ */
+struct decoder_msg {
+    enum decoder_msg_type type;
+
+    /**
+     * When the message was decoded
+     */
+    time_t timestamp;
+
+    /**
+     * The frequency of the channel the message was received on, in Hz. Omitted if 0.
+     */
+    unsigned freq_hz;
+
+    /**
+     * How long ago the samples at the end of the message were captured, in microseconds, if
+     * has_latency is set
+     */
+    bool has_latency;
+    uint64_t capture_latency_us;
+
+    /**
+     * The pager capcode, or the MMSI for AIS
+     */
+    uint64_t address;
+
+    /**
+     * Pager details
+     */
+    uint16_t baud;
+    uint8_t phase;
+    uint8_t cycle_no;
+    uint8_t frame_no;
+    uint8_t function;
+    uint8_t seq_num;
+    bool fragmented;
+    bool maildrop;
+    uint32_t siv_data;
+
+    /**
+     * The decoded AIS report (a struct ais_position_report, ais_base_station_report or
+     * ais_static_voyage_data)
+     */
+    const void *ais;
+
+    /**
+     * The message text, or for AIS the raw message
+     */
+    const char *body;
+    size_t body_len;
+};
+
+/**
+ * The header of a binary record. All fields are little endian, and the header is followed by
+ * body_len bytes of message body.
+ */
+struct decoder_output_bin_record {
+    /**
+     * The length of the record, including this header, in bytes
+     */
+    uint16_t len;
+
+    /**
+     * The enum decoder_msg_type of the message
+     */
+    uint8_t type;
+
+    /**
+     * DECODER_OUTPUT_BIN_FLAG_*
+     */
+    uint8_t flags;
+
+    uint32_t freq_hz;
+
+    /**
+     * Seconds since the epoch
+     */
+    int64_t timestamp;
+
+    uint64_t address;
+
+    /**
+     * Microseconds, or UINT32_MAX if unknown
+     */
+    uint32_t capture_latency_us;
+
+    uint32_t siv_data;
+
+    uint16_t baud;
+    uint8_t phase;
+    uint8_t cycle_no;
+    uint8_t frame_no;
+    uint8_t function;
+    uint8_t seq_num;
+    uint8_t reserved;
+
+    uint16_t body_len;
+    uint8_t body[];
+} __attribute__((packed));
+
+#define DECODER_OUTPUT_BIN_FLAG_FRAGMENTED      (1u << 0)
+#define DECODER_OUTPUT_BIN_FLAG_MAILDROP        (1u << 1)
+#define DECODER_OUTPUT_BIN_FLAG_TRUNCATED       (1u << 2)
+
+/**
+ * A formatted record, waiting to be written
+ */
+struct decoder_output_record {
+    size_t len;
+    uint8_t data[DECODER_OUTPUT_RECORD_BYTES];
+};
+
+/**
+ * Formats decoded messages, and writes them out from a thread of its own, so decoders never
+ * block on the output (unless it falls a long way behind). Records are formatted by the
+ * decoding thread, straight into a preallocated slot, and whatever has piled up by the time
+ * the writer thread gets to it goes out in a single writev.
+ *
+ * Any number of threads can put messages.
+ */
+struct decoder_output {
+    /**
+     * Where records are written
+     */
+    int fd;
+
+    enum decoder_output_format format;
+
+    /**
+     * The record slots
+     */
+    struct decoder_output_record *records;
+
+    /**
+     * Free slots, as a stack of indices into records
+     */
+    uint32_t free_slots[DECODER_OUTPUT_NR_RECORDS];
+    size_t nr_free;
+
+    /**
+     * Slots waiting to be written, oldest first, as a ring of indices into records
+     */
+    uint32_t pending[DECODER_OUTPUT_NR_RECORDS];
+    size_t pending_head;
+    size_t nr_pending;
+
+    /**
+     * Protects the free stack and the pending ring
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Signalled when records are pending
+     */
+    pthread_cond_t wake;
+
+    /**
+     * Signalled when slots are freed
+     */
+    pthread_cond_t space;
+
+    /**
+     * Whether writing has failed, in which case records are discarded
+     */
+    bool write_failed;
+
+    struct worker_thread wthr;
+
+    /**
+     * Whether or not wthr was started
+     */
+    bool started;
+};
+
+/**
+ * Create an output, and start its writer thread.
+ *
+ * \param pout The new output, returned by reference
+ * \param fd The file to write to. Not closed when the output is deleted.
+ * \param format How to format records
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t decoder_output_new(struct decoder_output **pout, int fd, enum decoder_output_format format);
+
+/**
+ * Write out every record put so far, and stop the writer thread. No more messages may be put.
+ *
+ * \param pout The output, passed by reference. Set to NULL.
+ */
+void decoder_output_delete(struct decoder_output **pout);
+
+/**
+ * Format a message, and queue it to be written.
+ *
+ * \param out The output
+ * \param msg The message
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t decoder_output_put(struct decoder_output *out, const struct decoder_msg *msg);
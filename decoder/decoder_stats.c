@@ -0,0 +1,172 @@
+/*
+ *  decoder_stats.c - Counters for the decoder, and writing them out as JSON
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <decoder/decoder_stats.h>
+
+#include <inttypes.h>
+
+static const
+char *_decoder_stats_stage_names[DECODER_STATS_NR_STAGES] = {
+    [DECODER_STATS_STAGE_READ] = "read",
+    [DECODER_STATS_STAGE_RESAMPLE] = "resample",
+    [DECODER_STATS_STAGE_POST_FILTER] = "postFilter",
+    [DECODER_STATS_STAGE_FLEX] = "flex",
+    [DECODER_STATS_STAGE_POCSAG] = "pocsag",
+    [DECODER_STATS_STAGE_AIS] = "ais",
+};
+
+void decoder_stats_set_pager(struct decoder_stats_pager *mirror, const struct pager_stats *stats)
+{
+    decoder_stats_set(&mirror->nr_syncs, stats->nr_syncs);
+    decoder_stats_set(&mirror->nr_frame_rejects, stats->nr_frame_rejects);
+    decoder_stats_set(&mirror->nr_bch_clean, stats->nr_bch_clean);
+    decoder_stats_set(&mirror->nr_bch_corrected, stats->nr_bch_corrected);
+    decoder_stats_set(&mirror->nr_bch_failed, stats->nr_bch_failed);
+    decoder_stats_set(&mirror->nr_filtered, stats->nr_filtered);
+}
+
+void decoder_stats_set_ais(struct decoder_stats_ais *mirror, const struct ais_demod_stats *stats)
+{
+    decoder_stats_set(&mirror->nr_syncs, stats->nr_syncs);
+    decoder_stats_set(&mirror->nr_packets, stats->nr_packets);
+    decoder_stats_set(&mirror->nr_crc_rejects, stats->nr_crc_rejects);
+    decoder_stats_set(&mirror->nr_duplicates, stats->nr_duplicates);
+    decoder_stats_set(&mirror->nr_unchanged, stats->nr_unchanged);
+}
+
+static
+void _decoder_stats_sum(_Atomic uint64_t *total, _Atomic uint64_t *ctr)
+{
+    atomic_fetch_add_explicit(total, decoder_stats_read(ctr), memory_order_relaxed);
+}
+
+static
+void _decoder_stats_accumulate_pager(struct decoder_stats_pager *totals, struct decoder_stats_pager *stats)
+{
+    _decoder_stats_sum(&totals->nr_syncs, &stats->nr_syncs);
+    _decoder_stats_sum(&totals->nr_frame_rejects, &stats->nr_frame_rejects);
+    _decoder_stats_sum(&totals->nr_bch_clean, &stats->nr_bch_clean);
+    _decoder_stats_sum(&totals->nr_bch_corrected, &stats->nr_bch_corrected);
+    _decoder_stats_sum(&totals->nr_bch_failed, &stats->nr_bch_failed);
+    _decoder_stats_sum(&totals->nr_filtered, &stats->nr_filtered);
+}
+
+void decoder_stats_accumulate(struct decoder_stats *totals, struct decoder_stats *stats)
+{
+    for (size_t i = 0; i < DECODER_STATS_NR_STAGES; i++) {
+        _decoder_stats_sum(&totals->stage_ns[i], &stats->stage_ns[i]);
+        _decoder_stats_sum(&totals->stage_runs[i], &stats->stage_runs[i]);
+    }
+
+    _decoder_stats_sum(&totals->nr_samples_read, &stats->nr_samples_read);
+    _decoder_stats_sum(&totals->nr_samples_resampled, &stats->nr_samples_resampled);
+    _decoder_stats_sum(&totals->nr_msgs, &stats->nr_msgs);
+
+    for (size_t i = 0; i < DECODER_STATS_LATENCY_BUCKETS; i++) {
+        _decoder_stats_sum(&totals->capture_latency[i], &stats->capture_latency[i]);
+        _decoder_stats_sum(&totals->decode_latency[i], &stats->decode_latency[i]);
+    }
+
+    _decoder_stats_accumulate_pager(&totals->flex, &stats->flex);
+    _decoder_stats_accumulate_pager(&totals->pocsag, &stats->pocsag);
+
+    _decoder_stats_sum(&totals->ais.nr_syncs, &stats->ais.nr_syncs);
+    _decoder_stats_sum(&totals->ais.nr_packets, &stats->ais.nr_packets);
+    _decoder_stats_sum(&totals->ais.nr_crc_rejects, &stats->ais.nr_crc_rejects);
+    _decoder_stats_sum(&totals->ais.nr_duplicates, &stats->ais.nr_duplicates);
+    _decoder_stats_sum(&totals->ais.nr_unchanged, &stats->ais.nr_unchanged);
+}
+
+static
+void _decoder_stats_dump_pager(FILE *fp, const char *name, struct decoder_stats_pager *st)
+{
+    fprintf(fp, ",\"%s\":{\"syncs\":%" PRIu64 ",\"frameRejects\":%" PRIu64 ",\"bchClean\":%" PRIu64 ","
+            "\"bchCorrected\":%" PRIu64 ",\"bchFailed\":%" PRIu64 ",\"filtered\":%" PRIu64 "}",
+            name,
+            decoder_stats_read(&st->nr_syncs),
+            decoder_stats_read(&st->nr_frame_rejects),
+            decoder_stats_read(&st->nr_bch_clean),
+            decoder_stats_read(&st->nr_bch_corrected),
+            decoder_stats_read(&st->nr_bch_failed),
+            decoder_stats_read(&st->nr_filtered));
+}
+
+/**
+ * Write a latency histogram as an array of counts, leaving off the empty buckets at the end
+ */
+static
+void _decoder_stats_dump_latency(FILE *fp, const char *name, _Atomic uint64_t *hist)
+{
+    size_t nr_buckets = DECODER_STATS_LATENCY_BUCKETS;
+
+    while (0 != nr_buckets && 0 == decoder_stats_read(&hist[nr_buckets - 1])) {
+        nr_buckets--;
+    }
+
+    fprintf(fp, ",\"%s\":[", name);
+
+    for (size_t i = 0; i < nr_buckets; i++) {
+        fprintf(fp, "%s%" PRIu64, 0 == i ? "" : ",", decoder_stats_read(&hist[i]));
+    }
+
+    fprintf(fp, "]");
+}
+
+void decoder_stats_dump(FILE *fp, unsigned freq_hz, struct decoder_stats *stats)
+{
+    fprintf(fp, "{\"freqHz\":%u,\"samplesRead\":%" PRIu64 ",\"samplesResampled\":%" PRIu64 ",\"messages\":%" PRIu64,
+            freq_hz,
+            decoder_stats_read(&stats->nr_samples_read),
+            decoder_stats_read(&stats->nr_samples_resampled),
+            decoder_stats_read(&stats->nr_msgs));
+
+    fprintf(fp, ",\"stages\":{");
+
+    for (size_t i = 0; i < DECODER_STATS_NR_STAGES; i++) {
+        uint64_t nr_runs = decoder_stats_read(&stats->stage_runs[i]),
+                 total_ns = decoder_stats_read(&stats->stage_ns[i]);
+
+        fprintf(fp, "%s\"%s\":{\"runs\":%" PRIu64 ",\"totalUs\":%.1f,\"avgUs\":%.2f}",
+                0 == i ? "" : ",",
+                _decoder_stats_stage_names[i],
+                nr_runs,
+                (double)total_ns / 1000.0,
+                0 == nr_runs ? 0.0 : (double)total_ns / (double)nr_runs / 1000.0);
+    }
+
+    fprintf(fp, "}");
+
+    _decoder_stats_dump_pager(fp, "flex", &stats->flex);
+    _decoder_stats_dump_pager(fp, "pocsag", &stats->pocsag);
+
+    fprintf(fp, ",\"ais\":{\"syncs\":%" PRIu64 ",\"packets\":%" PRIu64 ",\"crcRejects\":%" PRIu64
+            ",\"duplicates\":%" PRIu64 ",\"unchanged\":%" PRIu64 "}",
+            decoder_stats_read(&stats->ais.nr_syncs),
+            decoder_stats_read(&stats->ais.nr_packets),
+            decoder_stats_read(&stats->ais.nr_crc_rejects),
+            decoder_stats_read(&stats->ais.nr_duplicates),
+            decoder_stats_read(&stats->ais.nr_unchanged));
+
+    _decoder_stats_dump_latency(fp, "captureLatencyLog2Us", stats->capture_latency);
+    _decoder_stats_dump_latency(fp, "decodeLatencyLog2Us", stats->decode_latency);
+
+    fprintf(fp, "}");
+}
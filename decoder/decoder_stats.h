@@ -0,0 +1,203 @@
+#pragma once
+
+#include <pager/pager_stats.h>
+
+#include <ais/ais_demod.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * The stages a block of samples goes through in the decoder, each timed separately
+ */
+enum decoder_stats_stage {
+    /**
+     * Reading from the input. Includes any time spent waiting for samples to arrive, so a
+     * channel starved of samples spends most of its time here.
+     */
+    DECODER_STATS_STAGE_READ = 0,
+    DECODER_STATS_STAGE_RESAMPLE = 1,
+
+    /**
+     * Inversion, gain and DC blocking
+     */
+    DECODER_STATS_STAGE_POST_FILTER = 2,
+    DECODER_STATS_STAGE_FLEX = 3,
+    DECODER_STATS_STAGE_POCSAG = 4,
+    DECODER_STATS_STAGE_AIS = 5,
+    DECODER_STATS_NR_STAGES,
+};
+
+/**
+ * The number of buckets in a latency histogram. Bucket 0 counts latencies under 1us, and bucket
+ * i > 0 counts latencies of at least 2^(i-1)us and under 2^i us; the last bucket also takes
+ * anything longer (from about 4 seconds).
+ */
+#define DECODER_STATS_LATENCY_BUCKETS       24
+
+/**
+ * Counters from a pager protocol decoder, mirrored so they can be read from another thread
+ */
+struct decoder_stats_pager {
+    _Atomic uint64_t nr_syncs;
+    _Atomic uint64_t nr_frame_rejects;
+    _Atomic uint64_t nr_bch_clean;
+    _Atomic uint64_t nr_bch_corrected;
+    _Atomic uint64_t nr_bch_failed;
+    _Atomic uint64_t nr_filtered;
+};
+
+/**
+ * Counters from the AIS demodulator, mirrored so they can be read from another thread
+ */
+struct decoder_stats_ais {
+    _Atomic uint64_t nr_syncs;
+    _Atomic uint64_t nr_packets;
+    _Atomic uint64_t nr_crc_rejects;
+    _Atomic uint64_t nr_duplicates;
+    _Atomic uint64_t nr_unchanged;
+};
+
+/**
+ * Runtime counters for a single channel. Like the multifm demodulator stats, every counter has
+ * exactly one writer, the thread servicing the channel, and is read from elsewhere with relaxed
+ * loads.
+ */
+struct decoder_stats {
+    /**
+     * Time spent in each stage, in nanoseconds, and the number of times each stage was run
+     */
+    _Atomic uint64_t stage_ns[DECODER_STATS_NR_STAGES];
+    _Atomic uint64_t stage_runs[DECODER_STATS_NR_STAGES];
+
+    /**
+     * Number of samples read from the input
+     */
+    _Atomic uint64_t nr_samples_read;
+
+    /**
+     * Number of samples out of the resampler
+     */
+    _Atomic uint64_t nr_samples_resampled;
+
+    /**
+     * Number of messages decoded
+     */
+    _Atomic uint64_t nr_msgs;
+
+    /**
+     * How long before a message was decoded its last sample was captured, for inputs that carry
+     * capture times (i.e. shared memory rings)
+     */
+    _Atomic uint64_t capture_latency[DECODER_STATS_LATENCY_BUCKETS];
+
+    /**
+     * How long after the read that completed it a message was decoded
+     */
+    _Atomic uint64_t decode_latency[DECODER_STATS_LATENCY_BUCKETS];
+
+    struct decoder_stats_pager flex;
+    struct decoder_stats_pager pocsag;
+    struct decoder_stats_ais ais;
+};
+
+/**
+ * Add to a counter. Only safe when called from the counter's single writer.
+ */
+static inline
+void decoder_stats_add(_Atomic uint64_t *ctr, uint64_t val)
+{
+    atomic_store_explicit(ctr, atomic_load_explicit(ctr, memory_order_relaxed) + val, memory_order_relaxed);
+}
+
+/**
+ * Set a counter. Only safe when called from the counter's single writer.
+ */
+static inline
+void decoder_stats_set(_Atomic uint64_t *ctr, uint64_t val)
+{
+    atomic_store_explicit(ctr, val, memory_order_relaxed);
+}
+
+/**
+ * Read a counter, from any thread
+ */
+static inline
+uint64_t decoder_stats_read(_Atomic uint64_t *ctr)
+{
+    return atomic_load_explicit(ctr, memory_order_relaxed);
+}
+
+/**
+ * Get the current monotonic time, in nanoseconds
+ */
+static inline
+uint64_t decoder_stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Account for a run of a stage that started at start_ns.
+ *
+ * \return The current time, to start timing the next stage from
+ */
+static inline
+uint64_t decoder_stats_stage_end(struct decoder_stats *stats, enum decoder_stats_stage stage, uint64_t start_ns)
+{
+    uint64_t now_ns = decoder_stats_now_ns();
+
+    decoder_stats_add(&stats->stage_ns[stage], now_ns - start_ns);
+    decoder_stats_add(&stats->stage_runs[stage], 1);
+
+    return now_ns;
+}
+
+/**
+ * Count a latency, in microseconds, in a latency histogram
+ */
+static inline
+void decoder_stats_latency(_Atomic uint64_t *hist, uint64_t latency_us)
+{
+    size_t bucket = 0 == latency_us ? 0 : 64 - __builtin_clzll(latency_us);
+
+    if (bucket >= DECODER_STATS_LATENCY_BUCKETS) {
+        bucket = DECODER_STATS_LATENCY_BUCKETS - 1;
+    }
+
+    decoder_stats_add(&hist[bucket], 1);
+}
+
+/**
+ * Mirror the counters kept by a pager protocol decoder
+ */
+void decoder_stats_set_pager(struct decoder_stats_pager *mirror, const struct pager_stats *stats);
+
+/**
+ * Mirror the counters kept by the AIS demodulator
+ */
+void decoder_stats_set_ais(struct decoder_stats_ais *mirror, const struct ais_demod_stats *stats);
+
+/**
+ * Add the counters of one channel to another's. Safe with several threads adding to the same
+ * totals at once, but the totals must not also be written by a channel.
+ *
+ * \param totals The counters to add to
+ * \param stats The counters to add
+ */
+void decoder_stats_accumulate(struct decoder_stats *totals, struct decoder_stats *stats);
+
+/**
+ * Write a channel's counters as a JSON object.
+ *
+ * \param fp Where to write the counters
+ * \param freq_hz The frequency of the channel
+ * \param stats The counters
+ */
+void decoder_stats_dump(FILE *fp, unsigned freq_hz, struct decoder_stats *stats);
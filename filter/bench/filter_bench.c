@@ -0,0 +1,798 @@
+/*
+ *  filter_bench.c - Micro-benchmarks for the filter kernels and the FM demodulator
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/fm_demod.h>
+#include <multifm/demod_base.h>
+
+#include <filter/filter.h>
+#include <filter/direct_fir.h>
+#include <filter/polyphase_fir.h>
+#include <filter/sample_buf.h>
+#include <filter/dc_blocker.h>
+#include <filter/utils.h>
+
+#include <app/app.h>
+
+#include <tsl/diag.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/safe_alloc.h>
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#define FB_MSG(sev, sys, msg, ...) MESSAGE("FILTER-BENCH", sev, sys, msg, ##__VA_ARGS__)
+
+/**
+ * The number of sample buffers cycled through a FIR. A FIR holds at most two at once, so the
+ * third is always free to be refilled.
+ */
+#define FILTER_BENCH_NR_BUFS        3
+
+/**
+ * The sample rate and channel offset the direct FIR derotates with, as multifm would
+ */
+#define FILTER_BENCH_SAMPLE_RATE    1000000
+#define FILTER_BENCH_OFFSET_HZ      12500
+
+#if defined(_USE_ARM_NEON)
+#define FILTER_BENCH_IMPLEMENTATION "neon"
+#elif defined(__AVX2__)
+#define FILTER_BENCH_IMPLEMENTATION "avx2"
+#elif defined(__SSE4_1__)
+#define FILTER_BENCH_IMPLEMENTATION "sse4.1"
+#elif defined(__SSE2__)
+#define FILTER_BENCH_IMPLEMENTATION "sse2"
+#else
+#define FILTER_BENCH_IMPLEMENTATION "generic"
+#endif
+
+/**
+ * The parameters swept over
+ */
+static const
+size_t filter_bench_taps[] = { 37, 128, 256, 512 };
+
+static const
+unsigned filter_bench_decimations[] = { 1, 25, 40, 120 };
+
+static const
+size_t filter_bench_buf_lens[] = { 1024, 16384 };
+
+/**
+ * Rational rates for the polyphase FIR, as (interpolate, decimate) pairs
+ */
+static const
+unsigned filter_bench_rates[][2] = { { 1, 1 }, { 1, 3 }, { 3, 2 }, { 2, 25 } };
+
+/**
+ * One parameterization of one benchmark
+ */
+struct filter_bench_case {
+    /**
+     * The name of the benchmark, i.e. the function being measured
+     */
+    const char *bench;
+
+    /**
+     * A short description of the variant being measured, or an empty string
+     */
+    const char *variant;
+
+    size_t nr_taps;
+    unsigned interpolate;
+    unsigned decimate;
+
+    /**
+     * The number of samples in each buffer handed to the function under test
+     */
+    size_t buf_len;
+};
+
+/**
+ * State for the benchmark being run. Only the parts relevant to the benchmark are set up.
+ */
+struct filter_bench_state {
+    struct filter_bench_case cs;
+
+    struct sample_buf *bufs[FILTER_BENCH_NR_BUFS];
+    unsigned next_buf;
+
+    int16_t *coeffs;
+    int16_t *out;
+
+    struct direct_fir fir;
+    struct polyphase_fir *pfir;
+    struct dc_blocker blk;
+    struct demod_base *demod;
+};
+
+/**
+ * Run one pass of a benchmark, returning the number of samples consumed by reference
+ */
+typedef aresult_t (*filter_bench_pass_func_t)(struct filter_bench_state *st, size_t *pnr_samples);
+
+/**
+ * The minimum time to run each case for, in nanoseconds
+ */
+static
+uint64_t min_run_ns = 200000000ull;
+
+/**
+ * Only run benchmarks whose name contains this, if set
+ */
+static
+const char *bench_match = NULL;
+
+/**
+ * Where to write the JSON report, if anywhere
+ */
+static
+FILE *json_out = NULL;
+
+/**
+ * Where to write the human readable table of results. Moved to stderr if the JSON report is
+ * going to stdout.
+ */
+static
+FILE *table_out = NULL;
+
+/**
+ * Whether a result has been written to the JSON report yet
+ */
+static
+bool json_first = true;
+
+static
+aresult_t _filter_bench_buf_release(struct sample_buf *buf)
+{
+    /* The buffers are recycled by the benchmark */
+    return A_OK;
+}
+
+/**
+ * Simple deterministic pseudo-random sample generator
+ */
+static
+int16_t _filter_bench_rand(uint32_t *state)
+{
+    *state = *state * 1103515245ul + 12345ul;
+    return (int16_t)(*state >> 16);
+}
+
+/**
+ * Allocate the sample buffers, output buffer and coefficients for a case, filled with noise.
+ */
+static
+aresult_t _filter_bench_state_init(struct filter_bench_state *st, const struct filter_bench_case *cs,
+        enum sample_type sample_type)
+{
+    aresult_t ret = A_OK;
+
+    const size_t nr_components = COMPLEX_INT_16 == sample_type ? 2 : 1,
+                 buf_bytes = cs->buf_len * nr_components * sizeof(int16_t);
+    uint32_t state = 0x5eed;
+
+    memset(st, 0, sizeof(*st));
+    st->cs = *cs;
+
+    for (size_t i = 0; i < FILTER_BENCH_NR_BUFS; i++) {
+        struct sample_buf *buf = NULL;
+        int16_t *samples = NULL;
+
+        if (FAILED(ret = TACALLOC((void **)&buf, 1, sizeof(struct sample_buf) + buf_bytes, SYS_CACHE_LINE_LENGTH))) {
+            goto done;
+        }
+
+        buf->sample_type = sample_type;
+        buf->nr_samples = cs->buf_len;
+        buf->sample_buf_bytes = buf_bytes;
+        buf->release = _filter_bench_buf_release;
+
+        samples = (int16_t *)buf->data_buf;
+        for (size_t j = 0; j < cs->buf_len * nr_components; j++) {
+            samples[j] = _filter_bench_rand(&state) / 4;
+        }
+
+        st->bufs[i] = buf;
+    }
+
+    /* Room for every output of a buffer, even at the highest interpolation rate */
+    if (FAILED(ret = TACALLOC((void **)&st->out, 4 * cs->buf_len, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (0 != cs->nr_taps) {
+        /* Real and imaginary coefficients, at a realistic gain */
+        if (FAILED(ret = TACALLOC((void **)&st->coeffs, cs->nr_taps, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+            goto done;
+        }
+
+        for (size_t i = 0; i < 2 * cs->nr_taps; i++) {
+            st->coeffs[i] = _filter_bench_rand(&state) / (int16_t)(16 * ((cs->nr_taps + 36) / 37));
+        }
+    }
+
+done:
+    return ret;
+}
+
+static
+void _filter_bench_state_cleanup(struct filter_bench_state *st)
+{
+    for (size_t i = 0; i < FILTER_BENCH_NR_BUFS; i++) {
+        if (NULL != st->bufs[i]) {
+            TFREE(st->bufs[i]);
+        }
+    }
+
+    if (NULL != st->out) {
+        TFREE(st->out);
+    }
+
+    if (NULL != st->coeffs) {
+        TFREE(st->coeffs);
+    }
+}
+
+/**
+ * Get the next sample buffer to push, holding a single reference
+ */
+static
+struct sample_buf *_filter_bench_buf_next(struct filter_bench_state *st)
+{
+    struct sample_buf *buf = st->bufs[st->next_buf];
+
+    st->next_buf = (st->next_buf + 1) % FILTER_BENCH_NR_BUFS;
+    atomic_store(&buf->refcount, 1);
+
+    return buf;
+}
+
+static
+aresult_t _filter_bench_direct_fir_pass(struct filter_bench_state *st, size_t *pnr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_gen = 0;
+
+    if (FAILED(ret = direct_fir_push_sample_buf(&st->fir, _filter_bench_buf_next(st)))) {
+        goto done;
+    }
+
+    do {
+        if (FAILED(ret = direct_fir_process(&st->fir, st->out, st->cs.buf_len, &nr_gen))) {
+            goto done;
+        }
+    } while (0 != nr_gen);
+
+    *pnr_samples = st->cs.buf_len;
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_polyphase_fir_pass(struct filter_bench_state *st, size_t *pnr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_gen = 0;
+    bool can_process = false;
+
+    if (FAILED(ret = polyphase_fir_push_sample_buf(st->pfir, _filter_bench_buf_next(st)))) {
+        goto done;
+    }
+
+    do {
+        if (FAILED(ret = polyphase_fir_process(st->pfir, st->out, st->cs.buf_len, &nr_gen))) {
+            goto done;
+        }
+
+        if (FAILED(ret = polyphase_fir_can_process(st->pfir, &can_process))) {
+            goto done;
+        }
+    } while (0 != nr_gen && true == can_process);
+
+    *pnr_samples = st->cs.buf_len;
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_dot_product_pass(struct filter_bench_state *st, size_t *pnr_samples)
+{
+    aresult_t ret = A_OK;
+
+    /* Every window starting in the first buffer, so the last nr_taps - 1 straddle the second */
+    for (size_t i = 0; i < st->cs.buf_len; i++) {
+        if (FAILED(ret = dot_product_sample_buffers_real(st->bufs[0], st->bufs[1], i, st->coeffs,
+                        st->cs.nr_taps, &st->out[i])))
+        {
+            goto done;
+        }
+    }
+
+    *pnr_samples = st->cs.buf_len;
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_dc_blocker_pass(struct filter_bench_state *st, size_t *pnr_samples)
+{
+    aresult_t ret = A_OK;
+
+    if (FAILED(ret = dc_blocker_apply(&st->blk, (int16_t *)st->bufs[0]->data_buf, st->cs.buf_len))) {
+        goto done;
+    }
+
+    *pnr_samples = st->cs.buf_len;
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_fm_demod_pass(struct filter_bench_state *st, size_t *pnr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0,
+           nr_out_bytes = 0;
+
+    if (FAILED(ret = demod_base_process(st->demod, (int16_t *)st->bufs[0]->data_buf, st->cs.buf_len,
+                    st->out, &nr_out, &nr_out_bytes)))
+    {
+        goto done;
+    }
+
+    *pnr_samples = st->cs.buf_len;
+
+done:
+    return ret;
+}
+
+static
+void _filter_bench_json_string(const char *key, const char *value)
+{
+    fprintf(json_out, "\"%s\": \"", key);
+
+    for (const char *c = value; '\0' != *c; c++) {
+        if ('"' == *c || '\\' == *c) {
+            fputc('\\', json_out);
+        }
+        fputc(*c, json_out);
+    }
+
+    fputc('"', json_out);
+}
+
+/**
+ * Run a pass until at least the minimum run time has elapsed, then report the throughput.
+ */
+static
+aresult_t _filter_bench_run(struct filter_bench_state *st, filter_bench_pass_func_t pass)
+{
+    aresult_t ret = A_OK;
+
+    const struct filter_bench_case *cs = &st->cs;
+    uint64_t start_ns = 0,
+             elapsed_ns = 0,
+             nr_samples = 0;
+    size_t nr_pass = 0;
+    double ns_per_sample = 0.0,
+           samples_per_sec = 0.0;
+
+    /* Warm up the caches and branch predictors, and fill the filter delay line */
+    for (size_t i = 0; i < FILTER_BENCH_NR_BUFS; i++) {
+        if (FAILED(ret = pass(st, &nr_pass))) {
+            goto done;
+        }
+    }
+
+    start_ns = sample_buf_now_ns();
+
+    do {
+        /* Check the clock every few passes, so short passes aren't dominated by clock_gettime */
+        for (size_t i = 0; i < 8; i++) {
+            if (FAILED(ret = pass(st, &nr_pass))) {
+                goto done;
+            }
+            nr_samples += nr_pass;
+        }
+
+        elapsed_ns = sample_buf_now_ns() - start_ns;
+    } while (elapsed_ns < min_run_ns);
+
+    ns_per_sample = (double)elapsed_ns / (double)nr_samples;
+    samples_per_sec = (double)nr_samples * 1e9 / (double)elapsed_ns;
+
+    fprintf(table_out, "%-32s %-14s %5zu %6u %6u %6zu %10.3f %10.3f\n", cs->bench, cs->variant,
+            cs->nr_taps, cs->interpolate, cs->decimate, cs->buf_len, ns_per_sample, samples_per_sec / 1e6);
+
+    if (NULL != json_out) {
+        fprintf(json_out, "%s\n    { ", true == json_first ? "" : ",");
+        _filter_bench_json_string("bench", cs->bench);
+        fprintf(json_out, ", ");
+        _filter_bench_json_string("variant", cs->variant);
+        fprintf(json_out, ", \"taps\": %zu, \"interpolate\": %u, \"decimate\": %u, \"buf_samples\": %zu, "
+                "\"samples\": %llu, \"elapsed_ns\": %llu, \"ns_per_sample\": %.4f, \"samples_per_sec\": %.1f }",
+                cs->nr_taps, cs->interpolate, cs->decimate, cs->buf_len,
+                (unsigned long long)nr_samples, (unsigned long long)elapsed_ns, ns_per_sample, samples_per_sec);
+        json_first = false;
+    }
+
+done:
+    if (FAILED(ret)) {
+        FB_MSG(SEV_ERROR, "BENCH-FAILED", "Benchmark %s (%s) failed, taps = %zu, buffer = %zu samples",
+                cs->bench, cs->variant, cs->nr_taps, cs->buf_len);
+    }
+
+    return ret;
+}
+
+static
+bool _filter_bench_wanted(const char *bench)
+{
+    return NULL == bench_match || NULL != strstr(bench, bench_match);
+}
+
+static
+aresult_t _filter_bench_direct_fir(void)
+{
+    aresult_t ret = A_OK;
+
+    static const char *variants[2] = { "asymmetric", "conj-symmetric" };
+
+    if (false == _filter_bench_wanted("direct_fir")) {
+        goto done;
+    }
+
+    for (size_t t = 0; t < sizeof(filter_bench_taps)/sizeof(filter_bench_taps[0]); t++) {
+        for (size_t d = 0; d < sizeof(filter_bench_decimations)/sizeof(filter_bench_decimations[0]); d++) {
+            for (size_t b = 0; b < sizeof(filter_bench_buf_lens)/sizeof(filter_bench_buf_lens[0]); b++) {
+                for (size_t v = 0; v < sizeof(variants)/sizeof(variants[0]); v++) {
+                    struct filter_bench_state st;
+                    struct filter_bench_case cs = {
+                        .bench = "direct_fir",
+                        .variant = variants[v],
+                        .nr_taps = filter_bench_taps[t],
+                        .interpolate = 1,
+                        .decimate = filter_bench_decimations[d],
+                        .buf_len = filter_bench_buf_lens[b],
+                    };
+                    int16_t *c_re = NULL,
+                            *c_im = NULL;
+
+                    if (FAILED(ret = _filter_bench_state_init(&st, &cs, COMPLEX_INT_16))) {
+                        goto done;
+                    }
+
+                    c_re = st.coeffs;
+                    c_im = &st.coeffs[cs.nr_taps];
+
+                    /* Mirror the taps, as a frequency shifted symmetric prototype would be */
+                    for (size_t k = 0; k < cs.nr_taps / 2 && 0 != v; k++) {
+                        c_re[cs.nr_taps - 1 - k] = c_re[k];
+                        c_im[cs.nr_taps - 1 - k] = -c_im[k];
+                    }
+
+                    if (0 != v && 0 != (cs.nr_taps & 1)) {
+                        c_im[cs.nr_taps / 2] = 0;
+                    }
+
+                    TSL_BUG_IF_FAILED(direct_fir_init(&st.fir, cs.nr_taps, c_re, c_im, cs.decimate, true,
+                                FILTER_BENCH_SAMPLE_RATE, FILTER_BENCH_OFFSET_HZ));
+
+                    ret = _filter_bench_run(&st, _filter_bench_direct_fir_pass);
+
+                    TSL_BUG_IF_FAILED(direct_fir_cleanup(&st.fir));
+                    _filter_bench_state_cleanup(&st);
+
+                    if (FAILED(ret)) {
+                        goto done;
+                    }
+                }
+            }
+        }
+    }
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_polyphase_fir(void)
+{
+    aresult_t ret = A_OK;
+
+    if (false == _filter_bench_wanted("polyphase_fir")) {
+        goto done;
+    }
+
+    for (size_t t = 0; t < sizeof(filter_bench_taps)/sizeof(filter_bench_taps[0]); t++) {
+        for (size_t r = 0; r < sizeof(filter_bench_rates)/sizeof(filter_bench_rates[0]); r++) {
+            for (size_t b = 0; b < sizeof(filter_bench_buf_lens)/sizeof(filter_bench_buf_lens[0]); b++) {
+                struct filter_bench_state st;
+                struct filter_bench_case cs = {
+                    .bench = "polyphase_fir",
+                    .variant = "real",
+                    .nr_taps = filter_bench_taps[t],
+                    .interpolate = filter_bench_rates[r][0],
+                    .decimate = filter_bench_rates[r][1],
+                    .buf_len = filter_bench_buf_lens[b],
+                };
+
+                if (FAILED(ret = _filter_bench_state_init(&st, &cs, REAL_INT_16))) {
+                    goto done;
+                }
+
+                TSL_BUG_IF_FAILED(polyphase_fir_new(&st.pfir, cs.nr_taps, st.coeffs, cs.interpolate, cs.decimate));
+
+                ret = _filter_bench_run(&st, _filter_bench_polyphase_fir_pass);
+
+                TSL_BUG_IF_FAILED(polyphase_fir_delete(&st.pfir));
+                _filter_bench_state_cleanup(&st);
+
+                if (FAILED(ret)) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_dot_product(void)
+{
+    aresult_t ret = A_OK;
+
+    if (false == _filter_bench_wanted("dot_product_sample_buffers_real")) {
+        goto done;
+    }
+
+    for (size_t t = 0; t < sizeof(filter_bench_taps)/sizeof(filter_bench_taps[0]); t++) {
+        for (size_t b = 0; b < sizeof(filter_bench_buf_lens)/sizeof(filter_bench_buf_lens[0]); b++) {
+            struct filter_bench_state st;
+            struct filter_bench_case cs = {
+                .bench = "dot_product_sample_buffers_real",
+                .variant = "",
+                .nr_taps = filter_bench_taps[t],
+                .interpolate = 1,
+                .decimate = 1,
+                .buf_len = filter_bench_buf_lens[b],
+            };
+
+            if (FAILED(ret = _filter_bench_state_init(&st, &cs, REAL_INT_16))) {
+                goto done;
+            }
+
+            ret = _filter_bench_run(&st, _filter_bench_dot_product_pass);
+
+            _filter_bench_state_cleanup(&st);
+
+            if (FAILED(ret)) {
+                goto done;
+            }
+        }
+    }
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_dc_blocker(void)
+{
+    aresult_t ret = A_OK;
+
+    if (false == _filter_bench_wanted("dc_blocker_apply")) {
+        goto done;
+    }
+
+    for (size_t b = 0; b < sizeof(filter_bench_buf_lens)/sizeof(filter_bench_buf_lens[0]); b++) {
+        struct filter_bench_state st;
+        struct filter_bench_case cs = {
+            .bench = "dc_blocker_apply",
+            .variant = "",
+            .interpolate = 1,
+            .decimate = 1,
+            .buf_len = filter_bench_buf_lens[b],
+        };
+
+        if (FAILED(ret = _filter_bench_state_init(&st, &cs, REAL_INT_16))) {
+            goto done;
+        }
+
+        TSL_BUG_IF_FAILED(dc_blocker_init(&st.blk, 0.9999));
+
+        ret = _filter_bench_run(&st, _filter_bench_dc_blocker_pass);
+
+        _filter_bench_state_cleanup(&st);
+
+        if (FAILED(ret)) {
+            goto done;
+        }
+    }
+
+done:
+    return ret;
+}
+
+static
+aresult_t _filter_bench_fm_demod(void)
+{
+    aresult_t ret = A_OK;
+
+    static const enum multifm_fm_discriminator discs[2] = {
+        MULTIFM_FM_DISCRIMINATOR_ATAN2,
+        MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE,
+    };
+    static const char *disc_names[2] = { "atan2", "differentiate" };
+
+    if (false == _filter_bench_wanted("fm_demod")) {
+        goto done;
+    }
+
+    for (size_t d = 0; d < sizeof(discs)/sizeof(discs[0]); d++) {
+        for (size_t b = 0; b < sizeof(filter_bench_buf_lens)/sizeof(filter_bench_buf_lens[0]); b++) {
+            struct filter_bench_state st;
+            struct filter_bench_case cs = {
+                .bench = "fm_demod",
+                .variant = disc_names[d],
+                .interpolate = 1,
+                .decimate = 1,
+                .buf_len = filter_bench_buf_lens[b],
+            };
+
+            if (FAILED(ret = _filter_bench_state_init(&st, &cs, COMPLEX_INT_16))) {
+                goto done;
+            }
+
+            TSL_BUG_IF_FAILED(multifm_fm_demod_init(&st.demod, discs[d]));
+
+            ret = _filter_bench_run(&st, _filter_bench_fm_demod_pass);
+
+            TSL_BUG_IF_FAILED(demod_base_cleanup(&st.demod));
+            _filter_bench_state_cleanup(&st);
+
+            if (FAILED(ret)) {
+                goto done;
+            }
+        }
+    }
+
+done:
+    return ret;
+}
+
+static
+void _usage(const char *appname)
+{
+    FB_MSG(SEV_INFO, "USAGE", "%s [-t min time per case, ms] [-b benchmark] [-j json output file]", appname);
+    FB_MSG(SEV_INFO, "USAGE", "        -b      Only run benchmarks whose name contains this string");
+    FB_MSG(SEV_INFO, "USAGE", "        -j      Write the results as JSON to this file, or - for stdout");
+    exit(EXIT_SUCCESS);
+}
+
+static
+void _set_options(int argc, char * const argv[])
+{
+    int arg = -1;
+    const char *json_file = NULL;
+
+    while ((arg = getopt(argc, argv, "t:b:j:h")) != -1) {
+        switch (arg) {
+        case 't':
+            min_run_ns = strtoull(optarg, NULL, 0) * 1000000ull;
+            break;
+        case 'b':
+            bench_match = optarg;
+            break;
+        case 'j':
+            json_file = optarg;
+            break;
+        case 'h':
+            _usage(argv[0]);
+            break;
+        }
+    }
+
+    if (0 == min_run_ns) {
+        FB_MSG(SEV_FATAL, "BAD-TIME", "Minimum time per case must be a non-zero number of milliseconds.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (NULL != json_file) {
+        if (!strcmp(json_file, "-")) {
+            json_out = stdout;
+        } else if (NULL == (json_out = fopen(json_file, "w"))) {
+            FB_MSG(SEV_FATAL, "BAD-JSON-FILE", "Failed to open %s for writing", json_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int main(int argc, char * const argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    struct utsname uts;
+
+    TSL_BUG_IF_FAILED(app_init("filter_bench", NULL));
+
+    _set_options(argc, argv);
+
+    if (0 != uname(&uts)) {
+        strcpy(uts.machine, "unknown");
+    }
+
+    FB_MSG(SEV_INFO, "STARTING", "Filter benchmarks, version %s, %s, %s kernels", _VC_VERSION,
+            uts.machine, FILTER_BENCH_IMPLEMENTATION);
+
+    if (NULL != json_out) {
+        fprintf(json_out, "{ ");
+        _filter_bench_json_string("version", _VC_VERSION);
+        fprintf(json_out, ", ");
+        _filter_bench_json_string("machine", uts.machine);
+        fprintf(json_out, ", ");
+        _filter_bench_json_string("implementation", FILTER_BENCH_IMPLEMENTATION);
+        fprintf(json_out, ", \"min_run_ns\": %llu, \"results\": [", (unsigned long long)min_run_ns);
+    }
+
+    /* Keep the JSON on stdout parseable */
+    table_out = stdout == json_out ? stderr : stdout;
+
+    fprintf(table_out, "%-32s %-14s %5s %6s %6s %6s %10s %10s\n", "bench", "variant", "taps", "interp", "decim",
+            "buffer", "ns/sample", "Msample/s");
+
+    if (FAILED(_filter_bench_direct_fir()) ||
+            FAILED(_filter_bench_polyphase_fir()) ||
+            FAILED(_filter_bench_dot_product()) ||
+            FAILED(_filter_bench_dc_blocker()) ||
+            FAILED(_filter_bench_fm_demod()))
+    {
+        goto done;
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    if (NULL != json_out) {
+        fprintf(json_out, "\n] }\n");
+        if (stdout != json_out) {
+            fclose(json_out);
+        }
+    }
+
+    return ret;
+}
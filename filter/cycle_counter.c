@@ -0,0 +1,244 @@
+/*
+ *  cycle_counter.c - Per-thread histograms of the time spent in the hot paths
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/cycle_counter.h>
+
+#ifdef _CYCLE_COUNTERS
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/syscall.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CYCLE_COUNTER_NAME_LEN          16
+
+/**
+ * The histograms for a single thread. Only the owning thread writes to them.
+ */
+struct cycle_counter_thread {
+    /**
+     * The next thread in the list of every thread that has counted anything. Never freed, so
+     * the counts outlive the thread.
+     */
+    struct cycle_counter_thread *next;
+
+    pid_t tid;
+    char name[CYCLE_COUNTER_NAME_LEN];
+
+    uint64_t max[CYCLE_COUNTER_NR_COUNTERS];
+    uint64_t buckets[CYCLE_COUNTER_NR_COUNTERS][CYCLE_COUNTER_NR_BUCKETS];
+};
+
+static
+_Atomic(struct cycle_counter_thread *) _cycle_counter_threads = NULL;
+
+static __thread
+struct cycle_counter_thread *_cycle_counter_thread = NULL;
+
+static __thread
+bool _cycle_counter_no_thread = false;
+
+/**
+ * When the first thread started counting, to work out how fast the counter runs
+ */
+static
+_Atomic uint64_t _cycle_counter_base_count = 0;
+
+static
+_Atomic uint64_t _cycle_counter_base_ns = 0;
+
+static const
+char *_cycle_counter_names[CYCLE_COUNTER_NR_COUNTERS] = {
+    [CYCLE_COUNTER_DIRECT_FIR] = "direct_fir_process",
+    [CYCLE_COUNTER_POLYPHASE_FIR] = "polyphase_fir_process",
+    [CYCLE_COUNTER_DC_BLOCKER] = "dc_blocker_apply",
+    [CYCLE_COUNTER_FM_DEMOD] = "multifm_fm_demod_process",
+    [CYCLE_COUNTER_FIFO_WRITE] = "fifo_write",
+    [CYCLE_COUNTER_FLEX_ON_PCM] = "pager_flex_on_pcm",
+    [CYCLE_COUNTER_POCSAG_ON_PCM] = "pager_pocsag_on_pcm",
+    [CYCLE_COUNTER_AIS_ON_PCM] = "ais_decode_on_pcm",
+};
+
+static
+uint64_t _cycle_counter_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static
+struct cycle_counter_thread *_cycle_counter_thread_new(void)
+{
+    struct cycle_counter_thread *thr = NULL;
+    uint64_t zero = 0;
+
+    if (FAILED(TZAALLOC(thr, SYS_CACHE_LINE_LENGTH))) {
+        return NULL;
+    }
+
+    thr->tid = syscall(SYS_gettid);
+    if (0 != pthread_getname_np(pthread_self(), thr->name, sizeof(thr->name))) {
+        snprintf(thr->name, sizeof(thr->name), "%d", (int)thr->tid);
+    }
+
+    /* The first thread to get here sets the base for calibrating the counter */
+    if (atomic_compare_exchange_strong(&_cycle_counter_base_ns, &zero, _cycle_counter_now_ns())) {
+        atomic_store(&_cycle_counter_base_count, cycle_counter_read());
+    }
+
+    thr->next = atomic_load_explicit(&_cycle_counter_threads, memory_order_relaxed);
+    while (false == atomic_compare_exchange_weak_explicit(&_cycle_counter_threads, &thr->next, thr,
+                memory_order_release, memory_order_relaxed)) { }
+
+    return thr;
+}
+
+void cycle_counter_record(enum cycle_counter ctr, uint64_t count)
+{
+    struct cycle_counter_thread *thr = _cycle_counter_thread;
+
+    if (NULL == thr) {
+        /* Callers might still want errno from whatever was being timed */
+        int errnum = errno;
+
+        if (true == _cycle_counter_no_thread) {
+            return;
+        }
+
+        thr = _cycle_counter_thread_new();
+        errno = errnum;
+
+        if (NULL == thr) {
+            _cycle_counter_no_thread = true;
+            return;
+        }
+
+        _cycle_counter_thread = thr;
+    }
+
+    thr->buckets[ctr][cycle_counter_bucket(count)]++;
+
+    if (count > thr->max[ctr]) {
+        thr->max[ctr] = count;
+    }
+}
+
+/**
+ * The smallest count that lands in the given bucket
+ */
+static
+uint64_t _cycle_counter_bucket_floor(unsigned bucket)
+{
+    unsigned group = bucket / CYCLE_COUNTER_SUB_BUCKETS;
+
+    if (0 == group) {
+        return bucket;
+    }
+
+    return (uint64_t)(CYCLE_COUNTER_SUB_BUCKETS + bucket % CYCLE_COUNTER_SUB_BUCKETS) << (group - 1);
+}
+
+/**
+ * Find the bucket holding the given percentile
+ */
+static
+uint64_t _cycle_counter_percentile(const uint64_t *buckets, uint64_t nr_counts, double pct)
+{
+    uint64_t target = (uint64_t)((double)nr_counts * pct / 100.0),
+             seen = 0;
+
+    for (unsigned i = 0; i < CYCLE_COUNTER_NR_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > target) {
+            return _cycle_counter_bucket_floor(i);
+        }
+    }
+
+    return 0;
+}
+
+void cycle_counter_dump(FILE *fp)
+{
+    static const double pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+
+    struct cycle_counter_thread *thr = NULL;
+    uint64_t base_ns = atomic_load(&_cycle_counter_base_ns),
+             elapsed_ns = 0,
+             elapsed_count = 0;
+    double ns_per_count = 0.0;
+
+    if (0 == base_ns) {
+        fprintf(fp, "No cycle counts recorded.\n");
+        return;
+    }
+
+    elapsed_ns = _cycle_counter_now_ns() - base_ns;
+    elapsed_count = cycle_counter_read() - atomic_load(&_cycle_counter_base_count);
+    ns_per_count = 0 != elapsed_count ? (double)elapsed_ns / (double)elapsed_count : 0.0;
+
+    fprintf(fp, "Cycle counts, %.3f ns per count\n", ns_per_count);
+    fprintf(fp, "%-16s %-26s %12s %10s %10s %10s %10s %10s %10s\n", "thread", "counter", "calls",
+            "p50", "p90", "p99", "p99.9", "max", "p99 ns");
+
+    for (thr = atomic_load_explicit(&_cycle_counter_threads, memory_order_acquire); NULL != thr; thr = thr->next) {
+        for (unsigned ctr = 0; ctr < CYCLE_COUNTER_NR_COUNTERS; ctr++) {
+            uint64_t buckets[CYCLE_COUNTER_NR_BUCKETS],
+                     nr_counts = 0,
+                     pct_counts[sizeof(pcts)/sizeof(pcts[0])];
+
+            /* Take a copy, so the percentiles are at least consistent with each other */
+            for (unsigned i = 0; i < CYCLE_COUNTER_NR_BUCKETS; i++) {
+                buckets[i] = __atomic_load_n(&thr->buckets[ctr][i], __ATOMIC_RELAXED);
+                nr_counts += buckets[i];
+            }
+
+            if (0 == nr_counts) {
+                continue;
+            }
+
+            for (size_t p = 0; p < sizeof(pcts)/sizeof(pcts[0]); p++) {
+                pct_counts[p] = _cycle_counter_percentile(buckets, nr_counts, pcts[p]);
+            }
+
+            fprintf(fp, "%-16s %-26s %12llu %10llu %10llu %10llu %10llu %10llu %10.0f\n", thr->name,
+                    _cycle_counter_names[ctr], (unsigned long long)nr_counts,
+                    (unsigned long long)pct_counts[0], (unsigned long long)pct_counts[1],
+                    (unsigned long long)pct_counts[2], (unsigned long long)pct_counts[3],
+                    (unsigned long long)__atomic_load_n(&thr->max[ctr], __ATOMIC_RELAXED),
+                    (double)pct_counts[2] * ns_per_count);
+        }
+    }
+
+    fflush(fp);
+}
+
+#endif /* defined(_CYCLE_COUNTERS) */
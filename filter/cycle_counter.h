@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef _CYCLE_COUNTERS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+/**
+ * The hot paths that can be timed. Build with -DCYCLE_COUNTERS=ON to time them.
+ */
+enum cycle_counter {
+    CYCLE_COUNTER_DIRECT_FIR = 0,
+    CYCLE_COUNTER_POLYPHASE_FIR = 1,
+    CYCLE_COUNTER_DC_BLOCKER = 2,
+    CYCLE_COUNTER_FM_DEMOD = 3,
+    CYCLE_COUNTER_FIFO_WRITE = 4,
+    CYCLE_COUNTER_FLEX_ON_PCM = 5,
+    CYCLE_COUNTER_POCSAG_ON_PCM = 6,
+    CYCLE_COUNTER_AIS_ON_PCM = 7,
+    CYCLE_COUNTER_NR_COUNTERS
+};
+
+/**
+ * Each power of 2 is split into 2^CYCLE_COUNTER_SUB_BITS linear buckets, so a bucket is never
+ * more than 12.5% wide
+ */
+#define CYCLE_COUNTER_SUB_BITS          3
+#define CYCLE_COUNTER_SUB_BUCKETS       (1u << CYCLE_COUNTER_SUB_BITS)
+#define CYCLE_COUNTER_NR_BUCKETS        ((64 - CYCLE_COUNTER_SUB_BITS + 1) * CYCLE_COUNTER_SUB_BUCKETS)
+
+#ifdef _CYCLE_COUNTERS
+
+/**
+ * Read the free running counter: the TSC on x86, the virtual counter on ARM, or the monotonic
+ * clock, in nanoseconds, anywhere else.
+ */
+static inline
+uint64_t cycle_counter_read(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t val;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+#elif defined(__ARM_ARCH_7A__)
+    uint64_t val;
+    __asm__ __volatile__("mrrc p15, 1, %Q0, %R0, c14" : "=r" (val));
+    return val;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * The histogram bucket a count falls in. Counts below CYCLE_COUNTER_SUB_BUCKETS get a bucket of
+ * their own, after that each power of 2 gets CYCLE_COUNTER_SUB_BUCKETS.
+ */
+static inline
+unsigned cycle_counter_bucket(uint64_t count)
+{
+    unsigned msb = 0;
+
+    if (count < CYCLE_COUNTER_SUB_BUCKETS) {
+        return count;
+    }
+
+    msb = 63 - __builtin_clzll(count);
+
+    return (msb - CYCLE_COUNTER_SUB_BITS + 1) * CYCLE_COUNTER_SUB_BUCKETS +
+        ((count >> (msb - CYCLE_COUNTER_SUB_BITS)) & (CYCLE_COUNTER_SUB_BUCKETS - 1));
+}
+
+/**
+ * Add a count to this thread's histogram for the given counter. Only ever touches memory owned
+ * by the calling thread.
+ */
+void cycle_counter_record(enum cycle_counter ctr, uint64_t count);
+
+/**
+ * Write a summary of every thread's histograms, with percentiles in counts and nanoseconds.
+ * Threads keep counting while this runs, so a summary can be a count or two out.
+ */
+void cycle_counter_dump(FILE *fp);
+
+#define CYCLE_COUNT_START(_var) \
+    uint64_t _var = cycle_counter_read()
+
+#define CYCLE_COUNT_STOP(_ctr, _var) \
+    cycle_counter_record((_ctr), cycle_counter_read() - (_var))
+
+#else /* !defined(_CYCLE_COUNTERS) */
+
+static inline
+void cycle_counter_dump(FILE *fp)
+{
+}
+
+#define CYCLE_COUNT_START(_var)         do { } while (0)
+#define CYCLE_COUNT_STOP(_ctr, _var)    do { } while (0)
+
+#endif /* defined(_CYCLE_COUNTERS) */
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filter/complex.h>
+#include <filter/cycle_counter.h>
 
 #include <tsl/errors.h>
 #include <tsl/assert.h>
@@ -73,6 +74,8 @@ aresult_t dc_blocker_apply(struct dc_blocker *blocker, int16_t *samples, size_t
 {
     aresult_t ret = A_OK;
 
+    CYCLE_COUNT_START(cycles);
+
     TSL_ASSERT_ARG(NULL != blocker);
     TSL_ASSERT_ARG(NULL != samples);
     TSL_ASSERT_ARG(0 != nr_samples);
@@ -89,6 +92,8 @@ aresult_t dc_blocker_apply(struct dc_blocker *blocker, int16_t *samples, size_t
         samples[i] = blocker->y_n_1;
     }
 
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_DC_BLOCKER, cycles);
+
     return ret;
 }
 
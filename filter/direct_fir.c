@@ -22,7 +22,10 @@
 
 #include <filter/filter.h>
 #include <filter/direct_fir.h>
+#include <filter/cycle_counter.h>
 #include <filter/sample_buf.h>
+#include <filter/sample_ring.h>
+#include <filter/rotator.h>
 #include <filter/complex.h>
 
 #include <tsl/errors.h>
@@ -31,19 +34,31 @@
 #include <tsl/safe_alloc.h>
 
 #include <string.h>
-#include <math.h>
-#include <complex.h>
 
 #if defined(_USE_ARM_NEON)
 /* Use ARM NEON because configuration told us to */
 #define _NEON_FIR_IMPLEMENTATION
+#elif defined(__AVX2__) || defined(__SSE4_1__)
+/* The compiler is targeting an x86 CPU with at least SSE4.1 (i.e. via -march=native) */
+#define _X86_FIR_IMPLEMENTATION
 #else
 #define _DIRECT_FIR_IMPLEMENTATION
 #endif /* determine which FIR implementation to use */
 
-aresult_t direct_fir_init(struct direct_fir *fir, size_t nr_coeffs, const int16_t *fir_real_coeff,
+static
+direct_fir_block_func_t _direct_fir_kernel_find(size_t nr_coeffs, unsigned decimate_factor,
+        enum direct_fir_symmetry symmetry);
+
+static
+enum direct_fir_symmetry _direct_fir_symmetry(const int16_t *c_re, const int16_t *c_im, size_t nr_coeffs);
+
+/**
+ * Prepare a FIR, either copying the coefficients or borrowing them.
+ */
+static
+aresult_t _direct_fir_init(struct direct_fir *fir, size_t nr_coeffs, const int16_t *fir_real_coeff,
         const int16_t *fir_imag_coeff, unsigned decimation_factor,
-        bool derotate, uint32_t sampling_rate, int32_t freq_shift)
+        bool derotate, uint32_t sampling_rate, int32_t freq_shift, bool shared)
 {
     aresult_t ret = A_OK;
 
@@ -53,45 +68,76 @@ aresult_t direct_fir_init(struct direct_fir *fir, size_t nr_coeffs, const int16_
     TSL_ASSERT_ARG(NULL != fir_imag_coeff);
     TSL_ASSERT_ARG(0 != decimation_factor);
 
-    DIAG("FIR: Preparing %zu coefficients, decimation by %u, with%s derotation, sampling rate = %u frequency_shift = %d",
-            nr_coeffs, decimation_factor, true == derotate ? "" : "out", sampling_rate, freq_shift);
+    DIAG("FIR: Preparing %zu %scoefficients, decimation by %u, with%s derotation, sampling rate = %u frequency_shift = %d",
+            nr_coeffs, true == shared ? "shared " : "", decimation_factor, true == derotate ? "" : "out",
+            sampling_rate, freq_shift);
 
     memset(fir, 0, sizeof(struct direct_fir));
 
-    TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->fir_real_coeff, nr_coeffs, sizeof(int16_t), 16));
-    memcpy(fir->fir_real_coeff, fir_real_coeff, nr_coeffs * sizeof(int16_t));
-    TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->fir_imag_coeff, nr_coeffs, sizeof(int16_t), 16));
-    memcpy(fir->fir_imag_coeff, fir_imag_coeff, nr_coeffs * sizeof(int16_t));
+    if (true == shared) {
+        /* Never written through; the owner of the coefficients keeps them alive and unchanged */
+        fir->fir_real_coeff = (int16_t *)fir_real_coeff;
+        fir->fir_imag_coeff = (int16_t *)fir_imag_coeff;
+        fir->shared_coeffs = true;
+    } else {
+        TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->fir_real_coeff, nr_coeffs, sizeof(int16_t), 16));
+        memcpy(fir->fir_real_coeff, fir_real_coeff, nr_coeffs * sizeof(int16_t));
+        TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->fir_imag_coeff, nr_coeffs, sizeof(int16_t), 16));
+        memcpy(fir->fir_imag_coeff, fir_imag_coeff, nr_coeffs * sizeof(int16_t));
+    }
+
+    /* Scratch space for stitching together windows that straddle two sample buffers */
+    TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->tail, 2 * nr_coeffs, 2 * sizeof(int16_t), 16));
 
     fir->decimate_factor = decimation_factor;
     fir->nr_coeffs = nr_coeffs;
+    fir->symmetry = _direct_fir_symmetry(fir_real_coeff, fir_imag_coeff, nr_coeffs);
+    fir->block = _direct_fir_kernel_find(nr_coeffs, decimation_factor, fir->symmetry);
+
+    if (DIRECT_FIR_ASYMMETRIC != fir->symmetry) {
+        DIAG("FIR: Coefficients are %ssymmetric, folding mirrored taps together",
+                DIRECT_FIR_CONJ_SYMMETRIC == fir->symmetry ? "conjugate " : "");
+    }
 
-    fir->rot_phase_re = 0;
-    fir->rot_phase_im = 0;
+    fir->derotate = derotate;
 
     if (true == derotate) {
-        double fwt0 = 2.0 * M_PI * (double)freq_shift / (double)sampling_rate,
-               q15 = 1ll << Q_15_SHIFT;
-        complex double derotate_incr = cexp(CMPLX(0, -fwt0 * (double)decimation_factor));
-        fir->rot_phase_incr_re = (int32_t)(creal(derotate_incr) * q15);
-        fir->rot_phase_incr_im = (int32_t)(cimag(derotate_incr) * q15);
-        fir->rot_phase_re = 1ul << Q_15_SHIFT;
-        fir->rot_phase_im = 0;
-        DIAG("Derotation factor: %f, %f (%08x, %08x -> %f, %f)", creal(derotate_incr), cimag(derotate_incr),
-                fir->rot_phase_incr_re, fir->rot_phase_incr_im,
-                (double)fir->rot_phase_incr_re/q15, (double)fir->rot_phase_incr_im/q15);
+        /* The derotator runs on the decimated output */
+        TSL_BUG_IF_FAILED(rotator_init(&fir->rot, sampling_rate, freq_shift, decimation_factor, true));
     }
 
-
     return ret;
 }
 
+aresult_t direct_fir_init(struct direct_fir *fir, size_t nr_coeffs, const int16_t *fir_real_coeff,
+        const int16_t *fir_imag_coeff, unsigned decimation_factor,
+        bool derotate, uint32_t sampling_rate, int32_t freq_shift)
+{
+    return _direct_fir_init(fir, nr_coeffs, fir_real_coeff, fir_imag_coeff, decimation_factor, derotate,
+            sampling_rate, freq_shift, false);
+}
+
+aresult_t direct_fir_init_shared(struct direct_fir *fir, size_t nr_coeffs, const int16_t *fir_real_coeff,
+        const int16_t *fir_imag_coeff, unsigned decimation_factor,
+        bool derotate, uint32_t sampling_rate, int32_t freq_shift)
+{
+    return _direct_fir_init(fir, nr_coeffs, fir_real_coeff, fir_imag_coeff, decimation_factor, derotate,
+            sampling_rate, freq_shift, true);
+}
+
 aresult_t direct_fir_cleanup(struct direct_fir *fir)
 {
     aresult_t ret = A_OK;
 
     TSL_ASSERT_ARG(NULL != fir);
 
+    if (true == fir->shared_coeffs) {
+        /* The coefficients belong to someone else */
+        fir->fir_real_coeff = NULL;
+        fir->fir_imag_coeff = NULL;
+        fir->shared_coeffs = false;
+    }
+
     if (NULL != fir->fir_real_coeff) {
         TFREE(fir->fir_real_coeff);
     }
@@ -100,6 +146,12 @@ aresult_t direct_fir_cleanup(struct direct_fir *fir)
         TFREE(fir->fir_imag_coeff);
     }
 
+    if (NULL != fir->tail) {
+        TFREE(fir->tail);
+    }
+
+    TSL_BUG_IF_FAILED(rotator_cleanup(&fir->rot));
+
     if (NULL != fir->sb_active) {
         sample_buf_decref(fir->sb_active);
         fir->sb_active = NULL;
@@ -146,309 +198,712 @@ done:
 }
 
 /**
- * Perform a phase derotation for the current sample.
+ * Multiply-accumulate the mirrored pairs of taps (k, nr_coeffs - 1 - k) for k from start up to
+ * the center of the filter, and the center tap itself if there is one. With c[k] = a + jb, a
+ * symmetric pair contributes c[k] * (x[k] + x[m]), and a conjugate symmetric pair contributes
+ * a * (x[k] + x[m]) + jb * (x[k] - x[m]); either takes four real multiplies, where the two taps
+ * would take eight. The sums are 32-bit wrapping, so the result matches _direct_fir_mac exactly.
  */
-static
-aresult_t _direct_fir_apply_derotation(struct direct_fir *fir, int32_t acc_re_in, int32_t acc_im_in,
-        int32_t *acc_re_out, int32_t *acc_im_out)
+static inline
+void _direct_fir_fold_pairs(const int16_t *samples, const int16_t *c_re, const int16_t *c_im,
+        size_t nr_coeffs, size_t start, bool conj, int32_t *pacc_re, int32_t *pacc_im)
 {
-    aresult_t ret = A_OK;
-
-    TSL_ASSERT_ARG_DEBUG(NULL != fir);
-    TSL_ASSERT_ARG_DEBUG(NULL != acc_re_out);
-    TSL_ASSERT_ARG_DEBUG(NULL != acc_im_out);
+    uint32_t acc_re = 0,
+             acc_im = 0;
+
+    for (size_t k = start; k < nr_coeffs / 2; k++) {
+        size_t m = nr_coeffs - 1 - k;
+        int32_t x_re = samples[2 * k],
+                x_im = samples[2 * k + 1],
+                y_re = samples[2 * m],
+                y_im = samples[2 * m + 1],
+                p_re = x_re + y_re,
+                p_im = x_im + y_im,
+                q_re = true == conj ? x_re - y_re : p_re,
+                q_im = true == conj ? x_im - y_im : p_im;
+        uint32_t a = (uint32_t)(int32_t)c_re[k],
+                 b = (uint32_t)(int32_t)c_im[k];
+
+        acc_re += a * (uint32_t)p_re - b * (uint32_t)q_im;
+        acc_im += a * (uint32_t)p_im + b * (uint32_t)q_re;
+    }
 
-    /* Apply the phase derotation to the sample */
-    cmul_q15_q30(acc_re_in, acc_im_in, fir->rot_phase_re, fir->rot_phase_im,
-            acc_re_out, acc_im_out);
+    if (0 != (nr_coeffs & 1)) {
+        size_t mid = nr_coeffs / 2;
+        int32_t f_re = 0,
+                f_im = 0;
 
-    /* Now add the phase rotation increment to the phase rotation for the next sample */
-    cmul_q15_q15(fir->rot_phase_re, fir->rot_phase_im, fir->rot_phase_incr_re, fir->rot_phase_incr_im,
-            &fir->rot_phase_re, &fir->rot_phase_im);
+        cmul_q15_q30(c_re[mid], c_im[mid], samples[2 * mid], samples[2 * mid + 1], &f_re, &f_im);
 
-    fir->rot_counter++;
+        acc_re += (uint32_t)f_re;
+        acc_im += (uint32_t)f_im;
+    }
 
-    return ret;
+    *pacc_re += (int32_t)acc_re;
+    *pacc_im += (int32_t)acc_im;
 }
 
 #if defined(_NEON_FIR_IMPLEMENTATION)
 #include <arm_neon.h>
 
-static
-aresult_t _direct_fir_process_sample(struct direct_fir *fir, int16_t *psample_real, int16_t *psample_imag)
+/**
+ * Multiply-accumulate a contiguous run of interleaved complex Q.15 samples against the
+ * given coefficients, accumulating the Q.30 result in acc_re/acc_im.
+ */
+static inline
+void _direct_fir_mac(const int16_t *samples, const int16_t *c_re, const int16_t *c_im,
+        size_t nr_samples, int32_t *pacc_re, int32_t *pacc_im)
 {
-    aresult_t ret = A_OK;
+    size_t i = 0;
+    int32_t acc_re = 0,
+            acc_im = 0;
+
+    /* Temporary vector accumulators */
+    int32x4_t acc_re_v = { 0, 0, 0, 0 },
+              acc_im_v = { 0, 0, 0, 0 };
+
+    for (; i + 4 <= nr_samples; i += 4) {
+        /* Samples loaded at offset */
+        int16x4x2_t samp;
+        int32x4_t f_acc;
+        int16x4_t cr,
+                  ci;
+
+        __builtin_prefetch(samples + 2 * i);
+        __builtin_prefetch(c_re + i);
+        __builtin_prefetch(c_im + i);
+
+        samp = vld2_s16(samples + 2 * i);
+
+        /* cr = vec4(c_re + i) */
+        cr = vld1_s16(c_re + i);
+        /* ci = vec4(c_im + i) */
+        ci = vld1_s16(c_im + i);
+
+        /* f_re = s_re * c_re */
+        f_acc = vmull_s16(samp.val[0], cr);
+        /* f_re -= s_im * c_im */
+        f_acc = vmlsl_s16(f_acc, samp.val[1], ci);
+        acc_re_v = vaddq_s32(acc_re_v, f_acc);
+
+        /* f_im = s_im * c_re */
+        f_acc = vmull_s16(samp.val[1], cr);
+        /* f_im += c_im * s_re */
+        f_acc = vmlal_s16(f_acc, ci, samp.val[0]);
+        acc_im_v = vaddq_s32(acc_im_v, f_acc);
+    }
+
+    /* Reduce the accumulators */
+    acc_re = acc_re_v[0] + acc_re_v[1] + acc_re_v[2] + acc_re_v[3];
+    acc_im = acc_im_v[0] + acc_im_v[1] + acc_im_v[2] + acc_im_v[3];
+
+    /* Pick up the stragglers */
+    for (; i < nr_samples; i++) {
+        int32_t f_re = 0,
+                f_im = 0;
+
+        cmul_q15_q30(c_re[i], c_im[i], samples[2 * i], samples[2 * i + 1], &f_re, &f_im);
+
+        acc_re += f_re;
+        acc_im += f_im;
+    }
+
+    *pacc_re += acc_re;
+    *pacc_im += acc_im;
+}
+
+/**
+ * Multiply-accumulate a contiguous run of samples against symmetric or conjugate symmetric
+ * coefficients, as _direct_fir_fold_pairs does. Mirrored samples are added in 32-bit lanes
+ * before the multiply, so each vector multiply covers two taps.
+ */
+static inline
+void _direct_fir_mac_folded(const int16_t *samples, const int16_t *c_re, const int16_t *c_im,
+        size_t nr_coeffs, bool conj, int32_t *pacc_re, int32_t *pacc_im)
+{
+    size_t k = 0;
+    int32x4_t acc_re_v = vdupq_n_s32(0),
+              acc_im_v = vdupq_n_s32(0);
+
+    for (; k + 4 <= nr_coeffs / 2; k += 4) {
+        int16x4x2_t x = vld2_s16(samples + 2 * k),
+                    y = vld2_s16(samples + 2 * (nr_coeffs - 4 - k));
+        /* The mirrored samples, in the same order as the taps they pair with */
+        int16x4_t y_re = vrev64_s16(y.val[0]),
+                  y_im = vrev64_s16(y.val[1]);
+        int32x4_t p_re = vaddl_s16(x.val[0], y_re),
+                  p_im = vaddl_s16(x.val[1], y_im),
+                  q_re = true == conj ? vsubl_s16(x.val[0], y_re) : p_re,
+                  q_im = true == conj ? vsubl_s16(x.val[1], y_im) : p_im,
+                  a = vmovl_s16(vld1_s16(c_re + k)),
+                  b = vmovl_s16(vld1_s16(c_im + k));
+
+        acc_re_v = vmlaq_s32(acc_re_v, a, p_re);
+        acc_re_v = vmlsq_s32(acc_re_v, b, q_im);
+        acc_im_v = vmlaq_s32(acc_im_v, a, p_im);
+        acc_im_v = vmlaq_s32(acc_im_v, b, q_re);
+    }
 
-    size_t coeffs_remain = 0,
-           buf_offset = 0;
-    struct sample_buf *cur_buf = NULL;
+    *pacc_re += acc_re_v[0] + acc_re_v[1] + acc_re_v[2] + acc_re_v[3];
+    *pacc_im += acc_im_v[0] + acc_im_v[1] + acc_im_v[2] + acc_im_v[3];
+
+    _direct_fir_fold_pairs(samples, c_re, c_im, nr_coeffs, k, conj, pacc_re, pacc_im);
+}
+
+#elif defined(_X86_FIR_IMPLEMENTATION)
+#include <immintrin.h>
+
+/**
+ * Sum the four 32-bit lanes of an SSE register
+ */
+static inline
+int32_t _direct_fir_hsum_epi32(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
 
+/**
+ * Multiply-accumulate a contiguous run of interleaved complex Q.15 samples against the
+ * given coefficients, accumulating the Q.30 result in acc_re/acc_im.
+ *
+ * The samples are interleaved I/Q, so pmaddwd against interleaved (c_re, 0) and (0, c_im) pairs
+ * gives the two halves of the real product for each sample, and (c_im, c_re) pairs give the
+ * imaginary product directly. Negating c_im instead would save a multiply, but would not be
+ * exact for a coefficient of -32768. All sums are in 32-bit wrapping arithmetic, just like
+ * cmul_q15_q30, so the result is bit-exact with the scalar implementation.
+ */
+static inline
+void _direct_fir_mac(const int16_t *samples, const int16_t *c_re, const int16_t *c_im,
+        size_t nr_samples, int32_t *pacc_re, int32_t *pacc_im)
+{
+    size_t i = 0;
     int32_t acc_re = 0,
             acc_im = 0;
+    __m128i acc_re_v = _mm_setzero_si128(),
+            acc_im_v = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+
+#if defined(__AVX2__)
+    __m256i acc_re_w = _mm256_setzero_si256(),
+            acc_im_w = _mm256_setzero_si256();
+
+    for (; i + 8 <= nr_samples; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(samples + 2 * i)),
+                cr = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(c_re + i))),
+                ci = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(c_im + i))),
+                /* (c_re, 0), (0, c_im) and (c_im, c_re) pairs, one per sample */
+                cr_0 = cr,
+                _0_ci = _mm256_slli_epi32(ci, 16),
+                ci_cr = _mm256_or_si256(ci, _mm256_slli_epi32(cr, 16));
+
+        acc_re_w = _mm256_add_epi32(acc_re_w, _mm256_madd_epi16(s, cr_0));
+        acc_re_w = _mm256_sub_epi32(acc_re_w, _mm256_madd_epi16(s, _0_ci));
+        acc_im_w = _mm256_add_epi32(acc_im_w, _mm256_madd_epi16(s, ci_cr));
+    }
 
-    TSL_ASSERT_ARG_DEBUG(NULL != fir);
-    TSL_ASSERT_ARG_DEBUG(NULL != psample_real);
-    TSL_ASSERT_ARG_DEBUG(NULL != psample_imag);
-    TSL_BUG_ON(NULL == fir->sb_active);
+    acc_re_v = _mm_add_epi32(_mm256_castsi256_si128(acc_re_w), _mm256_extracti128_si256(acc_re_w, 1));
+    acc_im_v = _mm_add_epi32(_mm256_castsi256_si128(acc_im_w), _mm256_extracti128_si256(acc_im_w, 1));
+#endif /* defined(__AVX2__) */
+
+    for (; i + 4 <= nr_samples; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(samples + 2 * i)),
+                cr = _mm_loadl_epi64((const __m128i *)(c_re + i)),
+                ci = _mm_loadl_epi64((const __m128i *)(c_im + i)),
+                cr_0 = _mm_unpacklo_epi16(cr, zero),
+                _0_ci = _mm_unpacklo_epi16(zero, ci),
+                ci_cr = _mm_unpacklo_epi16(ci, cr);
+
+        acc_re_v = _mm_add_epi32(acc_re_v, _mm_madd_epi16(s, cr_0));
+        acc_re_v = _mm_sub_epi32(acc_re_v, _mm_madd_epi16(s, _0_ci));
+        acc_im_v = _mm_add_epi32(acc_im_v, _mm_madd_epi16(s, ci_cr));
+    }
 
-    coeffs_remain = fir->nr_coeffs;
-    cur_buf = fir->sb_active;
-    buf_offset = fir->sample_offset;
+    acc_re = _direct_fir_hsum_epi32(acc_re_v);
+    acc_im = _direct_fir_hsum_epi32(acc_im_v);
 
-    /* Check if we have enough samples available */
-    if (fir->sample_offset + fir->nr_coeffs > fir->sb_active->nr_samples && fir->sb_next == NULL) {
-        ret = A_E_DONE;
-        goto done;
-    }
+    /* Pick up the stragglers */
+    for (; i < nr_samples; i++) {
+        int32_t f_re = 0,
+                f_im = 0;
 
-    do {
-        /* Temporary vector accumulators */
-        int32x4_t acc_re_v = { 0, 0, 0, 0 },
-                  acc_im_v = { 0, 0, 0, 0 };
+        cmul_q15_q30(c_re[i], c_im[i], samples[2 * i], samples[2 * i + 1], &f_re, &f_im);
 
-        /* Figure out how many samples to pull out */
-        size_t nr_samples_in = cur_buf->nr_samples - buf_offset,
-               start_coeff = fir->nr_coeffs - coeffs_remain;
+        acc_re += f_re;
+        acc_im += f_im;
+    }
 
-        /* Snap to either the number of coefficients in the FIR or the number of remaining
-         * coefficients, whichever is smaller.
-         */
-        nr_samples_in = BL_MIN2(nr_samples_in, coeffs_remain);
+    *pacc_re += acc_re;
+    *pacc_im += acc_im;
+}
 
-        if (nr_samples_in != fir->nr_coeffs) {
-            DIAG("Samples from buffer %p: %zu, start coefficient: %zu (%zu remain) start offset %zu (of %u)",
-                    cur_buf, nr_samples_in, start_coeff, coeffs_remain, buf_offset, fir->sb_active->nr_samples);
+/**
+ * Multiply-accumulate a contiguous run of samples against symmetric or conjugate symmetric
+ * coefficients, as _direct_fir_fold_pairs does.
+ *
+ * Adding the mirrored samples first would need 32-bit multiplies, which cost more than pmaddwd
+ * saves. Instead, the mirrored samples are reversed into the same order as the taps they pair
+ * with, and both sets are multiplied by the same (a, -b) and (b, a) pairs (or, for the conjugate
+ * taps, (a, b) and (-b, a)). Each tap's coefficients are built only once, so four pmaddwd
+ * cover eight taps, against six for _direct_fir_mac. The folded kernels are never chosen if
+ * an imaginary coefficient is -32768, so negating one is always exact.
+ */
+static inline
+void _direct_fir_mac_folded(const int16_t *samples, const int16_t *c_re, const int16_t *c_im,
+        size_t nr_coeffs, bool conj, int32_t *pacc_re, int32_t *pacc_im)
+{
+    size_t k = 0;
+    const size_t nr_pairs = nr_coeffs / 2;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc_re_v = _mm_setzero_si128(),
+            acc_im_v = _mm_setzero_si128();
+
+#if defined(__AVX2__)
+    const __m256i reverse = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i acc_re_w = _mm256_setzero_si256(),
+            acc_im_w = _mm256_setzero_si256();
+
+    for (; k + 8 <= nr_pairs; k += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(c_re + k)),
+                b = _mm_loadu_si128((const __m128i *)(c_im + k)),
+                nb = _mm_sub_epi16(zero, b);
+        __m256i x = _mm256_loadu_si256((const __m256i *)(samples + 2 * k)),
+                y = _mm256_permutevar8x32_epi32(
+                        _mm256_loadu_si256((const __m256i *)(samples + 2 * (nr_coeffs - 8 - k))), reverse),
+                a_nb = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(a, nb)),
+                        _mm_unpackhi_epi16(a, nb), 1),
+                b_a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(b, a)),
+                        _mm_unpackhi_epi16(b, a), 1),
+                y_re = a_nb,
+                y_im = b_a;
+
+        if (true == conj) {
+            y_re = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(a, b)),
+                    _mm_unpackhi_epi16(a, b), 1);
+            y_im = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(nb, a)),
+                    _mm_unpackhi_epi16(nb, a), 1);
         }
 
-        for (size_t i = 0; i < nr_samples_in / 4; i++) {
-            size_t start_samp = i * 4;
-            int16_t *sample_base =
-                (int16_t *)((uint8_t *)cur_buf->data_buf + (sizeof(int16_t) * 2 * (buf_offset + start_samp)));
-
-            /* Samples loaded at offset */
-            int16x4x2_t samples;
-            int32x4_t f_acc;
-            int16x4_t c_re,
-                      c_im;
-
-            __builtin_prefetch(sample_base);
-            __builtin_prefetch(fir->fir_real_coeff + start_samp + start_coeff);
-            __builtin_prefetch(fir->fir_imag_coeff + start_samp + start_coeff);
-
-            samples = vld2_s16(sample_base);
-
-            /* c_re = vec4(fir_real_coeff + start_samp + start_coeff) */
-            c_re = vld1_s16(fir->fir_real_coeff + start_samp + start_coeff);
-            /* c_im = vec4(fir_imag_coeff + start_samp + start_coeff) */
-            c_im = vld1_s16(fir->fir_imag_coeff + start_samp + start_coeff);
-
-            /* f_re = s_re * c_re */
-            f_acc = vmull_s16(samples.val[0], c_re);
-            /* f_re -= s_im * c_im */
-            f_acc = vmlsl_s16(f_acc, samples.val[1], c_im);
-            acc_re_v = vaddq_s32(acc_re_v, f_acc);
-
-            /* f_im = s_im * c_re */
-            f_acc = vmull_s16(samples.val[1], c_re);
-            /* f_im += c_im * s_re */
-            f_acc = vmlal_s16(f_acc, c_im, samples.val[0]);
-            acc_im_v = vaddq_s32(acc_im_v, f_acc);
+        acc_re_w = _mm256_add_epi32(acc_re_w, _mm256_madd_epi16(x, a_nb));
+        acc_re_w = _mm256_add_epi32(acc_re_w, _mm256_madd_epi16(y, y_re));
+        acc_im_w = _mm256_add_epi32(acc_im_w, _mm256_madd_epi16(x, b_a));
+        acc_im_w = _mm256_add_epi32(acc_im_w, _mm256_madd_epi16(y, y_im));
+    }
+
+    acc_re_v = _mm_add_epi32(_mm256_castsi256_si128(acc_re_w), _mm256_extracti128_si256(acc_re_w, 1));
+    acc_im_v = _mm_add_epi32(_mm256_castsi256_si128(acc_im_w), _mm256_extracti128_si256(acc_im_w, 1));
+#endif /* defined(__AVX2__) */
+
+    for (; k + 4 <= nr_pairs; k += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(samples + 2 * k)),
+                y = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(samples + 2 * (nr_coeffs - 4 - k))),
+                        _MM_SHUFFLE(0, 1, 2, 3)),
+                a = _mm_loadl_epi64((const __m128i *)(c_re + k)),
+                b = _mm_loadl_epi64((const __m128i *)(c_im + k)),
+                nb = _mm_sub_epi16(zero, b),
+                a_nb = _mm_unpacklo_epi16(a, nb),
+                b_a = _mm_unpacklo_epi16(b, a),
+                y_re = true == conj ? _mm_unpacklo_epi16(a, b) : a_nb,
+                y_im = true == conj ? _mm_unpacklo_epi16(nb, a) : b_a;
+
+        acc_re_v = _mm_add_epi32(acc_re_v, _mm_madd_epi16(x, a_nb));
+        acc_re_v = _mm_add_epi32(acc_re_v, _mm_madd_epi16(y, y_re));
+        acc_im_v = _mm_add_epi32(acc_im_v, _mm_madd_epi16(x, b_a));
+        acc_im_v = _mm_add_epi32(acc_im_v, _mm_madd_epi16(y, y_im));
+    }
+
+    *pacc_re += _direct_fir_hsum_epi32(acc_re_v);
+    *pacc_im += _direct_fir_hsum_epi32(acc_im_v);
+
+    _direct_fir_fold_pairs(samples, c_re, c_im, nr_coeffs, k, conj, pacc_re, pacc_im);
+}
+
+#elif defined(_DIRECT_FIR_IMPLEMENTATION)
+/**
+ * Multiply-accumulate a contiguous run of interleaved complex Q.15 samples against the
+ * given coefficients, accumulating the Q.30 result in acc_re/acc_im.
+ */
+static inline
+void _direct_fir_mac(const int16_t *samples, const int16_t *c_re, const int16_t *c_im,
+        size_t nr_samples, int32_t *pacc_re, int32_t *pacc_im)
+{
+    int32_t acc_re = 0,
+            acc_im = 0;
+
+    for (size_t i = 0; i < nr_samples; i++) {
+        int32_t f_re = 0,
+                f_im = 0;
+
+        /* Filter the sample */
+        cmul_q15_q30(c_re[i], c_im[i], samples[2 * i], samples[2 * i + 1], &f_re, &f_im);
+
+        /* Accumulate the sample */
+        acc_re += f_re;
+        acc_im += f_im;
+    }
+
+    *pacc_re += acc_re;
+    *pacc_im += acc_im;
+}
+/**
+ * Multiply-accumulate a contiguous run of samples against symmetric or conjugate symmetric
+ * coefficients.
+ */
+static inline
+void _direct_fir_mac_folded(const int16_t *samples, const int16_t *c_re, const int16_t *c_im,
+        size_t nr_coeffs, bool conj, int32_t *pacc_re, int32_t *pacc_im)
+{
+    _direct_fir_fold_pairs(samples, c_re, c_im, nr_coeffs, 0, conj, pacc_re, pacc_im);
+}
+#else /* no FIR implementation defined */
+#error No FIR implementation has been defined.
+#endif /* _NEON_FIR_IMPLEMENTATION */
+
+/**
+ * Compute a run of decimated output samples from a contiguous run of input samples. The window
+ * for output i starts at sample (i * decimate_factor). Always inlined, so that the kernels below
+ * can fix the number of taps, the decimation and the symmetry at compile time.
+ */
+static inline
+void _direct_fir_block(const struct direct_fir *fir, const int16_t *samples, size_t nr_out, int16_t *out,
+        size_t nr_coeffs, unsigned decimate_factor, enum direct_fir_symmetry symmetry)
+{
+    for (size_t i = 0; i < nr_out; i++) {
+        const int16_t *window = samples + 2 * i * decimate_factor;
+        int32_t acc_re = 0,
+                acc_im = 0;
+
+        if (DIRECT_FIR_ASYMMETRIC == symmetry) {
+            _direct_fir_mac(window, fir->fir_real_coeff, fir->fir_imag_coeff, nr_coeffs, &acc_re, &acc_im);
+        } else {
+            _direct_fir_mac_folded(window, fir->fir_real_coeff, fir->fir_imag_coeff, nr_coeffs,
+                    DIRECT_FIR_CONJ_SYMMETRIC == symmetry, &acc_re, &acc_im);
         }
 
-        /* Reduce the accumulators */
-        acc_re += acc_re_v[0] + acc_re_v[1] + acc_re_v[2] + acc_re_v[3];
-        acc_im += acc_im_v[0] + acc_im_v[1] + acc_im_v[2] + acc_im_v[3];
+        /* Return the computed sample, in Q.15 (currently in Q.30 due to the prior multiplication) */
+        out[2 * i    ] = round_q30_q15(acc_re);
+        out[2 * i + 1] = round_q30_q15(acc_im);
+    }
+}
+
+/**
+ * Declare the kernels for a number of taps and decimation, one for each symmetry. With all
+ * three known, the compiler unrolls the multiply-accumulate completely, with no remainder
+ * handling.
+ */
+#define DIRECT_FIR_KERNEL(_name, _taps, _decim) \
+    static \
+    void _direct_fir_block_##_name(const struct direct_fir *fir, const int16_t *samples, \
+            size_t nr_out, int16_t *out) \
+    { \
+        _direct_fir_block(fir, samples, nr_out, out, _taps, _decim, DIRECT_FIR_ASYMMETRIC); \
+    } \
+    \
+    static \
+    void _direct_fir_block_##_name##_sym(const struct direct_fir *fir, const int16_t *samples, \
+            size_t nr_out, int16_t *out) \
+    { \
+        _direct_fir_block(fir, samples, nr_out, out, _taps, _decim, DIRECT_FIR_SYMMETRIC); \
+    } \
+    \
+    static \
+    void _direct_fir_block_##_name##_conj(const struct direct_fir *fir, const int16_t *samples, \
+            size_t nr_out, int16_t *out) \
+    { \
+        _direct_fir_block(fir, samples, nr_out, out, _taps, _decim, DIRECT_FIR_CONJ_SYMMETRIC); \
+    }
+
+/* The general kernels, for any number of taps and decimation */
+DIRECT_FIR_KERNEL(generic, fir->nr_coeffs, fir->decimate_factor)
 
-        size_t res_start = nr_samples_in & ~((size_t)4 - 1);
+/*
+ * The (taps, decimation) pairs we ship in etc/: the FLEX channel filters for 1 and 3 MHz
+ * receivers, and the POCSAG channel filters for 1.2 and 2.5 MHz receivers.
+ */
+DIRECT_FIR_KERNEL(128_40, 128, 40)
+DIRECT_FIR_KERNEL(512_120, 512, 120)
+DIRECT_FIR_KERNEL(256_25, 256, 25)
+DIRECT_FIR_KERNEL(256_100, 256, 100)
 
-        for (size_t i = 0; i < nr_samples_in % 4; i++) {
-            TSL_BUG_ON(i + res_start + start_coeff >= fir->nr_coeffs);
-            TSL_BUG_ON(i + res_start + buf_offset >= cur_buf->nr_samples);
-            DIAG("Processing sample %zu (base = %zu)", i + res_start, res_start);
+#define DIRECT_FIR_KERNEL_ENTRY(_name) \
+    { _direct_fir_block_##_name, _direct_fir_block_##_name##_sym, _direct_fir_block_##_name##_conj }
 
-            int16_t *sample = &((int16_t *)cur_buf->data_buf)[2 * (buf_offset + res_start + i)];
+static const
+struct direct_fir_kernel {
+    size_t nr_coeffs;
+    unsigned decimate_factor;
 
-            int32_t s_re = sample[0],
-                    s_im = sample[1],
-                    c_re = fir->fir_real_coeff[i + start_coeff + res_start],
-                    c_im = fir->fir_imag_coeff[i + start_coeff + res_start],
-                    f_re = 0,
-                    f_im = 0;
+    /**
+     * The kernels, indexed by enum direct_fir_symmetry
+     */
+    direct_fir_block_func_t block[3];
+} _direct_fir_kernels[] = {
+    { 128,  40, DIRECT_FIR_KERNEL_ENTRY(128_40) },
+    { 512, 120, DIRECT_FIR_KERNEL_ENTRY(512_120) },
+    { 256,  25, DIRECT_FIR_KERNEL_ENTRY(256_25) },
+    { 256, 100, DIRECT_FIR_KERNEL_ENTRY(256_100) },
+};
+
+static const
+direct_fir_block_func_t _direct_fir_kernels_generic[3] = DIRECT_FIR_KERNEL_ENTRY(generic);
 
-            /* Filter the sample */
-            cmul_q15_q30(c_re, c_im, s_re, s_im, &f_re, &f_im);
+/**
+ * Pick the kernel specialized for the FIR's length, decimation and symmetry, if there is one,
+ * or the general kernel for its symmetry otherwise.
+ */
+static
+direct_fir_block_func_t _direct_fir_kernel_find(size_t nr_coeffs, unsigned decimate_factor,
+        enum direct_fir_symmetry symmetry)
+{
+    for (size_t i = 0; i < sizeof(_direct_fir_kernels)/sizeof(_direct_fir_kernels[0]); i++) {
+        const struct direct_fir_kernel *kern = &_direct_fir_kernels[i];
 
-            /* Accumulate the sample */
-            acc_re += f_re;
-            acc_im += f_im;
+        if (kern->nr_coeffs == nr_coeffs && kern->decimate_factor == decimate_factor) {
+            DIAG("FIR: Using the kernel for %zu taps, decimating by %u", nr_coeffs, decimate_factor);
+            return kern->block[symmetry];
         }
+    }
+
+    return _direct_fir_kernels_generic[symmetry];
+}
+
+/**
+ * Work out whether the coefficients are symmetric, or conjugate symmetric, about the center tap.
+ * The folded kernels negate imaginary coefficients, so a set containing -32768 is never folded.
+ */
+static
+enum direct_fir_symmetry _direct_fir_symmetry(const int16_t *c_re, const int16_t *c_im, size_t nr_coeffs)
+{
+    bool sym = true,
+         conj = true;
 
-        /* If we iterate through, we'll start at the beginning of the next buffer */
-        buf_offset = 0;
-        cur_buf = fir->sb_next;
-        coeffs_remain -= nr_samples_in;
+    if (nr_coeffs < 2) {
+        return DIRECT_FIR_ASYMMETRIC;
+    }
+
+    for (size_t k = 0; k < nr_coeffs; k++) {
+        size_t m = nr_coeffs - 1 - k;
 
-        if (0 != coeffs_remain) {
-            DIAG("COEFF: %zu remain, buffer = %p (prev = %p), %zu samples in",
-                    coeffs_remain, cur_buf, fir->sb_active, nr_samples_in);
+        if (INT16_MIN == c_im[k] || c_re[k] != c_re[m]) {
+            return DIRECT_FIR_ASYMMETRIC;
         }
-    } while (0 != coeffs_remain);
 
-    /* Check if the next sample will start in the following buffer; if so, move along */
-    if (fir->sample_offset + fir->decimate_factor >= fir->sb_active->nr_samples) {
-        size_t cur_nr_samples = fir->sb_active->nr_samples;
+        sym = sym && c_im[k] == c_im[m];
+        conj = conj && (int32_t)c_im[k] == -(int32_t)c_im[m];
+    }
 
-        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_active));
+    return true == sym ? DIRECT_FIR_SYMMETRIC :
+        true == conj ? DIRECT_FIR_CONJ_SYMMETRIC : DIRECT_FIR_ASYMMETRIC;
+}
 
-        fir->sb_active = fir->sb_next;
-        fir->sb_next = NULL;
-        fir->sample_offset = (fir->sample_offset + fir->decimate_factor) - cur_nr_samples;
-    } else {
-        fir->sample_offset += fir->decimate_factor;
+/**
+ * Compute a run of decimated output samples from a contiguous run of input samples, and
+ * derotate them if need be.
+ *
+ * \param fir The FIR
+ * \param samples The interleaved complex input samples. Must hold at least
+ *                ((nr_out - 1) * decimate_factor + nr_coeffs) samples.
+ * \param nr_out The number of output samples to compute
+ * \param out The output buffer, interleaved I/Q
+ */
+static
+void _direct_fir_process_block(struct direct_fir *fir, const int16_t *samples, size_t nr_out, int16_t *out)
+{
+    fir->block(fir, samples, nr_out, out);
+
+    /* Apply the phase derotation to the whole block at once, if appropriate */
+    if (true == fir->derotate) {
+        TSL_BUG_IF_FAILED(rotator_apply(&fir->rot, out, out, nr_out));
     }
+}
 
-    fir->nr_samples -= fir->decimate_factor;
+/**
+ * The number of output samples whose windows start before the end of a run of nr_start samples,
+ * and end within nr_avail samples, starting from the beginning of the run.
+ */
+static inline
+size_t _direct_fir_nr_outputs(struct direct_fir *fir, size_t nr_start, size_t nr_avail)
+{
+    size_t nr_fit = 0;
 
-    /* Apply a phase (de)rotation, if appropriate */
-    if (!(0 == fir->rot_phase_incr_re && 0 == fir->rot_phase_incr_im)) {
-        /* Convert the accumulated sample to Q.15 */
-        TSL_BUG_IF_FAILED(_direct_fir_apply_derotation(fir, round_q30_q15(acc_re), round_q30_q15(acc_im),
-                    &acc_re, &acc_im));
+    if (nr_avail < fir->nr_coeffs || 0 == nr_start) {
+        return 0;
     }
 
-    /* Return the computed sample, in Q.15 (currently in Q.30 due to the prior multiplication) */
-    *psample_real = round_q30_q15(acc_re);
-    *psample_imag = round_q30_q15(acc_im);
+    nr_fit = (nr_avail - fir->nr_coeffs) / fir->decimate_factor + 1;
 
-done:
-    return ret;
+    return BL_MIN2(nr_fit, (nr_start - 1) / fir->decimate_factor + 1);
 }
 
-#elif defined(_DIRECT_FIR_IMPLEMENTATION)
+/**
+ * If the next output starts in the next sample buffer, release the active buffer and move on.
+ */
 static
-aresult_t _direct_fir_process_sample(struct direct_fir *fir, int16_t *psample_real, int16_t *psample_imag)
+void _direct_fir_advance(struct direct_fir *fir)
 {
-    aresult_t ret = A_OK;
+    while (NULL != fir->sb_active && fir->sample_offset >= fir->sb_active->nr_samples) {
+        size_t cur_nr_samples = fir->sb_active->nr_samples;
 
-    int32_t acc_re = 0,
-            acc_im = 0;
-    size_t coeffs_remain = 0,
-           buf_offset = 0;
-    struct sample_buf *cur_buf = NULL;
+        if (NULL == fir->sb_next && fir->sample_offset > cur_nr_samples) {
+            /* Wait until we know where the next output starts */
+            break;
+        }
 
-    TSL_ASSERT_ARG_DEBUG(NULL != fir);
-    TSL_ASSERT_ARG_DEBUG(NULL != psample_real);
-    TSL_ASSERT_ARG_DEBUG(NULL != psample_imag);
-
-    coeffs_remain = fir->nr_coeffs;
-    cur_buf = fir->sb_active;
-    buf_offset = fir->sample_offset;
-
-    /* Check if we have enough samples available */
-    if (fir->sample_offset + fir->nr_coeffs > fir->sb_active->nr_samples &&
-            fir->sb_next == NULL)
-    {
-        ret = A_E_DONE;
-        goto done;
+        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_active));
+
+        fir->sb_active = fir->sb_next;
+        fir->sb_next = NULL;
+        fir->sample_offset -= cur_nr_samples;
     }
+}
+
+aresult_t direct_fir_process(struct direct_fir *fir, int16_t *out_buf, size_t nr_out_samples,
+        size_t *nr_out_samples_generated)
+{
+    aresult_t ret = A_OK;
 
-    /* Walk the number of samples in the current buffer up to the filter size */
-    do {
-        /* Figure out how many samples to pull out */
-        size_t nr_samples_in = cur_buf->nr_samples - buf_offset,
-               start_coeff = fir->nr_coeffs - coeffs_remain;
+    size_t nr_out = 0;
 
-        /* Snap to either the number of coefficients in the FIR or the number of remaining
-         * coefficients, whichever is smaller.
-         */
-        nr_samples_in = BL_MIN2(nr_samples_in, coeffs_remain);
+    CYCLE_COUNT_START(cycles);
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != out_buf);
+    TSL_ASSERT_ARG(0 != nr_out_samples);
+    TSL_ASSERT_ARG(NULL != nr_out_samples_generated);
 
-        for (size_t i = 0; i < nr_samples_in; i++) {
-            TSL_BUG_ON(i + start_coeff >= fir->nr_coeffs);
-            TSL_BUG_ON(i + buf_offset >= cur_buf->nr_samples);
+    TSL_BUG_ON(NULL == fir->fir_real_coeff);
+    TSL_BUG_ON(NULL == fir->fir_imag_coeff);
+    TSL_BUG_ON(0 == fir->nr_coeffs);
+    TSL_BUG_ON(NULL == fir->block);
 
-            int16_t *sample = &((int16_t *)cur_buf->data_buf)[2 * (buf_offset + i)];
+    *nr_out_samples_generated = 0;
 
-            int32_t s_re = (int32_t)sample[0],
-                    s_im = (int32_t)sample[1],
-                    c_re = fir->fir_real_coeff[i + start_coeff],
-                    c_im = fir->fir_imag_coeff[i + start_coeff],
-                    f_re = 0,
-                    f_im = 0;
+    /* A buffer might have been pushed since we last stopped short of the end of the active buffer */
+    _direct_fir_advance(fir);
 
-            /* Filter the sample */
-            cmul_q15_q30(c_re, c_im, s_re, s_im, &f_re, &f_im);
+    while (nr_out < nr_out_samples && NULL != fir->sb_active) {
+        struct sample_buf *active = fir->sb_active,
+                          *next = fir->sb_next;
+        size_t nr_remain = 0,
+               nr_tail = 0,
+               nr_head = 0,
+               nr_block = 0;
 
-            /* Accumulate the sample */
-            acc_re += f_re;
-            acc_im += f_im;
+        if (fir->sample_offset >= active->nr_samples) {
+            /* The next output starts in a buffer we don't have yet */
+            break;
         }
 
-        /* If we iterate through, we'll start at the beginning of the next buffer */
-        buf_offset = 0;
-        cur_buf = fir->sb_next;
-        coeffs_remain -= nr_samples_in;
-    } while (coeffs_remain != 0);
+        nr_remain = active->nr_samples - fir->sample_offset;
 
-    /* Check if the next sample will start in the following buffer; if so, move along */
-    if (fir->sample_offset + fir->decimate_factor > fir->sb_active->nr_samples) {
-        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_active));
-        fir->sb_active = fir->sb_next;
-        fir->sb_next = NULL;
-        fir->sample_offset = (fir->sample_offset + fir->decimate_factor) - fir->sb_active->nr_samples;
-    } else {
-        fir->sample_offset += fir->decimate_factor;
-    }
+        /* 1. Process every window that lies entirely within the active buffer, in place */
+        nr_block = BL_MIN2(_direct_fir_nr_outputs(fir, nr_remain, nr_remain), nr_out_samples - nr_out);
+
+        if (0 != nr_block) {
+            _direct_fir_process_block(fir, (int16_t *)active->data_buf + 2 * fir->sample_offset, nr_block,
+                    out_buf + 2 * nr_out);
+            fir->nr_samples -= nr_block * fir->decimate_factor;
+            nr_out += nr_block;
+            fir->sample_offset += nr_block * fir->decimate_factor;
+            _direct_fir_advance(fir);
+            continue;
+        }
+
+        /* 2. The next window straddles the two buffers; we need the next buffer to proceed */
+        if (NULL == next) {
+            break;
+        }
+
+        /*
+         * Stitch the tail of the active buffer to the head of the next buffer, and process
+         * the windows that start in the active buffer. nr_remain is less than nr_coeffs here,
+         * so the tail buffer always has space.
+         */
+        nr_tail = nr_remain;
+        nr_head = BL_MIN2((size_t)next->nr_samples, fir->nr_coeffs - 1);
+
+        memcpy(fir->tail, (int16_t *)active->data_buf + 2 * fir->sample_offset, nr_tail * 2 * sizeof(int16_t));
+        memcpy(fir->tail + 2 * nr_tail, next->data_buf, nr_head * 2 * sizeof(int16_t));
 
-    fir->nr_samples -= fir->decimate_factor;
+        nr_block = BL_MIN2(_direct_fir_nr_outputs(fir, nr_tail, nr_tail + nr_head), nr_out_samples - nr_out);
 
-    /* Apply a phase rotation, if appropriate */
-    if (!(0 == fir->rot_phase_incr_re && 0 == fir->rot_phase_incr_im)) {
-        /* Convert the accumulated sample to Q.15 and apply derotation */
-        TSL_BUG_IF_FAILED(_direct_fir_apply_derotation(fir, round_q30_q15(acc_re), round_q30_q15(acc_im), &acc_re, &acc_im));
+        if (0 == nr_block) {
+            /* The next buffer is too short to complete the window */
+            break;
+        }
+
+        _direct_fir_process_block(fir, fir->tail, nr_block, out_buf + 2 * nr_out);
+        fir->nr_samples -= nr_block * fir->decimate_factor;
+        nr_out += nr_block;
+        fir->sample_offset += nr_block * fir->decimate_factor;
+        _direct_fir_advance(fir);
     }
 
-    /* Return the computed sample, in Q.15 (currently in Q.30 due to the prior multiplications) */
-    *psample_real = round_q30_q15(acc_re);
-    *psample_imag = round_q30_q15(acc_im);
+    *nr_out_samples_generated = nr_out;
+
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_DIRECT_FIR, cycles);
 
-done:
     return ret;
 }
-#else /* no FIR implementation defined */
-#error No FIR implementation has been defined.
-#endif /* _NEON_FIR_IMPLEMENTATION */
 
-aresult_t direct_fir_process(struct direct_fir *fir, int16_t *out_buf, size_t nr_out_samples,
-        size_t *nr_out_samples_generated)
+aresult_t direct_fir_process_ring(struct direct_fir *fir, struct sample_ring *ring, int16_t *out_buf,
+        size_t nr_out_samples, size_t *nr_out_samples_generated)
 {
     aresult_t ret = A_OK;
 
+    const void *ptr = NULL;
+    size_t nr_avail = 0,
+           nr_skip = 0,
+           nr_block = 0,
+           nr_advance = 0;
+
+    CYCLE_COUNT_START(cycles);
+
     TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != ring);
     TSL_ASSERT_ARG(NULL != out_buf);
     TSL_ASSERT_ARG(0 != nr_out_samples);
     TSL_ASSERT_ARG(NULL != nr_out_samples_generated);
+    TSL_ASSERT_ARG(2 * sizeof(int16_t) == ring->sample_bytes);
 
-    TSL_BUG_ON(NULL == fir->fir_real_coeff);
-    TSL_BUG_ON(NULL == fir->fir_imag_coeff);
-    TSL_BUG_ON(0 == fir->nr_coeffs);
+    TSL_BUG_ON(NULL != fir->sb_active);
 
     *nr_out_samples_generated = 0;
 
-    if (NULL == fir->sb_active && NULL == fir->sb_next) {
+    TSL_BUG_IF_FAILED(sample_ring_read_ptr(ring, &ptr, &nr_avail));
+
+    /* Skip whatever lies between the last window and the next, if we decimate by more than we have taps */
+    nr_skip = BL_MIN2((size_t)fir->sample_offset, nr_avail);
+    if (0 != nr_skip) {
+        TSL_BUG_IF_FAILED(sample_ring_consume(ring, nr_skip));
+        TSL_BUG_IF_FAILED(sample_ring_read_ptr(ring, &ptr, &nr_avail));
+        fir->sample_offset -= nr_skip;
+    }
+
+    if (0 != fir->sample_offset) {
         goto done;
     }
 
-    for (size_t i = 0; i < nr_out_samples; i++) {
-        if (A_E_DONE == _direct_fir_process_sample(fir, &out_buf[2 * i], &out_buf[2 * i + 1])) {
-            *nr_out_samples_generated = i;
-            goto done;
-        }
+    nr_block = BL_MIN2(_direct_fir_nr_outputs(fir, nr_avail, nr_avail), nr_out_samples);
+
+    if (0 == nr_block) {
+        goto done;
     }
 
-    *nr_out_samples_generated = nr_out_samples;
+    _direct_fir_process_block(fir, ptr, nr_block, out_buf);
+
+    /* Release everything up to the start of the next window */
+    nr_advance = nr_block * fir->decimate_factor;
+    nr_skip = BL_MIN2(nr_advance, nr_avail);
+    TSL_BUG_IF_FAILED(sample_ring_consume(ring, nr_skip));
+    fir->sample_offset = nr_advance - nr_skip;
+
+    *nr_out_samples_generated = nr_block;
 
 done:
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_DIRECT_FIR, cycles);
+
     return ret;
 }
 
@@ -1,10 +1,41 @@
 #pragma once
 
+#include <filter/rotator.h>
+
 #include <tsl/result.h>
 
 #include <stdbool.h>
 
 struct sample_buf;
+struct sample_ring;
+struct direct_fir;
+
+/**
+ * Symmetries in the coefficients of a direct FIR that let it fold mirrored taps together
+ */
+enum direct_fir_symmetry {
+    /**
+     * No usable symmetry; one complex multiply per tap
+     */
+    DIRECT_FIR_ASYMMETRIC = 0,
+
+    /**
+     * c[N - 1 - k] == c[k], as for a linear phase low pass filter
+     */
+    DIRECT_FIR_SYMMETRIC = 1,
+
+    /**
+     * c[N - 1 - k] == conj(c[k]), as for a linear phase low pass filter shifted about its center tap
+     */
+    DIRECT_FIR_CONJ_SYMMETRIC = 2,
+};
+
+/**
+ * Computes nr_out decimated output samples from a contiguous run of interleaved I/Q samples.
+ * Either the general kernel, or one unrolled for a particular length and decimation.
+ */
+typedef void (*direct_fir_block_func_t)(const struct direct_fir *fir, const int16_t *samples, size_t nr_out,
+        int16_t *out);
 
 struct direct_fir {
     /**
@@ -17,6 +48,11 @@ struct direct_fir {
      */
     int16_t *fir_imag_coeff;
 
+    /**
+     * Whether the coefficients are borrowed from their owner, rather than held by this FIR
+     */
+    bool shared_coeffs;
+
     /**
      * The number of coefficients in this FIR
      */
@@ -28,7 +64,19 @@ struct direct_fir {
     unsigned decimate_factor;
 
     /**
-     * The offset of the next sample to be processed, in sb_active
+     * The symmetry found in the coefficients, if any
+     */
+    enum direct_fir_symmetry symmetry;
+
+    /**
+     * The kernel that computes a block of outputs, picked to match nr_coeffs, decimate_factor and
+     * symmetry
+     */
+    direct_fir_block_func_t block;
+
+    /**
+     * The offset of the next sample to be processed, in sb_active. When reading from a
+     * sample_ring, the number of samples still to be skipped before the next window starts.
      */
     unsigned sample_offset;
 
@@ -48,34 +96,29 @@ struct direct_fir {
     struct sample_buf *sb_next;
 
     /**
-     * The real part of the Q.15 rotation phase increment
-     */
-    int16_t rot_phase_incr_re;
-
-    /**
-     * The imaginary part of the Q.15 rotaiton phase increment
-     */
-    int16_t rot_phase_incr_im;
-
-    /**
-     * The real part of the Q.15 rotation factor to be applied to each sample
+     * Whether or not to derotate the output
      */
-    int16_t rot_phase_re;
+    bool derotate;
 
     /**
-     * The imaginary part of the Q.15 rotation factor to be applied to each sample
+     * The derotator, applied to each block of output samples
      */
-    int16_t rot_phase_im;
+    struct rotator rot;
 
     /**
-     * The rotation counter.
+     * Contiguous scratch space, interleaved I/Q, for the windows that straddle sb_active and
+     * sb_next. Holds the tail of sb_active followed by the head of sb_next; all other windows
+     * are computed in place.
      */
-    unsigned rot_counter;
+    int16_t *tail;
 };
 
 /**
  * Create a direct coefficient FIR, in Q.15. This function allocates memory.
  *
+ * If the coefficients are symmetric or conjugate symmetric about the center tap, each pair of
+ * mirrored taps is computed together, halving the multiplies a linear phase filter needs.
+ *
  * \param fir The FIR object. Pass a chunk of memory by reference.
  * \param nr_coeffs The number of coefficients in the FIR
  * \param fir_real_coeff The real coefficients for the FIR
@@ -94,6 +137,27 @@ aresult_t direct_fir_init(struct direct_fir *fir, size_t nr_coeffs, const int16_
         const int16_t *fir_imag_coeff, unsigned decimation_factor,
         bool derotate, uint32_t sampling_rate, int32_t freq_shift);
 
+/**
+ * Create a direct coefficient FIR that reads its coefficients in place, rather than keeping its
+ * own copy. Lets many FIRs with the same coefficients share one copy of them. Otherwise the same
+ * as direct_fir_init.
+ *
+ * \param fir The FIR object. Pass a chunk of memory by reference.
+ * \param nr_coeffs The number of coefficients in the FIR
+ * \param fir_real_coeff The real coefficients for the FIR. Must stay valid and unchanged until
+ *                       the FIR is cleaned up. Should be aligned to a cache line.
+ * \param fir_imag_coeff The imaginary coefficients for the FIR, as for fir_real_coeff
+ * \param decimation_factor The decimation factor to apply
+ * \param derotate Set to `true` if you wish to apply a derotator.
+ * \param sampling_rate The sampling rate. Ignored if not using the phase derotator.
+ * \param freq_shift The shift to derotate by, in Hz. Ignored if not using the phase derotator.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t direct_fir_init_shared(struct direct_fir *fir, size_t nr_coeffs, const int16_t *fir_real_coeff,
+        const int16_t *fir_imag_coeff, unsigned decimation_factor,
+        bool derotate, uint32_t sampling_rate, int32_t freq_shift);
+
 /**
  * Cleanup memory and release sample buffers for the FIR
  *
@@ -118,6 +182,10 @@ aresult_t direct_fir_push_sample_buf(struct direct_fir *fir, struct sample_buf *
  * 1. The number of samples available (must be at least the FIR width of samples)
  * 2. The number of output buffer samples
  *
+ * Outputs are computed a block at a time: every window that lies within the active sample buffer
+ * is computed in a single pass, and only the few windows that straddle two buffers are
+ * copied into contiguous scratch space first.
+ *
  * \param fir The FIR to apply
  * \param out_buf The buffer to write the output samples to
  * \param nr_out_samples The maximum number of output samples out_buf can hold
@@ -128,6 +196,23 @@ aresult_t direct_fir_push_sample_buf(struct direct_fir *fir, struct sample_buf *
 aresult_t direct_fir_process(struct direct_fir *fir, int16_t *out_buf, size_t nr_out_samples,
         size_t *nr_output_samples_generated);
 
+/**
+ * Apply the FIR to samples in a sample ring of complex 16-bit samples, rather than to pushed
+ * sample buffers. Every window is contiguous in the ring, so there is never a seam to stitch.
+ * Samples are consumed from the ring as soon as no future window needs them. Don't mix this
+ * with direct_fir_push_sample_buf on the same FIR.
+ *
+ * \param fir The FIR to apply
+ * \param ring The ring to read samples from. Must have 4-byte samples.
+ * \param out_buf The buffer to write the output samples to
+ * \param nr_out_samples The maximum number of output samples out_buf can hold
+ * \param nr_output_samples_generated The number of valid samples in out_buf
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t direct_fir_process_ring(struct direct_fir *fir, struct sample_ring *ring, int16_t *out_buf,
+        size_t nr_out_samples, size_t *nr_output_samples_generated);
+
 /**
  * Determine whether or not an additional sample buffer can be passed to the FIR, for further
  * processing.
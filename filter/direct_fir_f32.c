@@ -0,0 +1,348 @@
+/*
+ *  direct_fir_f32.c - A direct FIR, with arbitrary complex coefficients, in floating point
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/direct_fir_f32.h>
+#include <filter/fir_f32_priv.h>
+#include <filter/sample_buf.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+
+/**
+ * How many output samples to derotate before pulling the derotator back onto the unit circle
+ */
+#define DIRECT_FIR_F32_RENORM_INTERVAL          1024
+
+aresult_t direct_fir_f32_init(struct direct_fir_f32 *fir, size_t nr_coeffs, const float *fir_real_coeff,
+        const float *fir_imag_coeff, unsigned decimation_factor,
+        bool derotate, uint32_t sampling_rate, int32_t freq_shift)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(0 != nr_coeffs);
+    TSL_ASSERT_ARG(NULL != fir_real_coeff);
+    TSL_ASSERT_ARG(NULL != fir_imag_coeff);
+    TSL_ASSERT_ARG(0 != decimation_factor);
+    TSL_ASSERT_ARG(false == derotate || 0 != sampling_rate);
+
+    DIAG("FIR(f32): Preparing %zu coefficients, decimation by %u, with%s derotation, sampling rate = %u frequency_shift = %d",
+            nr_coeffs, decimation_factor, true == derotate ? "" : "out", sampling_rate, freq_shift);
+
+    memset(fir, 0, sizeof(struct direct_fir_f32));
+
+    /* Write each coefficient out twice, so the MAC can run straight down the interleaved samples */
+    TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->fir_real_coeff, 2 * nr_coeffs, sizeof(float), 32));
+    TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->fir_imag_coeff, 2 * nr_coeffs, sizeof(float), 32));
+
+    for (size_t i = 0; i < nr_coeffs; i++) {
+        fir->fir_real_coeff[2 * i] = fir->fir_real_coeff[2 * i + 1] = fir_real_coeff[i];
+        fir->fir_imag_coeff[2 * i] = fir->fir_imag_coeff[2 * i + 1] = fir_imag_coeff[i];
+    }
+
+    /* Scratch space for stitching together windows that straddle two sample buffers */
+    TSL_BUG_IF_FAILED(TACALLOC((void **)&fir->tail, 2 * nr_coeffs, 2 * sizeof(float), 32));
+
+    fir->decimate_factor = decimation_factor;
+    fir->nr_coeffs = nr_coeffs;
+    fir->derotate = derotate;
+    fir->rot_phase = 1.0;
+    fir->rot_phase_incr = 1.0;
+
+    if (true == derotate) {
+        double fwt0 = 2.0 * M_PI * (double)freq_shift / (double)sampling_rate;
+        fir->rot_phase_incr = cexp(CMPLX(0, -fwt0 * (double)decimation_factor));
+        DIAG("Derotation factor: %f, %f", creal(fir->rot_phase_incr), cimag(fir->rot_phase_incr));
+    }
+
+    return ret;
+}
+
+aresult_t direct_fir_f32_cleanup(struct direct_fir_f32 *fir)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+
+    if (NULL != fir->fir_real_coeff) {
+        TFREE(fir->fir_real_coeff);
+    }
+
+    if (NULL != fir->fir_imag_coeff) {
+        TFREE(fir->fir_imag_coeff);
+    }
+
+    if (NULL != fir->tail) {
+        TFREE(fir->tail);
+    }
+
+    if (NULL != fir->sb_active) {
+        sample_buf_decref(fir->sb_active);
+        fir->sb_active = NULL;
+    }
+
+    if (NULL != fir->sb_next) {
+        sample_buf_decref(fir->sb_next);
+        fir->sb_next = NULL;
+    }
+
+    fir->decimate_factor = 0;
+
+    return ret;
+}
+
+aresult_t direct_fir_f32_push_sample_buf(struct direct_fir_f32 *fir, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != buf);
+
+    TSL_BUG_ON(fir->sb_active == buf);
+    TSL_BUG_ON(fir->sb_next == buf);
+
+    if (COMPLEX_FLOAT_32 != buf->sample_type) {
+        DIAG("FIR(f32): sample buffer %p has sample type %d, expected complex floats", buf, buf->sample_type);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (NULL == fir->sb_active) {
+        fir->sb_active = buf;
+        TSL_BUG_ON(NULL != fir->sb_next);
+    } else {
+        if (NULL == fir->sb_next) {
+            fir->sb_next = buf;
+        } else {
+            ret = A_E_BUSY;
+            goto done;
+        }
+    }
+
+    DIAG("PUSH(active = %p next = %p)", fir->sb_active, fir->sb_next);
+
+    fir->nr_samples += buf->nr_samples;
+
+done:
+    return ret;
+}
+
+/**
+ * Compute a run of decimated output samples from a contiguous run of input samples. The window
+ * for output i starts at sample (i * decimate_factor).
+ *
+ * \param fir The FIR
+ * \param samples The interleaved complex input samples. Must hold at least
+ *                ((nr_out - 1) * decimate_factor + nr_coeffs) samples.
+ * \param nr_out The number of output samples to compute
+ * \param out The output buffer, interleaved I/Q
+ */
+static
+void _direct_fir_f32_process_block(struct direct_fir_f32 *fir, const float *samples, size_t nr_out, float *out)
+{
+    for (size_t i = 0; i < nr_out; i++) {
+        const float *window = samples + 2 * i * fir->decimate_factor;
+        float re_re = 0.0f,
+              re_im = 0.0f,
+              im_re = 0.0f,
+              im_im = 0.0f;
+        double complex acc;
+
+        /* (x_re * c_re, x_im * c_re) and (x_re * c_im, x_im * c_im) */
+        fir_f32_mac(window, fir->fir_real_coeff, 2 * fir->nr_coeffs, &re_re, &re_im);
+        fir_f32_mac(window, fir->fir_imag_coeff, 2 * fir->nr_coeffs, &im_re, &im_im);
+
+        if (false == fir->derotate) {
+            out[2 * i    ] = re_re - im_im;
+            out[2 * i + 1] = re_im + im_re;
+            continue;
+        }
+
+        /* Apply the phase derotation to the sample, and step the derotator */
+        acc = CMPLX(re_re - im_im, re_im + im_re) * fir->rot_phase;
+        out[2 * i    ] = (float)creal(acc);
+        out[2 * i + 1] = (float)cimag(acc);
+
+        fir->rot_phase *= fir->rot_phase_incr;
+
+        /* Rounding error accumulates in the magnitude of the derotator, so periodically undo it */
+        if (++fir->rot_counter == DIRECT_FIR_F32_RENORM_INTERVAL) {
+            fir->rot_phase /= cabs(fir->rot_phase);
+            fir->rot_counter = 0;
+        }
+    }
+
+    fir->nr_samples -= nr_out * fir->decimate_factor;
+}
+
+/**
+ * The number of output samples whose windows start before the end of a run of nr_start samples,
+ * and end within nr_avail samples, starting from the beginning of the run.
+ */
+static inline
+size_t _direct_fir_f32_nr_outputs(struct direct_fir_f32 *fir, size_t nr_start, size_t nr_avail)
+{
+    size_t nr_fit = 0;
+
+    if (nr_avail < fir->nr_coeffs || 0 == nr_start) {
+        return 0;
+    }
+
+    nr_fit = (nr_avail - fir->nr_coeffs) / fir->decimate_factor + 1;
+
+    return BL_MIN2(nr_fit, (nr_start - 1) / fir->decimate_factor + 1);
+}
+
+/**
+ * If the next output starts in the next sample buffer, release the active buffer and move on.
+ */
+static
+void _direct_fir_f32_advance(struct direct_fir_f32 *fir)
+{
+    while (NULL != fir->sb_active && fir->sample_offset >= fir->sb_active->nr_samples) {
+        size_t cur_nr_samples = fir->sb_active->nr_samples;
+
+        if (NULL == fir->sb_next && fir->sample_offset > cur_nr_samples) {
+            /* Wait until we know where the next output starts */
+            break;
+        }
+
+        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_active));
+
+        fir->sb_active = fir->sb_next;
+        fir->sb_next = NULL;
+        fir->sample_offset -= cur_nr_samples;
+    }
+}
+
+aresult_t direct_fir_f32_process(struct direct_fir_f32 *fir, float *out_buf, size_t nr_out_samples,
+        size_t *nr_out_samples_generated)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != out_buf);
+    TSL_ASSERT_ARG(0 != nr_out_samples);
+    TSL_ASSERT_ARG(NULL != nr_out_samples_generated);
+
+    TSL_BUG_ON(NULL == fir->fir_real_coeff);
+    TSL_BUG_ON(NULL == fir->fir_imag_coeff);
+    TSL_BUG_ON(0 == fir->nr_coeffs);
+
+    *nr_out_samples_generated = 0;
+
+    /* A buffer might have been pushed since we last stopped short of the end of the active buffer */
+    _direct_fir_f32_advance(fir);
+
+    while (nr_out < nr_out_samples && NULL != fir->sb_active) {
+        struct sample_buf *active = fir->sb_active,
+                          *next = fir->sb_next;
+        size_t nr_remain = 0,
+               nr_tail = 0,
+               nr_head = 0,
+               nr_block = 0;
+
+        if (fir->sample_offset >= active->nr_samples) {
+            /* The next output starts in a buffer we don't have yet */
+            break;
+        }
+
+        nr_remain = active->nr_samples - fir->sample_offset;
+
+        /* 1. Process every window that lies entirely within the active buffer, in place */
+        nr_block = BL_MIN2(_direct_fir_f32_nr_outputs(fir, nr_remain, nr_remain), nr_out_samples - nr_out);
+
+        if (0 != nr_block) {
+            _direct_fir_f32_process_block(fir, (float *)active->data_buf + 2 * fir->sample_offset, nr_block,
+                    out_buf + 2 * nr_out);
+            nr_out += nr_block;
+            fir->sample_offset += nr_block * fir->decimate_factor;
+            _direct_fir_f32_advance(fir);
+            continue;
+        }
+
+        /* 2. The next window straddles the two buffers; we need the next buffer to proceed */
+        if (NULL == next) {
+            break;
+        }
+
+        /* Stitch the tail of the active buffer to the head of the next, as in direct_fir_process */
+        nr_tail = nr_remain;
+        nr_head = BL_MIN2((size_t)next->nr_samples, fir->nr_coeffs - 1);
+
+        memcpy(fir->tail, (float *)active->data_buf + 2 * fir->sample_offset, nr_tail * 2 * sizeof(float));
+        memcpy(fir->tail + 2 * nr_tail, next->data_buf, nr_head * 2 * sizeof(float));
+
+        nr_block = BL_MIN2(_direct_fir_f32_nr_outputs(fir, nr_tail, nr_tail + nr_head), nr_out_samples - nr_out);
+
+        if (0 == nr_block) {
+            /* The next buffer is too short to complete the window */
+            break;
+        }
+
+        _direct_fir_f32_process_block(fir, fir->tail, nr_block, out_buf + 2 * nr_out);
+        nr_out += nr_block;
+        fir->sample_offset += nr_block * fir->decimate_factor;
+        _direct_fir_f32_advance(fir);
+    }
+
+    *nr_out_samples_generated = nr_out;
+
+    return ret;
+}
+
+aresult_t direct_fir_f32_can_process(struct direct_fir_f32 *fir, bool *pcan_process, size_t *pest_count)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != pcan_process);
+
+    *pcan_process = fir->nr_samples >= fir->nr_coeffs;
+
+    if (NULL != pest_count) {
+        *pest_count = fir->nr_samples/fir->nr_coeffs;
+    }
+
+    return ret;
+}
+
+aresult_t direct_fir_f32_full(struct direct_fir_f32 *fir, bool *pfull)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != fir);
+    TSL_ASSERT_ARG_DEBUG(NULL != pfull);
+
+    *pfull = (NULL != fir->sb_next);
+
+    return ret;
+}
+
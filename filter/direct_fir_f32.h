@@ -0,0 +1,162 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <complex.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct sample_buf;
+
+/**
+ * A floating point counterpart to the direct_fir, for COMPLEX_FLOAT_32 sample buffers. The
+ * push/process semantics are the same as those of the direct_fir; only the sample and
+ * coefficient representation differs. Nothing is requantized between stages, so any number of
+ * floating point filters can be chained without losing precision.
+ */
+struct direct_fir_f32 {
+    /**
+     * Real coefficients, each written out twice (see fir_f32_mac)
+     */
+    float *fir_real_coeff;
+
+    /**
+     * Imaginary coefficients, each written out twice
+     */
+    float *fir_imag_coeff;
+
+    /**
+     * The number of coefficients in this FIR
+     */
+    size_t nr_coeffs;
+
+    /**
+     * Decimation factor. Determines how we walk through the sample buffer.
+     */
+    unsigned decimate_factor;
+
+    /**
+     * The offset of the next sample to be processed, in sb_active
+     */
+    size_t sample_offset;
+
+    /**
+     * The total, pre-decimation number of samples available in the input buffers.
+     */
+    size_t nr_samples;
+
+    /**
+     * Active sample buffer being processed
+     */
+    struct sample_buf *sb_active;
+
+    /**
+     * Next sample buffer to be processed, if it's available
+     */
+    struct sample_buf *sb_next;
+
+    /**
+     * Whether or not to derotate the output
+     */
+    bool derotate;
+
+    /**
+     * The derotation applied to each successive output sample
+     */
+    double complex rot_phase_incr;
+
+    /**
+     * The derotation to apply to the next output sample
+     */
+    double complex rot_phase;
+
+    /**
+     * Output samples since the derotator was last renormalized
+     */
+    unsigned rot_counter;
+
+    /**
+     * Contiguous scratch space, interleaved I/Q, for the windows that straddle sb_active and
+     * sb_next
+     */
+    float *tail;
+};
+
+/**
+ * Create a floating point direct FIR. This function allocates memory.
+ *
+ * \param fir The FIR object. Pass a chunk of memory by reference.
+ * \param nr_coeffs The number of coefficients in the FIR
+ * \param fir_real_coeff The real coefficients for the FIR
+ * \param fir_imag_coeff The imaginary coefficients for the FIR
+ * \param decimation_factor The decimation factor to apply
+ * \param derotate Set to `true` if you wish to apply a derotator. Useful if the filter will
+ *                 shift a signal to baseband.
+ * \param sampling_rate The sampling rate. Used to manage the phase derotator. Ignored if not
+ *                      using the phase derotator.
+ * \param freq_shift If the filter will be downshifting another signal to baseband, how much
+ *                   is this shift by, in Hz. Ignored if not using the phase derotator.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t direct_fir_f32_init(struct direct_fir_f32 *fir, size_t nr_coeffs, const float *fir_real_coeff,
+        const float *fir_imag_coeff, unsigned decimation_factor,
+        bool derotate, uint32_t sampling_rate, int32_t freq_shift);
+
+/**
+ * Cleanup memory and release sample buffers for the FIR
+ *
+ * \param fir The FIR to cleanup.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t direct_fir_f32_cleanup(struct direct_fir_f32 *fir);
+
+/**
+ * Push an updated sample buffer.
+ *
+ * \param fir The FIR
+ * \param buf The buffer to push onto the queue. Must hold COMPLEX_FLOAT_32 samples.
+ *
+ * \return A_OK on success, A_E_BUSY if two buffers are already queued, A_E_INVAL if the buffer
+ *         holds some other kind of sample.
+ */
+aresult_t direct_fir_f32_push_sample_buf(struct direct_fir_f32 *fir, struct sample_buf *buf);
+
+/**
+ * Apply the FIR to as many samples as possible, constrained by the samples available and the
+ * space in the output buffer.
+ *
+ * \param fir The FIR to apply
+ * \param out_buf The buffer to write the interleaved I/Q output samples to
+ * \param nr_out_samples The maximum number of output samples out_buf can hold
+ * \param nr_output_samples_generated The number of valid samples in out_buf
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t direct_fir_f32_process(struct direct_fir_f32 *fir, float *out_buf, size_t nr_out_samples,
+        size_t *nr_output_samples_generated);
+
+/**
+ * Determine whether or not an additional sample buffer can be passed to the FIR.
+ *
+ * \param fir The FIR in question
+ * \param pfull Whether or not the FIR has space for an extra sample buffer, returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t direct_fir_f32_full(struct direct_fir_f32 *fir, bool *pfull);
+
+/**
+ * Determine whether or not there are enough samples available to produce at least one filtered,
+ * decimated sample.
+ *
+ * \param fir The FIR in question
+ * \param pcan_process Whether or not one filtered sample can be produced, returned by reference.
+ * \param pest_count The estimated count of samples that could be produced. Optional.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t direct_fir_f32_can_process(struct direct_fir_f32 *fir, bool *pcan_process, size_t *pest_count);
+
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A power gate with hysteresis, for skipping the work on a channel while there's nothing on it.
+ * The gate opens once the mean power of a block of complex samples reaches the open level, and
+ * closes once the power has stayed below the (lower) close level for the hold time.
+ *
+ * Levels are relative to full scale: a full scale complex tone, with I^2 + Q^2 = 2^30, is 0 dBFS.
+ */
+struct energy_gate {
+    /**
+     * Mean I^2 + Q^2 at or above which the gate opens
+     */
+    uint64_t open_level;
+
+    /**
+     * Mean I^2 + Q^2 below which the gate starts to close
+     */
+    uint64_t close_level;
+
+    /**
+     * How long the power has to stay below close_level before the gate closes, in samples
+     */
+    uint64_t hold_samples;
+
+    /**
+     * How much of the hold time is left, in samples
+     */
+    uint64_t hold_left;
+
+    /**
+     * Whether the gate is open
+     */
+    bool open;
+};
+
+/**
+ * Convert a level in dBFS to a mean I^2 + Q^2
+ */
+static inline
+uint64_t _energy_gate_level(double dbfs)
+{
+    return (uint64_t)llrint(pow(10.0, dbfs / 10.0) * (double)(1ull << 30));
+}
+
+/**
+ * Initialize a gate. The gate starts out closed.
+ *
+ * \param gate The gate state
+ * \param open_dbfs The level the gate opens at, in dBFS
+ * \param close_dbfs The level the gate starts to close below, in dBFS. No higher than open_dbfs.
+ * \param hold_samples How long the power has to stay below close_dbfs for the gate to close
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+static inline
+aresult_t energy_gate_init(struct energy_gate *gate, double open_dbfs, double close_dbfs, uint64_t hold_samples)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != gate);
+    TSL_ASSERT_ARG(open_dbfs <= 0.0);
+    TSL_ASSERT_ARG(close_dbfs <= open_dbfs);
+
+    memset(gate, 0, sizeof(*gate));
+
+    gate->open_level = _energy_gate_level(open_dbfs);
+    gate->close_level = _energy_gate_level(close_dbfs);
+    gate->hold_samples = hold_samples;
+
+    return ret;
+}
+
+/**
+ * Estimate the mean power of a block of complex samples.
+ *
+ * \param iq Interleaved I/Q samples
+ * \param nr_samples The number of complex samples
+ *
+ * \return The mean I^2 + Q^2, 0 for an empty block
+ */
+static inline
+uint64_t energy_gate_power(const int16_t *iq, size_t nr_samples)
+{
+    uint64_t acc = 0;
+
+    if (0 == nr_samples) {
+        return 0;
+    }
+
+    /* Each square fits in 31 bits; only the sum needs to be wider */
+    for (size_t i = 0; i < 2 * nr_samples; i++) {
+        acc += (uint32_t)((int32_t)iq[i] * (int32_t)iq[i]);
+    }
+
+    return acc / nr_samples;
+}
+
+/**
+ * Update a gate with a block of complex samples.
+ *
+ * \param gate The gate state
+ * \param iq Interleaved I/Q samples
+ * \param nr_samples The number of complex samples
+ *
+ * \return true if the block should be processed, false if it can be skipped
+ */
+static inline
+bool energy_gate_update(struct energy_gate *gate, const int16_t *iq, size_t nr_samples)
+{
+    uint64_t power = energy_gate_power(iq, nr_samples);
+
+    if (false == gate->open) {
+        if (power >= gate->open_level) {
+            gate->open = true;
+            gate->hold_left = gate->hold_samples;
+        }
+    } else if (power >= gate->close_level) {
+        gate->hold_left = gate->hold_samples;
+    } else if (gate->hold_left > nr_samples) {
+        gate->hold_left -= nr_samples;
+    } else {
+        gate->hold_left = 0;
+        gate->open = false;
+    }
+
+    return gate->open;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+
+#if defined(_USE_ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+/**
+ * The inner loop of the floating point filters: sum x[k] * c[k] over nr values, keeping the
+ * sums over even and odd k apart. With interleaved I/Q samples and coefficients that have each
+ * been written out twice, the even sum is the I part and the odd sum is the Q part of the
+ * product, so the same loop serves real and complex samples alike.
+ *
+ * Uses FMA where the compiler targets it (AVX2 class x86, or ARMv8), and plain vector
+ * multiply-adds otherwise. The results are not bit-identical between paths, since the order
+ * of the additions differs.
+ */
+static inline
+void fir_f32_mac(const float *x, const float *c, size_t nr, float *peven, float *podd)
+{
+    size_t i = 0;
+    float even = 0.0f,
+          odd = 0.0f;
+
+#if defined(_USE_ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+
+    for (; i + 4 <= nr; i += 4) {
+#if defined(__aarch64__)
+        acc = vfmaq_f32(acc, vld1q_f32(x + i), vld1q_f32(c + i));
+#else
+        acc = vmlaq_f32(acc, vld1q_f32(x + i), vld1q_f32(c + i));
+#endif
+    }
+
+    even = vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 2);
+    odd = vgetq_lane_f32(acc, 1) + vgetq_lane_f32(acc, 3);
+#elif defined(__AVX__)
+    __m256 acc_a = _mm256_setzero_ps(),
+           acc_b = _mm256_setzero_ps();
+    float lanes[8];
+
+    /* Two accumulators, to hide the latency of the multiply-add */
+    for (; i + 16 <= nr; i += 16) {
+#if defined(__FMA__)
+        acc_a = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(c + i), acc_a);
+        acc_b = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(c + i + 8), acc_b);
+#else
+        acc_a = _mm256_add_ps(acc_a, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(c + i)));
+        acc_b = _mm256_add_ps(acc_b, _mm256_mul_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(c + i + 8)));
+#endif
+    }
+
+    for (; i + 8 <= nr; i += 8) {
+        acc_a = _mm256_add_ps(acc_a, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(c + i)));
+    }
+
+    _mm256_storeu_ps(lanes, _mm256_add_ps(acc_a, acc_b));
+
+    even = lanes[0] + lanes[2] + lanes[4] + lanes[6];
+    odd = lanes[1] + lanes[3] + lanes[5] + lanes[7];
+#endif /* Vector implementations */
+
+    /* Pick up the stragglers */
+    for (; i < nr; i++) {
+        if (0 == (i & 1)) {
+            even += x[i] * c[i];
+        } else {
+            odd += x[i] * c[i];
+        }
+    }
+
+    *peven += even;
+    *podd += odd;
+}
+
@@ -0,0 +1,255 @@
+/*
+ *  halfband.c - Cascaded half-band decimators for complex Q.15 samples
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/halfband.h>
+#include <filter/sample_convert.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <string.h>
+
+/**
+ * The center tap of the filter
+ */
+#define HALFBAND_MID                    ((HALFBAND_NR_TAPS - 1) / 2)
+
+/**
+ * The number of non-zero taps on each side of the center tap
+ */
+#define HALFBAND_NR_SIDE_TAPS           ((HALFBAND_MID + 1) / 2)
+
+/**
+ * Q.15 value of the center tap. Every other even tap of a half-band filter is 0.
+ */
+#define HALFBAND_CENTER_COEFF           16384
+
+/**
+ * The odd taps, working outwards from the center tap. Kaiser-windowed (beta = 5.65), 0.2/0.3
+ * band edges, normalized for unity gain at DC.
+ */
+static const
+int16_t _halfband_coeffs[HALFBAND_NR_SIDE_TAPS] = {
+    10357, -3261, 1742, -1041, 632, -372, 206, -102, 42, -11
+};
+
+static inline
+int16_t _halfband_saturate(int32_t acc)
+{
+    acc = (acc + (1 << 14)) >> 15;
+
+    if (acc > INT16_MAX) {
+        acc = INT16_MAX;
+    } else if (acc < INT16_MIN) {
+        acc = INT16_MIN;
+    }
+
+    return (int16_t)acc;
+}
+
+/**
+ * Filter everything in the stage's work buffer that a full window can be formed for, keeping
+ * the rest around for the next call.
+ *
+ * \return The number of complex samples written to out
+ */
+static
+size_t _halfband_stage_run(struct halfband_stage *st, int16_t *out)
+{
+    size_t start = 0,
+           nr_out = 0;
+
+    for (start = 0; start + HALFBAND_NR_TAPS <= st->nr_work; start += 2) {
+        const int16_t *win = st->work + 2 * start;
+        int32_t acc_i = HALFBAND_CENTER_COEFF * (int32_t)win[2 * HALFBAND_MID],
+                acc_q = HALFBAND_CENTER_COEFF * (int32_t)win[2 * HALFBAND_MID + 1];
+
+        /* Fold the symmetric taps, so each coefficient is only multiplied once */
+        for (size_t k = 0; k < HALFBAND_NR_SIDE_TAPS; k++) {
+            size_t before = 2 * (HALFBAND_MID - (2 * k + 1)),
+                   after = 2 * (HALFBAND_MID + (2 * k + 1));
+
+            acc_i += _halfband_coeffs[k] * ((int32_t)win[before] + (int32_t)win[after]);
+            acc_q += _halfband_coeffs[k] * ((int32_t)win[before + 1] + (int32_t)win[after + 1]);
+        }
+
+        out[2 * nr_out    ] = _halfband_saturate(acc_i);
+        out[2 * nr_out + 1] = _halfband_saturate(acc_q);
+        nr_out++;
+    }
+
+    memmove(st->work, st->work + 2 * start, (st->nr_work - start) * 2 * sizeof(int16_t));
+    st->nr_work -= start;
+
+    return nr_out;
+}
+
+/**
+ * Run the samples just added to the first stage's work buffer through the whole cascade.
+ */
+static
+size_t _halfband_decimator_run(struct halfband_decimator *hb, int16_t *out)
+{
+    size_t nr_out = 0;
+
+    for (unsigned i = 0; i < hb->nr_stages; i++) {
+        if (i + 1 == hb->nr_stages) {
+            nr_out = _halfband_stage_run(&hb->stages[i], out);
+        } else {
+            struct halfband_stage *next = &hb->stages[i + 1];
+            next->nr_work += _halfband_stage_run(&hb->stages[i], next->work + 2 * next->nr_work);
+        }
+    }
+
+    return nr_out;
+}
+
+aresult_t halfband_decimator_init(struct halfband_decimator *hb, unsigned decimation)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != hb);
+
+    memset(hb, 0, sizeof(*hb));
+
+    switch (decimation) {
+    case 1:
+        hb->nr_stages = 0;
+        break;
+    case 2:
+        hb->nr_stages = 1;
+        break;
+    case 4:
+        hb->nr_stages = 2;
+        break;
+    case 8:
+        hb->nr_stages = 3;
+        break;
+    default:
+        DIAG("Half-band decimation factor must be 1, 2, 4 or 8 (got %u)", decimation);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    for (unsigned i = 0; i < hb->nr_stages; i++) {
+        if (FAILED(ret = TACALLOC((void **)&hb->stages[i].work, HALFBAND_NR_TAPS + HALFBAND_CHUNK_SAMPLES,
+                        2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH)))
+        {
+            goto done;
+        }
+    }
+
+done:
+    if (FAILED(ret)) {
+        halfband_decimator_cleanup(hb);
+    }
+
+    return ret;
+}
+
+aresult_t halfband_decimator_cleanup(struct halfband_decimator *hb)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != hb);
+
+    for (unsigned i = 0; i < HALFBAND_MAX_STAGES; i++) {
+        if (NULL != hb->stages[i].work) {
+            TFREE(hb->stages[i].work);
+        }
+        hb->stages[i].nr_work = 0;
+    }
+
+    hb->nr_stages = 0;
+
+    return ret;
+}
+
+aresult_t halfband_decimator_process(struct halfband_decimator *hb, const int16_t *in, size_t nr_in,
+        int16_t *out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != hb);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_out);
+
+    if (0 == hb->nr_stages) {
+        memcpy(out, in, nr_in * 2 * sizeof(int16_t));
+        nr_out = nr_in;
+        goto done;
+    }
+
+    for (size_t offs = 0; offs < nr_in; offs += HALFBAND_CHUNK_SAMPLES) {
+        struct halfband_stage *first = &hb->stages[0];
+        size_t nr_chunk = BL_MIN2(nr_in - offs, HALFBAND_CHUNK_SAMPLES);
+
+        memcpy(first->work + 2 * first->nr_work, in + 2 * offs, nr_chunk * 2 * sizeof(int16_t));
+        first->nr_work += nr_chunk;
+
+        nr_out += _halfband_decimator_run(hb, out + 2 * nr_out);
+    }
+
+done:
+    *pnr_out = nr_out;
+    return ret;
+}
+
+aresult_t halfband_decimator_process_u8(struct halfband_decimator *hb, const uint8_t *in, size_t nr_in,
+        int16_t *out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != hb);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_out);
+
+    if (0 == hb->nr_stages) {
+        TSL_BUG_IF_FAILED(sample_convert_u8_to_q15(out, in, nr_in * 2));
+        nr_out = nr_in;
+        goto done;
+    }
+
+    for (size_t offs = 0; offs < nr_in; offs += HALFBAND_CHUNK_SAMPLES) {
+        struct halfband_stage *first = &hb->stages[0];
+        size_t nr_chunk = BL_MIN2(nr_in - offs, HALFBAND_CHUNK_SAMPLES);
+
+        /* Convert straight into the first stage's work buffer, rather than a full rate sample buffer */
+        TSL_BUG_IF_FAILED(sample_convert_u8_to_q15(first->work + 2 * first->nr_work, in + 2 * offs, nr_chunk * 2));
+        first->nr_work += nr_chunk;
+
+        nr_out += _halfband_decimator_run(hb, out + 2 * nr_out);
+    }
+
+done:
+    *pnr_out = nr_out;
+    return ret;
+}
+
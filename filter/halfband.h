@@ -0,0 +1,100 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Number of taps in each half-band stage
+ */
+#define HALFBAND_NR_TAPS                39
+
+/**
+ * The most half-band stages that can be cascaded, for a decimation factor of up to 8
+ */
+#define HALFBAND_MAX_STAGES             3
+
+/**
+ * Number of input samples converted and filtered at a time, so the working set of each stage
+ * stays in cache.
+ */
+#define HALFBAND_CHUNK_SAMPLES          2048
+
+/**
+ * A single decimate-by-2 half-band stage. Works on interleaved complex Q.15 samples.
+ */
+struct halfband_stage {
+    /**
+     * Interleaved I/Q samples waiting to be filtered. Samples left over from the last call are
+     * kept at the start of the buffer, new samples are appended after them.
+     */
+    int16_t *work;
+
+    /**
+     * Number of complex samples in the work buffer
+     */
+    size_t nr_work;
+};
+
+/**
+ * A cascade of half-band filters, decimating complex samples by a power of 2. Each stage
+ * passes 0 to 0.2 of its input rate flat, and puts aliases from 0.3 and above at least 58dB
+ * down.
+ */
+struct halfband_decimator {
+    /**
+     * The stages, in order from the full rate input
+     */
+    struct halfband_stage stages[HALFBAND_MAX_STAGES];
+
+    /**
+     * The number of stages in use. If 0, samples are passed through unchanged.
+     */
+    unsigned nr_stages;
+};
+
+/**
+ * Initialize a half-band decimator cascade.
+ *
+ * \param hb The decimator
+ * \param decimation The overall decimation factor. Must be 1, 2, 4 or 8.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t halfband_decimator_init(struct halfband_decimator *hb, unsigned decimation);
+
+/**
+ * Clean up the resources held by a half-band decimator.
+ */
+aresult_t halfband_decimator_cleanup(struct halfband_decimator *hb);
+
+/**
+ * Decimate a block of interleaved complex Q.15 samples.
+ *
+ * \param hb The decimator
+ * \param in The input samples
+ * \param nr_in The number of complex input samples
+ * \param out The output buffer. Must have space for nr_in / decimation + 1 complex samples.
+ * \param pnr_out The number of complex samples written to out, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t halfband_decimator_process(struct halfband_decimator *hb, const int16_t *in, size_t nr_in,
+        int16_t *out, size_t *pnr_out);
+
+/**
+ * Convert a block of interleaved complex unsigned 8-bit samples to Q.15 and decimate them, in
+ * one pass, so the full rate Q.15 samples never leave the cache.
+ *
+ * \param hb The decimator
+ * \param in The input samples, as unsigned 8-bit I/Q pairs
+ * \param nr_in The number of complex input samples
+ * \param out The output buffer. Must have space for nr_in / decimation + 1 complex samples.
+ * \param pnr_out The number of complex samples written to out, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t halfband_decimator_process_u8(struct halfband_decimator *hb, const uint8_t *in, size_t nr_in,
+        int16_t *out, size_t *pnr_out);
+
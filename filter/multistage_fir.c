@@ -0,0 +1,521 @@
+/*
+ *  multistage_fir.c - Multi-stage CIC, half-band and FIR decimating channel filter
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/multistage_fir.h>
+#include <filter/sample_buf.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of frequency points per coefficient used when designing the final FIR
+ */
+#define MULTISTAGE_DESIGN_GRID              16
+
+static inline
+int16_t _multistage_saturate(int64_t v)
+{
+    if (v > INT16_MAX) {
+        v = INT16_MAX;
+    } else if (v < INT16_MIN) {
+        v = INT16_MIN;
+    }
+
+    return (int16_t)v;
+}
+
+static
+uint64_t _multistage_gcd(uint64_t a, uint64_t b)
+{
+    while (0 != b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/**
+ * Build one period of the oscillator that mixes the channel at freq_shift down to baseband.
+ * The period of an offset that is a whole number of Hz divides the sample rate; if that is too
+ * long, use the nearest offset that repeats every MULTISTAGE_NCO_MAX_PERIOD samples instead.
+ */
+static
+aresult_t _multistage_fir_nco_prepare(struct multistage_fir *fir, uint32_t sampling_rate, int32_t freq_shift)
+{
+    aresult_t ret = A_OK;
+
+    uint64_t shift = (uint64_t)llabs((long long)freq_shift),
+             period = 0;
+    double cycles = 0.0;
+
+    period = sampling_rate / _multistage_gcd(sampling_rate, shift);
+    cycles = (double)freq_shift * (double)period / (double)sampling_rate;
+
+    if (period > MULTISTAGE_NCO_MAX_PERIOD) {
+        period = MULTISTAGE_NCO_MAX_PERIOD;
+        cycles = round((double)freq_shift * (double)period / (double)sampling_rate);
+        DIAG("Offset %d Hz does not repeat often enough, mixing at %f Hz instead", freq_shift,
+                cycles * (double)sampling_rate / (double)period);
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&fir->nco, period, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < period; i++) {
+        double complex rot = cexp(CMPLX(0, -2.0 * M_PI * cycles * (double)i / (double)period));
+
+        fir->nco[2 * i    ] = (int16_t)lrint(creal(rot) * INT16_MAX);
+        fir->nco[2 * i + 1] = (int16_t)lrint(cimag(rot) * INT16_MAX);
+    }
+
+    fir->nco_period = period;
+    fir->nco_phase = 0;
+
+done:
+    return ret;
+}
+
+aresult_t multistage_fir_init(struct multistage_fir *fir, uint32_t sampling_rate, int32_t freq_shift,
+        unsigned cic_decimation, unsigned hb_decimation,
+        size_t nr_comp_coeffs, const int16_t *comp_coeffs, unsigned comp_decimation)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(0 != sampling_rate);
+    TSL_ASSERT_ARG(0 != nr_comp_coeffs);
+    TSL_ASSERT_ARG(NULL != comp_coeffs);
+    TSL_ASSERT_ARG(0 != comp_decimation);
+
+    memset(fir, 0, sizeof(*fir));
+
+    if (2 > cic_decimation || MULTISTAGE_CIC_MAX_DECIMATION < cic_decimation) {
+        DIAG("CIC decimation must be between 2 and %u (got %u)", MULTISTAGE_CIC_MAX_DECIMATION, cic_decimation);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = halfband_decimator_init(&fir->hb, hb_decimation))) {
+        goto done;
+    }
+
+    if (FAILED(ret = _multistage_fir_nco_prepare(fir, sampling_rate, freq_shift))) {
+        goto done;
+    }
+
+    fir->cic_decimation = cic_decimation;
+    fir->cic_scale = 1.0 / pow((double)cic_decimation, MULTISTAGE_CIC_ORDER);
+    fir->hb_decimation = hb_decimation;
+
+    if (FAILED(ret = TACALLOC((void **)&fir->cic_out, MULTISTAGE_CHUNK_SAMPLES / cic_decimation + 1,
+                    2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&fir->comp_coeffs, nr_comp_coeffs, sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    memcpy(fir->comp_coeffs, comp_coeffs, nr_comp_coeffs * sizeof(int16_t));
+    fir->nr_comp_coeffs = nr_comp_coeffs;
+    fir->comp_decimation = comp_decimation;
+
+    /* Grown as needed when buffers are pushed */
+    fir->work_cap = nr_comp_coeffs + MULTISTAGE_CHUNK_SAMPLES;
+    if (FAILED(ret = TACALLOC((void **)&fir->work, fir->work_cap, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+done:
+    if (FAILED(ret)) {
+        multistage_fir_cleanup(fir);
+    }
+
+    return ret;
+}
+
+aresult_t multistage_fir_cleanup(struct multistage_fir *fir)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+
+    if (NULL != fir->sb_last) {
+        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_last));
+        fir->sb_last = NULL;
+    }
+
+    if (NULL != fir->nco) {
+        TFREE(fir->nco);
+    }
+
+    if (NULL != fir->cic_out) {
+        TFREE(fir->cic_out);
+    }
+
+    if (NULL != fir->comp_coeffs) {
+        TFREE(fir->comp_coeffs);
+    }
+
+    if (NULL != fir->work) {
+        TFREE(fir->work);
+    }
+
+    TSL_BUG_IF_FAILED(halfband_decimator_cleanup(&fir->hb));
+
+    fir->nr_work = 0;
+    fir->work_offset = 0;
+
+    return ret;
+}
+
+/**
+ * Mix a chunk of samples to baseband and run them through the CIC.
+ *
+ * \return The number of complex samples written to out
+ */
+static
+size_t _multistage_fir_cic(struct multistage_fir *fir, const int16_t *in, size_t nr_in, int16_t *out)
+{
+    const unsigned decimation = fir->cic_decimation;
+    uint64_t i0 = fir->cic_integ[0][0], q0 = fir->cic_integ[1][0],
+             i1 = fir->cic_integ[0][1], q1 = fir->cic_integ[1][1],
+             i2 = fir->cic_integ[0][2], q2 = fir->cic_integ[1][2],
+             i3 = fir->cic_integ[0][3], q3 = fir->cic_integ[1][3];
+    size_t phase = fir->nco_phase,
+           nr_out = 0;
+    unsigned cic_phase = fir->cic_phase;
+
+    for (size_t n = 0; n < nr_in; n++) {
+        int32_t x_i = in[2 * n],
+                x_q = in[2 * n + 1],
+                c_i = fir->nco[2 * phase],
+                c_q = fir->nco[2 * phase + 1];
+        int32_t m_i = (x_i * c_i - x_q * c_q + (1 << 14)) >> 15,
+                m_q = (x_i * c_q + x_q * c_i + (1 << 14)) >> 15;
+
+        if (++phase == fir->nco_period) {
+            phase = 0;
+        }
+
+        /* Integrators, in wrapping unsigned arithmetic */
+        i0 += (uint64_t)(int64_t)m_i; i1 += i0; i2 += i1; i3 += i2;
+        q0 += (uint64_t)(int64_t)m_q; q1 += q0; q2 += q1; q3 += q2;
+
+        if (++cic_phase == decimation) {
+            uint64_t v_i = i3,
+                     v_q = q3;
+
+            cic_phase = 0;
+
+            /* Combs, at the decimated rate */
+            for (size_t s = 0; s < MULTISTAGE_CIC_ORDER; s++) {
+                uint64_t d_i = v_i - fir->cic_comb[0][s],
+                         d_q = v_q - fir->cic_comb[1][s];
+                fir->cic_comb[0][s] = v_i;
+                fir->cic_comb[1][s] = v_q;
+                v_i = d_i;
+                v_q = d_q;
+            }
+
+            out[2 * nr_out    ] = _multistage_saturate(llrint((double)(int64_t)v_i * fir->cic_scale));
+            out[2 * nr_out + 1] = _multistage_saturate(llrint((double)(int64_t)v_q * fir->cic_scale));
+            nr_out++;
+        }
+    }
+
+    fir->cic_integ[0][0] = i0; fir->cic_integ[1][0] = q0;
+    fir->cic_integ[0][1] = i1; fir->cic_integ[1][1] = q1;
+    fir->cic_integ[0][2] = i2; fir->cic_integ[1][2] = q2;
+    fir->cic_integ[0][3] = i3; fir->cic_integ[1][3] = q3;
+    fir->nco_phase = phase;
+    fir->cic_phase = cic_phase;
+
+    return nr_out;
+}
+
+/**
+ * Drop the samples the final FIR is done with, and make sure there's space for nr_new more.
+ */
+static
+aresult_t _multistage_fir_work_reserve(struct multistage_fir *fir, size_t nr_new)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_drop = BL_MIN2(fir->work_offset, fir->nr_work);
+    int16_t *work = NULL;
+
+    memmove(fir->work, fir->work + 2 * nr_drop, (fir->nr_work - nr_drop) * 2 * sizeof(int16_t));
+    fir->nr_work -= nr_drop;
+    fir->work_offset -= nr_drop;
+
+    if (fir->nr_work + nr_new <= fir->work_cap) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&work, 2 * (fir->nr_work + nr_new), 2 * sizeof(int16_t),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    memcpy(work, fir->work, fir->nr_work * 2 * sizeof(int16_t));
+    TFREE(fir->work);
+    fir->work = work;
+    fir->work_cap = 2 * (fir->nr_work + nr_new);
+
+done:
+    return ret;
+}
+
+aresult_t multistage_fir_push_sample_buf(struct multistage_fir *fir, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    const int16_t *samples = NULL;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != buf);
+
+    TSL_BUG_ON(fir->sb_last == buf);
+
+    /* The CIC produces at most one sample per cic_decimation inputs, and each half-band stage at most one more
+     * than half of what it is given
+     */
+    if (FAILED(ret = _multistage_fir_work_reserve(fir,
+                    buf->nr_samples / fir->cic_decimation + 1 + HALFBAND_MAX_STAGES)))
+    {
+        goto done;
+    }
+
+    samples = (const int16_t *)buf->data_buf;
+
+    for (size_t offs = 0; offs < buf->nr_samples; offs += MULTISTAGE_CHUNK_SAMPLES) {
+        size_t nr_chunk = BL_MIN2(buf->nr_samples - offs, MULTISTAGE_CHUNK_SAMPLES),
+               nr_cic = 0,
+               nr_hb = 0;
+        int16_t *tail = fir->work + 2 * fir->nr_work;
+
+        /* Without a half-band cascade, the CIC can write straight into the final FIR's input */
+        if (1 == fir->hb_decimation) {
+            fir->nr_work += _multistage_fir_cic(fir, samples + 2 * offs, nr_chunk, tail);
+            continue;
+        }
+
+        nr_cic = _multistage_fir_cic(fir, samples + 2 * offs, nr_chunk, fir->cic_out);
+        TSL_BUG_IF_FAILED(halfband_decimator_process(&fir->hb, fir->cic_out, nr_cic, tail, &nr_hb));
+        fir->nr_work += nr_hb;
+    }
+
+    TSL_BUG_ON(fir->nr_work > fir->work_cap);
+
+    if (NULL != fir->sb_last) {
+        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_last));
+    }
+
+    fir->sb_last = buf;
+
+done:
+    return ret;
+}
+
+aresult_t multistage_fir_process(struct multistage_fir *fir, int16_t *out_buf, size_t nr_out_samples,
+        size_t *nr_output_samples_generated)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0,
+           offset = 0,
+           nr_coeffs = 0;
+    const int16_t *coeffs = NULL;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != out_buf);
+    TSL_ASSERT_ARG(NULL != nr_output_samples_generated);
+
+    offset = fir->work_offset;
+    nr_coeffs = fir->nr_comp_coeffs;
+    coeffs = fir->comp_coeffs;
+
+    while (nr_out < nr_out_samples && offset + nr_coeffs <= fir->nr_work) {
+        const int16_t *win = fir->work + 2 * offset;
+        int64_t acc_i = 0,
+                acc_q = 0;
+
+        for (size_t k = 0; k < nr_coeffs; k++) {
+            acc_i += (int32_t)coeffs[k] * (int32_t)win[2 * k    ];
+            acc_q += (int32_t)coeffs[k] * (int32_t)win[2 * k + 1];
+        }
+
+        out_buf[2 * nr_out    ] = _multistage_saturate((acc_i + (1 << 14)) >> 15);
+        out_buf[2 * nr_out + 1] = _multistage_saturate((acc_q + (1 << 14)) >> 15);
+
+        nr_out++;
+        offset += fir->comp_decimation;
+    }
+
+    fir->work_offset = offset;
+    *nr_output_samples_generated = nr_out;
+
+    return ret;
+}
+
+aresult_t multistage_fir_can_process(struct multistage_fir *fir, bool *pcan_process, size_t *pest_count)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_avail = 0;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != pcan_process);
+
+    if (fir->work_offset + fir->nr_comp_coeffs <= fir->nr_work) {
+        nr_avail = (fir->nr_work - fir->work_offset - fir->nr_comp_coeffs) / fir->comp_decimation + 1;
+    }
+
+    *pcan_process = 0 != nr_avail;
+
+    if (NULL != pest_count) {
+        *pest_count = nr_avail;
+    }
+
+    return ret;
+}
+
+aresult_t multistage_fir_full(struct multistage_fir *fir, bool *pfull)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != fir);
+    TSL_ASSERT_ARG_DEBUG(NULL != pfull);
+
+    *pfull = false;
+
+    return ret;
+}
+
+/**
+ * Magnitude response of the CIC at the given frequency, in cycles per input sample
+ */
+static
+double _multistage_cic_response(unsigned decimation, double freq)
+{
+    double num = sin(M_PI * freq * decimation),
+           den = decimation * sin(M_PI * freq);
+
+    if (fabs(den) < 1e-12) {
+        return 1.0;
+    }
+
+    return pow(fabs(num / den), MULTISTAGE_CIC_ORDER);
+}
+
+aresult_t multistage_fir_design(const double *proto, size_t nr_proto, unsigned cic_decimation,
+        unsigned hb_decimation, double gain, int16_t *comp_coeffs, size_t nr_comp_coeffs)
+{
+    aresult_t ret = A_OK;
+
+    double *resp = NULL,
+           *taps = NULL;
+    const size_t nr_grid = MULTISTAGE_DESIGN_GRID * nr_comp_coeffs;
+    const double rate = 1.0 / ((double)cic_decimation * (double)hb_decimation),
+                 center = ((double)nr_comp_coeffs - 1.0) / 2.0;
+    double dc = 0.0,
+           sum = 0.0;
+
+    TSL_ASSERT_ARG(NULL != proto);
+    TSL_ASSERT_ARG(0 != nr_proto);
+    TSL_ASSERT_ARG(0 != cic_decimation);
+    TSL_ASSERT_ARG(0 != hb_decimation);
+    TSL_ASSERT_ARG(NULL != comp_coeffs);
+    TSL_ASSERT_ARG(0 != nr_comp_coeffs);
+
+    if (FAILED(ret = TCALLOC((void **)&resp, nr_grid, sizeof(double)))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&taps, nr_comp_coeffs, sizeof(double)))) {
+        goto done;
+    }
+
+    /* The response we want from the final FIR, from 0 to half its input rate: the prototype, less the CIC droop */
+    for (size_t k = 0; k < nr_grid; k++) {
+        double freq = ((double)k + 0.5) * rate / (2.0 * nr_grid);
+        double complex acc = 0.0;
+
+        for (size_t i = 0; i < nr_proto; i++) {
+            acc += proto[i] * cexp(CMPLX(0, -2.0 * M_PI * freq * (double)i));
+        }
+
+        resp[k] = gain * cabs(acc) / _multistage_cic_response(cic_decimation, freq);
+    }
+
+    for (size_t i = 0; i < nr_proto; i++) {
+        dc += proto[i];
+    }
+    dc = gain * fabs(dc);
+
+    /* Frequency sampling: the inverse transform of the linear phase response, Hamming windowed */
+    for (size_t n = 0; n < nr_comp_coeffs; n++) {
+        double window = 1 == nr_comp_coeffs ? 1.0 :
+                0.54 - 0.46 * cos(2.0 * M_PI * (double)n / ((double)nr_comp_coeffs - 1.0));
+        double tap = 0.0;
+
+        for (size_t k = 0; k < nr_grid; k++) {
+            double freq = ((double)k + 0.5) / (2.0 * nr_grid);
+            tap += resp[k] * cos(2.0 * M_PI * freq * ((double)n - center));
+        }
+
+        taps[n] = window * tap / (double)nr_grid;
+        sum += taps[n];
+    }
+
+    /* Windowing moves the DC gain around a little; put it back where the prototype had it */
+    for (size_t n = 0; n < nr_comp_coeffs; n++) {
+        double q15 = (0.0 != sum ? taps[n] * dc / sum : taps[n]) * (1 << 15);
+
+        q15 = BL_MIN2(BL_MAX2(q15, (double)INT16_MIN), (double)INT16_MAX);
+        comp_coeffs[n] = (int16_t)lrint(q15);
+    }
+
+done:
+    if (NULL != resp) {
+        TFREE(resp);
+    }
+
+    if (NULL != taps) {
+        TFREE(taps);
+    }
+
+    return ret;
+}
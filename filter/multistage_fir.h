@@ -0,0 +1,241 @@
+#pragma once
+
+#include <filter/halfband.h>
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct sample_buf;
+
+/**
+ * Number of integrator and comb stages in the CIC decimator
+ */
+#define MULTISTAGE_CIC_ORDER                4
+
+/**
+ * The largest CIC decimation factor. Keeps the CIC gain, R^4, well inside 64-bit accumulators.
+ */
+#define MULTISTAGE_CIC_MAX_DECIMATION       64
+
+/**
+ * The longest period of the mixing oscillator table. Channel offsets that don't repeat within
+ * this many samples are rounded to the nearest offset that does; at a 1 MHz sample rate the
+ * error is at most 31 Hz.
+ */
+#define MULTISTAGE_NCO_MAX_PERIOD           16384
+
+/**
+ * Number of input samples mixed and integrated at a time
+ */
+#define MULTISTAGE_CHUNK_SAMPLES            2048
+
+/**
+ * A multi-stage decimating channel filter, as an alternative to a single long direct_fir:
+ *
+ *  1. A table driven oscillator mixes the channel down to baseband.
+ *  2. A CIC decimator does the bulk of the decimation, using only additions.
+ *  3. An optional half-band cascade (see halfband.h) decimates by a further power of 2.
+ *  4. A short FIR with real coefficients, running at the reduced rate, shapes the channel,
+ *     compensates for the droop of the CIC and does the remaining decimation.
+ *
+ * Only the last stage multiplies per tap, and it runs at a fraction of the input rate, so for
+ * large decimation factors the cost per output sample is a small fraction of that of a
+ * direct_fir with the same response. Sample buffers are consumed as soon as they are pushed,
+ * so there is no limit to how many can be pushed between calls to multistage_fir_process.
+ */
+struct multistage_fir {
+    /**
+     * One period of the mixing oscillator, as interleaved Q.15 I/Q
+     */
+    int16_t *nco;
+
+    /**
+     * The number of complex samples in the oscillator period
+     */
+    size_t nco_period;
+
+    /**
+     * The oscillator sample to apply to the next input sample
+     */
+    size_t nco_phase;
+
+    /**
+     * The CIC decimation factor
+     */
+    unsigned cic_decimation;
+
+    /**
+     * Number of input samples integrated since the CIC last produced an output
+     */
+    unsigned cic_phase;
+
+    /**
+     * The CIC integrator states, for I and Q. Arithmetic wraps around, which the combs undo.
+     */
+    uint64_t cic_integ[2][MULTISTAGE_CIC_ORDER];
+
+    /**
+     * The CIC comb delay lines, for I and Q
+     */
+    uint64_t cic_comb[2][MULTISTAGE_CIC_ORDER];
+
+    /**
+     * Reciprocal of the CIC gain, R^4
+     */
+    double cic_scale;
+
+    /**
+     * Scratch space for the CIC output of one chunk of input samples, interleaved I/Q
+     */
+    int16_t *cic_out;
+
+    /**
+     * The half-band cascade following the CIC. Passes samples through if hb_decimation is 1.
+     */
+    struct halfband_decimator hb;
+
+    /**
+     * The decimation factor of the half-band cascade
+     */
+    unsigned hb_decimation;
+
+    /**
+     * Real Q.15 coefficients of the final FIR
+     */
+    int16_t *comp_coeffs;
+
+    /**
+     * The number of coefficients in the final FIR
+     */
+    size_t nr_comp_coeffs;
+
+    /**
+     * The decimation factor of the final FIR
+     */
+    unsigned comp_decimation;
+
+    /**
+     * Samples waiting for the final FIR, interleaved I/Q
+     */
+    int16_t *work;
+
+    /**
+     * The number of complex samples in work
+     */
+    size_t nr_work;
+
+    /**
+     * The capacity of work, in complex samples
+     */
+    size_t work_cap;
+
+    /**
+     * The start of the next window of the final FIR, in work. May be past the end of work, if
+     * the final FIR decimates by more than it has taps.
+     */
+    size_t work_offset;
+
+    /**
+     * The most recently pushed sample buffer. Held until the next push, so callers can keep
+     * referring to it like they could with a direct_fir.
+     */
+    struct sample_buf *sb_last;
+};
+
+/**
+ * Create a multi-stage decimating filter. This function allocates memory.
+ *
+ * \param fir The filter. Pass a chunk of memory by reference.
+ * \param sampling_rate The input sampling rate, in Hz
+ * \param freq_shift The offset of the channel from the center of the input, in Hz
+ * \param cic_decimation The CIC decimation factor, from 2 to MULTISTAGE_CIC_MAX_DECIMATION
+ * \param hb_decimation The half-band decimation factor: 1, 2, 4 or 8
+ * \param nr_comp_coeffs The number of coefficients in the final FIR
+ * \param comp_coeffs The real, Q.15 coefficients of the final FIR. Copied.
+ * \param comp_decimation The decimation factor of the final FIR
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t multistage_fir_init(struct multistage_fir *fir, uint32_t sampling_rate, int32_t freq_shift,
+        unsigned cic_decimation, unsigned hb_decimation,
+        size_t nr_comp_coeffs, const int16_t *comp_coeffs, unsigned comp_decimation);
+
+/**
+ * Cleanup memory and release sample buffers for the filter. Safe to call on a zeroed filter.
+ *
+ * \param fir The filter to cleanup.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t multistage_fir_cleanup(struct multistage_fir *fir);
+
+/**
+ * Push a sample buffer of complex 16-bit samples. The samples are mixed, run through the CIC
+ * and half-band stages immediately. The filter takes over the caller's reference.
+ *
+ * \param fir The filter
+ * \param buf The buffer to push
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t multistage_fir_push_sample_buf(struct multistage_fir *fir, struct sample_buf *buf);
+
+/**
+ * Run the final FIR over as many samples as possible, constrained by the samples available and
+ * the space in the output buffer.
+ *
+ * \param fir The filter to apply
+ * \param out_buf The buffer to write the interleaved I/Q output samples to
+ * \param nr_out_samples The maximum number of output samples out_buf can hold
+ * \param nr_output_samples_generated The number of valid samples in out_buf
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t multistage_fir_process(struct multistage_fir *fir, int16_t *out_buf, size_t nr_out_samples,
+        size_t *nr_output_samples_generated);
+
+/**
+ * Determine whether or not there are enough samples available to produce at least one filtered,
+ * decimated sample.
+ *
+ * \param fir The filter in question
+ * \param pcan_process Whether or not one filtered sample can be produced, returned by reference.
+ * \param pest_count The number of samples that could be produced. Optional.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t multistage_fir_can_process(struct multistage_fir *fir, bool *pcan_process, size_t *pest_count);
+
+/**
+ * Determine whether the filter can take another sample buffer. Always false, since pushed
+ * buffers are consumed right away; provided for parity with direct_fir.
+ *
+ * \param fir The filter in question
+ * \param pfull Whether or not the filter is full, returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t multistage_fir_full(struct multistage_fir *fir, bool *pfull);
+
+/**
+ * Design the coefficients of the final FIR, so the cascade as a whole matches the magnitude
+ * response of a single FIR prototype designed for the full input rate, like the one a
+ * direct_fir would be given. The droop of the CIC is divided out over the whole band the
+ * final FIR sees.
+ *
+ * \param proto The prototype low-pass filter taps, at the input rate
+ * \param nr_proto The number of prototype taps
+ * \param cic_decimation The CIC decimation factor the coefficients are for
+ * \param hb_decimation The half-band decimation factor the coefficients are for
+ * \param gain Linear gain to apply to the channel
+ * \param comp_coeffs The Q.15 coefficients, returned by reference
+ * \param nr_comp_coeffs The number of coefficients to design. Should be odd.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t multistage_fir_design(const double *proto, size_t nr_proto, unsigned cic_decimation,
+        unsigned hb_decimation, double gain, int16_t *comp_coeffs, size_t nr_comp_coeffs);
+
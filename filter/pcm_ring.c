@@ -0,0 +1,462 @@
+/*
+ *  pcm_ring.c - Shared memory ring for passing PCM samples between processes
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/pcm_ring.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static
+size_t _pcm_ring_data_offset(void)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    return (sizeof(struct pcm_ring_shared) + page_size - 1) & ~(page_size - 1);
+}
+
+static
+aresult_t _pcm_ring_map(struct pcm_ring *ring, int fd, size_t map_len)
+{
+    aresult_t ret = A_OK;
+
+    void *map = NULL;
+
+    /* Fault everything in now, rather than on the first pass around the ring */
+    if (MAP_FAILED == (map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0))) {
+        int errnum = errno;
+        DIAG("Failed to map PCM ring: %s (%d)", strerror(errnum), errnum);
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    ring->shared = map;
+    ring->map_len = map_len;
+
+done:
+    return ret;
+}
+
+aresult_t pcm_ring_create(struct pcm_ring **pring, const char *path, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_ring *ring = NULL;
+    size_t data_offset = _pcm_ring_data_offset(),
+           map_len = data_offset + nr_samples * sizeof(int16_t);
+    int fd = -1;
+
+    TSL_ASSERT_ARG(NULL != pring);
+    TSL_ASSERT_ARG(NULL != path && '\0' != *path);
+    TSL_ASSERT_ARG(0 != nr_samples);
+    TSL_ASSERT_ARG(0 == (nr_samples & (nr_samples - 1)));
+
+    *pring = NULL;
+
+    if (FAILED(ret = TZAALLOC(ring, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    /* Start from a fresh file, so a consumer still attached to an old ring can't see this one half-built */
+    if (0 > unlink(path) && ENOENT != errno) {
+        int errnum = errno;
+        DIAG("Failed to remove old PCM ring '%s': %s (%d)", path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 > (fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666))) {
+        int errnum = errno;
+        DIAG("Failed to create PCM ring '%s': %s (%d)", path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 > ftruncate(fd, map_len)) {
+        int errnum = errno;
+        DIAG("Failed to size PCM ring '%s' to %zu bytes: %s (%d)", path, map_len, strerror(errnum), errnum);
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    if (FAILED(ret = _pcm_ring_map(ring, fd, map_len))) {
+        goto done;
+    }
+
+    ring->samples = (int16_t *)((uint8_t *)ring->shared + data_offset);
+    ring->mask = nr_samples - 1;
+    ring->producer = true;
+
+    ring->shared->version = PCM_RING_VERSION;
+    ring->shared->nr_samples = nr_samples;
+    ring->shared->data_offset = data_offset;
+    atomic_store_explicit(&ring->shared->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->shared->tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->shared->wake_seq, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->shared->nr_dropped, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->shared->waiting, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->shared->stamp_seq, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->shared->stamp_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->shared->stamp_ns, 0, memory_order_relaxed);
+
+    /* Publish the ring to consumers */
+    atomic_store_explicit(&ring->shared->magic, PCM_RING_MAGIC, memory_order_release);
+
+    DIAG("PCM ring '%s': %zu samples", path, nr_samples);
+
+    *pring = ring;
+
+done:
+    if (0 <= fd) {
+        close(fd);
+    }
+
+    if (FAILED(ret)) {
+        if (NULL != ring) {
+            if (NULL != ring->shared) {
+                munmap(ring->shared, ring->map_len);
+            }
+            TFREE(ring);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pcm_ring_attach(struct pcm_ring **pring, const char *path)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_ring *ring = NULL;
+    struct pcm_ring_shared *shared = NULL;
+    struct stat st;
+    int fd = -1;
+
+    TSL_ASSERT_ARG(NULL != pring);
+    TSL_ASSERT_ARG(NULL != path && '\0' != *path);
+
+    *pring = NULL;
+
+    if (FAILED(ret = TZAALLOC(ring, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (0 > (fd = open(path, O_RDWR | O_CLOEXEC))) {
+        ret = A_E_BUSY;
+        goto done;
+    }
+
+    if (0 > fstat(fd, &st)) {
+        int errnum = errno;
+        DIAG("Failed to stat PCM ring '%s': %s (%d)", path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* The producer hasn't finished creating the ring yet */
+    if ((size_t)st.st_size < _pcm_ring_data_offset()) {
+        ret = A_E_BUSY;
+        goto done;
+    }
+
+    if (FAILED(ret = _pcm_ring_map(ring, fd, st.st_size))) {
+        goto done;
+    }
+
+    shared = ring->shared;
+
+    if (PCM_RING_MAGIC != atomic_load_explicit(&shared->magic, memory_order_acquire)) {
+        ret = A_E_BUSY;
+        goto done;
+    }
+
+    if (PCM_RING_VERSION != shared->version) {
+        DIAG("PCM ring '%s' has version %u, expected %u", path, shared->version, PCM_RING_VERSION);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 == shared->nr_samples || 0 != (shared->nr_samples & (shared->nr_samples - 1)) ||
+            shared->data_offset + shared->nr_samples * sizeof(int16_t) > ring->map_len)
+    {
+        DIAG("PCM ring '%s' is malformed", path);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    ring->samples = (int16_t *)((uint8_t *)shared + shared->data_offset);
+    ring->mask = shared->nr_samples - 1;
+    ring->producer = false;
+
+    /* Skip anything that was written before we showed up */
+    atomic_store_explicit(&shared->tail, atomic_load_explicit(&shared->head, memory_order_acquire),
+            memory_order_release);
+
+    *pring = ring;
+
+done:
+    if (0 <= fd) {
+        close(fd);
+    }
+
+    if (FAILED(ret)) {
+        if (NULL != ring) {
+            if (NULL != ring->shared) {
+                munmap(ring->shared, ring->map_len);
+            }
+            TFREE(ring);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pcm_ring_write(struct pcm_ring *ring, const int16_t *samples, size_t nr_samples, size_t *pnr_written)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_ring_shared *shared = NULL;
+    uint64_t head = 0,
+             tail = 0;
+    size_t nr_free = 0,
+           nr_write = 0,
+           offs = 0,
+           first = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+    TSL_ASSERT_ARG_DEBUG(NULL != samples || 0 == nr_samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_written);
+    TSL_ASSERT_ARG_DEBUG(true == ring->producer);
+
+    shared = ring->shared;
+
+    head = atomic_load_explicit(&shared->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&shared->tail, memory_order_acquire);
+
+    nr_free = ring->mask + 1 - (size_t)(head - tail);
+    nr_write = nr_samples < nr_free ? nr_samples : nr_free;
+
+    /* Copy in, in up to two pieces if we wrap around the end of the ring */
+    offs = head & ring->mask;
+    first = ring->mask + 1 - offs;
+    if (first > nr_write) {
+        first = nr_write;
+    }
+
+    memcpy(ring->samples + offs, samples, first * sizeof(int16_t));
+    memcpy(ring->samples, samples + first, (nr_write - first) * sizeof(int16_t));
+
+    atomic_store_explicit(&shared->head, head + nr_write, memory_order_release);
+
+    if (nr_write != nr_samples) {
+        atomic_fetch_add_explicit(&shared->nr_dropped, nr_samples - nr_write, memory_order_relaxed);
+    }
+
+    /* Pairs with the fence in pcm_ring_read: either we see the consumer waiting, or it sees our samples */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (0 != nr_write && 0 != atomic_load_explicit(&shared->waiting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&shared->wake_seq, 1, memory_order_release);
+        if (0 > syscall(SYS_futex, &shared->wake_seq, FUTEX_WAKE, 1, NULL, NULL, 0)) {
+            int errnum = errno;
+            PANIC("Failed to wake PCM ring consumer. Reason: %s (%d)", strerror(errnum), errnum);
+        }
+    }
+
+    *pnr_written = nr_write;
+
+    return ret;
+}
+
+aresult_t pcm_ring_stamp(struct pcm_ring *ring, uint64_t time_ns)
+{
+    struct pcm_ring_shared *shared = NULL;
+    uint32_t seq = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+    TSL_ASSERT_ARG_DEBUG(true == ring->producer);
+
+    shared = ring->shared;
+
+    seq = atomic_load_explicit(&shared->stamp_seq, memory_order_relaxed);
+
+    /* Mark the stamp as being updated before touching it */
+    atomic_store_explicit(&shared->stamp_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&shared->stamp_pos, atomic_load_explicit(&shared->head, memory_order_relaxed),
+            memory_order_relaxed);
+    atomic_store_explicit(&shared->stamp_ns, time_ns, memory_order_relaxed);
+
+    atomic_store_explicit(&shared->stamp_seq, seq + 2, memory_order_release);
+
+    return A_OK;
+}
+
+aresult_t pcm_ring_read_time(struct pcm_ring *ring, uint32_t sample_rate_hz, uint64_t *ptime_ns)
+{
+    struct pcm_ring_shared *shared = NULL;
+    uint64_t pos = 0,
+             stamp_pos = 0,
+             stamp_ns = 0;
+    uint32_t seq = 0;
+    int64_t delta = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+    TSL_ASSERT_ARG_DEBUG(0 != sample_rate_hz);
+    TSL_ASSERT_ARG_DEBUG(NULL != ptime_ns);
+    TSL_ASSERT_ARG_DEBUG(false == ring->producer);
+
+    shared = ring->shared;
+
+    /* Retry until we get a consistent view of the stamp */
+    do {
+        seq = atomic_load_explicit(&shared->stamp_seq, memory_order_acquire);
+        stamp_pos = atomic_load_explicit(&shared->stamp_pos, memory_order_relaxed);
+        stamp_ns = atomic_load_explicit(&shared->stamp_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while (0 != (seq & 1) || seq != atomic_load_explicit(&shared->stamp_seq, memory_order_relaxed));
+
+    if (0 == stamp_ns) {
+        return A_E_NOTFOUND;
+    }
+
+    /* The most recently read sample; the stamp may be ahead of or behind it */
+    pos = atomic_load_explicit(&shared->tail, memory_order_relaxed) - 1;
+    delta = (int64_t)(pos - stamp_pos);
+
+    *ptime_ns = stamp_ns + delta * 1000000000ll / (int64_t)sample_rate_hz;
+
+    return A_OK;
+}
+
+aresult_t pcm_ring_read(struct pcm_ring *ring, int16_t *samples, size_t max_samples, size_t *pnr_read,
+        int timeout_ms)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_ring_shared *shared = NULL;
+    bool waited = false;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+    TSL_ASSERT_ARG_DEBUG(0 != max_samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_read);
+    TSL_ASSERT_ARG_DEBUG(false == ring->producer);
+
+    shared = ring->shared;
+
+    *pnr_read = 0;
+
+    while (true) {
+        uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_relaxed),
+                 head = atomic_load_explicit(&shared->head, memory_order_acquire);
+        uint32_t seq = 0;
+        struct timespec ts;
+
+        if (head != tail) {
+            size_t nr_read = (size_t)(head - tail),
+                   offs = tail & ring->mask,
+                   first = ring->mask + 1 - offs;
+
+            if (nr_read > max_samples) {
+                nr_read = max_samples;
+            }
+
+            if (first > nr_read) {
+                first = nr_read;
+            }
+
+            memcpy(samples, ring->samples + offs, first * sizeof(int16_t));
+            memcpy(samples + first, ring->samples, (nr_read - first) * sizeof(int16_t));
+
+            atomic_store_explicit(&shared->tail, tail + nr_read, memory_order_release);
+
+            *pnr_read = nr_read;
+            break;
+        }
+
+        if (0 == timeout_ms || true == waited) {
+            break;
+        }
+
+        /* Get ready to sleep, and make sure nothing arrived in the meantime */
+        seq = atomic_load_explicit(&shared->wake_seq, memory_order_acquire);
+        atomic_store_explicit(&shared->waiting, 1, memory_order_relaxed);
+
+        /* Pairs with the fence in pcm_ring_write */
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (head == atomic_load_explicit(&shared->head, memory_order_acquire)) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000l;
+
+            if (0 > syscall(SYS_futex, &shared->wake_seq, FUTEX_WAIT, seq, 0 > timeout_ms ? NULL : &ts, NULL, 0)) {
+                int errnum = errno;
+                if (EAGAIN != errnum && EINTR != errnum && ETIMEDOUT != errnum) {
+                    PANIC("Failed to wait on PCM ring. Reason: %s (%d)", strerror(errnum), errnum);
+                }
+            }
+        }
+
+        atomic_store_explicit(&shared->waiting, 0, memory_order_relaxed);
+
+        waited = true;
+    }
+
+    return ret;
+}
+
+aresult_t pcm_ring_delete(struct pcm_ring **pring)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_ring *ring = NULL;
+
+    TSL_ASSERT_ARG(NULL != pring);
+    TSL_ASSERT_ARG(NULL != *pring);
+
+    ring = *pring;
+
+    if (NULL != ring->shared) {
+        munmap(ring->shared, ring->map_len);
+        ring->shared = NULL;
+    }
+
+    TFREE(ring);
+
+    *pring = NULL;
+
+    return ret;
+}
+
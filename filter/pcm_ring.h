@@ -0,0 +1,207 @@
+#pragma once
+
+#include <tsl/cal.h>
+#include <tsl/result.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Magic number at the start of a shared PCM ring ("PCMR")
+ */
+#define PCM_RING_MAGIC                  0x504d4352ul
+
+/**
+ * Version of the shared ring layout
+ */
+#define PCM_RING_VERSION                2
+
+/**
+ * The header at the start of a shared PCM ring. The samples follow, starting at data_offset.
+ * This layout is shared between processes, so it must only ever be changed along with
+ * PCM_RING_VERSION.
+ */
+struct pcm_ring_shared {
+    /**
+     * PCM_RING_MAGIC, written last when the ring is created
+     */
+    _Atomic uint32_t magic;
+
+    /**
+     * PCM_RING_VERSION
+     */
+    uint32_t version;
+
+    /**
+     * The number of int16_t samples in the ring. Always a power of 2.
+     */
+    uint64_t nr_samples;
+
+    /**
+     * Offset of the sample data from the start of the mapping, in bytes. Page aligned.
+     */
+    uint64_t data_offset;
+
+    /**
+     * Total number of samples ever written. Only written by the producer.
+     */
+    _Atomic uint64_t head CAL_CACHE_ALIGNED;
+
+    /**
+     * Futex word, incremented by the producer every time it wakes a sleeping consumer
+     */
+    _Atomic uint32_t wake_seq;
+
+    /**
+     * Number of samples the producer had to drop because the ring was full
+     */
+    _Atomic uint64_t nr_dropped;
+
+    /**
+     * Sequence lock over stamp_pos and stamp_ns. Odd while the producer is updating them.
+     */
+    _Atomic uint32_t stamp_seq;
+
+    /**
+     * The position in the sample stream (see head) of the most recently time stamped sample
+     */
+    _Atomic uint64_t stamp_pos;
+
+    /**
+     * When the most recently time stamped sample was captured, in nanoseconds on the
+     * CLOCK_MONOTONIC clock (see sample_buf_now_ns). 0 if nothing has been stamped.
+     */
+    _Atomic uint64_t stamp_ns;
+
+    /**
+     * Total number of samples ever consumed. Only written by the consumer.
+     */
+    _Atomic uint64_t tail CAL_CACHE_ALIGNED;
+
+    /**
+     * Set by the consumer when it is about to sleep on wake_seq
+     */
+    _Atomic uint32_t waiting;
+};
+
+/**
+ * A handle on a PCM sample ring, backed by a file in shared memory (i.e. on /dev/shm). One
+ * process writes samples, and one process reads them, without any system calls unless the
+ * reader runs out of samples and has to sleep.
+ */
+struct pcm_ring {
+    /**
+     * The shared ring header
+     */
+    struct pcm_ring_shared *shared;
+
+    /**
+     * The ring samples
+     */
+    int16_t *samples;
+
+    /**
+     * The number of samples in the ring, less one
+     */
+    size_t mask;
+
+    /**
+     * Length of the shared mapping, in bytes
+     */
+    size_t map_len;
+
+    /**
+     * Whether or not this handle created the ring (and so is the producer)
+     */
+    bool producer;
+};
+
+/**
+ * Create a new shared PCM ring, replacing any existing file at the given path. The caller is the
+ * producer for the ring.
+ *
+ * \param pring The new ring, returned by reference
+ * \param path The path of the shared memory file backing the ring
+ * \param nr_samples The capacity of the ring, in samples. Must be a power of 2.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_ring_create(struct pcm_ring **pring, const char *path, size_t nr_samples);
+
+/**
+ * Attach to an existing shared PCM ring as its consumer. Only samples written after attaching
+ * will be read.
+ *
+ * \param pring The ring, returned by reference
+ * \param path The path of the shared memory file backing the ring
+ *
+ * \return A_OK on success, A_E_BUSY if the ring does not exist or is not yet initialized, an
+ *         error code otherwise.
+ */
+aresult_t pcm_ring_attach(struct pcm_ring **pring, const char *path);
+
+/**
+ * Write samples to the ring, waking the consumer if it is sleeping. If the ring does not have
+ * space for all the samples, only those that fit are written and the rest are counted as
+ * dropped. Must only be called by the producer.
+ *
+ * \param ring The ring
+ * \param samples The samples to write
+ * \param nr_samples The number of samples to write
+ * \param pnr_written The number of samples written, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_ring_write(struct pcm_ring *ring, const int16_t *samples, size_t nr_samples, size_t *pnr_written);
+
+/**
+ * Record when the next sample to be written was captured, so the consumer can tell how far
+ * behind the radio it is. Must only be called by the producer.
+ *
+ * \param ring The ring
+ * \param time_ns The capture time of the next sample written, on the CLOCK_MONOTONIC clock
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_ring_stamp(struct pcm_ring *ring, uint64_t time_ns);
+
+/**
+ * Work out when the most recently read sample was captured, by extrapolating from the latest
+ * time stamp the producer recorded. Must only be called by the consumer.
+ *
+ * \param ring The ring
+ * \param sample_rate_hz The rate of the PCM samples in the ring
+ * \param ptime_ns The capture time, on the CLOCK_MONOTONIC clock, returned by reference
+ *
+ * \return A_OK on success, A_E_NOTFOUND if the producer has not stamped any samples, an error
+ *         code otherwise.
+ */
+aresult_t pcm_ring_read_time(struct pcm_ring *ring, uint32_t sample_rate_hz, uint64_t *ptime_ns);
+
+/**
+ * Read samples from the ring, waiting up to timeout_ms for samples to arrive if the ring is
+ * empty. Must only be called by the consumer.
+ *
+ * \param ring The ring
+ * \param samples The buffer to read samples into
+ * \param max_samples The most samples to read
+ * \param pnr_read The number of samples read, returned by reference. Will be 0 if the timeout
+ *                 elapsed.
+ * \param timeout_ms The longest time to wait, in milliseconds. -1 to wait forever.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_ring_read(struct pcm_ring *ring, int16_t *samples, size_t max_samples, size_t *pnr_read,
+        int timeout_ms);
+
+/**
+ * Release a handle on a PCM ring. The shared memory file is left in place.
+ *
+ * \param pring The ring, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_ring_delete(struct pcm_ring **pring);
+
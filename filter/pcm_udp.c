@@ -0,0 +1,706 @@
+/*
+ *  pcm_udp.c - Send and receive PCM samples as UDP datagrams, so capture and decode can
+ *          run on different hosts
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/pcm_udp.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PCM_UDP_HEADER_BYTES            sizeof(struct pcm_udp_header)
+#define PCM_UDP_PACKET_BYTES            (PCM_UDP_HEADER_BYTES + PCM_UDP_MAX_VALUES * sizeof(int16_t))
+
+_Static_assert(32 == sizeof(struct pcm_udp_header), "PCM datagram header must not be padded");
+_Static_assert(PCM_UDP_PACKET_BYTES + 8 + 40 <= 1500, "PCM datagrams must fit in an Ethernet MTU, even over IPv6");
+
+/**
+ * The number of 16-bit values that make up one sample in the given format
+ */
+static inline
+size_t _pcm_udp_values_per_sample(enum pcm_udp_format format)
+{
+    return PCM_UDP_FORMAT_CS16 == format ? 2 : 1;
+}
+
+struct pcm_udp_sender {
+    int fd;
+
+    struct sockaddr_storage dest;
+    socklen_t dest_len;
+
+    uint32_t channel_id;
+    uint32_t sample_rate;
+    enum pcm_udp_format format;
+
+    /**
+     * The sequence number for the next datagram
+     */
+    uint64_t seq;
+
+    /**
+     * The number of datagrams waiting to be sent
+     */
+    size_t nr_queued;
+
+    /**
+     * The number of samples in each queued datagram, to count what's dropped
+     */
+    size_t nr_pkt_samples[PCM_UDP_BATCH_PACKETS];
+
+    struct mmsghdr msgs[PCM_UDP_BATCH_PACKETS];
+    struct iovec iovs[PCM_UDP_BATCH_PACKETS];
+
+    /**
+     * PCM_UDP_BATCH_PACKETS datagrams of PCM_UDP_PACKET_BYTES each
+     */
+    uint8_t *packets;
+};
+
+struct pcm_udp_receiver {
+    int fd;
+
+    /**
+     * Only accept datagrams for this channel, unless it's 0
+     */
+    uint32_t channel_id;
+
+    /**
+     * The only sample format we accept
+     */
+    enum pcm_udp_format format;
+
+    /**
+     * The sequence number we expect next, once we've seen a datagram
+     */
+    uint64_t next_seq;
+    bool have_seq;
+
+    uint64_t nr_lost;
+    uint64_t nr_rejected;
+
+    /**
+     * The datagrams from the last receive, their headers in host byte order. Datagrams that were
+     * rejected have their sample count set to 0.
+     */
+    struct pcm_udp_header hdrs[PCM_UDP_BATCH_PACKETS];
+    size_t nr_pkts;
+
+    /**
+     * The next received datagram to read from, and how many of its samples have been read
+     */
+    size_t next_pkt;
+    size_t pkt_offset;
+
+    struct mmsghdr msgs[PCM_UDP_BATCH_PACKETS];
+    struct iovec iovs[PCM_UDP_BATCH_PACKETS];
+    uint8_t *packets;
+};
+
+/**
+ * Resolve host:port, or [host]:port for IPv6. An empty host is the wildcard address, if passive.
+ */
+static
+aresult_t _pcm_udp_resolve(const char *spec, bool passive, struct sockaddr_storage *paddr, socklen_t *plen)
+{
+    aresult_t ret = A_OK;
+
+    char host[256];
+    const char *colon = NULL,
+               *port = NULL;
+    size_t host_len = 0;
+    struct addrinfo hints,
+                    *res = NULL;
+    int gai_ret = 0;
+
+    if (NULL == (colon = strrchr(spec, ':')) || '\0' == colon[1]) {
+        DIAG("Address '%s' needs a port, as host:port", spec);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    port = colon + 1;
+    host_len = colon - spec;
+
+    /* Strip the brackets from an IPv6 address */
+    if (0 != host_len && '[' == spec[0] && ']' == spec[host_len - 1]) {
+        spec++;
+        host_len -= 2;
+    }
+
+    if (host_len >= sizeof(host)) {
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    memcpy(host, spec, host_len);
+    host[host_len] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV | (true == passive ? AI_PASSIVE : 0);
+
+    if (0 != (gai_ret = getaddrinfo('\0' == host[0] ? NULL : host, port, &hints, &res))) {
+        DIAG("Failed to resolve '%s': %s", spec, gai_strerror(gai_ret));
+        ret = A_E_NOTFOUND;
+        goto done;
+    }
+
+    memcpy(paddr, res->ai_addr, res->ai_addrlen);
+    *plen = res->ai_addrlen;
+
+done:
+    if (NULL != res) {
+        freeaddrinfo(res);
+    }
+
+    return ret;
+}
+
+static
+bool _pcm_udp_is_multicast(const struct sockaddr_storage *addr)
+{
+    if (AF_INET == addr->ss_family) {
+        return IN_MULTICAST(ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr));
+    }
+
+    if (AF_INET6 == addr->ss_family) {
+        return IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)addr)->sin6_addr);
+    }
+
+    return false;
+}
+
+aresult_t pcm_udp_sender_new(struct pcm_udp_sender **psnd, const char *dest, uint32_t channel_id,
+        uint32_t sample_rate, enum pcm_udp_format format, int ttl)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_udp_sender *snd = NULL;
+
+    TSL_ASSERT_ARG(NULL != psnd);
+    TSL_ASSERT_ARG(NULL != dest);
+    TSL_ASSERT_ARG(0 != sample_rate);
+    TSL_ASSERT_ARG(PCM_UDP_FORMAT_S16 == format || PCM_UDP_FORMAT_CS16 == format);
+    TSL_ASSERT_ARG(0 <= ttl && 255 >= ttl);
+
+    *psnd = NULL;
+
+    if (FAILED(ret = TZAALLOC(snd, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    snd->fd = -1;
+    snd->channel_id = channel_id;
+    snd->sample_rate = sample_rate;
+    snd->format = format;
+
+    if (FAILED(ret = _pcm_udp_resolve(dest, false, &snd->dest, &snd->dest_len))) {
+        goto done;
+    }
+
+    if (0 > (snd->fd = socket(snd->dest.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0))) {
+        int errnum = errno;
+        DIAG("Failed to create UDP socket: %s (%d)", strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 != ttl && true == _pcm_udp_is_multicast(&snd->dest)) {
+        int rc = AF_INET == snd->dest.ss_family ?
+            setsockopt(snd->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) :
+            setsockopt(snd->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+
+        if (0 > rc) {
+            int errnum = errno;
+            DIAG("Failed to set multicast TTL of %d: %s (%d)", ttl, strerror(errnum), errnum);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&snd->packets, PCM_UDP_BATCH_PACKETS, PCM_UDP_PACKET_BYTES,
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < PCM_UDP_BATCH_PACKETS; i++) {
+        snd->iovs[i].iov_base = snd->packets + i * PCM_UDP_PACKET_BYTES;
+        snd->msgs[i].msg_hdr.msg_name = &snd->dest;
+        snd->msgs[i].msg_hdr.msg_namelen = snd->dest_len;
+        snd->msgs[i].msg_hdr.msg_iov = &snd->iovs[i];
+        snd->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    *psnd = snd;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != snd) {
+            TSL_BUG_IF_FAILED(pcm_udp_sender_delete(&snd));
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pcm_udp_sender_flush(struct pcm_udp_sender *snd, size_t *pnr_dropped)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_sent = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != snd);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_dropped);
+
+    *pnr_dropped = 0;
+
+    while (nr_sent < snd->nr_queued) {
+        int rc = sendmmsg(snd->fd, &snd->msgs[nr_sent], snd->nr_queued - nr_sent, MSG_DONTWAIT);
+
+        if (0 > rc && EINTR == errno) {
+            continue;
+        }
+
+        /* Whatever the socket won't take now is dropped, we can't hold up the caller */
+        if (0 >= rc) {
+            break;
+        }
+
+        nr_sent += rc;
+    }
+
+    for (size_t i = nr_sent; i < snd->nr_queued; i++) {
+        *pnr_dropped += snd->nr_pkt_samples[i];
+    }
+
+    snd->nr_queued = 0;
+
+    return ret;
+}
+
+aresult_t pcm_udp_sender_write(struct pcm_udp_sender *snd, const int16_t *samples, size_t nr_samples,
+        uint64_t start_time_ns, size_t *pnr_dropped)
+{
+    aresult_t ret = A_OK;
+
+    size_t values_per_sample = 0,
+           offset = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != snd);
+    TSL_ASSERT_ARG_DEBUG(NULL != samples || 0 == nr_samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_dropped);
+
+    *pnr_dropped = 0;
+
+    values_per_sample = _pcm_udp_values_per_sample(snd->format);
+
+    while (offset < nr_samples) {
+        size_t nr_pkt = BL_MIN2(nr_samples - offset, PCM_UDP_MAX_VALUES / values_per_sample),
+               nr_values = nr_pkt * values_per_sample,
+               nr_flush_dropped = 0;
+        uint8_t *pkt = NULL;
+        struct pcm_udp_header hdr;
+        int16_t *pkt_samples = NULL;
+        const int16_t *src = samples + offset * values_per_sample;
+
+        if (PCM_UDP_BATCH_PACKETS == snd->nr_queued) {
+            TSL_BUG_IF_FAILED(pcm_udp_sender_flush(snd, &nr_flush_dropped));
+            *pnr_dropped += nr_flush_dropped;
+        }
+
+        pkt = snd->packets + snd->nr_queued * PCM_UDP_PACKET_BYTES;
+        pkt_samples = (int16_t *)(pkt + PCM_UDP_HEADER_BYTES);
+
+        hdr.magic = htole32(PCM_UDP_MAGIC);
+        hdr.version = PCM_UDP_VERSION;
+        hdr.format = snd->format;
+        hdr.nr_samples = htole16(nr_pkt);
+        hdr.channel_id = htole32(snd->channel_id);
+        hdr.sample_rate = htole32(snd->sample_rate);
+        hdr.seq = htole64(snd->seq++);
+        hdr.start_time_ns = htole64(0 == start_time_ns ? 0 :
+                start_time_ns + (uint64_t)offset * 1000000000ull / snd->sample_rate);
+        memcpy(pkt, &hdr, sizeof(hdr));
+
+        for (size_t i = 0; i < nr_values; i++) {
+            pkt_samples[i] = htole16(src[i]);
+        }
+
+        snd->iovs[snd->nr_queued].iov_len = PCM_UDP_HEADER_BYTES + nr_values * sizeof(int16_t);
+        snd->nr_pkt_samples[snd->nr_queued] = nr_pkt;
+        snd->nr_queued++;
+
+        offset += nr_pkt;
+    }
+
+    return ret;
+}
+
+aresult_t pcm_udp_sender_delete(struct pcm_udp_sender **psnd)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_udp_sender *snd = NULL;
+
+    TSL_ASSERT_PTR_BY_REF(psnd);
+
+    snd = *psnd;
+
+    if (0 <= snd->fd) {
+        close(snd->fd);
+    }
+
+    if (NULL != snd->packets) {
+        TFREE(snd->packets);
+    }
+
+    TFREE(snd);
+    *psnd = NULL;
+
+    return ret;
+}
+
+/**
+ * Join the multicast group the receiver is bound to
+ */
+static
+aresult_t _pcm_udp_receiver_join(struct pcm_udp_receiver *rcv, const struct sockaddr_storage *group)
+{
+    aresult_t ret = A_OK;
+
+    int rc = 0;
+
+    if (AF_INET == group->ss_family) {
+        struct ip_mreqn mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = ((const struct sockaddr_in *)group)->sin_addr;
+        mreq.imr_address.s_addr = htonl(INADDR_ANY);
+
+        rc = setsockopt(rcv->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    } else {
+        struct ipv6_mreq mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.ipv6mr_multiaddr = ((const struct sockaddr_in6 *)group)->sin6_addr;
+
+        rc = setsockopt(rcv->fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq));
+    }
+
+    if (0 > rc) {
+        int errnum = errno;
+        DIAG("Failed to join multicast group: %s (%d)", strerror(errnum), errnum);
+        ret = A_E_INVAL;
+    }
+
+    return ret;
+}
+
+aresult_t pcm_udp_receiver_new(struct pcm_udp_receiver **prcv, const char *addr, uint32_t channel_id,
+        enum pcm_udp_format format)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_udp_receiver *rcv = NULL;
+    struct sockaddr_storage local;
+    socklen_t local_len = 0;
+    int one = 1;
+
+    TSL_ASSERT_ARG(NULL != prcv);
+    TSL_ASSERT_ARG(NULL != addr);
+    TSL_ASSERT_ARG(PCM_UDP_FORMAT_S16 == format || PCM_UDP_FORMAT_CS16 == format);
+
+    *prcv = NULL;
+
+    if (FAILED(ret = TZAALLOC(rcv, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    rcv->fd = -1;
+    rcv->channel_id = channel_id;
+    rcv->format = format;
+
+    if (FAILED(ret = _pcm_udp_resolve(addr, true, &local, &local_len))) {
+        goto done;
+    }
+
+    /* Every channel on a group numbers its datagrams on its own, so we have to pick one */
+    if (0 == channel_id && true == _pcm_udp_is_multicast(&local)) {
+        DIAG("A channel ID is required to receive from multicast group '%s'", addr);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 > (rcv->fd = socket(local.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))) {
+        int errnum = errno;
+        DIAG("Failed to create UDP socket: %s (%d)", strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* Every channel on a multicast group can have a receiver of its own */
+    if (0 > setsockopt(rcv->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))) {
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* Bound to the group itself, so we only see the group's traffic */
+    if (0 > bind(rcv->fd, (struct sockaddr *)&local, local_len)) {
+        int errnum = errno;
+        DIAG("Failed to bind to '%s': %s (%d)", addr, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (true == _pcm_udp_is_multicast(&local) && FAILED(ret = _pcm_udp_receiver_join(rcv, &local))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&rcv->packets, PCM_UDP_BATCH_PACKETS, PCM_UDP_PACKET_BYTES,
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < PCM_UDP_BATCH_PACKETS; i++) {
+        rcv->iovs[i].iov_base = rcv->packets + i * PCM_UDP_PACKET_BYTES;
+        rcv->iovs[i].iov_len = PCM_UDP_PACKET_BYTES;
+        rcv->msgs[i].msg_hdr.msg_iov = &rcv->iovs[i];
+        rcv->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    *prcv = rcv;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != rcv) {
+            TSL_BUG_IF_FAILED(pcm_udp_receiver_delete(&rcv));
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Check a received datagram, returning its header in host byte order. Anything that isn't PCM
+ * for our channel comes back with no samples.
+ */
+static
+void _pcm_udp_receiver_parse(struct pcm_udp_receiver *rcv, const uint8_t *pkt, size_t len, struct pcm_udp_header *hdr)
+{
+    struct pcm_udp_header wire;
+    uint64_t seq = 0;
+    size_t values_per_sample = _pcm_udp_values_per_sample(rcv->format);
+
+    memset(hdr, 0, sizeof(*hdr));
+
+    if (len < PCM_UDP_HEADER_BYTES) {
+        rcv->nr_rejected++;
+        return;
+    }
+
+    memcpy(&wire, pkt, sizeof(wire));
+
+    if (PCM_UDP_MAGIC != le32toh(wire.magic) || PCM_UDP_VERSION != wire.version ||
+            rcv->format != wire.format ||
+            PCM_UDP_MAX_VALUES / values_per_sample < le16toh(wire.nr_samples) ||
+            len != PCM_UDP_HEADER_BYTES + le16toh(wire.nr_samples) * values_per_sample * sizeof(int16_t))
+    {
+        rcv->nr_rejected++;
+        return;
+    }
+
+    /* Someone else's channel on the same group */
+    if (0 != rcv->channel_id && rcv->channel_id != le32toh(wire.channel_id)) {
+        return;
+    }
+
+    seq = le64toh(wire.seq);
+
+    /* Anything behind what we expected is a restarted sender (or a reordered datagram), so resync */
+    if (true == rcv->have_seq && seq > rcv->next_seq) {
+        rcv->nr_lost += seq - rcv->next_seq;
+    }
+
+    rcv->next_seq = seq + 1;
+    rcv->have_seq = true;
+
+    hdr->magic = PCM_UDP_MAGIC;
+    hdr->version = wire.version;
+    hdr->format = wire.format;
+    hdr->nr_samples = le16toh(wire.nr_samples);
+    hdr->channel_id = le32toh(wire.channel_id);
+    hdr->sample_rate = le32toh(wire.sample_rate);
+    hdr->seq = seq;
+    hdr->start_time_ns = le64toh(wire.start_time_ns);
+}
+
+/**
+ * Receive a batch of datagrams, waiting up to timeout_ms if none are waiting
+ */
+static
+aresult_t _pcm_udp_receiver_fill(struct pcm_udp_receiver *rcv, int timeout_ms)
+{
+    aresult_t ret = A_OK;
+
+    int nr_msgs = 0;
+
+    rcv->nr_pkts = 0;
+    rcv->next_pkt = 0;
+    rcv->pkt_offset = 0;
+
+    if (0 > (nr_msgs = recvmmsg(rcv->fd, rcv->msgs, PCM_UDP_BATCH_PACKETS, MSG_DONTWAIT, NULL))) {
+        int errnum = errno;
+        struct pollfd pfd = { .fd = rcv->fd, .events = POLLIN };
+
+        if (EAGAIN != errnum && EWOULDBLOCK != errnum && EINTR != errnum) {
+            DIAG("Failed to receive PCM datagrams: %s (%d)", strerror(errnum), errnum);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (0 == timeout_ms || 0 >= poll(&pfd, 1, timeout_ms)) {
+            goto done;
+        }
+
+        if (0 > (nr_msgs = recvmmsg(rcv->fd, rcv->msgs, PCM_UDP_BATCH_PACKETS, MSG_DONTWAIT, NULL))) {
+            goto done;
+        }
+    }
+
+    for (int i = 0; i < nr_msgs; i++) {
+        _pcm_udp_receiver_parse(rcv, rcv->packets + i * PCM_UDP_PACKET_BYTES, rcv->msgs[i].msg_len, &rcv->hdrs[i]);
+    }
+
+    rcv->nr_pkts = nr_msgs;
+
+done:
+    return ret;
+}
+
+aresult_t pcm_udp_receiver_read(struct pcm_udp_receiver *rcv, int16_t *samples, size_t max_samples,
+        size_t *pnr_read, int timeout_ms)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_read = 0,
+           values_per_sample = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != rcv);
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_read);
+
+    *pnr_read = 0;
+
+    values_per_sample = _pcm_udp_values_per_sample(rcv->format);
+
+    while (nr_read < max_samples) {
+        const struct pcm_udp_header *hdr = NULL;
+        const int16_t *pkt_samples = NULL;
+        size_t nr_copy = 0;
+
+        if (rcv->next_pkt == rcv->nr_pkts) {
+            /* Only wait if we have nothing at all to hand back */
+            if (FAILED(ret = _pcm_udp_receiver_fill(rcv, 0 == nr_read ? timeout_ms : 0))) {
+                goto done;
+            }
+
+            if (0 == rcv->nr_pkts) {
+                break;
+            }
+        }
+
+        hdr = &rcv->hdrs[rcv->next_pkt];
+        pkt_samples = (const int16_t *)(rcv->packets + rcv->next_pkt * PCM_UDP_PACKET_BYTES + PCM_UDP_HEADER_BYTES);
+        nr_copy = BL_MIN2(hdr->nr_samples - rcv->pkt_offset, max_samples - nr_read);
+
+        for (size_t i = 0; i < nr_copy * values_per_sample; i++) {
+            samples[nr_read * values_per_sample + i] = le16toh(pkt_samples[rcv->pkt_offset * values_per_sample + i]);
+        }
+
+        nr_read += nr_copy;
+        rcv->pkt_offset += nr_copy;
+
+        if (rcv->pkt_offset == hdr->nr_samples) {
+            rcv->next_pkt++;
+            rcv->pkt_offset = 0;
+        }
+    }
+
+    *pnr_read = nr_read;
+
+done:
+    return ret;
+}
+
+int pcm_udp_receiver_fd(struct pcm_udp_receiver *rcv)
+{
+    TSL_BUG_ON(NULL == rcv);
+    return rcv->fd;
+}
+
+uint64_t pcm_udp_receiver_nr_lost(struct pcm_udp_receiver *rcv)
+{
+    TSL_BUG_ON(NULL == rcv);
+    return rcv->nr_lost;
+}
+
+aresult_t pcm_udp_receiver_delete(struct pcm_udp_receiver **prcv)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_udp_receiver *rcv = NULL;
+
+    TSL_ASSERT_PTR_BY_REF(prcv);
+
+    rcv = *prcv;
+
+    /* Closing the socket leaves any group it joined */
+    if (0 <= rcv->fd) {
+        close(rcv->fd);
+    }
+
+    if (NULL != rcv->packets) {
+        TFREE(rcv->packets);
+    }
+
+    TFREE(rcv);
+    *prcv = NULL;
+
+    return ret;
+}
+
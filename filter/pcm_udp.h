@@ -0,0 +1,200 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct pcm_udp_sender;
+struct pcm_udp_receiver;
+
+/**
+ * Magic number at the start of every PCM datagram ("TPCM")
+ */
+#define PCM_UDP_MAGIC                   0x4d435054ul
+
+/**
+ * Version of the datagram header
+ */
+#define PCM_UDP_VERSION                 1
+
+/**
+ * The most 16-bit values carried by one datagram: 704 real samples, or 352 complex samples.
+ * Keeps a datagram inside a 1500 byte Ethernet MTU, so nothing is ever fragmented.
+ */
+#define PCM_UDP_MAX_VALUES              704
+
+/**
+ * The most datagrams sent or received with a single system call
+ */
+#define PCM_UDP_BATCH_PACKETS           32
+
+/**
+ * The sample representation carried in a datagram
+ */
+enum pcm_udp_format {
+    /**
+     * Real signed 16-bit PCM, as produced by the FM demodulator
+     */
+    PCM_UDP_FORMAT_S16 = 1,
+
+    /**
+     * Complex signed 16-bit samples, I and Q interleaved
+     */
+    PCM_UDP_FORMAT_CS16 = 2,
+};
+
+/**
+ * The header at the start of every datagram, followed by nr_samples samples. Every field, and
+ * every sample, is little endian on the wire. This layout is shared between hosts, so it must
+ * only ever be changed along with PCM_UDP_VERSION.
+ */
+struct pcm_udp_header {
+    /**
+     * PCM_UDP_MAGIC
+     */
+    uint32_t magic;
+
+    /**
+     * PCM_UDP_VERSION
+     */
+    uint8_t version;
+
+    /**
+     * The sample format, an enum pcm_udp_format
+     */
+    uint8_t format;
+
+    /**
+     * The number of samples following the header. A complex sample counts once.
+     */
+    uint16_t nr_samples;
+
+    /**
+     * Identifies the channel, so several channels can share a multicast group. By convention,
+     * the center frequency of the channel in Hz.
+     */
+    uint32_t channel_id;
+
+    /**
+     * The sample rate, in Hz
+     */
+    uint32_t sample_rate;
+
+    /**
+     * Counts up by one for every datagram the sender sends for this channel, so a receiver can
+     * tell if any were lost
+     */
+    uint64_t seq;
+
+    /**
+     * When the first sample in this datagram was captured, in nanoseconds on the sender's
+     * CLOCK_MONOTONIC clock. 0 if unknown.
+     */
+    uint64_t start_time_ns;
+};
+
+/**
+ * Create a sender of PCM datagrams for a single channel. Samples are queued as datagrams, and
+ * sent in batches of up to PCM_UDP_BATCH_PACKETS, with a single system call.
+ *
+ * \param psnd The new sender, returned by reference
+ * \param dest Where to send the datagrams, as host:port. IPv6 addresses go in brackets. The host
+ *             can be a multicast group.
+ * \param channel_id The channel ID to put in every datagram
+ * \param sample_rate The sample rate, in Hz
+ * \param format The sample format
+ * \param ttl The multicast TTL (or hop limit), 0 for the system default
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_udp_sender_new(struct pcm_udp_sender **psnd, const char *dest, uint32_t channel_id,
+        uint32_t sample_rate, enum pcm_udp_format format, int ttl);
+
+/**
+ * Queue samples to be sent. Datagrams are sent whenever a full batch is queued; the rest wait for
+ * more samples, or for pcm_udp_sender_flush. Never blocks: datagrams the socket won't take are
+ * dropped.
+ *
+ * \param snd The sender
+ * \param samples The samples to send, in host byte order. Complex samples are interleaved.
+ * \param nr_samples The number of samples. A complex sample counts once.
+ * \param start_time_ns When the first sample was captured, on the CLOCK_MONOTONIC clock. 0 if
+ *                      unknown.
+ * \param pnr_dropped The number of samples that could not be sent, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_udp_sender_write(struct pcm_udp_sender *snd, const int16_t *samples, size_t nr_samples,
+        uint64_t start_time_ns, size_t *pnr_dropped);
+
+/**
+ * Send every queued datagram.
+ *
+ * \param snd The sender
+ * \param pnr_dropped The number of samples that could not be sent, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_udp_sender_flush(struct pcm_udp_sender *snd, size_t *pnr_dropped);
+
+/**
+ * Release a sender, dropping anything still queued.
+ *
+ * \param psnd The sender, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_udp_sender_delete(struct pcm_udp_sender **psnd);
+
+/**
+ * Create a receiver of PCM datagrams for a single channel.
+ *
+ * \param prcv The new receiver, returned by reference
+ * \param addr The address to listen on, as host:port. If the host is a multicast group, the
+ *             group is joined. Several receivers can listen on the same group and port.
+ * \param channel_id Only datagrams for this channel are accepted. 0 to accept any channel, which
+ *                   is only allowed for a unicast address with a single sender: a group carries
+ *                   many channels, and their samples (and sequence numbers) can't be mixed.
+ * \param format The sample format to accept. Datagrams in any other format are rejected.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_udp_receiver_new(struct pcm_udp_receiver **prcv, const char *addr, uint32_t channel_id,
+        enum pcm_udp_format format);
+
+/**
+ * Read samples, waiting up to timeout_ms for a datagram to arrive if none are waiting.
+ *
+ * \param rcv The receiver
+ * \param samples The buffer to read samples into. Complex samples are interleaved.
+ * \param max_samples The most samples to read. A complex sample counts once.
+ * \param pnr_read The number of samples read, returned by reference. Will be 0 if the timeout
+ *                 elapsed.
+ * \param timeout_ms The longest time to wait, in milliseconds. 0 to not wait at all.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_udp_receiver_read(struct pcm_udp_receiver *rcv, int16_t *samples, size_t max_samples,
+        size_t *pnr_read, int timeout_ms);
+
+/**
+ * Get the socket the receiver reads from, to wait on it with epoll or the like
+ */
+int pcm_udp_receiver_fd(struct pcm_udp_receiver *rcv);
+
+/**
+ * Get the number of datagrams that went missing, going by the gaps in their sequence numbers
+ */
+uint64_t pcm_udp_receiver_nr_lost(struct pcm_udp_receiver *rcv);
+
+/**
+ * Release a receiver, leaving any multicast group it joined.
+ *
+ * \param prcv The receiver, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pcm_udp_receiver_delete(struct pcm_udp_receiver **prcv);
+
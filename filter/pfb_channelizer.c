@@ -0,0 +1,400 @@
+/*
+ *  pfb_channelizer.c - A polyphase filter bank channelizer, splitting a
+ *          wideband complex signal into many equally-spaced channels.
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/pfb_channelizer.h>
+#include <filter/pfb_channelizer_priv.h>
+#include <filter/filter.h>
+#include <filter/filter_priv.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/diag.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+
+#include <string.h>
+#include <math.h>
+
+/**
+ * Number of outputs worth of input samples to stage in the history buffer at a time. This
+ * bounds how often the history has to be compacted.
+ */
+#define PFB_CHANNELIZER_BLOCK_HOPS          256
+
+/**
+ * Largest number of channels we'll support.
+ */
+#define PFB_CHANNELIZER_MAX_CHANNELS        4096
+
+aresult_t pfb_channelizer_design_prototype(double *taps, size_t nr_taps, unsigned nr_channels)
+{
+    aresult_t ret = A_OK;
+
+    double fc = 0.0,
+           sum = 0.0,
+           mid = 0.0;
+
+    TSL_ASSERT_ARG(NULL != taps);
+    TSL_ASSERT_ARG(1 < nr_taps);
+    TSL_ASSERT_ARG(0 != nr_channels);
+
+    /* Cutoff is at the channel spacing, in cycles per sample */
+    fc = 1.0 / (double)nr_channels;
+    mid = (double)(nr_taps - 1) / 2.0;
+
+    for (size_t i = 0; i < nr_taps; i++) {
+        double x = (double)i - mid,
+               phi = 2.0 * M_PI * (double)i / (double)(nr_taps - 1),
+               window = 0.42 - 0.5 * cos(phi) + 0.08 * cos(2.0 * phi),
+               sinc = (0.0 == x) ? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x);
+
+        taps[i] = sinc * window;
+        sum += taps[i];
+    }
+
+    /* Normalize to unity gain at DC */
+    for (size_t i = 0; i < nr_taps; i++) {
+        taps[i] /= sum;
+    }
+
+    return ret;
+}
+
+aresult_t pfb_channelizer_new(struct pfb_channelizer **ppfb, unsigned nr_channels, const double *proto_taps,
+        size_t nr_proto_taps)
+{
+    aresult_t ret = A_OK;
+
+    struct pfb_channelizer *pfb = NULL;
+    size_t taps_per_branch = 0,
+           nr_taps = 0;
+
+    TSL_ASSERT_ARG(NULL != ppfb);
+    TSL_ASSERT_ARG(2 <= nr_channels && PFB_CHANNELIZER_MAX_CHANNELS >= nr_channels);
+    TSL_ASSERT_ARG(0 == (nr_channels & (nr_channels - 1)));
+    TSL_ASSERT_ARG(NULL != proto_taps);
+    TSL_ASSERT_ARG(0 != nr_proto_taps);
+
+    *ppfb = NULL;
+
+    if (FAILED(ret = TZAALLOC(pfb, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    taps_per_branch = (nr_proto_taps + nr_channels - 1) / nr_channels;
+    nr_taps = taps_per_branch * nr_channels;
+
+    pfb->nr_channels = nr_channels;
+    pfb->log2_channels = __builtin_ctz(nr_channels);
+    pfb->taps_per_branch = taps_per_branch;
+    pfb->hop = nr_channels / 2;
+
+    if (FAILED(ret = TACALLOC((void **)&pfb->branch_coeffs, nr_taps, sizeof(float), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    /* Decompose the prototype filter into its branches. Any padding taps are left as 0. */
+    for (size_t i = 0; i < nr_proto_taps; i++) {
+        pfb->branch_coeffs[(i % nr_channels) * taps_per_branch + (i / nr_channels)] = (float)proto_taps[i];
+    }
+
+    pfb->hist_capacity = nr_taps + pfb->hop * PFB_CHANNELIZER_BLOCK_HOPS;
+    if (FAILED(ret = TACALLOC((void **)&pfb->hist, pfb->hist_capacity, 2 * sizeof(float), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    /* Prime the history so the first output is produced after the first hop of input */
+    pfb->nr_hist = nr_taps - pfb->hop;
+    pfb->hist_base = 0;
+
+    if (FAILED(ret = TACALLOC((void **)&pfb->fft_buf, nr_channels, 2 * sizeof(float), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&pfb->twiddles, nr_channels / 2, 2 * sizeof(float), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_channels / 2; i++) {
+        double phi = 2.0 * M_PI * (double)i / (double)nr_channels;
+        pfb->twiddles[2 * i    ] = (float)cos(phi);
+        pfb->twiddles[2 * i + 1] = (float)sin(phi);
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&pfb->bit_reverse, nr_channels, sizeof(uint16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_channels; i++) {
+        unsigned rev = 0;
+        for (size_t j = 0; j < pfb->log2_channels; j++) {
+            rev |= ((i >> j) & 1) << (pfb->log2_channels - 1 - j);
+        }
+        pfb->bit_reverse[i] = rev;
+    }
+
+    DIAG("PFB: %u channels, %zu taps per branch, hop of %u samples", nr_channels, taps_per_branch, pfb->hop);
+
+    *ppfb = pfb;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != pfb) {
+            TSL_BUG_IF_FAILED(pfb_channelizer_delete(&pfb));
+        }
+    }
+    return ret;
+}
+
+aresult_t pfb_channelizer_delete(struct pfb_channelizer **ppfb)
+{
+    aresult_t ret = A_OK;
+
+    struct pfb_channelizer *pfb = NULL;
+
+    TSL_ASSERT_PTR_BY_REF(ppfb);
+
+    pfb = *ppfb;
+
+    if (NULL != pfb->branch_coeffs) {
+        TFREE(pfb->branch_coeffs);
+    }
+
+    if (NULL != pfb->hist) {
+        TFREE(pfb->hist);
+    }
+
+    if (NULL != pfb->fft_buf) {
+        TFREE(pfb->fft_buf);
+    }
+
+    if (NULL != pfb->twiddles) {
+        TFREE(pfb->twiddles);
+    }
+
+    if (NULL != pfb->bit_reverse) {
+        TFREE(pfb->bit_reverse);
+    }
+
+    TFREE(pfb);
+    *ppfb = NULL;
+
+    return ret;
+}
+
+unsigned pfb_channelizer_hop(struct pfb_channelizer *pfb)
+{
+    TSL_BUG_ON(NULL == pfb);
+    return pfb->hop;
+}
+
+size_t pfb_channelizer_max_outputs(struct pfb_channelizer *pfb, size_t nr_in)
+{
+    TSL_BUG_ON(NULL == pfb);
+    return (nr_in + pfb->hop - 1) / pfb->hop;
+}
+
+aresult_t pfb_channelizer_channel_for_offset(struct pfb_channelizer *pfb, uint32_t sample_rate, int32_t offset_hz,
+        unsigned *pchannel, int32_t *presidual_hz)
+{
+    aresult_t ret = A_OK;
+
+    double spacing = 0.0;
+    long signed_channel = 0;
+
+    TSL_ASSERT_ARG(NULL != pfb);
+    TSL_ASSERT_ARG(0 != sample_rate);
+    TSL_ASSERT_ARG(NULL != pchannel);
+    TSL_ASSERT_ARG(NULL != presidual_hz);
+
+    if ((int64_t)offset_hz * 2 >= (int64_t)sample_rate || (int64_t)offset_hz * 2 < -(int64_t)sample_rate) {
+        FIL_MSG(SEV_ERROR, "OFFSET-OUT-OF-RANGE", "Offset of %d Hz is outside of the sampled bandwidth", offset_hz);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    spacing = (double)sample_rate / (double)pfb->nr_channels;
+    signed_channel = lround((double)offset_hz / spacing);
+
+    *presidual_hz = (int32_t)lround((double)offset_hz - (double)signed_channel * spacing);
+    *pchannel = (unsigned)((signed_channel + (long)pfb->nr_channels) % (long)pfb->nr_channels);
+
+done:
+    return ret;
+}
+
+/**
+ * Evaluate each branch filter against the window, writing the results in bit-reversed order
+ * to the FFT buffer.
+ */
+static inline
+void _pfb_channelizer_branches(struct pfb_channelizer *pfb, const float *window)
+{
+    const size_t nr_channels = pfb->nr_channels,
+                 taps_per_branch = pfb->taps_per_branch,
+                 newest = nr_channels * taps_per_branch - 1;
+
+    for (size_t m = 0; m < nr_channels; m++) {
+        const float *coeffs = &pfb->branch_coeffs[m * taps_per_branch];
+        float acc_re = 0.0f,
+              acc_im = 0.0f;
+        size_t rev = pfb->bit_reverse[m];
+
+        for (size_t p = 0; p < taps_per_branch; p++) {
+            const float *sample = &window[2 * (newest - m - p * nr_channels)];
+            acc_re += coeffs[p] * sample[0];
+            acc_im += coeffs[p] * sample[1];
+        }
+
+        pfb->fft_buf[2 * rev    ] = acc_re;
+        pfb->fft_buf[2 * rev + 1] = acc_im;
+    }
+}
+
+/**
+ * In-place radix-2 inverse DFT (without normalization) of the bit-reversed FFT buffer.
+ */
+static inline
+void _pfb_channelizer_ifft(struct pfb_channelizer *pfb)
+{
+    const size_t nr_channels = pfb->nr_channels;
+    float *buf = pfb->fft_buf;
+
+    for (size_t size = 2; size <= nr_channels; size <<= 1) {
+        size_t half = size >> 1,
+               tw_step = nr_channels / size;
+
+        for (size_t start = 0; start < nr_channels; start += size) {
+            for (size_t j = 0; j < half; j++) {
+                const float *tw = &pfb->twiddles[2 * j * tw_step];
+                float *a = &buf[2 * (start + j)],
+                      *b = &buf[2 * (start + j + half)];
+                float t_re = b[0] * tw[0] - b[1] * tw[1],
+                      t_im = b[0] * tw[1] + b[1] * tw[0];
+
+                b[0] = a[0] - t_re;
+                b[1] = a[1] - t_im;
+                a[0] += t_re;
+                a[1] += t_im;
+            }
+        }
+    }
+}
+
+static inline
+int16_t _pfb_channelizer_to_q15(float v)
+{
+    long r = lrintf(v);
+
+    if (r > INT16_MAX) {
+        r = INT16_MAX;
+    } else if (r < INT16_MIN) {
+        r = INT16_MIN;
+    }
+
+    return (int16_t)r;
+}
+
+aresult_t pfb_channelizer_process(struct pfb_channelizer *pfb, const int16_t *in, size_t nr_in,
+        int16_t *const *chan_out, size_t nr_out_max, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_consumed = 0,
+           nr_out = 0,
+           nr_taps = 0;
+
+    TSL_ASSERT_ARG(NULL != pfb);
+    TSL_ASSERT_ARG(NULL != in);
+    TSL_ASSERT_ARG(NULL != chan_out);
+    TSL_ASSERT_ARG(NULL != pnr_out);
+    TSL_ASSERT_ARG(nr_out_max >= pfb_channelizer_max_outputs(pfb, nr_in));
+
+    *pnr_out = 0;
+
+    nr_taps = pfb->nr_channels * pfb->taps_per_branch;
+
+    while (true) {
+        if (pfb->hist_base + nr_taps > pfb->nr_hist) {
+            size_t nr_copy = 0;
+            float *dest = NULL;
+
+            if (nr_consumed == nr_in) {
+                /* Everything has been consumed, we're done until the next buffer arrives */
+                break;
+            }
+
+            /* Move the remaining history to the start of the buffer */
+            if (0 != pfb->hist_base) {
+                memmove(pfb->hist, &pfb->hist[2 * pfb->hist_base],
+                        2 * sizeof(float) * (pfb->nr_hist - pfb->hist_base));
+                pfb->nr_hist -= pfb->hist_base;
+                pfb->hist_base = 0;
+            }
+
+            /* Stage as many new samples as we can */
+            nr_copy = BL_MIN2(pfb->hist_capacity - pfb->nr_hist, nr_in - nr_consumed);
+            dest = &pfb->hist[2 * pfb->nr_hist];
+
+            for (size_t i = 0; i < 2 * nr_copy; i++) {
+                dest[i] = (float)in[2 * nr_consumed + i];
+            }
+
+            pfb->nr_hist += nr_copy;
+            nr_consumed += nr_copy;
+
+            continue;
+        }
+
+        TSL_BUG_ON(nr_out >= nr_out_max);
+
+        _pfb_channelizer_branches(pfb, &pfb->hist[2 * pfb->hist_base]);
+        _pfb_channelizer_ifft(pfb);
+
+        for (size_t k = 0; k < pfb->nr_channels; k++) {
+            float re = pfb->fft_buf[2 * k],
+                  im = pfb->fft_buf[2 * k + 1];
+
+            if (NULL == chan_out[k]) {
+                continue;
+            }
+
+            /* Correct for the phase advance of the odd channels over a half-length hop */
+            if (true == pfb->odd_output && (k & 1)) {
+                re = -re;
+                im = -im;
+            }
+
+            chan_out[k][2 * nr_out    ] = _pfb_channelizer_to_q15(re);
+            chan_out[k][2 * nr_out + 1] = _pfb_channelizer_to_q15(im);
+        }
+
+        nr_out++;
+        pfb->hist_base += pfb->hop;
+        pfb->odd_output = !pfb->odd_output;
+    }
+
+    *pnr_out = nr_out;
+
+    return ret;
+}
+
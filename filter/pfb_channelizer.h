@@ -0,0 +1,98 @@
+#pragma once
+
+#include <filter/filter.h>
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pfb_channelizer;
+
+/**
+ * Create a new polyphase filter bank channelizer.
+ *
+ * The channelizer splits a complex input stream sampled at f_s into nr_channels equally
+ * spaced channels, where channel k is centered at k * f_s / nr_channels (channels above
+ * nr_channels/2 represent negative frequency offsets). The filter bank is oversampled by
+ * 2, so each channel is produced at 2 * f_s / nr_channels. This allows a signal that sits
+ * anywhere between two channel centers to be recovered without aliasing.
+ *
+ * \param ppfb The new channelizer state, returned by reference.
+ * \param nr_channels The number of channels. Must be a power of 2, at least 2.
+ * \param proto_taps The prototype low-pass filter, at the input sample rate. Typically has a
+ *                   cutoff of f_s / nr_channels.
+ * \param nr_proto_taps The number of taps in the prototype filter.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pfb_channelizer_new(struct pfb_channelizer **ppfb, unsigned nr_channels, const double *proto_taps,
+        size_t nr_proto_taps);
+
+/**
+ * Delete a polyphase filter bank channelizer.
+ *
+ * \param ppfb The channelizer state, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pfb_channelizer_delete(struct pfb_channelizer **ppfb);
+
+/**
+ * Channelize a buffer of complex Q.15 samples.
+ *
+ * \param pfb The channelizer state
+ * \param in The input samples, interleaved I/Q
+ * \param nr_in The number of complex input samples
+ * \param chan_out An array of nr_channels output buffers. Output for channel k is written,
+ *                 interleaved I/Q, to chan_out[k]. Channels with a NULL output buffer are
+ *                 skipped.
+ * \param nr_out_max The capacity of each output buffer, in complex samples. Must be at least
+ *                   pfb_channelizer_max_outputs(pfb, nr_in).
+ * \param pnr_out The number of samples written to each output buffer, returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pfb_channelizer_process(struct pfb_channelizer *pfb, const int16_t *in, size_t nr_in,
+        int16_t *const *chan_out, size_t nr_out_max, size_t *pnr_out);
+
+/**
+ * Get the number of input samples consumed for every output sample of a channel.
+ */
+unsigned pfb_channelizer_hop(struct pfb_channelizer *pfb);
+
+/**
+ * Get the most output samples a single call to pfb_channelizer_process could produce
+ * for the given number of input samples.
+ */
+size_t pfb_channelizer_max_outputs(struct pfb_channelizer *pfb, size_t nr_in);
+
+/**
+ * Map a frequency offset (relative to the input center frequency) to the channel that
+ * contains it.
+ *
+ * \param pfb The channelizer state
+ * \param sample_rate The input sample rate, in Hz
+ * \param offset_hz The offset of the signal of interest from the center frequency, in Hz
+ * \param pchannel The channel index, returned by reference
+ * \param presidual_hz The offset of the signal from the center of that channel, returned by
+ *                     reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pfb_channelizer_channel_for_offset(struct pfb_channelizer *pfb, uint32_t sample_rate, int32_t offset_hz,
+        unsigned *pchannel, int32_t *presidual_hz);
+
+/**
+ * Design a prototype filter suitable for a channelizer with the given number of channels.
+ * This is a Blackman-windowed sinc with a cutoff of f_s / nr_channels, normalized to unity
+ * gain at DC.
+ *
+ * \param taps The output array of filter taps
+ * \param nr_taps The number of taps to generate. Should be a multiple of nr_channels.
+ * \param nr_channels The number of channels the filter will be used with.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pfb_channelizer_design_prototype(double *taps, size_t nr_taps, unsigned nr_channels);
+
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The state for a polyphase filter bank channelizer. The prototype filter h[] of length L = M * P
+ * is decomposed into M branch filters of P taps each, where branch m holds h[m + p * M].
+ *
+ * Every M/2 input samples, each branch filter is evaluated against the sample history, and an
+ * M-point inverse DFT of the branch outputs yields one output sample for each of the M channels.
+ *
+ * All intermediate math is performed in single-precision float; the input and output samples are
+ * complex Q.15.
+ */
+struct pfb_channelizer {
+    /**
+     * The branch filter coefficients. There are nr_channels branches with taps_per_branch coefficients
+     * each. The p'th coefficient for branch m is found at (m * taps_per_branch + p).
+     */
+    float *branch_coeffs;
+
+    /**
+     * The number of channels (M). Always a power of 2.
+     */
+    unsigned nr_channels;
+
+    /**
+     * log2(nr_channels)
+     */
+    unsigned log2_channels;
+
+    /**
+     * The number of taps in each branch filter (P)
+     */
+    size_t taps_per_branch;
+
+    /**
+     * The number of input samples consumed per output sample (M/2)
+     */
+    unsigned hop;
+
+    /**
+     * Sample history, interleaved I/Q. The newest sample is at the end. The window for the next
+     * output starts at hist_base.
+     */
+    float *hist;
+
+    /**
+     * The capacity of hist, in complex samples
+     */
+    size_t hist_capacity;
+
+    /**
+     * The number of valid complex samples in hist
+     */
+    size_t nr_hist;
+
+    /**
+     * The start of the window for the next output, in hist
+     */
+    size_t hist_base;
+
+    /**
+     * Branch filter outputs; these are transformed in-place. Interleaved I/Q.
+     */
+    float *fft_buf;
+
+    /**
+     * Twiddle factors for the inverse DFT, e^(+j2pi*i/M), for i in [0, M/2). Interleaved I/Q.
+     */
+    float *twiddles;
+
+    /**
+     * Bit-reversal permutation for an M-point FFT
+     */
+    uint16_t *bit_reverse;
+
+    /**
+     * Parity of the output sample counter. With a hop of M/2, odd channels pick up a factor of
+     * (-1) on every other output.
+     */
+    bool odd_output;
+};
+
@@ -22,10 +22,12 @@
  */
 
 #include <filter/polyphase_fir.h>
+#include <filter/cycle_counter.h>
 #include <filter/polyphase_fir_priv.h>
 #include <filter/filter.h>
 #include <filter/filter_priv.h>
 #include <filter/sample_buf.h>
+#include <filter/sample_ring.h>
 #include <filter/utils.h>
 
 #include <tsl/safe_alloc.h>
@@ -33,19 +35,31 @@
 #include <tsl/errors.h>
 #include <tsl/assert.h>
 
+#include <math.h>
+#include <stdlib.h>
+
 /**
- * Construct a new polyphase FIR.
- *
- * \param pfir The new polyphase FIR state, returned by reference.
- * \param nr_coeffs The number of coefficients in the FIR
- * \param fir_coeff The real coefficients for the FIR. In Q.15 representation.
- * \param interpolate The factor to interpolate (upsample) by
- * \param decimate The factor to decimate (downsample) by
- *
- * \return A_OK on success, an error code otherwise.
+ * Whether a set of coefficients is symmetric about its center
  */
-aresult_t polyphase_fir_new(struct polyphase_fir **pfir, size_t nr_coeffs, const int16_t *fir_coeff,
-            unsigned interpolate, unsigned decimate)
+static
+bool _polyphase_fir_symmetric(const int16_t *fir_coeff, size_t nr_coeffs)
+{
+    if (nr_coeffs < 2) {
+        return false;
+    }
+
+    for (size_t k = 0; k < nr_coeffs / 2; k++) {
+        if (fir_coeff[k] != fir_coeff[nr_coeffs - 1 - k]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static
+aresult_t _polyphase_fir_new(struct polyphase_fir **pfir, size_t nr_coeffs, const int16_t *fir_coeff,
+            unsigned interpolate, unsigned decimate, bool is_complex)
 {
     aresult_t ret = A_OK;
 
@@ -63,16 +77,31 @@ aresult_t polyphase_fir_new(struct polyphase_fir **pfir, size_t nr_coeffs, const
     }
 
     fir->nr_phase_filters = interpolate;
+    fir->is_complex = is_complex;
     fir->interpolation = interpolate;
     fir->decimation = decimate;
 
     /* Determine the number of coefficients in each phase */
     phase_coeffs = (nr_coeffs + interpolate - 1)/interpolate;
 
-    /* Round up to nearest 4 */
-    phase_coeffs = (phase_coeffs + 3) & ~(4-1);
+    /*
+     * With no interpolation, the one phase filter is the prototype itself, so a symmetric
+     * prototype can be folded. Otherwise each phase filter is the mirror image of another phase,
+     * rather than of itself, so there is nothing to fold.
+     */
+    fir->symmetric = 1 == interpolate && _polyphase_fir_symmetric(fir_coeff, nr_coeffs);
+
+    if (false == fir->symmetric) {
+        /* Round up to nearest 4. Padding would break the symmetry, so isn't done for a folded filter. */
+        phase_coeffs = (phase_coeffs + 3) & ~(4-1);
+    }
+
     fir->nr_filter_coeffs = phase_coeffs;
 
+    if (FAILED(ret = dot_product_find(phase_coeffs, is_complex, fir->symmetric, &fir->dot_product))) {
+        goto done;
+    }
+
     if (FAILED(ret = TACALLOC((void **)&fir->phase_filters, interpolate,  phase_coeffs * sizeof(sample_t), SYS_CACHE_LINE_LENGTH))) {
         goto done;
     }
@@ -104,6 +133,225 @@ done:
     return ret;
 }
 
+/**
+ * Construct a new polyphase FIR.
+ *
+ * \param pfir The new polyphase FIR state, returned by reference.
+ * \param nr_coeffs The number of coefficients in the FIR
+ * \param fir_coeff The real coefficients for the FIR. In Q.15 representation.
+ * \param interpolate The factor to interpolate (upsample) by
+ * \param decimate The factor to decimate (downsample) by
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_new(struct polyphase_fir **pfir, size_t nr_coeffs, const int16_t *fir_coeff,
+            unsigned interpolate, unsigned decimate)
+{
+    return _polyphase_fir_new(pfir, nr_coeffs, fir_coeff, interpolate, decimate, false);
+}
+
+/**
+ * Construct a new polyphase FIR for complex samples. The coefficients are real, and applied to
+ * I and Q alike. Sample buffers pushed to this FIR must hold interleaved I/Q samples, with
+ * nr_samples counting complex samples, and the output is interleaved I/Q.
+ *
+ * \param pfir The new polyphase FIR state, returned by reference.
+ * \param nr_coeffs The number of coefficients in the FIR
+ * \param fir_coeff The real coefficients for the FIR. In Q.15 representation.
+ * \param interpolate The factor to interpolate (upsample) by
+ * \param decimate The factor to decimate (downsample) by
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_new_complex(struct polyphase_fir **pfir, size_t nr_coeffs, const int16_t *fir_coeff,
+            unsigned interpolate, unsigned decimate)
+{
+    return _polyphase_fir_new(pfir, nr_coeffs, fir_coeff, interpolate, decimate, true);
+}
+
+/**
+ * The windowed sinc behind the fractional resampler's phase filters, t input samples from the
+ * centre of a filter half_width samples either side.
+ */
+static
+double _polyphase_fir_frac_kernel(double t, double cutoff, double half_width)
+{
+    double x = 2.0 * cutoff * t,
+           sinc = 1.0;
+
+    if (fabs(t) >= half_width) {
+        return 0.0;
+    }
+
+    if (0.0 != x) {
+        sinc = sin(M_PI * x) / (M_PI * x);
+    }
+
+    /* Blackman window */
+    return 2.0 * cutoff * sinc *
+        (0.42 + 0.5 * cos(M_PI * t / half_width) + 0.08 * cos(2.0 * M_PI * t / half_width));
+}
+
+static
+aresult_t _polyphase_fir_new_fractional(struct polyphase_fir **pfir, double ratio, bool is_complex)
+{
+    aresult_t ret = A_OK;
+
+    struct polyphase_fir *fir = NULL;
+    size_t nr_taps = 0;
+    double cutoff = 0.0,
+           delay = 0.0;
+    uint64_t step = 0;
+
+    TSL_ASSERT_ARG(NULL != pfir);
+    TSL_ASSERT_ARG(ratio >= POLYPHASE_FIR_FRAC_RATIO_MIN && ratio <= POLYPHASE_FIR_FRAC_RATIO_MAX);
+
+    if (FAILED(ret = TZAALLOC(fir, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    fir->fractional = true;
+    fir->is_complex = is_complex;
+    fir->nr_phase_filters = POLYPHASE_FIR_FRAC_PHASES + 1;
+
+    /* Band limit to the narrower of the input and output, and widen the filter to match */
+    cutoff = 0.45 * BL_MIN2(ratio, 1.0);
+    nr_taps = (size_t)ceil((double)POLYPHASE_FIR_FRAC_TAPS / BL_MIN2(ratio, 1.0));
+    nr_taps = (nr_taps + 3) & ~(4-1);
+    delay = (double)(nr_taps - 1) / 2.0;
+
+    fir->nr_filter_coeffs = nr_taps;
+
+    if (FAILED(ret = dot_product_find(nr_taps, is_complex, false, &fir->dot_product))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&fir->phase_filters, fir->nr_phase_filters, nr_taps * sizeof(sample_t),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < fir->nr_phase_filters; i++) {
+        int16_t *phase_filter = &fir->phase_filters[i * nr_taps];
+        double mu = (double)i / (double)POLYPHASE_FIR_FRAC_PHASES,
+               sum = 0.0;
+
+        for (size_t j = 0; j < nr_taps; j++) {
+            sum += _polyphase_fir_frac_kernel((double)j - delay - mu, cutoff, (double)nr_taps / 2.0);
+        }
+
+        /* Normalize each phase to unity gain at DC, so the gain doesn't ripple with the phase */
+        for (size_t j = 0; j < nr_taps; j++) {
+            double coeff = _polyphase_fir_frac_kernel((double)j - delay - mu, cutoff, (double)nr_taps / 2.0);
+            phase_filter[j] = (int16_t)lrint(coeff / sum * (double)(1 << Q_15_SHIFT));
+        }
+    }
+
+    step = (uint64_t)llrint(ldexp(1.0 / ratio, 32));
+    fir->frac_step_int = step >> 32;
+    fir->frac_step = (uint32_t)step;
+
+    DIAG("Fractional resampler: ratio %f, %zu phases of %zu taps", ratio, fir->nr_phase_filters, nr_taps);
+
+    *pfir = fir;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != fir) {
+            if (NULL != fir->phase_filters) {
+                TFREE(fir->phase_filters);
+            }
+            TFREE(fir);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Construct a new fractional resampler, for arbitrary ratios of output to input sample rate that
+ * would need an impractically large number of phases as a polyphase FIR. A fixed bank of
+ * POLYPHASE_FIR_FRAC_PHASES + 1 phase filters is designed for the ratio, and each output sample
+ * is linearly interpolated between the outputs of the two phases either side of it (a first
+ * order Farrow structure). The filter low-pass filters to 0.45 of the lower of the two rates.
+ *
+ * The resampler is used just like a polyphase FIR.
+ *
+ * \param pfir The new resampler state, returned by reference.
+ * \param ratio The output sample rate over the input sample rate, between
+ *              POLYPHASE_FIR_FRAC_RATIO_MIN and POLYPHASE_FIR_FRAC_RATIO_MAX
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_new_fractional(struct polyphase_fir **pfir, double ratio)
+{
+    return _polyphase_fir_new_fractional(pfir, ratio, false);
+}
+
+/**
+ * Construct a new fractional resampler for complex samples, as polyphase_fir_new_fractional.
+ * Sample buffers must hold interleaved I/Q samples, as for polyphase_fir_new_complex.
+ *
+ * \param pfir The new resampler state, returned by reference.
+ * \param ratio The output sample rate over the input sample rate
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_new_fractional_complex(struct polyphase_fir **pfir, double ratio)
+{
+    return _polyphase_fir_new_fractional(pfir, ratio, true);
+}
+
+/**
+ * Parse a resampling ratio, either as a fraction (e.g. 38400/25000) or a decimal number.
+ *
+ * \param str The ratio
+ * \param pratio The ratio, returned by reference
+ *
+ * \return A_OK on success, A_E_INVAL if the ratio is malformed or out of range
+ */
+aresult_t polyphase_fir_parse_ratio(const char *str, double *pratio)
+{
+    aresult_t ret = A_OK;
+
+    char *end = NULL;
+    double num = 0.0,
+           den = 1.0;
+
+    TSL_ASSERT_ARG(NULL != str);
+    TSL_ASSERT_ARG(NULL != pratio);
+
+    num = strtod(str, &end);
+
+    if (end == str) {
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if ('/' == *end) {
+        const char *den_str = end + 1;
+
+        den = strtod(den_str, &end);
+
+        if (end == den_str) {
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    if ('\0' != *end || !(den > 0.0) || !(num / den >= POLYPHASE_FIR_FRAC_RATIO_MIN) ||
+            num / den > POLYPHASE_FIR_FRAC_RATIO_MAX)
+    {
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    *pratio = num / den;
+
+done:
+    return ret;
+}
+
 /**
  * Delete/clean up resources consumed by a polyphase FIR.
  *
@@ -121,6 +369,17 @@ aresult_t polyphase_fir_delete(struct polyphase_fir **pfir)
 
     fir = *pfir;
 
+    /* Hand back any sample buffers we were still holding */
+    if (NULL != fir->sb_active) {
+        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_active));
+        fir->sb_active = NULL;
+    }
+
+    if (NULL != fir->sb_next) {
+        TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_next));
+        fir->sb_next = NULL;
+    }
+
     if (NULL != fir->phase_filters) {
         TFREE(fir->phase_filters);
     }
@@ -159,6 +418,68 @@ done:
     return ret;
 }
 
+/**
+ * Compute the dot product of a phase filter with the window starting at the next sample to be
+ * processed.
+ *
+ * \return A_OK on success, A_E_DONE if the window isn't all there yet
+ */
+static
+aresult_t _polyphase_fir_dot(struct polyphase_fir *fir, const int16_t *phase_filter, int16_t *out)
+{
+    if (fir->sample_offset + fir->nr_filter_coeffs <= fir->sb_active->nr_samples) {
+        /* The window is contiguous in the active buffer */
+        return fir->dot_product((int16_t *)fir->sb_active->data_buf +
+                    (true == fir->is_complex ? 2 : 1) * fir->sample_offset,
+                phase_filter, fir->nr_filter_coeffs, out);
+    } else if (true == fir->is_complex) {
+        return dot_product_sample_buffers_complex(fir->sb_active, fir->sb_next, fir->sample_offset,
+                (int16_t *)phase_filter, fir->nr_filter_coeffs, out);
+    } else {
+        return dot_product_sample_buffers_real(fir->sb_active, fir->sb_next, fir->sample_offset,
+                (int16_t *)phase_filter, fir->nr_filter_coeffs, out);
+    }
+}
+
+/**
+ * The phase filter of a fractional resampler for its current position. The next phase filter
+ * follows it.
+ */
+static inline
+const int16_t *_polyphase_fir_frac_phase(const struct polyphase_fir *fir)
+{
+    return &fir->phase_filters[fir->nr_filter_coeffs * (fir->frac_pos >> (32 - POLYPHASE_FIR_FRAC_PHASE_BITS))];
+}
+
+/**
+ * Blend the outputs of the two phase filters either side of a fractional resampler's current
+ * position, leaving the result in out.
+ */
+static inline
+void _polyphase_fir_frac_blend(const struct polyphase_fir *fir, int16_t *out, const int16_t *next)
+{
+    int32_t blend = (fir->frac_pos >> POLYPHASE_FIR_FRAC_BLEND_SHIFT) & ((1 << Q_15_SHIFT) - 1);
+
+    for (size_t k = 0; k < (true == fir->is_complex ? 2 : 1); k++) {
+        out[k] += (((int32_t)next[k] - (int32_t)out[k]) * blend + (1 << (Q_15_SHIFT - 1))) >> Q_15_SHIFT;
+    }
+}
+
+/**
+ * Step a fractional resampler on to its next output sample.
+ *
+ * \return The number of whole input samples to move forward by
+ */
+static inline
+size_t _polyphase_fir_frac_step(struct polyphase_fir *fir)
+{
+    uint64_t pos = (uint64_t)fir->frac_pos + fir->frac_step;
+
+    fir->frac_pos = (uint32_t)pos;
+
+    return fir->frac_step_int + (size_t)(pos >> 32);
+}
+
 aresult_t polyphase_fir_process(struct polyphase_fir *fir, int16_t *out_buf, size_t nr_out_samples,
         size_t *nr_out_samples_generated)
 {
@@ -168,6 +489,8 @@ aresult_t polyphase_fir_process(struct polyphase_fir *fir, int16_t *out_buf, siz
            nr_consumed = 0,
            nr_computed_samples = 0;
 
+    CYCLE_COUNT_START(cycles);
+
     TSL_ASSERT_ARG(NULL != fir);
     TSL_ASSERT_ARG(NULL != out_buf);
     TSL_ASSERT_ARG(0 != nr_out_samples);
@@ -183,15 +506,22 @@ aresult_t polyphase_fir_process(struct polyphase_fir *fir, int16_t *out_buf, siz
 
     for (size_t i = 0; i < nr_out_samples && fir->nr_samples > fir->nr_filter_coeffs; i++) {
         size_t interp_phase = 0;
-        TSL_BUG_ON(phase_id >= fir->nr_phase_filters);
-
-        aresult_t filt_ret = dot_product_sample_buffers_real(
-                fir->sb_active,
-                fir->sb_next,
-                fir->sample_offset,
-                &fir->phase_filters[fir->nr_filter_coeffs * phase_id],
-                fir->nr_filter_coeffs,
-                &out_buf[i]);
+        int16_t *out = &out_buf[(true == fir->is_complex ? 2 : 1) * i];
+        aresult_t filt_ret = A_OK;
+
+        if (true == fir->fractional) {
+            const int16_t *phase_filter = _polyphase_fir_frac_phase(fir);
+            int16_t next[2];
+
+            /* The next phase filters the same window, so is there if the first one was */
+            if (A_OK == (filt_ret = _polyphase_fir_dot(fir, phase_filter, out))) {
+                filt_ret = _polyphase_fir_dot(fir, phase_filter + fir->nr_filter_coeffs, next);
+                _polyphase_fir_frac_blend(fir, out, next);
+            }
+        } else {
+            TSL_BUG_ON(phase_id >= fir->nr_phase_filters);
+            filt_ret = _polyphase_fir_dot(fir, &fir->phase_filters[fir->nr_filter_coeffs * phase_id], out);
+        }
 
         if (filt_ret == A_E_DONE) {
             *nr_out_samples_generated = i;
@@ -203,10 +533,15 @@ aresult_t polyphase_fir_process(struct polyphase_fir *fir, int16_t *out_buf, siz
         nr_computed_samples++;
 
         /* Calculate the next phase to process */
-        phase_id += fir->decimation;
+        if (true == fir->fractional) {
+            interp_phase = _polyphase_fir_frac_step(fir);
+        } else {
+            phase_id += fir->decimation;
+
+            interp_phase = phase_id / fir->interpolation;
+            phase_id = phase_id % fir->interpolation;
+        }
 
-        interp_phase = phase_id / fir->interpolation;
-        phase_id = phase_id % fir->interpolation;
         nr_consumed += interp_phase;
         fir->nr_samples -= interp_phase;
 
@@ -229,6 +564,92 @@ aresult_t polyphase_fir_process(struct polyphase_fir *fir, int16_t *out_buf, siz
     *nr_out_samples_generated = nr_computed_samples;
 
 done:
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_POLYPHASE_FIR, cycles);
+
+    return ret;
+}
+
+/**
+ * Run the polyphase FIR over samples in a sample ring, rather than over pushed sample buffers.
+ * Every window is contiguous in the ring, so each output is a single dot product. Samples are
+ * consumed from the ring once no future output needs them. Don't mix this with
+ * polyphase_fir_push_sample_buf on the same FIR.
+ *
+ * \param fir The polyphase FIR
+ * \param ring The ring to read from. Must have 2-byte samples, or 4-byte samples for a complex FIR.
+ * \param out_buf The buffer to write output samples to
+ * \param nr_out_samples The maximum number of output samples out_buf can hold
+ * \param nr_out_samples_generated The number of samples written to out_buf, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_process_ring(struct polyphase_fir *fir, struct sample_ring *ring, int16_t *out_buf,
+        size_t nr_out_samples, size_t *nr_out_samples_generated)
+{
+    aresult_t ret = A_OK;
+
+    const int16_t *samples = NULL;
+    size_t width = 0,
+           nr_avail = 0,
+           nr_consume = 0,
+           phase_id = 0,
+           i = 0;
+
+    CYCLE_COUNT_START(cycles);
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != ring);
+    TSL_ASSERT_ARG(NULL != out_buf);
+    TSL_ASSERT_ARG(0 != nr_out_samples);
+    TSL_ASSERT_ARG(NULL != nr_out_samples_generated);
+
+    width = true == fir->is_complex ? 2 : 1;
+
+    TSL_ASSERT_ARG(width * sizeof(int16_t) == ring->sample_bytes);
+    TSL_BUG_ON(NULL != fir->sb_active);
+
+    TSL_BUG_IF_FAILED(sample_ring_read_ptr(ring, (const void **)&samples, &nr_avail));
+
+    phase_id = fir->last_phase;
+
+    for (i = 0; i < nr_out_samples && fir->sample_offset + fir->nr_filter_coeffs <= nr_avail; i++) {
+        const int16_t *phase_filter = &fir->phase_filters[fir->nr_filter_coeffs * phase_id];
+
+        if (true == fir->fractional) {
+            int16_t next[2];
+
+            phase_filter = _polyphase_fir_frac_phase(fir);
+
+            TSL_BUG_IF_FAILED(fir->dot_product(samples + width * fir->sample_offset, phase_filter,
+                        fir->nr_filter_coeffs, &out_buf[width * i]));
+            TSL_BUG_IF_FAILED(fir->dot_product(samples + width * fir->sample_offset,
+                        phase_filter + fir->nr_filter_coeffs, fir->nr_filter_coeffs, next));
+            _polyphase_fir_frac_blend(fir, &out_buf[width * i], next);
+
+            fir->sample_offset += _polyphase_fir_frac_step(fir);
+            continue;
+        }
+
+        TSL_BUG_IF_FAILED(fir->dot_product(samples + width * fir->sample_offset, phase_filter,
+                    fir->nr_filter_coeffs, &out_buf[width * i]));
+
+        /* Calculate the next phase to process */
+        phase_id += fir->decimation;
+        fir->sample_offset += phase_id / fir->interpolation;
+        phase_id = phase_id % fir->interpolation;
+    }
+
+    fir->last_phase = phase_id;
+
+    /* Release the samples we've moved past */
+    nr_consume = BL_MIN2(fir->sample_offset, nr_avail);
+    TSL_BUG_IF_FAILED(sample_ring_consume(ring, nr_consume));
+    fir->sample_offset -= nr_consume;
+
+    *nr_out_samples_generated = i;
+
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_POLYPHASE_FIR, cycles);
+
     return ret;
 }
 
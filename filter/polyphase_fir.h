@@ -5,14 +5,28 @@
 #include <stdbool.h>
 
 struct sample_buf;
+struct sample_ring;
 struct polyphase_fir;
 
+/**
+ * The range of output to input sample rate ratios a fractional resampler can be built for
+ */
+#define POLYPHASE_FIR_FRAC_RATIO_MIN        (1.0/16.0)
+#define POLYPHASE_FIR_FRAC_RATIO_MAX        16.0
+
 aresult_t polyphase_fir_new(struct polyphase_fir **pfir, size_t nr_coeffs, const int16_t *fir_real_coeff,
         unsigned interpolate, unsigned decimate);
+aresult_t polyphase_fir_new_complex(struct polyphase_fir **pfir, size_t nr_coeffs, const int16_t *fir_real_coeff,
+        unsigned interpolate, unsigned decimate);
+aresult_t polyphase_fir_new_fractional(struct polyphase_fir **pfir, double ratio);
+aresult_t polyphase_fir_new_fractional_complex(struct polyphase_fir **pfir, double ratio);
+aresult_t polyphase_fir_parse_ratio(const char *str, double *pratio);
 aresult_t polyphase_fir_delete(struct polyphase_fir **pfir);
 aresult_t polyphase_fir_push_sample_buf(struct polyphase_fir *fir, struct sample_buf *buf);
 aresult_t polyphase_fir_process(struct polyphase_fir *fir, int16_t *out_buf, size_t nr_out_samples,
         size_t *nr_out_samples_generated);
+aresult_t polyphase_fir_process_ring(struct polyphase_fir *fir, struct sample_ring *ring, int16_t *out_buf,
+        size_t nr_out_samples, size_t *nr_out_samples_generated);
 aresult_t polyphase_fir_can_process(struct polyphase_fir *fir, bool *pcan_process);
 aresult_t polyphase_fir_full(struct polyphase_fir *fir, bool *pfull);
 
@@ -0,0 +1,335 @@
+/*
+ *  polyphase_fir_f32.c - A polyphase FIR for rational resampling, in floating point
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/polyphase_fir_f32.h>
+#include <filter/polyphase_fir_priv.h>
+#include <filter/fir_f32_priv.h>
+#include <filter/filter_priv.h>
+#include <filter/sample_buf.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/diag.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+
+static
+aresult_t _polyphase_fir_f32_new(struct polyphase_fir_f32 **pfir, size_t nr_coeffs, const float *fir_coeff,
+            unsigned interpolate, unsigned decimate, bool is_complex)
+{
+    aresult_t ret = A_OK;
+
+    struct polyphase_fir_f32 *fir = NULL;
+    unsigned phase_coeffs = 0,
+             width = true == is_complex ? 2 : 1;
+
+    TSL_ASSERT_ARG(NULL != pfir);
+    TSL_ASSERT_ARG(0 != nr_coeffs);
+    TSL_ASSERT_ARG(NULL != fir_coeff);
+    TSL_ASSERT_ARG(0 < interpolate);
+    TSL_ASSERT_ARG(0 < decimate);
+
+    if (FAILED(ret = TZAALLOC(fir, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    fir->nr_phase_filters = interpolate;
+    fir->is_complex = is_complex;
+    fir->interpolation = interpolate;
+    fir->decimation = decimate;
+
+    /* Determine the number of coefficients in each phase, rounded up to the nearest 4 */
+    phase_coeffs = (nr_coeffs + interpolate - 1)/interpolate;
+    phase_coeffs = (phase_coeffs + 3) & ~(4-1);
+    fir->nr_filter_coeffs = phase_coeffs;
+
+    if (FAILED(ret = TACALLOC((void **)&fir->phase_filters, interpolate, width * phase_coeffs * sizeof(float),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    /* Walk the input filter and set the coefficients in the appropriate filter phase */
+    for (size_t i = 0; i < nr_coeffs; i++) {
+        size_t idx = width * ((i % interpolate) * phase_coeffs + (i / interpolate));
+
+        for (size_t j = 0; j < width; j++) {
+            fir->phase_filters[idx + j] = fir_coeff[i];
+        }
+    }
+
+    *pfir = fir;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != fir) {
+            TFREE(fir);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Construct a new floating point polyphase FIR, for REAL_FLOAT_32 samples.
+ *
+ * \param pfir The new polyphase FIR state, returned by reference.
+ * \param nr_coeffs The number of coefficients in the FIR
+ * \param fir_coeff The real coefficients for the FIR
+ * \param interpolate The factor to interpolate (upsample) by
+ * \param decimate The factor to decimate (downsample) by
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_f32_new(struct polyphase_fir_f32 **pfir, size_t nr_coeffs, const float *fir_coeff,
+            unsigned interpolate, unsigned decimate)
+{
+    return _polyphase_fir_f32_new(pfir, nr_coeffs, fir_coeff, interpolate, decimate, false);
+}
+
+/**
+ * Construct a new floating point polyphase FIR, for COMPLEX_FLOAT_32 samples. The coefficients
+ * are real, and applied to I and Q alike.
+ *
+ * \param pfir The new polyphase FIR state, returned by reference.
+ * \param nr_coeffs The number of coefficients in the FIR
+ * \param fir_coeff The real coefficients for the FIR
+ * \param interpolate The factor to interpolate (upsample) by
+ * \param decimate The factor to decimate (downsample) by
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_f32_new_complex(struct polyphase_fir_f32 **pfir, size_t nr_coeffs, const float *fir_coeff,
+            unsigned interpolate, unsigned decimate)
+{
+    return _polyphase_fir_f32_new(pfir, nr_coeffs, fir_coeff, interpolate, decimate, true);
+}
+
+/**
+ * Delete/clean up resources consumed by a floating point polyphase FIR, including any sample
+ * buffers it still holds.
+ *
+ * \param pfir The polyphase FIR to clean up, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t polyphase_fir_f32_delete(struct polyphase_fir_f32 **pfir)
+{
+    aresult_t ret = A_OK;
+
+    struct polyphase_fir_f32 *fir = NULL;
+
+    TSL_ASSERT_PTR_BY_REF(pfir);
+
+    fir = *pfir;
+
+    if (NULL != fir->sb_active) {
+        sample_buf_decref(fir->sb_active);
+    }
+
+    if (NULL != fir->sb_next) {
+        sample_buf_decref(fir->sb_next);
+    }
+
+    if (NULL != fir->phase_filters) {
+        TFREE(fir->phase_filters);
+    }
+
+    TFREE(fir);
+    *pfir = NULL;
+
+    return ret;
+}
+
+aresult_t polyphase_fir_f32_push_sample_buf(struct polyphase_fir_f32 *fir, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != buf);
+
+    TSL_BUG_ON(fir->sb_active == buf);
+    TSL_BUG_ON(fir->sb_next == buf);
+
+    if ((true == fir->is_complex ? COMPLEX_FLOAT_32 : REAL_FLOAT_32) != buf->sample_type) {
+        DIAG("Polyphase FIR(f32): sample buffer %p has unexpected sample type %d", buf, buf->sample_type);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (NULL == fir->sb_active) {
+        fir->sb_active = buf;
+        TSL_BUG_ON(NULL != fir->sb_next);
+    } else {
+        if (NULL == fir->sb_next) {
+            fir->sb_next = buf;
+        } else {
+            ret = A_E_BUSY;
+            goto done;
+        }
+    }
+
+    fir->nr_samples += buf->nr_samples;
+
+done:
+    return ret;
+}
+
+/**
+ * Apply one phase filter at the given offset, in the same way as dot_product_sample_buffers_real
+ * and dot_product_sample_buffers_complex do for Q.15 samples.
+ */
+static
+aresult_t _polyphase_fir_f32_dot_product(struct polyphase_fir_f32 *fir, const float *coeffs, float *psample)
+{
+    aresult_t ret = A_OK;
+
+    const size_t width = true == fir->is_complex ? 2 : 1,
+                 nr_coeffs = fir->nr_filter_coeffs;
+    struct sample_buf *cur_buf = fir->sb_active;
+    size_t coeffs_remain = nr_coeffs,
+           buf_offset = fir->sample_offset;
+    float even = 0.0f,
+          odd = 0.0f;
+
+    if (buf_offset + nr_coeffs > cur_buf->nr_samples && NULL == fir->sb_next) {
+        ret = A_E_DONE;
+        goto done;
+    }
+
+    do {
+        size_t nr_samples_in = BL_MIN2(cur_buf->nr_samples - buf_offset, coeffs_remain),
+               start_coeff = nr_coeffs - coeffs_remain;
+
+        fir_f32_mac((float *)cur_buf->data_buf + width * buf_offset, coeffs + width * start_coeff,
+                width * nr_samples_in, &even, &odd);
+
+        buf_offset = 0;
+        coeffs_remain -= nr_samples_in;
+#ifdef _TSL_DEBUG
+        TSL_BUG_ON(cur_buf == fir->sb_next && coeffs_remain != 0);
+#endif
+        cur_buf = fir->sb_next;
+    } while (coeffs_remain != 0);
+
+    if (true == fir->is_complex) {
+        psample[0] = even;
+        psample[1] = odd;
+    } else {
+        psample[0] = even + odd;
+    }
+
+done:
+    return ret;
+}
+
+aresult_t polyphase_fir_f32_process(struct polyphase_fir_f32 *fir, float *out_buf, size_t nr_out_samples,
+        size_t *nr_out_samples_generated)
+{
+    aresult_t ret = A_OK;
+
+    size_t phase_id = 0,
+           nr_computed_samples = 0,
+           width = 0;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != out_buf);
+    TSL_ASSERT_ARG(0 != nr_out_samples);
+    TSL_ASSERT_ARG(NULL != nr_out_samples_generated);
+
+    *nr_out_samples_generated = 0;
+
+    if (NULL == fir->sb_active && NULL == fir->sb_next) {
+        goto done;
+    }
+
+    width = true == fir->is_complex ? 2 : 1;
+    phase_id = fir->last_phase;
+
+    for (size_t i = 0; i < nr_out_samples && fir->nr_samples > fir->nr_filter_coeffs; i++) {
+        size_t interp_phase = 0;
+        aresult_t filt_ret = A_OK;
+
+        TSL_BUG_ON(phase_id >= fir->nr_phase_filters);
+
+        filt_ret = _polyphase_fir_f32_dot_product(fir,
+                &fir->phase_filters[width * fir->nr_filter_coeffs * phase_id], &out_buf[width * i]);
+
+        if (filt_ret == A_E_DONE) {
+            break;
+        } else if (FAILED(ret = filt_ret)) {
+            goto done;
+        }
+
+        nr_computed_samples++;
+
+        /* Calculate the next phase to process */
+        phase_id += fir->decimation;
+
+        interp_phase = phase_id / fir->interpolation;
+        phase_id = phase_id % fir->interpolation;
+        fir->nr_samples -= interp_phase;
+
+        /* Check if we're going to need to update the active buffer */
+        if (fir->sample_offset + interp_phase > fir->sb_active->nr_samples) {
+            /* Retire the active buffer, shift next to active */
+            size_t old_nr_samples = fir->sb_active->nr_samples;
+            TSL_BUG_IF_FAILED(sample_buf_decref(fir->sb_active));
+            fir->sb_active = fir->sb_next;
+            fir->sb_next = NULL;
+            fir->sample_offset = fir->sample_offset + interp_phase - old_nr_samples;
+        } else {
+            /* Continue walking the current buffer */
+            fir->sample_offset += interp_phase;
+        }
+
+        fir->last_phase = phase_id;
+    }
+
+    *nr_out_samples_generated = nr_computed_samples;
+
+done:
+    return ret;
+}
+
+aresult_t polyphase_fir_f32_can_process(struct polyphase_fir_f32 *fir, bool *pcan_process)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != fir);
+    TSL_ASSERT_ARG(NULL != pcan_process);
+
+    *pcan_process = fir->nr_samples >= fir->nr_filter_coeffs;
+
+    return ret;
+}
+
+aresult_t polyphase_fir_f32_full(struct polyphase_fir_f32 *fir, bool *pfull)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != fir);
+    TSL_ASSERT_ARG_DEBUG(NULL != pfull);
+
+    *pfull = (NULL != fir->sb_next);
+
+    return ret;
+}
+
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sample_buf;
+struct polyphase_fir_f32;
+
+/*
+ * A floating point counterpart to the polyphase FIR, for REAL_FLOAT_32 and COMPLEX_FLOAT_32
+ * sample buffers. Same semantics as the polyphase_fir_* functions.
+ */
+aresult_t polyphase_fir_f32_new(struct polyphase_fir_f32 **pfir, size_t nr_coeffs, const float *fir_real_coeff,
+        unsigned interpolate, unsigned decimate);
+aresult_t polyphase_fir_f32_new_complex(struct polyphase_fir_f32 **pfir, size_t nr_coeffs, const float *fir_real_coeff,
+        unsigned interpolate, unsigned decimate);
+aresult_t polyphase_fir_f32_delete(struct polyphase_fir_f32 **pfir);
+aresult_t polyphase_fir_f32_push_sample_buf(struct polyphase_fir_f32 *fir, struct sample_buf *buf);
+aresult_t polyphase_fir_f32_process(struct polyphase_fir_f32 *fir, float *out_buf, size_t nr_out_samples,
+        size_t *nr_out_samples_generated);
+aresult_t polyphase_fir_f32_can_process(struct polyphase_fir_f32 *fir, bool *pcan_process);
+aresult_t polyphase_fir_f32_full(struct polyphase_fir_f32 *fir, bool *pfull);
@@ -1,9 +1,31 @@
 #pragma once
 
+#include <filter/filter.h>
+#include <filter/utils.h>
+
+#include <stdbool.h>
 #include <stdint.h>
 
 struct sample_buf;
 
+/**
+ * A fractional resampler picks its phase filter from the top bits of the fractional part of
+ * its position in the input, and blends between that phase and the next by the bits below them.
+ */
+#define POLYPHASE_FIR_FRAC_PHASE_BITS       6
+#define POLYPHASE_FIR_FRAC_PHASES           (1u << POLYPHASE_FIR_FRAC_PHASE_BITS)
+
+/**
+ * The bits of the fractional position below the phase, kept for the blend between phases
+ */
+#define POLYPHASE_FIR_FRAC_BLEND_SHIFT      (32 - POLYPHASE_FIR_FRAC_PHASE_BITS - Q_15_SHIFT)
+
+/**
+ * The number of taps in each phase of a fractional resampler, when not decimating. Scaled up by
+ * the decimation factor otherwise, so the filter stays as sharp relative to the output rate.
+ */
+#define POLYPHASE_FIR_FRAC_TAPS             16
+
 /**
  * The state for a polyphase FIR. A Polyphase FIR is stored as a set of smaller filters, depending on the interpolation/decimation
  * factors.
@@ -38,6 +60,108 @@ struct polyphase_fir {
      */
     size_t nr_filter_coeffs;
 
+    /**
+     * Whether samples are interleaved complex I/Q, rather than real. Each phase filter is then
+     * applied to I and Q alike.
+     */
+    bool is_complex;
+
+    /**
+     * Whether the phase filter is symmetric, and the dot product folds mirrored taps together.
+     * Only ever true with no interpolation. Phase filters aren't padded in this case.
+     */
+    bool symmetric;
+
+    /**
+     * The dot product for windows that are contiguous in memory, specialized for
+     * nr_filter_coeffs if possible
+     */
+    dot_product_func_t dot_product;
+
+    /**
+     * The last phase we processed
+     */
+    size_t last_phase;
+
+    /**
+     * The interpolation factor
+     */
+    unsigned int interpolation;
+
+    /**
+     * The decimation factor
+     */
+    unsigned int decimation;
+
+    /**
+     * The current sample buffer to process
+     */
+    struct sample_buf *sb_active;
+
+    /**
+     * The next sample buffer to process
+     */
+    struct sample_buf *sb_next;
+
+    /**
+     * The total number of samples contained in this polyphase FIR
+     */
+    size_t nr_samples;
+
+    /**
+     * The next sample to be processed, relative to the start of sb_active. When reading from
+     * a sample_ring, relative to the oldest sample in the ring.
+     */
+    size_t sample_offset;
+
+    /**
+     * Whether this is a fractional resampler, stepping through the input by an arbitrary ratio
+     * rather than by interpolation/decimation phases. The phase filters are then a fixed bank of
+     * POLYPHASE_FIR_FRAC_PHASES + 1 filters, designed for the ratio, where phase i is the
+     * interpolating filter for an output i/POLYPHASE_FIR_FRAC_PHASES of the way between two input
+     * samples. last_phase, interpolation and decimation are unused.
+     */
+    bool fractional;
+
+    /**
+     * How far past sample_offset the next output sample falls, as a fraction of an input sample
+     * in 0.32 fixed point
+     */
+    uint32_t frac_pos;
+
+    /**
+     * How far to step through the input for each output sample, in whole input samples and a
+     * 0.32 fixed point fraction of one
+     */
+    size_t frac_step_int;
+    uint32_t frac_step;
+};
+
+/**
+ * The state for a floating point polyphase FIR. Laid out and walked like struct polyphase_fir.
+ */
+struct polyphase_fir_f32 {
+    /**
+     * The phase filters, as for struct polyphase_fir. For complex samples each coefficient is
+     * written out twice, so the i'th filter's j'th coefficient is at (2 * (i*M + j)).
+     */
+    float *phase_filters;
+
+    /**
+     * The number of phase filters in this polyphase FIR
+     */
+    size_t nr_phase_filters;
+
+    /**
+     * The number of filter coefficients in each phase filter, rounded up to a multiple of 4
+     */
+    size_t nr_filter_coeffs;
+
+    /**
+     * Whether samples are interleaved complex I/Q, rather than real
+     */
+    bool is_complex;
+
     /**
      * The last phase we processed
      */
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <filter/dc_blocker.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Fractional bits in the post-filter gain
+ */
+#define POST_FILTER_GAIN_SHIFT          12
+
+/**
+ * The gain that leaves samples as they are
+ */
+#define POST_FILTER_GAIN_UNITY          (1 << POST_FILTER_GAIN_SHIFT)
+
+/**
+ * The largest gain (exclusive) that can be applied. Keeps the product of a sample and the gain
+ * within 32 bits.
+ */
+#define POST_FILTER_GAIN_MAX            16.0
+
+/**
+ * The stage run over each block of resampler output before it is decoded: an optional inversion
+ * and gain, followed by an optional DC blocker, all in a single pass.
+ */
+struct post_filter {
+    /**
+     * Gain, in Q.12, negative if samples are to be inverted
+     */
+    int32_t gain;
+
+    /**
+     * Whether to block DC, and the DC blocker state
+     */
+    bool dc_block;
+    struct dc_blocker blck;
+};
+
+/**
+ * Initialize a post-filter.
+ *
+ * \param pf The post-filter state
+ * \param invert Whether to invert the sense of the samples
+ * \param gain Gain to apply to the samples, greater than 0 and less than POST_FILTER_GAIN_MAX
+ * \param dc_block Whether to remove DC from the samples
+ * \param dc_block_pole The pole of the DC blocker, if enabled
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+static inline
+aresult_t post_filter_init(struct post_filter *pf, bool invert, double gain, bool dc_block, double dc_block_pole)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != pf);
+    TSL_ASSERT_ARG(gain > 0.0 && gain < POST_FILTER_GAIN_MAX);
+
+    memset(pf, 0, sizeof(*pf));
+
+    pf->gain = (int32_t)lrint(gain * (double)POST_FILTER_GAIN_UNITY);
+    TSL_ASSERT_ARG(0 != pf->gain);
+
+    if (true == invert) {
+        pf->gain = -pf->gain;
+    }
+
+    pf->dc_block = dc_block;
+
+    if (true == dc_block) {
+        ret = dc_blocker_init(&pf->blck, dc_block_pole);
+    }
+
+    return ret;
+}
+
+/**
+ * Scale a sample by the post-filter gain, rounding and saturating the result.
+ */
+static inline
+int16_t _post_filter_scale(int16_t sample, int32_t gain)
+{
+    int32_t scaled = ((int32_t)sample * gain + (1 << (POST_FILTER_GAIN_SHIFT - 1))) >> POST_FILTER_GAIN_SHIFT;
+
+    if (scaled > INT16_MAX) {
+        scaled = INT16_MAX;
+    } else if (scaled < INT16_MIN) {
+        scaled = INT16_MIN;
+    }
+
+    return (int16_t)scaled;
+}
+
+/**
+ * Apply the post-filter to a block of samples, in place.
+ *
+ * Without a DC blocker this is a branch-free loop the compiler can vectorize. The DC blocker is
+ * recursive, so with it enabled the scaling is folded into the blocker's own loop instead of
+ * taking a second pass over the samples.
+ *
+ * \param pf The post-filter state
+ * \param samples The samples to filter
+ * \param nr_samples The number of samples
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+static inline
+aresult_t post_filter_apply(struct post_filter *pf, int16_t *restrict samples, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    int32_t gain = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != pf);
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+
+    gain = pf->gain;
+
+    if (false == pf->dc_block) {
+        if (POST_FILTER_GAIN_UNITY != gain) {
+            for (size_t i = 0; i < nr_samples; i++) {
+                samples[i] = _post_filter_scale(samples[i], gain);
+            }
+        }
+    } else {
+        /* Keep the blocker state in registers for the length of the block */
+        int32_t p = pf->blck.p,
+                x_n_1 = pf->blck.x_n_1,
+                y_n_1 = pf->blck.y_n_1,
+                acc = pf->blck.acc;
+
+        for (size_t i = 0; i < nr_samples; i++) {
+            int16_t sample = samples[i];
+
+            if (POST_FILTER_GAIN_UNITY != gain) {
+                sample = _post_filter_scale(sample, gain);
+            }
+
+            /* As in dc_blocker_apply */
+            acc -= x_n_1;
+            x_n_1 = sample << Q_15_SHIFT;
+            acc += x_n_1 - p * y_n_1;
+            y_n_1 = acc >> Q_15_SHIFT;
+            samples[i] = y_n_1;
+        }
+
+        pf->blck.x_n_1 = x_n_1;
+        pf->blck.y_n_1 = y_n_1;
+        pf->blck.acc = acc;
+    }
+
+    return ret;
+}
@@ -0,0 +1,305 @@
+/*
+ *  rotator.c - A vectorized frequency shifter for complex Q.15 samples
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/rotator.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <math.h>
+#include <string.h>
+
+#ifdef _USE_ARM_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Short tables are repeated until they hold at least this many phasors, so each pass through
+ * the table covers enough samples to be worth vectorizing
+ */
+#define ROTATOR_MIN_TABLE_SAMPLES           256
+
+static inline
+int16_t _rotator_saturate(int32_t v)
+{
+    if (v > INT16_MAX) {
+        return INT16_MAX;
+    } else if (v < INT16_MIN) {
+        return INT16_MIN;
+    }
+
+    return v;
+}
+
+/**
+ * Multiply nr complex samples by as many Q.15 phasors. Phasors must be no larger than INT16_MAX
+ * in magnitude, so neither the negation of the imaginary part nor the sums can overflow. Every
+ * implementation rounds and saturates the same way, so the results are bit-identical.
+ */
+static inline
+void _rotator_mix(const int16_t *in, const int16_t *ph, int16_t *out, size_t nr)
+{
+    size_t i = 0;
+
+#if defined(_USE_ARM_NEON)
+    for (; i + 4 <= nr; i += 4) {
+        int16x4x2_t x = vld2_s16(in + 2 * i),
+                    p = vld2_s16(ph + 2 * i),
+                    r;
+        int32x4_t re = vmlsl_s16(vmull_s16(x.val[0], p.val[0]), x.val[1], p.val[1]),
+                  im = vmlal_s16(vmull_s16(x.val[0], p.val[1]), x.val[1], p.val[0]);
+
+        r.val[0] = vqrshrn_n_s32(re, 15);
+        r.val[1] = vqrshrn_n_s32(im, 15);
+        vst2_s16(out + 2 * i, r);
+    }
+#elif defined(__SSE2__)
+    /* Negates the imaginary part of each phasor, as (p ^ m) - m */
+    const __m128i conj = _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0),
+                  round = _mm_set1_epi32(1 << 14);
+
+#if defined(__AVX2__)
+    const __m256i conj_w = _mm256_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0),
+                  round_w = _mm256_set1_epi32(1 << 14);
+
+    for (; i + 8 <= nr; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(in + 2 * i)),
+                p = _mm256_loadu_si256((const __m256i *)(ph + 2 * i)),
+                /* (p_re, -p_im) and (p_im, p_re) pairs */
+                p_conj = _mm256_sub_epi16(_mm256_xor_si256(p, conj_w), conj_w),
+                p_swap = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p, _MM_SHUFFLE(2, 3, 0, 1)),
+                        _MM_SHUFFLE(2, 3, 0, 1)),
+                re = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(x, p_conj), round_w), 15),
+                im = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(x, p_swap), round_w), 15);
+
+        /* Interleave and pack within each 128-bit lane, which keeps the samples in order */
+        _mm256_storeu_si256((__m256i *)(out + 2 * i),
+                _mm256_packs_epi32(_mm256_unpacklo_epi32(re, im), _mm256_unpackhi_epi32(re, im)));
+    }
+#endif /* defined(__AVX2__) */
+
+    for (; i + 4 <= nr; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + 2 * i)),
+                p = _mm_loadu_si128((const __m128i *)(ph + 2 * i)),
+                p_conj = _mm_sub_epi16(_mm_xor_si128(p, conj), conj),
+                p_swap = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(2, 3, 0, 1)),
+                        _MM_SHUFFLE(2, 3, 0, 1)),
+                re = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(x, p_conj), round), 15),
+                im = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(x, p_swap), round), 15);
+
+        _mm_storeu_si128((__m128i *)(out + 2 * i),
+                _mm_packs_epi32(_mm_unpacklo_epi32(re, im), _mm_unpackhi_epi32(re, im)));
+    }
+#endif /* Vector implementations */
+
+    /* Pick up the stragglers */
+    for (; i < nr; i++) {
+        int32_t x_re = in[2 * i],
+                x_im = in[2 * i + 1],
+                p_re = ph[2 * i],
+                p_im = ph[2 * i + 1];
+
+        out[2 * i    ] = _rotator_saturate((x_re * p_re - x_im * p_im + (1 << 14)) >> 15);
+        out[2 * i + 1] = _rotator_saturate((x_re * p_im + x_im * p_re + (1 << 14)) >> 15);
+    }
+}
+
+/**
+ * Recompute every lane from the exact phase at the start of the next block.
+ */
+static
+void _rotator_lanes_reset(struct rotator *rot)
+{
+    for (size_t k = 0; k < ROTATOR_LANES; k++) {
+        double angle = -2.0 * M_PI * (rot->phase + (double)k * rot->incr);
+        rot->lane_re[k] = (float)cos(angle);
+        rot->lane_im[k] = (float)sin(angle);
+    }
+
+    rot->nr_blocks = 0;
+}
+
+/**
+ * Generate the phasors for the next ROTATOR_LANES samples, and step every lane on to the block
+ * after.
+ */
+static
+void _rotator_next_block(struct rotator *rot)
+{
+    const float step_re = rot->step_re,
+                step_im = rot->step_im;
+
+    if (ROTATOR_RENORM_BLOCKS == rot->nr_blocks) {
+        _rotator_lanes_reset(rot);
+    }
+
+    for (size_t k = 0; k < ROTATOR_LANES; k++) {
+        float re = rot->lane_re[k],
+              im = rot->lane_im[k];
+
+        /* Clamp, in case the lane has drifted slightly outside of the unit circle */
+        rot->block[2 * k    ] = (int16_t)lrintf(fmaxf(fminf(re * INT16_MAX, INT16_MAX), -INT16_MAX));
+        rot->block[2 * k + 1] = (int16_t)lrintf(fmaxf(fminf(im * INT16_MAX, INT16_MAX), -INT16_MAX));
+
+        rot->lane_re[k] = re * step_re - im * step_im;
+        rot->lane_im[k] = re * step_im + im * step_re;
+    }
+
+    rot->phase += (double)ROTATOR_LANES * rot->incr;
+    rot->phase -= floor(rot->phase);
+    rot->nr_blocks++;
+}
+
+static
+uint64_t _rotator_gcd(uint64_t a, uint64_t b)
+{
+    while (0 != b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+aresult_t rotator_init(struct rotator *rot, uint32_t sampling_rate, int32_t freq_shift, unsigned decimation,
+        bool use_table)
+{
+    aresult_t ret = A_OK;
+
+    int64_t num = 0;
+    uint64_t period = 0,
+             table_len = 0;
+    double step = 0.0;
+
+    TSL_ASSERT_ARG(NULL != rot);
+    TSL_ASSERT_ARG(0 != sampling_rate);
+    TSL_ASSERT_ARG(0 != decimation);
+
+    memset(rot, 0, sizeof(*rot));
+
+    /* The phase step per sample is num/sampling_rate cycles, with num in [0, sampling_rate) */
+    num = ((int64_t)freq_shift * (int64_t)decimation) % (int64_t)sampling_rate;
+    if (num < 0) {
+        num += sampling_rate;
+    }
+
+    rot->incr = (double)num / (double)sampling_rate;
+    period = sampling_rate / _rotator_gcd(sampling_rate, (uint64_t)num);
+
+    if (true == use_table && period <= ROTATOR_MAX_TABLE_PERIOD) {
+        table_len = period * ((ROTATOR_MIN_TABLE_SAMPLES + period - 1) / period);
+
+        if (FAILED(ret = TACALLOC((void **)&rot->table, table_len, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+            goto done;
+        }
+
+        /* Work out each phase exactly, rather than accumulating it */
+        for (uint64_t i = 0; i < table_len; i++) {
+            double angle = -2.0 * M_PI * (double)(((uint64_t)num * i) % sampling_rate) / (double)sampling_rate;
+            rot->table[2 * i    ] = (int16_t)lrint(cos(angle) * INT16_MAX);
+            rot->table[2 * i + 1] = (int16_t)lrint(sin(angle) * INT16_MAX);
+        }
+
+        rot->table_period = table_len;
+        rot->table_phase = 0;
+
+        DIAG("Rotator: shift %d Hz at %u Hz (decimated by %u), table of %zu phasors (period %zu)", freq_shift,
+                sampling_rate, decimation, rot->table_period, (size_t)period);
+        goto done;
+    }
+
+    step = -2.0 * M_PI * (double)ROTATOR_LANES * rot->incr;
+    rot->step_re = (float)cos(step);
+    rot->step_im = (float)sin(step);
+    rot->phase = 0.0;
+
+    _rotator_lanes_reset(rot);
+
+    DIAG("Rotator: shift %d Hz at %u Hz (decimated by %u), %u lanes", freq_shift, sampling_rate, decimation,
+            ROTATOR_LANES);
+
+done:
+    return ret;
+}
+
+aresult_t rotator_cleanup(struct rotator *rot)
+{
+    TSL_ASSERT_ARG(NULL != rot);
+
+    if (NULL != rot->table) {
+        TFREE(rot->table);
+    }
+
+    rot->table_period = 0;
+
+    return A_OK;
+}
+
+aresult_t rotator_apply(struct rotator *rot, const int16_t *in, int16_t *out, size_t nr_samples)
+{
+    TSL_ASSERT_ARG_DEBUG(NULL != rot);
+    TSL_ASSERT_ARG_DEBUG(NULL != in || 0 == nr_samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != out || 0 == nr_samples);
+
+    if (NULL != rot->table) {
+        while (0 != nr_samples) {
+            size_t nr = BL_MIN2(nr_samples, rot->table_period - rot->table_phase);
+
+            _rotator_mix(in, rot->table + 2 * rot->table_phase, out, nr);
+
+            rot->table_phase += nr;
+            if (rot->table_phase == rot->table_period) {
+                rot->table_phase = 0;
+            }
+
+            in += 2 * nr;
+            out += 2 * nr;
+            nr_samples -= nr;
+        }
+    } else {
+        while (0 != nr_samples) {
+            size_t nr = 0;
+
+            if (0 == rot->block_offset) {
+                _rotator_next_block(rot);
+            }
+
+            nr = BL_MIN2(nr_samples, ROTATOR_LANES - rot->block_offset);
+
+            _rotator_mix(in, rot->block + 2 * rot->block_offset, out, nr);
+
+            rot->block_offset = (rot->block_offset + nr) % ROTATOR_LANES;
+
+            in += 2 * nr;
+            out += 2 * nr;
+            nr_samples -= nr;
+        }
+    }
+
+    return A_OK;
+}
+
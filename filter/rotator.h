@@ -0,0 +1,130 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of successive phasors the rotator computes at a time, one per lane
+ */
+#define ROTATOR_LANES                       32
+
+/**
+ * How many blocks of ROTATOR_LANES phasors to step before recomputing the lanes from the
+ * exact phase, undoing any drift in their magnitude and phase
+ */
+#define ROTATOR_RENORM_BLOCKS               64
+
+/**
+ * The longest oscillator table the rotator will build
+ */
+#define ROTATOR_MAX_TABLE_PERIOD            16384
+
+/**
+ * A frequency shifter for complex Q.15 samples: multiplies the n'th sample by
+ * exp(-j * 2 * pi * freq_shift * n / sampling_rate), moving a signal at freq_shift down to
+ * baseband. Usable before or after decimation, on its own or after a FIR that leaves the
+ * derotation to it.
+ *
+ * Phasors are generated for ROTATOR_LANES samples at a time. Each lane steps by the increment
+ * for ROTATOR_LANES samples, so the lanes are independent of one another and the loop
+ * vectorizes, unlike a rotator that steps once per sample. The lanes are regenerated from the
+ * exact phase every ROTATOR_RENORM_BLOCKS blocks, so the rotator neither drifts in magnitude
+ * nor accumulates phase error. If the shift repeats in a short enough period, a table of exact
+ * phasors covering whole periods can be used instead.
+ */
+struct rotator {
+    /**
+     * Phasors for the next block of samples, in single precision
+     */
+    float lane_re[ROTATOR_LANES];
+    float lane_im[ROTATOR_LANES];
+
+    /**
+     * The rotation by ROTATOR_LANES samples' worth of phase, applied to each lane per block
+     */
+    float step_re;
+    float step_im;
+
+    /**
+     * The phasors for the current block, as interleaved Q.15 I/Q
+     */
+    int16_t block[2 * ROTATOR_LANES];
+
+    /**
+     * The next phasor to use in block. 0 if a new block must be generated.
+     */
+    size_t block_offset;
+
+    /**
+     * The phase at the start of the next block, in cycles, in [0, 1)
+     */
+    double phase;
+
+    /**
+     * The phase increment per sample, in cycles, in [0, 1)
+     */
+    double incr;
+
+    /**
+     * Blocks generated since the lanes were last regenerated from phase
+     */
+    unsigned nr_blocks;
+
+    /**
+     * Precomputed phasors, as interleaved Q.15 I/Q, if the rotator is table driven. NULL
+     * otherwise.
+     */
+    int16_t *table;
+
+    /**
+     * The number of phasors in table. A whole number of periods of the shift.
+     */
+    size_t table_period;
+
+    /**
+     * The phasor in table to apply to the next sample
+     */
+    size_t table_phase;
+};
+
+/**
+ * Prepare a rotator. This function allocates memory if a table is used.
+ *
+ * \param rot The rotator. Pass a chunk of memory by reference.
+ * \param sampling_rate The sampling rate of the signal, before any decimation
+ * \param freq_shift The shift to remove, in Hz. The signal at this offset ends up at baseband.
+ * \param decimation The factor the signal has been decimated by at the point the rotator is
+ *                   applied, so the rotator steps by this many samples' worth of phase per
+ *                   sample. 1 if used before decimation.
+ * \param use_table Use one period of precomputed phasors, if the shift repeats in at most
+ *                  ROTATOR_MAX_TABLE_PERIOD samples. Otherwise, this is ignored.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t rotator_init(struct rotator *rot, uint32_t sampling_rate, int32_t freq_shift, unsigned decimation,
+        bool use_table);
+
+/**
+ * Release the resources held by a rotator. Safe to call on a zeroed rotator.
+ *
+ * \param rot The rotator
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t rotator_cleanup(struct rotator *rot);
+
+/**
+ * Apply the rotator to a run of samples, continuing from where the last call left off.
+ *
+ * \param rot The rotator
+ * \param in The interleaved I/Q samples to rotate
+ * \param out The rotated samples. May be the same as in.
+ * \param nr_samples The number of complex samples
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t rotator_apply(struct rotator *rot, const int16_t *in, int16_t *out, size_t nr_samples);
+
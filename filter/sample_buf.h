@@ -6,6 +6,7 @@
 #include <tsl/result.h>
 
 #include <stdint.h>
+#include <time.h>
 
 struct sample_buf;
 
@@ -42,6 +43,21 @@ enum sample_type {
      * Samples are complex unsigned 32-bit integers
      */
     COMPLEX_UINT_32     = 5,
+
+    /**
+     * Samples are real signed 16-bit integers
+     */
+    REAL_INT_16         = 6,
+
+    /**
+     * Samples are real 32-bit floats, nominally in [-1.0, 1.0)
+     */
+    REAL_FLOAT_32       = 7,
+
+    /**
+     * Samples are complex 32-bit floats, nominally in [-1.0, 1.0)
+     */
+    COMPLEX_FLOAT_32    = 8,
 };
 
 typedef aresult_t (*sample_buf_release_func_t)(struct sample_buf *buf);
@@ -80,10 +96,23 @@ struct sample_buf {
     uint32_t sample_buf_bytes;
 
     /**
-     * The start timestamp (in sample time) of this buffer
+     * When the first sample in this buffer was captured, in nanoseconds on the CLOCK_MONOTONIC
+     * clock (see sample_buf_now_ns). 0 if unknown.
      */
     uint64_t start_time_ns;
 
+    /**
+     * The sequence number of the received buffer these samples came from, so a buffer can be
+     * followed through each stage when tracing (see sample_trace.h).
+     */
+    uint64_t seq;
+
+    /**
+     * When the buffer was handed to its consumers, on the same clock as start_time_ns. Only set
+     * when tracing, 0 otherwise.
+     */
+    uint64_t deliver_ns;
+
     /**
      * Pointer to the function that will be called to release the sample buffer once the reference
      * count reaches 0.
@@ -96,10 +125,26 @@ struct sample_buf {
     void *priv;
 
     /**
-     * The actual data. This will need to be cast appropriately.
+     * The actual data. This will need to be cast appropriately. Aligned like the header, so a
+     * header can be placed immediately in front of samples that live elsewhere (i.e. in a
+     * memory mapped file).
      */
-    uint8_t data_buf[];
+    uint8_t data_buf[] CAL_ALIGN(16);
 };
 
 aresult_t sample_buf_decref(struct sample_buf *buf);
 
+/**
+ * Get the current time on the clock sample buffers are stamped with, in nanoseconds. This is
+ * CLOCK_MONOTONIC, so times can be compared between processes on the same host.
+ */
+static inline
+uint64_t sample_buf_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
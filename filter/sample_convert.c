@@ -0,0 +1,288 @@
+/*
+ *  sample_convert.c - Conversion of raw sample formats to Q.15
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/sample_convert.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+
+#include <math.h>
+
+#ifdef _USE_ARM_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+aresult_t sample_convert_u8_to_q15(int16_t *out, const uint8_t *in, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t i = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+
+#ifdef _USE_ARM_NEON
+    const int16x8_t sub_const = vdupq_n_s16(127);
+
+    for (; i + 8 <= nr_samples; i += 8) {
+        __builtin_prefetch(in + i + 64);
+
+        /* Convert to s16 - we can get away with the reinterpret because all values are [0, 255] */
+        int16x8_t samples = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(in + i)));
+
+        samples = vsubq_s16(samples, sub_const);
+        samples = vqshlq_n_s16(samples, SAMPLE_CONVERT_U8_SHIFT);
+
+        vst1q_s16(out + i, samples);
+    }
+#elif defined(__AVX2__)
+    const __m256i sub_const = _mm256_set1_epi16(127);
+
+    for (; i + 32 <= nr_samples; i += 32) {
+        __m256i raw = _mm256_loadu_si256((const __m256i *)(in + i)),
+                lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(raw)),
+                hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(raw, 1));
+
+        /* [-127, 128] << 7 can't overflow, so there's no need to saturate */
+        lo = _mm256_slli_epi16(_mm256_sub_epi16(lo, sub_const), SAMPLE_CONVERT_U8_SHIFT);
+        hi = _mm256_slli_epi16(_mm256_sub_epi16(hi, sub_const), SAMPLE_CONVERT_U8_SHIFT);
+
+        _mm256_storeu_si256((__m256i *)(out + i), lo);
+        _mm256_storeu_si256((__m256i *)(out + i + 16), hi);
+    }
+#elif defined(__SSE2__)
+    const __m128i sub_const = _mm_set1_epi16(127),
+                  zero = _mm_setzero_si128();
+
+    for (; i + 16 <= nr_samples; i += 16) {
+        __m128i raw = _mm_loadu_si128((const __m128i *)(in + i)),
+                lo = _mm_unpacklo_epi8(raw, zero),
+                hi = _mm_unpackhi_epi8(raw, zero);
+
+        lo = _mm_slli_epi16(_mm_sub_epi16(lo, sub_const), SAMPLE_CONVERT_U8_SHIFT);
+        hi = _mm_slli_epi16(_mm_sub_epi16(hi, sub_const), SAMPLE_CONVERT_U8_SHIFT);
+
+        _mm_storeu_si128((__m128i *)(out + i), lo);
+        _mm_storeu_si128((__m128i *)(out + i + 8), hi);
+    }
+#endif
+
+    /* Whatever is left over, or everything, if there's no vector unit */
+    for (; i < nr_samples; i++) {
+        out[i] = (int16_t)(((int)in[i] - 127) * (1 << SAMPLE_CONVERT_U8_SHIFT));
+    }
+
+    return ret;
+}
+
+aresult_t sample_convert_s8_to_q15(int16_t *out, const int8_t *in, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t i = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+
+#ifdef _USE_ARM_NEON
+    for (; i + 8 <= nr_samples; i += 8) {
+        __builtin_prefetch(in + i + 64);
+
+        /* The widening shift sign extends for us */
+        vst1q_s16(out + i, vshll_n_s8(vld1_s8(in + i), SAMPLE_CONVERT_S8_SHIFT));
+    }
+#elif defined(__AVX2__)
+    for (; i + 32 <= nr_samples; i += 32) {
+        __m256i raw = _mm256_loadu_si256((const __m256i *)(in + i)),
+                lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(raw)),
+                hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(raw, 1));
+
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_slli_epi16(lo, SAMPLE_CONVERT_S8_SHIFT));
+        _mm256_storeu_si256((__m256i *)(out + i + 16), _mm256_slli_epi16(hi, SAMPLE_CONVERT_S8_SHIFT));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= nr_samples; i += 16) {
+        __m128i raw = _mm_loadu_si128((const __m128i *)(in + i)),
+                /* Unpacking into the high byte gives sample << 8; shift back down to sign extend */
+                lo = _mm_srai_epi16(_mm_unpacklo_epi8(zero, raw), 8 - SAMPLE_CONVERT_S8_SHIFT),
+                hi = _mm_srai_epi16(_mm_unpackhi_epi8(zero, raw), 8 - SAMPLE_CONVERT_S8_SHIFT);
+
+        _mm_storeu_si128((__m128i *)(out + i), lo);
+        _mm_storeu_si128((__m128i *)(out + i + 8), hi);
+    }
+#endif
+
+    for (; i < nr_samples; i++) {
+        out[i] = (int16_t)(in[i] * (1 << SAMPLE_CONVERT_S8_SHIFT));
+    }
+
+    return ret;
+}
+
+aresult_t sample_convert_s16_swap(int16_t *out, const int16_t *in, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t i = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+
+#ifdef _USE_ARM_NEON
+    for (; i + 8 <= nr_samples; i += 8) {
+        uint8x16_t raw = vld1q_u8((const uint8_t *)(in + i));
+        vst1q_s16(out + i, vreinterpretq_s16_u8(vrev16q_u8(raw)));
+    }
+#elif defined(__AVX2__)
+    for (; i + 16 <= nr_samples; i += 16) {
+        __m256i raw = _mm256_loadu_si256((const __m256i *)(in + i));
+        raw = _mm256_or_si256(_mm256_slli_epi16(raw, 8), _mm256_srli_epi16(raw, 8));
+        _mm256_storeu_si256((__m256i *)(out + i), raw);
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= nr_samples; i += 8) {
+        __m128i raw = _mm_loadu_si128((const __m128i *)(in + i));
+        raw = _mm_or_si128(_mm_slli_epi16(raw, 8), _mm_srli_epi16(raw, 8));
+        _mm_storeu_si128((__m128i *)(out + i), raw);
+    }
+#endif
+
+    for (; i < nr_samples; i++) {
+        out[i] = (int16_t)__builtin_bswap16((uint16_t)in[i]);
+    }
+
+    return ret;
+}
+
+aresult_t sample_convert_f32_to_q15(int16_t *out, const float *in, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t i = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+
+    /*
+     * Clamping before converting keeps the vector and scalar paths in agreement, even for values
+     * far out of range. A NaN saturates high in both.
+     */
+#if defined(__AVX2__)
+    const __m256 scale = _mm256_set1_ps(32768.0f),
+                 max_val = _mm256_set1_ps(32767.0f),
+                 min_val = _mm256_set1_ps(-32768.0f);
+
+    for (; i + 16 <= nr_samples; i += 16) {
+        __m256 lo = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale),
+               hi = _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale);
+        __m256i lo_i, hi_i;
+
+        lo = _mm256_max_ps(_mm256_min_ps(lo, max_val), min_val);
+        hi = _mm256_max_ps(_mm256_min_ps(hi, max_val), min_val);
+
+        lo_i = _mm256_cvtps_epi32(lo);
+        hi_i = _mm256_cvtps_epi32(hi);
+
+        /* The pack works within each 128-bit lane, so put the samples back in order after */
+        _mm256_storeu_si256((__m256i *)(out + i),
+                _mm256_permute4x64_epi64(_mm256_packs_epi32(lo_i, hi_i), 0xd8));
+    }
+#elif defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(32768.0f),
+                 max_val = _mm_set1_ps(32767.0f),
+                 min_val = _mm_set1_ps(-32768.0f);
+
+    for (; i + 8 <= nr_samples; i += 8) {
+        __m128 lo = _mm_mul_ps(_mm_loadu_ps(in + i), scale),
+               hi = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+
+        lo = _mm_max_ps(_mm_min_ps(lo, max_val), min_val);
+        hi = _mm_max_ps(_mm_min_ps(hi, max_val), min_val);
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+#endif
+
+    for (; i < nr_samples; i++) {
+        float val = in[i] * 32768.0f;
+
+        if (!(val < 32767.0f)) {
+            val = 32767.0f;
+        } else if (val < -32768.0f) {
+            val = -32768.0f;
+        }
+
+        out[i] = (int16_t)lrintf(val);
+    }
+
+    return ret;
+}
+
+aresult_t sample_convert_q15_to_f32(float *out, const int16_t *in, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t i = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != out);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+
+#ifdef _USE_ARM_NEON
+    const float32x4_t scale = vdupq_n_f32(1.0f / 32768.0f);
+
+    for (; i + 8 <= nr_samples; i += 8) {
+        int16x8_t raw = vld1q_s16(in + i);
+
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(raw))), scale));
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(raw))), scale));
+    }
+#elif defined(__AVX2__)
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+
+    for (; i + 8 <= nr_samples; i += 8) {
+        __m256i raw = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(raw), scale));
+    }
+#elif defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+
+    for (; i + 8 <= nr_samples; i += 8) {
+        __m128i raw = _mm_loadu_si128((const __m128i *)(in + i)),
+                /* Unpacking into the high half gives sample << 16; shift back down to sign extend */
+                lo = _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16),
+                hi = _mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16);
+
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+
+    for (; i < nr_samples; i++) {
+        out[i] = (float)in[i] * (1.0f / 32768.0f);
+    }
+
+    return ret;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Shift applied to an 8-bit sample, once it is centred on 0, to get a Q.15 sample
+ */
+#define SAMPLE_CONVERT_U8_SHIFT         7
+
+/**
+ * Shift applied to a signed 8-bit sample to get a Q.15 sample. The same as for unsigned
+ * samples, so a capture comes out at the same level whichever 8-bit format it was saved in.
+ */
+#define SAMPLE_CONVERT_S8_SHIFT         SAMPLE_CONVERT_U8_SHIFT
+
+/**
+ * Convert unsigned 8-bit samples (as delivered by the RTL-SDR) to Q.15. The sample midpoint
+ * is taken to be 127.
+ *
+ * \param out The output Q.15 samples. Must have space for nr_samples values.
+ * \param in The unsigned 8-bit samples
+ * \param nr_samples The number of values to convert. For complex samples, this is twice the
+ *                   number of samples.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_convert_u8_to_q15(int16_t *out, const uint8_t *in, size_t nr_samples);
+
+/**
+ * Convert signed 8-bit samples to Q.15.
+ *
+ * \param out The output Q.15 samples. Must have space for nr_samples values.
+ * \param in The signed 8-bit samples
+ * \param nr_samples The number of values to convert. For complex samples, this is twice the
+ *                   number of samples.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_convert_s8_to_q15(int16_t *out, const int8_t *in, size_t nr_samples);
+
+/**
+ * Swap the byte order of 16-bit samples. out and in may be the same buffer.
+ *
+ * \param out The byte-swapped samples. Must have space for nr_samples values.
+ * \param in The samples to swap
+ * \param nr_samples The number of values to swap. For complex samples, this is twice the
+ *                   number of samples.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_convert_s16_swap(int16_t *out, const int16_t *in, size_t nr_samples);
+
+/**
+ * Convert 32-bit floating point samples, nominally in [-1.0, 1.0), to Q.15. Values out of range
+ * are saturated, and values in range are rounded to the nearest Q.15 value.
+ *
+ * \param out The output Q.15 samples. Must have space for nr_samples values.
+ * \param in The floating point samples
+ * \param nr_samples The number of values to convert. For complex samples, this is twice the
+ *                   number of samples.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_convert_f32_to_q15(int16_t *out, const float *in, size_t nr_samples);
+
+/**
+ * Convert Q.15 samples to 32-bit floating point, in [-1.0, 1.0). Exact, and the inverse of
+ * sample_convert_f32_to_q15.
+ *
+ * \param out The output floating point samples. Must have space for nr_samples values.
+ * \param in The Q.15 samples
+ * \param nr_samples The number of values to convert. For complex samples, this is twice the
+ *                   number of samples.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_convert_q15_to_f32(float *out, const int16_t *in, size_t nr_samples);
+
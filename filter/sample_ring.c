@@ -0,0 +1,252 @@
+/*
+ *  sample_ring.c - A double-mapped ring of samples, contiguous across the wrap point
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/sample_ring.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Map the same anonymous memory twice, back to back.
+ */
+static
+aresult_t _sample_ring_map(struct sample_ring *ring)
+{
+    aresult_t ret = A_OK;
+
+    uint8_t *base = MAP_FAILED;
+    int fd = -1;
+
+    if (0 > (fd = memfd_create("sample_ring", MFD_CLOEXEC))) {
+        int errnum = errno;
+        DIAG("Failed to create sample ring memory: %s (%d)", strerror(errnum), errnum);
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    if (0 > ftruncate(fd, ring->ring_bytes)) {
+        int errnum = errno;
+        DIAG("Failed to size sample ring to %zu bytes: %s (%d)", ring->ring_bytes, strerror(errnum), errnum);
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    /* Reserve space for both copies, so nothing else can be mapped in between */
+    if (MAP_FAILED == (base = mmap(NULL, 2 * ring->ring_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))) {
+        int errnum = errno;
+        DIAG("Failed to reserve sample ring address space: %s (%d)", strerror(errnum), errnum);
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        if (MAP_FAILED == mmap(base + i * ring->ring_bytes, ring->ring_bytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_FIXED | MAP_POPULATE, fd, 0))
+        {
+            int errnum = errno;
+            DIAG("Failed to map sample ring: %s (%d)", strerror(errnum), errnum);
+            ret = A_E_NOMEM;
+            goto done;
+        }
+    }
+
+    ring->base = base;
+
+done:
+    if (0 <= fd) {
+        close(fd);
+    }
+
+    if (FAILED(ret)) {
+        if (MAP_FAILED != base) {
+            munmap(base, 2 * ring->ring_bytes);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t sample_ring_new(struct sample_ring **pring, size_t nr_samples, size_t sample_bytes)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_ring *ring = NULL;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    TSL_ASSERT_ARG(NULL != pring);
+    TSL_ASSERT_ARG(0 != nr_samples);
+    TSL_ASSERT_ARG(0 != sample_bytes);
+    TSL_ASSERT_ARG(0 == (sample_bytes & (sample_bytes - 1)));
+    TSL_ASSERT_ARG(sample_bytes <= page_size);
+
+    *pring = NULL;
+
+    if (FAILED(ret = TZAALLOC(ring, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    /* Both copies have to start on a page boundary, so fill out the last page */
+    ring->ring_bytes = (nr_samples * sample_bytes + page_size - 1) & ~(page_size - 1);
+    ring->sample_bytes = sample_bytes;
+    ring->nr_samples = ring->ring_bytes / sample_bytes;
+
+    if (FAILED(ret = _sample_ring_map(ring))) {
+        goto done;
+    }
+
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+
+    DIAG("Sample ring: %zu samples of %zu bytes at %p", ring->nr_samples, sample_bytes, ring->base);
+
+    *pring = ring;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != ring) {
+            TFREE(ring);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t sample_ring_delete(struct sample_ring **pring)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_ring *ring = NULL;
+
+    TSL_ASSERT_PTR_BY_REF(pring);
+
+    ring = *pring;
+
+    if (NULL != ring->base) {
+        munmap(ring->base, 2 * ring->ring_bytes);
+        ring->base = NULL;
+    }
+
+    TFREE(ring);
+    *pring = NULL;
+
+    return ret;
+}
+
+aresult_t sample_ring_write_ptr(struct sample_ring *ring, void **pptr, size_t *pnr_free)
+{
+    uint64_t head = 0,
+             tail = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+    TSL_ASSERT_ARG_DEBUG(NULL != pptr);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_free);
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    *pptr = ring->base + (head % ring->nr_samples) * ring->sample_bytes;
+    *pnr_free = ring->nr_samples - (size_t)(head - tail);
+
+    return A_OK;
+}
+
+aresult_t sample_ring_produce(struct sample_ring *ring, size_t nr_samples)
+{
+    uint64_t head = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    TSL_BUG_ON(head + nr_samples - atomic_load_explicit(&ring->tail, memory_order_relaxed) > ring->nr_samples);
+
+    atomic_store_explicit(&ring->head, head + nr_samples, memory_order_release);
+
+    return A_OK;
+}
+
+aresult_t sample_ring_write(struct sample_ring *ring, const void *samples, size_t nr_samples,
+        size_t *pnr_written)
+{
+    aresult_t ret = A_OK;
+
+    void *ptr = NULL;
+    size_t nr_free = 0,
+           nr_write = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+    TSL_ASSERT_ARG_DEBUG(NULL != samples || 0 == nr_samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_written);
+
+    TSL_BUG_IF_FAILED(sample_ring_write_ptr(ring, &ptr, &nr_free));
+
+    /* One copy, even across the wrap point */
+    nr_write = BL_MIN2(nr_samples, nr_free);
+    memcpy(ptr, samples, nr_write * ring->sample_bytes);
+
+    TSL_BUG_IF_FAILED(sample_ring_produce(ring, nr_write));
+
+    *pnr_written = nr_write;
+
+    return ret;
+}
+
+aresult_t sample_ring_read_ptr(struct sample_ring *ring, const void **pptr, size_t *pnr_avail)
+{
+    uint64_t head = 0,
+             tail = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+    TSL_ASSERT_ARG_DEBUG(NULL != pptr);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_avail);
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    *pptr = ring->base + (tail % ring->nr_samples) * ring->sample_bytes;
+    *pnr_avail = (size_t)(head - tail);
+
+    return A_OK;
+}
+
+aresult_t sample_ring_consume(struct sample_ring *ring, size_t nr_samples)
+{
+    uint64_t tail = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    TSL_BUG_ON(tail + nr_samples > atomic_load_explicit(&ring->head, memory_order_relaxed));
+
+    atomic_store_explicit(&ring->tail, tail + nr_samples, memory_order_release);
+
+    return A_OK;
+}
+
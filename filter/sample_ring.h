@@ -0,0 +1,130 @@
+#pragma once
+
+#include <tsl/cal.h>
+#include <tsl/result.h>
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A "magic" sample ring: the ring's pages are mapped twice, back to back, so any run of up to
+ * the ring's capacity starting anywhere in the first copy is contiguous in memory. A FIR window
+ * that crosses the wrap point can then be read with plain pointer arithmetic, rather than being
+ * stitched together from two sample buffers, and a producer can queue as much lookahead as the
+ * ring holds.
+ *
+ * One thread writes to the ring, and one thread reads from it.
+ */
+struct sample_ring {
+    /**
+     * The start of the double mapping. Sample i is at the same address in both copies, modulo
+     * the ring size.
+     */
+    uint8_t *base;
+
+    /**
+     * The size of one copy of the ring, in bytes. A multiple of the page size.
+     */
+    size_t ring_bytes;
+
+    /**
+     * The size of a sample, in bytes (i.e. 4 for complex 16-bit samples)
+     */
+    size_t sample_bytes;
+
+    /**
+     * The capacity of the ring, in samples
+     */
+    size_t nr_samples;
+
+    /**
+     * The total number of samples ever written. Only written by the producer.
+     */
+    _Atomic uint64_t head CAL_CACHE_ALIGNED;
+
+    /**
+     * The total number of samples ever consumed. Only written by the consumer.
+     */
+    _Atomic uint64_t tail CAL_CACHE_ALIGNED;
+};
+
+/**
+ * Create a new sample ring.
+ *
+ * \param pring The new ring, returned by reference
+ * \param nr_samples The smallest capacity of the ring, in samples. Rounded up to fill a whole
+ *                   number of pages.
+ * \param sample_bytes The size of each sample. Must be a power of 2 no larger than a page.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_ring_new(struct sample_ring **pring, size_t nr_samples, size_t sample_bytes);
+
+/**
+ * Release a sample ring, and unmap its memory.
+ *
+ * \param pring The ring, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_ring_delete(struct sample_ring **pring);
+
+/**
+ * Get the space in the ring the producer can write to next. Nothing is made visible to the
+ * consumer until sample_ring_produce is called.
+ *
+ * \param ring The ring
+ * \param pptr The contiguous space to write to, returned by reference
+ * \param pnr_free The number of samples that can be written there, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_ring_write_ptr(struct sample_ring *ring, void **pptr, size_t *pnr_free);
+
+/**
+ * Make samples written at the pointer from sample_ring_write_ptr visible to the consumer.
+ *
+ * \param ring The ring
+ * \param nr_samples The number of samples written. At most the number of free samples.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_ring_produce(struct sample_ring *ring, size_t nr_samples);
+
+/**
+ * Copy samples into the ring. If the ring does not have space for all the samples, only those
+ * that fit are written.
+ *
+ * \param ring The ring
+ * \param samples The samples to write
+ * \param nr_samples The number of samples to write
+ * \param pnr_written The number of samples written, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_ring_write(struct sample_ring *ring, const void *samples, size_t nr_samples,
+        size_t *pnr_written);
+
+/**
+ * Get the samples waiting to be consumed. They are contiguous in memory, however the ring has
+ * wrapped around.
+ *
+ * \param ring The ring
+ * \param pptr The oldest unconsumed sample, returned by reference
+ * \param pnr_avail The number of samples available, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_ring_read_ptr(struct sample_ring *ring, const void **pptr, size_t *pnr_avail);
+
+/**
+ * Release the oldest samples in the ring, making space for the producer.
+ *
+ * \param ring The ring
+ * \param nr_samples The number of samples to release. At most the number available.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_ring_consume(struct sample_ring *ring, size_t nr_samples);
+
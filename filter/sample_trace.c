@@ -0,0 +1,291 @@
+/*
+ *  sample_trace.c - Per-thread rings of timestamps, following sample buffers through the pipeline
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <filter/sample_trace.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/syscall.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SAMPLE_TRACE_NAME_LEN           16
+
+struct sample_trace_event {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t seq;
+    uint32_t stage;
+};
+
+/**
+ * The events recorded by a single thread. Only the owning thread writes to the ring, so
+ * recording an event is a store and a release of the head.
+ */
+struct sample_trace_ring {
+    /**
+     * The next ring in the list of every ring ever created. Rings are never freed, so a thread's
+     * events outlive it.
+     */
+    struct sample_trace_ring *next;
+
+    pid_t tid;
+    char name[SAMPLE_TRACE_NAME_LEN];
+
+    /**
+     * The number of events ever recorded. The next event goes in head & mask.
+     */
+    _Atomic uint64_t head;
+
+    struct sample_trace_event events[];
+};
+
+bool _sample_trace_enabled = false;
+
+static
+size_t _sample_trace_nr_events = 0;
+
+static
+char _sample_trace_process[SAMPLE_TRACE_NAME_LEN];
+
+static
+_Atomic(struct sample_trace_ring *) _sample_trace_rings = NULL;
+
+static __thread
+struct sample_trace_ring *_sample_trace_ring = NULL;
+
+/**
+ * Set if this thread couldn't get a ring, so it doesn't keep trying
+ */
+static __thread
+bool _sample_trace_no_ring = false;
+
+static const
+char *_sample_trace_stage_names[SAMPLE_TRACE_NR_STAGES] = {
+    [SAMPLE_TRACE_CALLBACK] = "callback",
+    [SAMPLE_TRACE_CAPTURE] = "capture",
+    [SAMPLE_TRACE_DELIVER] = "deliver",
+    [SAMPLE_TRACE_QUEUE] = "queue",
+    [SAMPLE_TRACE_CHANNELIZE] = "channelize",
+    [SAMPLE_TRACE_DEMOD] = "demod",
+    [SAMPLE_TRACE_OUTPUT] = "output",
+    [SAMPLE_TRACE_READ] = "read",
+    [SAMPLE_TRACE_MESSAGE] = "message",
+};
+
+/**
+ * Copy a name, leaving out anything that would need escaping in a JSON string
+ */
+static
+void _sample_trace_copy_name(char *dst, const char *src)
+{
+    size_t i = 0;
+
+    for (; i < SAMPLE_TRACE_NAME_LEN - 1 && '\0' != src[i]; i++) {
+        dst[i] = ('"' == src[i] || '\\' == src[i] || (unsigned char)src[i] < 0x20) ? '_' : src[i];
+    }
+
+    dst[i] = '\0';
+}
+
+static
+struct sample_trace_ring *_sample_trace_ring_new(void)
+{
+    struct sample_trace_ring *ring = NULL;
+    char name[SAMPLE_TRACE_NAME_LEN] = { '\0' };
+
+    if (FAILED(TACALLOC((void **)&ring, 1, sizeof(struct sample_trace_ring) +
+                    _sample_trace_nr_events * sizeof(struct sample_trace_event), SYS_CACHE_LINE_LENGTH)))
+    {
+        return NULL;
+    }
+
+    ring->tid = syscall(SYS_gettid);
+    if (0 != pthread_getname_np(pthread_self(), name, sizeof(name))) {
+        snprintf(name, sizeof(name), "%d", (int)ring->tid);
+    }
+    _sample_trace_copy_name(ring->name, name);
+
+    /* Put it on the list, for sample_trace_dump to find */
+    ring->next = atomic_load_explicit(&_sample_trace_rings, memory_order_relaxed);
+    while (false == atomic_compare_exchange_weak_explicit(&_sample_trace_rings, &ring->next, ring,
+                memory_order_release, memory_order_relaxed)) { }
+
+    return ring;
+}
+
+void _sample_trace_record(enum sample_trace_stage stage, uint64_t seq, uint64_t start_ns, uint64_t end_ns)
+{
+    struct sample_trace_ring *ring = _sample_trace_ring;
+    struct sample_trace_event *evt = NULL;
+    uint64_t head = 0;
+
+    TSL_BUG_ON(SAMPLE_TRACE_NR_STAGES <= stage);
+
+    if (NULL == ring) {
+        if (true == _sample_trace_no_ring) {
+            return;
+        }
+
+        if (NULL == (ring = _sample_trace_ring_new())) {
+            _sample_trace_no_ring = true;
+            return;
+        }
+
+        _sample_trace_ring = ring;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    evt = &ring->events[head & (_sample_trace_nr_events - 1)];
+
+    evt->start_ns = start_ns;
+    evt->end_ns = end_ns < start_ns ? start_ns : end_ns;
+    evt->seq = seq;
+    evt->stage = stage;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+aresult_t sample_trace_enable(const char *process_name, size_t nr_events)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr = 1;
+
+    TSL_ASSERT_ARG(NULL != process_name);
+    TSL_ASSERT_ARG(0 != nr_events);
+
+    if (true == _sample_trace_enabled) {
+        goto done;
+    }
+
+    while (nr < nr_events) {
+        nr <<= 1;
+    }
+
+    _sample_trace_copy_name(_sample_trace_process, process_name);
+    _sample_trace_nr_events = nr;
+    _sample_trace_enabled = true;
+
+done:
+    return ret;
+}
+
+/**
+ * Write an event as a Chrome trace complete event. Events for the same buffer are tied together
+ * with a flow, so following a buffer from stage to stage is a click away.
+ */
+static
+void _sample_trace_write_event(FILE *fp, int pid, const struct sample_trace_ring *ring,
+        const struct sample_trace_event *evt)
+{
+    uint64_t dur_ns = evt->end_ns - evt->start_ns;
+
+    fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"sample\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%" PRIu64 ".%03" PRIu64 ",\"dur\":%" PRIu64 ".%03" PRIu64 ","
+            "\"bind_id\":\"%s-%" PRIu64 "\",\"flow_in\":true,\"flow_out\":true,"
+            "\"args\":{\"seq\":%" PRIu64 "}}",
+            _sample_trace_stage_names[evt->stage], pid, (int)ring->tid,
+            evt->start_ns / 1000, evt->start_ns % 1000, dur_ns / 1000, dur_ns % 1000,
+            _sample_trace_process, evt->seq, evt->seq);
+}
+
+aresult_t sample_trace_dump(const char *path)
+{
+    aresult_t ret = A_OK;
+
+    FILE *fp = NULL;
+    struct sample_trace_ring *ring = NULL;
+    struct sample_trace_event *events = NULL;
+    int pid = getpid();
+
+    TSL_ASSERT_ARG(NULL != path);
+
+    if (false == _sample_trace_enabled) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&events, _sample_trace_nr_events, sizeof(struct sample_trace_event),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    if (NULL == (fp = fopen(path, "w"))) {
+        int errnum = errno;
+        DIAG("Failed to open trace file '%s': %s (%d)", path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+            pid, _sample_trace_process);
+
+    for (ring = atomic_load_explicit(&_sample_trace_rings, memory_order_acquire); NULL != ring; ring = ring->next) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire),
+                 first = head > _sample_trace_nr_events ? head - _sample_trace_nr_events : 0,
+                 oldest = 0;
+
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, (int)ring->tid, ring->name);
+
+        /* Copy what's there, then drop whatever the owner might have overwritten meanwhile */
+        for (uint64_t i = first; i < head; i++) {
+            events[i - first] = ring->events[i & (_sample_trace_nr_events - 1)];
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        oldest = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        oldest = oldest >= _sample_trace_nr_events ? oldest - _sample_trace_nr_events + 1 : 0;
+
+        for (uint64_t i = oldest > first ? oldest : first; i < head; i++) {
+            _sample_trace_write_event(fp, pid, ring, &events[i - first]);
+        }
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    if (0 != fclose(fp)) {
+        ret = A_E_INVAL;
+    }
+    fp = NULL;
+
+done:
+    if (NULL != fp) {
+        fclose(fp);
+    }
+
+    if (NULL != events) {
+        TFREE(events);
+    }
+
+    return ret;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <filter/sample_buf.h>
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The stages a sample buffer passes through, from the device handing over the samples to a
+ * decoded message being written out.
+ */
+enum sample_trace_stage {
+    /**
+     * Servicing the device callback, converting the raw samples
+     */
+    SAMPLE_TRACE_CALLBACK = 0,
+
+    /**
+     * From when the first sample was captured until the buffer is delivered to the receiver's
+     * consumers
+     */
+    SAMPLE_TRACE_CAPTURE = 1,
+
+    /**
+     * Handing the buffer to each consumer
+     */
+    SAMPLE_TRACE_DELIVER = 2,
+
+    /**
+     * Waiting in a consumer's queue
+     */
+    SAMPLE_TRACE_QUEUE = 3,
+
+    /**
+     * Splitting the buffer into channels
+     */
+    SAMPLE_TRACE_CHANNELIZE = 4,
+
+    /**
+     * Filtering and demodulating the buffer
+     */
+    SAMPLE_TRACE_DEMOD = 5,
+
+    /**
+     * Writing a batch of PCM samples to the FIFO, ring or in-process decoder
+     */
+    SAMPLE_TRACE_OUTPUT = 6,
+
+    /**
+     * The decoder reading PCM samples from its FIFO or ring
+     */
+    SAMPLE_TRACE_READ = 7,
+
+    /**
+     * From when the samples were captured (or read, if that isn't known) until the message they
+     * held was decoded
+     */
+    SAMPLE_TRACE_MESSAGE = 8,
+
+    SAMPLE_TRACE_NR_STAGES
+};
+
+/**
+ * Default number of events remembered per thread. Old events are overwritten once a thread's
+ * ring fills.
+ */
+#define SAMPLE_TRACE_DEFAULT_EVENTS     65536
+
+/**
+ * Set once tracing has been enabled. Don't touch this directly.
+ */
+extern bool _sample_trace_enabled;
+
+/**
+ * Start tracing. Each thread that records an event gets its own ring, the first time it does.
+ * Call before starting any threads that will be traced.
+ *
+ * \param process_name The name to give this process in the trace
+ * \param nr_events The number of events remembered per thread. Rounded up to a power of 2.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t sample_trace_enable(const char *process_name, size_t nr_events);
+
+/**
+ * Write every event remembered so far, on every thread, as Chrome trace event JSON, suitable for
+ * loading into Perfetto or chrome://tracing. Events are timed on the sample buffer clock, so
+ * traces written by different processes on the same host line up. Threads can keep recording
+ * while the trace is written; events overwritten in the meantime are left out.
+ *
+ * \param path The file to write the trace to
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t sample_trace_dump(const char *path);
+
+void _sample_trace_record(enum sample_trace_stage stage, uint64_t seq, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Check if tracing is enabled
+ */
+static inline
+bool sample_trace_is_enabled(void)
+{
+    return _sample_trace_enabled;
+}
+
+/**
+ * Get the current time for a trace event, or 0 if tracing isn't enabled, so callers don't pay
+ * for reading the clock when no one is looking.
+ */
+static inline
+uint64_t sample_trace_now_ns(void)
+{
+    return true == _sample_trace_enabled ? sample_buf_now_ns() : 0;
+}
+
+/**
+ * Record that a buffer spent the given time in a stage, in this thread's ring. Does nothing if
+ * tracing isn't enabled, or if the start of the stage isn't known. Never blocks.
+ *
+ * \param stage The stage
+ * \param seq The sequence number of the buffer, see sample_buf
+ * \param start_ns When the stage started, on the sample buffer clock
+ * \param end_ns When the stage ended, on the sample buffer clock
+ */
+static inline
+void sample_trace_record(enum sample_trace_stage stage, uint64_t seq, uint64_t start_ns, uint64_t end_ns)
+{
+    if (false == _sample_trace_enabled || 0 == start_ns) {
+        return;
+    }
+
+    _sample_trace_record(stage, seq, start_ns, end_ns);
+}
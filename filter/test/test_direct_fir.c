@@ -1,8 +1,24 @@
 #include <filter/filter.h>
+#include <filter/direct_fir.h>
+#include <filter/sample_buf.h>
+#include <filter/complex.h>
 
 #include <test/assert.h>
 #include <test/framework.h>
 
+#include <tsl/safe_alloc.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_COEFFS              37
+#define TEST_DECIMATION             3
+#define TEST_NR_BUFS                4
+
+static const
+size_t test_direct_fir_buf_lens[TEST_NR_BUFS] = { 300, 257, 411, 129 };
+
 static
 aresult_t test_direct_fir_setup(void)
 {
@@ -15,11 +31,292 @@ aresult_t test_direct_fir_cleanup(void)
     return A_OK;
 }
 
+/**
+ * Simple deterministic pseudo-random sample generator
+ */
+static
+int16_t _test_direct_fir_rand(uint32_t *state)
+{
+    *state = *state * 1103515245ul + 12345ul;
+    return (int16_t)(*state >> 16);
+}
+
+static
+aresult_t _test_direct_fir_buf_release(struct sample_buf *buf)
+{
+    TFREE(buf);
+    return A_OK;
+}
+
+static
+aresult_t _test_direct_fir_buf_new(struct sample_buf **pbuf, const int16_t *samples, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    if (FAILED(ret = TCALLOC((void **)&buf, 1, sizeof(struct sample_buf) + nr_samples * 2 * sizeof(int16_t)))) {
+        goto done;
+    }
+
+    memcpy(buf->data_buf, samples, nr_samples * 2 * sizeof(int16_t));
+    buf->nr_samples = nr_samples;
+    buf->sample_buf_bytes = nr_samples * 2 * sizeof(int16_t);
+    buf->sample_type = COMPLEX_INT_16;
+    buf->release = _test_direct_fir_buf_release;
+    atomic_store(&buf->refcount, 1);
+
+    *pbuf = buf;
+
+done:
+    return ret;
+}
+
+TEST_DECLARE_UNIT(test_smoke, direct_fir)
+{
+    struct direct_fir fir;
+    int16_t coeffs[TEST_NR_COEFFS] = { 0 };
+
+    TEST_ASSERT_OK(direct_fir_init(&fir, TEST_NR_COEFFS, coeffs, coeffs, TEST_DECIMATION, false, 0, 0));
+    TEST_ASSERT_OK(direct_fir_cleanup(&fir));
+
+    return A_OK;
+}
+
+/**
+ * Run the FIR over a stream split across unevenly sized buffers, and check every output sample
+ * against a plain C reference. This exercises whichever SIMD kernel is built in, including the
+ * vector tails and windows that straddle two sample buffers. Longer filters get proportionally
+ * longer buffers and smaller coefficients.
+ *
+ * \param nr_coeffs The number of taps
+ * \param decimation The decimation factor to use
+ * \param out_chunk The most output samples to ask for in a single call to direct_fir_process
+ * \param symmetry The symmetry to give the coefficients
+ */
+static
+aresult_t _test_direct_fir_reference(size_t nr_coeffs, unsigned decimation, size_t out_chunk,
+        enum direct_fir_symmetry symmetry)
+{
+    struct direct_fir fir;
+    int16_t *c_re = NULL,
+            *c_im = NULL,
+            *samples = NULL,
+            *output = NULL;
+    size_t nr_samples = 0,
+           nr_expected = 0,
+           nr_out = 0,
+           offset = 0,
+           scale = (nr_coeffs + TEST_NR_COEFFS - 1) / TEST_NR_COEFFS;
+    uint32_t state = 0x5eed;
+
+    for (size_t i = 0; i < TEST_NR_BUFS; i++) {
+        nr_samples += scale * test_direct_fir_buf_lens[i];
+    }
+
+    nr_expected = (nr_samples - nr_coeffs) / decimation + 1;
+
+    TEST_ASSERT_OK(TCALLOC((void **)&c_re, nr_coeffs, sizeof(int16_t)));
+    TEST_ASSERT_OK(TCALLOC((void **)&c_im, nr_coeffs, sizeof(int16_t)));
+
+    /* Keep the coefficients to a realistic gain, so the accumulators don't overflow */
+    for (size_t i = 0; i < nr_coeffs; i++) {
+        c_re[i] = _test_direct_fir_rand(&state) / (int16_t)(16 * scale);
+        c_im[i] = _test_direct_fir_rand(&state) / (int16_t)(16 * scale);
+    }
+
+    /* Make sure the most negative coefficient is handled exactly */
+    if (DIRECT_FIR_ASYMMETRIC == symmetry) {
+        c_im[5] = INT16_MIN;
+    }
+    c_re[17] = INT16_MIN;
+
+    /* Mirror the first half of the taps onto the second */
+    for (size_t k = 0; k < nr_coeffs / 2 && DIRECT_FIR_ASYMMETRIC != symmetry; k++) {
+        c_re[nr_coeffs - 1 - k] = c_re[k];
+        c_im[nr_coeffs - 1 - k] = DIRECT_FIR_CONJ_SYMMETRIC == symmetry ? -c_im[k] : c_im[k];
+    }
+
+    if (DIRECT_FIR_CONJ_SYMMETRIC == symmetry && 0 != (nr_coeffs & 1)) {
+        c_im[nr_coeffs / 2] = 0;
+    }
+
+    TEST_ASSERT_OK(TCALLOC((void **)&samples, nr_samples, 2 * sizeof(int16_t)));
+    TEST_ASSERT_OK(TCALLOC((void **)&output, nr_expected + 1, 2 * sizeof(int16_t)));
+
+    for (size_t i = 0; i < 2 * nr_samples; i++) {
+        samples[i] = _test_direct_fir_rand(&state) / 4;
+    }
+
+    samples[40] = INT16_MIN;
+    samples[41] = INT16_MIN;
+
+    TEST_ASSERT_OK(direct_fir_init(&fir, nr_coeffs, c_re, c_im, decimation, false, 0, 0));
+    TEST_ASSERT_EQUALS(fir.symmetry, symmetry);
+
+    for (size_t i = 0; i < TEST_NR_BUFS; i++) {
+        struct sample_buf *buf = NULL;
+        size_t nr_gen = 0;
+
+        TEST_ASSERT_OK(_test_direct_fir_buf_new(&buf, samples + 2 * offset, scale * test_direct_fir_buf_lens[i]));
+        offset += scale * test_direct_fir_buf_lens[i];
+
+        TEST_ASSERT_OK(direct_fir_push_sample_buf(&fir, buf));
+
+        do {
+            size_t nr_req = BL_MIN2(out_chunk, nr_expected + 1 - nr_out);
+            TEST_ASSERT_OK(direct_fir_process(&fir, output + 2 * nr_out, nr_req, &nr_gen));
+            nr_out += nr_gen;
+        } while (0 != nr_gen && nr_out <= nr_expected);
+    }
+
+    TEST_ASSERT_EQUALS(nr_out, nr_expected);
+
+    for (size_t k = 0; k < nr_expected; k++) {
+        uint32_t acc_re = 0,
+                 acc_im = 0;
+
+        for (size_t j = 0; j < nr_coeffs; j++) {
+            int32_t s_re = samples[2 * (k * decimation + j)],
+                    s_im = samples[2 * (k * decimation + j) + 1];
+
+            acc_re += (uint32_t)(c_re[j] * s_re) - (uint32_t)(c_im[j] * s_im);
+            acc_im += (uint32_t)(c_re[j] * s_im) + (uint32_t)(c_im[j] * s_re);
+        }
+
+        if (output[2 * k] != round_q30_q15((int32_t)acc_re) ||
+                output[2 * k + 1] != round_q30_q15((int32_t)acc_im))
+        {
+            TEST_ERR("Mismatch at output %zu: got (%d, %d), expected (%d, %d)", k,
+                    output[2 * k], output[2 * k + 1],
+                    round_q30_q15((int32_t)acc_re), round_q30_q15((int32_t)acc_im));
+            return A_E_INVAL;
+        }
+    }
+
+    TEST_ASSERT_OK(direct_fir_cleanup(&fir));
+
+    TFREE(output);
+    TFREE(samples);
+    TFREE(c_re);
+    TFREE(c_im);
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_reference, direct_fir)
+{
+    TEST_ASSERT_OK(_test_direct_fir_reference(TEST_NR_COEFFS, TEST_DECIMATION, SIZE_MAX, DIRECT_FIR_ASYMMETRIC));
+
+    return A_OK;
+}
+
+/**
+ * Make sure block processing picks up where it left off, whether it stops because the output
+ * buffer is full, or because the decimation skips past the end of a sample buffer.
+ */
+TEST_DECLARE_UNIT(test_block_boundaries, direct_fir)
+{
+    TEST_ASSERT_OK(_test_direct_fir_reference(TEST_NR_COEFFS, 1, SIZE_MAX, DIRECT_FIR_ASYMMETRIC));
+    TEST_ASSERT_OK(_test_direct_fir_reference(TEST_NR_COEFFS, TEST_DECIMATION, 5, DIRECT_FIR_ASYMMETRIC));
+    TEST_ASSERT_OK(_test_direct_fir_reference(TEST_NR_COEFFS, 7, 1, DIRECT_FIR_ASYMMETRIC));
+    TEST_ASSERT_OK(_test_direct_fir_reference(TEST_NR_COEFFS, TEST_NR_COEFFS + 3, SIZE_MAX, DIRECT_FIR_ASYMMETRIC));
+
+    return A_OK;
+}
+
+/**
+ * The kernels unrolled for the filters we ship must agree with the reference, too.
+ */
+TEST_DECLARE_UNIT(test_kernels, direct_fir)
+{
+    TEST_ASSERT_OK(_test_direct_fir_reference(128, 40, SIZE_MAX, DIRECT_FIR_ASYMMETRIC));
+    TEST_ASSERT_OK(_test_direct_fir_reference(512, 120, 3, DIRECT_FIR_ASYMMETRIC));
+    TEST_ASSERT_OK(_test_direct_fir_reference(256, 25, SIZE_MAX, DIRECT_FIR_ASYMMETRIC));
+    TEST_ASSERT_OK(_test_direct_fir_reference(256, 100, 1, DIRECT_FIR_ASYMMETRIC));
 
-TEST_DECLARE_UNIT(test_smoke, flex)
+    return A_OK;
+}
+
+/**
+ * Symmetric and conjugate symmetric coefficients are found and folded, for odd and even
+ * lengths, and in the unrolled kernels, without changing the output.
+ */
+TEST_DECLARE_UNIT(test_symmetric, direct_fir)
 {
+    static const enum direct_fir_symmetry symmetries[2] = { DIRECT_FIR_SYMMETRIC, DIRECT_FIR_CONJ_SYMMETRIC };
+
+    for (size_t i = 0; i < 2; i++) {
+        TEST_ASSERT_OK(_test_direct_fir_reference(TEST_NR_COEFFS, TEST_DECIMATION, SIZE_MAX, symmetries[i]));
+        TEST_ASSERT_OK(_test_direct_fir_reference(TEST_NR_COEFFS + 1, 1, 5, symmetries[i]));
+        TEST_ASSERT_OK(_test_direct_fir_reference(74, TEST_DECIMATION, SIZE_MAX, symmetries[i]));
+        TEST_ASSERT_OK(_test_direct_fir_reference(128, 40, SIZE_MAX, symmetries[i]));
+        TEST_ASSERT_OK(_test_direct_fir_reference(256, 25, 3, symmetries[i]));
+    }
+
     return A_OK;
 }
 
-TEST_DECLARE_SUITE(flex, test_direct_fir_cleanup, test_direct_fir_setup, NULL, NULL);
+/**
+ * A FIR borrowing its coefficients produces the same output as one holding a copy, and leaves
+ * the coefficients alone when it is cleaned up.
+ */
+TEST_DECLARE_UNIT(test_shared, direct_fir)
+{
+    struct direct_fir fir_copy,
+                      fir_shared;
+    struct sample_buf *buf = NULL;
+    int16_t *coeffs = NULL,
+            *samples = NULL,
+            *out_copy = NULL,
+            *out_shared = NULL;
+    size_t nr_samples = test_direct_fir_buf_lens[0],
+           nr_expected = (nr_samples - TEST_NR_COEFFS) / TEST_DECIMATION + 1,
+           nr_copy = 0,
+           nr_shared = 0;
+    uint32_t state = 0xc0ef;
+
+    TEST_ASSERT_OK(TACALLOC((void **)&coeffs, TEST_NR_COEFFS, 2 * sizeof(int16_t), 64));
+    TEST_ASSERT_OK(TCALLOC((void **)&samples, nr_samples, 2 * sizeof(int16_t)));
+    TEST_ASSERT_OK(TCALLOC((void **)&out_copy, nr_expected, 2 * sizeof(int16_t)));
+    TEST_ASSERT_OK(TCALLOC((void **)&out_shared, nr_expected, 2 * sizeof(int16_t)));
+
+    for (size_t i = 0; i < 2 * TEST_NR_COEFFS; i++) {
+        coeffs[i] = _test_direct_fir_rand(&state) / 16;
+    }
+
+    for (size_t i = 0; i < 2 * nr_samples; i++) {
+        samples[i] = _test_direct_fir_rand(&state) / 4;
+    }
+
+    TEST_ASSERT_OK(direct_fir_init(&fir_copy, TEST_NR_COEFFS, coeffs, &coeffs[TEST_NR_COEFFS],
+                TEST_DECIMATION, true, 1000000, 12500));
+    TEST_ASSERT_OK(direct_fir_init_shared(&fir_shared, TEST_NR_COEFFS, coeffs, &coeffs[TEST_NR_COEFFS],
+                TEST_DECIMATION, true, 1000000, 12500));
+    TEST_ASSERT_EQUALS(fir_shared.fir_real_coeff, coeffs);
+    TEST_ASSERT_EQUALS(fir_shared.fir_imag_coeff, &coeffs[TEST_NR_COEFFS]);
+
+    TEST_ASSERT_OK(_test_direct_fir_buf_new(&buf, samples, nr_samples));
+    TEST_ASSERT_OK(direct_fir_push_sample_buf(&fir_copy, buf));
+    TEST_ASSERT_OK(_test_direct_fir_buf_new(&buf, samples, nr_samples));
+    TEST_ASSERT_OK(direct_fir_push_sample_buf(&fir_shared, buf));
+
+    TEST_ASSERT_OK(direct_fir_process(&fir_copy, out_copy, nr_expected, &nr_copy));
+    TEST_ASSERT_OK(direct_fir_process(&fir_shared, out_shared, nr_expected, &nr_shared));
+    TEST_ASSERT_EQUALS(nr_copy, nr_expected);
+    TEST_ASSERT_EQUALS(nr_shared, nr_expected);
+    TEST_ASSERT_EQUALS(memcmp(out_copy, out_shared, nr_expected * 2 * sizeof(int16_t)), 0);
+
+    TEST_ASSERT_OK(direct_fir_cleanup(&fir_shared));
+    TEST_ASSERT_OK(direct_fir_cleanup(&fir_copy));
+
+    /* The borrowed coefficients are still ours to free */
+    TFREE(coeffs);
+    TFREE(out_shared);
+    TFREE(out_copy);
+    TFREE(samples);
+
+    return A_OK;
+}
 
+TEST_DECLARE_SUITE(direct_fir, test_direct_fir_cleanup, test_direct_fir_setup, NULL, NULL);
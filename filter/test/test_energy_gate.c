@@ -0,0 +1,91 @@
+#include <filter/energy_gate.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_SAMPLES             256
+
+static
+int16_t test_gate_loud[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_gate_quiet[2 * TEST_NR_SAMPLES];
+
+static
+aresult_t test_energy_gate_setup(void)
+{
+    /* A complex tone at -20 dBFS, and one at -60 dBFS */
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        double ph = 0.1 * i;
+        test_gate_loud[2 * i] = (int16_t)lrint(cos(ph) * 3276.8);
+        test_gate_loud[2 * i + 1] = (int16_t)lrint(sin(ph) * 3276.8);
+        test_gate_quiet[2 * i] = (int16_t)lrint(cos(ph) * 32.768);
+        test_gate_quiet[2 * i + 1] = (int16_t)lrint(sin(ph) * 32.768);
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_energy_gate_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * The power estimate matches the level of a known tone, and full scale doesn't overflow.
+ */
+TEST_DECLARE_UNIT(test_energy_gate_power, energy_gate)
+{
+    int16_t full[2 * TEST_NR_SAMPLES];
+    double loud_db = 10.0 * log10((double)energy_gate_power(test_gate_loud, TEST_NR_SAMPLES) / (double)(1ull << 30));
+
+    if (fabs(loud_db + 20.0) >= 0.1) {
+        TEST_ERR("A -20 dBFS tone measured at %f dBFS", loud_db);
+        return A_E_INVAL;
+    }
+    TEST_ASSERT_EQUALS(energy_gate_power(test_gate_loud, 0), 0);
+
+    for (size_t i = 0; i < 2 * TEST_NR_SAMPLES; i++) {
+        full[i] = INT16_MIN;
+    }
+
+    TEST_ASSERT_EQUALS(energy_gate_power(full, TEST_NR_SAMPLES), 1ull << 31);
+
+    return A_OK;
+}
+
+/**
+ * The gate opens on a loud block, stays open for the hold time once it goes quiet, then closes.
+ */
+TEST_DECLARE_UNIT(test_energy_gate_hysteresis, energy_gate)
+{
+    struct energy_gate gate;
+
+    TEST_ASSERT_OK(energy_gate_init(&gate, -30.0, -40.0, 2 * TEST_NR_SAMPLES));
+
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_quiet, TEST_NR_SAMPLES), false);
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_loud, TEST_NR_SAMPLES), true);
+
+    /* Held open for two blocks' worth of quiet, closed on the third */
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_quiet, TEST_NR_SAMPLES), true);
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_quiet, TEST_NR_SAMPLES), false);
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_quiet, TEST_NR_SAMPLES), false);
+
+    /* Anything loud enough resets the hold */
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_loud, TEST_NR_SAMPLES), true);
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_quiet, TEST_NR_SAMPLES), true);
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_loud, TEST_NR_SAMPLES), true);
+    TEST_ASSERT_EQUALS(energy_gate_update(&gate, test_gate_quiet, TEST_NR_SAMPLES), true);
+
+    /* The close level has to sit at or below the open level */
+    TEST_ASSERT_EQUALS(FAILED(energy_gate_init(&gate, -40.0, -30.0, 0)), true);
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(energy_gate, test_energy_gate_cleanup, test_energy_gate_setup, NULL, NULL);
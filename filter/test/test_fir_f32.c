@@ -0,0 +1,379 @@
+#include <filter/filter.h>
+#include <filter/direct_fir.h>
+#include <filter/direct_fir_f32.h>
+#include <filter/polyphase_fir_f32.h>
+#include <filter/sample_buf.h>
+#include <filter/sample_convert.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <tsl/safe_alloc.h>
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_COEFFS              31
+#define TEST_DECIMATION             3
+#define TEST_NR_SAMPLES             1500
+
+/* One Q.15 LSB; the fixed point filters carry one rounding step per output */
+#define TEST_LSB                    (1.0f / 32768.0f)
+
+static
+int16_t test_fir_f32_in_q15[2 * TEST_NR_SAMPLES];
+
+static
+float test_fir_f32_in[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_fir_f32_coeff_re_q15[TEST_NR_COEFFS];
+
+static
+int16_t test_fir_f32_coeff_im_q15[TEST_NR_COEFFS];
+
+static
+float test_fir_f32_coeff_re[TEST_NR_COEFFS];
+
+static
+float test_fir_f32_coeff_im[TEST_NR_COEFFS];
+
+static
+int16_t _test_fir_f32_rand(uint32_t *state)
+{
+    *state = *state * 1103515245ul + 12345ul;
+    return (int16_t)(*state >> 16);
+}
+
+/**
+ * Generate the same input and coefficients in both representations. The fixed point filters
+ * treat coefficients as having Q_15_SHIFT fractional bits.
+ */
+static
+aresult_t test_fir_f32_setup(void)
+{
+    uint32_t state = 7;
+
+    for (size_t i = 0; i < 2 * TEST_NR_SAMPLES; i++) {
+        test_fir_f32_in_q15[i] = _test_fir_f32_rand(&state) / 8;
+    }
+
+    TSL_BUG_IF_FAILED(sample_convert_q15_to_f32(test_fir_f32_in, test_fir_f32_in_q15, 2 * TEST_NR_SAMPLES));
+
+    for (size_t i = 0; i < TEST_NR_COEFFS; i++) {
+        test_fir_f32_coeff_re_q15[i] = _test_fir_f32_rand(&state) / 16;
+        test_fir_f32_coeff_im_q15[i] = _test_fir_f32_rand(&state) / 16;
+        test_fir_f32_coeff_re[i] = (float)test_fir_f32_coeff_re_q15[i] / (float)(1 << Q_15_SHIFT);
+        test_fir_f32_coeff_im[i] = (float)test_fir_f32_coeff_im_q15[i] / (float)(1 << Q_15_SHIFT);
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_fir_f32_cleanup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t _test_fir_f32_buf_release(struct sample_buf *buf)
+{
+    TFREE(buf);
+    return A_OK;
+}
+
+static
+aresult_t _test_fir_f32_buf_new(struct sample_buf **pbuf, const void *samples, size_t nr_samples,
+        size_t nr_bytes, enum sample_type type)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    if (FAILED(ret = TCALLOC((void **)&buf, 1, sizeof(struct sample_buf) + nr_bytes))) {
+        goto done;
+    }
+
+    memcpy(buf->data_buf, samples, nr_bytes);
+    buf->nr_samples = nr_samples;
+    buf->sample_buf_bytes = nr_bytes;
+    buf->sample_type = type;
+    buf->release = _test_fir_f32_buf_release;
+    atomic_store(&buf->refcount, 1);
+
+    *pbuf = buf;
+
+done:
+    return ret;
+}
+
+/**
+ * Push the test input through a floating point direct FIR, in blocks of the given lengths
+ * (repeating the last), draining it a few samples at a time.
+ */
+static
+aresult_t _test_fir_f32_direct_run(struct direct_fir_f32 *fir, const float *in, size_t nr_in,
+        const size_t *blks, size_t nr_blks, float *out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    size_t offs = 0,
+           nr_out = 0,
+           blk = 0;
+
+    while (offs < nr_in) {
+        struct sample_buf *buf = NULL;
+        size_t nr = BL_MIN2(nr_in - offs, blks[BL_MIN2(blk, nr_blks - 1)]),
+               nr_gen = 0;
+        bool full = false;
+
+        TEST_ASSERT_OK(_test_fir_f32_buf_new(&buf, in + 2 * offs, nr, nr * 2 * sizeof(float), COMPLEX_FLOAT_32));
+        TEST_ASSERT_OK(direct_fir_f32_push_sample_buf(fir, buf));
+
+        do {
+            TEST_ASSERT_OK(direct_fir_f32_process(fir, out + 2 * nr_out, 13, &nr_gen));
+            nr_out += nr_gen;
+        } while (0 != nr_gen);
+
+        /* Blocks are at least as long as the filter, so the FIR can always take the next one */
+        TEST_ASSERT_OK(direct_fir_f32_full(fir, &full));
+        TEST_ASSERT_EQUALS(full, false);
+
+        offs += nr;
+        blk++;
+    }
+
+    *pnr_out = nr_out;
+
+    return ret;
+}
+
+TEST_DECLARE_UNIT(test_convert, fir_f32)
+{
+    static int16_t q15[65536],
+                   back[65536];
+    static float f32[65536];
+
+    for (size_t i = 0; i < 65536; i++) {
+        q15[i] = (int16_t)(i - 32768);
+    }
+
+    TEST_ASSERT_OK(sample_convert_q15_to_f32(f32, q15, 65536));
+    TEST_ASSERT_OK(sample_convert_f32_to_q15(back, f32, 65536));
+
+    TEST_ASSERT_EQUALS(f32[0], -1.0f);
+    TEST_ASSERT_EQUALS(memcmp(back, q15, sizeof(q15)), 0);
+
+    return A_OK;
+}
+
+/**
+ * The floating point direct FIR gives the same output as the Q.15 one, give or take the rounding
+ * of the latter, regardless of how the input is split into sample buffers. The buffer splits
+ * don't change the arithmetic at all, so those outputs are bit-identical.
+ */
+TEST_DECLARE_UNIT(test_direct_fir, fir_f32)
+{
+    static const size_t whole[1] = { TEST_NR_SAMPLES },
+                        pieces[5] = { 31, 45, 300, 64, 256 };
+    static int16_t ref_q15[2 * TEST_NR_SAMPLES];
+    static float ref[2 * TEST_NR_SAMPLES],
+                 out[2 * TEST_NR_SAMPLES];
+    struct direct_fir fir_q15;
+    struct direct_fir_f32 fir;
+    struct sample_buf *buf = NULL;
+    size_t nr_ref_q15 = 0,
+           nr_ref = 0,
+           nr_out = 0;
+
+    TEST_ASSERT_OK(direct_fir_init(&fir_q15, TEST_NR_COEFFS, test_fir_f32_coeff_re_q15, test_fir_f32_coeff_im_q15,
+                TEST_DECIMATION, false, 0, 0));
+    TEST_ASSERT_OK(_test_fir_f32_buf_new(&buf, test_fir_f32_in_q15, TEST_NR_SAMPLES,
+                TEST_NR_SAMPLES * 2 * sizeof(int16_t), COMPLEX_INT_16));
+    TEST_ASSERT_OK(direct_fir_push_sample_buf(&fir_q15, buf));
+    TEST_ASSERT_OK(direct_fir_process(&fir_q15, ref_q15, TEST_NR_SAMPLES, &nr_ref_q15));
+    TEST_ASSERT_OK(direct_fir_cleanup(&fir_q15));
+
+    TEST_ASSERT_OK(direct_fir_f32_init(&fir, TEST_NR_COEFFS, test_fir_f32_coeff_re, test_fir_f32_coeff_im,
+                TEST_DECIMATION, false, 0, 0));
+    TEST_ASSERT_OK(_test_fir_f32_direct_run(&fir, test_fir_f32_in, TEST_NR_SAMPLES, whole, 1, ref, &nr_ref));
+    TEST_ASSERT_OK(direct_fir_f32_cleanup(&fir));
+
+    TEST_ASSERT_OK(direct_fir_f32_init(&fir, TEST_NR_COEFFS, test_fir_f32_coeff_re, test_fir_f32_coeff_im,
+                TEST_DECIMATION, false, 0, 0));
+    TEST_ASSERT_OK(_test_fir_f32_direct_run(&fir, test_fir_f32_in, TEST_NR_SAMPLES, pieces, 5, out, &nr_out));
+    TEST_ASSERT_OK(direct_fir_f32_cleanup(&fir));
+
+    TEST_ASSERT_EQUALS(nr_ref, nr_ref_q15);
+    TEST_ASSERT_EQUALS(nr_out, nr_ref);
+    TEST_ASSERT_EQUALS(memcmp(out, ref, nr_out * 2 * sizeof(float)), 0);
+
+    for (size_t i = 0; i < 2 * nr_ref; i++) {
+        float expected = (float)ref_q15[i] * TEST_LSB;
+
+        if (fabsf(ref[i] - expected) > 1.5f * TEST_LSB) {
+            TEST_ERR("Mismatch at %zu: got %f, expected %f", i, ref[i], expected);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * A tone at the shift frequency comes out of the derotator at DC, and stays at unit magnitude
+ * over a long run.
+ */
+TEST_DECLARE_UNIT(test_derotate, fir_f32)
+{
+    static float tone[2 * 20000],
+                 out[2 * 20000];
+    static const size_t blks[1] = { 4096 };
+    const float one = 1.0f,
+                zero = 0.0f;
+    const double freq = 12345.0 / 250000.0;
+    struct direct_fir_f32 fir;
+    size_t nr_out = 0;
+
+    for (size_t i = 0; i < 20000; i++) {
+        tone[2 * i    ] = (float)cos(2.0 * M_PI * freq * i);
+        tone[2 * i + 1] = (float)sin(2.0 * M_PI * freq * i);
+    }
+
+    TEST_ASSERT_OK(direct_fir_f32_init(&fir, 1, &one, &zero, 1, true, 250000, 12345));
+    TEST_ASSERT_OK(_test_fir_f32_direct_run(&fir, tone, 20000, blks, 1, out, &nr_out));
+    TEST_ASSERT_OK(direct_fir_f32_cleanup(&fir));
+
+    TEST_ASSERT_EQUALS(nr_out, 20000);
+
+    for (size_t i = 0; i < nr_out; i++) {
+        if (fabsf(out[2 * i] - 1.0f) > 1e-3f || fabsf(out[2 * i + 1]) > 1e-3f) {
+            TEST_ERR("Sample %zu came out as (%f, %f)", i, out[2 * i], out[2 * i + 1]);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Buffers with the wrong sample type are turned away.
+ */
+TEST_DECLARE_UNIT(test_sample_type, fir_f32)
+{
+    struct direct_fir_f32 fir;
+    struct polyphase_fir_f32 *pfir = NULL;
+    struct sample_buf *buf = NULL;
+
+    TEST_ASSERT_OK(_test_fir_f32_buf_new(&buf, test_fir_f32_in, 8, 8 * 2 * sizeof(float), REAL_FLOAT_32));
+
+    TEST_ASSERT_OK(direct_fir_f32_init(&fir, TEST_NR_COEFFS, test_fir_f32_coeff_re, test_fir_f32_coeff_im,
+                TEST_DECIMATION, false, 0, 0));
+    TEST_ASSERT_EQUALS(direct_fir_f32_push_sample_buf(&fir, buf), A_E_INVAL);
+    TEST_ASSERT_OK(direct_fir_f32_cleanup(&fir));
+
+    TEST_ASSERT_OK(polyphase_fir_f32_new_complex(&pfir, TEST_NR_COEFFS, test_fir_f32_coeff_re, 3, 2));
+    TEST_ASSERT_EQUALS(polyphase_fir_f32_push_sample_buf(pfir, buf), A_E_INVAL);
+    TEST_ASSERT_OK(polyphase_fir_f32_delete(&pfir));
+
+    TEST_ASSERT_OK(sample_buf_decref(buf));
+
+    return A_OK;
+}
+
+/**
+ * Run samples through a floating point polyphase FIR, pushing them nr_per_buf at a time.
+ */
+static
+aresult_t _test_fir_f32_polyphase_run(struct polyphase_fir_f32 *pfir, const float *samples, size_t nr_samples,
+        size_t nr_per_buf, size_t width, float *out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0;
+
+    for (size_t offs = 0; offs < nr_samples; offs += nr_per_buf) {
+        struct sample_buf *buf = NULL;
+        size_t nr = BL_MIN2(nr_samples - offs, nr_per_buf),
+               nr_gen = 0;
+        bool full = false;
+
+        TEST_ASSERT_OK(_test_fir_f32_buf_new(&buf, samples + offs * width, nr, nr * width * sizeof(float),
+                    2 == width ? COMPLEX_FLOAT_32 : REAL_FLOAT_32));
+        TEST_ASSERT_OK(polyphase_fir_f32_push_sample_buf(pfir, buf));
+
+        do {
+            TEST_ASSERT_OK(polyphase_fir_f32_process(pfir, out + nr_out * width, 64, &nr_gen));
+            nr_out += nr_gen;
+            TEST_ASSERT_OK(polyphase_fir_f32_full(pfir, &full));
+        } while (true == full && 0 != nr_gen);
+    }
+
+    *pnr_out = nr_out;
+
+    return ret;
+}
+
+/**
+ * The floating point polyphase FIR gives the same output as the Q.15 one, within rounding, for
+ * both real and complex samples.
+ */
+TEST_DECLARE_UNIT(test_polyphase_fir, fir_f32)
+{
+    static int16_t ref_q15[2 * 4 * TEST_NR_SAMPLES];
+    static float out[2 * 4 * TEST_NR_SAMPLES];
+    struct polyphase_fir *pfir_q15 = NULL;
+    struct polyphase_fir_f32 *pfir = NULL;
+
+    for (size_t width = 1; width <= 2; width++) {
+        size_t nr_in = 2 * TEST_NR_SAMPLES / width,
+               nr_ref = 0,
+               nr_out = 0;
+
+        TEST_ASSERT_OK((1 == width ? polyphase_fir_new : polyphase_fir_new_complex)(&pfir_q15, TEST_NR_COEFFS,
+                    test_fir_f32_coeff_re_q15, 3, 2));
+        TEST_ASSERT_OK((1 == width ? polyphase_fir_f32_new : polyphase_fir_f32_new_complex)(&pfir, TEST_NR_COEFFS,
+                    test_fir_f32_coeff_re, 3, 2));
+
+        for (size_t offs = 0; offs < nr_in; offs += 97) {
+            struct sample_buf *buf = NULL;
+            size_t nr = BL_MIN2(nr_in - offs, 97),
+                   nr_gen = 0;
+            bool full = false;
+
+            TEST_ASSERT_OK(_test_fir_f32_buf_new(&buf, test_fir_f32_in_q15 + offs * width, nr,
+                        nr * width * sizeof(int16_t), 2 == width ? COMPLEX_INT_16 : REAL_INT_16));
+            TEST_ASSERT_OK(polyphase_fir_push_sample_buf(pfir_q15, buf));
+
+            do {
+                TEST_ASSERT_OK(polyphase_fir_process(pfir_q15, ref_q15 + nr_ref * width, 64, &nr_gen));
+                nr_ref += nr_gen;
+                TEST_ASSERT_OK(polyphase_fir_full(pfir_q15, &full));
+            } while (true == full && 0 != nr_gen);
+        }
+
+        TEST_ASSERT_OK(_test_fir_f32_polyphase_run(pfir, test_fir_f32_in, nr_in, 97, width, out, &nr_out));
+
+        TEST_ASSERT_OK(polyphase_fir_delete(&pfir_q15));
+        TEST_ASSERT_OK(polyphase_fir_f32_delete(&pfir));
+
+        TEST_ASSERT_EQUALS(nr_out, nr_ref);
+        TEST_ASSERT_EQUALS(nr_out > nr_in, true);
+
+        for (size_t i = 0; i < nr_out * width; i++) {
+            float expected = (float)ref_q15[i] * TEST_LSB;
+
+            if (fabsf(out[i] - expected) > 1.5f * TEST_LSB) {
+                TEST_ERR("Width %zu, mismatch at %zu: got %f, expected %f", width, i, out[i], expected);
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(fir_f32, test_fir_f32_cleanup, test_fir_f32_setup, NULL, NULL);
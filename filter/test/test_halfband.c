@@ -0,0 +1,174 @@
+#include <filter/halfband.h>
+#include <filter/sample_convert.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_SAMPLES             5000
+
+static
+int16_t test_halfband_in[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_halfband_out[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_halfband_ref[2 * TEST_NR_SAMPLES];
+
+static
+uint8_t test_halfband_raw[2 * TEST_NR_SAMPLES];
+
+static
+aresult_t test_halfband_setup(void)
+{
+    for (size_t i = 0; i < 2 * TEST_NR_SAMPLES; i++) {
+        test_halfband_raw[i] = (uint8_t)((i * 37 + (i >> 3)) & 0xff);
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_halfband_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * The vector and scalar conversion paths have to agree, at every alignment and length.
+ */
+TEST_DECLARE_UNIT(test_convert_u8, halfband)
+{
+    for (size_t offs = 0; offs < 4; offs++) {
+        size_t nr = 2 * TEST_NR_SAMPLES - offs - 3;
+
+        TEST_ASSERT_OK(sample_convert_u8_to_q15(test_halfband_out, test_halfband_raw + offs, nr));
+
+        for (size_t i = 0; i < nr; i++) {
+            int16_t expected = (int16_t)(((int)test_halfband_raw[i + offs] - 127) * (1 << SAMPLE_CONVERT_U8_SHIFT));
+            if (test_halfband_out[i] != expected) {
+                TEST_ERR("Mismatch at %zu (offset %zu): got %d, expected %d", i, offs, test_halfband_out[i], expected);
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Splitting the input into arbitrary blocks must give the same output as one big block.
+ */
+TEST_DECLARE_UNIT(test_block_boundaries, halfband)
+{
+    struct halfband_decimator hb;
+    size_t nr_ref = 0,
+           nr_out = 0,
+           offs = 0,
+           blk = 1;
+
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        test_halfband_in[2 * i    ] = (int16_t)(12000.0 * cos(0.05 * i));
+        test_halfband_in[2 * i + 1] = (int16_t)(12000.0 * sin(0.05 * i));
+    }
+
+    TEST_ASSERT_OK(halfband_decimator_init(&hb, 4));
+    TEST_ASSERT_OK(halfband_decimator_process(&hb, test_halfband_in, TEST_NR_SAMPLES, test_halfband_ref, &nr_ref));
+    TEST_ASSERT_OK(halfband_decimator_cleanup(&hb));
+
+    TEST_ASSERT_OK(halfband_decimator_init(&hb, 4));
+    while (offs < TEST_NR_SAMPLES) {
+        size_t nr = 0,
+               nr_blk = TEST_NR_SAMPLES - offs < blk ? TEST_NR_SAMPLES - offs : blk;
+
+        TEST_ASSERT_OK(halfband_decimator_process(&hb, test_halfband_in + 2 * offs, nr_blk,
+                    test_halfband_out + 2 * nr_out, &nr));
+        if (nr > nr_blk / 4 + 1) {
+            TEST_ERR("Got %zu outputs from %zu inputs", nr, nr_blk);
+            return A_E_INVAL;
+        }
+
+        nr_out += nr;
+        offs += nr_blk;
+        blk = blk * 3 + 1;
+    }
+    TEST_ASSERT_OK(halfband_decimator_cleanup(&hb));
+
+    TEST_ASSERT_EQUALS(nr_out, nr_ref);
+    TEST_ASSERT_EQUALS(memcmp(test_halfband_out, test_halfband_ref, nr_out * 2 * sizeof(int16_t)), 0);
+
+    return A_OK;
+}
+
+/**
+ * A tone in the passband goes through at unity gain, a tone in the stopband is crushed.
+ */
+TEST_DECLARE_UNIT(test_response, halfband)
+{
+    struct halfband_decimator hb;
+    const double freqs[2] = { 0.1, 0.35 };
+
+    for (size_t f = 0; f < 2; f++) {
+        size_t nr_out = 0;
+        double power = 0.0;
+
+        for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+            test_halfband_in[2 * i    ] = (int16_t)(16000.0 * cos(2.0 * M_PI * freqs[f] * i));
+            test_halfband_in[2 * i + 1] = (int16_t)(16000.0 * sin(2.0 * M_PI * freqs[f] * i));
+        }
+
+        TEST_ASSERT_OK(halfband_decimator_init(&hb, 2));
+        TEST_ASSERT_OK(halfband_decimator_process(&hb, test_halfband_in, TEST_NR_SAMPLES, test_halfband_out, &nr_out));
+        TEST_ASSERT_OK(halfband_decimator_cleanup(&hb));
+
+        TEST_ASSERT_EQUALS(nr_out, (TEST_NR_SAMPLES - HALFBAND_NR_TAPS) / 2 + 1);
+
+        for (size_t i = 0; i < nr_out; i++) {
+            power += (double)test_halfband_out[2 * i] * test_halfband_out[2 * i] +
+                (double)test_halfband_out[2 * i + 1] * test_halfband_out[2 * i + 1];
+        }
+
+        power = sqrt(power / nr_out);
+
+        TEST_INF("Tone at %f: RMS amplitude %f", freqs[f], power);
+
+        if ((0 == f && fabs(power - 16000.0) > 50.0) || (1 == f && power > 16000.0 / 500.0)) {
+            TEST_ERR("Tone at %f came out with RMS amplitude %f", freqs[f], power);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Fused conversion and decimation gives the same answer as doing the two separately.
+ */
+TEST_DECLARE_UNIT(test_fused_u8, halfband)
+{
+    struct halfband_decimator hb;
+    size_t nr_ref = 0,
+           nr_out = 0;
+
+    TEST_ASSERT_OK(sample_convert_u8_to_q15(test_halfband_in, test_halfband_raw, 2 * TEST_NR_SAMPLES));
+
+    TEST_ASSERT_OK(halfband_decimator_init(&hb, 2));
+    TEST_ASSERT_OK(halfband_decimator_process(&hb, test_halfband_in, TEST_NR_SAMPLES, test_halfband_ref, &nr_ref));
+    TEST_ASSERT_OK(halfband_decimator_cleanup(&hb));
+
+    TEST_ASSERT_OK(halfband_decimator_init(&hb, 2));
+    TEST_ASSERT_OK(halfband_decimator_process_u8(&hb, test_halfband_raw, TEST_NR_SAMPLES, test_halfband_out, &nr_out));
+    TEST_ASSERT_OK(halfband_decimator_cleanup(&hb));
+
+    TEST_ASSERT_EQUALS(nr_out, nr_ref);
+    TEST_ASSERT_EQUALS(memcmp(test_halfband_out, test_halfband_ref, nr_out * 2 * sizeof(int16_t)), 0);
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(halfband, test_halfband_cleanup, test_halfband_setup, NULL, NULL);
+
@@ -0,0 +1,211 @@
+#include <filter/multistage_fir.h>
+#include <filter/sample_buf.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <tsl/safe_alloc.h>
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_SAMPLE_RATE            1000000
+#define TEST_OFFSET                 123000
+#define TEST_NR_SAMPLES             20000
+#define TEST_NR_PROTO               128
+#define TEST_NR_COMP                27
+
+static
+double test_multistage_proto[TEST_NR_PROTO];
+
+static
+int16_t test_multistage_in[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_multistage_out[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_multistage_ref[2 * TEST_NR_SAMPLES];
+
+/**
+ * Hamming windowed sinc, cutting off at 10 kHz, like the lpfTaps we ship
+ */
+static
+aresult_t test_multistage_fir_setup(void)
+{
+    const double cutoff = 10000.0 / TEST_SAMPLE_RATE,
+                 center = (TEST_NR_PROTO - 1) / 2.0;
+    double sum = 0.0;
+
+    for (size_t i = 0; i < TEST_NR_PROTO; i++) {
+        double t = (double)i - center;
+        test_multistage_proto[i] = sin(2.0 * M_PI * cutoff * t) / (M_PI * t) *
+            (0.54 - 0.46 * cos(2.0 * M_PI * i / (TEST_NR_PROTO - 1)));
+        sum += test_multistage_proto[i];
+    }
+
+    for (size_t i = 0; i < TEST_NR_PROTO; i++) {
+        test_multistage_proto[i] /= sum;
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_multistage_fir_cleanup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t _test_multistage_buf_release(struct sample_buf *buf)
+{
+    TFREE(buf);
+    return A_OK;
+}
+
+static
+aresult_t _test_multistage_buf_new(struct sample_buf **pbuf, const int16_t *samples, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    if (FAILED(ret = TCALLOC((void **)&buf, 1, sizeof(struct sample_buf) + nr_samples * 2 * sizeof(int16_t)))) {
+        goto done;
+    }
+
+    memcpy(buf->data_buf, samples, nr_samples * 2 * sizeof(int16_t));
+    buf->nr_samples = nr_samples;
+    buf->sample_buf_bytes = nr_samples * 2 * sizeof(int16_t);
+    buf->sample_type = COMPLEX_INT_16;
+    buf->release = _test_multistage_buf_release;
+    atomic_store(&buf->refcount, 1);
+
+    *pbuf = buf;
+
+done:
+    return ret;
+}
+
+/**
+ * Push the test input in blocks of the given lengths (repeating the last), and collect everything
+ * the filter produces.
+ */
+static
+aresult_t _test_multistage_run(unsigned cic, unsigned hb, unsigned comp, const size_t *blks, size_t nr_blks,
+        int16_t *out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    struct multistage_fir fir;
+    int16_t coeffs[TEST_NR_COMP];
+    size_t offs = 0,
+           nr_out = 0,
+           blk = 0;
+
+    TEST_ASSERT_OK(multistage_fir_design(test_multistage_proto, TEST_NR_PROTO, cic, hb, 1.0, coeffs, TEST_NR_COMP));
+    TEST_ASSERT_OK(multistage_fir_init(&fir, TEST_SAMPLE_RATE, TEST_OFFSET, cic, hb, TEST_NR_COMP, coeffs, comp));
+
+    while (offs < TEST_NR_SAMPLES) {
+        struct sample_buf *buf = NULL;
+        size_t nr = BL_MIN2(TEST_NR_SAMPLES - offs, blks[BL_MIN2(blk, nr_blks - 1)]);
+        bool can_process = false;
+
+        TEST_ASSERT_OK(_test_multistage_buf_new(&buf, test_multistage_in + 2 * offs, nr));
+        TEST_ASSERT_OK(multistage_fir_push_sample_buf(&fir, buf));
+        TEST_ASSERT_OK(multistage_fir_can_process(&fir, &can_process, NULL));
+
+        while (true == can_process) {
+            size_t nr_proc = 0;
+            TEST_ASSERT_OK(multistage_fir_process(&fir, out + 2 * nr_out, 7, &nr_proc));
+            nr_out += nr_proc;
+            TEST_ASSERT_OK(multistage_fir_can_process(&fir, &can_process, NULL));
+        }
+
+        offs += nr;
+        blk++;
+    }
+
+    TEST_ASSERT_OK(multistage_fir_cleanup(&fir));
+
+    *pnr_out = nr_out;
+
+    return ret;
+}
+
+/**
+ * How the input is split into sample buffers must not change the output.
+ */
+TEST_DECLARE_UNIT(test_block_boundaries, multistage_fir)
+{
+    static const size_t whole[1] = { TEST_NR_SAMPLES },
+                        pieces[6] = { 1, 17, 3001, 2048, 4095, 333 };
+    uint32_t state = 1;
+    size_t nr_ref = 0,
+           nr_out = 0;
+
+    for (size_t i = 0; i < 2 * TEST_NR_SAMPLES; i++) {
+        state = state * 1103515245ul + 12345ul;
+        test_multistage_in[i] = (int16_t)(state >> 16);
+    }
+
+    TEST_ASSERT_OK(_test_multistage_run(5, 2, 4, whole, 1, test_multistage_ref, &nr_ref));
+    TEST_ASSERT_OK(_test_multistage_run(5, 2, 4, pieces, 6, test_multistage_out, &nr_out));
+
+    TEST_ASSERT_EQUALS(nr_out, nr_ref);
+    TEST_ASSERT_EQUALS(memcmp(test_multistage_out, test_multistage_ref, nr_out * 2 * sizeof(int16_t)), 0);
+
+    return A_OK;
+}
+
+/**
+ * A tone just off the channel center comes out at baseband with the prototype's gain (0.977 at
+ * 2 kHz), and one well outside the channel is crushed, both with and without the half-band stages.
+ */
+TEST_DECLARE_UNIT(test_response, multistage_fir)
+{
+    static const size_t blks[1] = { 4096 };
+    static const unsigned configs[2][3] = { { 5, 2, 4 }, { 10, 1, 4 } };
+    const double tones[2] = { 2000.0, 60000.0 };
+
+    for (size_t c = 0; c < 2; c++) {
+        for (size_t t = 0; t < 2; t++) {
+            double freq = (TEST_OFFSET + tones[t]) / TEST_SAMPLE_RATE,
+                   power = 0.0;
+            size_t nr_out = 0,
+                   settle = 2 * TEST_NR_COMP;
+
+            for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+                test_multistage_in[2 * i    ] = (int16_t)(10000.0 * cos(2.0 * M_PI * freq * i));
+                test_multistage_in[2 * i + 1] = (int16_t)(10000.0 * sin(2.0 * M_PI * freq * i));
+            }
+
+            TEST_ASSERT_OK(_test_multistage_run(configs[c][0], configs[c][1], configs[c][2], blks, 1,
+                        test_multistage_out, &nr_out));
+
+            TEST_ASSERT_EQUALS(nr_out > settle, true);
+
+            for (size_t i = settle; i < nr_out; i++) {
+                power += (double)test_multistage_out[2 * i] * test_multistage_out[2 * i] +
+                    (double)test_multistage_out[2 * i + 1] * test_multistage_out[2 * i + 1];
+            }
+
+            power = sqrt(power / (nr_out - settle));
+
+            TEST_INF("CIC %u, half-band %u: tone at %f Hz has RMS amplitude %f", configs[c][0], configs[c][1],
+                    tones[t], power);
+
+            if ((0 == t && fabs(power - 9773.0) > 100.0) || (1 == t && power > 100.0)) {
+                TEST_ERR("Tone at %f Hz came out with RMS amplitude %f", tones[t], power);
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(multistage_fir, test_multistage_fir_cleanup, test_multistage_fir_setup, NULL, NULL);
@@ -0,0 +1,174 @@
+#include <filter/pcm_ring.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define TEST_RING_SAMPLES           1024
+
+static
+char test_pcm_ring_path[64];
+
+static
+aresult_t test_pcm_ring_setup(void)
+{
+    snprintf(test_pcm_ring_path, sizeof(test_pcm_ring_path), "/tmp/test_pcm_ring.%d", (int)getpid());
+    return A_OK;
+}
+
+static
+aresult_t test_pcm_ring_cleanup(void)
+{
+    unlink(test_pcm_ring_path);
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_smoke, pcm_ring)
+{
+    struct pcm_ring *producer = NULL,
+                    *consumer = NULL;
+    int16_t buf[16];
+    size_t nr = 0;
+
+    TEST_ASSERT_OK(pcm_ring_create(&producer, test_pcm_ring_path, TEST_RING_SAMPLES));
+    TEST_ASSERT_OK(pcm_ring_attach(&consumer, test_pcm_ring_path));
+
+    /* Nothing to read, and we shouldn't block */
+    TEST_ASSERT_OK(pcm_ring_read(consumer, buf, 16, &nr, 0));
+    TEST_ASSERT_EQUALS(nr, 0);
+
+    /* Make sure the timeout is honoured */
+    TEST_ASSERT_OK(pcm_ring_read(consumer, buf, 16, &nr, 10));
+    TEST_ASSERT_EQUALS(nr, 0);
+
+    TEST_ASSERT_OK(pcm_ring_delete(&consumer));
+    TEST_ASSERT_OK(pcm_ring_delete(&producer));
+
+    return A_OK;
+}
+
+/**
+ * Push enough samples through, in odd-sized chunks, to wrap around the ring several times.
+ */
+TEST_DECLARE_UNIT(test_wrap, pcm_ring)
+{
+    struct pcm_ring *producer = NULL,
+                    *consumer = NULL;
+    int16_t in[333],
+            out[512];
+    int16_t next_in = 0,
+            next_out = 0;
+
+    TEST_ASSERT_OK(pcm_ring_create(&producer, test_pcm_ring_path, TEST_RING_SAMPLES));
+    TEST_ASSERT_OK(pcm_ring_attach(&consumer, test_pcm_ring_path));
+
+    for (size_t iter = 0; iter < 32; iter++) {
+        size_t nr_written = 0,
+               nr_read = 0;
+
+        for (size_t i = 0; i < 333; i++) {
+            in[i] = next_in++;
+        }
+
+        TEST_ASSERT_OK(pcm_ring_write(producer, in, 333, &nr_written));
+        TEST_ASSERT_EQUALS(nr_written, 333);
+
+        do {
+            TEST_ASSERT_OK(pcm_ring_read(consumer, out, 200, &nr_read, 0));
+
+            for (size_t i = 0; i < nr_read; i++) {
+                if (out[i] != next_out) {
+                    TEST_ERR("Sample mismatch: got %d, expected %d", out[i], next_out);
+                    return A_E_INVAL;
+                }
+                next_out++;
+            }
+        } while (0 != nr_read);
+    }
+
+    TEST_ASSERT_EQUALS(next_in, next_out);
+    TEST_ASSERT_EQUALS(atomic_load(&producer->shared->nr_dropped), 0);
+
+    TEST_ASSERT_OK(pcm_ring_delete(&consumer));
+    TEST_ASSERT_OK(pcm_ring_delete(&producer));
+
+    return A_OK;
+}
+
+/**
+ * A producer with a slow (or absent) consumer drops samples rather than blocking.
+ */
+TEST_DECLARE_UNIT(test_overflow, pcm_ring)
+{
+    struct pcm_ring *producer = NULL,
+                    *consumer = NULL;
+    int16_t in[TEST_RING_SAMPLES] = { 0 };
+    size_t nr_written = 0;
+
+    TEST_ASSERT_OK(pcm_ring_create(&producer, test_pcm_ring_path, TEST_RING_SAMPLES));
+    TEST_ASSERT_OK(pcm_ring_attach(&consumer, test_pcm_ring_path));
+
+    TEST_ASSERT_OK(pcm_ring_write(producer, in, 1000, &nr_written));
+    TEST_ASSERT_EQUALS(nr_written, 1000);
+
+    TEST_ASSERT_OK(pcm_ring_write(producer, in, 1000, &nr_written));
+    TEST_ASSERT_EQUALS(nr_written, TEST_RING_SAMPLES - 1000);
+    TEST_ASSERT_EQUALS(atomic_load(&producer->shared->nr_dropped), 2000 - TEST_RING_SAMPLES);
+
+    TEST_ASSERT_OK(pcm_ring_delete(&consumer));
+
+    /* A new consumer skips everything that was already in the ring */
+    TEST_ASSERT_OK(pcm_ring_attach(&consumer, test_pcm_ring_path));
+    TEST_ASSERT_OK(pcm_ring_write(producer, in, 1000, &nr_written));
+    TEST_ASSERT_EQUALS(nr_written, 1000);
+
+    TEST_ASSERT_OK(pcm_ring_delete(&consumer));
+    TEST_ASSERT_OK(pcm_ring_delete(&producer));
+
+    return A_OK;
+}
+
+/**
+ * The consumer can work out the capture time of what it reads from the producer's stamps.
+ */
+TEST_DECLARE_UNIT(test_stamp, pcm_ring)
+{
+    struct pcm_ring *producer = NULL,
+                    *consumer = NULL;
+    int16_t in[400] = { 0 },
+            out[400];
+    size_t nr_written = 0,
+           nr_read = 0;
+    uint64_t time_ns = 0;
+
+    TEST_ASSERT_OK(pcm_ring_create(&producer, test_pcm_ring_path, TEST_RING_SAMPLES));
+    TEST_ASSERT_OK(pcm_ring_attach(&consumer, test_pcm_ring_path));
+
+    TEST_ASSERT_EQUALS(pcm_ring_read_time(consumer, 16000, &time_ns), A_E_NOTFOUND);
+
+    /* At 16 kHz, each sample is 62.5 microseconds */
+    TEST_ASSERT_OK(pcm_ring_stamp(producer, 1000000000ull));
+    TEST_ASSERT_OK(pcm_ring_write(producer, in, 400, &nr_written));
+    TEST_ASSERT_EQUALS(nr_written, 400);
+
+    TEST_ASSERT_OK(pcm_ring_read(consumer, out, 161, &nr_read, 0));
+    TEST_ASSERT_EQUALS(nr_read, 161);
+    TEST_ASSERT_OK(pcm_ring_read_time(consumer, 16000, &time_ns));
+    TEST_ASSERT_EQUALS(time_ns, 1000000000ull + 10000000ull);
+
+    /* A stamp ahead of what we've read is extrapolated backwards */
+    TEST_ASSERT_OK(pcm_ring_stamp(producer, 2000000000ull));
+    TEST_ASSERT_OK(pcm_ring_read_time(consumer, 16000, &time_ns));
+    TEST_ASSERT_EQUALS(time_ns, 2000000000ull - 240ull * 62500ull);
+
+    TEST_ASSERT_OK(pcm_ring_delete(&consumer));
+    TEST_ASSERT_OK(pcm_ring_delete(&producer));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(pcm_ring, test_pcm_ring_cleanup, test_pcm_ring_setup, NULL, NULL);
+
@@ -0,0 +1,220 @@
+#include <filter/pcm_udp.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static
+char test_pcm_udp_addr[64];
+
+static
+aresult_t test_pcm_udp_setup(void)
+{
+    snprintf(test_pcm_udp_addr, sizeof(test_pcm_udp_addr), "127.0.0.1:%d", 20000 + (int)(getpid() % 20000));
+    return A_OK;
+}
+
+static
+aresult_t test_pcm_udp_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_smoke, pcm_udp)
+{
+    struct pcm_udp_receiver *rcv = NULL;
+    int16_t buf[16];
+    size_t nr = 0;
+
+    TEST_ASSERT_OK(pcm_udp_receiver_new(&rcv, test_pcm_udp_addr, 0, PCM_UDP_FORMAT_S16));
+    TEST_ASSERT_EQUALS(0 <= pcm_udp_receiver_fd(rcv), true);
+
+    /* Nothing to read, and we shouldn't block */
+    TEST_ASSERT_OK(pcm_udp_receiver_read(rcv, buf, 16, &nr, 0));
+    TEST_ASSERT_EQUALS(nr, 0);
+
+    /* Make sure the timeout is honoured */
+    TEST_ASSERT_OK(pcm_udp_receiver_read(rcv, buf, 16, &nr, 10));
+    TEST_ASSERT_EQUALS(nr, 0);
+
+    TEST_ASSERT_OK(pcm_udp_receiver_delete(&rcv));
+
+    /* A port is required */
+    TEST_ASSERT_EQUALS(pcm_udp_receiver_new(&rcv, "127.0.0.1", 0, PCM_UDP_FORMAT_S16), A_E_INVAL);
+
+    /* So is a channel ID, for a multicast group */
+    TEST_ASSERT_EQUALS(pcm_udp_receiver_new(&rcv, "239.255.0.1:5000", 0, PCM_UDP_FORMAT_S16), A_E_INVAL);
+
+    return A_OK;
+}
+
+/**
+ * Push samples through in odd-sized writes, so they're split across datagrams, and read them
+ * back in chunks that don't line up with the datagrams either.
+ */
+TEST_DECLARE_UNIT(test_loopback, pcm_udp)
+{
+    struct pcm_udp_sender *snd = NULL;
+    struct pcm_udp_receiver *rcv = NULL;
+    int16_t in[1500],
+            out[500];
+    int16_t next_in = 0,
+            next_out = 0;
+
+    TEST_ASSERT_OK(pcm_udp_receiver_new(&rcv, test_pcm_udp_addr, 0, PCM_UDP_FORMAT_S16));
+    TEST_ASSERT_OK(pcm_udp_sender_new(&snd, test_pcm_udp_addr, 1234, 16000, PCM_UDP_FORMAT_S16, 0));
+
+    for (size_t iter = 0; iter < 16; iter++) {
+        size_t nr_dropped = 0,
+               nr_read = 0;
+
+        for (size_t i = 0; i < 1500; i++) {
+            in[i] = next_in++;
+        }
+
+        TEST_ASSERT_OK(pcm_udp_sender_write(snd, in, 1500, 0, &nr_dropped));
+        TEST_ASSERT_EQUALS(nr_dropped, 0);
+        TEST_ASSERT_OK(pcm_udp_sender_flush(snd, &nr_dropped));
+        TEST_ASSERT_EQUALS(nr_dropped, 0);
+
+        do {
+            TEST_ASSERT_OK(pcm_udp_receiver_read(rcv, out, 317, &nr_read, 100));
+
+            for (size_t i = 0; i < nr_read; i++) {
+                if (out[i] != next_out) {
+                    TEST_ERR("Sample mismatch: got %d, expected %d", out[i], next_out);
+                    return A_E_INVAL;
+                }
+                next_out++;
+            }
+        } while (next_out != next_in && 0 != nr_read);
+    }
+
+    TEST_ASSERT_EQUALS(next_in, next_out);
+    TEST_ASSERT_EQUALS(pcm_udp_receiver_nr_lost(rcv), 0);
+
+    TEST_ASSERT_OK(pcm_udp_sender_delete(&snd));
+    TEST_ASSERT_OK(pcm_udp_receiver_delete(&rcv));
+
+    return A_OK;
+}
+
+/**
+ * Two channels sharing a destination are told apart by their channel ID.
+ */
+TEST_DECLARE_UNIT(test_channel_filter, pcm_udp)
+{
+    struct pcm_udp_sender *snd_a = NULL,
+                          *snd_b = NULL;
+    struct pcm_udp_receiver *rcv = NULL;
+    int16_t in_a[100],
+            in_b[100],
+            out[400];
+    size_t nr_dropped = 0,
+           nr_read = 0,
+           nr_total = 0;
+
+    for (size_t i = 0; i < 100; i++) {
+        in_a[i] = 1;
+        in_b[i] = 2;
+    }
+
+    TEST_ASSERT_OK(pcm_udp_receiver_new(&rcv, test_pcm_udp_addr, 2, PCM_UDP_FORMAT_S16));
+    TEST_ASSERT_OK(pcm_udp_sender_new(&snd_a, test_pcm_udp_addr, 1, 16000, PCM_UDP_FORMAT_S16, 0));
+    TEST_ASSERT_OK(pcm_udp_sender_new(&snd_b, test_pcm_udp_addr, 2, 16000, PCM_UDP_FORMAT_S16, 0));
+
+    TEST_ASSERT_OK(pcm_udp_sender_write(snd_a, in_a, 100, 0, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_sender_write(snd_b, in_b, 100, 0, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_sender_write(snd_a, in_a, 100, 0, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_sender_flush(snd_a, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_sender_flush(snd_b, &nr_dropped));
+
+    do {
+        TEST_ASSERT_OK(pcm_udp_receiver_read(rcv, out + nr_total, 400 - nr_total, &nr_read, 100));
+        nr_total += nr_read;
+    } while (0 != nr_read);
+
+    TEST_ASSERT_EQUALS(nr_total, 100);
+
+    for (size_t i = 0; i < nr_total; i++) {
+        TEST_ASSERT_EQUALS(out[i], 2);
+    }
+
+    TEST_ASSERT_OK(pcm_udp_sender_delete(&snd_a));
+    TEST_ASSERT_OK(pcm_udp_sender_delete(&snd_b));
+    TEST_ASSERT_OK(pcm_udp_receiver_delete(&rcv));
+
+    return A_OK;
+}
+
+/**
+ * Complex samples take twice the room, but must still fit a datagram in an Ethernet MTU, and
+ * must come back as I/Q pairs. A receiver for real samples must not take them.
+ */
+TEST_DECLARE_UNIT(test_complex, pcm_udp)
+{
+    struct pcm_udp_sender *snd = NULL;
+    struct pcm_udp_receiver *rcv = NULL,
+                            *rcv_real = NULL;
+    int16_t in[2 * 1000],
+            out[2 * 1000];
+    size_t nr_dropped = 0,
+           nr_read = 0,
+           nr_total = 0;
+
+    for (size_t i = 0; i < 1000; i++) {
+        in[2 * i] = i;
+        in[2 * i + 1] = -(int16_t)i;
+    }
+
+    TEST_ASSERT_OK(pcm_udp_receiver_new(&rcv, test_pcm_udp_addr, 0, PCM_UDP_FORMAT_CS16));
+    TEST_ASSERT_OK(pcm_udp_sender_new(&snd, test_pcm_udp_addr, 1234, 16000, PCM_UDP_FORMAT_CS16, 0));
+
+    /* Check the datagrams themselves first, taking them off the socket behind the receiver's back */
+    TEST_ASSERT_OK(pcm_udp_sender_write(snd, in, 1000, 0, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_sender_flush(snd, &nr_dropped));
+    TEST_ASSERT_EQUALS(nr_dropped, 0);
+
+    for (size_t i = 0; i < (1000 + PCM_UDP_MAX_VALUES / 2 - 1) / (PCM_UDP_MAX_VALUES / 2); i++) {
+        uint8_t pkt[4096];
+        ssize_t len = recv(pcm_udp_receiver_fd(rcv), pkt, sizeof(pkt), 0);
+
+        TEST_ASSERT_EQUALS(0 < len && len <= 1500 - 8 - 40, true);
+    }
+
+    TEST_ASSERT_OK(pcm_udp_sender_write(snd, in, 1000, 0, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_sender_flush(snd, &nr_dropped));
+    TEST_ASSERT_EQUALS(nr_dropped, 0);
+
+    do {
+        TEST_ASSERT_OK(pcm_udp_receiver_read(rcv, out + 2 * nr_total, 1000 - nr_total, &nr_read, 100));
+        nr_total += nr_read;
+    } while (0 != nr_read && 1000 != nr_total);
+
+    TEST_ASSERT_EQUALS(nr_total, 1000);
+
+    for (size_t i = 0; i < 2 * 1000; i++) {
+        TEST_ASSERT_EQUALS(out[i], in[i]);
+    }
+
+    TEST_ASSERT_OK(pcm_udp_receiver_delete(&rcv));
+
+    /* Real samples only, so complex datagrams are turned away */
+    TEST_ASSERT_OK(pcm_udp_receiver_new(&rcv_real, test_pcm_udp_addr, 0, PCM_UDP_FORMAT_S16));
+    TEST_ASSERT_OK(pcm_udp_sender_write(snd, in, 1000, 0, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_sender_flush(snd, &nr_dropped));
+    TEST_ASSERT_OK(pcm_udp_receiver_read(rcv_real, out, 1000, &nr_read, 100));
+    TEST_ASSERT_EQUALS(nr_read, 0);
+
+    TEST_ASSERT_OK(pcm_udp_sender_delete(&snd));
+    TEST_ASSERT_OK(pcm_udp_receiver_delete(&rcv_real));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(pcm_udp, test_pcm_udp_cleanup, test_pcm_udp_setup, NULL, NULL);
+
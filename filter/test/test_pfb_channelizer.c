@@ -0,0 +1,189 @@
+#include <filter/pfb_channelizer.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <tsl/safe_alloc.h>
+
+#include <math.h>
+
+#define TEST_NR_CHANNELS            8
+#define TEST_TAPS_PER_BRANCH        12
+#define TEST_SAMPLE_RATE            800000
+#define TEST_TONE_CHANNEL           3
+#define TEST_TONE_OFFSET_HZ         12000
+#define TEST_TONE_AMPLITUDE         8000.0
+#define TEST_NR_SAMPLES             (64 * 1024)
+#define TEST_BLOCK_SAMPLES          1000
+
+static
+aresult_t test_pfb_channelizer_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_pfb_channelizer_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * Calculate the mean power of the latter half of a buffer of complex samples
+ */
+static
+double _test_pfb_power(const int16_t *samples, size_t nr_samples)
+{
+    double power = 0.0;
+
+    for (size_t i = nr_samples / 2; i < nr_samples; i++) {
+        double re = samples[2 * i],
+               im = samples[2 * i + 1];
+        power += re * re + im * im;
+    }
+
+    return power / (double)(nr_samples - nr_samples / 2);
+}
+
+/**
+ * Estimate the frequency of a complex tone over the latter half of a buffer, in Hz
+ */
+static
+double _test_pfb_freq(const int16_t *samples, size_t nr_samples, double sample_rate)
+{
+    double acc_re = 0.0,
+           acc_im = 0.0;
+
+    for (size_t i = nr_samples / 2 + 1; i < nr_samples; i++) {
+        double a_re = samples[2 * i],
+               a_im = samples[2 * i + 1],
+               b_re = samples[2 * (i - 1)],
+               b_im = -samples[2 * (i - 1) + 1];
+        acc_re += a_re * b_re - a_im * b_im;
+        acc_im += a_re * b_im + a_im * b_re;
+    }
+
+    return atan2(acc_im, acc_re) * sample_rate / (2.0 * M_PI);
+}
+
+TEST_DECLARE_UNIT(test_smoke, pfb_channelizer)
+{
+    struct pfb_channelizer *pfb = NULL;
+    double taps[TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH];
+
+    TEST_ASSERT_OK(pfb_channelizer_design_prototype(taps, TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH, TEST_NR_CHANNELS));
+    TEST_ASSERT_OK(pfb_channelizer_new(&pfb, TEST_NR_CHANNELS, taps, TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH));
+    TEST_ASSERT_EQUALS(pfb_channelizer_hop(pfb), TEST_NR_CHANNELS/2);
+    TEST_ASSERT_OK(pfb_channelizer_delete(&pfb));
+
+    /* Non power-of-2 channel counts are not supported */
+    TEST_ASSERT_EQUALS(A_E_INVAL, pfb_channelizer_new(&pfb, 10, taps, TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH));
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_channel_for_offset, pfb_channelizer)
+{
+    struct pfb_channelizer *pfb = NULL;
+    double taps[TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH];
+    unsigned channel = 0;
+    int32_t residual = 0;
+
+    TEST_ASSERT_OK(pfb_channelizer_design_prototype(taps, TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH, TEST_NR_CHANNELS));
+    TEST_ASSERT_OK(pfb_channelizer_new(&pfb, TEST_NR_CHANNELS, taps, TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH));
+
+    /* 100 kHz spacing, so 312 kHz is 12 kHz above channel 3 */
+    TEST_ASSERT_OK(pfb_channelizer_channel_for_offset(pfb, TEST_SAMPLE_RATE, 312000, &channel, &residual));
+    TEST_ASSERT_EQUALS(channel, 3);
+    TEST_ASSERT_EQUALS(residual, 12000);
+
+    /* Negative offsets wrap to the upper channels */
+    TEST_ASSERT_OK(pfb_channelizer_channel_for_offset(pfb, TEST_SAMPLE_RATE, -140000, &channel, &residual));
+    TEST_ASSERT_EQUALS(channel, 7);
+    TEST_ASSERT_EQUALS(residual, -40000);
+
+    /* Out of band */
+    TEST_ASSERT_EQUALS(A_E_INVAL, pfb_channelizer_channel_for_offset(pfb, TEST_SAMPLE_RATE, 400000, &channel, &residual));
+
+    TEST_ASSERT_OK(pfb_channelizer_delete(&pfb));
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_tone_isolation, pfb_channelizer)
+{
+    struct pfb_channelizer *pfb = NULL;
+    double taps[TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH];
+    int16_t *input = NULL,
+            *outputs[TEST_NR_CHANNELS];
+    size_t nr_out_total = 0,
+           max_out = 0;
+    double f_tone = (double)(TEST_TONE_CHANNEL * TEST_SAMPLE_RATE / TEST_NR_CHANNELS + TEST_TONE_OFFSET_HZ) /
+                        (double)TEST_SAMPLE_RATE,
+           tone_power = 0.0;
+
+    TEST_ASSERT_OK(pfb_channelizer_design_prototype(taps, TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH, TEST_NR_CHANNELS));
+    TEST_ASSERT_OK(pfb_channelizer_new(&pfb, TEST_NR_CHANNELS, taps, TEST_NR_CHANNELS * TEST_TAPS_PER_BRANCH));
+
+    max_out = pfb_channelizer_max_outputs(pfb, TEST_NR_SAMPLES);
+
+    TEST_ASSERT_OK(TACALLOC((void **)&input, TEST_NR_SAMPLES, 2 * sizeof(int16_t), 16));
+    for (size_t i = 0; i < TEST_NR_CHANNELS; i++) {
+        TEST_ASSERT_OK(TACALLOC((void **)&outputs[i], max_out, 2 * sizeof(int16_t), 16));
+    }
+
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        input[2 * i    ] = (int16_t)(TEST_TONE_AMPLITUDE * cos(2.0 * M_PI * f_tone * (double)i));
+        input[2 * i + 1] = (int16_t)(TEST_TONE_AMPLITUDE * sin(2.0 * M_PI * f_tone * (double)i));
+    }
+
+    /* Feed the channelizer in odd-sized blocks, to make sure history is carried across calls */
+    for (size_t offs = 0; offs < TEST_NR_SAMPLES; offs += TEST_BLOCK_SAMPLES) {
+        size_t nr_in = TEST_NR_SAMPLES - offs > TEST_BLOCK_SAMPLES ? TEST_BLOCK_SAMPLES : TEST_NR_SAMPLES - offs,
+               nr_out = 0;
+        int16_t *block_out[TEST_NR_CHANNELS];
+
+        for (size_t i = 0; i < TEST_NR_CHANNELS; i++) {
+            block_out[i] = outputs[i] + 2 * nr_out_total;
+        }
+
+        TEST_ASSERT_OK(pfb_channelizer_process(pfb, input + 2 * offs, nr_in, block_out, max_out - nr_out_total, &nr_out));
+        nr_out_total += nr_out;
+    }
+
+    TEST_ASSERT_EQUALS(nr_out_total, TEST_NR_SAMPLES / (TEST_NR_CHANNELS / 2));
+
+    /* The tone should land in its channel with roughly unity gain... */
+    tone_power = _test_pfb_power(outputs[TEST_TONE_CHANNEL], nr_out_total);
+    TEST_INF("Tone channel power: %f (expected %f)", tone_power, TEST_TONE_AMPLITUDE * TEST_TONE_AMPLITUDE);
+    TEST_ASSERT_EQUALS(true, tone_power > 0.8 * TEST_TONE_AMPLITUDE * TEST_TONE_AMPLITUDE);
+    TEST_ASSERT_EQUALS(true, tone_power < 1.2 * TEST_TONE_AMPLITUDE * TEST_TONE_AMPLITUDE);
+
+    /* The tone must come out of its channel at its residual offset, so the phase has to be continuous */
+    TEST_ASSERT_EQUALS(true, fabs(_test_pfb_freq(outputs[TEST_TONE_CHANNEL], nr_out_total,
+                    2.0 * TEST_SAMPLE_RATE / TEST_NR_CHANNELS) - TEST_TONE_OFFSET_HZ) < 100.0);
+
+    /* ...and be at least 40dB down in channels that aren't adjacent to it */
+    for (size_t i = 0; i < TEST_NR_CHANNELS; i++) {
+        double power = 0.0;
+
+        if (i + 1 >= TEST_TONE_CHANNEL && i <= TEST_TONE_CHANNEL + 1) {
+            continue;
+        }
+
+        power = _test_pfb_power(outputs[i], nr_out_total);
+        TEST_INF("Channel %zu power: %f", i, power);
+        TEST_ASSERT_EQUALS(true, power * 1e4 < tone_power);
+    }
+
+    for (size_t i = 0; i < TEST_NR_CHANNELS; i++) {
+        TFREE(outputs[i]);
+    }
+    TFREE(input);
+
+    TEST_ASSERT_OK(pfb_channelizer_delete(&pfb));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(pfb_channelizer, test_pfb_channelizer_cleanup, test_pfb_channelizer_setup, NULL, NULL);
@@ -1,8 +1,20 @@
 #include <filter/filter.h>
+#include <filter/sample_buf.h>
+#include <filter/utils.h>
+#include <filter/complex.h>
+#include <filter/polyphase_fir.h>
+#include <filter/polyphase_fir_priv.h>
 
 #include <test/assert.h>
 #include <test/framework.h>
 
+#include <tsl/safe_alloc.h>
+
+#include <math.h>
+
+#define TEST_DOT_NR_SAMPLES         96
+#define TEST_DOT_MAX_COEFFS         68
+
 static const
 int16_t test_polyphase_fir_coeffs[] = {
     255, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
@@ -32,5 +44,376 @@ TEST_DECLARE_UNIT(test_smoke, polyphase)
     return A_OK;
 }
 
+static
+aresult_t _test_polyphase_buf_release(struct sample_buf *buf)
+{
+    TFREE(buf);
+    return A_OK;
+}
+
+/**
+ * The vectorized dot product has to agree with the obvious scalar one, for every length, and
+ * wherever the window straddles the two sample buffers. Samples and coefficients are kept small
+ * enough that the sums can't overflow.
+ */
+TEST_DECLARE_UNIT(test_dot_product, polyphase)
+{
+    struct sample_buf *bufs[2] = { NULL, NULL };
+    int16_t coeffs[TEST_DOT_MAX_COEFFS];
+    uint32_t state = 7;
+
+    for (size_t b = 0; b < 2; b++) {
+        TEST_ASSERT_OK(TCALLOC((void **)&bufs[b], 1, sizeof(struct sample_buf) + TEST_DOT_NR_SAMPLES * sizeof(int16_t)));
+        bufs[b]->nr_samples = TEST_DOT_NR_SAMPLES;
+        bufs[b]->sample_type = REAL_UINT_16;
+        bufs[b]->release = _test_polyphase_buf_release;
+
+        for (size_t i = 0; i < TEST_DOT_NR_SAMPLES; i++) {
+            state = state * 1103515245ul + 12345ul;
+            ((int16_t *)bufs[b]->data_buf)[i] = (int16_t)(state >> 16) / 8;
+        }
+    }
+
+    for (size_t i = 0; i < TEST_DOT_MAX_COEFFS; i++) {
+        state = state * 1103515245ul + 12345ul;
+        coeffs[i] = (int16_t)(state >> 16) / 8;
+    }
+
+    for (size_t nr_coeffs = 1; nr_coeffs <= TEST_DOT_MAX_COEFFS; nr_coeffs++) {
+        for (size_t offs = 0; offs < TEST_DOT_NR_SAMPLES; offs++) {
+            int32_t acc = 0;
+            int16_t sample = 0;
+
+            for (size_t i = 0; i < nr_coeffs; i++) {
+                size_t pos = offs + i;
+                int16_t s = pos < TEST_DOT_NR_SAMPLES ? ((int16_t *)bufs[0]->data_buf)[pos] :
+                    ((int16_t *)bufs[1]->data_buf)[pos - TEST_DOT_NR_SAMPLES];
+                acc += (int32_t)s * coeffs[i];
+            }
+
+            TEST_ASSERT_OK(dot_product_sample_buffers_real(bufs[0], bufs[1], offs, coeffs, nr_coeffs, &sample));
+
+            if (sample != round_q30_q15(acc)) {
+                TEST_ERR("Mismatch for %zu coefficients at offset %zu: got %d, expected %d", nr_coeffs, offs,
+                        sample, round_q30_q15(acc));
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    TFREE(bufs[0]);
+    TFREE(bufs[1]);
+
+    return A_OK;
+}
+
+/**
+ * The dot products unrolled for the phase lengths we ship agree with the scalar dot product,
+ * and any other length gets the general dot product.
+ */
+TEST_DECLARE_UNIT(test_dot_product_find, polyphase)
+{
+    static const size_t lengths[3] = { 36, 52, 37 };
+    int16_t samples[2 * TEST_DOT_MAX_COEFFS],
+            coeffs[TEST_DOT_MAX_COEFFS];
+    uint32_t state = 5;
+
+    for (size_t i = 0; i < 2 * TEST_DOT_MAX_COEFFS; i++) {
+        state = state * 1103515245ul + 12345ul;
+        samples[i] = (int16_t)(state >> 16) / 8;
+    }
+
+    for (size_t i = 0; i < TEST_DOT_MAX_COEFFS; i++) {
+        state = state * 1103515245ul + 12345ul;
+        coeffs[i] = (int16_t)(state >> 16) / 8;
+    }
+
+    for (size_t l = 0; l < 3; l++) {
+        dot_product_func_t real = NULL,
+                           cplx = NULL;
+        int32_t acc_r = 0,
+                acc_i = 0,
+                acc_q = 0;
+        int16_t out_r = 0,
+                out_iq[2] = { 0, 0 };
+
+        TEST_ASSERT_OK(dot_product_find(lengths[l], false, false, &real));
+        TEST_ASSERT_OK(dot_product_find(lengths[l], true, false, &cplx));
+        TEST_ASSERT_EQUALS(real == dot_product_real, 37 == lengths[l]);
+        TEST_ASSERT_EQUALS(cplx == dot_product_complex, 37 == lengths[l]);
+
+        for (size_t i = 0; i < lengths[l]; i++) {
+            acc_r += (int32_t)samples[i] * coeffs[i];
+            acc_i += (int32_t)samples[2 * i] * coeffs[i];
+            acc_q += (int32_t)samples[2 * i + 1] * coeffs[i];
+        }
+
+        TEST_ASSERT_OK(real(samples, coeffs, lengths[l], &out_r));
+        TEST_ASSERT_OK(cplx(samples, coeffs, lengths[l], out_iq));
+
+        TEST_ASSERT_EQUALS(out_r, round_q30_q15(acc_r));
+        TEST_ASSERT_EQUALS(out_iq[0], round_q30_q15(acc_i));
+        TEST_ASSERT_EQUALS(out_iq[1], round_q30_q15(acc_q));
+    }
+
+    return A_OK;
+}
+
+/**
+ * The folded dot products agree with the scalar dot product for symmetric coefficients, whether
+ * or not there is a center tap, and whether or not the vector loops can be used at all.
+ */
+TEST_DECLARE_UNIT(test_dot_product_folded, polyphase)
+{
+    static const size_t lengths[6] = { 2, 3, 9, 36, 37, 67 };
+    int16_t samples[2 * TEST_DOT_MAX_COEFFS],
+            coeffs[TEST_DOT_MAX_COEFFS];
+    uint32_t state = 9;
+
+    for (size_t i = 0; i < 2 * TEST_DOT_MAX_COEFFS; i++) {
+        state = state * 1103515245ul + 12345ul;
+        samples[i] = (int16_t)(state >> 16) / 8;
+    }
+
+    /* Include the most negative sample, to make sure the mirrored sums are widened */
+    samples[0] = samples[1] = INT16_MIN;
+
+    for (size_t l = 0; l < 6; l++) {
+        const size_t nr = lengths[l];
+        int32_t acc_r = 0,
+                acc_i = 0,
+                acc_q = 0;
+        int16_t out_r = 0,
+                out_iq[2] = { 0, 0 };
+
+        for (size_t i = 0; i < (nr + 1) / 2; i++) {
+            state = state * 1103515245ul + 12345ul;
+            coeffs[i] = coeffs[nr - 1 - i] = (int16_t)(state >> 16) / 8;
+        }
+
+        for (size_t i = 0; i < nr; i++) {
+            acc_r += (int32_t)samples[i] * coeffs[i];
+            acc_i += (int32_t)samples[2 * i] * coeffs[i];
+            acc_q += (int32_t)samples[2 * i + 1] * coeffs[i];
+        }
+
+        TEST_ASSERT_OK(dot_product_real_folded(samples, coeffs, nr, &out_r));
+        TEST_ASSERT_OK(dot_product_complex_folded(samples, coeffs, nr, out_iq));
+
+        TEST_ASSERT_EQUALS(out_r, round_q30_q15(acc_r));
+        TEST_ASSERT_EQUALS(out_iq[0], round_q30_q15(acc_i));
+        TEST_ASSERT_EQUALS(out_iq[1], round_q30_q15(acc_q));
+    }
+
+    return A_OK;
+}
+
+/**
+ * Build a sample buffer holding nr_samples samples, taken from every stride'th entry of samples
+ */
+static
+aresult_t _test_polyphase_buf_new(struct sample_buf **pbuf, const int16_t *samples, size_t nr_samples,
+        size_t nr_values, size_t stride)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    if (FAILED(ret = TCALLOC((void **)&buf, 1, sizeof(struct sample_buf) + nr_values * sizeof(int16_t)))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_values; i++) {
+        ((int16_t *)buf->data_buf)[i] = samples[i * stride];
+    }
+
+    buf->nr_samples = nr_samples;
+    buf->sample_buf_bytes = nr_values * sizeof(int16_t);
+    buf->release = _test_polyphase_buf_release;
+    buf->refcount = 1;
+
+    *pbuf = buf;
+
+done:
+    return ret;
+}
+
+/**
+ * Run samples through a polyphase FIR, pushing them nr_per_buf at a time, and collect the output.
+ */
+static
+aresult_t _test_polyphase_run(struct polyphase_fir *pfir, const int16_t *samples, size_t nr_samples,
+        size_t nr_per_buf, size_t values_per_sample, size_t stride, int16_t *out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0;
+
+    for (size_t offs = 0; offs < nr_samples; offs += nr_per_buf) {
+        struct sample_buf *buf = NULL;
+        size_t nr = BL_MIN2(nr_samples - offs, nr_per_buf),
+               nr_gen = 0;
+        bool full = false;
+
+        TEST_ASSERT_OK(_test_polyphase_buf_new(&buf, samples + offs * values_per_sample * stride, nr,
+                    nr * values_per_sample, stride));
+        TEST_ASSERT_OK(polyphase_fir_push_sample_buf(pfir, buf));
+
+        /* Drain until the FIR can take the next buffer */
+        do {
+            TEST_ASSERT_OK(polyphase_fir_process(pfir, out + nr_out * values_per_sample, 64, &nr_gen));
+            nr_out += nr_gen;
+            TEST_ASSERT_OK(polyphase_fir_full(pfir, &full));
+        } while (true == full && 0 != nr_gen);
+    }
+
+    *pnr_out = nr_out;
+
+    return ret;
+}
+
+/**
+ * Filtering complex samples has to give the same I and Q as filtering each separately.
+ */
+TEST_DECLARE_UNIT(test_complex, polyphase)
+{
+    static int16_t iq[2 * 1000],
+                   out_iq[2 * 4000],
+                   out_i[4000],
+                   out_q[4000];
+    struct polyphase_fir *pfir = NULL;
+    const size_t nr_coeffs = sizeof(test_polyphase_fir_coeffs)/sizeof(int16_t);
+    size_t nr_iq = 0,
+           nr_i = 0,
+           nr_q = 0;
+    uint32_t state = 3;
+
+    for (size_t i = 0; i < 2 * 1000; i++) {
+        state = state * 1103515245ul + 12345ul;
+        iq[i] = (int16_t)(state >> 16) / 8;
+    }
+
+    TEST_ASSERT_OK(polyphase_fir_new_complex(&pfir, nr_coeffs, test_polyphase_fir_coeffs, 3, 2));
+    TEST_ASSERT_OK(_test_polyphase_run(pfir, iq, 1000, 97, 2, 1, out_iq, &nr_iq));
+    TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+    TEST_ASSERT_OK(polyphase_fir_new(&pfir, nr_coeffs, test_polyphase_fir_coeffs, 3, 2));
+    TEST_ASSERT_OK(_test_polyphase_run(pfir, iq, 1000, 97, 1, 2, out_i, &nr_i));
+    TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+    TEST_ASSERT_OK(polyphase_fir_new(&pfir, nr_coeffs, test_polyphase_fir_coeffs, 3, 2));
+    TEST_ASSERT_OK(_test_polyphase_run(pfir, iq + 1, 1000, 97, 1, 2, out_q, &nr_q));
+    TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+    TEST_ASSERT_EQUALS(nr_iq, nr_i);
+    TEST_ASSERT_EQUALS(nr_iq, nr_q);
+    TEST_ASSERT_EQUALS(nr_iq > 1400, true);
+
+    for (size_t i = 0; i < nr_iq; i++) {
+        if (out_iq[2 * i] != out_i[i] || out_iq[2 * i + 1] != out_q[i]) {
+            TEST_ERR("Mismatch at %zu: got (%d, %d), expected (%d, %d)", i, out_iq[2 * i], out_iq[2 * i + 1],
+                    out_i[i], out_q[i]);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * A symmetric filter with no interpolation is found to be symmetric, and its output matches the
+ * filter computed directly.
+ */
+TEST_DECLARE_UNIT(test_symmetric, polyphase)
+{
+    static int16_t samples[1000],
+                   out[1000];
+    int16_t coeffs[31];
+    struct polyphase_fir *pfir = NULL;
+    size_t nr_out = 0;
+    uint32_t state = 13;
+
+    for (size_t i = 0; i < 1000; i++) {
+        state = state * 1103515245ul + 12345ul;
+        samples[i] = (int16_t)(state >> 16) / 8;
+    }
+
+    for (size_t i = 0; i < 16; i++) {
+        state = state * 1103515245ul + 12345ul;
+        coeffs[i] = coeffs[30 - i] = (int16_t)(state >> 16) / 16;
+    }
+
+    TEST_ASSERT_OK(polyphase_fir_new(&pfir, 31, coeffs, 1, 3));
+    TEST_ASSERT_EQUALS(pfir->symmetric, true);
+    TEST_ASSERT_EQUALS(pfir->nr_filter_coeffs, 31);
+    TEST_ASSERT_OK(_test_polyphase_run(pfir, samples, 1000, 97, 1, 1, out, &nr_out));
+    TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+    TEST_ASSERT_EQUALS(nr_out > 300, true);
+
+    for (size_t n = 0; n < nr_out; n++) {
+        int32_t acc = 0;
+
+        for (size_t k = 0; k < 31; k++) {
+            acc += (int32_t)samples[3 * n + k] * coeffs[k];
+        }
+
+        if (out[n] != round_q30_q15(acc)) {
+            TEST_ERR("Mismatch at %zu: got %d, expected %d", n, out[n], round_q30_q15(acc));
+            return A_E_INVAL;
+        }
+    }
+
+    /* Interpolating filters are never folded */
+    TEST_ASSERT_OK(polyphase_fir_new(&pfir, 31, coeffs, 2, 3));
+    TEST_ASSERT_EQUALS(pfir->symmetric, false);
+    TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+    return A_OK;
+}
+
+/**
+ * A fractional resampler at an awkward ratio reproduces an in-band tone at the new rate, delayed
+ * by half the length of its phase filters, and keeps its bank small.
+ */
+TEST_DECLARE_UNIT(test_fractional, polyphase)
+{
+    static int16_t samples[2000],
+                   out[4000];
+    struct polyphase_fir *pfir = NULL;
+    double ratio = 0.0,
+           delay = 0.0;
+    size_t nr_out = 0;
+
+    for (size_t i = 0; i < 2000; i++) {
+        samples[i] = (int16_t)lrint(8000.0 * sin(2.0 * M_PI * 1000.0 * (double)i / 25000.0));
+    }
+
+    TEST_ASSERT_OK(polyphase_fir_parse_ratio("38400/25000", &ratio));
+    TEST_ASSERT_EQUALS(ratio == 1.536, true);
+    TEST_ASSERT_EQUALS(polyphase_fir_parse_ratio("38400/", &ratio), A_E_INVAL);
+    TEST_ASSERT_EQUALS(polyphase_fir_parse_ratio("100", &ratio), A_E_INVAL);
+
+    TEST_ASSERT_OK(polyphase_fir_new_fractional(&pfir, 38400.0/25000.0));
+    TEST_ASSERT_EQUALS(pfir->nr_phase_filters * pfir->nr_filter_coeffs * sizeof(int16_t) < 4096, true);
+    delay = (double)(pfir->nr_filter_coeffs - 1) / 2.0;
+    TEST_ASSERT_OK(_test_polyphase_run(pfir, samples, 2000, 97, 1, 1, out, &nr_out));
+    TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+    TEST_ASSERT_EQUALS(nr_out > 3000, true);
+
+    for (size_t n = 0; n < nr_out; n++) {
+        double t = (double)n * 25000.0 / 38400.0 + delay,
+               expected = 8000.0 * sin(2.0 * M_PI * 1000.0 * t / 25000.0);
+
+        if (fabs((double)out[n] - expected) > 16.0) {
+            TEST_ERR("Mismatch at %zu: got %d, expected %f", n, out[n], expected);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
 TEST_DECLARE_SUITE(polyphase, test_polyphase_fir_cleanup, test_polyphase_fir_setup, NULL, NULL);
 
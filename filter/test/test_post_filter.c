@@ -0,0 +1,141 @@
+#include <filter/post_filter.h>
+#include <filter/dc_blocker.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_SAMPLES             1031
+
+static
+int16_t test_post_in[TEST_NR_SAMPLES];
+
+static
+int16_t test_post_out[TEST_NR_SAMPLES];
+
+static
+int16_t test_post_ref[TEST_NR_SAMPLES];
+
+static
+aresult_t test_post_filter_setup(void)
+{
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        test_post_in[i] = (int16_t)(sin(0.03 * i) * 12000.0) + 3000;
+    }
+
+    /* Make sure the extremes are there to saturate */
+    test_post_in[3] = INT16_MIN;
+    test_post_in[4] = INT16_MAX;
+
+    return A_OK;
+}
+
+static
+aresult_t test_post_filter_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * With unity gain and nothing else asked for, samples pass through untouched.
+ */
+TEST_DECLARE_UNIT(test_post_filter_identity, post_filter)
+{
+    struct post_filter pf;
+
+    TEST_ASSERT_OK(post_filter_init(&pf, false, 1.0, false, 0.9999));
+
+    memcpy(test_post_out, test_post_in, sizeof(test_post_in));
+    TEST_ASSERT_OK(post_filter_apply(&pf, test_post_out, TEST_NR_SAMPLES));
+    TEST_ASSERT_EQUALS(memcmp(test_post_out, test_post_in, sizeof(test_post_in)), 0);
+
+    return A_OK;
+}
+
+/**
+ * Inversion and gain round to nearest and saturate instead of wrapping.
+ */
+TEST_DECLARE_UNIT(test_post_filter_invert_gain, post_filter)
+{
+    struct post_filter pf;
+
+    TEST_ASSERT_OK(post_filter_init(&pf, true, 1.0, false, 0.9999));
+
+    memcpy(test_post_out, test_post_in, sizeof(test_post_in));
+    TEST_ASSERT_OK(post_filter_apply(&pf, test_post_out, TEST_NR_SAMPLES));
+
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        int32_t expected = -(int32_t)test_post_in[i];
+
+        if (expected > INT16_MAX) {
+            expected = INT16_MAX;
+        }
+
+        if (test_post_out[i] != expected) {
+            TEST_ERR("Inverted mismatch at %zu: got %d, expected %d", i, test_post_out[i], expected);
+            return A_E_INVAL;
+        }
+    }
+
+    TEST_ASSERT_OK(post_filter_init(&pf, false, 2.5, false, 0.9999));
+
+    memcpy(test_post_out, test_post_in, sizeof(test_post_in));
+    TEST_ASSERT_OK(post_filter_apply(&pf, test_post_out, TEST_NR_SAMPLES));
+
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        double expected = floor((double)test_post_in[i] * 2.5 + 0.5);
+
+        if (expected > INT16_MAX) {
+            expected = INT16_MAX;
+        } else if (expected < INT16_MIN) {
+            expected = INT16_MIN;
+        }
+
+        if (test_post_out[i] != (int16_t)expected) {
+            TEST_ERR("Gain mismatch at %zu: got %d, expected %d", i, test_post_out[i], (int)expected);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * The fused pass matches inverting, then running the plain DC blocker, even when the samples
+ * arrive in uneven blocks.
+ */
+TEST_DECLARE_UNIT(test_post_filter_dc_block, post_filter)
+{
+    struct post_filter pf;
+    struct dc_blocker blck;
+    size_t offs = 0,
+           block = 1;
+
+    TEST_ASSERT_OK(post_filter_init(&pf, true, 1.0, true, 0.999));
+    TEST_ASSERT_OK(dc_blocker_init(&blck, 0.999));
+
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        int32_t inv = -(int32_t)test_post_in[i];
+        test_post_ref[i] = inv > INT16_MAX ? INT16_MAX : inv;
+    }
+
+    TEST_ASSERT_OK(dc_blocker_apply(&blck, test_post_ref, TEST_NR_SAMPLES));
+
+    memcpy(test_post_out, test_post_in, sizeof(test_post_in));
+
+    while (offs < TEST_NR_SAMPLES) {
+        size_t nr = BL_MIN2(block, TEST_NR_SAMPLES - offs);
+        TEST_ASSERT_OK(post_filter_apply(&pf, test_post_out + offs, nr));
+        offs += nr;
+        block = block * 3 + 1;
+    }
+
+    TEST_ASSERT_EQUALS(memcmp(test_post_out, test_post_ref, sizeof(test_post_ref)), 0);
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(post_filter, test_post_filter_cleanup, test_post_filter_setup, NULL, NULL);
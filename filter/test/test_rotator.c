@@ -0,0 +1,184 @@
+#include <filter/filter.h>
+#include <filter/direct_fir.h>
+#include <filter/rotator.h>
+#include <filter/sample_buf.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <tsl/safe_alloc.h>
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_SAMPLE_RATE            1000000
+#define TEST_NR_SAMPLES             200000
+#define TEST_AMPLITUDE              16000.0
+
+static
+int16_t test_rotator_in[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_rotator_out[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_rotator_ref[2 * TEST_NR_SAMPLES];
+
+static
+aresult_t test_rotator_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_rotator_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * Fill the input with a tone at the given offset
+ */
+static
+void _test_rotator_tone(int32_t freq)
+{
+    for (size_t i = 0; i < TEST_NR_SAMPLES; i++) {
+        double angle = 2.0 * M_PI * (double)(((int64_t)freq * (int64_t)i) % TEST_SAMPLE_RATE) / TEST_SAMPLE_RATE;
+        test_rotator_in[2 * i    ] = (int16_t)lrint(TEST_AMPLITUDE * cos(angle));
+        test_rotator_in[2 * i + 1] = (int16_t)lrint(TEST_AMPLITUDE * sin(angle));
+    }
+}
+
+/**
+ * Check that every sample is at DC, with the tone's amplitude
+ */
+static
+aresult_t _test_rotator_check_dc(const int16_t *out, size_t nr_samples)
+{
+    for (size_t i = 0; i < nr_samples; i++) {
+        if (fabs(out[2 * i] - TEST_AMPLITUDE) > 3.0 || abs(out[2 * i + 1]) > 3) {
+            TEST_ERR("Sample %zu came out as (%d, %d)", i, out[2 * i], out[2 * i + 1]);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Apply a rotator in runs of awkward lengths, so runs start and end partway through blocks
+ */
+static
+aresult_t _test_rotator_run_split(struct rotator *rot, const int16_t *in, int16_t *out, size_t nr_samples)
+{
+    static const size_t lens[6] = { 1, 7, 33, 1000, 31, 4096 };
+    size_t offs = 0,
+           idx = 0;
+
+    while (offs < nr_samples) {
+        size_t nr = BL_MIN2(nr_samples - offs, lens[idx % 6]);
+        TEST_ASSERT_OK(rotator_apply(rot, in + 2 * offs, out + 2 * offs, nr));
+        offs += nr;
+        idx++;
+    }
+
+    return A_OK;
+}
+
+/**
+ * A tone at the shift comes out at DC, with neither its amplitude nor phase drifting over a long
+ * run, for a shift with a period too long for a table and for one that a table can cover. How
+ * the samples are split into runs doesn't change the output.
+ */
+TEST_DECLARE_UNIT(test_shift, rotator)
+{
+    static const int32_t shifts[3] = { 123457, -125000, 0 };
+
+    for (size_t s = 0; s < 3; s++) {
+        for (int use_table = 0; use_table < 2; use_table++) {
+            struct rotator rot;
+
+            _test_rotator_tone(shifts[s]);
+
+            TEST_ASSERT_OK(rotator_init(&rot, TEST_SAMPLE_RATE, shifts[s], 1, 0 != use_table));
+            TEST_ASSERT_EQUALS(NULL != rot.table, 0 != use_table && 123457 != shifts[s]);
+            TEST_ASSERT_OK(rotator_apply(&rot, test_rotator_in, test_rotator_ref, TEST_NR_SAMPLES));
+            TEST_ASSERT_OK(rotator_cleanup(&rot));
+
+            TEST_ASSERT_OK(_test_rotator_check_dc(test_rotator_ref, TEST_NR_SAMPLES));
+
+            TEST_ASSERT_OK(rotator_init(&rot, TEST_SAMPLE_RATE, shifts[s], 1, 0 != use_table));
+            TEST_ASSERT_OK(_test_rotator_run_split(&rot, test_rotator_in, test_rotator_out, TEST_NR_SAMPLES));
+            TEST_ASSERT_OK(rotator_cleanup(&rot));
+
+            TEST_ASSERT_EQUALS(memcmp(test_rotator_out, test_rotator_ref, sizeof(test_rotator_ref)), 0);
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Rotating in place gives the same result as rotating into another buffer.
+ */
+TEST_DECLARE_UNIT(test_in_place, rotator)
+{
+    struct rotator rot;
+
+    _test_rotator_tone(-98765);
+
+    TEST_ASSERT_OK(rotator_init(&rot, TEST_SAMPLE_RATE, -98765, 1, false));
+    TEST_ASSERT_OK(rotator_apply(&rot, test_rotator_in, test_rotator_ref, TEST_NR_SAMPLES));
+    TEST_ASSERT_OK(rotator_cleanup(&rot));
+
+    TEST_ASSERT_OK(rotator_init(&rot, TEST_SAMPLE_RATE, -98765, 1, false));
+    TEST_ASSERT_OK(_test_rotator_run_split(&rot, test_rotator_in, test_rotator_in, TEST_NR_SAMPLES));
+    TEST_ASSERT_OK(rotator_cleanup(&rot));
+
+    TEST_ASSERT_EQUALS(memcmp(test_rotator_in, test_rotator_ref, sizeof(test_rotator_ref)), 0);
+
+    return A_OK;
+}
+
+static
+aresult_t _test_rotator_buf_release(struct sample_buf *buf)
+{
+    TFREE(buf);
+    return A_OK;
+}
+
+/**
+ * A direct FIR derotating its decimated output brings a tone at the shift down to DC.
+ */
+TEST_DECLARE_UNIT(test_direct_fir_derotate, rotator)
+{
+    const int16_t coeff_re = 1 << Q_15_SHIFT,
+                  coeff_im = 0;
+    struct direct_fir fir;
+    struct sample_buf *buf = NULL;
+    size_t nr_out = 0;
+
+    _test_rotator_tone(234567);
+
+    TEST_ASSERT_OK(TCALLOC((void **)&buf, 1, sizeof(struct sample_buf) + sizeof(test_rotator_in)));
+    memcpy(buf->data_buf, test_rotator_in, sizeof(test_rotator_in));
+    buf->nr_samples = TEST_NR_SAMPLES;
+    buf->sample_buf_bytes = sizeof(test_rotator_in);
+    buf->sample_type = COMPLEX_INT_16;
+    buf->release = _test_rotator_buf_release;
+    atomic_store(&buf->refcount, 1);
+
+    TEST_ASSERT_OK(direct_fir_init(&fir, 1, &coeff_re, &coeff_im, 4, true, TEST_SAMPLE_RATE, 234567));
+    TEST_ASSERT_OK(direct_fir_push_sample_buf(&fir, buf));
+    TEST_ASSERT_OK(direct_fir_process(&fir, test_rotator_out, TEST_NR_SAMPLES, &nr_out));
+    TEST_ASSERT_OK(direct_fir_cleanup(&fir));
+
+    TEST_ASSERT_EQUALS(nr_out, TEST_NR_SAMPLES / 4);
+    TEST_ASSERT_OK(_test_rotator_check_dc(test_rotator_out, nr_out));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(rotator, test_rotator_cleanup, test_rotator_setup, NULL, NULL);
@@ -0,0 +1,136 @@
+#include <filter/sample_convert.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_SAMPLES             4099
+
+static
+int8_t test_convert_s8[TEST_NR_SAMPLES + 4];
+
+static
+int16_t test_convert_s16[TEST_NR_SAMPLES + 4];
+
+static
+float test_convert_f32[TEST_NR_SAMPLES + 4];
+
+static
+int16_t test_convert_out[TEST_NR_SAMPLES + 4];
+
+static
+aresult_t test_sample_convert_setup(void)
+{
+    for (size_t i = 0; i < TEST_NR_SAMPLES + 4; i++) {
+        test_convert_s8[i] = (int8_t)((i * 37 + (i >> 3)) & 0xff);
+        test_convert_s16[i] = (int16_t)((i * 7919 + (i >> 2)) & 0xffff);
+        test_convert_f32[i] = (float)sin(0.01 * i) * 1.25f;
+    }
+
+    /* Make sure the extremes show up somewhere in the vector paths */
+    test_convert_s8[5] = INT8_MIN;
+    test_convert_s8[6] = INT8_MAX;
+    test_convert_f32[7] = 1.0f;
+    test_convert_f32[8] = -1.0f;
+    test_convert_f32[9] = 1e30f;
+    test_convert_f32[10] = -1e30f;
+    test_convert_f32[11] = NAN;
+    test_convert_f32[12] = 0.5f / 32768.0f;
+
+    return A_OK;
+}
+
+static
+aresult_t test_sample_convert_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * Signed 8-bit samples land at the same scale as unsigned 8-bit samples, at every alignment.
+ */
+TEST_DECLARE_UNIT(test_convert_s8, sample_convert)
+{
+    for (size_t offs = 0; offs < 4; offs++) {
+        size_t nr = TEST_NR_SAMPLES - offs;
+
+        TEST_ASSERT_OK(sample_convert_s8_to_q15(test_convert_out, test_convert_s8 + offs, nr));
+
+        for (size_t i = 0; i < nr; i++) {
+            int16_t expected = (int16_t)(test_convert_s8[i + offs] * (1 << SAMPLE_CONVERT_S8_SHIFT));
+            if (test_convert_out[i] != expected) {
+                TEST_ERR("Mismatch at %zu (offset %zu): got %d, expected %d", i, offs, test_convert_out[i], expected);
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Byte swapping works both into a separate buffer and in place, and swapping twice is a no-op.
+ */
+TEST_DECLARE_UNIT(test_convert_s16_swap, sample_convert)
+{
+    for (size_t offs = 0; offs < 4; offs++) {
+        size_t nr = TEST_NR_SAMPLES - offs;
+
+        TEST_ASSERT_OK(sample_convert_s16_swap(test_convert_out, test_convert_s16 + offs, nr));
+
+        for (size_t i = 0; i < nr; i++) {
+            uint16_t raw = (uint16_t)test_convert_s16[i + offs],
+                     expected = (uint16_t)((raw << 8) | (raw >> 8));
+            if ((uint16_t)test_convert_out[i] != expected) {
+                TEST_ERR("Mismatch at %zu (offset %zu): got %04x, expected %04x", i, offs,
+                        (uint16_t)test_convert_out[i], expected);
+                return A_E_INVAL;
+            }
+        }
+
+        TEST_ASSERT_OK(sample_convert_s16_swap(test_convert_out, test_convert_out, nr));
+        TEST_ASSERT_EQUALS(memcmp(test_convert_out, test_convert_s16 + offs, nr * sizeof(int16_t)), 0);
+    }
+
+    return A_OK;
+}
+
+/**
+ * Floating point samples are rounded to Q.15, and saturate rather than wrap around.
+ */
+TEST_DECLARE_UNIT(test_convert_f32, sample_convert)
+{
+    for (size_t offs = 0; offs < 4; offs++) {
+        size_t nr = TEST_NR_SAMPLES - offs;
+
+        TEST_ASSERT_OK(sample_convert_f32_to_q15(test_convert_out, test_convert_f32 + offs, nr));
+
+        for (size_t i = 0; i < nr; i++) {
+            float val = test_convert_f32[i + offs];
+            double scaled = isnan(val) ? INT16_MAX : (double)val * 32768.0;
+            long expected = 0;
+
+            if (scaled > INT16_MAX) {
+                scaled = INT16_MAX;
+            } else if (scaled < INT16_MIN) {
+                scaled = INT16_MIN;
+            }
+
+            expected = lrint(scaled);
+
+            if (test_convert_out[i] != expected) {
+                TEST_ERR("Mismatch at %zu (offset %zu): got %d, expected %ld (from %f)", i, offs,
+                        test_convert_out[i], expected, val);
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(sample_convert, test_sample_convert_cleanup, test_sample_convert_setup, NULL, NULL);
+
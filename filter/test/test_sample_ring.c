@@ -0,0 +1,248 @@
+#include <filter/direct_fir.h>
+#include <filter/polyphase_fir.h>
+#include <filter/sample_buf.h>
+#include <filter/sample_ring.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <tsl/safe_alloc.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_SAMPLES             5000
+#define TEST_NR_COEFFS              37
+
+static
+int16_t test_sample_ring_in[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_sample_ring_coeff_re[TEST_NR_COEFFS];
+
+static
+int16_t test_sample_ring_coeff_im[TEST_NR_COEFFS];
+
+static
+int16_t test_sample_ring_ref[2 * TEST_NR_SAMPLES * 2];
+
+static
+int16_t test_sample_ring_out[2 * TEST_NR_SAMPLES * 2];
+
+static
+int16_t _test_sample_ring_rand(uint32_t *state)
+{
+    *state = *state * 1103515245ul + 12345ul;
+    return (int16_t)(*state >> 16);
+}
+
+static
+aresult_t test_sample_ring_setup(void)
+{
+    uint32_t state = 11;
+
+    for (size_t i = 0; i < 2 * TEST_NR_SAMPLES; i++) {
+        test_sample_ring_in[i] = _test_sample_ring_rand(&state) / 8;
+    }
+
+    for (size_t i = 0; i < TEST_NR_COEFFS; i++) {
+        test_sample_ring_coeff_re[i] = _test_sample_ring_rand(&state) / 16;
+        test_sample_ring_coeff_im[i] = _test_sample_ring_rand(&state) / 16;
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_sample_ring_cleanup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t _test_sample_ring_buf_release(struct sample_buf *buf)
+{
+    TFREE(buf);
+    return A_OK;
+}
+
+/**
+ * Wrap all of the test input, as samples of the given size, in one sample buffer.
+ */
+static
+aresult_t _test_sample_ring_buf_new(struct sample_buf **pbuf, size_t sample_bytes)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    if (FAILED(ret = TCALLOC((void **)&buf, 1, sizeof(struct sample_buf) + sizeof(test_sample_ring_in)))) {
+        goto done;
+    }
+
+    memcpy(buf->data_buf, test_sample_ring_in, sizeof(test_sample_ring_in));
+    buf->nr_samples = sizeof(test_sample_ring_in) / sample_bytes;
+    buf->sample_buf_bytes = sizeof(test_sample_ring_in);
+    buf->sample_type = 4 == sample_bytes ? COMPLEX_INT_16 : REAL_INT_16;
+    buf->release = _test_sample_ring_buf_release;
+    atomic_store(&buf->refcount, 1);
+
+    *pbuf = buf;
+
+done:
+    return ret;
+}
+
+/**
+ * Writes that cross the end of the ring come back out contiguous, and the ring never takes more
+ * than it can hold.
+ */
+TEST_DECLARE_UNIT(test_wrap, sample_ring)
+{
+    struct sample_ring *ring = NULL;
+    const void *rptr = NULL;
+    void *wptr = NULL;
+    size_t nr = 0,
+           nr_avail = 0,
+           nr_samples = 0;
+
+    TEST_ASSERT_OK(sample_ring_new(&ring, 1000, 4));
+    nr_samples = ring->nr_samples;
+    TEST_ASSERT_EQUALS(nr_samples >= 1000, true);
+
+    /* Move the ring to just short of the wrap point */
+    TEST_ASSERT_OK(sample_ring_write(ring, test_sample_ring_in, nr_samples - 10, &nr));
+    TEST_ASSERT_EQUALS(nr, nr_samples - 10);
+    TEST_ASSERT_OK(sample_ring_consume(ring, nr));
+
+    TEST_ASSERT_OK(sample_ring_write(ring, test_sample_ring_in, 100, &nr));
+    TEST_ASSERT_EQUALS(nr, 100);
+
+    TEST_ASSERT_OK(sample_ring_read_ptr(ring, &rptr, &nr_avail));
+    TEST_ASSERT_EQUALS(nr_avail, 100);
+    TEST_ASSERT_EQUALS(memcmp(rptr, test_sample_ring_in, 100 * 4), 0);
+
+    /* The start of the ring sees the samples written past the end */
+    TEST_ASSERT_EQUALS(memcmp(ring->base, test_sample_ring_in + 2 * 10, 90 * 4), 0);
+
+    /* Fill it up; the excess is turned away */
+    TEST_ASSERT_OK(sample_ring_write(ring, test_sample_ring_in, TEST_NR_SAMPLES, &nr));
+    TEST_ASSERT_EQUALS(nr, nr_samples - 100);
+    TEST_ASSERT_OK(sample_ring_write_ptr(ring, &wptr, &nr));
+    TEST_ASSERT_EQUALS(nr, 0);
+
+    TEST_ASSERT_OK(sample_ring_delete(&ring));
+    TEST_ASSERT_EQUALS(ring, NULL);
+
+    return A_OK;
+}
+
+/**
+ * A direct FIR reading from a small ring gives exactly the same output as one given all of the
+ * input in one sample buffer, whether it decimates by less or more than it has taps.
+ */
+TEST_DECLARE_UNIT(test_direct_fir, sample_ring)
+{
+    static const unsigned decimations[2] = { 3, 50 };
+
+    for (size_t d = 0; d < 2; d++) {
+        struct direct_fir fir;
+        struct sample_ring *ring = NULL;
+        struct sample_buf *buf = NULL;
+        size_t nr_ref = 0,
+               nr_out = 0,
+               nr_in = 0;
+
+        TEST_ASSERT_OK(direct_fir_init(&fir, TEST_NR_COEFFS, test_sample_ring_coeff_re, test_sample_ring_coeff_im,
+                    decimations[d], false, 0, 0));
+        TEST_ASSERT_OK(_test_sample_ring_buf_new(&buf, 4));
+        TEST_ASSERT_OK(direct_fir_push_sample_buf(&fir, buf));
+        TEST_ASSERT_OK(direct_fir_process(&fir, test_sample_ring_ref, TEST_NR_SAMPLES, &nr_ref));
+        TEST_ASSERT_OK(direct_fir_cleanup(&fir));
+
+        TEST_ASSERT_OK(direct_fir_init(&fir, TEST_NR_COEFFS, test_sample_ring_coeff_re, test_sample_ring_coeff_im,
+                    decimations[d], false, 0, 0));
+        TEST_ASSERT_OK(sample_ring_new(&ring, 1, 4));
+
+        while (nr_in < TEST_NR_SAMPLES) {
+            size_t nr_written = 0,
+                   nr_gen = 0;
+
+            TEST_ASSERT_OK(sample_ring_write(ring, test_sample_ring_in + 2 * nr_in,
+                        BL_MIN2(TEST_NR_SAMPLES - nr_in, 333), &nr_written));
+            nr_in += nr_written;
+
+            do {
+                TEST_ASSERT_OK(direct_fir_process_ring(&fir, ring, test_sample_ring_out + 2 * nr_out, 7, &nr_gen));
+                nr_out += nr_gen;
+            } while (0 != nr_gen);
+        }
+
+        TEST_ASSERT_OK(sample_ring_delete(&ring));
+        TEST_ASSERT_OK(direct_fir_cleanup(&fir));
+
+        TEST_ASSERT_EQUALS(nr_out, nr_ref);
+        TEST_ASSERT_EQUALS(memcmp(test_sample_ring_out, test_sample_ring_ref, nr_out * 2 * sizeof(int16_t)), 0);
+    }
+
+    return A_OK;
+}
+
+/**
+ * Likewise for the polyphase FIR, with real and complex samples.
+ */
+TEST_DECLARE_UNIT(test_polyphase_fir, sample_ring)
+{
+    for (size_t width = 1; width <= 2; width++) {
+        struct polyphase_fir *pfir = NULL;
+        struct sample_ring *ring = NULL;
+        struct sample_buf *buf = NULL;
+        size_t nr_total = 2 * TEST_NR_SAMPLES / width,
+               nr_ref = 0,
+               nr_out = 0,
+               nr_in = 0;
+
+        TEST_ASSERT_OK((1 == width ? polyphase_fir_new : polyphase_fir_new_complex)(&pfir, TEST_NR_COEFFS,
+                    test_sample_ring_coeff_re, 3, 2));
+        TEST_ASSERT_OK(_test_sample_ring_buf_new(&buf, width * sizeof(int16_t)));
+        TEST_ASSERT_OK(polyphase_fir_push_sample_buf(pfir, buf));
+        TEST_ASSERT_OK(polyphase_fir_process(pfir, test_sample_ring_ref, 2 * TEST_NR_SAMPLES * 2 / width, &nr_ref));
+        TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+        TEST_ASSERT_OK((1 == width ? polyphase_fir_new : polyphase_fir_new_complex)(&pfir, TEST_NR_COEFFS,
+                    test_sample_ring_coeff_re, 3, 2));
+        TEST_ASSERT_OK(sample_ring_new(&ring, 1, width * sizeof(int16_t)));
+
+        while (nr_in < nr_total) {
+            size_t nr_written = 0,
+                   nr_gen = 0;
+
+            TEST_ASSERT_OK(sample_ring_write(ring, test_sample_ring_in + width * nr_in,
+                        BL_MIN2(nr_total - nr_in, 333), &nr_written));
+            nr_in += nr_written;
+
+            do {
+                TEST_ASSERT_OK(polyphase_fir_process_ring(pfir, ring, test_sample_ring_out + width * nr_out,
+                            11, &nr_gen));
+                nr_out += nr_gen;
+            } while (0 != nr_gen);
+        }
+
+        TEST_ASSERT_OK(sample_ring_delete(&ring));
+        TEST_ASSERT_OK(polyphase_fir_delete(&pfir));
+
+        /*
+         * The sample buffer path stops one input sample short of the end of its input, which
+         * is worth up to two outputs when interpolating by 3/2
+         */
+        TEST_INF("Width %zu: %zu samples from the ring, %zu from the sample buffer", width, nr_out, nr_ref);
+        TEST_ASSERT_EQUALS(nr_out >= nr_ref, true);
+        TEST_ASSERT_EQUALS(nr_out <= nr_ref + 2, true);
+        TEST_ASSERT_EQUALS(memcmp(test_sample_ring_out, test_sample_ring_ref, nr_ref * width * sizeof(int16_t)), 0);
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(sample_ring, test_sample_ring_cleanup, test_sample_ring_setup, NULL, NULL);
@@ -29,6 +29,165 @@
 #include <tsl/diag.h>
 #include <tsl/assert.h>
 
+#ifdef _USE_ARM_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) && !defined(_USE_ARM_NEON)
+/* pmaddwd already does two taps per 32-bit lane, so folding symmetric taps saves nothing */
+#define _DOT_PRODUCT_FOLD_SYMMETRIC         false
+#else
+#define _DOT_PRODUCT_FOLD_SYMMETRIC         true
+#endif
+
+/**
+ * Multiply-accumulate a contiguous run of real Q.15 samples against the given coefficients,
+ * returning the Q.30 sum.
+ *
+ * Polyphase FIR phases are padded with zero coefficients to a multiple of 4 (see
+ * polyphase_fir_priv.h), so unless a window straddles two sample buffers the vector loops cover
+ * every coefficient. The vector paths sum in 32-bit wrapping arithmetic, just like the scalar
+ * loop, so all of them give bit-identical results.
+ */
+static inline
+int32_t _dot_product_mac(const int16_t *samples, const int16_t *coeffs, size_t nr)
+{
+    size_t i = 0;
+    int32_t acc = 0;
+
+#if defined(_USE_ARM_NEON)
+    int32x4_t acc_v = vdupq_n_s32(0);
+
+    for (; i + 8 <= nr; i += 8) {
+        int16x8_t s = vld1q_s16(samples + i),
+                  c = vld1q_s16(coeffs + i);
+
+        acc_v = vmlal_s16(acc_v, vget_low_s16(s), vget_low_s16(c));
+        acc_v = vmlal_s16(acc_v, vget_high_s16(s), vget_high_s16(c));
+    }
+
+    for (; i + 4 <= nr; i += 4) {
+        acc_v = vmlal_s16(acc_v, vld1_s16(samples + i), vld1_s16(coeffs + i));
+    }
+
+    acc = vgetq_lane_s32(acc_v, 0) + vgetq_lane_s32(acc_v, 1) + vgetq_lane_s32(acc_v, 2) + vgetq_lane_s32(acc_v, 3);
+#elif defined(__SSE2__)
+    __m128i acc_v = _mm_setzero_si128();
+
+#if defined(__AVX2__)
+    __m256i acc_w = _mm256_setzero_si256();
+
+    for (; i + 16 <= nr; i += 16) {
+        acc_w = _mm256_add_epi32(acc_w, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(samples + i)),
+                    _mm256_loadu_si256((const __m256i *)(coeffs + i))));
+    }
+
+    acc_v = _mm_add_epi32(_mm256_castsi256_si128(acc_w), _mm256_extracti128_si256(acc_w, 1));
+#endif /* defined(__AVX2__) */
+
+    for (; i + 8 <= nr; i += 8) {
+        acc_v = _mm_add_epi32(acc_v, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(samples + i)),
+                    _mm_loadu_si128((const __m128i *)(coeffs + i))));
+    }
+
+    for (; i + 4 <= nr; i += 4) {
+        acc_v = _mm_add_epi32(acc_v, _mm_madd_epi16(_mm_loadl_epi64((const __m128i *)(samples + i)),
+                    _mm_loadl_epi64((const __m128i *)(coeffs + i))));
+    }
+
+    acc_v = _mm_add_epi32(acc_v, _mm_shuffle_epi32(acc_v, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc_v = _mm_add_epi32(acc_v, _mm_shuffle_epi32(acc_v, _MM_SHUFFLE(2, 3, 0, 1)));
+    acc = _mm_cvtsi128_si32(acc_v);
+#endif /* SIMD implementations */
+
+    /* Pick up the stragglers */
+    for (; i < nr; i++) {
+        acc += (int32_t)samples[i] * (int32_t)coeffs[i];
+    }
+
+    return acc;
+}
+
+/**
+ * Multiply-accumulate a contiguous run of interleaved complex Q.15 samples against the given
+ * real coefficients, accumulating the Q.30 I and Q sums in pacc_i and pacc_q.
+ *
+ * On x86, pmaddwd against interleaved (c, 0) and (0, c) pairs picks out the I and Q products
+ * without having to deinterleave the samples.
+ */
+static inline
+void _dot_product_mac_complex(const int16_t *samples, const int16_t *coeffs, size_t nr,
+        int32_t *pacc_i, int32_t *pacc_q)
+{
+    size_t i = 0;
+    int32_t acc_i = 0,
+            acc_q = 0;
+
+#if defined(_USE_ARM_NEON)
+    int32x4_t acc_i_v = vdupq_n_s32(0),
+              acc_q_v = vdupq_n_s32(0);
+
+    for (; i + 4 <= nr; i += 4) {
+        int16x4x2_t s = vld2_s16(samples + 2 * i);
+        int16x4_t c = vld1_s16(coeffs + i);
+
+        acc_i_v = vmlal_s16(acc_i_v, s.val[0], c);
+        acc_q_v = vmlal_s16(acc_q_v, s.val[1], c);
+    }
+
+    acc_i = vgetq_lane_s32(acc_i_v, 0) + vgetq_lane_s32(acc_i_v, 1) + vgetq_lane_s32(acc_i_v, 2) + vgetq_lane_s32(acc_i_v, 3);
+    acc_q = vgetq_lane_s32(acc_q_v, 0) + vgetq_lane_s32(acc_q_v, 1) + vgetq_lane_s32(acc_q_v, 2) + vgetq_lane_s32(acc_q_v, 3);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc_i_v = _mm_setzero_si128(),
+            acc_q_v = _mm_setzero_si128();
+
+#if defined(__AVX2__)
+    __m256i acc_i_w = _mm256_setzero_si256(),
+            acc_q_w = _mm256_setzero_si256();
+
+    for (; i + 8 <= nr; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(samples + 2 * i)),
+                c_0 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(coeffs + i))),
+                _0_c = _mm256_slli_epi32(c_0, 16);
+
+        acc_i_w = _mm256_add_epi32(acc_i_w, _mm256_madd_epi16(s, c_0));
+        acc_q_w = _mm256_add_epi32(acc_q_w, _mm256_madd_epi16(s, _0_c));
+    }
+
+    acc_i_v = _mm_add_epi32(_mm256_castsi256_si128(acc_i_w), _mm256_extracti128_si256(acc_i_w, 1));
+    acc_q_v = _mm_add_epi32(_mm256_castsi256_si128(acc_q_w), _mm256_extracti128_si256(acc_q_w, 1));
+#endif /* defined(__AVX2__) */
+
+    for (; i + 4 <= nr; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(samples + 2 * i)),
+                c = _mm_loadl_epi64((const __m128i *)(coeffs + i));
+
+        acc_i_v = _mm_add_epi32(acc_i_v, _mm_madd_epi16(s, _mm_unpacklo_epi16(c, zero)));
+        acc_q_v = _mm_add_epi32(acc_q_v, _mm_madd_epi16(s, _mm_unpacklo_epi16(zero, c)));
+    }
+
+    acc_i_v = _mm_add_epi32(acc_i_v, _mm_shuffle_epi32(acc_i_v, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc_i_v = _mm_add_epi32(acc_i_v, _mm_shuffle_epi32(acc_i_v, _MM_SHUFFLE(2, 3, 0, 1)));
+    acc_i = _mm_cvtsi128_si32(acc_i_v);
+
+    acc_q_v = _mm_add_epi32(acc_q_v, _mm_shuffle_epi32(acc_q_v, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc_q_v = _mm_add_epi32(acc_q_v, _mm_shuffle_epi32(acc_q_v, _MM_SHUFFLE(2, 3, 0, 1)));
+    acc_q = _mm_cvtsi128_si32(acc_q_v);
+#endif /* SIMD implementations */
+
+    /* Pick up the stragglers */
+    for (; i < nr; i++) {
+        acc_i += (int32_t)samples[2 * i    ] * (int32_t)coeffs[i];
+        acc_q += (int32_t)samples[2 * i + 1] * (int32_t)coeffs[i];
+    }
+
+    *pacc_i += acc_i;
+    *pacc_q += acc_q;
+}
+
 /**
  * Compute the dot product of samples spread across a zero-copy buffer with a coefficient vector.
  *
@@ -86,17 +245,12 @@ aresult_t dot_product_sample_buffers_real(
          */
         nr_samples_in = BL_MIN2(nr_samples_in, coeffs_remain);
 
-        for (size_t i = 0; i < nr_samples_in; i++) {
 #ifdef _TSL_DEBUG
-            TSL_BUG_ON(i + start_coeff >= nr_coeffs);
-            TSL_BUG_ON(i + buf_offset >= cur_buf->nr_samples);
+        TSL_BUG_ON(start_coeff + nr_samples_in > nr_coeffs);
+        TSL_BUG_ON(buf_offset + nr_samples_in > cur_buf->nr_samples);
 #endif /* defined(_TSL_DEBUG) */
 
-            int32_t sample = ((int16_t *)cur_buf->data_buf)[buf_offset + i],
-                    coeff = coeffs[start_coeff + i];
-
-            acc_res += sample * coeff;
-        }
+        acc_res += _dot_product_mac((int16_t *)cur_buf->data_buf + buf_offset, coeffs + start_coeff, nr_samples_in);
 
         /* If we iterate through, we'll start at the beginning of the next buffer */
         buf_offset = 0;
@@ -115,3 +269,336 @@ done:
     return ret;
 }
 
+
+/**
+ * Compute the dot product of complex samples spread across a zero-copy buffer with a real
+ * coefficient vector.
+ *
+ * \param sb_active The current sample buffer, of interleaved I/Q samples. Must never be NULL.
+ * \param sb_next The "next" sample buffer. Must not be NULL if sb_active has fewer than nr_coeffs samples in it.
+ * \param buf_start_offset The start offset, in complex samples, from the start of sb_active.
+ * \param coeffs The real coefficients to be dotted with samples in sb_active, sb_next.
+ * \param nr_coeffs The number of coefficients in the coeffs vector.
+ * \param psample The resultant I/Q pair. Returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t dot_product_sample_buffers_complex(
+        struct sample_buf *sb_active,
+        struct sample_buf *sb_next,
+        size_t buf_start_offset,
+        int16_t *coeffs,
+        size_t nr_coeffs,
+        int16_t *psample)
+{
+    aresult_t ret = A_OK;
+
+    int32_t acc_i = 0,
+            acc_q = 0;
+    size_t coeffs_remain = 0,
+           buf_offset = 0;
+    struct sample_buf *cur_buf = NULL;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != sb_active);
+    TSL_ASSERT_ARG_DEBUG(NULL != coeffs);
+    TSL_ASSERT_ARG_DEBUG(0 != nr_coeffs);
+    TSL_ASSERT_ARG_DEBUG(NULL != psample);
+
+    coeffs_remain = nr_coeffs;
+    cur_buf = sb_active;
+    buf_offset = buf_start_offset;
+
+    if (buf_offset + nr_coeffs > sb_active->nr_samples && sb_next == NULL) {
+        ret = A_E_DONE;
+        goto done;
+    }
+
+    do {
+        size_t nr_samples_in = BL_MIN2(cur_buf->nr_samples - buf_offset, coeffs_remain),
+               start_coeff = nr_coeffs - coeffs_remain;
+
+        _dot_product_mac_complex((int16_t *)cur_buf->data_buf + 2 * buf_offset, coeffs + start_coeff,
+                nr_samples_in, &acc_i, &acc_q);
+
+        buf_offset = 0;
+        coeffs_remain -= nr_samples_in;
+#ifdef _TSL_DEBUG
+        TSL_BUG_ON(cur_buf == sb_next && coeffs_remain != 0);
+#endif
+        cur_buf = sb_next;
+    } while (coeffs_remain != 0);
+
+    psample[0] = round_q30_q15(acc_i);
+    psample[1] = round_q30_q15(acc_q);
+
+done:
+    return ret;
+}
+
+/**
+ * Compute the dot product of a contiguous run of real samples with a real coefficient vector,
+ * such as a window read out of a sample_ring.
+ *
+ * \param samples The samples. Must hold at least nr_coeffs samples.
+ * \param coeffs The real coefficients to be dotted with the samples.
+ * \param nr_coeffs The number of coefficients in the coeffs vector.
+ * \param psample The resultant sample. Returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t dot_product_real(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs, int16_t *psample)
+{
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != coeffs);
+    TSL_ASSERT_ARG_DEBUG(NULL != psample);
+
+    *psample = round_q30_q15(_dot_product_mac(samples, coeffs, nr_coeffs));
+
+    return A_OK;
+}
+
+/**
+ * Compute the dot product of a contiguous run of complex samples with a real coefficient
+ * vector.
+ *
+ * \param samples The interleaved I/Q samples. Must hold at least nr_coeffs complex samples.
+ * \param coeffs The real coefficients to be dotted with the samples.
+ * \param nr_coeffs The number of coefficients in the coeffs vector.
+ * \param psample The resultant I/Q pair. Returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t dot_product_complex(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs, int16_t *psample)
+{
+    int32_t acc_i = 0,
+            acc_q = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != coeffs);
+    TSL_ASSERT_ARG_DEBUG(NULL != psample);
+
+    _dot_product_mac_complex(samples, coeffs, nr_coeffs, &acc_i, &acc_q);
+
+    psample[0] = round_q30_q15(acc_i);
+    psample[1] = round_q30_q15(acc_q);
+
+    return A_OK;
+}
+
+/**
+ * Multiply-accumulate a contiguous run of real samples against coefficients that are symmetric
+ * about their center, adding each pair of mirrored samples before the multiply. The sums are
+ * 32-bit wrapping, so the result matches _dot_product_mac exactly.
+ */
+static inline
+int32_t _dot_product_mac_folded(const int16_t *samples, const int16_t *coeffs, size_t nr)
+{
+    size_t k = 0;
+    uint32_t acc = 0;
+
+#if defined(_USE_ARM_NEON)
+    int32x4_t acc_v = vdupq_n_s32(0);
+
+    for (; k + 4 <= nr / 2; k += 4) {
+        int16x4_t x = vld1_s16(samples + k),
+                  y = vrev64_s16(vld1_s16(samples + nr - 4 - k));
+
+        acc_v = vmlaq_s32(acc_v, vaddl_s16(x, y), vmovl_s16(vld1_s16(coeffs + k)));
+    }
+
+    acc = vgetq_lane_s32(acc_v, 0) + vgetq_lane_s32(acc_v, 1) + vgetq_lane_s32(acc_v, 2) + vgetq_lane_s32(acc_v, 3);
+#endif /* defined(_USE_ARM_NEON) */
+
+    for (; k < nr / 2; k++) {
+        acc += (uint32_t)(int32_t)coeffs[k] * (uint32_t)((int32_t)samples[k] + (int32_t)samples[nr - 1 - k]);
+    }
+
+    if (0 != (nr & 1)) {
+        acc += (uint32_t)((int32_t)coeffs[nr / 2] * (int32_t)samples[nr / 2]);
+    }
+
+    return (int32_t)acc;
+}
+
+/**
+ * Multiply-accumulate a contiguous run of interleaved complex samples against symmetric real
+ * coefficients, as _dot_product_mac_folded does for real samples.
+ */
+static inline
+void _dot_product_mac_complex_folded(const int16_t *samples, const int16_t *coeffs, size_t nr,
+        int32_t *pacc_i, int32_t *pacc_q)
+{
+    size_t k = 0;
+    uint32_t acc_i = 0,
+             acc_q = 0;
+
+#if defined(_USE_ARM_NEON)
+    int32x4_t acc_i_v = vdupq_n_s32(0),
+              acc_q_v = vdupq_n_s32(0);
+
+    for (; k + 4 <= nr / 2; k += 4) {
+        int16x4x2_t x = vld2_s16(samples + 2 * k),
+                    y = vld2_s16(samples + 2 * (nr - 4 - k));
+        int32x4_t c = vmovl_s16(vld1_s16(coeffs + k));
+
+        acc_i_v = vmlaq_s32(acc_i_v, vaddl_s16(x.val[0], vrev64_s16(y.val[0])), c);
+        acc_q_v = vmlaq_s32(acc_q_v, vaddl_s16(x.val[1], vrev64_s16(y.val[1])), c);
+    }
+
+    acc_i = vgetq_lane_s32(acc_i_v, 0) + vgetq_lane_s32(acc_i_v, 1) + vgetq_lane_s32(acc_i_v, 2) + vgetq_lane_s32(acc_i_v, 3);
+    acc_q = vgetq_lane_s32(acc_q_v, 0) + vgetq_lane_s32(acc_q_v, 1) + vgetq_lane_s32(acc_q_v, 2) + vgetq_lane_s32(acc_q_v, 3);
+#endif /* defined(_USE_ARM_NEON) */
+
+    for (; k < nr / 2; k++) {
+        size_t m = nr - 1 - k;
+        uint32_t c = (uint32_t)(int32_t)coeffs[k];
+
+        acc_i += c * (uint32_t)((int32_t)samples[2 * k    ] + (int32_t)samples[2 * m    ]);
+        acc_q += c * (uint32_t)((int32_t)samples[2 * k + 1] + (int32_t)samples[2 * m + 1]);
+    }
+
+    if (0 != (nr & 1)) {
+        acc_i += (uint32_t)((int32_t)coeffs[nr / 2] * (int32_t)samples[2 * (nr / 2)    ]);
+        acc_q += (uint32_t)((int32_t)coeffs[nr / 2] * (int32_t)samples[2 * (nr / 2) + 1]);
+    }
+
+    *pacc_i += (int32_t)acc_i;
+    *pacc_q += (int32_t)acc_q;
+}
+
+/**
+ * Compute the dot product of a contiguous run of real samples with a real coefficient vector
+ * that is symmetric about its center, with one multiply per pair of mirrored taps.
+ *
+ * \param samples The samples. Must hold at least nr_coeffs samples.
+ * \param coeffs The symmetric coefficients.
+ * \param nr_coeffs The number of coefficients in the coeffs vector.
+ * \param psample The resultant sample. Returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t dot_product_real_folded(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs,
+        int16_t *psample)
+{
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != coeffs);
+    TSL_ASSERT_ARG_DEBUG(NULL != psample);
+
+    *psample = round_q30_q15(_dot_product_mac_folded(samples, coeffs, nr_coeffs));
+
+    return A_OK;
+}
+
+/**
+ * Compute the dot product of a contiguous run of complex samples with a real coefficient vector
+ * that is symmetric about its center, with one multiply per pair of mirrored taps for each of I
+ * and Q.
+ *
+ * \param samples The interleaved I/Q samples. Must hold at least nr_coeffs complex samples.
+ * \param coeffs The symmetric coefficients.
+ * \param nr_coeffs The number of coefficients in the coeffs vector.
+ * \param psample The resultant I/Q pair. Returned by reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t dot_product_complex_folded(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs,
+        int16_t *psample)
+{
+    int32_t acc_i = 0,
+            acc_q = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != coeffs);
+    TSL_ASSERT_ARG_DEBUG(NULL != psample);
+
+    _dot_product_mac_complex_folded(samples, coeffs, nr_coeffs, &acc_i, &acc_q);
+
+    psample[0] = round_q30_q15(acc_i);
+    psample[1] = round_q30_q15(acc_q);
+
+    return A_OK;
+}
+
+/**
+ * Declare real and complex dot products for a fixed number of coefficients. With the length
+ * known, the compiler unrolls the vector loops completely and drops the remainder handling.
+ */
+#define DOT_PRODUCT_KERNEL(_nr) \
+    static \
+    aresult_t _dot_product_real_##_nr(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs, \
+            int16_t *psample) \
+    { \
+        TSL_BUG_ON(_nr != nr_coeffs); \
+        *psample = round_q30_q15(_dot_product_mac(samples, coeffs, _nr)); \
+        return A_OK; \
+    } \
+    \
+    static \
+    aresult_t _dot_product_complex_##_nr(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs, \
+            int16_t *psample) \
+    { \
+        int32_t acc_i = 0, \
+                acc_q = 0; \
+        TSL_BUG_ON(_nr != nr_coeffs); \
+        _dot_product_mac_complex(samples, coeffs, _nr, &acc_i, &acc_q); \
+        psample[0] = round_q30_q15(acc_i); \
+        psample[1] = round_q30_q15(acc_q); \
+        return A_OK; \
+    }
+
+/*
+ * The phase filter lengths of the resampling filters we ship in etc/: 821 taps interpolating
+ * by 16, and by 25, padded to a multiple of 4.
+ */
+DOT_PRODUCT_KERNEL(52)
+DOT_PRODUCT_KERNEL(36)
+
+static const
+struct dot_product_kernel {
+    size_t nr_coeffs;
+    dot_product_func_t real;
+    dot_product_func_t complex;
+} _dot_product_kernels[] = {
+    { 52, _dot_product_real_52, _dot_product_complex_52 },
+    { 36, _dot_product_real_36, _dot_product_complex_36 },
+};
+
+/**
+ * Find the best dot product for a given number of coefficients: one specialized for that length,
+ * if there is one, or dot_product_real or dot_product_complex otherwise.
+ *
+ * Symmetric coefficients get the folded dot products, except on x86, where adding the mirrored
+ * samples first would need 32-bit lanes and save nothing over pmaddwd.
+ *
+ * \param nr_coeffs The number of coefficients the dot product will be called with
+ * \param is_complex Whether the samples are interleaved complex I/Q, rather than real
+ * \param symmetric Whether the nr_coeffs coefficients are symmetric about their center
+ * \param pfunc The dot product, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t dot_product_find(size_t nr_coeffs, bool is_complex, bool symmetric, dot_product_func_t *pfunc)
+{
+    TSL_ASSERT_ARG(0 != nr_coeffs);
+    TSL_ASSERT_ARG(NULL != pfunc);
+
+    *pfunc = true == is_complex ? dot_product_complex : dot_product_real;
+
+    if (true == symmetric && true == _DOT_PRODUCT_FOLD_SYMMETRIC) {
+        DIAG("Dot product: folding %zu symmetric coefficients", nr_coeffs);
+        *pfunc = true == is_complex ? dot_product_complex_folded : dot_product_real_folded;
+        return A_OK;
+    }
+
+    for (size_t i = 0; i < sizeof(_dot_product_kernels)/sizeof(_dot_product_kernels[0]); i++) {
+        const struct dot_product_kernel *kern = &_dot_product_kernels[i];
+
+        if (kern->nr_coeffs == nr_coeffs) {
+            DIAG("Dot product: using the kernel for %zu coefficients", nr_coeffs);
+            *pfunc = true == is_complex ? kern->complex : kern->real;
+            break;
+        }
+    }
+
+    return A_OK;
+}
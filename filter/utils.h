@@ -2,6 +2,8 @@
 
 #include <tsl/result.h>
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 struct sample_buf;
@@ -10,3 +12,25 @@ aresult_t dot_product_sample_buffers_real(struct sample_buf *sb_active,
         struct sample_buf *sb_next, size_t buf_start_offset,
         int16_t *coeffs, size_t nr_coeffs, int16_t *psample);
 
+aresult_t dot_product_sample_buffers_complex(struct sample_buf *sb_active,
+        struct sample_buf *sb_next, size_t buf_start_offset,
+        int16_t *coeffs, size_t nr_coeffs, int16_t *psample);
+
+aresult_t dot_product_real(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs, int16_t *psample);
+
+aresult_t dot_product_complex(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs, int16_t *psample);
+
+/**
+ * A dot product over a contiguous run of samples, with the signature of dot_product_real and
+ * dot_product_complex.
+ */
+typedef aresult_t (*dot_product_func_t)(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs,
+        int16_t *psample);
+
+aresult_t dot_product_real_folded(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs,
+        int16_t *psample);
+
+aresult_t dot_product_complex_folded(const int16_t *samples, const int16_t *coeffs, size_t nr_coeffs,
+        int16_t *psample);
+
+aresult_t dot_product_find(size_t nr_coeffs, bool is_complex, bool symmetric, dot_product_func_t *pfunc);
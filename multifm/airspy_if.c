@@ -14,6 +14,11 @@
 
 #include <string.h>
 
+/**
+ * The most complex samples the Airspy library hands us in a single transfer
+ */
+#define AIRSPY_NR_SAMPLES               (128 * 1024 * 2)
+
 static
 aresult_t _airspy_worker_thread_delete(struct receiver *rx)
 {
@@ -37,6 +42,8 @@ aresult_t _airspy_worker_thread_delete(struct receiver *rx)
     airspy_close(athr->dev);
     athr->dev = NULL;
 
+    TSL_BUG_IF_FAILED(halfband_decimator_cleanup(&athr->hb));
+
 done:
     return ret;
 }
@@ -48,6 +55,7 @@ int _airspy_on_sample_block(struct airspy_device *dev, void *ctx, airspy_transfe
 
     struct airspy_thread *thr = ctx;
     struct sample_buf *sbuf = NULL;
+    size_t nr_samples = 0;
 
     if (true == thr->rx.muted) {
         /* Don't do anything, we're muted */
@@ -64,9 +72,19 @@ int _airspy_on_sample_block(struct airspy_device *dev, void *ctx, airspy_transfe
 
     DIAG("Received %u samples", transfer->sample_count);
 
-    /* TODO: for now, just memcpy to the output */
-    memcpy(sbuf->data_buf, transfer->samples, transfer->sample_count * sizeof(int16_t) * 2);
-    sbuf->nr_samples = transfer->sample_count;
+    receiver_sample_buf_stamp(&thr->rx, sbuf, transfer->sample_count);
+
+    if ((size_t)transfer->sample_count > thr->max_transfer_samples) {
+        DIAG("Transfer of %u samples is too large for a sample buffer, dropping.", transfer->sample_count);
+        TSL_BUG_IF_FAILED(sample_buf_decref(sbuf));
+        thr->dropped++;
+        goto done;
+    }
+
+    /* Copy the samples out, decimating them with the half-band cascade if asked to */
+    TSL_BUG_IF_FAILED(halfband_decimator_process(&thr->hb, transfer->samples, transfer->sample_count,
+                (int16_t *)sbuf->data_buf, &nr_samples));
+    sbuf->nr_samples = nr_samples;
 
     /* Something has gone very wrong... */
     if (FAILED(receiver_sample_buf_deliver(&thr->rx, sbuf))) {
@@ -111,7 +129,7 @@ done:
     return ret;
 }
 
-aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg)
+aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg, struct config *device)
 {
     aresult_t ret = A_OK;
 
@@ -123,43 +141,43 @@ aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg)
         lna_gain = 1,
         vga_gain = 5,
         mixer_gain = 5,
+        hb_decimation = 1,
         airspy_ret = 0;
-    bool bias_t = false;
-    struct config device = CONFIG_INIT_EMPTY;
+    bool bias_t = false,
+         packed = false;
 
     TSL_ASSERT_ARG(NULL != pthr);
     TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(NULL != device);
 
-    TSL_BUG_IF_FAILED(config_get(cfg, &device, "device"));
-
-    if (FAILED(ret = config_get_integer(cfg, &sample_rate, "sampleRateHz"))) {
+    if (FAILED(ret = receiver_config_get_integer(device, cfg, &sample_rate, "sampleRateHz"))) {
         MFM_MSG(SEV_INFO, "NO-SAMPLE-RATE", "Need to specify a sample rate, in Hertz.");
         goto done;
     }
 
-    if (FAILED(ret = config_get_integer(cfg, &center_freq, "centerFreqHz"))) {
+    if (FAILED(ret = receiver_config_get_integer(device, cfg, &center_freq, "centerFreqHz"))) {
         MFM_MSG(SEV_INFO, "NO-CENTER-FREQ", "You forgot to specify a center frequency, in Hz.");
         goto done;
     }
 
     /* Grab our device serial number, if present */
-    if (FAILED(config_get_integer(&device, &ser_no, "serialNo"))) {
+    if (FAILED(config_get_integer(device, &ser_no, "serialNo"))) {
         /* Not present, so we'll open the first device we find */
         ser_no = -1;
     }
 
     /* Get the LNA gain from the device config */
-    if (FAILED(config_get_integer(&device, &lna_gain, "lnaGain"))) {
+    if (FAILED(config_get_integer(device, &lna_gain, "lnaGain"))) {
         lna_gain = 1;
     }
 
     /* Get the VGA gain from the device config */
-    if (FAILED(config_get_integer(&device, &vga_gain, "vgaGain"))) {
+    if (FAILED(config_get_integer(device, &vga_gain, "vgaGain"))) {
         vga_gain = 5;
     }
 
     /* Get the Mixer gain from the device config */
-    if (FAILED(config_get_integer(&device, &mixer_gain, "mixerGain"))) {
+    if (FAILED(config_get_integer(device, &mixer_gain, "mixerGain"))) {
         mixer_gain = 5;
     }
 
@@ -167,7 +185,7 @@ aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg)
             lna_gain, vga_gain, mixer_gain);
 
     /* Check if we should enable the Bias Tee */
-    if (FAILED(config_get_boolean(&device, &bias_t, "enableBiasTee"))) {
+    if (FAILED(config_get_boolean(device, &bias_t, "enableBiasTee"))) {
         bias_t = false;
     } else {
         if (true == bias_t) {
@@ -175,6 +193,23 @@ aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg)
         }
     }
 
+    /* Packed 12-bit samples need only 3/4 of the USB bandwidth; the library unpacks them for us */
+    if (FAILED(config_get_boolean(device, &packed, "packedSamples"))) {
+        packed = false;
+    }
+
+    /* Optionally decimate on the way in, so every channel sees fewer samples */
+    if (FAILED(config_get_integer(device, &hb_decimation, "halfBandDecimation"))) {
+        hb_decimation = 1;
+    }
+
+    if (1 != hb_decimation && 2 != hb_decimation && 4 != hb_decimation && 8 != hb_decimation) {
+        MFM_MSG(SEV_FATAL, "BAD-HALF-BAND-DECIMATION", "Half-band decimation of %d is not supported, must be "
+                "1, 2, 4 or 8.", hb_decimation);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
     /* Open the device */
     if (-1 != ser_no) {
         if (0 != (airspy_ret = airspy_open_sn(&dev, ser_no))) {
@@ -232,17 +267,42 @@ aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg)
         MFM_MSG(SEV_WARNING, "FAILED-ENABLE-BIAS", "Failed to enable Bias Tee for powering an outside device.");
     }
 
+    if (0 != airspy_set_packing(dev, (true == packed) ? 1 : 0)) {
+        MFM_MSG(SEV_FATAL, "FAILED-SET-PACKING", "Failed to %s packed sample transfers, aborting.",
+                (true == packed) ? "enable" : "disable");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (true == packed) {
+        MFM_MSG(SEV_INFO, "PACKED-SAMPLES", "Transferring packed 12-bit samples from the Airspy");
+    }
+
     /* Create the device object */
     if (FAILED(ret = TZAALLOC(athr, SYS_CACHE_LINE_LENGTH))) {
         goto done;
     }
 
+    /* The device belongs to athr from here on */
     athr->dev = dev;
-    athr->dump_fd = -1;
+    dev = NULL;
+    athr->max_transfer_samples = AIRSPY_NR_SAMPLES;
+
+    if (FAILED(ret = halfband_decimator_init(&athr->hb, hb_decimation))) {
+        goto done;
+    }
+
+    if (1 != hb_decimation) {
+        MFM_MSG(SEV_INFO, "HALF-BAND-DECIMATION", "Decimating Airspy samples by %d with half-band filters",
+                hb_decimation);
+    }
+
+    athr->rx.input_decimation = hb_decimation;
+    athr->rx.local_cfg = device;
 
     /* Initialize the worker thread */
     TSL_BUG_IF_FAILED(receiver_init(&athr->rx, cfg, _airspy_worker_thread, _airspy_worker_thread_delete,
-                128 * 1024 * 2));
+                AIRSPY_NR_SAMPLES / hb_decimation + 1));
 
     *pthr = &athr->rx;
 
@@ -252,6 +312,12 @@ done:
         if (NULL != dev) {
             airspy_close(dev);
         }
+
+        if (NULL != athr) {
+            airspy_close(athr->dev);
+            halfband_decimator_cleanup(&athr->hb);
+            TFREE(athr);
+        }
     }
 
     return ret;
@@ -2,11 +2,13 @@
 
 #include <multifm/receiver.h>
 
+#include <filter/halfband.h>
+
 struct airspy_device;
 struct config;
 
 /**
- * State for the RTL-SDR reader thread
+ * State for the Airspy reader thread
  */
 struct airspy_thread {
     /**
@@ -20,18 +22,30 @@ struct airspy_thread {
     struct airspy_device *dev;
 
     /**
-     * File descriptor to dump raw samples to
+     * The number of buffers we had to discard
      */
-    int dump_fd;
+    uint64_t dropped;
 
     /**
-     * The number of buffers we had to discard
+     * Half-band decimator applied to the samples as they are copied out of the transfer, if any
      */
-    uint64_t dropped;
+    struct halfband_decimator hb;
+
+    /**
+     * The largest number of samples a transfer can hold without overflowing a sample buffer
+     */
+    size_t max_transfer_samples;
 };
 
 /**
- * Create a new
+ * Create a new Airspy receiver.
+ *
+ * \param pthr The new receiver, returned by reference
+ * \param cfg The process-wide configuration
+ * \param device The device stanza. Receiver parameters (i.e. centerFreqHz, channels) given here
+ *               take precedence over the process-wide configuration.
+ *
+ * \return A_OK on success, an error code otherwise.
  */
-aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg);
+aresult_t airspy_worker_thread_new(struct receiver **pthr, struct config *cfg, struct config *device);
 
@@ -0,0 +1,664 @@
+/*
+ *  multifm_bench.c - How many channels the multifm pipeline keeps up with in real time
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/receiver.h>
+#include <multifm/demod.h>
+#include <multifm/demod_pool.h>
+#include <multifm/file_if.h>
+#include <multifm/stats.h>
+
+#include <filter/sample_buf.h>
+
+#include <config/engine.h>
+
+#include <app/app.h>
+
+#include <tsl/diag.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/list.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <complex.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MB_MSG(sev, sys, msg, ...) MESSAGE("MULTIFM-BENCH", sev, sys, msg, ##__VA_ARGS__)
+
+/**
+ * Where the synthetic channels are placed
+ */
+#define MULTIFM_BENCH_CENTER_FREQ_HZ    450000000
+#define MULTIFM_BENCH_SPACING_HZ        12500
+
+/**
+ * The channel filter, designed for the decimated rate
+ */
+#define MULTIFM_BENCH_LPF_TAPS          128
+
+/**
+ * Samples synthesized at a time
+ */
+#define MULTIFM_BENCH_BLOCK_SAMPLES     4096
+
+/**
+ * How often to check if the demodulators have finished, and how many checks in a row they must
+ * be caught up, with no new sample buffers, before the file is taken to have been read through.
+ */
+#define MULTIFM_BENCH_POLL_US           1000
+#define MULTIFM_BENCH_IDLE_POLLS        50
+
+#define MULTIFM_BENCH_MAX_CPUS          256
+
+/**
+ * Busy and total jiffies for each CPU, from /proc/stat
+ */
+struct multifm_bench_cpu_times {
+    size_t nr_cpus;
+    unsigned long long busy[MULTIFM_BENCH_MAX_CPUS];
+    unsigned long long total[MULTIFM_BENCH_MAX_CPUS];
+};
+
+/**
+ * The most channels to run, doubling from 1
+ */
+static
+unsigned max_channels = 64;
+
+/**
+ * The length of the synthesized recording, in seconds
+ */
+static
+unsigned nr_secs = 10;
+
+static
+int sample_rate = 1000000;
+
+static
+int decimation = 40;
+
+/**
+ * The size of the demodulator worker pool, or 0 for a thread per channel
+ */
+static
+int nr_workers = 0;
+
+/**
+ * A capture to replay, as host byte order cs16, rather than synthesizing one
+ */
+static
+const char *in_file = NULL;
+
+/**
+ * Where to write the synthesized recording
+ */
+static
+char synth_file[PATH_MAX] = "/tmp/multifm_bench_XXXXXX";
+
+static
+FILE *json_out = NULL;
+
+static
+FILE *table_out = NULL;
+
+static
+bool json_first = true;
+
+/**
+ * The offset from the center frequency of the given channel
+ */
+static
+int _multifm_bench_offset_hz(unsigned chan)
+{
+    return ((int)chan - (int)max_channels / 2) * MULTIFM_BENCH_SPACING_HZ + MULTIFM_BENCH_SPACING_HZ / 2;
+}
+
+/**
+ * Synthesize a recording with an unmodulated carrier, and a little noise, in each of the
+ * channels. What's in the channels doesn't change how much work it is to demodulate them.
+ */
+static
+aresult_t _multifm_bench_synthesize(const char *path)
+{
+    aresult_t ret = A_OK;
+
+    int fd = -1;
+    float complex *phase = NULL,
+                  *step = NULL;
+    int16_t *block = NULL;
+    float amplitude = 0.9f * 32767.0f / (float)max_channels;
+    uint32_t noise = 1;
+    uint64_t nr_samples = (uint64_t)nr_secs * (uint64_t)sample_rate;
+
+    if (0 > (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600))) {
+        MB_MSG(SEV_FATAL, "CANT-CREATE-FILE", "Unable to create the synthesized recording '%s'", path);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&phase, max_channels, sizeof(float complex))) ||
+            FAILED(ret = TCALLOC((void **)&step, max_channels, sizeof(float complex))) ||
+            FAILED(ret = TCALLOC((void **)&block, MULTIFM_BENCH_BLOCK_SAMPLES, 2 * sizeof(int16_t))))
+    {
+        goto done;
+    }
+
+    for (unsigned c = 0; c < max_channels; c++) {
+        phase[c] = 1.0f;
+        step[c] = cexpf(I * 2.0f * (float)M_PI * (float)_multifm_bench_offset_hz(c) / (float)sample_rate);
+    }
+
+    for (uint64_t done_samples = 0; done_samples < nr_samples; done_samples += MULTIFM_BENCH_BLOCK_SAMPLES) {
+        size_t nr_block = BL_MIN2(nr_samples - done_samples, MULTIFM_BENCH_BLOCK_SAMPLES);
+
+        for (size_t i = 0; i < nr_block; i++) {
+            float complex sum = 0.0f;
+
+            for (unsigned c = 0; c < max_channels; c++) {
+                sum += phase[c];
+                phase[c] *= step[c];
+            }
+
+            sum *= amplitude;
+
+            noise = noise * 1664525u + 1013904223u;
+            block[2 * i] = (int16_t)(crealf(sum) + (float)((int32_t)noise >> 26));
+            block[2 * i + 1] = (int16_t)(cimagf(sum) + (float)((int32_t)(noise << 6) >> 26));
+        }
+
+        /* Keep the phasors from drifting off the unit circle */
+        for (unsigned c = 0; c < max_channels; c++) {
+            phase[c] /= cabsf(phase[c]);
+        }
+
+        if ((ssize_t)(nr_block * 2 * sizeof(int16_t)) != write(fd, block, nr_block * 2 * sizeof(int16_t))) {
+            MB_MSG(SEV_FATAL, "CANT-WRITE-FILE", "Failed to write the synthesized recording '%s'", path);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+done:
+    if (0 <= fd) {
+        close(fd);
+    }
+
+    if (NULL != phase) {
+        TFREE(phase);
+    }
+
+    if (NULL != step) {
+        TFREE(step);
+    }
+
+    if (NULL != block) {
+        TFREE(block);
+    }
+
+    return ret;
+}
+
+/**
+ * Write a multifm configuration replaying the recording as fast as the demodulators can keep
+ * up, with nr_channels channels written to /dev/null.
+ */
+static
+aresult_t _multifm_bench_config_write(const char *path, const char *recording, unsigned nr_channels)
+{
+    aresult_t ret = A_OK;
+
+    FILE *fp = NULL;
+    double cutoff = 0.4 / (double)decimation,
+           taps[MULTIFM_BENCH_LPF_TAPS],
+           sum = 0.0;
+
+    if (NULL == (fp = fopen(path, "w"))) {
+        MB_MSG(SEV_FATAL, "CANT-CREATE-CONFIG", "Unable to create benchmark configuration '%s'", path);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* Hamming windowed sinc, with unity gain at DC */
+    for (size_t i = 0; i < MULTIFM_BENCH_LPF_TAPS; i++) {
+        double n = (double)i - (double)(MULTIFM_BENCH_LPF_TAPS - 1) / 2.0,
+               sinc = 0.0 == n ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * n) / (M_PI * n);
+
+        taps[i] = sinc * (0.54 - 0.46 * cos(2.0 * M_PI * (double)i / (double)(MULTIFM_BENCH_LPF_TAPS - 1)));
+        sum += taps[i];
+    }
+
+    fprintf(fp, "{\n  \"device\" : { \"type\" : \"file\", \"filename\" : \"%s\", \"fileFormat\" : \"cs16\", "
+            "\"maxSpeed\" : true },\n", recording);
+    fprintf(fp, "  \"sampleRateHz\" : %d,\n  \"centerFreqHz\" : %d,\n  \"nrSampBufs\" : 128,\n"
+            "  \"decimationFactor\" : %d,\n", sample_rate, MULTIFM_BENCH_CENTER_FREQ_HZ, decimation);
+
+    if (0 != nr_workers) {
+        fprintf(fp, "  \"demodWorkerThreads\" : %d,\n", nr_workers);
+    }
+
+    fprintf(fp, "  \"lpfTaps\" : [");
+    for (size_t i = 0; i < MULTIFM_BENCH_LPF_TAPS; i++) {
+        fprintf(fp, "%s%.17g", 0 == i ? "" : ", ", taps[i] / sum);
+    }
+    fprintf(fp, "],\n  \"channels\" : [");
+
+    for (unsigned c = 0; c < nr_channels; c++) {
+        fprintf(fp, "%s\n    { \"outFifo\" : \"/dev/null\", \"chanCenterFreq\" : %d }", 0 == c ? "" : ",",
+                MULTIFM_BENCH_CENTER_FREQ_HZ + _multifm_bench_offset_hz(c));
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+
+    if (0 != fclose(fp)) {
+        ret = A_E_INVAL;
+    }
+    fp = NULL;
+
+done:
+    if (NULL != fp) {
+        fclose(fp);
+    }
+
+    return ret;
+}
+
+static
+void _multifm_bench_cpu_times(struct multifm_bench_cpu_times *times)
+{
+    FILE *fp = NULL;
+    char line[256];
+
+    times->nr_cpus = 0;
+
+    if (NULL == (fp = fopen("/proc/stat", "r"))) {
+        return;
+    }
+
+    while (NULL != fgets(line, sizeof(line), fp) && times->nr_cpus < MULTIFM_BENCH_MAX_CPUS) {
+        unsigned long long user = 0, nice = 0, sys = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+        unsigned cpu = 0;
+
+        /* Skip the total line, only the per-CPU lines have a number */
+        if (strncmp(line, "cpu", 3) || 9 != sscanf(line, "cpu%u %llu %llu %llu %llu %llu %llu %llu %llu",
+                    &cpu, &user, &nice, &sys, &idle, &iowait, &irq, &softirq, &steal))
+        {
+            continue;
+        }
+
+        times->busy[times->nr_cpus] = user + nice + sys + irq + softirq + steal;
+        times->total[times->nr_cpus] = times->busy[times->nr_cpus] + idle + iowait;
+        times->nr_cpus++;
+    }
+
+    fclose(fp);
+}
+
+static
+uint64_t _multifm_bench_cpu_ns(void)
+{
+    struct rusage ru;
+
+    if (0 != getrusage(RUSAGE_SELF, &ru)) {
+        return 0;
+    }
+
+    return ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000ull +
+        ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000ull;
+}
+
+/**
+ * Check if every demodulator has processed, or dropped, every sample buffer delivered so far
+ */
+static
+bool _multifm_bench_caught_up(struct receiver *rx, uint64_t nr_delivered)
+{
+    struct demod_thread *dthr = NULL;
+
+    list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+        struct demod_stats *st = &dthr->stats;
+
+        if (stats_counter_read(&st->nr_bufs) + stats_counter_read(&st->nr_filter_drops) +
+                stats_counter_read(&st->nr_ring_full_drops) + stats_counter_read(&st->nr_shed_bufs) != nr_delivered)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Run the recording through a receiver with the given number of channels, and report how it did
+ */
+static
+aresult_t _multifm_bench_run(const char *recording, uint64_t nr_samples, unsigned nr_channels)
+{
+    aresult_t ret = A_OK;
+
+    char cfg_path[] = "/tmp/multifm_bench_XXXXXX.json";
+    int cfg_fd = -1;
+    struct config *cfg = NULL;
+    struct config device = CONFIG_INIT_EMPTY;
+    struct receiver *rx = NULL;
+    struct demod_pool *pool = NULL;
+    struct multifm_bench_cpu_times *before = NULL,
+                                   *after = NULL;
+    uint64_t start_ns = 0,
+             end_ns = 0,
+             start_cpu_ns = 0,
+             cpu_ns = 0,
+             nr_delivered = 0;
+    unsigned nr_idle = 0;
+    double elapsed_secs = 0.0,
+           rt_factor = 0.0;
+
+    if (FAILED(ret = TZAALLOC(before, SYS_CACHE_LINE_LENGTH)) ||
+            FAILED(ret = TZAALLOC(after, SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    if (0 > (cfg_fd = mkstemps(cfg_path, 5))) {
+        MB_MSG(SEV_FATAL, "CANT-CREATE-CONFIG", "Unable to create a temporary configuration file");
+        ret = A_E_INVAL;
+        goto done;
+    }
+    close(cfg_fd);
+
+    if (FAILED(ret = _multifm_bench_config_write(cfg_path, recording, nr_channels))) {
+        goto done;
+    }
+
+    TSL_BUG_IF_FAILED(config_new(&cfg));
+
+    if (FAILED(ret = config_add(cfg, cfg_path)) ||
+            FAILED(ret = config_get(cfg, &device, "device")) ||
+            FAILED(ret = file_worker_thread_new(&rx, cfg, &device)) ||
+            FAILED(ret = receiver_demod_pool_new(&pool, &rx, 1, cfg)))
+    {
+        MB_MSG(SEV_FATAL, "SETUP-FAILED", "Failed to set up a receiver with %u channels", nr_channels);
+        goto done;
+    }
+
+    if (NULL != pool) {
+        TSL_BUG_IF_FAILED(demod_pool_start(pool));
+    }
+
+    /* Every channel has to see the whole recording, or the run isn't comparable */
+    if (FAILED(ret = receiver_setup_wait(rx))) {
+        MB_MSG(SEV_FATAL, "SETUP-FAILED", "Failed to set up all %u channels", nr_channels);
+        goto done;
+    }
+
+    _multifm_bench_cpu_times(before);
+    start_cpu_ns = _multifm_bench_cpu_ns();
+    start_ns = sample_buf_now_ns();
+
+    TSL_BUG_IF_FAILED(receiver_set_mute(rx, false));
+    TSL_BUG_IF_FAILED(receiver_start(rx));
+
+    /*
+     * The file is replayed as fast as the demodulators take the samples, so once they're caught
+     * up and no more are coming, it has been read through.
+     */
+    while (nr_idle < MULTIFM_BENCH_IDLE_POLLS) {
+        uint64_t nr_seen = __atomic_load_n(&rx->last_seq, __ATOMIC_ACQUIRE);
+
+        usleep(MULTIFM_BENCH_POLL_US);
+
+        if (0 != nr_seen && nr_seen == nr_delivered && true == _multifm_bench_caught_up(rx, nr_seen)) {
+            nr_idle++;
+            continue;
+        }
+
+        nr_delivered = nr_seen;
+        nr_idle = 0;
+        end_ns = sample_buf_now_ns();
+        cpu_ns = _multifm_bench_cpu_ns() - start_cpu_ns;
+        _multifm_bench_cpu_times(after);
+    }
+
+    elapsed_secs = (double)(end_ns - start_ns) / 1e9;
+    rt_factor = (double)nr_samples / (double)sample_rate / elapsed_secs;
+
+    fprintf(table_out, "%8u %8d %12.3f %10.3f %10.2f %10.2f  ", nr_channels, nr_workers, elapsed_secs,
+            (double)nr_samples / elapsed_secs / 1e6, rt_factor, (double)cpu_ns / (double)(end_ns - start_ns));
+
+    if (NULL != json_out) {
+        fprintf(json_out, "%s\n    { \"channels\": %u, \"workers\": %d, \"samples\": %llu, \"elapsed_ns\": %llu, "
+                "\"cpu_ns\": %llu, \"samples_per_sec\": %.1f, \"real_time_factor\": %.3f, \"core_busy_pct\": [",
+                true == json_first ? "" : ",", nr_channels, nr_workers, (unsigned long long)nr_samples,
+                (unsigned long long)(end_ns - start_ns), (unsigned long long)cpu_ns,
+                (double)nr_samples / elapsed_secs, rt_factor);
+        json_first = false;
+    }
+
+    for (size_t i = 0; i < BL_MIN2(before->nr_cpus, after->nr_cpus); i++) {
+        unsigned long long total = after->total[i] - before->total[i];
+        double busy_pct = 0 == total ? 0.0 : 100.0 * (double)(after->busy[i] - before->busy[i]) / (double)total;
+
+        fprintf(table_out, "%s%3.0f", 0 == i ? "" : " ", busy_pct);
+
+        if (NULL != json_out) {
+            fprintf(json_out, "%s%.1f", 0 == i ? "" : ", ", busy_pct);
+        }
+    }
+
+    fprintf(table_out, "\n");
+
+    if (NULL != json_out) {
+        fprintf(json_out, "] }");
+    }
+
+done:
+    if (NULL != pool) {
+        receiver_demod_pool_delete(&pool, &rx, 1);
+    }
+
+    if (NULL != rx) {
+        receiver_cleanup(&rx);
+    }
+
+    demod_coeff_cache_flush();
+
+    if (NULL != cfg) {
+        config_delete(&cfg);
+    }
+
+    if (0 <= cfg_fd) {
+        /* Closed already, but we created the file */
+        unlink(cfg_path);
+    }
+
+    if (NULL != before) {
+        TFREE(before);
+    }
+
+    if (NULL != after) {
+        TFREE(after);
+    }
+
+    return ret;
+}
+
+static
+void _usage(const char *appname)
+{
+    MB_MSG(SEV_INFO, "USAGE", "%s [-c max channels] [-s seconds] [-r sample rate] [-d decimation] [-w workers] [-i capture] [-j json output file]", appname);
+    MB_MSG(SEV_INFO, "USAGE", "        -c      Run 1, 2, 4... up to this many channels (default 64)");
+    MB_MSG(SEV_INFO, "USAGE", "        -s      Seconds of samples to synthesize (default 10)");
+    MB_MSG(SEV_INFO, "USAGE", "        -r      Sample rate, in Hz (default 1000000)");
+    MB_MSG(SEV_INFO, "USAGE", "        -d      Decimation to each channel's rate (default 40)");
+    MB_MSG(SEV_INFO, "USAGE", "        -w      Demodulator worker threads, 0 for a thread per channel (default 0)");
+    MB_MSG(SEV_INFO, "USAGE", "        -i      Replay this host byte order cs16 capture, rather than synthesizing one");
+    MB_MSG(SEV_INFO, "USAGE", "        -j      Write the results as JSON to this file, or - for stdout");
+    exit(EXIT_SUCCESS);
+}
+
+static
+void _set_options(int argc, char * const argv[])
+{
+    int arg = -1;
+    const char *json_file = NULL;
+
+    while ((arg = getopt(argc, argv, "c:s:r:d:w:i:j:h")) != -1) {
+        switch (arg) {
+        case 'c':
+            max_channels = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            nr_secs = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            sample_rate = strtol(optarg, NULL, 0);
+            break;
+        case 'd':
+            decimation = strtol(optarg, NULL, 0);
+            break;
+        case 'w':
+            nr_workers = strtol(optarg, NULL, 0);
+            break;
+        case 'i':
+            in_file = optarg;
+            break;
+        case 'j':
+            json_file = optarg;
+            break;
+        case 'h':
+            _usage(argv[0]);
+            break;
+        }
+    }
+
+    if (0 == max_channels || 0 == nr_secs || 0 >= sample_rate || 0 >= decimation || 0 > nr_workers) {
+        MB_MSG(SEV_FATAL, "BAD-ARGUMENTS", "Channels, seconds, sample rate and decimation must be positive.");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Every channel has to fit in the band, clear of the edges */
+    if ((int)(max_channels / 2 + 1) * MULTIFM_BENCH_SPACING_HZ > sample_rate / 2) {
+        MB_MSG(SEV_FATAL, "TOO-MANY-CHANNELS", "%u channels %d Hz apart don't fit in %d Hz", max_channels,
+                MULTIFM_BENCH_SPACING_HZ, sample_rate);
+        exit(EXIT_FAILURE);
+    }
+
+    if (NULL != json_file) {
+        if (!strcmp(json_file, "-")) {
+            json_out = stdout;
+        } else if (NULL == (json_out = fopen(json_file, "w"))) {
+            MB_MSG(SEV_FATAL, "BAD-JSON-FILE", "Failed to open %s for writing", json_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int main(int argc, char * const argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    struct utsname uts;
+    struct stat st;
+    const char *recording = NULL;
+    int synth_fd = -1;
+    uint64_t nr_samples = 0;
+
+    TSL_BUG_IF_FAILED(app_init("multifm_bench", NULL));
+
+    _set_options(argc, argv);
+
+    recording = in_file;
+
+    if (0 != uname(&uts)) {
+        strcpy(uts.machine, "unknown");
+    }
+
+    MB_MSG(SEV_INFO, "STARTING", "multifm channel scaling benchmark, version %s, %s, %ld CPUs", _VC_VERSION,
+            uts.machine, sysconf(_SC_NPROCESSORS_ONLN));
+
+    if (NULL == recording) {
+        if (0 > (synth_fd = mkstemp(synth_file))) {
+            MB_MSG(SEV_FATAL, "CANT-CREATE-FILE", "Unable to create a file for the synthesized recording");
+            goto done;
+        }
+        close(synth_fd);
+
+        MB_MSG(SEV_INFO, "SYNTHESIZING", "Synthesizing %u seconds of %u channels at %d Hz", nr_secs, max_channels,
+                sample_rate);
+
+        if (FAILED(_multifm_bench_synthesize(synth_file))) {
+            goto done;
+        }
+
+        recording = synth_file;
+    }
+
+    if (0 != stat(recording, &st) || 0 == (nr_samples = st.st_size / (2 * sizeof(int16_t)))) {
+        MB_MSG(SEV_FATAL, "BAD-RECORDING", "Recording '%s' is missing or empty", recording);
+        goto done;
+    }
+
+    if (NULL != json_out) {
+        fprintf(json_out, "{ \"version\": \"%s\", \"machine\": \"%s\", \"sample_rate\": %d, \"decimation\": %d, "
+                "\"results\": [", _VC_VERSION, uts.machine, sample_rate, decimation);
+    }
+
+    /* Keep the JSON on stdout parseable */
+    table_out = stdout == json_out ? stderr : stdout;
+
+    fprintf(table_out, "%8s %8s %12s %10s %10s %10s  %s\n", "channels", "workers", "elapsed (s)", "Msample/s",
+            "x realtime", "cores", "busy % per core");
+
+    for (unsigned nr_channels = 1; nr_channels <= max_channels; nr_channels *= 2) {
+        if (FAILED(_multifm_bench_run(recording, nr_samples, nr_channels))) {
+            goto done;
+        }
+
+        /* Finish with the full count, even if it isn't a power of 2 */
+        if (nr_channels < max_channels && nr_channels * 2 > max_channels) {
+            nr_channels = max_channels / 2;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    if (NULL != json_out) {
+        fprintf(json_out, "\n] }\n");
+        if (stdout != json_out) {
+            fclose(json_out);
+        }
+    }
+
+    if (0 <= synth_fd) {
+        unlink(synth_file);
+    }
+
+    return ret;
+}
@@ -0,0 +1,620 @@
+/*
+ *  channelizer.c - Shared polyphase channelizer stage for multifm
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/channelizer.h>
+#include <multifm/receiver.h>
+#include <multifm/demod.h>
+#include <multifm/sample_buf_pool.h>
+#include <multifm/multifm.h>
+
+#include <filter/pfb_channelizer.h>
+#include <filter/sample_buf.h>
+#include <filter/sample_trace.h>
+
+#include <config/engine.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+
+#include <stdatomic.h>
+#include <string.h>
+
+#define CHANNELIZER_DEFAULT_TAPS_PER_CHANNEL        12
+#define CHANNELIZER_DEFAULT_BUFS_PER_CHANNEL        64
+#define CHANNELIZER_DEFAULT_BATCH_BUFS              4
+
+/**
+ * Grab an output buffer for each channel someone is listening to
+ */
+static
+void _channelizer_alloc_outputs(struct channelizer *chan)
+{
+    for (unsigned i = 0; i < chan->nr_channels; i++) {
+        chan->out_bufs[i] = NULL;
+        chan->out_ptrs[i] = NULL;
+
+        if (0 == chan->channel_refs[i]) {
+            continue;
+        }
+
+        if (FAILED(sample_buf_pool_alloc(chan->samp_alloc, &chan->out_bufs[i]))) {
+            if (0 == chan->nr_samp_buf_alloc_fails) {
+                MFM_MSG(SEV_INFO, "NO-CHANNELIZER-BUFFER", "There are no available channelizer sample buffers, dropping channelized samples.");
+            }
+            chan->nr_samp_buf_alloc_fails++;
+            chan->out_bufs[i] = NULL;
+
+            /* Keep the filter bank state moving, but throw the output away */
+            chan->out_ptrs[i] = chan->scratch;
+            continue;
+        }
+
+        chan->out_ptrs[i] = (int16_t *)chan->out_bufs[i]->data_buf;
+    }
+}
+
+/**
+ * Hand the output for each active channel to the demodulator threads consuming it
+ */
+static
+void _channelizer_deliver_outputs(struct channelizer *chan, size_t nr_out, uint64_t start_time_ns, uint64_t seq,
+        uint64_t deliver_ns)
+{
+    struct demod_thread *dthr = NULL;
+
+    demod_shed_begin(&chan->rx->shed);
+
+    for (unsigned i = 0; i < chan->nr_channels; i++) {
+        struct sample_buf *obuf = chan->out_bufs[i];
+
+        if (NULL == obuf) {
+            continue;
+        }
+
+        chan->out_bufs[i] = NULL;
+
+        if (0 == nr_out) {
+            /* Not enough samples accumulated to produce an output, yet */
+            TSL_BUG_IF_FAILED(sample_buf_pool_free(chan->samp_alloc, obuf));
+            continue;
+        }
+
+        obuf->sample_type = COMPLEX_INT_16;
+        obuf->nr_samples = nr_out;
+        obuf->sample_buf_bytes = nr_out * 2 * sizeof(int16_t);
+        obuf->start_time_ns = start_time_ns;
+        obuf->seq = seq;
+        obuf->deliver_ns = deliver_ns;
+        atomic_store(&obuf->refcount, chan->channel_refs[i]);
+
+        list_for_each_type(dthr, &chan->rx->demod_threads, dt_node) {
+            if (dthr->channelizer_channel == i) {
+                TSL_BUG_IF_FAILED(demod_thread_deliver(dthr, obuf, &chan->rx->shed));
+            }
+        }
+    }
+
+    demod_shed_end(&chan->rx->shed);
+}
+
+/**
+ * Channelize a single input buffer, and hand the output for each active channel to the
+ * demodulator threads consuming it.
+ */
+static
+aresult_t _channelizer_process(struct channelizer *chan, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0;
+    uint64_t start_time_ns = buf->start_time_ns,
+             seq = buf->seq,
+             process_ns = sample_trace_now_ns(),
+             deliver_ns = 0;
+
+    sample_trace_record(SAMPLE_TRACE_QUEUE, seq, buf->deliver_ns, process_ns);
+
+    _channelizer_alloc_outputs(chan);
+
+    TSL_BUG_IF_FAILED(pfb_channelizer_process(chan->pfb, (int16_t *)buf->data_buf, buf->nr_samples,
+                chan->out_ptrs, chan->max_out_samples, &nr_out));
+
+    chan->total_nr_samples += buf->nr_samples;
+
+    /* We're done with the full-rate samples */
+    TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+    buf = NULL;
+
+    deliver_ns = sample_trace_now_ns();
+    sample_trace_record(SAMPLE_TRACE_CHANNELIZE, seq, process_ns, deliver_ns);
+
+    _channelizer_deliver_outputs(chan, nr_out, start_time_ns, seq, deliver_ns);
+
+    return ret;
+}
+
+#ifdef HAVE_OPENCL
+/**
+ * Collect the oldest accelerator dispatch, and hand its output to the demodulator threads
+ */
+static
+aresult_t _channelizer_cl_collect(struct channelizer *chan)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_out = 0;
+    unsigned head = chan->batch_head;
+    uint64_t deliver_ns = 0;
+
+    _channelizer_alloc_outputs(chan);
+
+    if (FAILED(ret = channelizer_cl_collect(chan->cl, chan->out_ptrs, &nr_out))) {
+        /* Hand back the output buffers, nothing was written to them */
+        nr_out = 0;
+    }
+
+    chan->batch_head = (head + 1) % CHANNELIZER_CL_NR_SLOTS;
+
+    deliver_ns = sample_trace_now_ns();
+    sample_trace_record(SAMPLE_TRACE_CHANNELIZE, chan->batch_seq[head], chan->batch_dispatch_ns[head], deliver_ns);
+
+    _channelizer_deliver_outputs(chan, nr_out, chan->batch_start_time_ns[head], chan->batch_seq[head], deliver_ns);
+
+    return ret;
+}
+
+/**
+ * Hand a batch of input buffers to the accelerator, and pick up any output that is due. While
+ * the input keeps up, each batch is collected once the next one has been dispatched, so the
+ * transfers and the kernels for one overlap staging the other. Once the input dries up, the
+ * last batch is collected straight away.
+ *
+ * \param chan The channelizer
+ * \param pidle Set to true if there was nothing at all to do, returned by reference
+ */
+static
+aresult_t _channelizer_cl_service(struct channelizer *chan, bool *pidle)
+{
+    aresult_t ret = A_OK;
+
+    unsigned nr_bufs = 0,
+             nr_pending = 0;
+
+    *pidle = false;
+
+    while (nr_bufs < chan->batch_bufs && channelizer_cl_space(chan->cl) >= chan->samples_per_buf) {
+        struct sample_buf *buf = NULL;
+
+        TSL_BUG_IF_FAILED(spsc_ring_pop(&chan->ring, (void **)&buf));
+        if (NULL == buf) {
+            break;
+        }
+
+        sample_trace_record(SAMPLE_TRACE_QUEUE, buf->seq, buf->deliver_ns, sample_trace_now_ns());
+
+        if (false == chan->batch_staged) {
+            chan->staged_start_time_ns = buf->start_time_ns;
+            chan->staged_seq = buf->seq;
+            chan->batch_staged = true;
+        }
+
+        TSL_BUG_IF_FAILED(channelizer_cl_append(chan->cl, (int16_t *)buf->data_buf, buf->nr_samples));
+        chan->total_nr_samples += buf->nr_samples;
+
+        TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+        nr_bufs++;
+    }
+
+    nr_pending = channelizer_cl_nr_pending(chan->cl);
+
+    if (0 != nr_bufs) {
+        if (FAILED(ret = channelizer_cl_dispatch(chan->cl))) {
+            goto done;
+        }
+
+        /* Too few samples for an output stay staged for the next dispatch */
+        if (channelizer_cl_nr_pending(chan->cl) != nr_pending) {
+            unsigned slot = (chan->batch_head + nr_pending) % CHANNELIZER_CL_NR_SLOTS;
+            chan->batch_start_time_ns[slot] = chan->staged_start_time_ns;
+            chan->batch_seq[slot] = chan->staged_seq;
+            chan->batch_dispatch_ns[slot] = sample_trace_now_ns();
+            chan->batch_staged = false;
+            nr_pending++;
+        }
+    }
+
+    /* The next batch can't be staged until its slot is collected */
+    if (CHANNELIZER_CL_NR_SLOTS == nr_pending || (0 == nr_bufs && 0 != nr_pending)) {
+        ret = _channelizer_cl_collect(chan);
+    } else if (0 == nr_bufs) {
+        *pidle = true;
+    }
+
+done:
+    return ret;
+}
+#endif /* defined(HAVE_OPENCL) */
+
+static
+aresult_t _channelizer_thread_work(struct worker_thread *wthr)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer *chan = BL_CONTAINER_OF(wthr, struct channelizer, wthr);
+
+    while (worker_thread_is_running(wthr)) {
+        struct sample_buf *buf = NULL;
+
+#ifdef HAVE_OPENCL
+        if (NULL != chan->cl) {
+            bool idle = false;
+
+            TSL_BUG_IF_FAILED(_channelizer_cl_service(chan, &idle));
+            if (true == idle) {
+                TSL_BUG_IF_FAILED(spsc_ring_wait(&chan->ring, 1000));
+            }
+
+            continue;
+        }
+#endif
+
+        TSL_BUG_IF_FAILED(spsc_ring_pop(&chan->ring, (void **)&buf));
+
+        if (NULL != buf) {
+            TSL_BUG_IF_FAILED(_channelizer_process(chan, buf));
+        } else {
+            /* Sleep until the acquisition thread wakes us up */
+            TSL_BUG_IF_FAILED(spsc_ring_wait(&chan->ring, 1000));
+        }
+    }
+
+    DIAG("Channelized %zu samples before termination.", chan->total_nr_samples);
+
+    return ret;
+}
+
+aresult_t channelizer_new(struct channelizer **pchan, struct receiver *rx, struct config *cfg,
+        uint32_t sample_rate, size_t samples_per_buf)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer *chan = NULL;
+    double *proto_taps = NULL;
+    size_t nr_proto_taps = 0;
+    const char *accelerator = NULL;
+    int nr_channels = 0,
+        taps_per_channel = CHANNELIZER_DEFAULT_TAPS_PER_CHANNEL,
+        nr_bufs = CHANNELIZER_DEFAULT_BUFS_PER_CHANNEL,
+        batch_bufs = CHANNELIZER_DEFAULT_BATCH_BUFS;
+
+    TSL_ASSERT_ARG(NULL != pchan);
+    TSL_ASSERT_ARG(NULL != rx);
+    TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(0 != sample_rate);
+    TSL_ASSERT_ARG(0 != samples_per_buf);
+
+    *pchan = NULL;
+
+    if (FAILED(ret = config_get_integer(cfg, &nr_channels, "nrChannels"))) {
+        MFM_MSG(SEV_ERROR, "NO-CHANNELIZER-CHANNELS", "Need to specify the number of channelizer channels as 'nrChannels'.");
+        goto done;
+    }
+
+    if (0 >= nr_channels) {
+        MFM_MSG(SEV_ERROR, "BAD-CHANNELIZER-CHANNELS", "Channelizer channel count of '%d' is not valid.", nr_channels);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(config_get_integer(cfg, &nr_bufs, "nrSampBufs"))) {
+        nr_bufs = CHANNELIZER_DEFAULT_BUFS_PER_CHANNEL;
+    }
+
+    if (0 >= nr_bufs) {
+        MFM_MSG(SEV_ERROR, "BAD-CHANNELIZER-BUFS", "Channelizer sample buffer count of '%d' is not valid.", nr_bufs);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* Use the provided prototype filter, or design one if none was given */
+    if (FAILED(config_get_float_array(cfg, &proto_taps, &nr_proto_taps, "prototypeTaps"))) {
+        if (FAILED(config_get_integer(cfg, &taps_per_channel, "tapsPerChannel"))) {
+            taps_per_channel = CHANNELIZER_DEFAULT_TAPS_PER_CHANNEL;
+        }
+
+        if (0 >= taps_per_channel) {
+            MFM_MSG(SEV_ERROR, "BAD-CHANNELIZER-TAPS", "Channelizer taps per channel of '%d' is not valid.", taps_per_channel);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        nr_proto_taps = (size_t)nr_channels * (size_t)taps_per_channel;
+
+        if (FAILED(ret = TACALLOC((void **)&proto_taps, nr_proto_taps, sizeof(double), SYS_CACHE_LINE_LENGTH))) {
+            MFM_MSG(SEV_FATAL, "NO-MEM", "Out of memory for channelizer prototype filter.");
+            goto done;
+        }
+
+        if (FAILED(ret = pfb_channelizer_design_prototype(proto_taps, nr_proto_taps, nr_channels))) {
+            MFM_MSG(SEV_ERROR, "BAD-CHANNELIZER-PROTOTYPE", "Failed to design channelizer prototype filter.");
+            goto done;
+        }
+    }
+
+    if (FAILED(ret = TZAALLOC(chan, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    chan->ring.wake_fd = -1;
+
+    chan->rx = rx;
+    chan->nr_channels = nr_channels;
+    chan->sample_rate = sample_rate;
+    chan->nr_bufs_per_channel = nr_bufs;
+
+    if (FAILED(ret = pfb_channelizer_new(&chan->pfb, nr_channels, proto_taps, nr_proto_taps))) {
+        MFM_MSG(SEV_ERROR, "BAD-CHANNELIZER", "Failed to create a %d channel channelizer. The channel count must be a power of 2.",
+                nr_channels);
+        goto done;
+    }
+
+    chan->out_sample_rate = sample_rate / pfb_channelizer_hop(chan->pfb);
+    chan->max_out_samples = pfb_channelizer_max_outputs(chan->pfb, samples_per_buf);
+    chan->samples_per_buf = samples_per_buf;
+
+    if (!FAILED(config_get_string(cfg, &accelerator, "accelerator")) && strcmp(accelerator, "none")) {
+        if (strcmp(accelerator, "opencl")) {
+            MFM_MSG(SEV_ERROR, "BAD-CHANNELIZER-ACCELERATOR", "Unknown channelizer accelerator '%s', must be 'opencl' or 'none'.",
+                    accelerator);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        config_get_integer(cfg, &batch_bufs, "batchBufs");
+
+        if (0 >= batch_bufs) {
+            MFM_MSG(SEV_ERROR, "BAD-CHANNELIZER-BATCH", "Channelizer batch of '%d' buffers is not valid.", batch_bufs);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        chan->batch_bufs = batch_bufs;
+
+#ifdef HAVE_OPENCL
+        MFM_MSG(SEV_WARNING, "OPENCL-CHANNELIZER-EXPERIMENTAL", "The OpenCL channelizer is experimental. Check "
+                "test_multifm passes on this device before relying on it.");
+
+        if (FAILED(ret = channelizer_cl_new(&chan->cl, cfg, nr_channels, proto_taps, nr_proto_taps,
+                        (size_t)batch_bufs * samples_per_buf)))
+        {
+            MFM_MSG(SEV_ERROR, "NO-CHANNELIZER-ACCELERATOR", "Failed to set up the OpenCL channelizer.");
+            goto done;
+        }
+
+        chan->max_out_samples = channelizer_cl_max_outputs(chan->cl);
+#else
+        MFM_MSG(SEV_ERROR, "OPENCL-NOT-SUPPORTED", "The OpenCL channelizer is not supported by this build.");
+        ret = A_E_INVAL;
+        goto done;
+#endif
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&chan->channel_refs, nr_channels, sizeof(unsigned)))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&chan->out_bufs, nr_channels, sizeof(struct sample_buf *)))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&chan->out_ptrs, nr_channels, sizeof(int16_t *)))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&chan->scratch, chan->max_out_samples, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (FAILED(ret = spsc_ring_init(&chan->ring, 128))) {
+        goto done;
+    }
+
+    MFM_MSG(SEV_INFO, "CHANNELIZER", "Channelizer: %d channels, %zu prototype taps, %u Hz per channel output",
+            nr_channels, nr_proto_taps, chan->out_sample_rate);
+
+    *pchan = chan;
+
+done:
+    if (NULL != proto_taps) {
+        TFREE(proto_taps);
+    }
+
+    if (FAILED(ret)) {
+        if (NULL != chan) {
+            channelizer_delete(&chan);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t channelizer_assign(struct channelizer *chan, int32_t offset_hz, unsigned *pchannel, int32_t *presidual_hz)
+{
+    aresult_t ret = A_OK;
+
+    unsigned channel = 0;
+
+    TSL_ASSERT_ARG(NULL != chan);
+    TSL_ASSERT_ARG(NULL != pchannel);
+    TSL_ASSERT_ARG(NULL != presidual_hz);
+
+    if (FAILED(ret = pfb_channelizer_channel_for_offset(chan->pfb, chan->sample_rate, offset_hz, &channel, presidual_hz))) {
+        MFM_MSG(SEV_ERROR, "CHANNEL-OUT-OF-BAND", "Channel offset %d Hz is outside of the received bandwidth.", offset_hz);
+        goto done;
+    }
+
+    if (0 == chan->channel_refs[channel]) {
+        chan->nr_active_channels++;
+    }
+
+    chan->channel_refs[channel]++;
+
+    *pchannel = channel;
+
+done:
+    return ret;
+}
+
+unsigned channelizer_decimation(struct channelizer *chan)
+{
+    TSL_BUG_ON(NULL == chan);
+
+    return pfb_channelizer_hop(chan->pfb);
+}
+
+aresult_t channelizer_start(struct channelizer *chan)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != chan);
+    TSL_ASSERT_ARG(NULL == chan->samp_alloc);
+
+    if (0 == chan->nr_active_channels) {
+        MFM_MSG(SEV_ERROR, "NO-CHANNELIZER-CONSUMERS", "No channels were assigned to the channelizer.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = sample_buf_pool_new(&chan->samp_alloc,
+                    sizeof(struct sample_buf) + chan->max_out_samples * 2 * sizeof(int16_t),
+                    chan->nr_active_channels * chan->nr_bufs_per_channel,
+                    chan->rx->samp_buf_hugepages, chan->rx->samp_buf_numa_node)))
+    {
+        MFM_MSG(SEV_FATAL, "NO-MEM", "Out of memory for channelizer sample buffers.");
+        goto done;
+    }
+
+    if (FAILED(ret = worker_thread_new(&chan->wthr, _channelizer_thread_work, WORKER_THREAD_CPU_MASK_ANY))) {
+        MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start channelizer thread, aborting.");
+        TSL_BUG_IF_FAILED(sample_buf_pool_delete(&chan->samp_alloc));
+        goto done;
+    }
+
+done:
+    return ret;
+}
+
+aresult_t channelizer_deliver(struct channelizer *chan, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != chan);
+    TSL_ASSERT_ARG_DEBUG(NULL != buf);
+
+    if (FAILED(spsc_ring_push(&chan->ring, buf))) {
+        if (0 == chan->nr_ring_full_drops) {
+            MFM_MSG(SEV_WARNING, "CHANNELIZER-FALLING-BEHIND", "Channelizer is not keeping up, dropping sample buffers.");
+        }
+        chan->nr_ring_full_drops++;
+        TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+    }
+
+    return ret;
+}
+
+aresult_t channelizer_stop(struct channelizer *chan)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    TSL_ASSERT_ARG(NULL != chan);
+
+    /* The sample buffer allocator only exists once the thread has been started */
+    if (NULL != chan->samp_alloc) {
+        TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&chan->wthr));
+        TSL_BUG_IF_FAILED(worker_thread_delete(&chan->wthr));
+    }
+
+    /* Release anything the receiver handed us that we never got to */
+    do {
+        buf = NULL;
+        TSL_BUG_IF_FAILED(spsc_ring_pop(&chan->ring, (void **)&buf));
+        if (NULL != buf) {
+            TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+        }
+    } while (NULL != buf);
+
+    return ret;
+}
+
+aresult_t channelizer_delete(struct channelizer **pchan)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer *chan = NULL;
+
+    TSL_ASSERT_ARG(NULL != pchan);
+    TSL_ASSERT_ARG(NULL != *pchan);
+
+    chan = *pchan;
+
+    TSL_BUG_IF_FAILED(spsc_ring_cleanup(&chan->ring));
+
+    if (NULL != chan->samp_alloc) {
+        TSL_BUG_IF_FAILED(sample_buf_pool_delete(&chan->samp_alloc));
+    }
+
+#ifdef HAVE_OPENCL
+    if (NULL != chan->cl) {
+        TSL_BUG_IF_FAILED(channelizer_cl_delete(&chan->cl));
+    }
+#endif
+
+    if (NULL != chan->pfb) {
+        TSL_BUG_IF_FAILED(pfb_channelizer_delete(&chan->pfb));
+    }
+
+    if (NULL != chan->scratch) {
+        TFREE(chan->scratch);
+    }
+
+    if (NULL != chan->out_ptrs) {
+        TFREE(chan->out_ptrs);
+    }
+
+    if (NULL != chan->out_bufs) {
+        TFREE(chan->out_bufs);
+    }
+
+    if (NULL != chan->channel_refs) {
+        TFREE(chan->channel_refs);
+    }
+
+    TFREE(chan);
+
+    *pchan = NULL;
+
+    return ret;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <tsl/result.h>
+#include <tsl/cal.h>
+#include <tsl/worker_thread.h>
+
+#include <multifm/spsc_ring.h>
+#include <multifm/channelizer_cl.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct pfb_channelizer;
+struct channelizer_cl;
+struct sample_buf_pool;
+struct receiver;
+struct sample_buf;
+struct config;
+
+/**
+ * A shared channelizer stage. Runs a single polyphase filter bank over each buffer of samples
+ * the receiver delivers, and hands each demodulator thread only the (already decimated) slice
+ * of spectrum its channel lives in.
+ */
+struct channelizer {
+    /**
+     * Ring of full-rate sample buffers waiting to be channelized
+     */
+    struct spsc_ring ring CAL_CACHE_ALIGNED;
+
+    /**
+     * Number of input sample buffers dropped because the ring was full
+     */
+    size_t nr_ring_full_drops;
+
+    /**
+     * The channelizer worker thread
+     */
+    struct worker_thread wthr;
+
+    /**
+     * The receiver we deliver channelized samples on behalf of
+     */
+    struct receiver *rx;
+
+    /**
+     * The filter bank itself
+     */
+    struct pfb_channelizer *pfb;
+
+    /**
+     * The filter bank offloaded to an OpenCL device, if an accelerator was asked for. When set,
+     * pfb is left idle.
+     */
+    struct channelizer_cl *cl;
+
+    /**
+     * The most input sample buffers handed to the accelerator in one dispatch
+     */
+    unsigned batch_bufs;
+
+    /**
+     * The largest number of samples in an input sample buffer
+     */
+    size_t samples_per_buf;
+
+    /**
+     * When the first sample of each accelerator dispatch not yet collected was captured, the
+     * sequence number of the buffer it came from, and when it was dispatched (when tracing).
+     * Oldest first, starting at batch_head.
+     */
+    uint64_t batch_start_time_ns[CHANNELIZER_CL_NR_SLOTS];
+    uint64_t batch_seq[CHANNELIZER_CL_NR_SLOTS];
+    uint64_t batch_dispatch_ns[CHANNELIZER_CL_NR_SLOTS];
+    unsigned batch_head;
+
+    /**
+     * Whether samples have been handed to the accelerator since the last dispatch, and when the
+     * first of them was captured.
+     */
+    bool batch_staged;
+    uint64_t staged_start_time_ns;
+    uint64_t staged_seq;
+
+    /**
+     * The number of channels in the filter bank
+     */
+    unsigned nr_channels;
+
+    /**
+     * The input sample rate, in Hz
+     */
+    uint32_t sample_rate;
+
+    /**
+     * The sample rate of each channel output, in Hz
+     */
+    uint32_t out_sample_rate;
+
+    /**
+     * The largest number of samples a single input buffer can produce, per channel
+     */
+    size_t max_out_samples;
+
+    /**
+     * The number of demodulator threads consuming each channel. Only channels with a
+     * consumer are given an output buffer.
+     */
+    unsigned *channel_refs;
+
+    /**
+     * The number of channels with at least one consumer
+     */
+    size_t nr_active_channels;
+
+    /**
+     * The number of output sample buffers to allocate per active channel
+     */
+    size_t nr_bufs_per_channel;
+
+    /**
+     * Pool of channelized sample buffers
+     */
+    struct sample_buf_pool *samp_alloc;
+
+    /**
+     * Output sample buffers for the current input buffer, one per channel
+     */
+    struct sample_buf **out_bufs;
+
+    /**
+     * Output sample pointers handed to the filter bank, one per channel
+     */
+    int16_t **out_ptrs;
+
+    /**
+     * Scratch output, used when we're out of sample buffers so the filter bank state stays
+     * continuous.
+     */
+    int16_t *scratch;
+
+    /**
+     * Number of failed sample buffer allocations
+     */
+    size_t nr_samp_buf_alloc_fails;
+
+    /**
+     * Total number of input samples channelized
+     */
+    size_t total_nr_samples;
+};
+
+/**
+ * Create a new channelizer stage.
+ *
+ * \param pchan The new channelizer, returned by reference
+ * \param rx The receiver this channelizer feeds demodulator threads for
+ * \param cfg The "channelizer" section of the configuration. Setting "accelerator" to "opencl"
+ *            runs the filter bank on an OpenCL device, "batchBufs" input buffers at a time.
+ *            This is experimental: run test_multifm on the device first, to check it gives the
+ *            same channels as the CPU.
+ * \param sample_rate The input sample rate, in Hz
+ * \param samples_per_buf The largest number of samples in a receiver sample buffer
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t channelizer_new(struct channelizer **pchan, struct receiver *rx, struct config *cfg,
+        uint32_t sample_rate, size_t samples_per_buf);
+
+/**
+ * Assign a channel, by its offset from the center frequency, to a channelizer output.
+ *
+ * \param chan The channelizer
+ * \param offset_hz The offset of the channel from the center frequency, in Hz
+ * \param pchannel The channelizer output carrying this channel, returned by reference
+ * \param presidual_hz The offset of the channel from the center of that output, returned
+ *                     by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t channelizer_assign(struct channelizer *chan, int32_t offset_hz, unsigned *pchannel, int32_t *presidual_hz);
+
+/**
+ * The number of input samples consumed per channelizer output sample.
+ */
+unsigned channelizer_decimation(struct channelizer *chan);
+
+/**
+ * Start the channelizer thread. All channels must be assigned before this is called.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t channelizer_start(struct channelizer *chan);
+
+/**
+ * Hand a full-rate sample buffer to the channelizer.
+ *
+ * \param chan The channelizer
+ * \param buf The sample buffer. The channelizer takes ownership of one reference.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t channelizer_deliver(struct channelizer *chan, struct sample_buf *buf);
+
+/**
+ * Stop the channelizer thread, and release any sample buffers still waiting to be processed.
+ * The demodulator threads can still hold channelized buffers after this returns, so they must
+ * be cleaned up before calling channelizer_delete.
+ */
+aresult_t channelizer_stop(struct channelizer *chan);
+
+/**
+ * Release all resources held by the channelizer.
+ *
+ * \param pchan The channelizer, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t channelizer_delete(struct channelizer **pchan);
+
@@ -0,0 +1,855 @@
+/*
+ *  channelizer_cl.c - The polyphase filter bank channelizer, offloaded to an OpenCL device
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include <multifm/channelizer_cl.h>
+#include <multifm/multifm.h>
+
+#include <config/engine.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+
+#include <CL/cl.h>
+
+#include <math.h>
+#include <string.h>
+
+#define CHANNELIZER_CL_MAX_PLATFORMS        16
+#define CHANNELIZER_CL_MAX_DEVICES          16
+#define CHANNELIZER_CL_MAX_CHANNELS         4096
+
+/**
+ * The two halves of the filter bank. Each work item of pfb_branches evaluates one branch filter
+ * for one output, each work item of pfb_dft produces one output sample of one channel. The math
+ * matches pfb_channelizer.c, so the output is the same (give or take float rounding), but the
+ * DFT is done directly; with a work item per bin it's the FFT's data shuffling that would hurt.
+ */
+static const
+char *_channelizer_cl_source =
+    "__kernel void pfb_branches(__global const short2 *in, __global const float *coeffs,\n"
+    "        __global float2 *branch, const uint nr_channels, const uint taps_per_branch, const uint hop)\n"
+    "{\n"
+    "    const uint j = get_global_id(0),\n"
+    "               m = get_global_id(1),\n"
+    "               newest = j * hop + nr_channels * taps_per_branch - 1;\n"
+    "    __global const float *c = &coeffs[m * taps_per_branch];\n"
+    "    float2 acc = (float2)(0.0f, 0.0f);\n"
+    "\n"
+    "    for (uint p = 0; p < taps_per_branch; p++) {\n"
+    "        acc += c[p] * convert_float2(in[newest - m - p * nr_channels]);\n"
+    "    }\n"
+    "\n"
+    "    branch[j * nr_channels + m] = acc;\n"
+    "}\n"
+    "\n"
+    "__kernel void pfb_dft(__global const float2 *branch, __global const float2 *twiddles,\n"
+    "        __global short2 *out, const uint nr_channels, const uint nr_out, const uint odd_first)\n"
+    "{\n"
+    "    const uint j = get_global_id(0),\n"
+    "               k = get_global_id(1);\n"
+    "    __global const float2 *b = &branch[j * nr_channels];\n"
+    "    float2 acc = (float2)(0.0f, 0.0f);\n"
+    "\n"
+    "    for (uint m = 0; m < nr_channels; m++) {\n"
+    "        const float2 tw = twiddles[(m * k) & (nr_channels - 1)],\n"
+    "                     x = b[m];\n"
+    "        acc += (float2)(x.x * tw.x - x.y * tw.y, x.x * tw.y + x.y * tw.x);\n"
+    "    }\n"
+    "\n"
+    "    /* The odd channels pick up a factor of -1 on every other output */\n"
+    "    if (((odd_first ^ j) & 1) && (k & 1)) {\n"
+    "        acc = -acc;\n"
+    "    }\n"
+    "\n"
+    "    out[k * nr_out + j] = convert_short2_sat_rte(acc);\n"
+    "}\n";
+
+/**
+ * A dispatch's worth of buffers. The host side of the input and output is pinned, so the
+ * transfers can run without the driver bouncing them through a copy of its own.
+ */
+struct channelizer_cl_slot {
+    /**
+     * Each slot gets its own queue, so one slot's transfers can overlap the other's kernels
+     */
+    cl_command_queue queue;
+
+    cl_mem in_pinned;
+    cl_mem out_pinned;
+    int16_t *in_host;
+    int16_t *out_host;
+
+    cl_mem in_dev;
+    cl_mem branch_dev;
+    cl_mem out_dev;
+
+    /**
+     * Signalled once the output has landed in out_host
+     */
+    cl_event done;
+
+    /**
+     * The number of complex samples in in_host, including what was carried over
+     */
+    size_t nr_in;
+
+    /**
+     * The number of output samples per channel the dispatch produces
+     */
+    size_t nr_out;
+
+    /**
+     * Whether the samples carried over from the previous dispatch have been copied in yet
+     */
+    bool staged;
+
+    /**
+     * Whether the slot has been dispatched, but not collected
+     */
+    bool pending;
+};
+
+struct channelizer_cl {
+    cl_context ctx;
+    cl_device_id dev;
+    cl_program prog;
+    cl_kernel branches;
+    cl_kernel dft;
+
+    /**
+     * The branch filter coefficients, laid out as in struct pfb_channelizer
+     */
+    cl_mem coeffs_dev;
+
+    /**
+     * e^(+j2pi*i/M), for i in [0, M)
+     */
+    cl_mem twiddles_dev;
+
+    unsigned nr_channels;
+    size_t taps_per_branch;
+    size_t nr_taps;
+    unsigned hop;
+
+    /**
+     * The most samples the caller will append between dispatches
+     */
+    size_t max_in;
+
+    /**
+     * The capacity of each slot's input, in complex samples. Leaves room for the carry.
+     */
+    size_t slot_in_capacity;
+
+    /**
+     * The most outputs, per channel, a dispatch can produce
+     */
+    size_t max_out;
+
+    /**
+     * The tail of the last dispatch's input, not yet consumed by an output. It starts the next
+     * dispatch's input.
+     */
+    int16_t *carry;
+    size_t nr_carry;
+
+    /**
+     * Parity of the next output sample
+     */
+    bool odd_next;
+
+    unsigned cur;
+    unsigned oldest;
+    unsigned nr_pending;
+
+    struct channelizer_cl_slot slots[CHANNELIZER_CL_NR_SLOTS];
+};
+
+/**
+ * Find the device to run on. Either the one the configuration asks for, or the first GPU on any
+ * platform.
+ */
+static
+aresult_t _channelizer_cl_find_device(struct config *cfg, cl_device_id *pdev)
+{
+    aresult_t ret = A_OK;
+
+    cl_platform_id platforms[CHANNELIZER_CL_MAX_PLATFORMS];
+    cl_device_id devices[CHANNELIZER_CL_MAX_DEVICES];
+    cl_uint nr_platforms = 0,
+            nr_devices = 0;
+    cl_int err = CL_SUCCESS;
+    int platform_idx = -1,
+        device_idx = -1;
+
+    config_get_integer(cfg, &platform_idx, "clPlatform");
+    config_get_integer(cfg, &device_idx, "clDevice");
+
+    if (CL_SUCCESS != (err = clGetPlatformIDs(CHANNELIZER_CL_MAX_PLATFORMS, platforms, &nr_platforms)) ||
+            0 == nr_platforms)
+    {
+        MFM_MSG(SEV_ERROR, "NO-OPENCL-PLATFORMS", "No OpenCL platforms found (%d).", err);
+        ret = A_E_NOTFOUND;
+        goto done;
+    }
+
+    nr_platforms = BL_MIN2(nr_platforms, CHANNELIZER_CL_MAX_PLATFORMS);
+
+    if (0 <= platform_idx || 0 <= device_idx) {
+        platform_idx = BL_MAX2(platform_idx, 0);
+        device_idx = BL_MAX2(device_idx, 0);
+
+        if ((cl_uint)platform_idx >= nr_platforms) {
+            MFM_MSG(SEV_ERROR, "BAD-OPENCL-PLATFORM", "OpenCL platform %d does not exist, there are %u.",
+                    platform_idx, nr_platforms);
+            ret = A_E_NOTFOUND;
+            goto done;
+        }
+
+        if (CL_SUCCESS != (err = clGetDeviceIDs(platforms[platform_idx], CL_DEVICE_TYPE_ALL,
+                        CHANNELIZER_CL_MAX_DEVICES, devices, &nr_devices)) ||
+                (cl_uint)device_idx >= BL_MIN2(nr_devices, CHANNELIZER_CL_MAX_DEVICES))
+        {
+            MFM_MSG(SEV_ERROR, "BAD-OPENCL-DEVICE", "OpenCL device %d does not exist on platform %d.",
+                    device_idx, platform_idx);
+            ret = A_E_NOTFOUND;
+            goto done;
+        }
+
+        *pdev = devices[device_idx];
+        goto done;
+    }
+
+    for (cl_uint i = 0; i < nr_platforms; i++) {
+        if (CL_SUCCESS == clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1, devices, &nr_devices) &&
+                0 != nr_devices)
+        {
+            *pdev = devices[0];
+            goto done;
+        }
+    }
+
+    MFM_MSG(SEV_ERROR, "NO-OPENCL-GPU", "None of the %u OpenCL platforms has a GPU. Set 'clPlatform' and "
+            "'clDevice' to use some other device.", nr_platforms);
+    ret = A_E_NOTFOUND;
+
+done:
+    return ret;
+}
+
+/**
+ * Create a buffer in pinned host memory, and map it for the life of the channelizer
+ */
+static
+aresult_t _channelizer_cl_pinned_new(struct channelizer_cl *cl, cl_command_queue queue, size_t bytes,
+        cl_map_flags flags, cl_mem *pmem, int16_t **phost)
+{
+    aresult_t ret = A_OK;
+
+    cl_int err = CL_SUCCESS;
+
+    *pmem = clCreateBuffer(cl->ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, &err);
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-NO-PINNED-MEM", "Failed to allocate %zu bytes of pinned memory (%d).", bytes, err);
+        *pmem = NULL;
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    *phost = clEnqueueMapBuffer(queue, *pmem, CL_TRUE, flags, 0, bytes, 0, NULL, NULL, &err);
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-MAP-FAILED", "Failed to map %zu bytes of pinned memory (%d).", bytes, err);
+        *phost = NULL;
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+done:
+    return ret;
+}
+
+static
+aresult_t _channelizer_cl_device_new(struct channelizer_cl *cl, cl_mem_flags flags, size_t bytes, void *host,
+        cl_mem *pmem)
+{
+    aresult_t ret = A_OK;
+
+    cl_int err = CL_SUCCESS;
+
+    *pmem = clCreateBuffer(cl->ctx, flags, bytes, host, &err);
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-NO-DEVICE-MEM", "Failed to allocate %zu bytes of device memory (%d).", bytes, err);
+        *pmem = NULL;
+        ret = A_E_NOMEM;
+    }
+
+    return ret;
+}
+
+static
+aresult_t _channelizer_cl_slot_new(struct channelizer_cl *cl, struct channelizer_cl_slot *slot)
+{
+    aresult_t ret = A_OK;
+
+    cl_int err = CL_SUCCESS;
+    size_t in_bytes = cl->slot_in_capacity * 2 * sizeof(int16_t),
+           out_bytes = cl->max_out * cl->nr_channels * 2 * sizeof(int16_t);
+
+    slot->queue = clCreateCommandQueue(cl->ctx, cl->dev, 0, &err);
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-NO-QUEUE", "Failed to create OpenCL command queue (%d).", err);
+        slot->queue = NULL;
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_pinned_new(cl, slot->queue, in_bytes, CL_MAP_WRITE, &slot->in_pinned,
+                    &slot->in_host)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_pinned_new(cl, slot->queue, out_bytes, CL_MAP_READ, &slot->out_pinned,
+                    &slot->out_host)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_device_new(cl, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, in_bytes, NULL,
+                    &slot->in_dev)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_device_new(cl, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+                    cl->max_out * cl->nr_channels * 2 * sizeof(float), NULL, &slot->branch_dev)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_device_new(cl, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, out_bytes, NULL,
+                    &slot->out_dev)))
+    {
+        goto done;
+    }
+
+done:
+    return ret;
+}
+
+static
+void _channelizer_cl_slot_delete(struct channelizer_cl_slot *slot)
+{
+    if (NULL != slot->done) {
+        clWaitForEvents(1, &slot->done);
+        clReleaseEvent(slot->done);
+        slot->done = NULL;
+    }
+
+    if (NULL != slot->in_host) {
+        clEnqueueUnmapMemObject(slot->queue, slot->in_pinned, slot->in_host, 0, NULL, NULL);
+        slot->in_host = NULL;
+    }
+
+    if (NULL != slot->out_host) {
+        clEnqueueUnmapMemObject(slot->queue, slot->out_pinned, slot->out_host, 0, NULL, NULL);
+        slot->out_host = NULL;
+    }
+
+    if (NULL != slot->queue) {
+        clFinish(slot->queue);
+    }
+
+    if (NULL != slot->out_dev) {
+        clReleaseMemObject(slot->out_dev);
+    }
+
+    if (NULL != slot->branch_dev) {
+        clReleaseMemObject(slot->branch_dev);
+    }
+
+    if (NULL != slot->in_dev) {
+        clReleaseMemObject(slot->in_dev);
+    }
+
+    if (NULL != slot->out_pinned) {
+        clReleaseMemObject(slot->out_pinned);
+    }
+
+    if (NULL != slot->in_pinned) {
+        clReleaseMemObject(slot->in_pinned);
+    }
+
+    if (NULL != slot->queue) {
+        clReleaseCommandQueue(slot->queue);
+    }
+
+    memset(slot, 0, sizeof(*slot));
+}
+
+static
+aresult_t _channelizer_cl_build(struct channelizer_cl *cl)
+{
+    aresult_t ret = A_OK;
+
+    cl_int err = CL_SUCCESS;
+    char *log = NULL;
+    size_t log_len = 0;
+
+    cl->prog = clCreateProgramWithSource(cl->ctx, 1, &_channelizer_cl_source, NULL, &err);
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-BAD-PROGRAM", "Failed to create the channelizer OpenCL program (%d).", err);
+        cl->prog = NULL;
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (CL_SUCCESS != (err = clBuildProgram(cl->prog, 1, &cl->dev, "-cl-mad-enable", NULL, NULL))) {
+        MFM_MSG(SEV_ERROR, "OPENCL-BUILD-FAILED", "Failed to build the channelizer OpenCL kernels (%d).", err);
+
+        if (CL_SUCCESS == clGetProgramBuildInfo(cl->prog, cl->dev, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_len) &&
+                0 != log_len && !FAILED(TCALLOC((void **)&log, log_len + 1, 1)))
+        {
+            if (CL_SUCCESS == clGetProgramBuildInfo(cl->prog, cl->dev, CL_PROGRAM_BUILD_LOG, log_len, log, NULL)) {
+                MFM_MSG(SEV_ERROR, "OPENCL-BUILD-LOG", "%s", log);
+            }
+        }
+
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    cl->branches = clCreateKernel(cl->prog, "pfb_branches", &err);
+    if (CL_SUCCESS != err) {
+        cl->branches = NULL;
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    cl->dft = clCreateKernel(cl->prog, "pfb_dft", &err);
+    if (CL_SUCCESS != err) {
+        cl->dft = NULL;
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+done:
+    if (NULL != log) {
+        TFREE(log);
+    }
+
+    return ret;
+}
+
+/**
+ * Upload the filter bank's coefficients and twiddles
+ */
+static
+aresult_t _channelizer_cl_upload_taps(struct channelizer_cl *cl, const double *proto_taps, size_t nr_proto_taps)
+{
+    aresult_t ret = A_OK;
+
+    float *coeffs = NULL,
+          *twiddles = NULL;
+
+    if (FAILED(ret = TACALLOC((void **)&coeffs, cl->nr_taps, sizeof(float), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    /* Decomposed into branches just like pfb_channelizer_new does. Padding taps are left as 0. */
+    for (size_t i = 0; i < nr_proto_taps; i++) {
+        coeffs[(i % cl->nr_channels) * cl->taps_per_branch + (i / cl->nr_channels)] = (float)proto_taps[i];
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&twiddles, cl->nr_channels, 2 * sizeof(float), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < cl->nr_channels; i++) {
+        double phi = 2.0 * M_PI * (double)i / (double)cl->nr_channels;
+        twiddles[2 * i    ] = (float)cos(phi);
+        twiddles[2 * i + 1] = (float)sin(phi);
+    }
+
+    if (FAILED(ret = _channelizer_cl_device_new(cl, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS,
+                    cl->nr_taps * sizeof(float), coeffs, &cl->coeffs_dev)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_device_new(cl, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS,
+                    cl->nr_channels * 2 * sizeof(float), twiddles, &cl->twiddles_dev)))
+    {
+        goto done;
+    }
+
+done:
+    if (NULL != twiddles) {
+        TFREE(twiddles);
+    }
+
+    if (NULL != coeffs) {
+        TFREE(coeffs);
+    }
+
+    return ret;
+}
+
+aresult_t channelizer_cl_new(struct channelizer_cl **pcl, struct config *cfg, unsigned nr_channels,
+        const double *proto_taps, size_t nr_proto_taps, size_t max_in_samples)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer_cl *cl = NULL;
+    cl_int err = CL_SUCCESS;
+    char dev_name[128] = { '\0' };
+
+    TSL_ASSERT_ARG(NULL != pcl);
+    TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(2 <= nr_channels && CHANNELIZER_CL_MAX_CHANNELS >= nr_channels);
+    TSL_ASSERT_ARG(0 == (nr_channels & (nr_channels - 1)));
+    TSL_ASSERT_ARG(NULL != proto_taps);
+    TSL_ASSERT_ARG(0 != nr_proto_taps);
+    TSL_ASSERT_ARG(0 != max_in_samples);
+
+    *pcl = NULL;
+
+    if (FAILED(ret = TZAALLOC(cl, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    cl->nr_channels = nr_channels;
+    cl->taps_per_branch = (nr_proto_taps + nr_channels - 1) / nr_channels;
+    cl->nr_taps = cl->taps_per_branch * nr_channels;
+    cl->hop = nr_channels / 2;
+    cl->max_in = max_in_samples;
+
+    /* There's never more than a filter's worth of samples carried over */
+    cl->slot_in_capacity = cl->nr_taps - 1 + max_in_samples;
+    cl->max_out = (cl->slot_in_capacity - cl->nr_taps) / cl->hop + 1;
+
+    /* Prime the history so the first output is produced after the first hop of input, as the CPU does */
+    if (FAILED(ret = TACALLOC((void **)&cl->carry, cl->nr_taps, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+    cl->nr_carry = cl->nr_taps - cl->hop;
+
+    if (FAILED(ret = _channelizer_cl_find_device(cfg, &cl->dev))) {
+        goto done;
+    }
+
+    clGetDeviceInfo(cl->dev, CL_DEVICE_NAME, sizeof(dev_name) - 1, dev_name, NULL);
+
+    cl->ctx = clCreateContext(NULL, 1, &cl->dev, NULL, NULL, &err);
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-NO-CONTEXT", "Failed to create an OpenCL context on '%s' (%d).", dev_name, err);
+        cl->ctx = NULL;
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_build(cl))) {
+        goto done;
+    }
+
+    if (FAILED(ret = _channelizer_cl_upload_taps(cl, proto_taps, nr_proto_taps))) {
+        goto done;
+    }
+
+    for (unsigned i = 0; i < CHANNELIZER_CL_NR_SLOTS; i++) {
+        if (FAILED(ret = _channelizer_cl_slot_new(cl, &cl->slots[i]))) {
+            goto done;
+        }
+    }
+
+    MFM_MSG(SEV_INFO, "OPENCL-CHANNELIZER", "Channelizing on '%s', up to %zu samples per dispatch",
+            dev_name, max_in_samples);
+
+    *pcl = cl;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != cl) {
+            TSL_BUG_IF_FAILED(channelizer_cl_delete(&cl));
+        }
+    }
+
+    return ret;
+}
+
+aresult_t channelizer_cl_delete(struct channelizer_cl **pcl)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer_cl *cl = NULL;
+
+    TSL_ASSERT_PTR_BY_REF(pcl);
+
+    cl = *pcl;
+
+    for (unsigned i = 0; i < CHANNELIZER_CL_NR_SLOTS; i++) {
+        _channelizer_cl_slot_delete(&cl->slots[i]);
+    }
+
+    if (NULL != cl->twiddles_dev) {
+        clReleaseMemObject(cl->twiddles_dev);
+    }
+
+    if (NULL != cl->coeffs_dev) {
+        clReleaseMemObject(cl->coeffs_dev);
+    }
+
+    if (NULL != cl->dft) {
+        clReleaseKernel(cl->dft);
+    }
+
+    if (NULL != cl->branches) {
+        clReleaseKernel(cl->branches);
+    }
+
+    if (NULL != cl->prog) {
+        clReleaseProgram(cl->prog);
+    }
+
+    if (NULL != cl->ctx) {
+        clReleaseContext(cl->ctx);
+    }
+
+    if (NULL != cl->carry) {
+        TFREE(cl->carry);
+    }
+
+    TFREE(cl);
+    *pcl = NULL;
+
+    return ret;
+}
+
+size_t channelizer_cl_max_outputs(struct channelizer_cl *cl)
+{
+    TSL_BUG_ON(NULL == cl);
+    return cl->max_out;
+}
+
+size_t channelizer_cl_space(struct channelizer_cl *cl)
+{
+    struct channelizer_cl_slot *slot = NULL;
+
+    TSL_BUG_ON(NULL == cl);
+
+    slot = &cl->slots[cl->cur];
+
+    return cl->slot_in_capacity - (true == slot->staged ? slot->nr_in : cl->nr_carry);
+}
+
+aresult_t channelizer_cl_append(struct channelizer_cl *cl, const int16_t *in, size_t nr_in)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer_cl_slot *slot = NULL;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != cl);
+    TSL_ASSERT_ARG_DEBUG(NULL != in);
+    TSL_ASSERT_ARG(nr_in <= channelizer_cl_space(cl));
+
+    slot = &cl->slots[cl->cur];
+
+    if (true == slot->pending) {
+        ret = A_E_BUSY;
+        goto done;
+    }
+
+    if (false == slot->staged) {
+        memcpy(slot->in_host, cl->carry, cl->nr_carry * 2 * sizeof(int16_t));
+        slot->nr_in = cl->nr_carry;
+        slot->staged = true;
+    }
+
+    memcpy(&slot->in_host[2 * slot->nr_in], in, nr_in * 2 * sizeof(int16_t));
+    slot->nr_in += nr_in;
+
+done:
+    return ret;
+}
+
+aresult_t channelizer_cl_dispatch(struct channelizer_cl *cl)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer_cl_slot *slot = NULL;
+    cl_int err = CL_SUCCESS;
+    cl_uint nr_channels = 0,
+            taps_per_branch = 0,
+            hop = 0,
+            nr_out = 0,
+            odd_first = 0;
+    size_t global[2],
+           consumed = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != cl);
+
+    slot = &cl->slots[cl->cur];
+
+    TSL_BUG_ON(true == slot->pending);
+
+    /* Not enough for an output yet, so hang on to what we have for the next dispatch */
+    if (false == slot->staged || slot->nr_in < cl->nr_taps) {
+        goto done;
+    }
+
+    slot->nr_out = (slot->nr_in - cl->nr_taps) / cl->hop + 1;
+    TSL_BUG_ON(slot->nr_out > cl->max_out);
+
+    /* Everything the outputs haven't stepped past starts the next dispatch */
+    consumed = slot->nr_out * cl->hop;
+    cl->nr_carry = slot->nr_in - consumed;
+    memcpy(cl->carry, &slot->in_host[2 * consumed], cl->nr_carry * 2 * sizeof(int16_t));
+
+    nr_channels = cl->nr_channels;
+    taps_per_branch = cl->taps_per_branch;
+    hop = cl->hop;
+    nr_out = slot->nr_out;
+    odd_first = true == cl->odd_next;
+
+    if (CL_SUCCESS != (err = clEnqueueWriteBuffer(slot->queue, slot->in_dev, CL_FALSE, 0,
+                    slot->nr_in * 2 * sizeof(int16_t), slot->in_host, 0, NULL, NULL)))
+    {
+        goto done;
+    }
+
+    global[0] = nr_out;
+    global[1] = nr_channels;
+
+    if (CL_SUCCESS != (err = clSetKernelArg(cl->branches, 0, sizeof(cl_mem), &slot->in_dev)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->branches, 1, sizeof(cl_mem), &cl->coeffs_dev)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->branches, 2, sizeof(cl_mem), &slot->branch_dev)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->branches, 3, sizeof(cl_uint), &nr_channels)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->branches, 4, sizeof(cl_uint), &taps_per_branch)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->branches, 5, sizeof(cl_uint), &hop)) ||
+            CL_SUCCESS != (err = clEnqueueNDRangeKernel(slot->queue, cl->branches, 2, NULL, global, NULL,
+                    0, NULL, NULL)))
+    {
+        goto done;
+    }
+
+    if (CL_SUCCESS != (err = clSetKernelArg(cl->dft, 0, sizeof(cl_mem), &slot->branch_dev)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->dft, 1, sizeof(cl_mem), &cl->twiddles_dev)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->dft, 2, sizeof(cl_mem), &slot->out_dev)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->dft, 3, sizeof(cl_uint), &nr_channels)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->dft, 4, sizeof(cl_uint), &nr_out)) ||
+            CL_SUCCESS != (err = clSetKernelArg(cl->dft, 5, sizeof(cl_uint), &odd_first)) ||
+            CL_SUCCESS != (err = clEnqueueNDRangeKernel(slot->queue, cl->dft, 2, NULL, global, NULL,
+                    0, NULL, NULL)))
+    {
+        goto done;
+    }
+
+    if (CL_SUCCESS != (err = clEnqueueReadBuffer(slot->queue, slot->out_dev, CL_FALSE, 0,
+                    (size_t)nr_out * nr_channels * 2 * sizeof(int16_t), slot->out_host, 0, NULL, &slot->done)))
+    {
+        goto done;
+    }
+
+    /* Get the device started, we'll be back for the output later */
+    clFlush(slot->queue);
+
+    if (nr_out & 1) {
+        cl->odd_next = !cl->odd_next;
+    }
+
+    slot->pending = true;
+    cl->nr_pending++;
+    cl->cur = (cl->cur + 1) % CHANNELIZER_CL_NR_SLOTS;
+
+done:
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-DISPATCH-FAILED", "Failed to dispatch a batch to the OpenCL device (%d).", err);
+        clFinish(slot->queue);
+        ret = A_E_INVAL;
+    }
+
+    return ret;
+}
+
+unsigned channelizer_cl_nr_pending(struct channelizer_cl *cl)
+{
+    TSL_BUG_ON(NULL == cl);
+    return cl->nr_pending;
+}
+
+aresult_t channelizer_cl_collect(struct channelizer_cl *cl, int16_t *const *chan_out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    struct channelizer_cl_slot *slot = NULL;
+    cl_int err = CL_SUCCESS;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != cl);
+    TSL_ASSERT_ARG_DEBUG(NULL != chan_out);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_out);
+
+    *pnr_out = 0;
+
+    if (0 == cl->nr_pending) {
+        ret = A_E_EMPTY;
+        goto done;
+    }
+
+    slot = &cl->slots[cl->oldest];
+
+    TSL_BUG_ON(false == slot->pending);
+
+    err = clWaitForEvents(1, &slot->done);
+    clReleaseEvent(slot->done);
+    slot->done = NULL;
+
+    slot->pending = false;
+    slot->staged = false;
+    slot->nr_in = 0;
+    cl->nr_pending--;
+    cl->oldest = (cl->oldest + 1) % CHANNELIZER_CL_NR_SLOTS;
+
+    if (CL_SUCCESS != err) {
+        MFM_MSG(SEV_ERROR, "OPENCL-BATCH-FAILED", "OpenCL channelizer batch failed (%d).", err);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* The output is laid out a channel at a time, so each channel is a single copy */
+    for (size_t k = 0; k < cl->nr_channels; k++) {
+        if (NULL == chan_out[k]) {
+            continue;
+        }
+
+        memcpy(chan_out[k], &slot->out_host[2 * k * slot->nr_out], slot->nr_out * 2 * sizeof(int16_t));
+    }
+
+    *pnr_out = slot->nr_out;
+
+done:
+    return ret;
+}
+
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct channelizer_cl;
+struct config;
+
+/**
+ * The number of dispatches a channelizer_cl can have in flight. While the device works on
+ * one, the next batch is staged in the other's pinned host buffer.
+ */
+#define CHANNELIZER_CL_NR_SLOTS         2
+
+/**
+ * Create an OpenCL implementation of the polyphase filter bank in filter/pfb_channelizer.h.
+ * It produces the same channels, at the same rate, but works in batches: input samples are
+ * appended to a pinned host buffer, handed to the device with channelizer_cl_dispatch, and the
+ * channelized output picked up later with channelizer_cl_collect.
+ *
+ * \param pcl The new OpenCL channelizer, returned by reference
+ * \param cfg The "channelizer" section of the configuration. The "clPlatform" and "clDevice"
+ *            indices pick the device to use, the first GPU found is used otherwise.
+ * \param nr_channels The number of channels. Must be a power of 2, at least 2.
+ * \param proto_taps The prototype low-pass filter, at the input sample rate
+ * \param nr_proto_taps The number of taps in the prototype filter
+ * \param max_in_samples The most input samples that will be appended between dispatches
+ *
+ * \return A_OK on success, A_E_NOTFOUND if there is no suitable OpenCL device, an error code
+ *         otherwise.
+ */
+aresult_t channelizer_cl_new(struct channelizer_cl **pcl, struct config *cfg, unsigned nr_channels,
+        const double *proto_taps, size_t nr_proto_taps, size_t max_in_samples);
+
+/**
+ * Release the OpenCL channelizer, waiting for anything still in flight.
+ *
+ * \param pcl The OpenCL channelizer, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t channelizer_cl_delete(struct channelizer_cl **pcl);
+
+/**
+ * Get the most output samples, per channel, a single dispatch can produce.
+ */
+size_t channelizer_cl_max_outputs(struct channelizer_cl *cl);
+
+/**
+ * Get the number of input samples that can still be appended before the next dispatch.
+ */
+size_t channelizer_cl_space(struct channelizer_cl *cl);
+
+/**
+ * Append complex Q.15 samples to the batch for the next dispatch.
+ *
+ * \param cl The OpenCL channelizer
+ * \param in The input samples, interleaved I/Q
+ * \param nr_in The number of complex samples. Must be no more than channelizer_cl_space.
+ *
+ * \return A_OK on success, A_E_BUSY if the next dispatch's buffers are still in flight (call
+ *         channelizer_cl_collect first), an error code otherwise.
+ */
+aresult_t channelizer_cl_append(struct channelizer_cl *cl, const int16_t *in, size_t nr_in);
+
+/**
+ * Hand the samples appended so far to the device. Returns without waiting for the device.
+ *
+ * \param cl The OpenCL channelizer
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t channelizer_cl_dispatch(struct channelizer_cl *cl);
+
+/**
+ * Get the number of dispatches that have not been collected yet.
+ */
+unsigned channelizer_cl_nr_pending(struct channelizer_cl *cl);
+
+/**
+ * Wait for the oldest dispatch to finish, and copy out its channelized samples.
+ *
+ * \param cl The OpenCL channelizer
+ * \param chan_out An array of nr_channels output buffers, each with room for
+ *                 channelizer_cl_max_outputs samples. Channels with a NULL buffer are skipped.
+ * \param pnr_out The number of samples written to each output buffer, returned by reference
+ *
+ * \return A_OK on success, A_E_EMPTY if nothing is pending, an error code otherwise.
+ */
+aresult_t channelizer_cl_collect(struct channelizer_cl *cl, int16_t *const *chan_out, size_t *pnr_out);
+
@@ -0,0 +1,427 @@
+/*
+ *  control.c - Change the channels of running receivers over a UNIX socket
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/control.h>
+#include <multifm/receiver.h>
+#include <multifm/demod.h>
+#include <multifm/multifm.h>
+
+#include <config/engine.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/list.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * How often the control thread checks if it should shut down, in milliseconds
+ */
+#define CONTROL_POLL_INTERVAL_MS        1000
+
+/**
+ * The longest we'll wait on a client to send its command or read its reply, in milliseconds
+ */
+#define CONTROL_CLIENT_TIMEOUT_MS       1000
+
+/**
+ * The longest command line accepted
+ */
+#define CONTROL_MAX_LINE                (PATH_MAX + 16)
+
+/**
+ * Add the channel described in a JSON file to the first receiver that covers it.
+ */
+static
+void _control_server_add(struct control_server *srv, int client_fd, const char *path)
+{
+    struct config *channel CAL_CLEANUP(config_delete) = NULL;
+    int center_freq_hz = 0;
+    aresult_t ret = A_OK;
+
+    TSL_BUG_IF_FAILED(config_new(&channel));
+
+    if (FAILED(config_add(channel, path))) {
+        dprintf(client_fd, "ERR can't load channel from '%s'\n", path);
+        goto done;
+    }
+
+    if (FAILED(config_get_integer(channel, &center_freq_hz, "chanCenterFreq"))) {
+        dprintf(client_fd, "ERR channel has no chanCenterFreq\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < srv->nr_rxs; i++) {
+        if (false == receiver_covers(srv->rxs[i], center_freq_hz)) {
+            continue;
+        }
+
+        if (FAILED(ret = receiver_channel_add(srv->rxs[i], channel))) {
+            dprintf(client_fd, "ERR receiver %zu can't add channel at %d Hz (%s)\n", i, center_freq_hz,
+                    A_E_BUSY == ret ? "its channels are fixed" : "bad channel configuration");
+        } else {
+            MFM_MSG(SEV_INFO, "CHANNEL-ADDED", "Added channel at %4.5f MHz to receiver %zu",
+                    (double)center_freq_hz/1e6, i);
+            dprintf(client_fd, "OK %zu\n", i);
+        }
+
+        goto done;
+    }
+
+    dprintf(client_fd, "ERR no receiver covers %d Hz\n", center_freq_hz);
+
+done:
+    return;
+}
+
+/**
+ * Remove the channel with the given center frequency, from whichever receiver has it.
+ */
+static
+void _control_server_remove(struct control_server *srv, int client_fd, const char *freq)
+{
+    char *end = NULL;
+    long center_freq_hz = strtol(freq, &end, 10);
+    aresult_t ret = A_OK;
+    size_t busy_rx = 0;
+    bool have_busy = false;
+
+    if (end == freq || '\0' != *end || INT_MAX < center_freq_hz || INT_MIN > center_freq_hz) {
+        dprintf(client_fd, "ERR bad frequency '%s'\n", freq);
+        goto done;
+    }
+
+    /* The same frequency can be on more than one receiver, and only some of them can let it go */
+    for (size_t i = 0; i < srv->nr_rxs; i++) {
+        if (FAILED(ret = receiver_channel_remove(srv->rxs[i], center_freq_hz))) {
+            if (A_E_NOTFOUND != ret && false == have_busy) {
+                busy_rx = i;
+                have_busy = true;
+            }
+            continue;
+        }
+
+        dprintf(client_fd, "OK %zu\n", i);
+        goto done;
+    }
+
+    if (true == have_busy) {
+        dprintf(client_fd, "ERR receiver %zu can't remove channels\n", busy_rx);
+    } else {
+        dprintf(client_fd, "ERR no channel at %ld Hz\n", center_freq_hz);
+    }
+
+done:
+    return;
+}
+
+/**
+ * List the channels of every receiver, as receiver index followed by channel frequencies.
+ */
+static
+void _control_server_list(struct control_server *srv, int client_fd)
+{
+    dprintf(client_fd, "OK");
+
+    for (size_t i = 0; i < srv->nr_rxs; i++) {
+        struct receiver *rx = srv->rxs[i];
+        struct demod_thread *dthr = NULL;
+        bool first = true;
+
+        dprintf(client_fd, " %zu:", i);
+
+        pthread_mutex_lock(&rx->demod_lock);
+
+        list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+            dprintf(client_fd, "%s%d", first ? "" : ",", dthr->center_freq_hz);
+            first = false;
+        }
+
+        pthread_mutex_unlock(&rx->demod_lock);
+    }
+
+    dprintf(client_fd, "\n");
+}
+
+/**
+ * Read a single command line from the client. Returns false if the client didn't send one.
+ */
+static
+bool _control_server_read_line(int client_fd, char *line, size_t max_len)
+{
+    size_t len = 0;
+
+    while (len < max_len - 1) {
+        ssize_t nr_read = read(client_fd, line + len, max_len - 1 - len);
+
+        if (0 > nr_read) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+
+        if (0 == nr_read) {
+            break;
+        }
+
+        len += nr_read;
+
+        if (NULL != memchr(line, '\n', len)) {
+            break;
+        }
+    }
+
+    line[len] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+
+    return 0 != len;
+}
+
+static
+void _control_server_serve_client(struct control_server *srv)
+{
+    int client_fd = -1;
+    char line[CONTROL_MAX_LINE];
+    char *arg = NULL;
+    struct timeval tv = {
+        .tv_sec = CONTROL_CLIENT_TIMEOUT_MS / 1000,
+        .tv_usec = (CONTROL_CLIENT_TIMEOUT_MS % 1000) * 1000,
+    };
+
+    if (0 > (client_fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC))) {
+        int errnum = errno;
+        if (EAGAIN != errnum && EINTR != errnum) {
+            MFM_MSG(SEV_WARNING, "CONTROL-ACCEPT-FAILED", "Failed to accept control client: %s (%d)",
+                    strerror(errnum), errnum);
+        }
+        goto done;
+    }
+
+    /* Don't let a client that stalls hold up the next one */
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (false == _control_server_read_line(client_fd, line, sizeof(line))) {
+        goto done;
+    }
+
+    if (NULL != (arg = strchr(line, ' '))) {
+        *arg++ = '\0';
+        arg += strspn(arg, " ");
+    }
+
+    DIAG("Control command: '%s' '%s'", line, NULL != arg ? arg : "");
+
+    if (!strcmp(line, "add") && NULL != arg && '\0' != *arg) {
+        _control_server_add(srv, client_fd, arg);
+    } else if (!strcmp(line, "remove") && NULL != arg && '\0' != *arg) {
+        _control_server_remove(srv, client_fd, arg);
+    } else if (!strcmp(line, "list")) {
+        _control_server_list(srv, client_fd);
+    } else {
+        dprintf(client_fd, "ERR unknown command, expected 'add <path>', 'remove <frequency>' or 'list'\n");
+    }
+
+done:
+    if (0 <= client_fd) {
+        close(client_fd);
+    }
+}
+
+static
+aresult_t _control_server_thread(struct worker_thread *wthr)
+{
+    aresult_t ret = A_OK;
+
+    struct control_server *srv = BL_CONTAINER_OF(wthr, struct control_server, wthr);
+
+    while (worker_thread_is_running(wthr)) {
+        struct pollfd pfd = { .fd = srv->listen_fd, .events = POLLIN };
+
+        if (0 < poll(&pfd, 1, CONTROL_POLL_INTERVAL_MS) && (pfd.revents & POLLIN)) {
+            _control_server_serve_client(srv);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Create the listening socket for the control server, replacing anything already at the path.
+ */
+static
+aresult_t _control_server_listen(struct control_server *srv, const char *sock_path)
+{
+    aresult_t ret = A_OK;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    size_t path_len = strlen(sock_path);
+
+    if (path_len >= sizeof(addr.sun_path)) {
+        MFM_MSG(SEV_ERROR, "CONTROL-PATH-TOO-LONG", "Control socket path '%s' is too long.", sock_path);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    memcpy(addr.sun_path, sock_path, path_len + 1);
+
+    if (FAILED(ret = TCALLOC((void **)&srv->sock_path, path_len + 1, 1))) {
+        goto done;
+    }
+
+    memcpy(srv->sock_path, sock_path, path_len + 1);
+
+    if (0 > (srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "CONTROL-SOCKET-FAILED", "Unable to create control socket: %s (%d)",
+                strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    unlink(sock_path);
+
+    if (0 > bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "CONTROL-BIND-FAILED", "Unable to bind control socket to '%s': %s (%d)",
+                sock_path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 > listen(srv->listen_fd, 8)) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "CONTROL-LISTEN-FAILED", "Unable to listen on control socket: %s (%d)",
+                strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    MFM_MSG(SEV_INFO, "CONTROL-SOCKET", "Accepting channel changes on '%s'", sock_path);
+
+done:
+    return ret;
+}
+
+aresult_t control_server_new(struct control_server **psrv, struct receiver *const *rxs, size_t nr_rxs,
+        const char *sock_path)
+{
+    aresult_t ret = A_OK;
+
+    struct control_server *srv = NULL;
+
+    TSL_ASSERT_ARG(NULL != psrv);
+    TSL_ASSERT_ARG(NULL != rxs);
+    TSL_ASSERT_ARG(0 != nr_rxs);
+    TSL_ASSERT_ARG(NULL != sock_path && '\0' != *sock_path);
+
+    *psrv = NULL;
+
+    if (FAILED(ret = TZAALLOC(srv, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    srv->listen_fd = -1;
+
+    if (FAILED(ret = TCALLOC((void **)&srv->rxs, nr_rxs, sizeof(struct receiver *)))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_rxs; i++) {
+        TSL_BUG_ON(NULL == rxs[i]);
+        srv->rxs[i] = rxs[i];
+    }
+
+    srv->nr_rxs = nr_rxs;
+
+    if (FAILED(ret = _control_server_listen(srv, sock_path))) {
+        goto done;
+    }
+
+    if (FAILED(ret = worker_thread_new(&srv->wthr, _control_server_thread, WORKER_THREAD_CPU_MASK_ANY))) {
+        MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start control thread, aborting.");
+        goto done;
+    }
+
+    srv->started = true;
+
+    *psrv = srv;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != srv) {
+            control_server_delete(&srv);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t control_server_delete(struct control_server **psrv)
+{
+    aresult_t ret = A_OK;
+
+    struct control_server *srv = NULL;
+
+    TSL_ASSERT_ARG(NULL != psrv);
+    TSL_ASSERT_ARG(NULL != *psrv);
+
+    srv = *psrv;
+
+    if (true == srv->started) {
+        TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&srv->wthr));
+        TSL_BUG_IF_FAILED(worker_thread_delete(&srv->wthr));
+        srv->started = false;
+    }
+
+    if (-1 != srv->listen_fd) {
+        close(srv->listen_fd);
+        unlink(srv->sock_path);
+    }
+
+    if (NULL != srv->sock_path) {
+        TFREE(srv->sock_path);
+    }
+
+    if (NULL != srv->rxs) {
+        TFREE(srv->rxs);
+    }
+
+    TFREE(srv);
+
+    *psrv = NULL;
+
+    return ret;
+}
+
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <tsl/result.h>
+#include <tsl/worker_thread.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct receiver;
+
+/**
+ * A thread listening on a UNIX socket for commands that change the channels of running
+ * receivers. Each connection carries a single command, on a single line, and gets a single line
+ * reply starting with either "OK" or "ERR":
+ *
+ *  - "add <path>" adds the channel described in the given JSON file, which holds one entry in
+ *    the same form as the "channels" array, to the first receiver that covers its frequency.
+ *  - "remove <frequency>" removes the channel with the given chanCenterFreq.
+ *  - "list" lists the channel frequencies of each receiver.
+ */
+struct control_server {
+    /**
+     * The receivers whose channels can be changed
+     */
+    struct receiver **rxs;
+
+    /**
+     * The number of receivers
+     */
+    size_t nr_rxs;
+
+    /**
+     * The listening UNIX socket
+     */
+    int listen_fd;
+
+    /**
+     * The path the socket is bound to
+     */
+    char *sock_path;
+
+    /**
+     * The control thread
+     */
+    struct worker_thread wthr;
+
+    /**
+     * Whether or not the control thread was started
+     */
+    bool started;
+};
+
+/**
+ * Create and start a control server for the given receivers.
+ *
+ * \param psrv The new control server, returned by reference
+ * \param rxs The receivers to control
+ * \param nr_rxs The number of receivers in rxs
+ * \param sock_path The path to create the UNIX socket at
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t control_server_new(struct control_server **psrv, struct receiver *const *rxs, size_t nr_rxs,
+        const char *sock_path);
+
+/**
+ * Stop and destroy a control server, removing its socket. Must be called before the receivers
+ * are cleaned up.
+ *
+ * \param psrv The control server, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t control_server_delete(struct control_server **psrv);
+
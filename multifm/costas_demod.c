@@ -23,6 +23,24 @@ struct multifm_costas_demod {
     float e_max;
 };
 
+/**
+ * Convert to Q.15, saturating. Rotating a full-scale sample can take either component as far
+ * out as sqrt(2), and 1.0 itself doesn't fit in Q.15 either.
+ */
+static inline
+int16_t _costas_demod_to_q15(float val)
+{
+    static const float to_q15 = (float)(1 << Q_15_SHIFT);
+
+    if (val >= (float)INT16_MAX / to_q15) {
+        return INT16_MAX;
+    } else if (val <= (float)INT16_MIN / to_q15) {
+        return INT16_MIN;
+    }
+
+    return val * to_q15;
+}
+
 aresult_t multifm_costas_demod_init(struct demod_base **pdemod, float f_shift, float alpha, float beta,
         int16_t e_max)
 {
@@ -48,6 +66,9 @@ aresult_t multifm_costas_demod_init(struct demod_base **pdemod, float f_shift, f
     demod->f_dev_max = demod->f_dev + 0.3f;
     demod->f_dev_min = demod->f_dev - 0.3f;
 
+    demod->demod.process = multifm_costas_demod_process;
+    demod->demod.cleanup = multifm_costas_demod_cleanup;
+
     *pdemod = &demod->demod;
 
     return ret;
@@ -101,11 +122,8 @@ aresult_t multifm_costas_demod_process(struct demod_base *demod, int16_t *in_sam
 
         dc->last_phase = fmodf(phase, 2 * M_PI);
 
-        TSL_BUG_ON(fabsf(crealf(out_samp)) > 1.0);
-        TSL_BUG_ON(fabsf(cimagf(out_samp)) > 1.0);
-
-        out_samples[2 * i    ] = crealf(out_samp) * to_q15;
-        out_samples[2 * i + 1] = cimagf(out_samp) * to_q15;
+        out_samples[2 * i    ] = _costas_demod_to_q15(crealf(out_samp));
+        out_samples[2 * i + 1] = _costas_demod_to_q15(cimagf(out_samp));
     }
 
     *pnr_out_samples = nr_in_samples;
@@ -23,18 +23,29 @@
 #include <multifm/demod.h>
 #include <multifm/multifm.h>
 
-#include <multifm/fm_demod.h>
+#include <multifm/demod_base.h>
+#include <multifm/iq_recorder.h>
+#include <multifm/pcm_decoder.h>
 
 #include <filter/direct_fir.h>
 #include <filter/sample_buf.h>
+#include <filter/sample_trace.h>
 #include <filter/complex.h>
+#include <filter/pcm_ring.h>
+#include <filter/pcm_udp.h>
+#include <filter/cycle_counter.h>
 
 #include <tsl/frame_alloc.h>
 #include <tsl/errors.h>
 #include <tsl/assert.h>
 #include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
 
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <complex.h>
+#include <pthread.h>
+#include <inttypes.h>
 #include <stdatomic.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -45,78 +56,328 @@
 #include <arm_neon.h>
 #endif
 
+static
+aresult_t _demod_output_attach(struct demod_thread *thr);
+
+/**
+ * Write a batch of PCM samples to the output FIFO.
+ *
+ * \return 0 on success, -1 on failure, with errno set.
+ */
+static
+int _demod_thread_fifo_write(struct demod_thread *dthr, int16_t *out_buf, size_t nr_bytes)
+{
+    struct iovec iov = { .iov_base = out_buf, .iov_len = nr_bytes };
+
+    if (DEMOD_OUTPUT_FIFO_WRITE == dthr->out_mode) {
+        return 0 > write(dthr->fifo_fd, out_buf, nr_bytes) ? -1 : 0;
+    }
+
+    /* The pages are handed to the pipe by reference, so no copy is made here */
+    while (0 != iov.iov_len) {
+        ssize_t nr_spliced = 0;
+
+        if (0 > (nr_spliced = vmsplice(dthr->fifo_fd, &iov, 1, 0))) {
+            return -1;
+        }
+
+        iov.iov_base = (uint8_t *)iov.iov_base + nr_spliced;
+        iov.iov_len -= nr_spliced;
+    }
+
+    return 0;
+}
+
+/**
+ * Account for samples the UDP sender couldn't get onto the wire.
+ */
+static
+void _demod_thread_udp_dropped(struct demod_thread *dthr, size_t nr_dropped)
+{
+    if (0 != nr_dropped) {
+        if (0 == dthr->nr_dropped_samples) {
+            MFM_MSG(SEV_WARNING, "UDP-OUTPUT-DROPS", "UDP socket send buffer is full. "
+                    "Until it drains, we're dropping samples.");
+        }
+        dthr->nr_dropped_samples += nr_dropped;
+        stats_counter_add(&dthr->stats.nr_dropped_samples, nr_dropped);
+    } else if (0 != dthr->nr_dropped_samples) {
+        MFM_MSG(SEV_WARNING, "UDP-OUTPUT-RESUMED", "UDP socket send buffer drained. Dropped %zu "
+                "samples in the interim.", dthr->nr_dropped_samples);
+        dthr->nr_dropped_samples = 0;
+    }
+}
+
+/**
+ * Hand a batch of PCM samples to the consumer, however this demodulator is set up to do so.
+ * The capture time of the batch (0 if unknown) is passed along where the output supports it.
+ */
+static
+void _demod_thread_output(struct demod_thread *dthr, int16_t *out_buf, size_t nr_bytes, uint64_t time_ns)
+{
+    int fifo_ret = 0;
+
+    if (DEMOD_OUTPUT_DECODER == dthr->out_mode) {
+        /* The samples are already in the decoder's ring */
+        TSL_BUG_IF_FAILED(pcm_decoder_produce(dthr->decoder, nr_bytes / sizeof(int16_t)));
+        return;
+    }
+
+    if (DEMOD_OUTPUT_UDP == dthr->out_mode) {
+        size_t nr_dropped = 0;
+
+        /* Queued, and sent once a batch of datagrams fills, or the sample buffer is done */
+        TSL_BUG_IF_FAILED(pcm_udp_sender_write(dthr->udp, out_buf, dthr->nr_pcm_samples, time_ns, &nr_dropped));
+        _demod_thread_udp_dropped(dthr, nr_dropped);
+        return;
+    }
+
+    if (DEMOD_OUTPUT_SHM_RING == dthr->out_mode) {
+        size_t nr_out = nr_bytes / sizeof(int16_t),
+               nr_written = 0;
+
+        if (0 != time_ns && 0 != nr_out) {
+            TSL_BUG_IF_FAILED(pcm_ring_stamp(dthr->pcm_ring, time_ns));
+        }
+
+        TSL_BUG_IF_FAILED(pcm_ring_write(dthr->pcm_ring, out_buf, nr_out, &nr_written));
+
+        if (nr_written != nr_out) {
+            if (0 == dthr->nr_dropped_samples) {
+                MFM_MSG(SEV_WARNING, "PCM-RING-FULL", "Shared memory PCM ring is full. "
+                        "Until a consumer catches up, we're dropping samples.");
+            }
+            dthr->nr_dropped_samples += nr_out - nr_written;
+            stats_counter_add(&dthr->stats.nr_dropped_samples, nr_out - nr_written);
+        } else if (0 != dthr->nr_dropped_samples) {
+            MFM_MSG(SEV_WARNING, "PCM-RING-RESUMED", "Shared memory PCM ring consumer caught up. Dropped %zu "
+                    "samples in the interim.", dthr->nr_dropped_samples);
+            dthr->nr_dropped_samples = 0;
+        }
+
+        return;
+    }
+
+    /* No reader has opened the FIFO yet, so drop the samples, as if the reader had gone away */
+    if (-1 == dthr->fifo_fd) {
+        uint64_t now_ns = stats_now_ns();
+
+        if (now_ns >= dthr->fifo_retry_ns) {
+            dthr->fifo_retry_ns = now_ns + DEMOD_FIFO_RETRY_NS;
+
+            if (!FAILED(_demod_output_attach(dthr))) {
+                MFM_MSG(SEV_INFO, "FIFO-READER", "Output fifo '%s' has a reader, writing samples to it.",
+                        dthr->fifo_path);
+            }
+        }
+
+        /* Even if we just opened the FIFO, this batch isn't in a splice buffer */
+        dthr->nr_dropped_samples += dthr->nr_pcm_samples;
+        stats_counter_add(&dthr->stats.nr_dropped_samples, dthr->nr_pcm_samples);
+        return;
+    }
+
+    CYCLE_COUNT_START(cycles);
+    fifo_ret = _demod_thread_fifo_write(dthr, out_buf, nr_bytes);
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_FIFO_WRITE, cycles);
+
+    if (0 > fifo_ret) {
+        int errnum = errno;
+        if (errnum == EPIPE) {
+            if (0 == dthr->nr_dropped_samples) {
+                MFM_MSG(SEV_WARNING, "FIFO-REMOTE-END-DISCONNECTED", "Remote end of FIFO disconnected. "
+                        "Until a process picks up the FIFO, we're dropping samples.");
+            }
+            dthr->nr_dropped_samples += dthr->nr_pcm_samples;
+            stats_counter_add(&dthr->stats.nr_dropped_samples, dthr->nr_pcm_samples);
+        } else {
+            PANIC("Failed to write %zu bytes to the output fifo. Reason: %s (%d)",
+                    nr_bytes, strerror(errnum), errnum);
+        }
+    } else if (0 != dthr->nr_dropped_samples) {
+        MFM_MSG(SEV_WARNING, "FIFO-RESUMED", "Remote FIFO end reconnected. Dropped %zu samples in the interim.",
+                dthr->nr_dropped_samples);
+        dthr->nr_dropped_samples = 0;
+    }
+}
+
+/*
+ * The channel filter is either a direct_fir or a multistage_fir, which share an interface
+ */
+static inline
+aresult_t _demod_filter_push(struct demod_thread *dthr, struct sample_buf *sbuf)
+{
+    return true == dthr->multistage ? multistage_fir_push_sample_buf(&dthr->msfir, sbuf) :
+        direct_fir_push_sample_buf(&dthr->fir, sbuf);
+}
+
+static inline
+aresult_t _demod_filter_can_process(struct demod_thread *dthr, bool *pcan_process)
+{
+    return true == dthr->multistage ? multistage_fir_can_process(&dthr->msfir, pcan_process, NULL) :
+        direct_fir_can_process(&dthr->fir, pcan_process, NULL);
+}
+
+static inline
+aresult_t _demod_filter_process(struct demod_thread *dthr, int16_t *out_buf, size_t nr_out_samples,
+        size_t *pnr_samples)
+{
+    return true == dthr->multistage ? multistage_fir_process(&dthr->msfir, out_buf, nr_out_samples, pnr_samples) :
+        direct_fir_process(&dthr->fir, out_buf, nr_out_samples, pnr_samples);
+}
+
+/**
+ * Pick the batch size for the next sample buffer, if this channel adapts it. A backlog in the ring
+ * means we're falling behind, so take bigger bites to spread the cost of each FIR, demodulator and
+ * output call over more samples. Once caught up, give that back while the samples of the buffer
+ * just processed were later than the target getting out.
+ */
+static
+void _demod_thread_adapt(struct demod_thread *dthr, uint64_t latency_ns)
+{
+    size_t batch_len = dthr->batch_len;
+
+    if (0 == dthr->latency_target_ns) {
+        return;
+    }
+
+    if (0 != spsc_ring_depth(&dthr->ring)) {
+        batch_len = BL_MIN2(2 * batch_len, dthr->max_batch_len);
+    } else if (latency_ns > dthr->latency_target_ns) {
+        batch_len = BL_MAX2(batch_len / 2, dthr->min_batch_len);
+    }
+
+    if (batch_len != dthr->batch_len) {
+        dthr->batch_len = batch_len;
+        atomic_store_explicit(&dthr->stats.batch_len, batch_len, memory_order_relaxed);
+    }
+}
+
 static
 aresult_t demod_thread_process(struct demod_thread *dthr, struct sample_buf *sbuf)
 {
     aresult_t ret = A_OK;
 
     bool can_process = false;
+    uint64_t start_ns = 0,
+             process_ns = 0,
+             capture_ns = 0,
+             seq = 0;
+    size_t nr_in = 0;
 
     TSL_ASSERT_ARG(NULL != dthr);
     TSL_ASSERT_ARG(NULL != sbuf);
 
-    TSL_BUG_IF_FAILED(direct_fir_push_sample_buf(&dthr->fir, sbuf));
-    TSL_BUG_IF_FAILED(direct_fir_can_process(&dthr->fir, &can_process, NULL));
+    start_ns = stats_now_ns();
+    seq = sbuf->seq;
+    capture_ns = sbuf->start_time_ns;
+
+    sample_trace_record(SAMPLE_TRACE_QUEUE, seq, sbuf->deliver_ns, start_ns);
 
-    TSL_BUG_ON(false == can_process);
+    /* The filter didn't take the buffer, so drop it rather than fall over */
+    if (FAILED(ret = _demod_filter_push(dthr, sbuf))) {
+        if (0 == stats_counter_read(&dthr->stats.nr_filter_drops)) {
+            MFM_MSG(SEV_WARNING, "DEMOD-FILTER-BUSY", "Channel at %d Hz: the channel filter can't take any more "
+                    "samples, dropping sample buffers.", dthr->center_freq_hz);
+        }
+        stats_counter_add(&dthr->stats.nr_filter_drops, 1);
+        TSL_BUG_IF_FAILED(sample_buf_decref(sbuf));
+        ret = A_OK;
+        goto done;
+    }
+
+    TSL_BUG_IF_FAILED(_demod_filter_can_process(dthr, &can_process));
+
+    /* A multi-stage filter might need a few small buffers before its final FIR has a full window */
+    TSL_BUG_ON(false == dthr->multistage && false == can_process);
 
     while (true == can_process) {
         size_t nr_samples = 0,
                nr_processed_bytes = 0;
+        int16_t *out_buf = NULL;
+        uint64_t batch_ns = 0,
+                 output_ns = 0;
+
+        /* Capture time of the first sample in this batch, working forward from the buffer's */
+        if (0 != sbuf->start_time_ns) {
+            batch_ns = sbuf->start_time_ns + (uint64_t)nr_in * 1000000000ull / dthr->samp_hz;
+        }
 
         /* 1. Filter using FIR, decimate by the specified factor. Iterate over the output
          *    buffer samples.
          */
-        TSL_BUG_IF_FAILED(direct_fir_process(&dthr->fir, dthr->filt_samp_buf + dthr->nr_fm_samples,
-                    LPF_OUTPUT_LEN - dthr->nr_fm_samples, &nr_samples));
+        TSL_BUG_IF_FAILED(_demod_filter_process(dthr, dthr->filt_samp_buf + dthr->nr_fm_samples,
+                    dthr->batch_len - dthr->nr_fm_samples, &nr_samples));
 
-        dthr->total_nr_demod_samples += nr_samples;
+        stats_counter_add(&dthr->stats.nr_demod_samples, nr_samples);
+        nr_in += nr_samples * dthr->decimation;
 
-        if (-1 != dthr->debug_signal_fd) {
-            if (0 > write(dthr->debug_signal_fd, dthr->filt_samp_buf + dthr->nr_fm_samples, nr_samples * 2 * sizeof(int16_t))) {
-                int errnum = errno;
-                MFM_MSG(SEV_WARNING, "CANT-WRITE-DEBUG-FILE", "Unable to write %zu bytes to post-demod debug file. Reason: %s (%d). Skipping.",
-                        nr_samples * 2 * sizeof(int16_t), strerror(errnum), errnum);
-            }
+        if (NULL != dthr->debug_rec && 0 != nr_samples) {
+            TSL_BUG_IF_FAILED(iq_recorder_write(dthr->debug_rec, dthr->filt_samp_buf + dthr->nr_fm_samples,
+                        nr_samples * 2 * sizeof(int16_t)));
+        }
+
+        /* Nothing on the channel, so there's nothing worth demodulating or writing out */
+        if (true == dthr->use_gate && 0 != nr_samples &&
+                false == energy_gate_update(&dthr->gate, dthr->filt_samp_buf + dthr->nr_fm_samples, nr_samples))
+        {
+            stats_counter_add(&dthr->stats.nr_gated_samples, nr_samples);
+            dthr->nr_fm_samples = 0;
+            TSL_BUG_IF_FAILED(_demod_filter_can_process(dthr, &can_process));
+            continue;
         }
 
         dthr->nr_fm_samples += nr_samples;
 
         /* 2. Perform quadrature demod, write to output demodulation buffer. */
-        /* TODO: smarten this up a lot - this sucks */
         dthr->nr_pcm_samples = 0;
 
-        TSL_BUG_IF_FAILED(multifm_fm_demod_process(dthr->demod, dthr->filt_samp_buf, dthr->nr_fm_samples,
-                    dthr->out_buf, &dthr->nr_pcm_samples, &nr_processed_bytes));
+        out_buf = dthr->out_buf;
+        if (DEMOD_OUTPUT_FIFO_VMSPLICE == dthr->out_mode && NULL != dthr->splice_bufs) {
+            out_buf = dthr->splice_bufs + dthr->next_splice_buf * dthr->splice_buf_stride;
+        } else if (DEMOD_OUTPUT_DECODER == dthr->out_mode) {
+            TSL_BUG_IF_FAILED(pcm_decoder_write_ptr(dthr->decoder, &out_buf));
+        }
+
+        TSL_BUG_IF_FAILED(demod_base_process(dthr->demod, dthr->filt_samp_buf, dthr->nr_fm_samples,
+                    out_buf, &dthr->nr_pcm_samples, &nr_processed_bytes));
 
         /* x. Write out the resulting PCM samples */
-        if (0 > write(dthr->fifo_fd, dthr->out_buf, nr_processed_bytes)) {
-            int errnum = errno;
-            if (errnum == EPIPE) {
-                if (0 == dthr->nr_dropped_samples) {
-                    MFM_MSG(SEV_WARNING, "FIFO-REMOTE-END-DISCONNECTED", "Remote end of FIFO disconnected. "
-                            "Until a process picks up the FIFO, we're dropping samples.");
-                }
-                dthr->nr_dropped_samples += dthr->nr_pcm_samples;
-            } else {
-                PANIC("Failed to write %zu bytes to the output fifo. Reason: %s (%d)",
-                        sizeof(int16_t) * dthr->nr_pcm_samples,
-                        strerror(errnum), errnum);
-            }
-        } else if (0 != dthr->nr_dropped_samples) {
-            MFM_MSG(SEV_WARNING, "FIFO-RESUMED", "Remote FIFO end reconnected. Dropped %zu samples in the interim.",
-                    dthr->nr_dropped_samples);
-            dthr->nr_dropped_samples = 0;
+        output_ns = sample_trace_now_ns();
+        _demod_thread_output(dthr, out_buf, nr_processed_bytes, batch_ns);
+        sample_trace_record(SAMPLE_TRACE_OUTPUT, seq, output_ns, sample_trace_now_ns());
+        stats_counter_add(&dthr->stats.nr_pcm_samples, dthr->nr_pcm_samples);
+
+        if (DEMOD_OUTPUT_FIFO_VMSPLICE == dthr->out_mode && NULL != dthr->splice_bufs) {
+            dthr->next_splice_buf = (dthr->next_splice_buf + 1) % dthr->nr_splice_bufs;
         }
 
-        TSL_BUG_IF_FAILED(direct_fir_can_process(&dthr->fir, &can_process, NULL));
+        TSL_BUG_IF_FAILED(_demod_filter_can_process(dthr, &can_process));
 
         /* We're done with this batch of samples, woohoo */
         dthr->nr_fm_samples = 0;
     }
 
+    /* Send whatever datagrams this sample buffer left queued */
+    if (DEMOD_OUTPUT_UDP == dthr->out_mode) {
+        size_t nr_dropped = 0;
+        TSL_BUG_IF_FAILED(pcm_udp_sender_flush(dthr->udp, &nr_dropped));
+        _demod_thread_udp_dropped(dthr, nr_dropped);
+    }
+
     /* Force the thread to wait until a new buffer is available */
 
+    process_ns = stats_now_ns() - start_ns;
+    sample_trace_record(SAMPLE_TRACE_DEMOD, seq, start_ns, start_ns + process_ns);
+    stats_counter_add(&dthr->stats.nr_bufs, 1);
+    stats_counter_add(&dthr->stats.total_process_ns, process_ns);
+    stats_counter_max(&dthr->stats.max_process_ns, process_ns);
+
+    if (0 != capture_ns) {
+        _demod_thread_adapt(dthr, start_ns + process_ns - capture_ns);
+    }
+
+done:
     return ret;
 }
 
@@ -127,60 +388,329 @@ aresult_t _demod_thread_work(struct worker_thread *wthr)
 
     struct demod_thread *dthr = BL_CONTAINER_OF(wthr, struct demod_thread, wthr);
 
-    pthread_mutex_lock(&dthr->wq_mtx);
-
     while (worker_thread_is_running(wthr)) {
         struct sample_buf *buf = NULL;
-        TSL_BUG_IF_FAILED(work_queue_pop(&dthr->wq, (void **)&buf));
+        TSL_BUG_IF_FAILED(spsc_ring_pop(&dthr->ring, (void **)&buf));
 
         if (NULL != buf) {
-            pthread_mutex_unlock(&dthr->wq_mtx);
-
             /* Process the buffer */
             TSL_BUG_IF_FAILED(demod_thread_process(dthr, buf));
-
-            /* Re-acquire the lock */
-            pthread_mutex_lock(&dthr->wq_mtx);
         } else {
-            /* Wait until the acquisition thread wakes us up */
-            int pt_en = 0;
-            struct timespec ts;
-            clock_gettime(CLOCK_REALTIME, &ts);
-            ts.tv_sec += 1;
-            if (0 != (pt_en = pthread_cond_timedwait(&dthr->wq_cv, &dthr->wq_mtx, &ts))) {
-                DIAG("Warning: nothing was ready for us to consume. %s (%d)", strerror(pt_en),
-                        pt_en);
-                continue;
-            }
+            /* Sleep until the acquisition thread wakes us up */
+            TSL_BUG_IF_FAILED(spsc_ring_wait(&dthr->ring, 1000));
+        }
+    }
+
+    DIAG("Processed %" PRIu64 " samples before termination.", stats_counter_read(&dthr->stats.nr_demod_samples));
+
+    return ret;
+}
+
+aresult_t demod_thread_set_batch(struct demod_thread *thr, size_t batch_len, size_t min_batch_len,
+        uint64_t latency_target_ns)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != thr);
+    TSL_ASSERT_ARG(false == thr->has_thread);
+    TSL_ASSERT_ARG(DEMOD_MIN_BATCH_LEN <= min_batch_len);
+    TSL_ASSERT_ARG(min_batch_len <= batch_len);
+    TSL_ASSERT_ARG(batch_len <= thr->max_batch_len);
+
+    thr->batch_len = batch_len;
+    thr->min_batch_len = 0 != latency_target_ns ? min_batch_len : batch_len;
+    thr->latency_target_ns = latency_target_ns;
+    atomic_store(&thr->stats.batch_len, batch_len);
+
+    return ret;
+}
+
+aresult_t demod_thread_start(struct demod_thread *thr, unsigned core_id)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != thr);
+    TSL_ASSERT_ARG(false == thr->has_thread);
+
+    if (FAILED(ret = worker_thread_new(&thr->wthr, _demod_thread_work, core_id))) {
+        MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start demodulator thread, aborting.");
+        goto done;
+    }
+
+    thr->has_thread = true;
+
+done:
+    return ret;
+}
+
+aresult_t demod_thread_service(struct demod_thread *thr, bool *pdid_work)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != thr);
+    TSL_ASSERT_ARG_DEBUG(NULL != pdid_work);
+
+    *pdid_work = false;
+
+    /* Cheap check before we bother contending for the demodulator */
+    if (true == spsc_ring_empty(&thr->ring)) {
+        goto done;
+    }
+
+    /* Someone else is already working on this demodulator */
+    if (atomic_flag_test_and_set_explicit(&thr->busy, memory_order_acquire)) {
+        goto done;
+    }
+
+    /* Catch up on a few buffers while the filter state is still in cache, but leave some for the others */
+    for (size_t i = 0; i < DEMOD_SERVICE_MAX_BUFS; i++) {
+        buf = NULL;
+        TSL_BUG_IF_FAILED(spsc_ring_pop(&thr->ring, (void **)&buf));
+
+        if (NULL == buf) {
+            break;
         }
+
+        TSL_BUG_IF_FAILED(demod_thread_process(thr, buf));
+        *pdid_work = true;
+    }
+
+    atomic_flag_clear_explicit(&thr->busy, memory_order_release);
+
+done:
+    return ret;
+}
+
+/**
+ * Open the output FIFO, if a reader has shown up. The FIFO is opened non-blocking, so we never
+ * wait for a reader, then switched back to blocking writes, so a slow reader still holds us up
+ * rather than losing samples. Doesn't say why it failed, since it's retried until a reader
+ * appears.
+ *
+ * \param thr The demodulator thread
+ *
+ * \return A_OK if the FIFO is now open, A_E_BUSY if there is no reader yet, an error code otherwise
+ */
+static
+aresult_t _demod_output_attach(struct demod_thread *thr)
+{
+    aresult_t ret = A_OK;
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE),
+           stride_bytes = 0;
+    int pipe_size = 0,
+        flags = 0,
+        fd = -1;
+
+    if (0 > (fd = open(thr->fifo_path, O_WRONLY | O_NONBLOCK))) {
+        ret = ENXIO == errno ? A_E_BUSY : A_E_INVAL;
+        goto done;
+    }
+
+    if (0 > (flags = fcntl(fd, F_GETFL)) || 0 > fcntl(fd, F_SETFL, flags & ~O_NONBLOCK)) {
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (DEMOD_OUTPUT_FIFO_VMSPLICE != thr->out_mode) {
+        goto attached;
+    }
+
+    if (0 > (pipe_size = fcntl(fd, F_GETPIPE_SZ))) {
+        int errnum = errno;
+        MFM_MSG(SEV_WARNING, "CANT-VMSPLICE", "Output '%s' must be a FIFO to use vmsplice: %s (%d). Writing "
+                "to it instead.", thr->fifo_path, strerror(errnum), errnum);
+        thr->out_mode = DEMOD_OUTPUT_FIFO_WRITE;
+        goto attached;
+    }
+
+    /* Every buffer gets pages to itself, and we keep twice as many as the pipe has pages (in
+     * case a batch gets split across two splices), so a buffer is never reused while the pipe
+     * still holds a reference to it.
+     */
+    stride_bytes = (2 * thr->max_batch_len * sizeof(int16_t) + page_size - 1) & ~(page_size - 1);
+    thr->splice_buf_stride = stride_bytes / sizeof(int16_t);
+    thr->nr_splice_bufs = 2 * ((size_t)pipe_size / page_size) + 2;
+    thr->next_splice_buf = 0;
+
+    if (FAILED(ret = TACALLOC((void **)&thr->splice_bufs, thr->nr_splice_bufs, stride_bytes, page_size))) {
+        MFM_MSG(SEV_FATAL, "NO-MEM", "Out of memory for vmsplice buffers.");
+        goto done;
     }
 
-    DIAG("Processed %zu samples before termination.", dthr->total_nr_demod_samples);
+    DIAG("Output '%s': vmsplice with %zu buffers, pipe size %d bytes", thr->fifo_path, thr->nr_splice_bufs, pipe_size);
+
+attached:
+    thr->fifo_fd = fd;
+    fd = -1;
+
+done:
+    if (0 <= fd) {
+        close(fd);
+    }
 
     return ret;
 }
 
+/**
+ * Set up the output path for the demodulator thread. An output FIFO nobody is reading yet is
+ * opened later on, once a reader shows up; until then, its samples are dropped.
+ *
+ * \param thr The demodulator thread
+ * \param out_path The FIFO to open, or the shared memory ring file to create. Unused for an
+ *                 in-process decoder, or UDP output.
+ * \param out_mode How samples are delivered
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+static
+aresult_t _demod_output_prepare(struct demod_thread *thr, const char *out_path, enum demod_output_mode out_mode)
+{
+    aresult_t ret = A_OK;
+
+    struct stat st;
+
+    TSL_ASSERT_ARG(NULL != thr);
+    TSL_ASSERT_ARG(DEMOD_OUTPUT_DECODER == out_mode || DEMOD_OUTPUT_UDP == out_mode ||
+            (NULL != out_path && '\0' != *out_path));
+
+    thr->out_mode = out_mode;
+
+    if (DEMOD_OUTPUT_DECODER == out_mode || DEMOD_OUTPUT_UDP == out_mode) {
+        goto done;
+    }
+
+    if (DEMOD_OUTPUT_SHM_RING == out_mode) {
+        if (FAILED(ret = pcm_ring_create(&thr->pcm_ring, out_path, DEMOD_PCM_RING_SAMPLES))) {
+            MFM_MSG(SEV_FATAL, "CANT-CREATE-PCM-RING", "Unable to create shared memory PCM ring '%s'", out_path);
+            goto done;
+        }
+
+        MFM_MSG(SEV_INFO, "PCM-RING", "Publishing PCM samples to shared memory ring '%s'", out_path);
+        goto done;
+    }
+
+    if (DEMOD_OUTPUT_FIFO_VMSPLICE == out_mode && (0 > stat(out_path, &st) || !S_ISFIFO(st.st_mode))) {
+        MFM_MSG(SEV_FATAL, "CANT-VMSPLICE", "Output '%s' must be a FIFO to use vmsplice", out_path);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&thr->fifo_path, strlen(out_path) + 1, sizeof(char)))) {
+        goto done;
+    }
+
+    strcpy(thr->fifo_path, out_path);
+
+    /* Open the output FIFO, if there's a reader already */
+    if (FAILED(ret = _demod_output_attach(thr))) {
+        if (A_E_BUSY != ret) {
+            int errnum = errno;
+            MFM_MSG(SEV_FATAL, "CANT-OPEN-FIFO", "Unable to open output fifo '%s': %s (%d)", out_path,
+                    strerror(errnum), errnum);
+            goto done;
+        }
+
+        MFM_MSG(SEV_INFO, "FIFO-NO-READER", "Output fifo '%s' has no reader yet, dropping its samples until "
+                "it does.", out_path);
+        ret = A_OK;
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Release the output path for the demodulator thread.
+ */
+static
+void _demod_output_cleanup(struct demod_thread *thr)
+{
+    if (-1 != thr->fifo_fd) {
+        close(thr->fifo_fd);
+        thr->fifo_fd = -1;
+    }
+
+    if (NULL != thr->fifo_path) {
+        TFREE(thr->fifo_path);
+    }
+
+    if (NULL != thr->pcm_ring) {
+        TSL_BUG_IF_FAILED(pcm_ring_delete(&thr->pcm_ring));
+    }
+
+    if (NULL != thr->splice_bufs) {
+        TFREE(thr->splice_bufs);
+    }
+
+    if (NULL != thr->debug_rec) {
+        TSL_BUG_IF_FAILED(iq_recorder_delete(&thr->debug_rec));
+    }
+}
+
+static
+void _demod_coeff_cache_put(struct demod_coeff_cache_entry *ent);
+
 aresult_t demod_thread_delete(struct demod_thread **pthr)
 {
     aresult_t ret = A_OK;
 
     struct demod_thread *thr = NULL;
+    struct sample_buf *buf = NULL;
 
     TSL_ASSERT_ARG(NULL != pthr);
     TSL_ASSERT_ARG(NULL != *pthr);
 
     thr = *pthr;
 
-    TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&thr->wthr));
-    TSL_BUG_IF_FAILED(worker_thread_delete(&thr->wthr));
-    TSL_BUG_IF_FAILED(work_queue_release(&thr->wq));
-
-    if (-1 != thr->fifo_fd) {
-        close(thr->fifo_fd);
-        thr->fifo_fd = -1;
+    if (true == thr->has_thread) {
+        TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&thr->wthr));
+        TSL_BUG_IF_FAILED(worker_thread_delete(&thr->wthr));
+        thr->has_thread = false;
     }
 
+    /* Release any sample buffers that never got processed */
+    do {
+        buf = NULL;
+        TSL_BUG_IF_FAILED(spsc_ring_pop(&thr->ring, (void **)&buf));
+        if (NULL != buf) {
+            TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+        }
+    } while (NULL != buf);
+
+    TSL_BUG_IF_FAILED(spsc_ring_cleanup(&thr->ring));
+
+    _demod_output_cleanup(thr);
+
     TSL_BUG_IF_FAILED(direct_fir_cleanup(&thr->fir));
+    TSL_BUG_IF_FAILED(multistage_fir_cleanup(&thr->msfir));
+
+    if (NULL != thr->coeff_ent) {
+        _demod_coeff_cache_put(thr->coeff_ent);
+        thr->coeff_ent = NULL;
+    }
+
+    if (NULL != thr->demod) {
+        TSL_BUG_IF_FAILED(demod_base_cleanup(&thr->demod));
+    }
+
+    if (NULL != thr->decoder) {
+        TSL_BUG_IF_FAILED(pcm_decoder_delete(&thr->decoder));
+    }
+
+    if (NULL != thr->udp) {
+        TSL_BUG_IF_FAILED(pcm_udp_sender_delete(&thr->udp));
+    }
+
+    if (NULL != thr->filt_samp_buf) {
+        TFREE(thr->filt_samp_buf);
+    }
+
+    if (NULL != thr->out_buf) {
+        TFREE(thr->out_buf);
+    }
 
     TFREE(thr);
 
@@ -189,50 +719,235 @@ aresult_t demod_thread_delete(struct demod_thread **pthr)
     return ret;
 }
 
+aresult_t demod_thread_deliver(struct demod_thread *thr, struct sample_buf *buf, struct demod_shed *shed)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != thr);
+    TSL_ASSERT_ARG_DEBUG(NULL != buf);
+    TSL_ASSERT_ARG_DEBUG(NULL != shed);
+
+    /* Something more important is falling behind, so give it our share of the CPU */
+    if (thr->priority > shed->level) {
+        if (false == thr->shedding) {
+            MFM_MSG(SEV_WARNING, "DEMOD-SHEDDING", "Channel at %d Hz: more important channels are falling behind, "
+                    "dropping sample buffers.", thr->center_freq_hz);
+            thr->shedding = true;
+        }
+        stats_counter_add(&thr->stats.nr_shed_bufs, 1);
+        TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+        goto done;
+    }
+
+    if (true == thr->shedding) {
+        MFM_MSG(SEV_INFO, "DEMOD-SHED-RESUMED", "Channel at %d Hz: resuming, %" PRIu64 " sample buffers shed so far.",
+                thr->center_freq_hz, stats_counter_read(&thr->stats.nr_shed_bufs));
+        thr->shedding = false;
+    }
+
+    if (thr->priority < shed->next_level && DEMOD_BACKLOG_ENTRIES <= spsc_ring_depth(&thr->ring)) {
+        shed->next_level = thr->priority;
+    }
+
+    /* This will only enter the kernel if the thread is asleep waiting for samples */
+    if (FAILED(spsc_ring_push(&thr->ring, buf))) {
+        if (0 == stats_counter_read(&thr->stats.nr_ring_full_drops)) {
+            MFM_MSG(SEV_WARNING, "DEMOD-FALLING-BEHIND", "Demodulator thread is not keeping up, dropping sample buffers.");
+        }
+        stats_counter_add(&thr->stats.nr_ring_full_drops, 1);
+        TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+    }
+
+done:
+    return ret;
+}
+
 /**
- * Prepare a FIR for channelizing. Converts tuned LPF to a band-pass filter.
- *
- * \param thr The thread to attach the FIR to
- * \param lpf_taps The taps for the direct-form FIR. These are real, the filter must be at baseband.
- * \param lpf_nr_taps The number of taps in the direct-form FIR. This is the order of the filter + 1.
- * \param offset_hz The offset, in hertz, from the center frequency
- * \param sample_rate The sample rate of the input stream
- * \param decimation The decimation factor for the output from this FIR.
+ * A set of frequency shifted filter coefficients, shared read-only by every channel that uses
+ * them, and kept around once they are unused in case a channel comes back
+ */
+struct demod_coeff_cache_entry {
+    /**
+     * What the coefficients were computed from. The prototype is identified by a hash.
+     */
+    uint64_t proto_hash;
+    size_t nr_taps;
+    int32_t offset_hz;
+    uint32_t sample_rate;
+    double gain;
+
+    /**
+     * The number of channel FIRs reading these coefficients. Entries in use are never evicted.
+     */
+    unsigned refcount;
+
+    /**
+     * When this entry was last used, in lookups since startup. The oldest unused entry is replaced.
+     */
+    uint64_t last_used;
+
+    /**
+     * The real coefficients, followed by the imaginary coefficients, cache line aligned. NULL if
+     * the entry is empty.
+     */
+    int16_t *coeffs;
+};
+
+/**
+ * The channel filters, whether in use or recently used. Channels are created from whatever
+ * thread is configuring the receiver, so access is serialized.
+ */
+static struct {
+    pthread_mutex_t lock;
+    uint64_t clock;
+    struct demod_coeff_cache_entry entries[DEMOD_COEFF_CACHE_ENTRIES];
+} _demod_coeff_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * FNV-1a over the filter prototype.
+ */
+static
+uint64_t _demod_coeff_proto_hash(const double *lpf_taps, size_t lpf_nr_taps)
+{
+    const uint8_t *bytes = (const uint8_t *)lpf_taps;
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < lpf_nr_taps * sizeof(double); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+/**
+ * Find a cached set of coefficients, and take a reference to it. Must be called with the cache
+ * lock held.
+ */
+static
+struct demod_coeff_cache_entry *_demod_coeff_cache_get(uint64_t proto_hash, size_t nr_taps, int32_t offset_hz,
+        uint32_t sample_rate, double gain)
+{
+    for (size_t i = 0; i < DEMOD_COEFF_CACHE_ENTRIES; i++) {
+        struct demod_coeff_cache_entry *ent = &_demod_coeff_cache.entries[i];
+
+        if (NULL != ent->coeffs && ent->proto_hash == proto_hash && ent->nr_taps == nr_taps &&
+                ent->offset_hz == offset_hz && ent->sample_rate == sample_rate && ent->gain == gain)
+        {
+            ent->last_used = ++_demod_coeff_cache.clock;
+            ent->refcount++;
+            return ent;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Hand a set of coefficients over to the cache, and take a reference to it. Replaces an empty
+ * entry, or the least recently used entry no channel is using. Must be called with the cache
+ * lock held.
  *
- * \return A_OK on success, an error code otherwise
+ * \return The entry, or NULL if every entry is in use, in which case the caller still owns coeffs.
  */
 static
-aresult_t _demod_fir_prepare(struct demod_thread *thr, const double *lpf_taps, size_t lpf_nr_taps, int32_t offset_hz, uint32_t sample_rate, int decimation, double gain)
+struct demod_coeff_cache_entry *_demod_coeff_cache_insert(uint64_t proto_hash, size_t nr_taps, int32_t offset_hz,
+        uint32_t sample_rate, double gain, int16_t *coeffs)
 {
-    aresult_t ret = A_OK;
+    struct demod_coeff_cache_entry *victim = NULL;
 
-    int16_t *coeffs = NULL;
-    double f_offs = -2.0 * M_PI * (double)offset_hz / (double)sample_rate;
-#ifdef _DUMP_LPF
-    int64_t power = 0;
-    double dpower = 0.0;
-#endif /* defined(_DUMP_LPF) */
-    size_t base = lpf_nr_taps;
+    for (size_t i = 0; i < DEMOD_COEFF_CACHE_ENTRIES; i++) {
+        struct demod_coeff_cache_entry *ent = &_demod_coeff_cache.entries[i];
 
-    DIAG("Preparing LPF for offset %d Hz", offset_hz);
+        if (NULL == ent->coeffs) {
+            victim = ent;
+            break;
+        }
 
-    TSL_ASSERT_ARG(NULL != thr);
-    TSL_ASSERT_ARG(NULL != lpf_taps);
-    TSL_ASSERT_ARG(0 != lpf_nr_taps);
+        if (0 == ent->refcount && (NULL == victim || ent->last_used < victim->last_used)) {
+            victim = ent;
+        }
+    }
 
-    if (FAILED(ret = TACALLOC((void *)&coeffs, lpf_nr_taps, sizeof(int16_t) * 2, SYS_CACHE_LINE_LENGTH))) {
-        MFM_MSG(SEV_FATAL, "NO-MEM", "Out of memory for FIR.");
-        goto done;
+    if (NULL == victim) {
+        return NULL;
+    }
+
+    if (NULL != victim->coeffs) {
+        TFREE(victim->coeffs);
     }
 
+    victim->proto_hash = proto_hash;
+    victim->nr_taps = nr_taps;
+    victim->offset_hz = offset_hz;
+    victim->sample_rate = sample_rate;
+    victim->gain = gain;
+    victim->refcount = 1;
+    victim->last_used = ++_demod_coeff_cache.clock;
+    victim->coeffs = coeffs;
+
+    return victim;
+}
+
+/**
+ * Drop a channel's reference to its coefficients. They stay cached for reuse until evicted.
+ */
+static
+void _demod_coeff_cache_put(struct demod_coeff_cache_entry *ent)
+{
+    pthread_mutex_lock(&_demod_coeff_cache.lock);
+    TSL_BUG_ON(0 == ent->refcount);
+    ent->refcount--;
+    pthread_mutex_unlock(&_demod_coeff_cache.lock);
+}
+
+void demod_coeff_cache_flush(void)
+{
+    pthread_mutex_lock(&_demod_coeff_cache.lock);
+
+    for (size_t i = 0; i < DEMOD_COEFF_CACHE_ENTRIES; i++) {
+        struct demod_coeff_cache_entry *ent = &_demod_coeff_cache.entries[i];
+
+        /* Every channel should be gone by now */
+        TSL_BUG_ON(0 != ent->refcount);
+
+        if (NULL != ent->coeffs) {
+            TFREE(ent->coeffs);
+        }
+    }
+
+    pthread_mutex_unlock(&_demod_coeff_cache.lock);
+}
+
+/**
+ * Compute the coefficients of the channel filter: the prototype, shifted to the channel offset.
+ *
+ * \param coeffs The real coefficients, followed by the imaginary coefficients
+ */
+static
+void _demod_fir_compute(int16_t *coeffs, const double *lpf_taps, size_t lpf_nr_taps, int32_t offset_hz,
+        uint32_t sample_rate, double gain)
+{
+    const double f_offs = -2.0 * M_PI * (double)offset_hz / (double)sample_rate,
+                 center = (double)(lpf_nr_taps - 1) / 2.0,
+                 q15 = 1ll << Q_15_SHIFT;
+    const size_t base = lpf_nr_taps;
 #ifdef _DUMP_LPF
+    int64_t power = 0;
+    double dpower = 0.0;
+
     fprintf(stderr, "lpf_shifted_%d = [\n", offset_hz);
 #endif /* defined(_DUMP_LPF) */
 
+    /*
+     * Shift the prototype about its center tap, rather than about its first tap. This only
+     * changes the phase of the output by a constant, which the FM discriminator can't see, but
+     * keeps a symmetric prototype conjugate symmetric, so the FIR can fold its mirrored taps.
+     */
     for (size_t i = 0; i < lpf_nr_taps; i++) {
         /* Calculate the new tap coefficient */
-        const double complex lpf_tap = gain * cexp(CMPLX(0, f_offs * (double)i)) * lpf_taps[i];
-        const double q15 = 1ll << Q_15_SHIFT;
+        const double complex lpf_tap = gain * cexp(CMPLX(0, f_offs * ((double)i - center))) * lpf_taps[i];
 #ifdef _DUMP_LPF
         double ptemp = 0;
         int64_t samp_power = 0;
@@ -256,9 +971,77 @@ aresult_t _demod_fir_prepare(struct demod_thread *thr, const double *lpf_taps, s
     fprintf(stderr, "];\n");
     fprintf(stderr, "%% Total power: %llu (%016llx) (%f)\n", power, power, dpower);
 #endif /* defined(_DUMP_LPF) */
+}
+
+/**
+ * Prepare a FIR for channelizing. Converts tuned LPF to a band-pass filter. Channels with the
+ * same prototype, offset, sample rate and gain share one read-only copy of the coefficients.
+ *
+ * \param thr The thread to attach the FIR to
+ * \param lpf_taps The taps for the direct-form FIR. These are real, the filter must be at baseband.
+ * \param lpf_nr_taps The number of taps in the direct-form FIR. This is the order of the filter + 1.
+ * \param offset_hz The offset, in hertz, from the center frequency
+ * \param sample_rate The sample rate of the input stream
+ * \param decimation The decimation factor for the output from this FIR.
+ * \param gain The gain to apply to the channel
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+static
+aresult_t _demod_fir_prepare(struct demod_thread *thr, const double *lpf_taps, size_t lpf_nr_taps, int32_t offset_hz, uint32_t sample_rate, int decimation, double gain)
+{
+    aresult_t ret = A_OK;
+
+    int16_t *coeffs = NULL;
+    struct demod_coeff_cache_entry *ent = NULL;
+    uint64_t proto_hash = 0;
+    const size_t base = lpf_nr_taps;
+
+    DIAG("Preparing LPF for offset %d Hz", offset_hz);
+
+    TSL_ASSERT_ARG(NULL != thr);
+    TSL_ASSERT_ARG(NULL != lpf_taps);
+    TSL_ASSERT_ARG(0 != lpf_nr_taps);
+
+    proto_hash = _demod_coeff_proto_hash(lpf_taps, lpf_nr_taps);
+
+    /* Another channel might already be using, or have recently used, the same filter */
+    pthread_mutex_lock(&_demod_coeff_cache.lock);
+    ent = _demod_coeff_cache_get(proto_hash, lpf_nr_taps, offset_hz, sample_rate, gain);
+    pthread_mutex_unlock(&_demod_coeff_cache.lock);
+
+    if (NULL == ent) {
+        if (FAILED(ret = TACALLOC((void *)&coeffs, lpf_nr_taps, sizeof(int16_t) * 2, SYS_CACHE_LINE_LENGTH))) {
+            MFM_MSG(SEV_FATAL, "NO-MEM", "Out of memory for FIR.");
+            goto done;
+        }
 
-    /* Create a Direct Type FIR implementation */
-    TSL_BUG_IF_FAILED(direct_fir_init(&thr->fir, lpf_nr_taps, coeffs, &coeffs[base], decimation, true, sample_rate, offset_hz));
+        _demod_fir_compute(coeffs, lpf_taps, lpf_nr_taps, offset_hz, sample_rate, gain);
+
+        pthread_mutex_lock(&_demod_coeff_cache.lock);
+
+        /* Someone else might have computed the same filter in the meantime */
+        if (NULL == (ent = _demod_coeff_cache_get(proto_hash, lpf_nr_taps, offset_hz, sample_rate, gain)) &&
+                NULL != (ent = _demod_coeff_cache_insert(proto_hash, lpf_nr_taps, offset_hz, sample_rate, gain, coeffs)))
+        {
+            /* The cache owns the coefficients from here on */
+            coeffs = NULL;
+        }
+
+        pthread_mutex_unlock(&_demod_coeff_cache.lock);
+    }
+
+    if (NULL != ent) {
+        DIAG("Sharing LPF for offset %d Hz", offset_hz);
+        TSL_BUG_IF_FAILED(direct_fir_init_shared(&thr->fir, lpf_nr_taps, ent->coeffs, &ent->coeffs[base],
+                    decimation, true, sample_rate, offset_hz));
+        thr->coeff_ent = ent;
+    } else {
+        /* Every cache entry is in use by a distinct filter, so this channel gets its own copy */
+        DIAG("Coefficient cache is full, using a private LPF for offset %d Hz", offset_hz);
+        TSL_BUG_IF_FAILED(direct_fir_init(&thr->fir, lpf_nr_taps, coeffs, &coeffs[base], decimation, true,
+                    sample_rate, offset_hz));
+    }
 
 done:
     if (NULL != coeffs) {
@@ -268,21 +1051,87 @@ done:
     return ret;
 }
 
-aresult_t demod_thread_new(struct demod_thread **pthr, unsigned core_id,
-        int32_t offset_hz, uint32_t samp_hz, const char *out_fifo, int decimation_factor,
+/**
+ * Set up a multi-stage filter for the channel. Its final FIR is designed so the cascade has the
+ * magnitude response of the direct filter, lpf_taps, that would otherwise have been used.
+ */
+static
+aresult_t _demod_multistage_prepare(struct demod_thread *thr, const double *lpf_taps, size_t lpf_nr_taps,
+        int32_t offset_hz, uint32_t sample_rate, int decimation, unsigned cic_decimation, unsigned hb_decimation,
+        size_t nr_comp_taps, double gain)
+{
+    aresult_t ret = A_OK;
+
+    int16_t *coeffs = NULL;
+    unsigned pre_decimation = cic_decimation * hb_decimation;
+
+    TSL_ASSERT_ARG(NULL != thr);
+    TSL_ASSERT_ARG(NULL != lpf_taps);
+    TSL_ASSERT_ARG(0 != lpf_nr_taps);
+    TSL_ASSERT_ARG(0 != pre_decimation);
+    TSL_ASSERT_ARG(0 == decimation % pre_decimation);
+
+    /* Twice the span of the prototype at the reduced rate is plenty to reproduce its response */
+    if (0 == nr_comp_taps) {
+        nr_comp_taps = 2 * ((lpf_nr_taps + pre_decimation - 1) / pre_decimation) + 1;
+    }
+
+    DIAG("Preparing multi-stage filter for offset %d Hz: CIC %u, half-band %u, %zu taps decimating by %u",
+            offset_hz, cic_decimation, hb_decimation, nr_comp_taps, decimation / pre_decimation);
+
+    if (FAILED(ret = TACALLOC((void *)&coeffs, nr_comp_taps, sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        MFM_MSG(SEV_FATAL, "NO-MEM", "Out of memory for FIR.");
+        goto done;
+    }
+
+    if (FAILED(ret = multistage_fir_design(lpf_taps, lpf_nr_taps, cic_decimation, hb_decimation, gain,
+                    coeffs, nr_comp_taps)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = multistage_fir_init(&thr->msfir, sample_rate, offset_hz, cic_decimation, hb_decimation,
+                    nr_comp_taps, coeffs, decimation / pre_decimation)))
+    {
+        goto done;
+    }
+
+    thr->multistage = true;
+
+done:
+    if (NULL != coeffs) {
+        TFREE(coeffs);
+    }
+
+    return ret;
+}
+
+aresult_t demod_thread_new(struct demod_thread **pthr,
+        int32_t offset_hz, uint32_t samp_hz, const char *out_path, enum demod_output_mode out_mode,
+        int decimation_factor,
         const double *lpf_taps, size_t lpf_nr_taps,
+        unsigned cic_decimation, unsigned hb_decimation, size_t nr_comp_taps,
         const char *fir_debug_output,
-        double channel_gain)
+        double channel_gain,
+        size_t max_batch_len,
+        struct demod_base *demod,
+        struct pcm_decoder *decoder,
+        struct pcm_udp_sender *udp)
 {
     aresult_t ret = A_OK;
 
     struct demod_thread *thr = NULL;
 
     TSL_ASSERT_ARG(NULL != pthr);
-    TSL_ASSERT_ARG(NULL != out_fifo && '\0' != *out_fifo);
+    TSL_ASSERT_ARG((DEMOD_OUTPUT_DECODER == out_mode) == (NULL != decoder));
+    TSL_ASSERT_ARG((DEMOD_OUTPUT_UDP == out_mode) == (NULL != udp));
+    TSL_ASSERT_ARG(NULL != decoder || NULL != udp || (NULL != out_path && '\0' != *out_path));
+    TSL_ASSERT_ARG(0 != samp_hz);
     TSL_ASSERT_ARG(0 != decimation_factor);
     TSL_ASSERT_ARG(NULL != lpf_taps);
     TSL_ASSERT_ARG(0 != lpf_nr_taps);
+    TSL_ASSERT_ARG(DEMOD_MIN_BATCH_LEN <= max_batch_len && DEMOD_MAX_BATCH_LEN >= max_batch_len);
+    TSL_ASSERT_ARG(NULL != demod);
 
     *pthr = NULL;
 
@@ -291,64 +1140,89 @@ aresult_t demod_thread_new(struct demod_thread **pthr, unsigned core_id,
     }
 
     thr->fifo_fd = -1;
-    thr->debug_signal_fd = -1;
-
-    /* Initialize the work queue */
-    if (FAILED(ret = work_queue_new(&thr->wq, 128))) {
+    thr->ring.wake_fd = -1;
+    thr->core_id = WORKER_THREAD_CPU_MASK_ANY;
+    thr->offset_hz = offset_hz;
+    thr->samp_hz = samp_hz;
+    thr->decimation = decimation_factor;
+    thr->priority = DEMOD_PRIORITY_NORMAL;
+    thr->batch_len = max_batch_len;
+    thr->min_batch_len = max_batch_len;
+    thr->max_batch_len = max_batch_len;
+    atomic_store(&thr->stats.batch_len, max_batch_len);
+
+    /* Room for a batch of complex samples, going in and coming out */
+    if (FAILED(ret = TACALLOC((void **)&thr->filt_samp_buf, 2 * max_batch_len, sizeof(int16_t),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
         goto done;
     }
 
-    /* Initialize the mutex */
-    if (0 != pthread_mutex_init(&thr->wq_mtx, NULL)) {
-        ret = A_E_INVAL;
+    if (FAILED(ret = TACALLOC((void **)&thr->out_buf, 2 * max_batch_len, sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
         goto done;
     }
 
-    /* Initialize the condition variable */
-    if (0 != pthread_cond_init(&thr->wq_cv, NULL)) {
-        ret = A_E_INVAL;
+    /* Initialize the work ring */
+    if (FAILED(ret = spsc_ring_init(&thr->ring, DEMOD_RING_ENTRIES))) {
         goto done;
     }
 
     /* Initialize the filter */
-    if (FAILED(ret = _demod_fir_prepare(thr, lpf_taps, lpf_nr_taps, offset_hz, samp_hz, decimation_factor, channel_gain))) {
+    if (0 != cic_decimation) {
+        if (FAILED(ret = _demod_multistage_prepare(thr, lpf_taps, lpf_nr_taps, offset_hz, samp_hz, decimation_factor,
+                        cic_decimation, hb_decimation, nr_comp_taps, channel_gain)))
+        {
+            goto done;
+        }
+    } else if (FAILED(ret = _demod_fir_prepare(thr, lpf_taps, lpf_nr_taps, offset_hz, samp_hz, decimation_factor, channel_gain))) {
         goto done;
     }
 
-    /* Set up the demodulator */
-    TSL_BUG_IF_FAILED(multifm_fm_demod_init(&thr->demod));
-
     /* Open the debug output file, if applicable */
     if (NULL != fir_debug_output && '\0' != *fir_debug_output) {
-        if (0 > (thr->debug_signal_fd = open(fir_debug_output, O_WRONLY))) {
-            ret = A_E_INVAL;
+        if (FAILED(ret = iq_recorder_new(&thr->debug_rec, fir_debug_output, false, DEMOD_DEBUG_NR_BUFS,
+                        max_batch_len * 2 * sizeof(int16_t))))
+        {
             MFM_MSG(SEV_FATAL, "CANT-OPEN-SIGNAL-DEBUG", "Unable to open signal debug dump file '%s'", fir_debug_output);
             goto done;
         }
     }
 
-    /* Open the output FIFO */
-    if (0 > (thr->fifo_fd = open(out_fifo, O_WRONLY))) {
-        ret = A_E_INVAL;
-        MFM_MSG(SEV_FATAL, "CANT-OPEN-FIFO", "Unable to open output fifo '%s'", out_fifo);
+    /* Set up the output FIFO or shared memory ring */
+    if (FAILED(ret = _demod_output_prepare(thr, out_path, out_mode))) {
         goto done;
     }
 
     list_init(&thr->dt_node);
+    atomic_flag_clear(&thr->busy);
 
-    TSL_BUG_IF_FAILED(worker_thread_new(&thr->wthr, _demod_thread_work, core_id));
+    /* We own the demodulator, decoder and UDP sender from here on */
+    thr->demod = demod;
+    thr->decoder = decoder;
+    thr->udp = udp;
 
     *pthr = thr;
 
 done:
     if (FAILED(ret)) {
         if (NULL != thr) {
-            if (-1 != thr->fifo_fd) {
-                close(thr->fifo_fd);
-                thr->fifo_fd = -1;
-            }
+            _demod_output_cleanup(thr);
 
             TSL_BUG_IF_FAILED(direct_fir_cleanup(&thr->fir));
+            TSL_BUG_IF_FAILED(multistage_fir_cleanup(&thr->msfir));
+            TSL_BUG_IF_FAILED(spsc_ring_cleanup(&thr->ring));
+
+            if (NULL != thr->coeff_ent) {
+                _demod_coeff_cache_put(thr->coeff_ent);
+            }
+
+            if (NULL != thr->filt_samp_buf) {
+                TFREE(thr->filt_samp_buf);
+            }
+
+            if (NULL != thr->out_buf) {
+                TFREE(thr->out_buf);
+            }
 
             TFREE(thr);
         }
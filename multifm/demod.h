@@ -1,60 +1,243 @@
 #pragma once
 
-#include <tsl/work_queue.h>
 #include <tsl/list.h>
 #include <tsl/worker_thread.h>
 
 #include <filter/direct_fir.h>
+#include <filter/multistage_fir.h>
 #include <filter/dc_blocker.h>
+#include <filter/energy_gate.h>
 
-#include <pthread.h>
+#include <multifm/spsc_ring.h>
+#include <multifm/stats.h>
 
+#include <stdatomic.h>
+
+/**
+ * The default number of filtered samples demodulated in a batch, and the range a channel's batch
+ * size can be set or adapt over
+ */
 #define LPF_OUTPUT_LEN              1024
+#define DEMOD_MIN_BATCH_LEN         32
+#define DEMOD_MAX_BATCH_LEN         (64 * 1024)
+
+/**
+ * The number of sample buffers that can be waiting for a demodulator, and how many waiting makes
+ * it backlogged enough for less important channels to be shed (see struct demod_shed)
+ */
+#define DEMOD_RING_ENTRIES          128
+#define DEMOD_BACKLOG_ENTRIES       (DEMOD_RING_ENTRIES / 4)
+
+/**
+ * The most sample buffers a worker pool thread processes for a demodulator before moving on
+ */
+#define DEMOD_SERVICE_MAX_BUFS      8
+
+/**
+ * How often to look for a reader on an output FIFO that no one has opened yet, in nanoseconds
+ */
+#define DEMOD_FIFO_RETRY_NS         (100ull * 1000000ull)
+
+/**
+ * The number of filtered signal batches that can be waiting to be written to the signal debug file
+ */
+#define DEMOD_DEBUG_NR_BUFS         64
+
+/**
+ * The number of distinct frequency shifted channel filters that can be shared between channels,
+ * or kept around for reuse once unused. Channels beyond this get their own copy.
+ */
+#define DEMOD_COEFF_CACHE_ENTRIES   128
+
+/**
+ * Capacity of a shared memory PCM output ring, in samples
+ */
+#define DEMOD_PCM_RING_SAMPLES      (1ul << 17)
 
 struct polyphase_fir;
+struct pcm_ring;
 struct demod_base;
+struct sample_buf;
+struct iq_recorder;
+struct demod_coeff_cache_entry;
+struct pcm_decoder;
+struct pcm_udp_sender;
+
+/**
+ * How a demodulator hands PCM samples to its consumer
+ */
+enum demod_output_mode {
+    /**
+     * write(2) each batch of samples to a FIFO
+     */
+    DEMOD_OUTPUT_FIFO_WRITE = 0,
+
+    /**
+     * vmsplice(2) each batch of samples into a FIFO, from a rotating set of page-aligned
+     * buffers, so the kernel never has to copy the samples on the way in
+     */
+    DEMOD_OUTPUT_FIFO_VMSPLICE = 1,
+
+    /**
+     * Publish samples in a shared memory ring (see filter/pcm_ring.h); no system calls unless
+     * the consumer is asleep
+     */
+    DEMOD_OUTPUT_SHM_RING = 2,
+
+    /**
+     * Decode the samples in this thread, with a protocol decoder (see multifm/pcm_decoder.h).
+     * The demodulator writes straight into the decoder's input ring.
+     */
+    DEMOD_OUTPUT_DECODER = 3,
+
+    /**
+     * Send samples as UDP datagrams (see filter/pcm_udp.h), to be decoded on another host. The
+     * datagrams for each sample buffer go out with a single system call.
+     */
+    DEMOD_OUTPUT_UDP = 4,
+};
+
+/**
+ * How important a channel is, when there isn't enough CPU to go around. Lower values are more
+ * important.
+ */
+enum demod_priority {
+    DEMOD_PRIORITY_HIGH = 0,
+    DEMOD_PRIORITY_NORMAL = 1,
+    DEMOD_PRIORITY_LOW = 2,
+};
+
+/**
+ * Overload state for the demodulators the same thread delivers sample buffers to. While a channel
+ * is backlogged, every less important channel has its sample buffers dropped, rather than queued,
+ * so the cores go to the channels that matter. Only touched by the delivering thread.
+ */
+struct demod_shed {
+    /**
+     * Channels less important than this have their sample buffers shed
+     */
+    enum demod_priority level;
+
+    /**
+     * The level for the next round of deliveries, worked out as this round goes
+     */
+    enum demod_priority next_level;
+};
 
 /**
  * Demodulator thread context
  */
 struct demod_thread {
     /**
-     * SPSC queue used to deliver work to this worker thread
+     * SPSC ring used to deliver work to this worker thread
      */
-    struct work_queue wq CAL_CACHE_ALIGNED;
+    struct spsc_ring ring CAL_CACHE_ALIGNED;
 
     /**
-     * The FIR filter being applied by this thread (usually for baseband selection)
+     * The FIR filter being applied by this thread (usually for baseband selection), unless
+     * multistage is set
      */
     struct direct_fir fir;
 
     /**
-     * The file descriptor for the output FIFO
+     * The shared coefficients fir reads, if any. Released when the thread is deleted.
+     */
+    struct demod_coeff_cache_entry *coeff_ent;
+
+    /**
+     * The multi-stage decimating filter used instead of fir, if multistage is set
+     */
+    struct multistage_fir msfir;
+
+    /**
+     * Whether msfir does the channel filtering, rather than fir
+     */
+    bool multistage;
+
+    /**
+     * How output samples are delivered
+     */
+    enum demod_output_mode out_mode;
+
+    /**
+     * The file descriptor for the output FIFO, or -1 until a reader has opened it
      */
     int fifo_fd;
 
     /**
-     * The file descriptor for dumping the filtered signal
+     * The path of the output FIFO, kept to open it once a reader shows up
+     */
+    char *fifo_path;
+
+    /**
+     * When to next look for a reader on the output FIFO, while it isn't open
+     */
+    uint64_t fifo_retry_ns;
+
+    /**
+     * The shared memory output ring, if out_mode is DEMOD_OUTPUT_SHM_RING
+     */
+    struct pcm_ring *pcm_ring;
+
+    /**
+     * The protocol decoder, if out_mode is DEMOD_OUTPUT_DECODER
+     */
+    struct pcm_decoder *decoder;
+
+    /**
+     * The UDP sender, if out_mode is DEMOD_OUTPUT_UDP
+     */
+    struct pcm_udp_sender *udp;
+
+    /**
+     * Page-aligned output buffers, if out_mode is DEMOD_OUTPUT_FIFO_VMSPLICE. There are always
+     * more of these than the FIFO has pages, so by the time we come back around to a buffer,
+     * the reader is done with it. Allocated once the FIFO is open, since that's when we know
+     * how big the pipe is.
+     */
+    int16_t *splice_bufs;
+
+    /**
+     * The number of splice buffers
+     */
+    size_t nr_splice_bufs;
+
+    /**
+     * Distance between the start of each splice buffer, in int16_t samples
      */
-    int debug_signal_fd;
+    size_t splice_buf_stride;
 
     /**
-     * Mutex for the work queue. Always must be held while manipulating it.
+     * The next splice buffer to be filled
      */
-    pthread_mutex_t wq_mtx;
+    size_t next_splice_buf;
 
     /**
-     * Condition variable to be signalled when there is work to be done. This
-     * thread will wait on the condvar until signalled to wake up by the
-     * sample producer.
+     * Records the filtered signal, for debugging. Written from its own thread, so it doesn't
+     * hold up demodulation.
      */
-    pthread_cond_t wq_cv;
+    struct iq_recorder *debug_rec;
 
     /**
-     * Demodulator worker thread state
+     * Demodulator worker thread state. Only used if this demodulator has a dedicated thread.
      */
     struct worker_thread wthr;
 
+    /**
+     * Whether or not wthr was started
+     */
+    bool has_thread;
+
+    /**
+     * The CPU core the dedicated worker thread should be pinned to
+     */
+    unsigned core_id;
+
+    /**
+     * Held by whichever worker pool thread is currently servicing this demodulator
+     */
+    atomic_flag busy;
+
     /**
      * Demodulator state
      */
@@ -66,29 +249,75 @@ struct demod_thread {
     struct list_entry dt_node;
 
     /**
-     * Total number of samples demodulated
+     * The channelizer output this thread consumes, if the receiver has a channelizer
      */
-    size_t total_nr_demod_samples;
+    unsigned channelizer_channel;
 
     /**
-     * Total number of PCM samples generated
+     * The center frequency of this channel, in Hz
      */
-    size_t total_nr_pcm_samples;
+    int center_freq_hz;
 
     /**
-     * Number of samples dropped on the floor
+     * The offset of this channel from the receiver's center frequency, in Hz
+     */
+    int32_t offset_hz;
+
+    /**
+     * The rate of the samples delivered to this thread, in Hz
+     */
+    uint32_t samp_hz;
+
+    /**
+     * The decimation applied by the channel filter
+     */
+    unsigned decimation;
+
+    /**
+     * Number of samples dropped on the floor since the consumer last kept up
      */
     size_t nr_dropped_samples;
 
+    /**
+     * How important this channel is, and whether it's having its sample buffers shed
+     */
+    enum demod_priority priority;
+    bool shedding;
+
+    /**
+     * Whether to skip demodulating and writing out blocks while the channel is quiet, and the
+     * gate that decides, run on the filtered baseband samples
+     */
+    bool use_gate;
+    struct energy_gate gate;
+
     /**
      * Number of FM signal samples available
      */
     size_t nr_fm_samples;
 
+    /**
+     * The most filtered samples demodulated and written out in one go
+     */
+    size_t batch_len;
+
+    /**
+     * The range batch_len adapts over, if there's a latency target. filt_samp_buf and out_buf
+     * have room for max_batch_len.
+     */
+    size_t min_batch_len;
+    size_t max_batch_len;
+
+    /**
+     * If not 0, batch_len grows while sample buffers queue up, and shrinks while samples take
+     * longer than this to get from the receiver to the output, in nanoseconds
+     */
+    uint64_t latency_target_ns;
+
     /**
      * Filtered samples to be processed
      */
-    int16_t filt_samp_buf[2 * LPF_OUTPUT_LEN];
+    int16_t *filt_samp_buf;
 
     /**
      * Number of good PCM samples
@@ -96,22 +325,124 @@ struct demod_thread {
     size_t nr_pcm_samples;
 
     /**
-     * Output demodulated sample buffer
+     * Output demodulated sample buffer. Sized for demodulators with complex outputs.
      */
-    int16_t out_buf[LPF_OUTPUT_LEN];
+    int16_t *out_buf;
+
+    /**
+     * Runtime counters, read by the stats thread
+     */
+    struct demod_stats stats;
 };
 
 aresult_t demod_thread_delete(struct demod_thread **pthr);
 
 /**
- * Create a new demodulation thread.
+ * Start a round of deliveries: one sample buffer handed to every demodulator that wants it.
+ */
+static inline
+void demod_shed_begin(struct demod_shed *shed)
+{
+    shed->next_level = DEMOD_PRIORITY_LOW;
+}
+
+/**
+ * Finish a round of deliveries. Channels less important than any channel found backlogged this
+ * round are shed in the next.
+ */
+static inline
+void demod_shed_end(struct demod_shed *shed)
+{
+    shed->level = shed->next_level;
+}
+
+/**
+ * Hand a sample buffer to a demodulation thread, and wake it up if it is waiting. Must
+ * only be called from the single thread producing samples for this demodulator. If the
+ * thread's ring is full, or the thread is being shed to make room for more important
+ * channels, the buffer is released and dropped.
+ *
+ * \param thr The demodulator thread
+ * \param buf The sample buffer. The caller must have taken a reference on behalf of the thread.
+ * \param shed The overload state of the delivering thread, within a round of deliveries
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t demod_thread_deliver(struct demod_thread *thr, struct sample_buf *buf, struct demod_shed *shed);
+
+/**
+ * Create a new demodulation thread. The demodulator does not consume any samples until it is
+ * either started with demod_thread_start, or serviced by a worker pool.
  *
+ * \param out_path The output FIFO, or the shared memory PCM ring file to create. Unused, and may be
+ *                 NULL, if out_mode is DEMOD_OUTPUT_DECODER or DEMOD_OUTPUT_UDP.
+ * \param out_mode How output samples are delivered
+ * \param cic_decimation If not 0, filter with a multistage_fir, decimating by this much in its CIC.
+ *                       lpf_taps is then the prototype the final FIR is designed from.
+ * \param hb_decimation The half-band decimation of the multistage_fir. Ignored if cic_decimation is 0.
+ * \param nr_comp_taps The length of the final FIR of the multistage_fir, or 0 to pick one from the
+ *                     length of lpf_taps. Ignored if cic_decimation is 0.
  * \param demod_gain The gain of the channelizing FIR, expressed in linear units.
+ * \param max_batch_len The most filtered samples the thread will demodulate at once. The batch size
+ *                      starts out here, and can be lowered (or adapted) once the thread is created.
+ * \param demod The demodulator to run on the filtered samples. On success, the demodulator
+ *              thread takes ownership of it.
+ * \param decoder The protocol decoder to hand samples to, if out_mode is DEMOD_OUTPUT_DECODER,
+ *                otherwise NULL. On success, the demodulator thread takes ownership of it.
+ * \param udp The UDP sender to hand samples to, if out_mode is DEMOD_OUTPUT_UDP, otherwise NULL.
+ *            On success, the demodulator thread takes ownership of it.
  *
  */
-aresult_t demod_thread_new(struct demod_thread **pthr, unsigned core_id,
-        int32_t offset_hz, uint32_t samp_hz, const char *out_fifo, int decimation_factor,
+aresult_t demod_thread_new(struct demod_thread **pthr,
+        int32_t offset_hz, uint32_t samp_hz, const char *out_path, enum demod_output_mode out_mode,
+        int decimation_factor,
         const double *lpf_taps, size_t lpf_nr_taps,
+        unsigned cic_decimation, unsigned hb_decimation, size_t nr_comp_taps,
         const char *fir_debug_output,
-        double channel_gain);
+        double channel_gain,
+        size_t max_batch_len,
+        struct demod_base *demod,
+        struct pcm_decoder *decoder,
+        struct pcm_udp_sender *udp);
+
+/**
+ * Set how many filtered samples the demodulator handles at once. Call before the thread starts.
+ *
+ * \param thr The demodulator
+ * \param batch_len The batch size, no more than the max_batch_len the thread was created with
+ * \param min_batch_len The smallest the batch size can adapt down to, if latency_target_ns is set
+ * \param latency_target_ns If not 0, adapt the batch size between min_batch_len and max_batch_len,
+ *                          aiming to get samples from the receiver to the output within this long
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t demod_thread_set_batch(struct demod_thread *thr, size_t batch_len, size_t min_batch_len,
+        uint64_t latency_target_ns);
+
+/**
+ * Start a dedicated worker thread for this demodulator.
+ *
+ * \param thr The demodulator
+ * \param core_id The CPU core to pin the thread to, or WORKER_THREAD_CPU_MASK_ANY to let it float
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t demod_thread_start(struct demod_thread *thr, unsigned core_id);
+
+/**
+ * Process pending sample buffers, up to DEMOD_SERVICE_MAX_BUFS, if there are any and no other
+ * thread is already working on this demodulator. Used by worker pools, which share demodulators
+ * between threads.
+ *
+ * \param thr The demodulator
+ * \param pdid_work Set to true if any sample buffers were processed, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t demod_thread_service(struct demod_thread *thr, bool *pdid_work);
+
+/**
+ * Release every channel filter kept around for reuse. Call once all receivers are gone.
+ */
+void demod_coeff_cache_flush(void);
 
@@ -1,6 +1,59 @@
 #pragma once
 
+#include <tsl/result.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct demod_base;
+
+/**
+ * Demodulate a batch of filtered complex samples. Implementations are handed the whole batch
+ * at once, so each can vectorise its own loop.
+ *
+ * \param demod The demodulator state
+ * \param in_samples The complex Q.15 input samples, interleaved I/Q
+ * \param nr_in_samples The number of complex input samples
+ * \param out_samples The output buffer. Must fit at least 2 * nr_in_samples values.
+ * \param pnr_out_samples The number of output samples, returned by reference
+ * \param pnr_out_bytes The number of bytes written to out_samples, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+typedef aresult_t (*demod_process_func_t)(struct demod_base *demod, int16_t *in_samples, size_t nr_in_samples,
+        int16_t *out_samples, size_t *pnr_out_samples, size_t *pnr_out_bytes);
+
+/**
+ * Release all resources held by the demodulator, setting *pdemod to NULL.
+ */
+typedef aresult_t (*demod_cleanup_func_t)(struct demod_base **pdemod);
+
+/**
+ * Common base for all demodulators. Each implementation embeds this in its own state, and fills
+ * in the function table when it is initialized.
+ */
 struct demod_base {
+    /**
+     * Process a batch of samples
+     */
+    demod_process_func_t process;
 
+    /**
+     * Clean up the demodulator
+     */
+    demod_cleanup_func_t cleanup;
 };
 
+static inline
+aresult_t demod_base_process(struct demod_base *demod, int16_t *in_samples, size_t nr_in_samples,
+        int16_t *out_samples, size_t *pnr_out_samples, size_t *pnr_out_bytes)
+{
+    return demod->process(demod, in_samples, nr_in_samples, out_samples, pnr_out_samples, pnr_out_bytes);
+}
+
+static inline
+aresult_t demod_base_cleanup(struct demod_base **pdemod)
+{
+    return (*pdemod)->cleanup(pdemod);
+}
+
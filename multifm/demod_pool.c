@@ -0,0 +1,322 @@
+/*
+ *  demod_pool.c - Worker pool for servicing many demodulators with a few threads
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/demod_pool.h>
+#include <multifm/demod.h>
+#include <multifm/spsc_ring.h>
+#include <multifm/sample_buf_pool.h>
+#include <multifm/multifm.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/epoll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEMOD_POOL_MAX_EVENTS           16
+
+/**
+ * How long an idle worker sleeps before checking for work to steal, in milliseconds
+ */
+#define DEMOD_POOL_IDLE_TIMEOUT_MS      100
+
+/**
+ * Try to take pending work from any other worker's demodulators.
+ */
+static
+aresult_t _demod_pool_steal(struct demod_pool_worker *wkr, bool *pdid_work)
+{
+    aresult_t ret = A_OK;
+
+    struct demod_pool *pool = wkr->pool;
+
+    *pdid_work = false;
+
+    for (size_t i = 0; i < pool->nr_demods; i++) {
+        size_t idx = (wkr->steal_start + i) % pool->nr_demods;
+
+        TSL_BUG_IF_FAILED(demod_thread_service(pool->demods[idx], pdid_work));
+
+        if (true == *pdid_work) {
+            wkr->nr_steals++;
+            wkr->steal_start = idx + 1;
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Sleep until one of our home demodulators has work, or the idle timeout elapses.
+ */
+static
+aresult_t _demod_pool_sleep(struct demod_pool_worker *wkr)
+{
+    aresult_t ret = A_OK;
+
+    bool can_sleep = true;
+    struct epoll_event events[DEMOD_POOL_MAX_EVENTS];
+
+    for (size_t i = 0; i < wkr->nr_home; i++) {
+        if (false == spsc_ring_prepare_wait(&wkr->home[i]->ring)) {
+            can_sleep = false;
+        }
+    }
+
+    if (true == can_sleep) {
+        if (0 > epoll_wait(wkr->epoll_fd, events, DEMOD_POOL_MAX_EVENTS, DEMOD_POOL_IDLE_TIMEOUT_MS)) {
+            int errnum = errno;
+            if (EINTR != errnum) {
+                PANIC("Failed to wait for demodulator work. Reason: %s (%d)", strerror(errnum), errnum);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < wkr->nr_home; i++) {
+        TSL_BUG_IF_FAILED(spsc_ring_finish_wait(&wkr->home[i]->ring));
+    }
+
+    return ret;
+}
+
+static
+aresult_t _demod_pool_work(struct worker_thread *wthr)
+{
+    aresult_t ret = A_OK;
+
+    struct demod_pool_worker *wkr = BL_CONTAINER_OF(wthr, struct demod_pool_worker, wthr);
+
+    while (worker_thread_is_running(wthr)) {
+        bool did_work = false;
+
+        /* Service our own demodulators first */
+        for (size_t i = 0; i < wkr->nr_home; i++) {
+            bool serviced = false;
+            TSL_BUG_IF_FAILED(demod_thread_service(wkr->home[i], &serviced));
+            did_work |= serviced;
+        }
+
+        if (true == did_work) {
+            continue;
+        }
+
+        /* Nothing to do at home, help out someone who's falling behind */
+        TSL_BUG_IF_FAILED(_demod_pool_steal(wkr, &did_work));
+
+        if (false == did_work) {
+            TSL_BUG_IF_FAILED(_demod_pool_sleep(wkr));
+        }
+    }
+
+    DIAG("Pool worker %zu: stole %zu sample buffers before termination.", wkr->id, wkr->nr_steals);
+
+    return ret;
+}
+
+/**
+ * Pick the home worker for a demodulator: the least loaded worker on its NUMA node, so it
+ * shares a cache and memory controller with the receiver filling its buffers. Falls back to the
+ * least loaded worker overall.
+ */
+static
+struct demod_pool_worker *_demod_pool_pick_home(struct demod_pool *pool, int node, size_t start)
+{
+    struct demod_pool_worker *best = NULL,
+                             *best_local = NULL;
+
+    for (size_t i = 0; i < pool->nr_workers; i++) {
+        struct demod_pool_worker *wkr = &pool->workers[(start + i) % pool->nr_workers];
+
+        if (NULL == best || wkr->nr_home < best->nr_home) {
+            best = wkr;
+        }
+
+        if (0 <= node && wkr->numa_node == node && (NULL == best_local || wkr->nr_home < best_local->nr_home)) {
+            best_local = wkr;
+        }
+    }
+
+    return NULL != best_local ? best_local : best;
+}
+
+aresult_t demod_pool_new(struct demod_pool **ppool, size_t nr_workers, struct demod_thread *const *demods,
+        const int *demod_nodes, size_t nr_demods, const unsigned *cores, size_t nr_cores)
+{
+    aresult_t ret = A_OK;
+
+    struct demod_pool *pool = NULL;
+
+    TSL_ASSERT_ARG(NULL != ppool);
+    TSL_ASSERT_ARG(0 != nr_workers);
+    TSL_ASSERT_ARG(NULL != demods);
+    TSL_ASSERT_ARG(0 != nr_demods);
+    TSL_ASSERT_ARG(NULL != cores || 0 == nr_cores);
+
+    *ppool = NULL;
+
+    if (FAILED(ret = TZAALLOC(pool, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    /* More workers than demodulators would just leave threads idle */
+    pool->nr_workers = BL_MIN2(nr_workers, nr_demods);
+    pool->nr_demods = nr_demods;
+
+    if (FAILED(ret = TACALLOC((void **)&pool->workers, pool->nr_workers, sizeof(struct demod_pool_worker),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < pool->nr_workers; i++) {
+        pool->workers[i].epoll_fd = -1;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&pool->demods, nr_demods, sizeof(struct demod_thread *)))) {
+        goto done;
+    }
+
+    memcpy(pool->demods, demods, nr_demods * sizeof(struct demod_thread *));
+
+    for (size_t i = 0; i < pool->nr_workers; i++) {
+        struct demod_pool_worker *wkr = &pool->workers[i];
+
+        wkr->pool = pool;
+        wkr->id = i;
+        wkr->core_id = 0 != nr_cores ? cores[i % nr_cores] : WORKER_THREAD_CPU_MASK_ANY;
+        wkr->numa_node = 0 != nr_cores ? sample_buf_pool_cpu_node(wkr->core_id) : -1;
+        wkr->steal_start = i;
+
+        /* Big enough for every demodulator, since NUMA placement can unbalance the workers */
+        if (FAILED(ret = TCALLOC((void **)&wkr->home, nr_demods, sizeof(struct demod_thread *)))) {
+            goto done;
+        }
+
+        if (0 > (wkr->epoll_fd = epoll_create1(EPOLL_CLOEXEC))) {
+            int errnum = errno;
+            MFM_MSG(SEV_ERROR, "CANT-CREATE-EPOLL", "Failed to create epoll instance for pool worker: %s (%d)",
+                    strerror(errnum), errnum);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    /* Hand out the demodulators, and watch their rings from their home worker */
+    for (size_t i = 0; i < nr_demods; i++) {
+        struct demod_pool_worker *wkr = _demod_pool_pick_home(pool, NULL != demod_nodes ? demod_nodes[i] : -1, i);
+        struct epoll_event evt = { .events = EPOLLIN, .data.ptr = pool->demods[i] };
+
+        wkr->home[wkr->nr_home++] = pool->demods[i];
+
+        if (0 > epoll_ctl(wkr->epoll_fd, EPOLL_CTL_ADD, pool->demods[i]->ring.wake_fd, &evt)) {
+            int errnum = errno;
+            MFM_MSG(SEV_ERROR, "CANT-ADD-EPOLL", "Failed to watch demodulator ring: %s (%d)",
+                    strerror(errnum), errnum);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    MFM_MSG(SEV_INFO, "DEMOD-POOL", "Servicing %zu channels with %zu worker threads", nr_demods, pool->nr_workers);
+
+    *ppool = pool;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != pool) {
+            demod_pool_delete(&pool);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t demod_pool_start(struct demod_pool *pool)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != pool);
+
+    for (size_t i = 0; i < pool->nr_workers; i++) {
+        struct demod_pool_worker *wkr = &pool->workers[i];
+
+        if (FAILED(ret = worker_thread_new(&wkr->wthr, _demod_pool_work, wkr->core_id))) {
+            MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start pool worker thread %zu, aborting.", i);
+            goto done;
+        }
+
+        wkr->started = true;
+    }
+
+done:
+    return ret;
+}
+
+aresult_t demod_pool_delete(struct demod_pool **ppool)
+{
+    aresult_t ret = A_OK;
+
+    struct demod_pool *pool = NULL;
+
+    TSL_ASSERT_ARG(NULL != ppool);
+    TSL_ASSERT_ARG(NULL != *ppool);
+
+    pool = *ppool;
+
+    if (NULL != pool->workers) {
+        for (size_t i = 0; i < pool->nr_workers; i++) {
+            struct demod_pool_worker *wkr = &pool->workers[i];
+
+            if (true == wkr->started) {
+                TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&wkr->wthr));
+                TSL_BUG_IF_FAILED(worker_thread_delete(&wkr->wthr));
+                wkr->started = false;
+            }
+
+            if (0 <= wkr->epoll_fd) {
+                close(wkr->epoll_fd);
+                wkr->epoll_fd = -1;
+            }
+
+            if (NULL != wkr->home) {
+                TFREE(wkr->home);
+            }
+        }
+
+        TFREE(pool->workers);
+    }
+
+    if (NULL != pool->demods) {
+        TFREE(pool->demods);
+    }
+
+    TFREE(pool);
+
+    *ppool = NULL;
+
+    return ret;
+}
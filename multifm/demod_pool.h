@@ -0,0 +1,133 @@
+#pragma once
+
+#include <tsl/result.h>
+#include <tsl/list.h>
+#include <tsl/worker_thread.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct demod_thread;
+struct demod_pool;
+
+/**
+ * A worker thread in a demodulator pool
+ */
+struct demod_pool_worker {
+    /**
+     * The worker thread
+     */
+    struct worker_thread wthr;
+
+    /**
+     * The pool this worker belongs to
+     */
+    struct demod_pool *pool;
+
+    /**
+     * The index of this worker in the pool
+     */
+    size_t id;
+
+    /**
+     * Whether or not the worker thread was started
+     */
+    bool started;
+
+    /**
+     * The CPU core this worker is pinned to, or WORKER_THREAD_CPU_MASK_ANY
+     */
+    unsigned core_id;
+
+    /**
+     * The NUMA node of the core this worker is pinned to, or -1 if unknown or floating
+     */
+    int numa_node;
+
+    /**
+     * epoll instance used to sleep on the rings of this worker's home demodulators
+     */
+    int epoll_fd;
+
+    /**
+     * The demodulators this worker is responsible for. The worker sleeps on these, and always
+     * checks them first.
+     */
+    struct demod_thread **home;
+
+    /**
+     * The number of home demodulators
+     */
+    size_t nr_home;
+
+    /**
+     * Where to start looking for work to steal, next time we're idle
+     */
+    size_t steal_start;
+
+    /**
+     * The number of sample buffers this worker processed for other workers' demodulators
+     */
+    size_t nr_steals;
+};
+
+/**
+ * A fixed-size pool of worker threads, servicing an arbitrary number of demodulators. Each
+ * demodulator has a home worker, but any idle worker can steal pending work from a busy one.
+ */
+struct demod_pool {
+    /**
+     * The workers
+     */
+    struct demod_pool_worker *workers;
+
+    /**
+     * The number of workers
+     */
+    size_t nr_workers;
+
+    /**
+     * All demodulators serviced by this pool
+     */
+    struct demod_thread **demods;
+
+    /**
+     * The number of demodulators
+     */
+    size_t nr_demods;
+};
+
+/**
+ * Create a new demodulator worker pool. Each demodulator's home worker is the least loaded of
+ * the workers pinned to a core on the demodulator's NUMA node, or of all the workers if none
+ * are.
+ *
+ * \param ppool The new pool, returned by reference
+ * \param nr_workers The number of worker threads
+ * \param demods The demodulators to service
+ * \param demod_nodes For each demodulator, the NUMA node its sample buffers live on, or -1 if
+ *                    unknown. May be NULL.
+ * \param nr_demods The number of demodulators
+ * \param cores CPU cores to pin workers to, round-robin. NULL to let workers float.
+ * \param nr_cores The number of cores in cores
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t demod_pool_new(struct demod_pool **ppool, size_t nr_workers, struct demod_thread *const *demods,
+        const int *demod_nodes, size_t nr_demods, const unsigned *cores, size_t nr_cores);
+
+/**
+ * Start the worker threads for the pool.
+ */
+aresult_t demod_pool_start(struct demod_pool *pool);
+
+/**
+ * Stop all pool workers, and release the pool's resources. The demodulators themselves are
+ * not touched.
+ *
+ * \param ppool The pool, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t demod_pool_delete(struct demod_pool **ppool);
+
@@ -5,36 +5,99 @@
 #include <config/engine.h>
 
 #include <filter/sample_buf.h>
+#include <filter/sample_convert.h>
 
 #include <tsl/assert.h>
 #include <tsl/diag.h>
 #include <tsl/errors.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <stdio.h>
 
+/**
+ * The default number of samples read into a sample buffer, unless the device sets samplesPerBuffer
+ */
 #define SAMPLES_PER_BUF     (4 * 1024)
 
+/**
+ * The sample formats for little and big endian 16-bit samples on this host
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define FILE_WORKER_SAMPLE_FORMAT_S16_LE    FILE_WORKER_SAMPLE_FORMAT_S16_SWAPPED
+#define FILE_WORKER_SAMPLE_FORMAT_S16_BE    FILE_WORKER_SAMPLE_FORMAT_S16
+#else
+#define FILE_WORKER_SAMPLE_FORMAT_S16_LE    FILE_WORKER_SAMPLE_FORMAT_S16
+#define FILE_WORKER_SAMPLE_FORMAT_S16_BE    FILE_WORKER_SAMPLE_FORMAT_S16_SWAPPED
+#endif
+
+/**
+ * Suffixes of the two halves of a SigMF recording
+ */
+#define FILE_SIGMF_META_SUFFIX          ".sigmf-meta"
+#define FILE_SIGMF_DATA_SUFFIX          ".sigmf-data"
+
+/**
+ * Number of samples in each window of a memory mapped file. Large, so the cost of mapping each
+ * window is spread over plenty of samples.
+ */
+#define FILE_MMAP_WINDOW_SAMPLES        (16 * 1024)
+
+/**
+ * Default number of windows of a memory mapped file that can be in flight at once
+ */
+#define FILE_MMAP_DEFAULT_NR_BUFS       64
+
+/**
+ * How many windows ahead of the current one to ask the kernel to read
+ */
+#define FILE_MMAP_READAHEAD_WINDOWS     4
+
+/**
+ * How long to wait for the consumers to catch up, when running flat out, in microseconds
+ */
+#define FILE_BACKPRESSURE_WAIT_US       100
+
 static
 aresult_t __file_read_bytes(struct file_worker_thread *rx, void *tgt_buf, size_t max_bytes, size_t *pbytes_read)
 {
     aresult_t ret = A_OK;
 
-    long nr_bytes = 0;
+    size_t nr_bytes = 0;
 
     TSL_ASSERT_ARG(NULL != rx);
     TSL_ASSERT_ARG(NULL != tgt_buf);
     TSL_ASSERT_ARG(0 != max_bytes);
     TSL_ASSERT_ARG(NULL != pbytes_read);
 
-    if (0 > (nr_bytes = read(rx->fd, tgt_buf, max_bytes))) {
-        int errnum = errno;
-        FL_MSG(SEV_FATAL, "FILE-READ-ERROR", "Failed to read data from file, reason: %s (%d)",
-                strerror(errnum), errnum);
-        ret = A_E_INVAL;
-        goto done;
+    /* Keep reading until the buffer is full, so a short read from a pipe doesn't split a sample */
+    while (nr_bytes < max_bytes) {
+        ssize_t nr = read(rx->fd, (uint8_t *)tgt_buf + nr_bytes, max_bytes - nr_bytes);
+
+        if (0 > nr) {
+            int errnum = errno;
+
+            if (EINTR == errnum) {
+                continue;
+            }
+
+            FL_MSG(SEV_FATAL, "FILE-READ-ERROR", "Failed to read data from file, reason: %s (%d)",
+                    strerror(errnum), errnum);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (0 == nr) {
+            /* End of file */
+            break;
+        }
+
+        nr_bytes += nr;
     }
 
     *pbytes_read = nr_bytes;
@@ -43,6 +106,39 @@ done:
     return ret;
 }
 
+/**
+ * Read a buffer's worth of samples that need converting into the bounce buffer.
+ *
+ * \param rx The file worker thread
+ * \param sample_bytes The size of a single complex sample in the file, in bytes
+ * \param pnr_samples The number of whole complex samples read, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+static
+aresult_t __file_read_bounce(struct file_worker_thread *rx, size_t sample_bytes, size_t *pnr_samples)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_read = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != rx);
+    TSL_ASSERT_ARG_DEBUG(NULL != rx->bounce_buf);
+    TSL_ASSERT_ARG_DEBUG(NULL != pnr_samples);
+
+    if (FAILED(ret = __file_read_bytes(rx, rx->bounce_buf, rx->bounce_buf_bytes, &nr_read))) {
+        goto done;
+    }
+
+    TSL_BUG_ON(nr_read > rx->bounce_buf_bytes);
+
+    /* A partial sample can only be left at the very end of the file, so it's dropped */
+    *pnr_samples = nr_read / sample_bytes;
+
+done:
+    return ret;
+}
+
 static
 aresult_t _file_read_cs16(struct file_worker_thread *rx, struct sample_buf *sbuf)
 {
@@ -53,7 +149,7 @@ aresult_t _file_read_cs16(struct file_worker_thread *rx, struct sample_buf *sbuf
     TSL_ASSERT_ARG(NULL != rx);
     TSL_ASSERT_ARG(NULL != sbuf);
 
-    if (FAILED(ret = __file_read_bytes(rx, sbuf->data_buf, SAMPLES_PER_BUF * 2 * sizeof(int16_t), &nr_read))) {
+    if (FAILED(ret = __file_read_bytes(rx, sbuf->data_buf, rx->samples_per_buf * 2 * sizeof(int16_t), &nr_read))) {
         goto done;
     }
 
@@ -64,48 +160,44 @@ done:
 }
 
 static
-aresult_t _file_read_cs8(struct file_worker_thread *rx, struct sample_buf *sbuf)
+aresult_t _file_read_cs16_swapped(struct file_worker_thread *rx, struct sample_buf *sbuf)
 {
     aresult_t ret = A_OK;
 
-    size_t nr_read = 0,
-           rem = 0;
-
-    int8_t *in_buf = NULL;
-    int16_t *out_buf = NULL;
-
     TSL_ASSERT_ARG(NULL != rx);
     TSL_ASSERT_ARG(NULL != sbuf);
 
-    /* Read into bounce buffer */
-    if (FAILED(ret = __file_read_bytes(rx, rx->bounce_buf, rx->bounce_buf_bytes, &nr_read))) {
-        DIAG("Failed to read from file, aborting.");
+    if (FAILED(ret = _file_read_cs16(rx, sbuf))) {
         goto done;
     }
 
-    TSL_BUG_ON(nr_read > rx->bounce_buf_bytes);
+    /* Swap in place; there's no need to bounce */
+    TSL_BUG_IF_FAILED(sample_convert_s16_swap((int16_t *)sbuf->data_buf, (int16_t *)sbuf->data_buf,
+                sbuf->nr_samples * 2));
 
-    in_buf = rx->bounce_buf;
-    out_buf = (int16_t *)sbuf->data_buf;
+done:
+    return ret;
+}
 
-    /* Convert to s16 just through a cast */
-    for (size_t i = 0; i < nr_read; i += 4) {
-        out_buf[i] = in_buf[i];
-        out_buf[i + 1] = in_buf[i + 1];
-        out_buf[i + 2] = in_buf[i + 2];
-        out_buf[i + 3] = in_buf[i + 3];
-    }
+static
+aresult_t _file_read_cs8(struct file_worker_thread *rx, struct sample_buf *sbuf)
+{
+    aresult_t ret = A_OK;
 
-    rem = nr_read % 4;
+    size_t nr_samples = 0;
 
-    for (size_t i = 0; i < rem; i++) {
-        out_buf[nr_read - rem + i] = in_buf[nr_read - rem + i];
+    TSL_ASSERT_ARG(NULL != rx);
+    TSL_ASSERT_ARG(NULL != sbuf);
+
+    if (FAILED(ret = __file_read_bounce(rx, 2 * sizeof(int8_t), &nr_samples))) {
+        DIAG("Failed to read from file, aborting.");
+        goto done;
     }
 
-    DIAG("Read %zu bytes from input file", nr_read);
+    TSL_BUG_IF_FAILED(sample_convert_s8_to_q15((int16_t *)sbuf->data_buf, rx->bounce_buf, nr_samples * 2));
 
     /* Ensure we mark the buffer only for the number of samples actually available */
-    sbuf->nr_samples = nr_read/2;
+    sbuf->nr_samples = nr_samples;
 
 done:
     return ret;
@@ -116,90 +208,390 @@ aresult_t _file_read_cu8(struct file_worker_thread *rx, struct sample_buf *sbuf)
 {
     aresult_t ret = A_OK;
 
-    size_t nr_read = 0,
-           rem = 0;
+    size_t nr_samples = 0;
+
+    TSL_ASSERT_ARG(NULL != rx);
+    TSL_ASSERT_ARG(NULL != sbuf);
+
+    if (FAILED(ret = __file_read_bounce(rx, 2 * sizeof(uint8_t), &nr_samples))) {
+        goto done;
+    }
+
+    /* Same conversion as the RTL-SDR, so a raw dump replays exactly as it was received */
+    TSL_BUG_IF_FAILED(sample_convert_u8_to_q15((int16_t *)sbuf->data_buf, rx->bounce_buf, nr_samples * 2));
+
+    sbuf->nr_samples = nr_samples;
+
+done:
+    return ret;
+}
+
+static
+aresult_t _file_read_cf32(struct file_worker_thread *rx, struct sample_buf *sbuf)
+{
+    aresult_t ret = A_OK;
 
-    int8_t *in_buf = NULL;
-    int16_t *out_buf = NULL;
+    size_t nr_samples = 0;
 
     TSL_ASSERT_ARG(NULL != rx);
     TSL_ASSERT_ARG(NULL != sbuf);
 
-    /* Read into bounce buffer */
-    if (FAILED(ret = __file_read_bytes(rx, rx->bounce_buf, rx->bounce_buf_bytes, &nr_read))) {
+    if (FAILED(ret = __file_read_bounce(rx, 2 * sizeof(float), &nr_samples))) {
         goto done;
     }
 
-    TSL_BUG_ON(nr_read > rx->bounce_buf_bytes);
+    TSL_BUG_IF_FAILED(sample_convert_f32_to_q15((int16_t *)sbuf->data_buf, rx->bounce_buf, nr_samples * 2));
 
-    in_buf = rx->bounce_buf;
-    out_buf = (int16_t *)sbuf->data_buf;
+    sbuf->nr_samples = nr_samples;
 
-    /* Convert to s16 just through a cast, then subtracting 127 (assumes input is [0, 255]) */
-    for (size_t i = 0; i < nr_read; i += 4) {
-        out_buf[i + 0] = (int16_t)in_buf[i + 0] - 127;
-        out_buf[i + 1] = (int16_t)in_buf[i + 1] - 127;
-        out_buf[i + 2] = (int16_t)in_buf[i + 2] - 127;
-        out_buf[i + 3] = (int16_t)in_buf[i + 3] - 127;
+done:
+    return ret;
+}
+
+/**
+ * Drop a reference to a memory mapped file source, tearing it down if it was the last one.
+ */
+static
+void _file_mmap_source_put(struct file_mmap_source *map)
+{
+    if (1 != atomic_fetch_sub_explicit(&map->refs, 1, memory_order_acq_rel)) {
+        return;
     }
 
-    rem = nr_read % 4;
+    DIAG("Releasing file mapping");
 
-    for (size_t i = 0; i < rem; i++) {
-        out_buf[nr_read - rem + i] = in_buf[nr_read - rem + i];
+    munmap(map->region, map->region_len);
+
+    if (0 <= map->fd) {
+        close(map->fd);
     }
 
-    /* Ensure we mark the buffer only for the number of samples actually available */
-    sbuf->nr_samples = nr_read/2;
+    if (NULL != map->slot_busy) {
+        TFREE(map->slot_busy);
+    }
+
+    TFREE(map);
+}
+
+/**
+ * Release a sample buffer that points into a memory mapped file, freeing its slot to be
+ * mapped onto a new window of the file.
+ */
+static
+aresult_t _file_mmap_buf_release(struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    struct file_mmap_source *map = NULL;
+    size_t slot = 0;
+
+    TSL_ASSERT_ARG(NULL != buf);
+    TSL_BUG_ON(atomic_load(&buf->refcount) != 0);
+
+    map = buf->priv;
+    slot = ((uint8_t *)buf - map->region) / map->slot_bytes;
+
+    TSL_BUG_ON(slot >= map->nr_slots);
+
+    atomic_store_explicit(&map->slot_busy[slot], false, memory_order_release);
+
+    _file_mmap_source_put(map);
+
+    return ret;
+}
+
+/**
+ * Create a memory mapped file source. Takes ownership of fd on success. The source starts
+ * with two references: one dropped by the file worker thread when it terminates, and one
+ * dropped when the receiver is cleaned up.
+ */
+static
+aresult_t _file_mmap_source_new(struct file_mmap_source **pmap, int fd, size_t nr_slots)
+{
+    aresult_t ret = A_OK;
+
+    struct file_mmap_source *map = NULL;
+    struct stat st;
+
+    TSL_ASSERT_ARG(NULL != pmap);
+    TSL_ASSERT_ARG(0 <= fd);
+    TSL_ASSERT_ARG(0 != nr_slots);
+
+    *pmap = NULL;
+
+    if (0 > fstat(fd, &st)) {
+        int errnum = errno;
+        FL_MSG(SEV_FATAL, "CANT-STAT-FILE", "Unable to get size of input file, reason: %s (%d)",
+                strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = TZAALLOC(map, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    map->fd = -1;
+    map->region = MAP_FAILED;
+    map->file_len = st.st_size;
+    map->nr_slots = nr_slots;
+    map->page_size = sysconf(_SC_PAGESIZE);
+
+    /* The header has to fit right before the window, and still be suitably aligned */
+    TSL_BUG_ON(offsetof(struct sample_buf, data_buf) > map->page_size);
+    TSL_BUG_ON(0 != (map->page_size - offsetof(struct sample_buf, data_buf)) % __alignof__(struct sample_buf));
+
+    map->window_bytes = (FILE_MMAP_WINDOW_SAMPLES * 2 * sizeof(int16_t) + map->page_size - 1) & ~(map->page_size - 1);
+    map->slot_bytes = map->page_size + map->window_bytes;
+    map->region_len = map->slot_bytes * nr_slots;
+
+    if (FAILED(ret = TCALLOC((void **)&map->slot_busy, nr_slots, sizeof(atomic_bool)))) {
+        goto done;
+    }
+
+    /* Reserve the address space for all the slots; windows of the file are mapped into it as needed */
+    if (MAP_FAILED == (map->region = mmap(NULL, map->region_len, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)))
+    {
+        int errnum = errno;
+        FL_MSG(SEV_FATAL, "CANT-RESERVE-MAPPING", "Unable to reserve %zu bytes of address space, reason: %s (%d)",
+                map->region_len, strerror(errnum), errnum);
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_slots; i++) {
+        uint8_t *slot = map->region + i * map->slot_bytes;
+
+        if (MAP_FAILED == mmap(slot, map->page_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_POPULATE, -1, 0))
+        {
+            ret = A_E_NOMEM;
+            goto done;
+        }
+
+        atomic_init(&map->slot_busy[i], false);
+    }
+
+    /* Tell the kernel how we're going to walk the file, and get it started */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    readahead(fd, 0, FILE_MMAP_READAHEAD_WINDOWS * map->window_bytes);
+
+    map->fd = fd;
+    atomic_init(&map->refs, 2);
+
+    FL_MSG(SEV_INFO, "MMAP-FILE", "Memory mapping input file, %zu windows of %zu bytes",
+            nr_slots, map->window_bytes);
+
+    *pmap = map;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != map) {
+            if (MAP_FAILED != map->region) {
+                munmap(map->region, map->region_len);
+            }
+
+            if (NULL != map->slot_busy) {
+                TFREE(map->slot_busy);
+            }
+
+            TFREE(map);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Map the next window of the file into a free slot, and hand it out as a sample buffer.
+ *
+ * \return A_OK on success, A_E_BUSY if all slots are in use, A_E_DONE at the end of the file.
+ */
+static
+aresult_t _file_mmap_next(struct file_mmap_source *map, struct sample_buf **pbuf)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *sbuf = NULL;
+    uint8_t *slot = NULL;
+    size_t slot_idx = 0,
+           nr_bytes = 0,
+           map_len = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != map);
+    TSL_ASSERT_ARG_DEBUG(NULL != pbuf);
+
+    *pbuf = NULL;
+
+    if (map->file_len - map->next_offset < (off_t)(2 * sizeof(int16_t))) {
+        ret = A_E_DONE;
+        goto done;
+    }
+
+    /* Buffers tend to be released in order, so the next slot is almost always free */
+    for (slot_idx = 0; slot_idx < map->nr_slots; slot_idx++) {
+        size_t idx = (map->next_slot + slot_idx) % map->nr_slots;
+        if (false == atomic_load_explicit(&map->slot_busy[idx], memory_order_acquire)) {
+            slot_idx = idx;
+            break;
+        }
+    }
+
+    if (slot_idx == map->nr_slots) {
+        ret = A_E_BUSY;
+        goto done;
+    }
+
+    nr_bytes = BL_MIN2((off_t)map->window_bytes, map->file_len - map->next_offset);
+    map_len = (nr_bytes + map->page_size - 1) & ~(map->page_size - 1);
+    slot = map->region + slot_idx * map->slot_bytes;
+
+    /* Replaces whatever window this slot held before. Private, so stray writes never reach the file. */
+    if (MAP_FAILED == mmap(slot + map->page_size, map_len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED | MAP_POPULATE, map->fd, map->next_offset))
+    {
+        int errnum = errno;
+        FL_MSG(SEV_FATAL, "CANT-MAP-FILE", "Unable to map window at offset %lld of input file, reason: %s (%d)",
+                (long long)map->next_offset, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    map->next_offset += map->window_bytes;
+    map->next_slot = (slot_idx + 1) % map->nr_slots;
+
+    /* Keep the kernel reading ahead of us */
+    readahead(map->fd, map->next_offset + (FILE_MMAP_READAHEAD_WINDOWS - 1) * map->window_bytes, map->window_bytes);
+
+    sbuf = (struct sample_buf *)(slot + map->page_size - offsetof(struct sample_buf, data_buf));
+    sbuf->sample_type = COMPLEX_INT_16;
+    sbuf->nr_samples = nr_bytes / (2 * sizeof(int16_t));
+    sbuf->sample_buf_bytes = sbuf->nr_samples * 2 * sizeof(int16_t);
+    sbuf->start_time_ns = 0;
+    sbuf->release = _file_mmap_buf_release;
+    sbuf->priv = map;
+
+    atomic_store_explicit(&map->slot_busy[slot_idx], true, memory_order_relaxed);
+    atomic_fetch_add_explicit(&map->refs, 1, memory_order_relaxed);
+
+    *pbuf = sbuf;
 
 done:
     return ret;
 }
 
+/**
+ * Wait until every consumer has room for another sample buffer, rather than letting them drop
+ * buffers on the floor.
+ */
+static
+void _file_worker_wait_for_consumers(struct file_worker_thread *thr)
+{
+    while (receiver_thread_running(&thr->rcvr) && false == receiver_can_deliver(&thr->rcvr)) {
+        usleep(FILE_BACKPRESSURE_WAIT_US);
+    }
+}
+
 static
 aresult_t _file_worker_thread_work(struct receiver *rx)
 {
     aresult_t ret = A_OK;
 
     struct file_worker_thread *thr = NULL;
+    uint64_t start_ns = 0,
+             nr_samples = 0,
+             elapsed_ns = 0;
 
     TSL_ASSERT_ARG(NULL != rx);
 
     thr = BL_CONTAINER_OF(rx, struct file_worker_thread, rcvr);
 
-    while (receiver_thread_running(rx)) {
-        /* Start timer */
-        uint64_t start_time = tsl_get_clock_monotonic();
+    start_ns = tsl_get_clock_monotonic();
 
+    while (receiver_thread_running(rx)) {
         /* Read in a sample buffer */
         struct sample_buf *sbuf = NULL;
-        if (FAILED(receiver_sample_buf_alloc(rx, &sbuf))) {
-            /* TODO: we need to make this saner */
-            usleep(500000);
-            continue;
-        }
 
-        TSL_BUG_ON(NULL == thr->read_call);
-        if (FAILED(ret = thr->read_call(thr, sbuf))) {
-            /* Chances are we ran out of samples to process */
-            goto done;
+        if (NULL != thr->map) {
+            if (FAILED(ret = _file_mmap_next(thr->map, &sbuf))) {
+                if (A_E_BUSY == ret) {
+                    /* Wait for the demodulators to let go of a window */
+                    ret = A_OK;
+                    usleep(FILE_BACKPRESSURE_WAIT_US);
+                    continue;
+                }
+
+                if (A_E_DONE == ret) {
+                    FL_MSG(SEV_INFO, "END-OF-FILE", "Reached the end of the input file.");
+                    ret = A_OK;
+                }
+
+                goto done;
+            }
+        } else {
+            if (FAILED(receiver_sample_buf_alloc(rx, &sbuf))) {
+                /* Buffers come back as fast as the demodulators get through them */
+                usleep(FILE_BACKPRESSURE_WAIT_US);
+                continue;
+            }
+
+            TSL_BUG_ON(NULL == thr->read_call);
+            if (FAILED(ret = thr->read_call(thr, sbuf))) {
+                /* Chances are we ran out of samples to process */
+                goto done;
+            }
+
+            if (0 == sbuf->nr_samples) {
+                FL_MSG(SEV_INFO, "END-OF-FILE", "Reached the end of the input file.");
+                atomic_store(&sbuf->refcount, 1);
+                TSL_BUG_IF_FAILED(sample_buf_decref(sbuf));
+                goto done;
+            }
         }
 
         DIAG("There are %u samples in the input read sample buffer", sbuf->nr_samples);
 
+        /* Treat the samples as captured as they come off the disk, like a live radio would */
+        receiver_sample_buf_stamp(rx, sbuf, sbuf->nr_samples);
+
+        nr_samples += sbuf->nr_samples;
+
+        if (true == thr->max_speed) {
+            _file_worker_wait_for_consumers(thr);
+        }
+
         /* Deliver the sample buffer */
         TSL_BUG_IF_FAILED(receiver_sample_buf_deliver(rx, sbuf));
 
-        /* Stop timer, check how long this mess took */
-        uint64_t total_time = tsl_get_clock_monotonic() - start_time;
+        if (false == thr->max_speed) {
+            /* Pace against an absolute schedule, so time spent reading doesn't accumulate as drift */
+            uint64_t now_ns = tsl_get_clock_monotonic(),
+                     deadline_ns = start_ns + (nr_samples / thr->samples_per_sec) * 1000000000ull +
+                (nr_samples % thr->samples_per_sec) * 1000000000ull / thr->samples_per_sec;
 
-        /* Sleep until we should deliver the next one */
-        if (total_time < thr->time_per_buf_ns) {
-            usleep((thr->time_per_buf_ns - total_time)/1000);
+            if (now_ns < deadline_ns) {
+                usleep((deadline_ns - now_ns)/1000);
+            }
         }
     }
 
 done:
+    elapsed_ns = tsl_get_clock_monotonic() - start_ns;
+
+    if (0 != elapsed_ns && 0 != thr->samples_per_sec) {
+        double secs = (double)elapsed_ns / 1e9,
+               rate = (double)nr_samples / secs;
+
+        FL_MSG(SEV_INFO, "REPLAY-THROUGHPUT", "Read %llu samples in %.3f seconds: %.0f samples/sec, %.2fx real time",
+                (unsigned long long)nr_samples, secs, rate, rate / (double)thr->samples_per_sec);
+    }
+
+    if (NULL != thr->map) {
+        /* Drop the worker's reference; the buffers in flight keep the mapping alive */
+        _file_mmap_source_put(thr->map);
+    }
+
     return ret;
 }
 
@@ -214,7 +606,7 @@ aresult_t _file_worker_thread_cleanup(struct receiver *rx)
 
     fwt = BL_CONTAINER_OF(rx, struct file_worker_thread, rcvr);
 
-    if (0 >= fwt->fd) {
+    if (0 <= fwt->fd) {
         close(fwt->fd);
         fwt->fd = -1;
     }
@@ -223,44 +615,176 @@ aresult_t _file_worker_thread_cleanup(struct receiver *rx)
         TFREE(fwt->bounce_buf);
     }
 
+    if (NULL != fwt->map) {
+        _file_mmap_source_put(fwt->map);
+    }
+
     return ret;
 }
 
-aresult_t file_worker_thread_new(struct receiver **pthr, struct config *cfg)
+/**
+ * Map a SigMF core:datatype onto one of the sample formats we can read.
+ */
+static
+aresult_t _file_sigmf_format(const char *datatype, enum file_worker_sample_format *pformat)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != datatype);
+    TSL_ASSERT_ARG(NULL != pformat);
+
+    if (!strcmp(datatype, "ci16_le")) {
+        *pformat = FILE_WORKER_SAMPLE_FORMAT_S16_LE;
+    } else if (!strcmp(datatype, "ci16_be")) {
+        *pformat = FILE_WORKER_SAMPLE_FORMAT_S16_BE;
+    } else if (!strcmp(datatype, "ci8")) {
+        *pformat = FILE_WORKER_SAMPLE_FORMAT_S8;
+    } else if (!strcmp(datatype, "cu8")) {
+        *pformat = FILE_WORKER_SAMPLE_FORMAT_U8;
+#if __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+    } else if (!strcmp(datatype, "cf32_le")) {
+        *pformat = FILE_WORKER_SAMPLE_FORMAT_F32;
+#else
+    } else if (!strcmp(datatype, "cf32_be")) {
+        *pformat = FILE_WORKER_SAMPLE_FORMAT_F32;
+#endif
+    } else {
+        ret = A_E_INVAL;
+    }
+
+    return ret;
+}
+
+/**
+ * Read the metadata of a SigMF recording, to find the sample format and the file holding the
+ * samples. The filename can name either half of the recording, or the recording without a suffix.
+ *
+ * \param filename The configured filename
+ * \param data_path The path of the SigMF data file, returned by reference
+ * \param data_path_len Length of the data_path buffer
+ * \param pformat The sample format of the data file, returned by reference
+ * \param psample_rate The sample rate recorded in the metadata, or 0 if none was, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+static
+aresult_t _file_sigmf_load(const char *filename, char *data_path, size_t data_path_len,
+        enum file_worker_sample_format *pformat, double *psample_rate)
+{
+    aresult_t ret = A_OK;
+
+    struct config *meta CAL_CLEANUP(config_delete) = NULL;
+    struct config global = CONFIG_INIT_EMPTY;
+    char meta_path[PATH_MAX];
+    const char *datatype = NULL;
+    size_t base_len = 0,
+           suffix_len = strlen(FILE_SIGMF_META_SUFFIX);
+
+    TSL_ASSERT_ARG(NULL != filename);
+    TSL_ASSERT_ARG(NULL != data_path);
+    TSL_ASSERT_ARG(NULL != pformat);
+    TSL_ASSERT_ARG(NULL != psample_rate);
+
+    *psample_rate = 0.0;
+
+    base_len = strlen(filename);
+    if (base_len > suffix_len && (!strcmp(filename + base_len - suffix_len, FILE_SIGMF_META_SUFFIX) ||
+                !strcmp(filename + base_len - suffix_len, FILE_SIGMF_DATA_SUFFIX)))
+    {
+        base_len -= suffix_len;
+    }
+
+    if ((size_t)snprintf(meta_path, sizeof(meta_path), "%.*s" FILE_SIGMF_META_SUFFIX, (int)base_len, filename) >= sizeof(meta_path) ||
+            (size_t)snprintf(data_path, data_path_len, "%.*s" FILE_SIGMF_DATA_SUFFIX, (int)base_len, filename) >= data_path_len)
+    {
+        FL_MSG(SEV_FATAL, "SIGMF-PATH-TOO-LONG", "SigMF recording path [%s] is too long, aborting.", filename);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    TSL_BUG_IF_FAILED(config_new(&meta));
+
+    if (FAILED(ret = config_add(meta, meta_path))) {
+        FL_MSG(SEV_FATAL, "SIGMF-BAD-METADATA", "Unable to load SigMF metadata from [%s], aborting.", meta_path);
+        goto done;
+    }
+
+    if (FAILED(ret = config_get(meta, &global, "global")) ||
+            FAILED(ret = config_get_string(&global, &datatype, "core:datatype")))
+    {
+        FL_MSG(SEV_FATAL, "SIGMF-NO-DATATYPE", "SigMF metadata [%s] has no global core:datatype, aborting.", meta_path);
+        goto done;
+    }
+
+    if (FAILED(ret = _file_sigmf_format(datatype, pformat))) {
+        FL_MSG(SEV_FATAL, "SIGMF-UNSUPPORTED-DATATYPE", "SigMF datatype [%s] is not supported, aborting.", datatype);
+        goto done;
+    }
+
+    if (FAILED(config_get_float(&global, psample_rate, "core:sample_rate"))) {
+        *psample_rate = 0.0;
+    }
+
+    FL_MSG(SEV_INFO, "SIGMF-RECORDING", "SigMF recording [%s] holds %s samples", data_path, datatype);
+
+done:
+    return ret;
+}
+
+aresult_t file_worker_thread_new(struct receiver **pthr, struct config *cfg, struct config *devcfg)
 {
     aresult_t ret = A_OK;
 
     struct file_worker_thread *thr = NULL;
-    int fd = -1;
+    int fd = -1,
+        nr_map_bufs = FILE_MMAP_DEFAULT_NR_BUFS,
+        sample_rate = 0,
+        buf_samples = SAMPLES_PER_BUF;
+    bool use_mmap = false,
+         max_speed = false;
     const char *filename = NULL,
                *format = NULL;
-    struct config devcfg = CONFIG_INIT_EMPTY;
+    char sigmf_data_path[PATH_MAX];
+    double sigmf_sample_rate = 0.0;
     enum file_worker_sample_format sample_format = FILE_WORKER_SAMPLE_FORMAT_UNKNOWN;
+    size_t samples_per_buf = SAMPLES_PER_BUF,
+           bounce_sample_bytes = 0;
 
     TSL_ASSERT_ARG(NULL != pthr);
     TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(NULL != devcfg);
 
-    if (FAILED(ret = config_get(cfg, &devcfg, "device"))) {
-        FL_MSG(SEV_FATAL, "MISSING-DEVICE-STANZA", "Missing 'device' stanza of configuration, aborting.");
-        goto done;
-    }
-
-    if (FAILED(ret = config_get_string(&devcfg, &filename, "filename"))) {
+    if (FAILED(ret = config_get_string(devcfg, &filename, "filename"))) {
         FL_MSG(SEV_FATAL, "CONFIG-NO-FILE", "Need to specify a filename in the device config, aborting.");
         goto done;
     }
 
-    if (FAILED(config_get_string(&devcfg, &format, "fileFormat"))) {
+    if (FAILED(ret = config_get_string(devcfg, &format, "fileFormat"))) {
+        FL_MSG(SEV_FATAL, "CONFIG-NO-FORMAT", "Need to specify a fileFormat in the device config, aborting.");
         goto done;
     }
 
     /* Validate that the format is supported */
-    if (!strncmp(format, "cs16", 4)) {
+    if (!strcmp(format, "cs16")) {
         sample_format = FILE_WORKER_SAMPLE_FORMAT_S16;
-    } else if (!strncmp(format, "cs8", 3)) {
+    } else if (!strcmp(format, "cs16le")) {
+        sample_format = FILE_WORKER_SAMPLE_FORMAT_S16_LE;
+    } else if (!strcmp(format, "cs16be")) {
+        sample_format = FILE_WORKER_SAMPLE_FORMAT_S16_BE;
+    } else if (!strcmp(format, "cs8")) {
         sample_format = FILE_WORKER_SAMPLE_FORMAT_S8;
-    } else if (!strncmp(format, "cu8", 3)) {
+    } else if (!strcmp(format, "cu8")) {
         sample_format = FILE_WORKER_SAMPLE_FORMAT_U8;
+    } else if (!strcmp(format, "cf32")) {
+        sample_format = FILE_WORKER_SAMPLE_FORMAT_F32;
+    } else if (!strcmp(format, "sigmf")) {
+        /* The metadata says what the samples are, and where they live */
+        if (FAILED(ret = _file_sigmf_load(filename, sigmf_data_path, sizeof(sigmf_data_path),
+                        &sample_format, &sigmf_sample_rate)))
+        {
+            goto done;
+        }
+        filename = sigmf_data_path;
     } else {
         FL_MSG(SEV_FATAL, "UNSUPPORTED-FILE-FORMAT", "File format [%s] is not supported, aborting.",
                 format);
@@ -268,8 +792,35 @@ aresult_t file_worker_thread_new(struct receiver **pthr, struct config *cfg)
         goto done;
     }
 
-    FL_MSG(SEV_INFO, "CREATING-FILE-SOURCE", "Sourcing samples in format %s from file [%s]",
-            format, filename);
+    if (FAILED(ret = receiver_config_get_integer(devcfg, cfg, &sample_rate, "sampleRateHz")) || 0 >= sample_rate) {
+        FL_MSG(SEV_FATAL, "NO-SAMPLE-RATE", "Need to specify a sample rate, in Hertz, to pace the replay.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* The channel plan is built around sampleRateHz, so it had better match the recording */
+    if (0.0 != sigmf_sample_rate && (int)(sigmf_sample_rate + 0.5) != sample_rate) {
+        FL_MSG(SEV_FATAL, "SIGMF-SAMPLE-RATE-MISMATCH", "SigMF recording was made at %.0f Hz, but sampleRateHz is %d, aborting.",
+                sigmf_sample_rate, sample_rate);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* Bigger reads cost less per sample, smaller ones get samples to the channels sooner */
+    if (!FAILED(receiver_config_get_integer(devcfg, cfg, &buf_samples, "samplesPerBuffer")) && 0 >= buf_samples) {
+        FL_MSG(SEV_FATAL, "BAD-SAMPLES-PER-BUFFER", "samplesPerBuffer must be a positive number of samples.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    samples_per_buf = buf_samples;
+
+    if (FAILED(config_get_boolean(devcfg, &max_speed, "maxSpeed"))) {
+        max_speed = false;
+    }
+
+    FL_MSG(SEV_INFO, "CREATING-FILE-SOURCE", "Sourcing samples in format %s from file [%s]%s",
+            format, filename, max_speed ? ", as fast as possible" : "");
 
     /* Try to open the file */
     if (0 > (fd = open(filename, O_RDONLY))) {
@@ -286,40 +837,79 @@ aresult_t file_worker_thread_new(struct receiver **pthr, struct config *cfg)
 
     thr->fd = fd;
     thr->sample_format = sample_format;
+    thr->samples_per_sec = sample_rate;
+    thr->max_speed = max_speed;
+    thr->samples_per_buf = samples_per_buf;
 
-    if (sample_format == FILE_WORKER_SAMPLE_FORMAT_S8 || sample_format == FILE_WORKER_SAMPLE_FORMAT_U8) {
-        DIAG("Creating bounce buffer, input format requires conversion.");
-        switch (sample_format) {
-        case FILE_WORKER_SAMPLE_FORMAT_S8:
-            thr->read_call = _file_read_cs8;
-            break;
-        case FILE_WORKER_SAMPLE_FORMAT_U8:
-            thr->read_call = _file_read_cu8;
-            break;
-        default:
-            PANIC("Sample format is corrupted, aborting.");
+    if (FAILED(config_get_boolean(devcfg, &use_mmap, "mmap"))) {
+        use_mmap = false;
+    }
+
+    switch (sample_format) {
+    case FILE_WORKER_SAMPLE_FORMAT_S8:
+        thr->read_call = _file_read_cs8;
+        bounce_sample_bytes = 2 * sizeof(int8_t);
+        break;
+    case FILE_WORKER_SAMPLE_FORMAT_U8:
+        thr->read_call = _file_read_cu8;
+        bounce_sample_bytes = 2 * sizeof(uint8_t);
+        break;
+    case FILE_WORKER_SAMPLE_FORMAT_F32:
+        thr->read_call = _file_read_cf32;
+        bounce_sample_bytes = 2 * sizeof(float);
+        break;
+    case FILE_WORKER_SAMPLE_FORMAT_S16_SWAPPED:
+        thr->read_call = _file_read_cs16_swapped;
+        break;
+    case FILE_WORKER_SAMPLE_FORMAT_S16:
+        thr->read_call = _file_read_cs16;
+
+        if (true == use_mmap) {
+            if (FAILED(receiver_config_get_integer(devcfg, cfg, &nr_map_bufs, "nrSampBufs")) || 0 >= nr_map_bufs) {
+                nr_map_bufs = FILE_MMAP_DEFAULT_NR_BUFS;
+            }
+
+            if (FAILED(ret = _file_mmap_source_new(&thr->map, fd, nr_map_bufs))) {
+                goto done;
+            }
+
+            /* The mapping owns the file descriptor now */
+            thr->fd = -1;
+            fd = -1;
+            samples_per_buf = FILE_MMAP_WINDOW_SAMPLES;
         }
+        break;
+    default:
+        PANIC("Sample format is corrupted, aborting.");
+    }
+
+    if (0 != bounce_sample_bytes) {
+        DIAG("Creating bounce buffer, input format requires conversion.");
 
-        if (FAILED(ret = TACALLOC(&thr->bounce_buf, SAMPLES_PER_BUF, 2 * sizeof(int8_t), SYS_CACHE_LINE_LENGTH))) {
+        if (FAILED(ret = TACALLOC(&thr->bounce_buf, samples_per_buf, bounce_sample_bytes, SYS_CACHE_LINE_LENGTH))) {
             goto done;
         }
 
-        thr->bounce_buf_bytes = SAMPLES_PER_BUF * 2 * sizeof(int8_t);
-    } else if (sample_format == FILE_WORKER_SAMPLE_FORMAT_S16) {
-        thr->read_call = _file_read_cs16;
-    } else {
-        FL_MSG(SEV_FATAL, "UNSUPPORTED-SAMPLE-FORMAT", "Sample format [%s] is not supported, aborting.", format);
+        thr->bounce_buf_bytes = samples_per_buf * bounce_sample_bytes;
+    }
+
+    if (true == use_mmap && NULL == thr->map) {
+        FL_MSG(SEV_WARNING, "MMAP-NOT-SUPPORTED", "Only host byte order cs16 files can be memory mapped, reading instead.");
     }
 
     /* Initialize the receiver subsystem */
+    thr->rcvr.local_cfg = devcfg;
     TSL_BUG_IF_FAILED(receiver_init(&thr->rcvr, cfg, _file_worker_thread_work,
-                _file_worker_thread_cleanup, SAMPLES_PER_BUF));
+                _file_worker_thread_cleanup, samples_per_buf));
 
     *pthr = &thr->rcvr;
 
 done:
     if (FAILED(ret)) {
         if (NULL != thr) {
+            if (NULL != thr->bounce_buf) {
+                TFREE(thr->bounce_buf);
+            }
             TFREE(thr);
             thr = NULL;
         }
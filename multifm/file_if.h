@@ -5,4 +5,14 @@
 struct receiver;
 struct config;
 
-aresult_t file_worker_thread_new(struct receiver **pthr, struct config *cfg);
+/**
+ * Create a new receiver replaying samples from a file.
+ *
+ * \param pthr The new receiver, returned by reference
+ * \param cfg The process-wide configuration
+ * \param device The device stanza. Receiver parameters (i.e. centerFreqHz, channels) given here
+ *               take precedence over the process-wide configuration.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t file_worker_thread_new(struct receiver **pthr, struct config *cfg, struct config *device);
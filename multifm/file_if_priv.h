@@ -4,6 +4,10 @@
 
 #include <tsl/result.h>
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
 struct sample_buf;
 struct file_worker_thread;
 
@@ -13,7 +17,79 @@ enum file_worker_sample_format {
     FILE_WORKER_SAMPLE_FORMAT_UNKNOWN = 0,
     FILE_WORKER_SAMPLE_FORMAT_S8,   /* Signed 8-bit integer input */
     FILE_WORKER_SAMPLE_FORMAT_U8,   /* Unsigned 8-bit integer input */
-    FILE_WORKER_SAMPLE_FORMAT_S16,  /* Signed 16-bit integer input */
+    FILE_WORKER_SAMPLE_FORMAT_S16,  /* Signed 16-bit integer input, in host byte order */
+    FILE_WORKER_SAMPLE_FORMAT_S16_SWAPPED,  /* Signed 16-bit integer input, in the other byte order */
+    FILE_WORKER_SAMPLE_FORMAT_F32,  /* 32-bit float input, in host byte order */
+};
+
+/**
+ * A zero-copy source of cs16 sample buffers, carved directly out of a memory mapping of the
+ * input file. Each buffer gets its own slot: a private anonymous page holding the sample_buf
+ * header, immediately followed by a window of the file mapped in place, so data_buf points
+ * straight at the file's pages. A slot is only remapped onto a new window of the file once
+ * every consumer has released the buffer it holds.
+ */
+struct file_mmap_source {
+    /**
+     * The reserved address space holding all the slots
+     */
+    uint8_t *region;
+
+    /**
+     * Length of the reserved address space, in bytes
+     */
+    size_t region_len;
+
+    /**
+     * The system page size
+     */
+    size_t page_size;
+
+    /**
+     * Size of each window of the file, in bytes. Always a multiple of the page size.
+     */
+    size_t window_bytes;
+
+    /**
+     * Distance between the start of each slot, in bytes
+     */
+    size_t slot_bytes;
+
+    /**
+     * The number of slots
+     */
+    size_t nr_slots;
+
+    /**
+     * For each slot, whether its buffer is still held by a consumer
+     */
+    atomic_bool *slot_busy;
+
+    /**
+     * The slot to try first, the next time a buffer is needed
+     */
+    size_t next_slot;
+
+    /**
+     * The file being mapped. Owned by the source.
+     */
+    int fd;
+
+    /**
+     * Length of the file, in bytes
+     */
+    off_t file_len;
+
+    /**
+     * Offset of the next window to be mapped
+     */
+    off_t next_offset;
+
+    /**
+     * References to the source: one for the file worker, one for each buffer in flight. The
+     * mapping is torn down when the last one is dropped.
+     */
+    atomic_size_t refs;
 };
 
 struct file_worker_thread {
@@ -21,13 +97,27 @@ struct file_worker_thread {
 
     int fd;
 
-    long samples_per_sec;
-    uint64_t time_per_buf_ns;
+    uint64_t samples_per_sec;
+
+    /**
+     * If true, don't pace the replay to real time; read as fast as the consumers can keep up
+     */
+    bool max_speed;
     enum file_worker_sample_format sample_format;
 
+    /**
+     * The most samples read into a sample buffer, when the file isn't memory mapped
+     */
+    size_t samples_per_buf;
+
     file_read_convert_call_func_t read_call;
     void *bounce_buf;
     size_t bounce_buf_bytes;
+
+    /**
+     * If the input file is memory mapped, the source of sample buffers. NULL otherwise.
+     */
+    struct file_mmap_source *map;
 };
 
 #define FL_MSG(sev, sys, msg, ...)      MESSAGE("FILEIF", sev, sys, msg, ##__VA_ARGS__)
@@ -1,7 +1,7 @@
 #include <multifm/fm_demod.h>
 #include <multifm/demod_base.h>
-#include <multifm/fast_atan2f.h>
 
+#include <filter/cycle_counter.h>
 #include <filter/filter.h>
 
 #include <tsl/errors.h>
@@ -11,23 +11,296 @@
 
 #include <math.h>
 
+#if defined(_USE_ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Number of CORDIC iterations. The residual error after the last iteration is about a third of
+ * an output LSB.
+ */
+#define FM_DEMOD_CORDIC_ITERATIONS      16
+
+/**
+ * atan(2^-k), as a binary angle where 2^31 is pi
+ */
+static const
+int32_t _fm_demod_cordic_atan[FM_DEMOD_CORDIC_ITERATIONS] = {
+    536870912, 316933406, 167458907, 85004756, 42667331, 21354465, 10679838, 5340245,
+    2670163, 1335087, 667544, 333772, 166886, 83443, 41722, 20861,
+};
+
+/**
+ * Scale from a phase step in radians, with the magnitude squared halved, to Q.15 (where 1.0 is pi)
+ */
+#define FM_DEMOD_DIFF_SCALE             ((float)(16384.0/M_PI))
+
 struct multifm_fm_demod {
     struct demod_base demod;
+    enum multifm_fm_discriminator disc;
     int32_t last_fm_re;
     int32_t last_fm_im;
 };
 
-aresult_t multifm_fm_demod_init(struct demod_base **pdemod)
+/**
+ * Calculate the CORDIC atan2 of the phase difference (s_re, s_im). The wrapping arithmetic here
+ * must match the vector implementations exactly.
+ */
+static inline
+int16_t _fm_demod_cordic(int32_t s_re, int32_t s_im)
+{
+    /* Leave headroom for the CORDIC gain */
+    int32_t x = s_re >> 2,
+            y = s_im >> 2,
+            m = x >> 31;
+    uint32_t z = (uint32_t)m & 0x80000000ul;
+
+    /* Rotate by pi into the right half-plane, if needed */
+    x = (x ^ m) - m;
+    y = (y ^ m) - m;
+
+    for (int k = 0; k < FM_DEMOD_CORDIC_ITERATIONS; k++) {
+        int32_t dx = y >> k,
+                dy = x >> k;
+
+        /* Rotate towards the x axis */
+        m = y >> 31;
+        x += (dx ^ m) - m;
+        y -= (dy ^ m) - m;
+        z += (uint32_t)((_fm_demod_cordic_atan[k] ^ m) - m);
+    }
+
+    return (int16_t)((z + 0x8000ul) >> 16);
+}
+
+/**
+ * Differentiate-and-divide approximation of the phase step. I dQ - Q dI is the imaginary part of
+ * the conjugate product, so we get to reuse it for free.
+ */
+static inline
+int16_t _fm_demod_differentiate(int32_t s_im, int32_t mag_half)
+{
+    float phi = (float)s_im * FM_DEMOD_DIFF_SCALE,
+          den = (float)mag_half;
+
+    if (den < 1.0f) {
+        den = 1.0f;
+    }
+
+    phi = phi / den;
+
+    if (phi > 32767.0f) {
+        phi = 32767.0f;
+    } else if (phi < -32768.0f) {
+        phi = -32768.0f;
+    }
+
+    return (int16_t)(int32_t)phi;
+}
+
+/**
+ * Demodulate a single sample a, given the prior sample b.
+ */
+static inline
+int16_t _fm_demod_sample(enum multifm_fm_discriminator disc, int32_t a_re, int32_t a_im, int32_t b_re, int32_t b_im)
+{
+    /* Multiply by the complex conjugate of the prior sample, negating its phase term */
+    int32_t s_re = (int32_t)((uint32_t)(a_re * b_re) + (uint32_t)(a_im * b_im)),
+            s_im = (int32_t)((uint32_t)(a_im * b_re) - (uint32_t)(a_re * b_im));
+
+    if (MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE == disc) {
+        int32_t mag_half = (int32_t)(((uint32_t)(a_re * a_re) + (uint32_t)(a_im * a_im)) >> 1);
+        return _fm_demod_differentiate(s_im, mag_half);
+    }
+
+    return _fm_demod_cordic(s_re, s_im);
+}
+
+#if defined(_USE_ARM_NEON)
+static inline
+int32x4_t _fm_demod_neg_if(int32x4_t v, int32x4_t m)
+{
+    return vsubq_s32(veorq_s32(v, m), m);
+}
+
+static inline
+int16x4_t _fm_demod_cordic_x4(int32x4_t s_re, int32x4_t s_im)
+{
+    int32x4_t x = vshrq_n_s32(s_re, 2),
+              y = vshrq_n_s32(s_im, 2),
+              m = vshrq_n_s32(x, 31);
+    uint32x4_t z = vandq_u32(vreinterpretq_u32_s32(m), vdupq_n_u32(0x80000000ul));
+
+    x = _fm_demod_neg_if(x, m);
+    y = _fm_demod_neg_if(y, m);
+
+    for (int k = 0; k < FM_DEMOD_CORDIC_ITERATIONS; k++) {
+        int32x4_t shift = vdupq_n_s32(-k),
+                  dx = vshlq_s32(y, shift),
+                  dy = vshlq_s32(x, shift);
+
+        m = vshrq_n_s32(y, 31);
+        x = vaddq_s32(x, _fm_demod_neg_if(dx, m));
+        y = vsubq_s32(y, _fm_demod_neg_if(dy, m));
+        z = vaddq_u32(z, vreinterpretq_u32_s32(_fm_demod_neg_if(vdupq_n_s32(_fm_demod_cordic_atan[k]), m)));
+    }
+
+    return vreinterpret_s16_u16(vshrn_n_u32(vaddq_u32(z, vdupq_n_u32(0x8000ul)), 16));
+}
+
+static inline
+int16x4_t _fm_demod_differentiate_x4(int32x4_t s_im, int32x4_t mag_half)
+{
+    float32x4_t phi = vmulq_f32(vcvtq_f32_s32(s_im), vdupq_n_f32(FM_DEMOD_DIFF_SCALE)),
+                den = vmaxq_f32(vcvtq_f32_s32(mag_half), vdupq_n_f32(1.0f));
+
+#ifdef __aarch64__
+    phi = vdivq_f32(phi, den);
+#else
+    /* No vector divide on ARMv7, so refine the reciprocal estimate instead. Not bit-exact with
+     * the scalar version, but well within the accuracy of this approximation.
+     */
+    float32x4_t rcp = vrecpeq_f32(den);
+    rcp = vmulq_f32(vrecpsq_f32(den, rcp), rcp);
+    rcp = vmulq_f32(vrecpsq_f32(den, rcp), rcp);
+    phi = vmulq_f32(phi, rcp);
+#endif
+
+    phi = vminq_f32(vmaxq_f32(phi, vdupq_n_f32(-32768.0f)), vdupq_n_f32(32767.0f));
+
+    return vmovn_s32(vcvtq_s32_f32(phi));
+}
+
+/**
+ * Demodulate nr_out samples, where out[i] is the phase step from in[i] to in[i + 1]. Returns the
+ * number of samples processed; the caller handles the remainder.
+ */
+static
+size_t _fm_demod_process_vector(enum multifm_fm_discriminator disc, const int16_t *in, int16_t *out, size_t nr_out)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= nr_out; i += 4) {
+        int16x4x2_t b = vld2_s16(in + 2 * i),
+                    a = vld2_s16(in + 2 * (i + 1));
+        int32x4_t s_im = vmlsl_s16(vmull_s16(a.val[1], b.val[0]), a.val[0], b.val[1]);
+        int16x4_t res;
+
+        if (MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE == disc) {
+            uint32x4_t mag = vreinterpretq_u32_s32(vmlal_s16(vmull_s16(a.val[0], a.val[0]), a.val[1], a.val[1]));
+            res = _fm_demod_differentiate_x4(s_im, vreinterpretq_s32_u32(vshrq_n_u32(mag, 1)));
+        } else {
+            int32x4_t s_re = vmlal_s16(vmull_s16(a.val[0], b.val[0]), a.val[1], b.val[1]);
+            res = _fm_demod_cordic_x4(s_re, s_im);
+        }
+
+        vst1_s16(out + i, res);
+    }
+
+    return i;
+}
+#elif defined(__SSE2__)
+static inline
+__m128i _fm_demod_neg_if(__m128i v, __m128i m)
+{
+    return _mm_sub_epi32(_mm_xor_si128(v, m), m);
+}
+
+static inline
+__m128i _fm_demod_cordic_x4(__m128i s_re, __m128i s_im)
+{
+    __m128i x = _mm_srai_epi32(s_re, 2),
+            y = _mm_srai_epi32(s_im, 2),
+            m = _mm_srai_epi32(x, 31),
+            z = _mm_and_si128(m, _mm_set1_epi32(INT32_MIN));
+
+    x = _fm_demod_neg_if(x, m);
+    y = _fm_demod_neg_if(y, m);
+
+    for (int k = 0; k < FM_DEMOD_CORDIC_ITERATIONS; k++) {
+        __m128i shift = _mm_cvtsi32_si128(k),
+                dx = _mm_sra_epi32(y, shift),
+                dy = _mm_sra_epi32(x, shift);
+
+        m = _mm_srai_epi32(y, 31);
+        x = _mm_add_epi32(x, _fm_demod_neg_if(dx, m));
+        y = _mm_sub_epi32(y, _fm_demod_neg_if(dy, m));
+        z = _mm_add_epi32(z, _fm_demod_neg_if(_mm_set1_epi32(_fm_demod_cordic_atan[k]), m));
+    }
+
+    /* Taking the top half as signed is the same as wrapping the binary angle to an int16 */
+    return _mm_srai_epi32(_mm_add_epi32(z, _mm_set1_epi32(0x8000)), 16);
+}
+
+static inline
+__m128i _fm_demod_differentiate_x4(__m128i s_im, __m128i mag_half)
+{
+    __m128 phi = _mm_mul_ps(_mm_cvtepi32_ps(s_im), _mm_set1_ps(FM_DEMOD_DIFF_SCALE)),
+           den = _mm_max_ps(_mm_cvtepi32_ps(mag_half), _mm_set1_ps(1.0f));
+
+    phi = _mm_div_ps(phi, den);
+    phi = _mm_min_ps(_mm_max_ps(phi, _mm_set1_ps(-32768.0f)), _mm_set1_ps(32767.0f));
+
+    return _mm_cvttps_epi32(phi);
+}
+
+/**
+ * Demodulate nr_out samples, where out[i] is the phase step from in[i] to in[i + 1]. Returns the
+ * number of samples processed; the caller handles the remainder.
+ */
+static
+size_t _fm_demod_process_vector(enum multifm_fm_discriminator disc, const int16_t *in, int16_t *out, size_t nr_out)
+{
+    size_t i = 0;
+
+    const __m128i mask_re = _mm_set1_epi32(0x0000ffff),
+                  mask_im = _mm_set1_epi32((int32_t)0xffff0000ul);
+
+    for (; i + 4 <= nr_out; i += 4) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 2 * i)),
+                a = _mm_loadu_si128((const __m128i *)(in + 2 * (i + 1))),
+                b_swap = _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, 0xb1), 0xb1),
+                s_im = _mm_sub_epi32(_mm_madd_epi16(a, _mm_and_si128(b_swap, mask_im)),
+                                     _mm_madd_epi16(a, _mm_and_si128(b_swap, mask_re))),
+                res;
+
+        if (MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE == disc) {
+            res = _fm_demod_differentiate_x4(s_im, _mm_srli_epi32(_mm_madd_epi16(a, a), 1));
+        } else {
+            res = _fm_demod_cordic_x4(_mm_madd_epi16(a, b), s_im);
+        }
+
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packs_epi32(res, res));
+    }
+
+    return i;
+}
+#else
+static
+size_t _fm_demod_process_vector(enum multifm_fm_discriminator disc, const int16_t *in, int16_t *out, size_t nr_out)
+{
+    return 0;
+}
+#endif
+
+aresult_t multifm_fm_demod_init(struct demod_base **pdemod, enum multifm_fm_discriminator disc)
 {
     aresult_t ret = A_OK;
 
     struct multifm_fm_demod *demod = NULL;
 
     TSL_ASSERT_ARG(NULL != pdemod);
+    TSL_ASSERT_ARG(MULTIFM_FM_DISCRIMINATOR_ATAN2 == disc || MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE == disc);
     *pdemod = NULL;
 
     TSL_BUG_IF_FAILED(TZAALLOC(demod, SYS_CACHE_LINE_LENGTH));
 
+    demod->disc = disc;
+    demod->demod.process = multifm_fm_demod_process;
+    demod->demod.cleanup = multifm_fm_demod_cleanup;
+
     *pdemod = &demod->demod;
 
     return ret;
@@ -39,8 +312,9 @@ aresult_t multifm_fm_demod_process(struct demod_base *demod, int16_t *in_samples
     aresult_t ret = A_OK;
 
     struct multifm_fm_demod *dfm = NULL;
-    static const float to_q15 = (float)(1 << Q_15_SHIFT);
-    size_t nr_out_samples = 0;
+    size_t nr_done = 0;
+
+    CYCLE_COUNT_START(cycles);
 
     TSL_ASSERT_ARG(NULL != demod);
     TSL_ASSERT_ARG(NULL != in_samples);
@@ -50,36 +324,25 @@ aresult_t multifm_fm_demod_process(struct demod_base *demod, int16_t *in_samples
 
     dfm = BL_CONTAINER_OF(demod, struct multifm_fm_demod, demod);
 
-    for (size_t i = 0; i < nr_in_samples; i++) {
-        /* Get the complex conjugate of the prior sample, negating the phase term */
-        int32_t b_re =  dfm->last_fm_re,
-                b_im = -dfm->last_fm_im,
-                a_re =  in_samples[2 * i    ],
-                a_im =  in_samples[2 * i + 1];
-        int32_t s_re = 0,
-                s_im = 0;
-
-        /* Calculate the phase difference */
-        s_re = a_re * b_re - a_im * b_im;
-        s_im = a_re * b_im + a_im * b_re;
+    /* The first sample is relative to the last sample of the previous batch */
+    out_samples[0] = _fm_demod_sample(dfm->disc, in_samples[0], in_samples[1], dfm->last_fm_re, dfm->last_fm_im);
 
-        /* Convert from cartesian coordinates to a phase angle */
-        /* TODO: This needs to be made full-integer */
-        float phi = fast_atan2f((float)s_im, (float)s_re);
+    /* Every other sample is relative to its neighbour in this batch */
+    nr_done = _fm_demod_process_vector(dfm->disc, in_samples, out_samples + 1, nr_in_samples - 1);
 
-        /* Scale by pi (since atan2 returns an angle in (-pi,pi]), convert back to Q.15 */
-        float phi_scaled = (phi/M_PI) * to_q15;
-        out_samples[nr_out_samples] = (int16_t)phi_scaled;
+    for (size_t i = nr_done + 1; i < nr_in_samples; i++) {
+        out_samples[i] = _fm_demod_sample(dfm->disc, in_samples[2 * i], in_samples[2 * i + 1],
+                in_samples[2 * (i - 1)], in_samples[2 * (i - 1) + 1]);
+    }
 
-        nr_out_samples++;
+    /* Store the last sample processed */
+    dfm->last_fm_re = in_samples[2 * (nr_in_samples - 1)    ];
+    dfm->last_fm_im = in_samples[2 * (nr_in_samples - 1) + 1];
 
-        /* Store the last sample processed */
-        dfm->last_fm_re = a_re;
-        dfm->last_fm_im = a_im;
-    }
+    *pnr_out_samples = nr_in_samples;
+    *pnr_out_bytes = nr_in_samples * sizeof(int16_t);
 
-    *pnr_out_samples = nr_out_samples;
-    *pnr_out_bytes = nr_out_samples * sizeof(int16_t);
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_FM_DEMOD, cycles);
 
     return ret;
 }
@@ -4,6 +4,24 @@
 
 struct demod_base;
 
+/**
+ * The phase discriminators available to the FM demodulator
+ */
+enum multifm_fm_discriminator {
+    /**
+     * Full integer CORDIC atan2 of the phase difference between consecutive samples. Accurate
+     * regardless of amplitude or deviation.
+     */
+    MULTIFM_FM_DISCRIMINATOR_ATAN2 = 0,
+
+    /**
+     * Differentiate-and-divide approximation, (I dQ - Q dI)/(I^2 + Q^2). Cheaper, but only
+     * accurate for small phase steps (i.e. deviation well below the sample rate) and a steady
+     * amplitude.
+     */
+    MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE = 1,
+};
+
 /**
  * FM Demodulator
  *
@@ -16,14 +34,16 @@ struct demod_base;
  * Initialize a new FM demodulator
  *
  * \param pdemod The demodulator state, returned by reference.
+ * \param disc The phase discriminator to use
  *
  * \return A_OK on success, an error code otherwise
  */
-aresult_t multifm_fm_demod_init(struct demod_base **pdemod);
+aresult_t multifm_fm_demod_init(struct demod_base **pdemod, enum multifm_fm_discriminator disc);
 
 /**
  * Given the demodulator state, process the specified sample buffers, and write the output samples
- * out to the real-valued PCM buffer.
+ * out to the real-valued PCM buffer. The whole batch is processed at once, so the discriminator
+ * can be vectorised.
  */
 aresult_t multifm_fm_demod_process(struct demod_base *demod, int16_t *in_samples, size_t nr_in_samples,
         int16_t *out_samples, size_t *pnr_out_samples, size_t *pnr_out_bytes);
@@ -0,0 +1,407 @@
+/*
+ *  iq_recorder.c - Write raw IQ samples to disk off the receive path
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/iq_recorder.h>
+#include <multifm/sample_buf_pool.h>
+#include <multifm/stats.h>
+#include <multifm/multifm.h>
+
+#include <filter/sample_buf.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Alignment of the O_DIRECT staging buffer
+ */
+#define IQ_RECORDER_DIRECT_ALIGN        4096
+
+/**
+ * How long the recorder thread sleeps waiting for work, in milliseconds
+ */
+#define IQ_RECORDER_IDLE_TIMEOUT_MS     100
+
+static
+size_t _iq_recorder_buf_bytes(struct sample_buf *buf)
+{
+    return (size_t)buf->nr_samples * 2 * sizeof(int16_t);
+}
+
+/**
+ * Write out a whole I/O vector, picking up after short writes.
+ */
+static
+aresult_t _iq_recorder_writev(struct iq_recorder *rec, struct iovec *iov, int nr_iov)
+{
+    aresult_t ret = A_OK;
+
+    while (0 < nr_iov) {
+        ssize_t written = writev(rec->fd, iov, nr_iov);
+
+        if (0 > written) {
+            int errnum = errno;
+
+            if (EINTR == errnum) {
+                continue;
+            }
+
+            if (false == rec->write_failed) {
+                MFM_MSG(SEV_ERROR, "IQ-WRITE-FAILED", "Failed to write IQ recording: %s (%d), dropping samples from now on",
+                        strerror(errnum), errnum);
+                rec->write_failed = true;
+            }
+
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        stats_counter_add(&rec->nr_bytes, written);
+
+        while (0 < nr_iov && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            nr_iov--;
+        }
+
+        if (0 < nr_iov) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Write out the full staging buffer.
+ */
+static
+aresult_t _iq_recorder_flush_stage(struct iq_recorder *rec)
+{
+    aresult_t ret = A_OK;
+
+    struct iovec iov = { .iov_base = rec->stage, .iov_len = rec->nr_staged };
+
+    ret = _iq_recorder_writev(rec, &iov, 1);
+    rec->nr_staged = 0;
+
+    return ret;
+}
+
+/**
+ * Write a batch of sample buffers, and release them.
+ */
+static
+aresult_t _iq_recorder_write_batch(struct iq_recorder *rec, struct sample_buf **bufs, size_t nr_bufs)
+{
+    aresult_t ret = A_OK;
+
+    struct iovec iov[IQ_RECORDER_BATCH];
+
+    if (true == rec->write_failed) {
+        stats_counter_add(&rec->nr_dropped, nr_bufs);
+        goto done;
+    }
+
+    if (false == rec->direct) {
+        for (size_t i = 0; i < nr_bufs; i++) {
+            iov[i].iov_base = bufs[i]->data_buf;
+            iov[i].iov_len = _iq_recorder_buf_bytes(bufs[i]);
+        }
+
+        if (FAILED(_iq_recorder_writev(rec, iov, nr_bufs))) {
+            stats_counter_add(&rec->nr_dropped, nr_bufs);
+        }
+    } else {
+        /* O_DIRECT needs aligned, whole-block writes, so everything goes through the stage */
+        for (size_t i = 0; i < nr_bufs && false == rec->write_failed; i++) {
+            const uint8_t *data = bufs[i]->data_buf;
+            size_t nr_bytes = _iq_recorder_buf_bytes(bufs[i]);
+
+            while (0 != nr_bytes) {
+                size_t to_copy = BL_MIN2(nr_bytes, IQ_RECORDER_STAGE_BYTES - rec->nr_staged);
+
+                memcpy(rec->stage + rec->nr_staged, data, to_copy);
+                rec->nr_staged += to_copy;
+                data += to_copy;
+                nr_bytes -= to_copy;
+
+                if (IQ_RECORDER_STAGE_BYTES == rec->nr_staged && FAILED(_iq_recorder_flush_stage(rec))) {
+                    stats_counter_add(&rec->nr_dropped, nr_bufs - i);
+                    break;
+                }
+            }
+        }
+    }
+
+done:
+    for (size_t i = 0; i < nr_bufs; i++) {
+        TSL_BUG_IF_FAILED(sample_buf_decref(bufs[i]));
+    }
+
+    return ret;
+}
+
+/**
+ * Pull up to a batch of sample buffers off the queue, and write them.
+ */
+static
+size_t _iq_recorder_drain(struct iq_recorder *rec)
+{
+    struct sample_buf *bufs[IQ_RECORDER_BATCH];
+    size_t nr_bufs = 0;
+
+    while (nr_bufs < IQ_RECORDER_BATCH) {
+        void *item = NULL;
+
+        TSL_BUG_IF_FAILED(spsc_ring_pop(&rec->ring, &item));
+
+        if (NULL == item) {
+            break;
+        }
+
+        bufs[nr_bufs++] = item;
+    }
+
+    if (0 != nr_bufs) {
+        _iq_recorder_write_batch(rec, bufs, nr_bufs);
+    }
+
+    return nr_bufs;
+}
+
+static
+aresult_t _iq_recorder_work(struct worker_thread *wthr)
+{
+    aresult_t ret = A_OK;
+
+    struct iq_recorder *rec = BL_CONTAINER_OF(wthr, struct iq_recorder, wthr);
+
+    while (worker_thread_is_running(wthr)) {
+        if (0 == _iq_recorder_drain(rec)) {
+            TSL_BUG_IF_FAILED(spsc_ring_wait(&rec->ring, IQ_RECORDER_IDLE_TIMEOUT_MS));
+        }
+    }
+
+    return ret;
+}
+
+aresult_t iq_recorder_new(struct iq_recorder **prec, const char *path, bool direct, size_t max_queued,
+        size_t max_copy_bytes)
+{
+    aresult_t ret = A_OK;
+
+    struct iq_recorder *rec = NULL;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    size_t nr_slots = 1;
+
+    TSL_ASSERT_ARG(NULL != prec);
+    TSL_ASSERT_ARG(NULL != path && '\0' != *path);
+    TSL_ASSERT_ARG(0 != max_queued);
+
+    *prec = NULL;
+
+    if (FAILED(ret = TZAALLOC(rec, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    rec->fd = -1;
+    rec->max_queued = max_queued;
+
+    while (nr_slots < max_queued) {
+        nr_slots <<= 1;
+    }
+
+    if (FAILED(ret = spsc_ring_init(&rec->ring, nr_slots))) {
+        MFM_MSG(SEV_ERROR, "CANT-INIT-RING", "Failed to create IQ recorder queue, aborting.");
+        goto done;
+    }
+
+    if (true == direct) {
+        if (0 > (rec->fd = open(path, flags | O_DIRECT, 0644))) {
+            int errnum = errno;
+            MFM_MSG(SEV_WARNING, "NO-DIRECT-IO", "Can't open '%s' for direct I/O: %s (%d), using buffered writes.",
+                    path, strerror(errnum), errnum);
+        } else {
+            rec->direct = true;
+        }
+    }
+
+    if (0 > rec->fd && 0 > (rec->fd = open(path, flags, 0644))) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "CANT-OPEN-IQ-FILE", "Unable to open IQ recording file '%s': %s (%d)",
+                path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (true == rec->direct) {
+        if (FAILED(ret = TACALLOC((void **)&rec->stage, IQ_RECORDER_STAGE_BYTES, 1, IQ_RECORDER_DIRECT_ALIGN))) {
+            goto done;
+        }
+    }
+
+    if (0 != max_copy_bytes) {
+        if (FAILED(ret = sample_buf_pool_new(&rec->copy_pool, sizeof(struct sample_buf) + max_copy_bytes,
+                        max_queued, false, -1)))
+        {
+            goto done;
+        }
+
+        rec->max_copy_bytes = max_copy_bytes;
+    }
+
+    if (FAILED(ret = worker_thread_new(&rec->wthr, _iq_recorder_work, WORKER_THREAD_CPU_MASK_ANY))) {
+        MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start IQ recorder thread, aborting.");
+        goto done;
+    }
+
+    rec->started = true;
+
+    MFM_MSG(SEV_INFO, "IQ-RECORDING", "Recording IQ samples to '%s'%s", path,
+            true == rec->direct ? " (direct I/O)" : "");
+
+    *prec = rec;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != rec) {
+            iq_recorder_delete(&rec);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t iq_recorder_submit(struct iq_recorder *rec, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != rec);
+    TSL_ASSERT_ARG_DEBUG(NULL != buf);
+
+    if (spsc_ring_depth(&rec->ring) >= rec->max_queued || FAILED(spsc_ring_push(&rec->ring, buf))) {
+        /* The disk is falling behind. Drop the samples rather than holding up the receiver. */
+        if (0 == stats_counter_read(&rec->nr_dropped)) {
+            MFM_MSG(SEV_WARNING, "IQ-RECORDER-BEHIND", "IQ recorder can't keep up, dropping samples.");
+        }
+        stats_counter_add(&rec->nr_dropped, 1);
+        TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+    }
+
+    return ret;
+}
+
+aresult_t iq_recorder_write(struct iq_recorder *rec, const int16_t *samples, size_t nr_bytes)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != rec);
+    TSL_ASSERT_ARG_DEBUG(NULL != samples);
+    TSL_ASSERT_ARG_DEBUG(NULL != rec->copy_pool);
+    TSL_ASSERT_ARG_DEBUG(nr_bytes <= rec->max_copy_bytes);
+
+    if (FAILED(sample_buf_pool_alloc(rec->copy_pool, &buf))) {
+        stats_counter_add(&rec->nr_dropped, 1);
+        goto done;
+    }
+
+    memcpy(buf->data_buf, samples, nr_bytes);
+    buf->refcount = 1;
+    buf->sample_type = COMPLEX_INT_16;
+    buf->nr_samples = nr_bytes / (2 * sizeof(int16_t));
+    buf->start_time_ns = 0;
+
+    ret = iq_recorder_submit(rec, buf);
+
+done:
+    return ret;
+}
+
+aresult_t iq_recorder_delete(struct iq_recorder **prec)
+{
+    aresult_t ret = A_OK;
+
+    struct iq_recorder *rec = NULL;
+
+    TSL_ASSERT_ARG(NULL != prec);
+    TSL_ASSERT_ARG(NULL != *prec);
+
+    rec = *prec;
+
+    if (true == rec->started) {
+        TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&rec->wthr));
+        TSL_BUG_IF_FAILED(spsc_ring_wake(&rec->ring));
+        TSL_BUG_IF_FAILED(worker_thread_delete(&rec->wthr));
+        rec->started = false;
+
+        /* The producer is gone, write out whatever is left */
+        while (0 != _iq_recorder_drain(rec)) {
+        }
+    }
+
+    if (0 != rec->nr_staged && false == rec->write_failed) {
+        /* The tail won't be a whole number of blocks, so finish up with buffered I/O */
+        if (0 > fcntl(rec->fd, F_SETFL, fcntl(rec->fd, F_GETFL) & ~O_DIRECT)) {
+            int errnum = errno;
+            MFM_MSG(SEV_WARNING, "CANT-CLEAR-DIRECT", "Failed to switch off direct I/O: %s (%d)",
+                    strerror(errnum), errnum);
+        }
+        _iq_recorder_flush_stage(rec);
+    }
+
+    if (0 <= rec->fd) {
+        MFM_MSG(SEV_INFO, "IQ-RECORDING-DONE", "Wrote %" PRIu64 " bytes of IQ samples, dropped %" PRIu64 " sample buffers",
+                stats_counter_read(&rec->nr_bytes), stats_counter_read(&rec->nr_dropped));
+        close(rec->fd);
+        rec->fd = -1;
+    }
+
+    if (NULL != rec->stage) {
+        TFREE(rec->stage);
+    }
+
+    if (NULL != rec->copy_pool) {
+        sample_buf_pool_delete(&rec->copy_pool);
+    }
+
+    spsc_ring_cleanup(&rec->ring);
+
+    TFREE(rec);
+
+    *prec = NULL;
+
+    return ret;
+}
+
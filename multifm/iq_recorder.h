@@ -0,0 +1,152 @@
+#pragma once
+
+#include <multifm/spsc_ring.h>
+
+#include <tsl/result.h>
+#include <tsl/worker_thread.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct sample_buf;
+struct sample_buf_pool;
+
+/**
+ * The most sample buffers written in a single system call
+ */
+#define IQ_RECORDER_BATCH               64
+
+/**
+ * Size of the staging buffer used for O_DIRECT writes. A multiple of any sane block size.
+ */
+#define IQ_RECORDER_STAGE_BYTES         (4ul << 20)
+
+/**
+ * Writes complex 16-bit samples to a file from a dedicated thread, so the thread producing the
+ * samples never blocks on I/O. Sample buffers are handed over by reference, queued, and written
+ * in batches. If the disk can't keep up the queue fills, and further buffers are dropped rather
+ * than holding up the producer.
+ *
+ * Each recorder has a single producer.
+ */
+struct iq_recorder {
+    /**
+     * Sample buffers waiting to be written
+     */
+    struct spsc_ring ring CAL_CACHE_ALIGNED;
+
+    /**
+     * The thread doing the writing
+     */
+    struct worker_thread wthr;
+
+    /**
+     * Whether or not wthr was started
+     */
+    bool started;
+
+    /**
+     * The file being written to
+     */
+    int fd;
+
+    /**
+     * Whether the file was opened with O_DIRECT, in which case everything goes through the
+     * staging buffer
+     */
+    bool direct;
+
+    /**
+     * Page aligned staging buffer, for O_DIRECT writes
+     */
+    uint8_t *stage;
+
+    /**
+     * The number of bytes in the staging buffer
+     */
+    size_t nr_staged;
+
+    /**
+     * The most sample buffers the recorder holds on to at once. Beyond this new ones are dropped,
+     * so a slow disk can't starve the producer of buffers.
+     */
+    size_t max_queued;
+
+    /**
+     * Buffers that samples passed to iq_recorder_write are copied into, if the recorder was
+     * created to accept them
+     */
+    struct sample_buf_pool *copy_pool;
+
+    /**
+     * The most bytes that can be passed to iq_recorder_write at once
+     */
+    size_t max_copy_bytes;
+
+    /**
+     * Set once a write has failed, so we only complain once
+     */
+    bool write_failed;
+
+    /**
+     * The number of sample buffers dropped, because the queue was full or the write failed
+     */
+    _Atomic uint64_t nr_dropped;
+
+    /**
+     * The number of bytes written to the file
+     */
+    _Atomic uint64_t nr_bytes;
+};
+
+/**
+ * Create a new recorder, and start its thread.
+ *
+ * \param prec The new recorder, returned by reference
+ * \param path The file to write to. Created if it does not exist, truncated if it does.
+ * \param direct Bypass the page cache with O_DIRECT. Falls back to buffered writes, with a
+ *               warning, if the filesystem does not support it.
+ * \param max_queued The most sample buffers to hold on to at once, waiting to be written. Also the
+ *                   number of buffers set aside for iq_recorder_write.
+ * \param max_copy_bytes The most bytes that will be passed to iq_recorder_write at once, or 0 if
+ *                       only iq_recorder_submit will be used.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t iq_recorder_new(struct iq_recorder **prec, const char *path, bool direct, size_t max_queued,
+        size_t max_copy_bytes);
+
+/**
+ * Queue a sample buffer to be written. The caller must have taken a reference on behalf of the
+ * recorder. If max_queued buffers are already waiting, the buffer is released and dropped.
+ *
+ * \param rec The recorder
+ * \param buf The buffer. Its nr_samples complex 16-bit samples are written.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t iq_recorder_submit(struct iq_recorder *rec, struct sample_buf *buf);
+
+/**
+ * Copy complex 16-bit samples to be written, for samples that don't live in a sample buffer.
+ * Dropped if there is no room for them.
+ *
+ * \param rec The recorder
+ * \param samples The samples
+ * \param nr_bytes The size of the samples, in bytes. At most max_copy_bytes.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t iq_recorder_write(struct iq_recorder *rec, const int16_t *samples, size_t nr_bytes);
+
+/**
+ * Stop the recorder, writing out everything queued, and close the file.
+ *
+ * \param prec The recorder. Passed by reference, set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t iq_recorder_delete(struct iq_recorder **prec);
+
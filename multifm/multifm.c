@@ -39,8 +39,17 @@
 #include <multifm/file_if.h>
 
 #include <multifm/receiver.h>
+#include <multifm/demod_pool.h>
+#include <multifm/stats.h>
+#include <multifm/control.h>
+#include <multifm/demod.h>
+#include <multifm/pcm_decoder.h>
+
+#include <decoder/decoder_output.h>
 
 #include <filter/sample_buf.h>
+#include <filter/sample_trace.h>
+#include <filter/cycle_counter.h>
 
 #include <config/engine.h>
 
@@ -49,10 +58,12 @@
 #include <tsl/assert.h>
 #include <tsl/diag.h>
 #include <tsl/errors.h>
-#include <tsl/frame_alloc.h>
 
+#include <fcntl.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #ifdef HAVE_RTLSDR
 static
@@ -77,98 +88,326 @@ done:
 }
 #endif
 
+/**
+ * Set by SIGUSR1, to ask for the cycle counts to be written out
+ */
+static
+volatile sig_atomic_t _cycles_requested = 0;
+
+static
+void _on_sigusr1(int signum)
+{
+    _cycles_requested = 1;
+}
+
 static
 void _usage(const char *name)
 {
     fprintf(stderr, "usage: %s [Config File 1]{, Config File 2, ...} | %s -h\n", name, name);
+#ifdef HAVE_OPENCL
+    fprintf(stderr, "The OpenCL channelizer (\"accelerator\": \"opencl\" in \"channelizer\") is experimental;\n"
+            "run test_multifm on the device first to check it matches the CPU.\n");
+#endif
 #ifdef HAVE_RTLSDR
     _do_dump_rtl_sdr_devices();
 #endif
 }
 
-int main(int argc, const char *argv[])
+/**
+ * Create the receivers for one device stanza, appending them to rxs.
+ */
+static
+aresult_t _multifm_device_new(struct config *cfg, struct config *device, struct receiver **rxs, size_t max_rxs,
+        size_t *pnr_rxs)
 {
-    int ret = EXIT_FAILURE;
-    struct config *cfg CAL_CLEANUP(config_delete) = NULL;
-    struct config device = CONFIG_INIT_EMPTY;
-    struct receiver *rx_thr = NULL;
-    const char *dev_type = NULL;
+    aresult_t ret = A_OK;
 
-    if (argc < 2) {
-        _usage(argv[0]);
-        goto done;
-    }
-
-    /* Parse and load the configurations from the command line */
-    TSL_BUG_IF_FAILED(config_new(&cfg));
-
-    for (int i = 1; i < argc; i++) {
-        if (FAILED(config_add(cfg, argv[i]))) {
-            MFM_MSG(SEV_FATAL, "MALFORMED-CONFIG", "Configuration file [%s] is malformed.", argv[i]);
-            goto done;
-        }
-        DIAG("Added configuration file '%s'", argv[i]);
-    }
+    const char *dev_type = NULL;
+    size_t nr_new = 0;
 
-    /* Initialize the app framework */
-    TSL_BUG_IF_FAILED(app_init("multifm", cfg));
-    TSL_BUG_IF_FAILED(app_sigint_catch(NULL));
+    TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(NULL != device);
+    TSL_ASSERT_ARG(NULL != rxs);
+    TSL_ASSERT_ARG(NULL != pnr_rxs);
 
-    /* Figure out what kind of device we should initialize */
-    if (FAILED(config_get(cfg, &device, "device"))) {
-        MFM_MSG(SEV_FATAL, "MALFORMED-CONFIG", "Configuration is missing 'device' stanza. Aborting.");
+    if (*pnr_rxs >= max_rxs) {
+        MFM_MSG(SEV_FATAL, "TOO-MANY-RECEIVERS", "At most %zu receivers can be run in one process. Aborting.", max_rxs);
+        ret = A_E_INVAL;
         goto done;
     }
 
-    if (FAILED(config_get_string(&device, &dev_type, "type"))) {
+    if (FAILED(ret = config_get_string(device, &dev_type, "type"))) {
         MFM_MSG(SEV_FATAL, "MALFORMED-CONFIG", "The 'device' stanza is missing a 'type' specification. Aborting.");
         goto done;
     }
 
-    /* Prepare the RTL-SDR thread and demod threads */
+    /* Prepare the device thread and demod threads */
     if (!strncmp(dev_type, "rtlsdr", 6)) {
 #ifdef HAVE_RTLSDR
-        TSL_BUG_IF_FAILED(rtl_sdr_worker_thread_new(&rx_thr, cfg));
+        if (FAILED(ret = rtl_sdr_worker_thread_new(&rxs[*pnr_rxs], cfg, device))) {
+            goto done;
+        }
+        nr_new = 1;
 #else
         MFM_MSG(SEV_FATAL, "RTLSDR-NOT-SUPPORTED", "RTL-SDR devices are not supported by this build.");
+        ret = A_E_INVAL;
         goto done;
 #endif
     } else if (!strncmp(dev_type, "airspy", 6)) {
 #ifdef HAVE_DESPAIRSPY
-        TSL_BUG_IF_FAILED(airspy_worker_thread_new(&rx_thr, cfg));
+        if (FAILED(ret = airspy_worker_thread_new(&rxs[*pnr_rxs], cfg, device))) {
+            goto done;
+        }
+        nr_new = 1;
 #else
         MFM_MSG(SEV_FATAL, "AIRSPY-NOT-SUPPORTED", "Airspy devices are not supported by this build.");
+        ret = A_E_INVAL;
         goto done;
 #endif
     } else if (!strncmp(dev_type, "usrp", 4)) {
 #ifdef HAVE_UHD
-        TSL_BUG_IF_FAILED(uhd_worker_thread_new(&rx_thr, cfg));
+        /* One receiver for each RX chain of the radio */
+        if (FAILED(ret = uhd_worker_thread_new(&rxs[*pnr_rxs], max_rxs - *pnr_rxs, &nr_new, cfg, device))) {
+            goto done;
+        }
 #else
         MFM_MSG(SEV_FATAL, "USRP-NOT-SUPPORTED", "USRP devices are not supported by this build.");
+        ret = A_E_INVAL;
         goto done;
 #endif
     } else if (!strncmp(dev_type, "file", 4)) {
         /* Source samples from a binary file o' samples */
-        TSL_BUG_IF_FAILED(file_worker_thread_new(&rx_thr, cfg));
+        if (FAILED(ret = file_worker_thread_new(&rxs[*pnr_rxs], cfg, device))) {
+            goto done;
+        }
+        nr_new = 1;
     } else {
         MFM_MSG(SEV_FATAL, "UNKNOWN-DEV-TYPE", "Unknown device type: '%s'", dev_type);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    *pnr_rxs += nr_new;
+
+done:
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    int ret = EXIT_FAILURE;
+    struct config *cfg CAL_CLEANUP(config_delete) = NULL;
+    struct config device = CONFIG_INIT_EMPTY,
+                  devices = CONFIG_INIT_EMPTY;
+    struct receiver *rx_thrs[MULTIFM_MAX_RECEIVERS] = { NULL };
+    size_t nr_rx_thrs = 0,
+           dev_ctr = 0;
+    struct stats_server *stats = NULL;
+    struct control_server *control = NULL;
+    struct demod_pool *pool = NULL;
+    const char *stats_sock_path = NULL,
+               *control_sock_path = NULL,
+               *decode_out_path = NULL,
+               *decode_out_format = NULL,
+               *trace_path = NULL;
+    int decode_out_fd = STDOUT_FILENO;
+    enum decoder_output_format decode_format = DECODER_OUTPUT_FORMAT_JSON;
+    struct decoder_output *decode_out = NULL;
+    int stats_log_interval = 0,
+        trace_events = SAMPLE_TRACE_DEFAULT_EVENTS;
+    aresult_t ret_dev = A_OK;
+    struct sigaction sa = { .sa_flags = SA_RESTART };
+
+    if (argc < 2) {
+        _usage(argv[0]);
+        goto done;
+    }
+
+    /* Parse and load the configurations from the command line */
+    TSL_BUG_IF_FAILED(config_new(&cfg));
+
+    for (int i = 1; i < argc; i++) {
+        if (FAILED(config_add(cfg, argv[i]))) {
+            MFM_MSG(SEV_FATAL, "MALFORMED-CONFIG", "Configuration file [%s] is malformed.", argv[i]);
+            goto done;
+        }
+        DIAG("Added configuration file '%s'", argv[i]);
+    }
+
+    /* Initialize the app framework */
+    TSL_BUG_IF_FAILED(app_init("multifm", cfg));
+    TSL_BUG_IF_FAILED(app_sigint_catch(NULL));
+
+    /* Write out the cycle counts on SIGUSR1, if they were built in */
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = _on_sigusr1;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    /* Trace sample buffers through the pipeline, written out when we shut down, if asked to */
+    if (!FAILED(config_get_string(cfg, &trace_path, "traceFile"))) {
+        if (FAILED(config_get_integer(cfg, &trace_events, "traceEventsPerThread")) || 0 >= trace_events) {
+            trace_events = SAMPLE_TRACE_DEFAULT_EVENTS;
+        }
+
+        TSL_BUG_IF_FAILED(sample_trace_enable("multifm", trace_events));
+    }
+
+    /* Messages from channels decoded in-process go to stdout as JSON, unless asked otherwise */
+    if (!FAILED(config_get_string(cfg, &decode_out_path, "decodeOutput"))) {
+        if (0 > (decode_out_fd = open(decode_out_path, O_WRONLY | O_CREAT | O_APPEND, 0666))) {
+            MFM_MSG(SEV_FATAL, "BAD-DECODE-OUTPUT", "Failed to open decoder output file '%s', aborting.",
+                    decode_out_path);
+            goto done;
+        }
+    }
+
+    if (!FAILED(config_get_string(cfg, &decode_out_format, "decodeOutputFormat"))) {
+        if (!strcmp(decode_out_format, "binary")) {
+            decode_format = DECODER_OUTPUT_FORMAT_BINARY;
+        } else if (strcmp(decode_out_format, "json")) {
+            MFM_MSG(SEV_FATAL, "BAD-DECODE-OUTPUT", "Unknown decoder output format '%s', aborting.",
+                    decode_out_format);
+            goto done;
+        }
+    }
+
+    if (FAILED(decoder_output_new(&decode_out, decode_out_fd, decode_format))) {
+        MFM_MSG(SEV_FATAL, "BAD-DECODE-OUTPUT", "Failed to set up decoder output, aborting.");
         goto done;
     }
 
-    TSL_BUG_IF_FAILED(receiver_set_mute(rx_thr, false));
+    pcm_decoder_set_output(decode_out);
+
+    /* Either a single device, or an array of devices, each with its own channels */
+    if (!FAILED(config_get(cfg, &devices, "devices"))) {
+        if (!FAILED(config_get(cfg, &device, "device"))) {
+            MFM_MSG(SEV_FATAL, "MALFORMED-CONFIG", "Specify either a 'device' stanza or a 'devices' array, not both. Aborting.");
+            goto done;
+        }
+
+        CONFIG_ARRAY_FOR_EACH(device, &devices, ret_dev, dev_ctr) {
+            if (FAILED(ret_dev = _multifm_device_new(cfg, &device, rx_thrs, MULTIFM_MAX_RECEIVERS, &nr_rx_thrs))) {
+                MFM_MSG(SEV_FATAL, "BAD-DEVICE", "Failed to set up device %zu. Aborting.", dev_ctr);
+                goto done;
+            }
+        }
+
+        if (0 == nr_rx_thrs) {
+            MFM_MSG(SEV_FATAL, "MALFORMED-CONFIG", "The 'devices' array is empty. Aborting.");
+            goto done;
+        }
+    } else if (!FAILED(config_get(cfg, &device, "device"))) {
+        if (FAILED(_multifm_device_new(cfg, &device, rx_thrs, MULTIFM_MAX_RECEIVERS, &nr_rx_thrs))) {
+            goto done;
+        }
+    } else {
+        MFM_MSG(SEV_FATAL, "MALFORMED-CONFIG", "Configuration is missing 'device' stanza. Aborting.");
+        goto done;
+    }
+
+    /* One pool of demodulator workers services the channels of every receiver */
+    if (FAILED(receiver_demod_pool_new(&pool, rx_thrs, nr_rx_thrs, cfg))) {
+        goto done;
+    }
+
+    if (NULL != pool) {
+        TSL_BUG_IF_FAILED(demod_pool_start(pool));
+    }
 
     MFM_MSG(SEV_INFO, "CAPTURING", "Starting capture and demodulation process.");
-    TSL_BUG_IF_FAILED(receiver_start(rx_thr));
+
+    for (size_t i = 0; i < nr_rx_thrs; i++) {
+        TSL_BUG_IF_FAILED(receiver_set_mute(rx_thrs[i], false));
+        TSL_BUG_IF_FAILED(receiver_start(rx_thrs[i]));
+    }
+
+    /* Export runtime counters, if asked to */
+    if (FAILED(config_get_string(cfg, &stats_sock_path, "statsSocket"))) {
+        stats_sock_path = NULL;
+    }
+
+    if (FAILED(config_get_integer(cfg, &stats_log_interval, "statsLogIntervalSecs")) || 0 > stats_log_interval) {
+        stats_log_interval = 0;
+    }
+
+    if (NULL != stats_sock_path || 0 != stats_log_interval) {
+        if (FAILED(stats_server_new(&stats, rx_thrs, nr_rx_thrs, stats_sock_path, stats_log_interval))) {
+            MFM_MSG(SEV_FATAL, "STATS-FAILED", "Unable to start the stats server, aborting.");
+            goto done;
+        }
+    }
+
+    /* Accept channel changes while running, if asked to */
+    if (!FAILED(config_get_string(cfg, &control_sock_path, "controlSocket"))) {
+        if (FAILED(control_server_new(&control, rx_thrs, nr_rx_thrs, control_sock_path))) {
+            MFM_MSG(SEV_FATAL, "CONTROL-FAILED", "Unable to start the control server, aborting.");
+            goto done;
+        }
+    }
 
     while (app_running()) {
+        bool setup_failed = false;
+
         sleep(1);
+
+        /* A channel that failed in the background is still a bad configuration */
+        for (size_t i = 0; i < nr_rx_thrs; i++) {
+            if (FAILED(receiver_setup_status(rx_thrs[i]))) {
+                setup_failed = true;
+            }
+        }
+
+        if (true == setup_failed) {
+            MFM_MSG(SEV_FATAL, "CHANNEL-SETUP-FAILED", "A channel could not be set up, aborting.");
+            goto done;
+        }
+
+        if (0 != _cycles_requested) {
+            _cycles_requested = 0;
+            cycle_counter_dump(stderr);
+        }
     }
 
     DIAG("Terminating.");
 
     ret = EXIT_SUCCESS;
 done:
-    receiver_cleanup(&rx_thr);
+    /* No more channel changes once we start tearing things down */
+    if (NULL != control) {
+        control_server_delete(&control);
+    }
+
+    if (NULL != stats) {
+        stats_server_delete(&stats);
+    }
+
+    if (NULL != pool) {
+        receiver_demod_pool_delete(&pool, rx_thrs, nr_rx_thrs);
+    }
+
+    /* In reverse, since later receivers may share sample buffers with earlier ones */
+    for (size_t i = nr_rx_thrs; i > 0; i--) {
+        receiver_cleanup(&rx_thrs[i - 1]);
+    }
+
+    demod_coeff_cache_flush();
+
+    cycle_counter_dump(stderr);
+
+    /* Every thread that records events is gone by now */
+    if (NULL != trace_path && FAILED(sample_trace_dump(trace_path))) {
+        MFM_MSG(SEV_WARNING, "TRACE-FAILED", "Failed to write the sample trace to '%s'.", trace_path);
+    }
+
+    if (NULL != decode_out) {
+        pcm_decoder_set_output(NULL);
+        decoder_output_delete(&decode_out);
+    }
+
+    if (STDOUT_FILENO != decode_out_fd && 0 <= decode_out_fd) {
+        close(decode_out_fd);
+    }
+
     return ret;
 }
 
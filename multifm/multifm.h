@@ -3,3 +3,8 @@
 #include <tsl/diag.h>
 
 #define MFM_MSG(sev, sys, msg, ...) MESSAGE("MULTIFM", sev, sys, msg, ##__VA_ARGS__)
+
+/**
+ * The most receivers a single multifm process can run
+ */
+#define MULTIFM_MAX_RECEIVERS       8
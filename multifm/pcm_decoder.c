@@ -0,0 +1,538 @@
+/*
+ *  pcm_decoder.c - Protocol decoders run directly on demodulator output
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/pcm_decoder.h>
+#include <multifm/multifm.h>
+
+#include <decoder/decoder_output.h>
+
+#include <pager/pager_flex.h>
+#include <pager/pager_pocsag.h>
+
+#include <ais/ais_decode.h>
+
+#include <filter/filter.h>
+#include <filter/polyphase_fir.h>
+#include <filter/sample_ring.h>
+
+#include <config/engine.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/**
+ * Where decoded messages are written
+ */
+static
+struct decoder_output *_pcm_decoder_out = NULL;
+
+/**
+ * Every decoder, so a protocol callback can find the channel it was called for. Decoders come and
+ * go as channels are added and removed at runtime, so the list is protected by a lock.
+ */
+static
+struct list_entry _pcm_decoders = { .next = &_pcm_decoders, .prev = &_pcm_decoders };
+
+static
+pthread_mutex_t _pcm_decoders_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void pcm_decoder_set_output(struct decoder_output *out)
+{
+    _pcm_decoder_out = out;
+}
+
+/**
+ * Queue a message to be written. Messages decoded before an output is set are dropped.
+ */
+static
+aresult_t _pcm_decoder_put(const struct decoder_msg *msg)
+{
+    if (NULL == _pcm_decoder_out) {
+        return A_OK;
+    }
+
+    return decoder_output_put(_pcm_decoder_out, msg);
+}
+
+/**
+ * Start a message decoded by the given protocol state, filling in the details every message
+ * carries
+ */
+static
+void _pcm_decoder_msg_init(const void *proto, enum decoder_msg_type type, struct decoder_msg *msg)
+{
+    struct pcm_decoder *dec = NULL;
+
+    memset(msg, 0, sizeof(*msg));
+
+    msg->type = type;
+    msg->timestamp = time(NULL);
+
+    pthread_mutex_lock(&_pcm_decoders_lock);
+
+    list_for_each_type(dec, &_pcm_decoders, node) {
+        if ((const void *)dec->flex == proto || (const void *)dec->pocsag == proto ||
+                (const void *)dec->ais_decode == proto)
+        {
+            msg->freq_hz = dec->freq_hz;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&_pcm_decoders_lock);
+}
+
+static
+aresult_t _pcm_decoder_on_flex_alnum_msg(struct pager_flex *f, uint16_t baud, uint8_t phase, uint8_t cycle_no,
+        uint8_t frame_no, uint64_t cap_code, bool fragmented, bool maildrop, uint8_t seq_num,
+        const char *message_bytes, size_t message_len)
+{
+    struct decoder_msg msg;
+
+    _pcm_decoder_msg_init(f, DECODER_MSG_FLEX_ALNUM, &msg);
+    msg.baud = baud;
+    msg.phase = phase;
+    msg.cycle_no = cycle_no;
+    msg.frame_no = frame_no;
+    msg.address = cap_code;
+    msg.fragmented = fragmented;
+    msg.maildrop = maildrop;
+    msg.seq_num = seq_num;
+    msg.body = message_bytes;
+    msg.body_len = message_len;
+
+    return _pcm_decoder_put(&msg);
+}
+
+static
+aresult_t _pcm_decoder_on_flex_num_msg(struct pager_flex *f, uint16_t baud, uint8_t phase, uint8_t cycle_no,
+        uint8_t frame_no, uint64_t cap_code, const char *message_bytes, size_t message_len)
+{
+    struct decoder_msg msg;
+
+    _pcm_decoder_msg_init(f, DECODER_MSG_FLEX_NUM, &msg);
+    msg.baud = baud;
+    msg.phase = phase;
+    msg.cycle_no = cycle_no;
+    msg.frame_no = frame_no;
+    msg.address = cap_code;
+    msg.body = message_bytes;
+    msg.body_len = message_len;
+
+    return _pcm_decoder_put(&msg);
+}
+
+static
+aresult_t _pcm_decoder_on_flex_siv_msg(struct pager_flex *f, uint16_t baud, uint8_t phase, uint8_t cycle_no,
+        uint8_t frame_no, uint64_t cap_code, uint8_t siv_msg_type, uint32_t data)
+{
+    struct decoder_msg msg;
+
+    /* Only temporary address activations are reported */
+    if (PAGER_FLEX_SIV_TEMP_ADDRESS_ACTIVATION != siv_msg_type) {
+        return A_OK;
+    }
+
+    _pcm_decoder_msg_init(f, DECODER_MSG_FLEX_TEMP_ADDR_ACTIVATION, &msg);
+    msg.baud = baud;
+    msg.phase = phase;
+    msg.cycle_no = cycle_no;
+    msg.frame_no = frame_no;
+    msg.address = cap_code;
+    msg.siv_data = data;
+
+    return _pcm_decoder_put(&msg);
+}
+
+static
+aresult_t _pcm_decoder_on_pocsag_alnum_msg(struct pager_pocsag *p, uint16_t baud_rate, uint32_t capcode,
+        const char *data, size_t data_len, uint8_t function)
+{
+    struct decoder_msg msg;
+
+    _pcm_decoder_msg_init(p, DECODER_MSG_POCSAG_ALNUM, &msg);
+    msg.baud = baud_rate;
+    msg.address = capcode;
+    msg.function = function;
+    msg.body = data;
+    msg.body_len = data_len;
+
+    return _pcm_decoder_put(&msg);
+}
+
+static
+aresult_t _pcm_decoder_on_pocsag_num_msg(struct pager_pocsag *p, uint16_t baud_rate, uint32_t capcode,
+        const char *data, size_t data_len, uint8_t function)
+{
+    struct decoder_msg msg;
+
+    _pcm_decoder_msg_init(p, DECODER_MSG_POCSAG_NUM, &msg);
+    msg.baud = baud_rate;
+    msg.address = capcode;
+    msg.function = function;
+    msg.body = data;
+    msg.body_len = data_len;
+
+    return _pcm_decoder_put(&msg);
+}
+
+static
+aresult_t _pcm_decoder_on_ais_position_report(struct ais_decode *decode, void *state,
+        struct ais_position_report *pr, const char *raw_msg)
+{
+    struct decoder_msg msg;
+
+    _pcm_decoder_msg_init(decode, DECODER_MSG_AIS_POSITION_REPORT, &msg);
+    msg.address = pr->mmsi;
+    msg.ais = pr;
+    msg.body = raw_msg;
+    msg.body_len = strlen(raw_msg);
+
+    return _pcm_decoder_put(&msg);
+}
+
+static
+aresult_t _pcm_decoder_on_ais_base_station_report(struct ais_decode *decode, void *state,
+        struct ais_base_station_report *br, const char *raw_msg)
+{
+    struct decoder_msg msg;
+
+    _pcm_decoder_msg_init(decode, DECODER_MSG_AIS_BASE_STATION_REPORT, &msg);
+    msg.address = br->mmsi;
+    msg.ais = br;
+    msg.body = raw_msg;
+    msg.body_len = strlen(raw_msg);
+
+    return _pcm_decoder_put(&msg);
+}
+
+static
+aresult_t _pcm_decoder_on_ais_static_voyage_data(struct ais_decode *decode, void *state,
+        struct ais_static_voyage_data *svd, const char *raw_msg)
+{
+    struct decoder_msg msg;
+
+    _pcm_decoder_msg_init(decode, DECODER_MSG_AIS_STATIC_VOYAGE_DATA, &msg);
+    msg.address = svd->mmsi;
+    msg.ais = svd;
+    msg.body = raw_msg;
+    msg.body_len = strlen(raw_msg);
+
+    return _pcm_decoder_put(&msg);
+}
+
+/**
+ * Create the resampler for a decoder, from the Q.15 conversion of the taps in the decode stanza
+ */
+static
+aresult_t _pcm_decoder_resampler_new(struct pcm_decoder *dec, struct config *cfg, size_t max_batch)
+{
+    aresult_t ret = A_OK;
+
+    struct config *filter_cfg CAL_CLEANUP(config_delete) = NULL;
+    struct config *taps_cfg = cfg;
+    const char *filter_file = NULL;
+    double *taps_f = NULL;
+    int16_t *taps = NULL;
+    size_t nr_taps = 0;
+    int interpolate = 1,
+        decimate = 1;
+
+    if (!FAILED(config_get_integer(cfg, &interpolate, "interpolate")) && 0 >= interpolate) {
+        MFM_MSG(SEV_ERROR, "BAD-INTERPOLATION", "Interpolation factor must be a positive integer.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (!FAILED(config_get_integer(cfg, &decimate, "decimate")) && 0 >= decimate) {
+        MFM_MSG(SEV_ERROR, "BAD-DECIMATION", "Decimation factor must be a positive integer.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* The taps can be given inline, or in a filter file like the one the decoder takes */
+    if (!FAILED(config_get_string(cfg, &filter_file, "filterFile"))) {
+        TSL_BUG_IF_FAILED(config_new(&filter_cfg));
+
+        if (FAILED(ret = config_add(filter_cfg, filter_file))) {
+            MFM_MSG(SEV_ERROR, "BAD-DECODE-FILTER", "Filter file '%s' cannot be processed.", filter_file);
+            goto done;
+        }
+
+        taps_cfg = filter_cfg;
+    }
+
+    if (FAILED(ret = config_get_float_array(taps_cfg, &taps_f, &nr_taps, "lpfCoeffs"))) {
+        MFM_MSG(SEV_ERROR, "MISSING-DECODE-LPF", "Decoders need resampling filter coefficients ('lpfCoeffs').");
+        goto done;
+    }
+
+    /* The ring has to hold the resampler's history, and a whole batch from the demodulator */
+    if (nr_taps + max_batch > PCM_DECODER_RING_SAMPLES) {
+        MFM_MSG(SEV_ERROR, "DECODE-LPF-TOO-LONG", "Resampling filter is too long (%zu taps).", nr_taps);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&taps, nr_taps, sizeof(int16_t)))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_taps; i++) {
+        taps[i] = (int16_t)(taps_f[i] * (double)(1 << Q_15_SHIFT));
+    }
+
+    if (FAILED(ret = polyphase_fir_new(&dec->pfir, nr_taps, taps, interpolate, decimate))) {
+        goto done;
+    }
+
+    DIAG("Decoder resampling %d/%d with %zu taps", interpolate, decimate, nr_taps);
+
+done:
+    if (NULL != taps) {
+        TFREE(taps);
+    }
+
+    if (NULL != taps_f) {
+        TFREE(taps_f);
+    }
+
+    return ret;
+}
+
+aresult_t pcm_decoder_new(struct pcm_decoder **pdec, struct config *cfg, unsigned freq_hz, size_t max_batch)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_decoder *dec = NULL;
+    const char *protocol = NULL;
+    double dc_block_pole = 0.9999,
+           gain = 1.0;
+    bool invert = false,
+         dc_block = false;
+
+    TSL_ASSERT_ARG(NULL != pdec);
+    TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(0 != max_batch);
+
+    *pdec = NULL;
+
+    if (FAILED(ret = TZAALLOC(dec, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    list_init(&dec->node);
+    dec->freq_hz = freq_hz;
+    dec->max_batch = max_batch;
+
+    if (FAILED(ret = config_get_string(cfg, &protocol, "protocol"))) {
+        MFM_MSG(SEV_ERROR, "MISSING-PROTOCOL", "Decoder for channel at %u Hz needs a protocol.", freq_hz);
+        goto done;
+    }
+
+    if (!strcasecmp(protocol, "flex")) {
+        dec->proto = PCM_DECODER_PROTO_FLEX;
+    } else if (!strcasecmp(protocol, "pocsag")) {
+        dec->proto = PCM_DECODER_PROTO_POCSAG;
+    } else if (!strcasecmp(protocol, "ais")) {
+        dec->proto = PCM_DECODER_PROTO_AIS;
+    } else {
+        MFM_MSG(SEV_ERROR, "UNKNOWN-PROTOCOL-TYPE", "Unknown protocol '%s', must be one of 'flex', 'pocsag' "
+                "or 'ais'.", protocol);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(config_get_boolean(cfg, &invert, "invert"))) {
+        invert = false;
+    }
+
+    if (FAILED(config_get_boolean(cfg, &dc_block, "dcBlock"))) {
+        dc_block = false;
+    }
+
+    config_get_float(cfg, &dc_block_pole, "dcBlockPole");
+    config_get_float(cfg, &gain, "gain");
+
+    if (!(gain > 0.0 && gain < POST_FILTER_GAIN_MAX)) {
+        MFM_MSG(SEV_ERROR, "BAD-GAIN", "Decoder gain must be greater than 0 and less than %f.", POST_FILTER_GAIN_MAX);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = post_filter_init(&dec->post, invert, gain, dc_block, dc_block_pole))) {
+        goto done;
+    }
+
+    if (FAILED(ret = _pcm_decoder_resampler_new(dec, cfg, max_batch))) {
+        goto done;
+    }
+
+    if (FAILED(ret = sample_ring_new(&dec->ring, PCM_DECODER_RING_SAMPLES, sizeof(int16_t)))) {
+        goto done;
+    }
+
+    switch (dec->proto) {
+    case PCM_DECODER_PROTO_FLEX:
+        ret = pager_flex_new(&dec->flex, freq_hz, _pcm_decoder_on_flex_alnum_msg, _pcm_decoder_on_flex_num_msg,
+                _pcm_decoder_on_flex_siv_msg);
+        break;
+    case PCM_DECODER_PROTO_POCSAG:
+        ret = pager_pocsag_new(&dec->pocsag, freq_hz, _pcm_decoder_on_pocsag_num_msg,
+                _pcm_decoder_on_pocsag_alnum_msg, false);
+        break;
+    case PCM_DECODER_PROTO_AIS:
+        ret = ais_decode_new(&dec->ais_decode, freq_hz, _pcm_decoder_on_ais_position_report,
+                _pcm_decoder_on_ais_base_station_report, _pcm_decoder_on_ais_static_voyage_data);
+        break;
+    }
+
+    if (FAILED(ret)) {
+        goto done;
+    }
+
+    pthread_mutex_lock(&_pcm_decoders_lock);
+    list_append(&_pcm_decoders, &dec->node);
+    pthread_mutex_unlock(&_pcm_decoders_lock);
+
+    MFM_MSG(SEV_INFO, "DECODER", "Decoding %s on %u Hz in-process", protocol, freq_hz);
+
+    *pdec = dec;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != dec) {
+            TSL_BUG_IF_FAILED(pcm_decoder_delete(&dec));
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pcm_decoder_delete(struct pcm_decoder **pdec)
+{
+    aresult_t ret = A_OK;
+
+    struct pcm_decoder *dec = NULL;
+
+    TSL_ASSERT_ARG(NULL != pdec);
+    TSL_ASSERT_ARG(NULL != *pdec);
+
+    dec = *pdec;
+
+    pthread_mutex_lock(&_pcm_decoders_lock);
+    list_del(&dec->node);
+    pthread_mutex_unlock(&_pcm_decoders_lock);
+
+    if (NULL != dec->flex) {
+        pager_flex_delete(&dec->flex);
+    }
+
+    if (NULL != dec->pocsag) {
+        pager_pocsag_delete(&dec->pocsag);
+    }
+
+    if (NULL != dec->ais_decode) {
+        ais_decode_delete(&dec->ais_decode);
+    }
+
+    if (NULL != dec->pfir) {
+        TSL_BUG_IF_FAILED(polyphase_fir_delete(&dec->pfir));
+    }
+
+    if (NULL != dec->ring) {
+        TSL_BUG_IF_FAILED(sample_ring_delete(&dec->ring));
+    }
+
+    TFREE(dec);
+
+    *pdec = NULL;
+
+    return ret;
+}
+
+aresult_t pcm_decoder_write_ptr(struct pcm_decoder *dec, int16_t **pptr)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_free = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != dec);
+    TSL_ASSERT_ARG_DEBUG(NULL != pptr);
+
+    TSL_BUG_IF_FAILED(sample_ring_write_ptr(dec->ring, (void **)pptr, &nr_free));
+
+    /* Every batch is decoded as soon as it's written, so only the resampler's history is left */
+    TSL_BUG_ON(nr_free < dec->max_batch);
+
+    return ret;
+}
+
+aresult_t pcm_decoder_produce(struct pcm_decoder *dec, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != dec);
+
+    if (0 == nr_samples) {
+        goto done;
+    }
+
+    TSL_BUG_IF_FAILED(sample_ring_produce(dec->ring, nr_samples));
+
+    /* Resample and decode everything we can. What's left is the resampler's history. */
+    do {
+        size_t nr_out = 0;
+
+        TSL_BUG_IF_FAILED(polyphase_fir_process_ring(dec->pfir, dec->ring, dec->out_buf, PCM_DECODER_OUT_LEN,
+                    &nr_out));
+
+        if (0 == nr_out) {
+            break;
+        }
+
+        /* Inversion, gain and DC blocking, in one pass over the resampled block */
+        TSL_BUG_IF_FAILED(post_filter_apply(&dec->post, dec->out_buf, nr_out));
+
+        switch (dec->proto) {
+        case PCM_DECODER_PROTO_FLEX:
+            TSL_BUG_IF_FAILED(pager_flex_on_pcm(dec->flex, dec->out_buf, nr_out));
+            break;
+        case PCM_DECODER_PROTO_POCSAG:
+            TSL_BUG_IF_FAILED(pager_pocsag_on_pcm(dec->pocsag, dec->out_buf, nr_out));
+            break;
+        case PCM_DECODER_PROTO_AIS:
+            TSL_BUG_IF_FAILED(ais_decode_on_pcm(dec->ais_decode, dec->out_buf, nr_out));
+            break;
+        }
+    } while (true);
+
+done:
+    return ret;
+}
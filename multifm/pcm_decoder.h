@@ -0,0 +1,145 @@
+#pragma once
+
+#include <filter/post_filter.h>
+
+#include <tsl/list.h>
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct config;
+struct polyphase_fir;
+struct sample_ring;
+struct pager_flex;
+struct pager_pocsag;
+struct ais_decode;
+struct decoder_output;
+
+/**
+ * Capacity of the ring between a demodulator and its protocol decoder, in samples. Has to hold
+ * a batch of demodulator output on top of the resampler's history.
+ */
+#define PCM_DECODER_RING_SAMPLES    (1ul << 15)
+
+/**
+ * The most resampled samples decoded at once
+ */
+#define PCM_DECODER_OUT_LEN         1024
+
+/**
+ * The protocols a channel can be decoded as
+ */
+enum pcm_decoder_proto {
+    PCM_DECODER_PROTO_FLEX = 0,
+    PCM_DECODER_PROTO_POCSAG = 1,
+    PCM_DECODER_PROTO_AIS = 2,
+};
+
+/**
+ * A protocol decoder run directly on a demodulator's PCM output, in the demodulator's own
+ * thread, instead of in a separate decoder process fed through a FIFO. The demodulator writes
+ * its output straight into the resampler's input ring, so the samples are never copied.
+ */
+struct pcm_decoder {
+    /**
+     * The protocol being decoded
+     */
+    enum pcm_decoder_proto proto;
+
+    /**
+     * The frequency of the channel, in Hz. Reported with every message.
+     */
+    unsigned freq_hz;
+
+    /**
+     * PCM samples from the demodulator, waiting to be resampled
+     */
+    struct sample_ring *ring;
+
+    /**
+     * The most samples the demodulator writes to the ring at once
+     */
+    size_t max_batch;
+
+    /**
+     * Resamples the PCM to the rate the protocol decoder expects
+     */
+    struct polyphase_fir *pfir;
+
+    /**
+     * Inverts (for sources that don't preserve the sense of the signal), scales and removes DC
+     * from the resampled samples, as asked
+     */
+    struct post_filter post;
+
+    struct pager_flex *flex;
+    struct pager_pocsag *pocsag;
+    struct ais_decode *ais_decode;
+
+    /**
+     * Node in the list of all decoders, used to find a decoder from its protocol state
+     */
+    struct list_entry node;
+
+    /**
+     * Resampled samples, waiting to be decoded
+     */
+    int16_t out_buf[PCM_DECODER_OUT_LEN];
+};
+
+/**
+ * Create a decoder from a channel's "decode" stanza:
+ *
+ *   "decode": { "protocol": "flex", "interpolate": 1, "decimate": 1, "lpfCoeffs": [ ... ],
+ *               "dcBlock": false, "dcBlockPole": 0.9999, "invert": false, "gain": 1.0 }
+ *
+ * The resampling filter can instead be read from a file, holding an "lpfCoeffs" array, named
+ * by "filterFile".
+ *
+ * \param pdec The new decoder, returned by reference
+ * \param cfg The decode stanza
+ * \param freq_hz The frequency of the channel, in Hz
+ * \param max_batch The most PCM samples the demodulator will ever write at once
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pcm_decoder_new(struct pcm_decoder **pdec, struct config *cfg, unsigned freq_hz, size_t max_batch);
+
+/**
+ * Destroy a decoder.
+ *
+ * \param pdec The decoder, passed by reference. Set to NULL.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pcm_decoder_delete(struct pcm_decoder **pdec);
+
+/**
+ * Get the space the demodulator should write its next batch of PCM samples to. There is always
+ * room for max_batch samples.
+ *
+ * \param dec The decoder
+ * \param pptr The space to write to, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pcm_decoder_write_ptr(struct pcm_decoder *dec, int16_t **pptr);
+
+/**
+ * Decode the samples written at the pointer returned by pcm_decoder_write_ptr. Messages are
+ * written out as they are decoded.
+ *
+ * \param dec The decoder
+ * \param nr_samples The number of samples written
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pcm_decoder_produce(struct pcm_decoder *dec, size_t nr_samples);
+
+/**
+ * Set where every decoder writes its messages. Until an output is set, decoded messages are
+ * dropped.
+ */
+void pcm_decoder_set_output(struct decoder_output *out);
@@ -1,8 +1,19 @@
 #include <multifm/receiver.h>
 #include <multifm/demod.h>
+#include <multifm/channelizer.h>
+#include <multifm/demod_pool.h>
+#include <multifm/demod_base.h>
+#include <multifm/fm_demod.h>
+#include <multifm/costas_demod.h>
+#include <multifm/sample_buf_pool.h>
+#include <multifm/iq_recorder.h>
+#include <multifm/pcm_decoder.h>
 #include <multifm/multifm.h>
 
 #include <filter/sample_buf.h>
+#include <filter/sample_trace.h>
+#include <filter/multistage_fir.h>
+#include <filter/pcm_udp.h>
 
 #include <config/engine.h>
 
@@ -11,302 +22,1673 @@
 #include <tsl/assert.h>
 #include <tsl/list.h>
 #include <tsl/worker_thread.h>
-#include <tsl/frame_alloc.h>
 
+#include <pthread.h>
 #include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 /**
- * Free a live sample buffer.
+ * Allocate a sample buffer
+ */
+aresult_t receiver_sample_buf_alloc(struct receiver *rx, struct sample_buf **pbuf)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *sbuf = NULL;
+
+    TSL_ASSERT_ARG(NULL != rx);
+    TSL_ASSERT_ARG(NULL != pbuf);
+
+    *pbuf = NULL;
+
+    /* Allocate an output buffer */
+    if (FAILED(ret = sample_buf_pool_alloc(rx->samp_alloc, &sbuf))) {
+        if (0 == rx->nr_samp_buf_alloc_fails) {
+            MFM_MSG(SEV_INFO, "NO-SAMPLE-BUFFER", "There are no available sample buffers, dropping received samples.");
+        }
+        rx->nr_samp_buf_alloc_fails++;
+        goto done;
+    }
+
+    *pbuf = sbuf;
+
+done:
+    return ret;
+}
+
+/**
+ * Deliver a sample buffer to any waiting consumers
+ */
+aresult_t receiver_sample_buf_deliver(struct receiver *rx, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    struct demod_thread *dthr = NULL;
+    uint64_t deliver_ns = sample_trace_now_ns();
+
+    TSL_BUG_ON(0 == buf->nr_samples);
+
+    buf->seq = ++rx->last_seq;
+    buf->deliver_ns = deliver_ns;
+    sample_trace_record(SAMPLE_TRACE_CAPTURE, buf->seq, buf->start_time_ns, deliver_ns);
+
+    /* The recorder holds its own reference, taken before anyone else can let go of the buffer */
+    const uint32_t nr_recorder_refs = NULL != rx->recorder ? 1 : 0;
+
+    /* The channelizer is the only consumer of full-rate samples, if we have one */
+    if (NULL != rx->chan) {
+        atomic_store(&buf->refcount, 1 + nr_recorder_refs);
+        TSL_BUG_IF_FAILED(channelizer_deliver(rx->chan, buf));
+        goto done;
+    }
+
+    /* Channels can come and go at runtime, see receiver_channel_add */
+    pthread_mutex_lock(&rx->demod_lock);
+
+    if (0 == rx->nr_demod_threads + nr_recorder_refs) {
+        /* Every channel has been removed, no one wants these samples */
+        atomic_store(&buf->refcount, 1);
+        TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+    } else {
+        atomic_store(&buf->refcount, rx->nr_demod_threads + nr_recorder_refs);
+
+        /* Make it available to each demodulator/processing thread */
+        demod_shed_begin(&rx->shed);
+        list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+            TSL_BUG_IF_FAILED(demod_thread_deliver(dthr, buf, &rx->shed));
+        }
+        demod_shed_end(&rx->shed);
+    }
+
+    pthread_mutex_unlock(&rx->demod_lock);
+
+done:
+    sample_trace_record(SAMPLE_TRACE_DELIVER, rx->last_seq, deliver_ns, sample_trace_now_ns());
+
+    /* Recording comes last, the demodulators are what's latency sensitive */
+    if (NULL != rx->recorder) {
+        TSL_BUG_IF_FAILED(iq_recorder_submit(rx->recorder, buf));
+    }
+
+    return ret;
+}
+
+void receiver_sample_buf_stamp(struct receiver *rx, struct sample_buf *buf, size_t nr_raw_samples)
+{
+    uint64_t now_ns = sample_buf_now_ns(),
+             span_ns = 0;
+
+    TSL_BUG_ON(NULL == rx);
+    TSL_BUG_ON(NULL == buf);
+
+    /* The device has just handed over the last of these samples, so the first is older */
+    if (0 != rx->sample_rate_hz) {
+        span_ns = (uint64_t)nr_raw_samples * 1000000000ull / rx->sample_rate_hz;
+    }
+
+    buf->start_time_ns = now_ns > span_ns ? now_ns - span_ns : now_ns;
+}
+
+bool receiver_can_deliver(struct receiver *rx)
+{
+    struct demod_thread *dthr = NULL;
+    bool can_deliver = true;
+
+    TSL_BUG_ON(NULL == rx);
+
+    if (NULL != rx->chan) {
+        return spsc_ring_depth(&rx->chan->ring) <= rx->chan->ring.mask;
+    }
+
+    pthread_mutex_lock(&rx->demod_lock);
+
+    list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+        if (spsc_ring_depth(&dthr->ring) > dthr->ring.mask) {
+            can_deliver = false;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&rx->demod_lock);
+
+    return can_deliver;
+}
+
+/**
+ * Create the demodulator for a channel, as described by its "demod" key. Defaults to FM.
+ *
+ * \param channel The channel configuration
+ * \param nb_center_freq The center frequency of the channel, for diagnostics
+ * \param out_sample_rate The sample rate of the filtered samples handed to the demodulator
+ * \param pdemod The new demodulator, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+static
+aresult_t _receiver_demod_new(struct config *channel, int nb_center_freq, unsigned out_sample_rate,
+        struct demod_base **pdemod)
+{
+    aresult_t ret = A_OK;
+
+    const char *demod_name = "fm";
+
+    TSL_ASSERT_ARG(NULL != channel);
+    TSL_ASSERT_ARG(NULL != pdemod);
+    TSL_ASSERT_ARG(0 != out_sample_rate);
+
+    *pdemod = NULL;
+
+    if (FAILED(config_get_string(channel, &demod_name, "demod"))) {
+        demod_name = "fm";
+    }
+
+    if (!strcmp(demod_name, "fm")) {
+        const char *fm_disc_name = NULL;
+        enum multifm_fm_discriminator fm_disc = MULTIFM_FM_DISCRIMINATOR_ATAN2;
+
+        if (!FAILED(config_get_string(channel, &fm_disc_name, "fmDiscriminator"))) {
+            if (!strcmp(fm_disc_name, "atan2")) {
+                fm_disc = MULTIFM_FM_DISCRIMINATOR_ATAN2;
+            } else if (!strcmp(fm_disc_name, "differentiate")) {
+                fm_disc = MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE;
+            } else {
+                MFM_MSG(SEV_ERROR, "BAD-FM-DISCRIMINATOR", "Unknown FM discriminator '%s', must be one of "
+                        "'atan2' or 'differentiate'.", fm_disc_name);
+                ret = A_E_INVAL;
+                goto done;
+            }
+        }
+
+        ret = multifm_fm_demod_init(pdemod, fm_disc);
+    } else if (!strcmp(demod_name, "costas")) {
+        double f_shift_hz = 0.0,
+               alpha = 0.1,
+               beta = 0.0025;
+        int e_max = 1 << 14;
+
+        /* Each of these is optional, but one that's there has to be readable */
+        if ((FAILED(ret = config_get_float(channel, &f_shift_hz, "costasFreqShiftHz")) && A_E_NOTFOUND != ret) ||
+                (FAILED(ret = config_get_float(channel, &alpha, "costasAlpha")) && A_E_NOTFOUND != ret) ||
+                (FAILED(ret = config_get_float(channel, &beta, "costasBeta")) && A_E_NOTFOUND != ret))
+        {
+            MFM_MSG(SEV_ERROR, "BAD-COSTAS-CONFIG", "costasFreqShiftHz, costasAlpha and costasBeta must be numbers "
+                    "(channel at frequency %d).", nb_center_freq);
+            goto done;
+        }
+
+        if (FAILED(ret = config_get_integer(channel, &e_max, "costasErrorMax")) && A_E_NOTFOUND != ret) {
+            MFM_MSG(SEV_ERROR, "BAD-COSTAS-CONFIG", "costasErrorMax must be an integer (channel at frequency %d).",
+                    nb_center_freq);
+            goto done;
+        }
+
+        ret = A_OK;
+
+        if (0 >= e_max || INT16_MAX < e_max) {
+            MFM_MSG(SEV_ERROR, "BAD-COSTAS-ERROR-MAX", "Costas loop error limit '%d' must be in (0, %d].",
+                    e_max, INT16_MAX);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        DIAG("Costas demodulator: shift %f Hz, alpha %f beta %f, error limit %d", f_shift_hz, alpha, beta, e_max);
+
+        ret = multifm_costas_demod_init(pdemod, f_shift_hz / (double)out_sample_rate, alpha, beta, e_max);
+    } else {
+        MFM_MSG(SEV_ERROR, "BAD-DEMOD", "Unknown demodulator '%s' for channel at frequency %d, must be one "
+                "of 'fm' or 'costas'.", demod_name, nb_center_freq);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+done:
+    return ret;
+}
+
+aresult_t receiver_config_get_integer(struct config *local_cfg, struct config *cfg, int *pval, const char *key)
+{
+    if (NULL != local_cfg && !FAILED(config_get_integer(local_cfg, pval, key))) {
+        return A_OK;
+    }
+
+    return config_get_integer(cfg, pval, key);
+}
+
+/**
+ * Look up receiver parameters, preferring the receiver's own configuration over the
+ * process-wide configuration.
+ */
+static
+aresult_t _receiver_cfg_get_integer(struct receiver *rx, struct config *cfg, int *pval, const char *key)
+{
+    return receiver_config_get_integer(rx->local_cfg, cfg, pval, key);
+}
+
+static
+aresult_t _receiver_cfg_get_boolean(struct receiver *rx, struct config *cfg, bool *pval, const char *key)
+{
+    if (NULL != rx->local_cfg && !FAILED(config_get_boolean(rx->local_cfg, pval, key))) {
+        return A_OK;
+    }
+
+    return config_get_boolean(cfg, pval, key);
+}
+
+static
+aresult_t _receiver_cfg_get_string(struct receiver *rx, struct config *cfg, const char **pval, const char *key)
+{
+    if (NULL != rx->local_cfg && !FAILED(config_get_string(rx->local_cfg, pval, key))) {
+        return A_OK;
+    }
+
+    return config_get_string(cfg, pval, key);
+}
+
+static
+aresult_t _receiver_cfg_get_float_array(struct receiver *rx, struct config *cfg, double **pvals, size_t *pnr_vals,
+        const char *key)
+{
+    if (NULL != rx->local_cfg && !FAILED(config_get_float_array(rx->local_cfg, pvals, pnr_vals, key))) {
+        return A_OK;
+    }
+
+    return config_get_float_array(cfg, pvals, pnr_vals, key);
+}
+
+static
+aresult_t _receiver_cfg_get(struct receiver *rx, struct config *cfg, struct config *pval, const char *key)
+{
+    if (NULL != rx->local_cfg && !FAILED(config_get(rx->local_cfg, pval, key))) {
+        return A_OK;
+    }
+
+    return config_get(cfg, pval, key);
+}
+
+/**
+ * Create the demodulator thread for a channel, as described by a channel stanza. Uses the filter
+ * and rates receiver_init settled on for this receiver. The new thread is not linked to the
+ * receiver, nor started.
+ *
+ * \param rx The receiver
+ * \param channel The channel configuration
+ * \param pooled Whether the demodulator will be serviced by a worker pool
+ * \param idx Where the channel is among the receiver's channels, to spread them across CPU cores
+ * \param pdmt The new demodulator thread, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+static
+aresult_t _receiver_channel_new(struct receiver *rx, struct config *channel, bool pooled, size_t idx,
+        struct demod_thread **pdmt)
+{
+    aresult_t ret = A_OK;
+
+    const char *fifo_name = NULL,
+               *signal_debug = NULL;
+    int nb_center_freq = -1;
+    struct demod_thread *dmt = NULL;
+    double channel_gain = 1.0,
+           channel_gain_db = 0.0;
+    int32_t offset_hz = 0;
+    unsigned chan_channel = 0;
+    int cpu_core = -1;
+    struct demod_base *demod = NULL;
+    struct pcm_decoder *decoder = NULL;
+    struct pcm_udp_sender *udp = NULL;
+    enum pcm_udp_format udp_format = PCM_UDP_FORMAT_S16;
+    struct config decode = CONFIG_INIT_EMPTY,
+                  gate = CONFIG_INIT_EMPTY;
+    const char *demod_name = NULL;
+    enum demod_output_mode out_mode = DEMOD_OUTPUT_FIFO_WRITE;
+    enum demod_priority demod_priority = DEMOD_PRIORITY_NORMAL;
+    bool use_gate = false;
+    double gate_open_dbfs = -50.0,
+           gate_close_dbfs = -55.0;
+    const char *priority = NULL;
+    int gate_hold_ms = 500,
+        batch_len = rx->batch_len,
+        min_batch_len = 0,
+        max_batch_len = 0,
+        batch_latency_ms = rx->batch_latency_ms,
+        udp_channel_id = 0,
+        udp_ttl = 0;
+
+    TSL_ASSERT_ARG(NULL != rx);
+    TSL_ASSERT_ARG(NULL != channel);
+    TSL_ASSERT_ARG(NULL != pdmt);
+
+    *pdmt = NULL;
+
+    /* Either decode in-process, send over UDP, publish to a shared memory ring, or write to a FIFO */
+    if (!FAILED(config_get(channel, &decode, "decode"))) {
+        out_mode = DEMOD_OUTPUT_DECODER;
+        fifo_name = "in-process decoder";
+    } else if (!FAILED(config_get_string(channel, &fifo_name, "outUdp"))) {
+        out_mode = DEMOD_OUTPUT_UDP;
+    } else if (!FAILED(config_get_string(channel, &fifo_name, "outShm"))) {
+        out_mode = DEMOD_OUTPUT_SHM_RING;
+    } else if (FAILED(ret = config_get_string(channel, &fifo_name, "outFifo"))) {
+        MFM_MSG(SEV_ERROR, "MISSING-FIFO-ID", "Missing output FIFO filename, aborting.");
+        goto done;
+    } else {
+        bool use_vmsplice = false;
+
+        if (!FAILED(config_get_boolean(channel, &use_vmsplice, "outFifoVmsplice")) && true == use_vmsplice) {
+            out_mode = DEMOD_OUTPUT_FIFO_VMSPLICE;
+        }
+    }
+
+    if (FAILED(ret = config_get_integer(channel, &nb_center_freq, "chanCenterFreq"))) {
+        MFM_MSG(SEV_ERROR, "MISSING-CENTER-FREQ", "Missing output channel center frequency.");
+        goto done;
+    }
+
+    if (!FAILED(config_get_string(channel, &signal_debug, "signalDebugFile"))) {
+        MFM_MSG(SEV_INFO, "WRITING-SIGNAL-DEBUG", "The channel at frequency %d will have raw I/Q written to '%s'",
+                nb_center_freq, signal_debug);
+    }
+
+    if (!FAILED(config_get_float(channel, &channel_gain_db, "dBGain"))) {
+        /* Convert the gain to linear units */
+        channel_gain = pow(10.0, channel_gain_db/10.0);
+        DIAG("Setting input channel gain to: %f (%f dB)", channel_gain, channel_gain_db);
+    }
+
+    /*
+     * Skip demodulating a channel while it's quiet:
+     *   "energyGate": { "openDbfs": -50.0, "closeDbfs": -55.0, "holdMs": 500 }
+     */
+    if (!FAILED(config_get(channel, &gate, "energyGate"))) {
+        use_gate = true;
+        config_get_float(&gate, &gate_open_dbfs, "openDbfs");
+
+        if (FAILED(config_get_float(&gate, &gate_close_dbfs, "closeDbfs"))) {
+            gate_close_dbfs = gate_open_dbfs - 5.0;
+        }
+
+        config_get_integer(&gate, &gate_hold_ms, "holdMs");
+
+        if (gate_open_dbfs > 0.0 || gate_close_dbfs > gate_open_dbfs || 0 > gate_hold_ms) {
+            MFM_MSG(SEV_ERROR, "BAD-ENERGY-GATE", "Channel at frequency %d: the energy gate must open at or below "
+                    "0 dBFS, close at or below where it opens, and hold for a non-negative time.", nb_center_freq);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        DIAG("Energy gate: open at %f dBFS, close below %f dBFS after %d ms", gate_open_dbfs, gate_close_dbfs,
+                gate_hold_ms);
+    }
+
+    /*
+     * How many filtered samples to demodulate and write out at once. Smaller batches get samples
+     * out sooner, bigger ones cost less per sample. With a latency target, the batch size adapts,
+     * within a factor of 8 of where it starts:
+     *   "batchSamples": 1024, "batchLatencyTargetMs": 20
+     */
+    config_get_integer(channel, &batch_len, "batchSamples");
+    config_get_integer(channel, &batch_latency_ms, "batchLatencyTargetMs");
+
+    if (DEMOD_MIN_BATCH_LEN > batch_len || DEMOD_MAX_BATCH_LEN < batch_len || 0 > batch_latency_ms) {
+        MFM_MSG(SEV_ERROR, "BAD-BATCH-SIZE", "Channel at frequency %d: batches must be between %d and %d samples, "
+                "with a non-negative latency target.", nb_center_freq, DEMOD_MIN_BATCH_LEN, DEMOD_MAX_BATCH_LEN);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    min_batch_len = batch_len;
+    max_batch_len = batch_len;
+
+    if (0 != batch_latency_ms) {
+        min_batch_len = BL_MAX2(batch_len / 8, DEMOD_MIN_BATCH_LEN);
+        max_batch_len = BL_MIN2(batch_len * 8, DEMOD_MAX_BATCH_LEN);
+        DIAG("Adapting batches between %d and %d samples, for a latency of %d ms", min_batch_len, max_batch_len,
+                batch_latency_ms);
+    }
+
+    /* When there isn't enough CPU to go around, less important channels are dropped first */
+    if (!FAILED(config_get_string(channel, &priority, "priority"))) {
+        if (!strcmp(priority, "high")) {
+            demod_priority = DEMOD_PRIORITY_HIGH;
+        } else if (!strcmp(priority, "normal")) {
+            demod_priority = DEMOD_PRIORITY_NORMAL;
+        } else if (!strcmp(priority, "low")) {
+            demod_priority = DEMOD_PRIORITY_LOW;
+        } else {
+            MFM_MSG(SEV_ERROR, "BAD-PRIORITY", "Channel at frequency %d: priority '%s' is not one of 'high', "
+                    "'normal' or 'low'.", nb_center_freq, priority);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    if (!FAILED(config_get_integer(channel, &cpu_core, "cpuCore")) && true == pooled) {
+        MFM_MSG(SEV_WARNING, "IGNORING-CPU-CORE", "Channel at frequency %d has a cpuCore, but demodulators are serviced "
+                "by a worker pool. Ignoring.", nb_center_freq);
+        cpu_core = -1;
+    }
+
+    DIAG("Center Frequency: %d Hz FIFO: %s", nb_center_freq, fifo_name);
+
+    offset_hz = (int32_t)nb_center_freq - rx->center_freq_hz;
+
+    /* With a channelizer, the demodulator only has to tune the offset within its channel */
+    if (NULL != rx->chan) {
+        /* Channels are set up in parallel, see receiver_init */
+        pthread_mutex_lock(&rx->demod_lock);
+        ret = channelizer_assign(rx->chan, offset_hz, &chan_channel, &offset_hz);
+        pthread_mutex_unlock(&rx->demod_lock);
+
+        if (FAILED(ret)) {
+            goto done;
+        }
+        DIAG("Channelizer channel: %u, residual offset %d Hz", chan_channel, offset_hz);
+    }
+
+    /* Create the demodulator for this channel */
+    if (FAILED(ret = _receiver_demod_new(channel, nb_center_freq, rx->demod_sample_rate / rx->demod_decimation,
+                    &demod)))
+    {
+        goto done;
+    }
+
+    /* The protocol decoders want real PCM, which only the FM demodulator produces */
+    if (DEMOD_OUTPUT_DECODER == out_mode) {
+        if (!FAILED(config_get_string(channel, &demod_name, "demod")) && strcmp(demod_name, "fm")) {
+            MFM_MSG(SEV_ERROR, "BAD-DECODE-DEMOD", "Channel at frequency %d can only be decoded in-process with "
+                    "the 'fm' demodulator.", nb_center_freq);
+            TSL_BUG_IF_FAILED(demod_base_cleanup(&demod));
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (FAILED(ret = pcm_decoder_new(&decoder, &decode, nb_center_freq, 2 * max_batch_len))) {
+            MFM_MSG(SEV_ERROR, "FAILED-DECODER", "Failed to create decoder for channel at frequency %d, aborting.",
+                    nb_center_freq);
+            TSL_BUG_IF_FAILED(demod_base_cleanup(&demod));
+            goto done;
+        }
+    }
+
+    /*
+     * Datagrams are tagged with the channel center frequency, unless told otherwise, so channels
+     * can share a multicast group:
+     *   "outUdp": "239.1.1.1:5000", "udpChannelId": 1, "udpTtl": 4
+     */
+    if (DEMOD_OUTPUT_UDP == out_mode) {
+        udp_channel_id = nb_center_freq;
+        config_get_integer(channel, &udp_channel_id, "udpChannelId");
+        config_get_integer(channel, &udp_ttl, "udpTtl");
+
+        if (0 > udp_ttl || 255 < udp_ttl) {
+            MFM_MSG(SEV_ERROR, "BAD-UDP-TTL", "Channel at frequency %d: multicast TTL %d must be in [0, 255].",
+                    nb_center_freq, udp_ttl);
+            TSL_BUG_IF_FAILED(demod_base_cleanup(&demod));
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        /* The Costas demodulator produces complex samples, FM real PCM */
+        if (!FAILED(config_get_string(channel, &demod_name, "demod")) && !strcmp(demod_name, "costas")) {
+            udp_format = PCM_UDP_FORMAT_CS16;
+        }
+
+        if (FAILED(ret = pcm_udp_sender_new(&udp, fifo_name, udp_channel_id,
+                        rx->demod_sample_rate / rx->demod_decimation, udp_format, udp_ttl)))
+        {
+            MFM_MSG(SEV_ERROR, "FAILED-UDP-OUTPUT", "Failed to set up UDP output to '%s' for channel at frequency "
+                    "%d, aborting.", fifo_name, nb_center_freq);
+            TSL_BUG_IF_FAILED(demod_base_cleanup(&demod));
+            goto done;
+        }
+    }
+
+    /* Create demodulator thread object */
+    if (FAILED(ret = demod_thread_new(&dmt, offset_hz,
+                    rx->demod_sample_rate, fifo_name, out_mode, rx->demod_decimation, rx->lpf_taps, rx->lpf_nr_taps,
+                    rx->cic_decimation, rx->hb_decimation, rx->cic_nr_comp_taps,
+                    signal_debug,
+                    channel_gain,
+                    max_batch_len,
+                    demod,
+                    decoder,
+                    udp)))
+    {
+        MFM_MSG(SEV_ERROR, "FAILED-DEMOD-THREAD", "Failed to create demodulator thread, aborting.");
+        TSL_BUG_IF_FAILED(demod_base_cleanup(&demod));
+        if (NULL != decoder) {
+            TSL_BUG_IF_FAILED(pcm_decoder_delete(&decoder));
+        }
+        if (NULL != udp) {
+            TSL_BUG_IF_FAILED(pcm_udp_sender_delete(&udp));
+        }
+        goto done;
+    }
+
+    dmt->channelizer_channel = chan_channel;
+    dmt->center_freq_hz = nb_center_freq;
+    dmt->priority = demod_priority;
+
+    TSL_BUG_IF_FAILED(demod_thread_set_batch(dmt, batch_len, min_batch_len, (uint64_t)batch_latency_ms * 1000000ull));
+
+    if (true == use_gate) {
+        TSL_BUG_IF_FAILED(energy_gate_init(&dmt->gate, gate_open_dbfs, gate_close_dbfs,
+                    (uint64_t)gate_hold_ms * (rx->demod_sample_rate / rx->demod_decimation) / 1000));
+        dmt->use_gate = true;
+    }
+
+    if (0 <= cpu_core) {
+        dmt->core_id = cpu_core;
+    } else if (0 != rx->nr_demod_cores) {
+        dmt->core_id = rx->demod_cores[idx % rx->nr_demod_cores];
+    }
+
+    list_init(&dmt->dt_node);
+
+    MFM_MSG(SEV_INFO, "CHANNEL", "[%zu]: %4.5f MHz Gain: %f dB -> [%s]%s%s",
+            idx + 1, (double)nb_center_freq/1e6, channel_gain_db, fifo_name,
+            (NULL != signal_debug ? " DEBUG: " : ""),
+            (NULL != signal_debug ? signal_debug : ""));
+
+    *pdmt = dmt;
+
+done:
+    return ret;
+}
+
+/**
+ * The most threads channels are set up on at once
+ */
+#define RECEIVER_SETUP_MAX_THREADS      8
+
+struct receiver_setup;
+
+struct receiver_setup_worker {
+    struct worker_thread wthr;
+    struct receiver_setup *setup;
+    bool started;
+};
+
+/**
+ * Channels being set up in parallel. Designing the channel filters and decoders is most of the
+ * work, and channels don't share any of it (short of the coefficient cache, which has its own
+ * lock).
+ */
+struct receiver_setup {
+    struct receiver *rx;
+
+    /**
+     * The channel stanzas, and the index of the next one to set up
+     */
+    struct config *channels;
+    size_t nr_channels;
+    atomic_size_t next_channel;
+
+    /**
+     * Whether the demodulators are serviced by a worker pool
+     */
+    bool pooled;
+
+    /**
+     * Whether channels are linked to the receiver as soon as each is ready, rather than all at
+     * once, in order, by receiver_init. Only for receivers that can change their channels while
+     * running.
+     */
+    bool deferred;
+
+    /**
+     * Set to stop picking up channels, once one has failed
+     */
+    atomic_bool failed;
+
+    /**
+     * The new demodulators, by channel index, if not deferred
+     */
+    struct demod_thread **dmts;
+
+    struct receiver_setup_worker *workers;
+    size_t nr_workers;
+
+    /**
+     * Protects everything below, and is signalled whenever a channel is done or a worker exits
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    size_t nr_ready;
+    size_t nr_running;
+
+    /**
+     * Whether receiver_init has returned, leaving the rest of the channels to the workers
+     */
+    bool returned;
+
+    /**
+     * The first failure, if any
+     */
+    aresult_t ret;
+};
+
+/**
+ * Link a newly created demodulator to the receiver, starting it if the other demodulators are
+ * already running. The capture thread takes demod_lock for every buffer it delivers, so the
+ * thread is started without the lock held; demods_started never goes back to false, so once
+ * it's been seen set, it can't change under us.
+ */
+static
+aresult_t _receiver_channel_attach(struct receiver *rx, struct demod_thread *dmt)
+{
+    aresult_t ret = A_OK;
+
+    bool started = false;
+
+    pthread_mutex_lock(&rx->demod_lock);
+
+    /* Not running yet, so receiver_start will start it along with the rest */
+    if (false == (started = rx->demods_started)) {
+        list_append(&rx->demod_threads, &dmt->dt_node);
+        rx->nr_demod_threads++;
+    }
+
+    pthread_mutex_unlock(&rx->demod_lock);
+
+    if (true == started) {
+        if (FAILED(ret = demod_thread_start(dmt, dmt->core_id))) {
+            goto done;
+        }
+
+        pthread_mutex_lock(&rx->demod_lock);
+        list_append(&rx->demod_threads, &dmt->dt_node);
+        rx->nr_demod_threads++;
+        pthread_mutex_unlock(&rx->demod_lock);
+    }
+
+done:
+    return ret;
+}
+
+static
+aresult_t _receiver_setup_work(struct worker_thread *wthr)
+{
+    struct receiver_setup_worker *wkr = BL_CONTAINER_OF(wthr, struct receiver_setup_worker, wthr);
+    struct receiver_setup *setup = wkr->setup;
+
+    while (worker_thread_is_running(wthr) && false == atomic_load(&setup->failed)) {
+        aresult_t ret = A_OK;
+        struct demod_thread *dmt = NULL;
+        size_t idx = atomic_fetch_add(&setup->next_channel, 1);
+
+        if (idx >= setup->nr_channels) {
+            break;
+        }
+
+        if (!FAILED(ret = _receiver_channel_new(setup->rx, &setup->channels[idx], setup->pooled, idx, &dmt)) &&
+                true == setup->deferred && FAILED(ret = _receiver_channel_attach(setup->rx, dmt)))
+        {
+            TSL_BUG_IF_FAILED(demod_thread_delete(&dmt));
+        }
+
+        pthread_mutex_lock(&setup->lock);
+
+        if (FAILED(ret)) {
+            MFM_MSG(SEV_ERROR, "CHANNEL-SETUP-FAILURE", "Failed to set up channel %zu.", idx + 1);
+
+            if (!FAILED(setup->ret)) {
+                setup->ret = ret;
+            }
+
+            /* A bad channel is as fatal now as it would have been before capture started, see receiver_setup_status */
+            atomic_store(&setup->failed, true);
+        } else {
+            if (false == setup->deferred) {
+                setup->dmts[idx] = dmt;
+            }
+            setup->nr_ready++;
+        }
+
+        pthread_cond_broadcast(&setup->cond);
+        pthread_mutex_unlock(&setup->lock);
+    }
+
+    pthread_mutex_lock(&setup->lock);
+
+    if (0 == --setup->nr_running && true == setup->returned && !FAILED(setup->ret)) {
+        MFM_MSG(SEV_INFO, "CHANNELS-READY", "Finished setting up all %zu channels.", setup->nr_channels);
+    }
+
+    pthread_cond_broadcast(&setup->cond);
+    pthread_mutex_unlock(&setup->lock);
+
+    return A_OK;
+}
+
+/**
+ * Stop setting up channels, and release the setup state. Channels already linked to the receiver
+ * stay linked.
+ */
+static
+void _receiver_setup_delete(struct receiver_setup **psetup)
+{
+    struct receiver_setup *setup = *psetup;
+
+    if (NULL != setup->workers) {
+        for (size_t i = 0; i < setup->nr_workers; i++) {
+            if (true == setup->workers[i].started) {
+                TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&setup->workers[i].wthr));
+                TSL_BUG_IF_FAILED(worker_thread_delete(&setup->workers[i].wthr));
+            }
+        }
+
+        TFREE(setup->workers);
+    }
+
+    if (NULL != setup->dmts) {
+        for (size_t i = 0; i < setup->nr_channels; i++) {
+            if (NULL != setup->dmts[i]) {
+                TSL_BUG_IF_FAILED(demod_thread_delete(&setup->dmts[i]));
+            }
+        }
+
+        TFREE(setup->dmts);
+    }
+
+    if (NULL != setup->channels) {
+        TFREE(setup->channels);
+    }
+
+    pthread_cond_destroy(&setup->cond);
+    pthread_mutex_destroy(&setup->lock);
+
+    TFREE(setup);
+    *psetup = NULL;
+}
+
+/**
+ * Set up every channel in a "channels" array, on several threads at once. Returns when every
+ * channel is ready, in which case they're linked to the receiver in the order they're listed. A
+ * receiver that can change its channels while running only waits for the first channel to be
+ * ready, so it can start capturing sooner; the rest are linked (and started, if the receiver
+ * has been) as they become ready.
+ *
+ * \param rx The receiver
+ * \param channels The "channels" array
+ * \param pooled Whether the demodulators will be serviced by a worker pool
  *
- * \param buf The buffer to free
- * 
  * \return A_OK on success, an error code otherwise.
  */
 static
-aresult_t _sample_buf_release(struct sample_buf *buf)
+aresult_t _receiver_setup_channels(struct receiver *rx, struct config *channels, bool pooled)
+{
+    aresult_t ret = A_OK;
+
+    struct receiver_setup *setup = NULL;
+    struct config channel;
+    size_t arr_ctr = 0,
+           nr_channels = 0;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CONFIG_ARRAY_FOR_EACH(channel, channels, ret, arr_ctr) {
+        nr_channels++;
+    }
+    if (FAILED(ret) || 0 == nr_channels) {
+        goto done;
+    }
+
+    if (FAILED(ret = TZAALLOC(setup, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    pthread_mutex_init(&setup->lock, NULL);
+    pthread_cond_init(&setup->cond, NULL);
+
+    setup->rx = rx;
+    setup->pooled = pooled;
+    setup->nr_channels = nr_channels;
+
+    /* Pool workers and the channelizer both work from a fixed set of channels */
+    setup->deferred = false == pooled && NULL == rx->chan;
+
+    if (FAILED(ret = TCALLOC((void **)&setup->channels, nr_channels, sizeof(struct config))) ||
+            FAILED(ret = TCALLOC((void **)&setup->dmts, nr_channels, sizeof(struct demod_thread *))))
+    {
+        goto done;
+    }
+
+    CONFIG_ARRAY_FOR_EACH(channel, channels, ret, arr_ctr) {
+        setup->channels[arr_ctr] = channel;
+    }
+    if (FAILED(ret)) {
+        goto done;
+    }
+
+    setup->nr_workers = BL_MIN2(nr_channels, BL_MIN2(RECEIVER_SETUP_MAX_THREADS, 0 < nr_cpus ? (size_t)nr_cpus : 1));
+
+    if (FAILED(ret = TACALLOC((void **)&setup->workers, setup->nr_workers, sizeof(struct receiver_setup_worker),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < setup->nr_workers; i++) {
+        setup->workers[i].setup = setup;
+
+        pthread_mutex_lock(&setup->lock);
+        setup->nr_running++;
+        pthread_mutex_unlock(&setup->lock);
+
+        if (FAILED(ret = worker_thread_new(&setup->workers[i].wthr, _receiver_setup_work, WORKER_THREAD_CPU_MASK_ANY))) {
+            MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start channel setup thread, aborting.");
+            pthread_mutex_lock(&setup->lock);
+            setup->nr_running--;
+            pthread_mutex_unlock(&setup->lock);
+            atomic_store(&setup->failed, true);
+            goto done;
+        }
+
+        setup->workers[i].started = true;
+    }
+
+    pthread_mutex_lock(&setup->lock);
+
+    while (0 != setup->nr_running && (false == setup->deferred || 0 == setup->nr_ready) &&
+            false == atomic_load(&setup->failed))
+    {
+        pthread_cond_wait(&setup->cond, &setup->lock);
+    }
+
+    ret = setup->ret;
+
+    if (!FAILED(ret) && 0 != setup->nr_running) {
+        setup->returned = true;
+        MFM_MSG(SEV_INFO, "CHANNELS-PENDING", "%zu of %zu channels ready, setting up the rest in the background.",
+                setup->nr_ready, nr_channels);
+    }
+
+    pthread_mutex_unlock(&setup->lock);
+
+    if (FAILED(ret)) {
+        goto done;
+    }
+
+    if (true == setup->returned) {
+        rx->setup = setup;
+        setup = NULL;
+        goto done;
+    }
+
+    /* Every channel is ready, link them up in the order they're listed, unless they linked themselves */
+    for (size_t i = 0; i < nr_channels && false == setup->deferred; i++) {
+        list_append(&rx->demod_threads, &setup->dmts[i]->dt_node);
+        rx->nr_demod_threads++;
+        setup->dmts[i] = NULL;
+    }
+
+done:
+    if (NULL != setup) {
+        _receiver_setup_delete(&setup);
+    }
+
+    return ret;
+}
+
+aresult_t receiver_init(struct receiver *rx, struct config *cfg,
+        receiver_rx_thread_func_t rx_func, receiver_cleanup_func_t cleanup_func,
+        size_t samples_per_buf)
+{
+    aresult_t ret = A_OK;
+
+    double *lpf_taps = NULL,
+           *demod_cores_cfg = NULL,
+           *resample_filter_taps CAL_CLEANUP(free_double_array) = NULL;
+    unsigned *demod_cores = NULL;
+    const char *iq_record_file = NULL;
+    bool iq_record_direct = false;
+
+    size_t lpf_nr_taps = 0,
+           nr_demod_cores = 0;
+    int decimation_factor = 0,
+        demod_decimation = 0,
+        nr_samp_bufs = 0,
+        rx_core = -1,
+        numa_node = -1,
+        demod_sample_rate = 0,
+        nr_pool_workers = 0,
+        cic_decimation = 0,
+        sample_rate = 0,
+        center_freq = 0;
+    int16_t *resample_int_filter_taps CAL_CLEANUP(free_i16_array) = NULL;
+
+    struct config channels,
+                  chan_cfg,
+                  *filter_cfg = cfg;
+
+    TSL_ASSERT_ARG(NULL != rx);
+    TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(NULL != rx_func);
+    TSL_ASSERT_ARG(NULL != cleanup_func);
+    TSL_ASSERT_ARG(0 != samples_per_buf);
+
+    rx->muted = true;
+    rx->started = false;
+    rx->demods_started = false;
+    rx->setup = NULL;
+    rx->samp_alloc_shared = NULL != rx->samp_alloc;
+    rx->samp_buf_hugepages = false;
+    rx->samp_buf_numa_node = -1;
+    rx->rx_core = WORKER_THREAD_CPU_MASK_ANY;
+    rx->chan = NULL;
+    rx->pool = NULL;
+    rx->recorder = NULL;
+    rx->lpf_taps = NULL;
+    rx->lpf_nr_taps = 0;
+    rx->cic_decimation = 0;
+    rx->hb_decimation = 1;
+    rx->cic_nr_comp_taps = 0;
+    rx->batch_len = LPF_OUTPUT_LEN;
+    rx->batch_latency_ms = 0;
+    rx->shed.level = DEMOD_PRIORITY_LOW;
+    rx->shed.next_level = DEMOD_PRIORITY_LOW;
+    rx->demod_cores = NULL;
+    rx->nr_demod_cores = 0;
+    rx->cleanup_func = cleanup_func;
+    rx->thread_func = rx_func;
+
+    list_init(&rx->demod_threads);
+    pthread_mutex_init(&rx->demod_lock, NULL);
+
+    if (FAILED(ret = _receiver_cfg_get_integer(rx, cfg, &nr_samp_bufs, "nrSampBufs"))) {
+        MFM_MSG(SEV_INFO, "DEFAULT-SAMP-BUFS", "Setting sample buffer count to 64");
+        nr_samp_bufs = 64;
+    }
+
+    if (FAILED(ret = _receiver_cfg_get_integer(rx, cfg, &sample_rate, "sampleRateHz"))) {
+        MFM_MSG(SEV_INFO, "NO-SAMPLE-RATE", "Need to specify a sample rate, in Hertz.");
+        goto done;
+    }
+
+    if (FAILED(ret = _receiver_cfg_get_integer(rx, cfg, &center_freq, "centerFreqHz"))) {
+        MFM_MSG(SEV_INFO, "NO-CENTER-FREQ", "You forgot to specify a center frequency, in Hz.");
+        goto done;
+    }
+
+    MFM_MSG(SEV_INFO, "SAMPLE-RATE", "Sample rate is set to %u Hz", sample_rate);
+
+    rx->sample_rate_hz = sample_rate;
+
+    if (0 == rx->input_decimation) {
+        rx->input_decimation = 1;
+    }
+
+    if (1 != rx->input_decimation) {
+        sample_rate /= rx->input_decimation;
+        MFM_MSG(SEV_INFO, "INPUT-DECIMATION", "Receiver decimates by %u, channels see a sample rate of %d Hz",
+                rx->input_decimation, sample_rate);
+    }
+    MFM_MSG(SEV_INFO, "CENTER-FREQ", "Center Frequency is %u Hz", center_freq);
+
+    rx->center_freq_hz = center_freq;
+
+    if (!FAILED(_receiver_cfg_get_integer(rx, cfg, &rx_core, "rxCpuCore"))) {
+        if (0 > rx_core) {
+            MFM_MSG(SEV_ERROR, "BAD-RX-CPU-CORE", "rxCpuCore of %d is not valid.", rx_core);
+            ret = A_E_INVAL;
+            goto done;
+        }
+        rx->rx_core = rx_core;
+        /* By default, keep the sample buffers local to the thread that fills them */
+        numa_node = sample_buf_pool_cpu_node(rx_core);
+    }
+
+    if (FAILED(_receiver_cfg_get_boolean(rx, cfg, &rx->samp_buf_hugepages, "sampBufHugePages"))) {
+        rx->samp_buf_hugepages = false;
+    }
+
+    if (!FAILED(_receiver_cfg_get_integer(rx, cfg, &numa_node, "sampBufNumaNode")) && 0 > numa_node) {
+        numa_node = -1;
+    }
+
+    rx->samp_buf_numa_node = numa_node;
+
+    if (0 == rx->nr_samp_buf_users) {
+        rx->nr_samp_buf_users = 1;
+    }
+
+    /*
+     * Create the pool of sample buffers, unless the driver handed us one shared with another
+     * receiver. Everything is faulted in and locked now, rather than the first time the radio
+     * fills a buffer.
+     */
+    if (false == rx->samp_alloc_shared &&
+            FAILED(ret = sample_buf_pool_new(&rx->samp_alloc,
+                sizeof(struct sample_buf) +
+                    samples_per_buf * sizeof(int16_t) * 2,
+                nr_samp_bufs * rx->nr_samp_buf_users, rx->samp_buf_hugepages, rx->samp_buf_numa_node)))
+    {
+        MFM_MSG(SEV_ERROR, "CANT-ALLOC-SAMP-BUFS", "Unable to allocate %d sample buffers, aborting.",
+                nr_samp_bufs * (int)rx->nr_samp_buf_users);
+        goto done;
+    }
+
+    /*
+     * Optionally record the delivered samples. The older iqDumpFile option wrote the RTL-SDR's
+     * raw 8-bit samples from the USB callback, so take it to mean the same thing.
+     */
+    if (FAILED(_receiver_cfg_get_string(rx, cfg, &iq_record_file, "iqRecordFile")) &&
+            !FAILED(_receiver_cfg_get_string(rx, cfg, &iq_record_file, "iqDumpFile")))
+    {
+        MFM_MSG(SEV_WARNING, "IQ-DUMP-FILE-DEPRECATED", "iqDumpFile is deprecated, use iqRecordFile. Samples are "
+                "now recorded as interleaved 16-bit I/Q.");
+    }
+
+    if (NULL != iq_record_file) {
+        if (FAILED(_receiver_cfg_get_boolean(rx, cfg, &iq_record_direct, "iqRecordDirect"))) {
+            iq_record_direct = false;
+        }
+
+        /* Never let the recorder sit on more than half the buffers, or a slow disk starves the demodulators */
+        if (FAILED(ret = iq_recorder_new(&rx->recorder, iq_record_file, iq_record_direct,
+                        BL_MAX2(nr_samp_bufs / 2, 1), 0)))
+        {
+            MFM_MSG(SEV_ERROR, "CANT-RECORD-IQ", "Unable to record I/Q samples to '%s', aborting.", iq_record_file);
+            goto done;
+        }
+    }
+
+    /* Grab the decimation factor and other parameters first, just to validate them. */
+    if (FAILED(ret = _receiver_cfg_get_integer(rx, cfg, &decimation_factor, "decimationFactor"))) {
+        decimation_factor = 1;
+        MFM_MSG(SEV_INFO, "NO-DECIMATION", "Not decimating the output signal: using full bandwidth.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 >= decimation_factor) {
+        MFM_MSG(SEV_ERROR, "BAD-DECIMATION-FACTOR", "Decimation factor of '%d' is not valid.",
+                decimation_factor);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    demod_decimation = decimation_factor;
+    demod_sample_rate = sample_rate;
+
+    /*
+     * If a channelizer is configured, the demodulator threads only see their channel's slice
+     * of spectrum, at the channelizer output rate. The channel filter then needs to be designed
+     * for that rate, so it lives in the channelizer section.
+     */
+    if (!FAILED(_receiver_cfg_get(rx, cfg, &chan_cfg, "channelizer"))) {
+        unsigned chan_decimation = 0;
+
+        if (FAILED(ret = channelizer_new(&rx->chan, rx, &chan_cfg, sample_rate, samples_per_buf))) {
+            MFM_MSG(SEV_ERROR, "CHANNELIZER-SETUP-FAILED", "Failed to set up channelizer, aborting.");
+            goto done;
+        }
+
+        chan_decimation = channelizer_decimation(rx->chan);
+
+        if (0 != decimation_factor % chan_decimation) {
+            MFM_MSG(SEV_ERROR, "BAD-DECIMATION-FACTOR", "Decimation factor of '%d' must be a multiple of the channelizer decimation (%u).",
+                    decimation_factor, chan_decimation);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        demod_decimation = decimation_factor / chan_decimation;
+        demod_sample_rate = sample_rate / chan_decimation;
+        filter_cfg = &chan_cfg;
+    }
+
+    rx->demod_sample_rate = demod_sample_rate;
+    rx->demod_decimation = demod_decimation;
+
+    /* Optionally do the bulk of the decimation in a CIC and half-band stages, ahead of a short FIR */
+    if (!FAILED(_receiver_cfg_get_integer(rx, cfg, &cic_decimation, "cicDecimation"))) {
+        int hb_decimation = 1,
+            nr_comp_taps = 0;
+
+        if (!FAILED(_receiver_cfg_get_integer(rx, cfg, &hb_decimation, "cicHalfbandDecimation")) &&
+                1 != hb_decimation && 2 != hb_decimation && 4 != hb_decimation && 8 != hb_decimation)
+        {
+            MFM_MSG(SEV_ERROR, "BAD-HALFBAND-DECIMATION", "Half-band decimation of '%d' is not valid, must be 1, 2, 4 or 8.",
+                    hb_decimation);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (2 > cic_decimation || MULTISTAGE_CIC_MAX_DECIMATION < cic_decimation) {
+            MFM_MSG(SEV_ERROR, "BAD-CIC-DECIMATION", "CIC decimation of '%d' is not valid, must be between 2 and %d.",
+                    cic_decimation, MULTISTAGE_CIC_MAX_DECIMATION);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (0 != demod_decimation % (cic_decimation * hb_decimation)) {
+            MFM_MSG(SEV_ERROR, "BAD-CIC-DECIMATION", "Decimation factor of '%d' must be a multiple of the CIC and half-band decimation (%d).",
+                    demod_decimation, cic_decimation * hb_decimation);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (!FAILED(_receiver_cfg_get_integer(rx, cfg, &nr_comp_taps, "cicCompensatorTaps")) && 0 >= nr_comp_taps) {
+            MFM_MSG(SEV_ERROR, "BAD-CIC-COMPENSATOR", "CIC compensator length of '%d' is not valid.", nr_comp_taps);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        MFM_MSG(SEV_INFO, "MULTISTAGE-FILTER", "Decimating by %d in a CIC, %d in half-band stages and %d in the channel filter",
+                cic_decimation, hb_decimation, demod_decimation / (cic_decimation * hb_decimation));
+
+        rx->cic_decimation = cic_decimation;
+        rx->hb_decimation = hb_decimation;
+        rx->cic_nr_comp_taps = nr_comp_taps;
+    }
+
+    /* Batch sizes for the channels, unless they say otherwise */
+    _receiver_cfg_get_integer(rx, cfg, &rx->batch_len, "batchSamples");
+    _receiver_cfg_get_integer(rx, cfg, &rx->batch_latency_ms, "batchLatencyTargetMs");
+
+    /* Check that there's a filter specified */
+    if (FAILED(ret = (filter_cfg == cfg ?
+                    _receiver_cfg_get_float_array(rx, cfg, &lpf_taps, &lpf_nr_taps, "lpfTaps") :
+                    config_get_float_array(filter_cfg, &lpf_taps, &lpf_nr_taps, "lpfTaps"))))
+    {
+        MFM_MSG(SEV_ERROR, "BAD-FILTER-TAPS", "Need to provide a baseband filter with at least two filter taps as 'lpfTaps'.");
+        goto done;
+    }
+
+    if (1 >= lpf_nr_taps) {
+        MFM_MSG(SEV_ERROR, "INSUFF-FILTER-TAPS", "Not enough filter taps for the low-pass filter.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* The FIR in each demodulator thread needs a full filter's worth of samples in each buffer */
+    if (NULL != rx->chan && samples_per_buf / channelizer_decimation(rx->chan) <= lpf_nr_taps) {
+        MFM_MSG(SEV_ERROR, "INSUFF-CHANNELIZER-SAMPLES", "Sample buffers of %zu samples are too small for a %zu tap filter after channelizing.",
+                samples_per_buf, lpf_nr_taps);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    /* Hang on to the filter, for channels added later on */
+    rx->lpf_taps = lpf_taps;
+    rx->lpf_nr_taps = lpf_nr_taps;
+    lpf_taps = NULL;
+
+    /* CPU cores to spread the demodulators across, round-robin */
+    if (!FAILED(_receiver_cfg_get_float_array(rx, cfg, &demod_cores_cfg, &nr_demod_cores, "demodCores"))) {
+        if (FAILED(ret = TCALLOC((void **)&demod_cores, nr_demod_cores, sizeof(unsigned)))) {
+            goto done;
+        }
+
+        for (size_t i = 0; i < nr_demod_cores; i++) {
+            if (0 > demod_cores_cfg[i]) {
+                MFM_MSG(SEV_ERROR, "BAD-DEMOD-CORE", "CPU core '%f' is not valid.", demod_cores_cfg[i]);
+                ret = A_E_INVAL;
+                goto done;
+            }
+            demod_cores[i] = (unsigned)demod_cores_cfg[i];
+        }
+
+        MFM_MSG(SEV_INFO, "DEMOD-CORES", "Spreading demodulators across %zu CPU cores", nr_demod_cores);
+
+        rx->demod_cores = demod_cores;
+        rx->nr_demod_cores = nr_demod_cores;
+        demod_cores = NULL;
+    }
+
+    /* The worker pool is process-wide, see receiver_demod_pool_new */
+    if (FAILED(config_get_integer(cfg, &nr_pool_workers, "demodWorkerThreads"))) {
+        nr_pool_workers = 0;
+    }
+
+    /* Create the demodulator threads, walking the list of channels to be processed. */
+    if (FAILED(ret = _receiver_cfg_get(rx, cfg, &channels, "channels"))) {
+        MFM_MSG(SEV_ERROR, "MISSING-CHANNELS", "Need to specify at least one channel to demodulate.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = _receiver_setup_channels(rx, &channels, 0 != nr_pool_workers))) {
+        MFM_MSG(SEV_ERROR, "CHANNEL-SETUP-FAILURE", "Error setting up array of channels, aborting.");
+        goto done;
+    }
+
+done:
+    /* The driver's configuration need not outlive this call */
+    rx->local_cfg = NULL;
+
+    if (NULL != lpf_taps) {
+        TFREE(lpf_taps);
+    }
+
+    if (NULL != demod_cores_cfg) {
+        TFREE(demod_cores_cfg);
+    }
+
+    if (NULL != demod_cores) {
+        TFREE(demod_cores);
+    }
+
+    return ret;
+}
+
+static
+aresult_t _receiver_worker_thread(struct worker_thread *wthr)
+{
+    struct receiver *rx = BL_CONTAINER_OF(wthr, struct receiver, wthr);
+
+    TSL_BUG_ON(NULL == rx->thread_func);
+
+    return rx->thread_func(rx);
+}
+
+aresult_t receiver_start(struct receiver *rx)
 {
     aresult_t ret = A_OK;
 
-    struct frame_alloc *fa = NULL;
+    TSL_ASSERT_ARG(NULL != rx);
+
+    /*
+     * Demodulators serviced by a worker pool are run by the pool, the rest get their own threads.
+     * Channels still being set up are started as they're linked in.
+     */
+    pthread_mutex_lock(&rx->demod_lock);
+
+    if (NULL == rx->pool) {
+        struct demod_thread *dthr = NULL;
+
+        list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+            if (FAILED(ret = demod_thread_start(dthr, dthr->core_id))) {
+                break;
+            }
+        }
+    }
+
+    rx->demods_started = !FAILED(ret);
+
+    pthread_mutex_unlock(&rx->demod_lock);
+
+    if (FAILED(ret)) {
+        goto done;
+    }
 
-    TSL_ASSERT_ARG(NULL != buf);
-    TSL_BUG_ON(atomic_load(&buf->refcount) != 0);
+    /* The channelizer has to be ready before the first samples arrive */
+    if (NULL != rx->chan) {
+        if (FAILED(ret = channelizer_start(rx->chan))) {
+            goto done;
+        }
+    }
 
-    fa = buf->priv;
+    if (FAILED(ret = worker_thread_new(&rx->wthr, _receiver_worker_thread, rx->rx_core))) {
+        MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start worker thread, aborting.");
+        goto done;
+    }
 
-    TSL_BUG_IF_FAILED(frame_free(fa, (void **)&buf));
+    rx->started = true;
 
+done:
     return ret;
 }
 
-/**
- * Allocate a sample buffer
- */
-aresult_t receiver_sample_buf_alloc(struct receiver *rx, struct sample_buf **pbuf)
+aresult_t receiver_setup_status(struct receiver *rx)
 {
     aresult_t ret = A_OK;
 
-    struct sample_buf *sbuf = NULL;
+    struct receiver_setup *setup = NULL;
 
     TSL_ASSERT_ARG(NULL != rx);
-    TSL_ASSERT_ARG(NULL != pbuf);
-
-    *pbuf = NULL;
 
-    /* Allocate an output buffer */
-    if (FAILED(ret = frame_alloc(rx->samp_alloc, (void **)&sbuf))) {
-        if (0 == rx->nr_samp_buf_alloc_fails) {
-            MFM_MSG(SEV_INFO, "NO-SAMPLE-BUFFER", "There are no available sample buffers, dropping received samples.");
-        }
-        rx->nr_samp_buf_alloc_fails++;
+    if (NULL == (setup = rx->setup)) {
         goto done;
     }
 
-    /* Initialize the state for the sample buffer */
-    sbuf->release = _sample_buf_release;
-    sbuf->priv = rx->samp_alloc;
-
-    *pbuf = sbuf;
+    pthread_mutex_lock(&setup->lock);
+    ret = setup->ret;
+    pthread_mutex_unlock(&setup->lock);
 
 done:
     return ret;
 }
 
-/**
- * Deliver a sample buffer to any waiting consumers
- */
-aresult_t receiver_sample_buf_deliver(struct receiver *rx, struct sample_buf *buf)
+aresult_t receiver_setup_wait(struct receiver *rx)
 {
     aresult_t ret = A_OK;
 
-    struct demod_thread *dthr = NULL;
+    struct receiver_setup *setup = NULL;
 
-    TSL_BUG_ON(0 == buf->nr_samples);
+    TSL_ASSERT_ARG(NULL != rx);
+
+    if (NULL == (setup = rx->setup)) {
+        goto done;
+    }
 
-    atomic_store(&buf->refcount, rx->nr_demod_threads);
+    pthread_mutex_lock(&setup->lock);
 
-    /* Make it available to each demodulator/processing thread */
-    list_for_each_type(dthr, &rx->demod_threads, dt_node) {
-        pthread_mutex_lock(&dthr->wq_mtx);
-        TSL_BUG_IF_FAILED(work_queue_push(&dthr->wq, buf));
-        pthread_mutex_unlock(&dthr->wq_mtx);
-        /* Signal there is data ready, if the thread is waiting on the condvar */
-        pthread_cond_signal(&dthr->wq_cv);
+    while (0 != setup->nr_running) {
+        pthread_cond_wait(&setup->cond, &setup->lock);
     }
 
+    ret = setup->ret;
+
+    pthread_mutex_unlock(&setup->lock);
+
+done:
     return ret;
 }
 
-aresult_t receiver_init(struct receiver *rx, struct config *cfg,
-        receiver_rx_thread_func_t rx_func, receiver_cleanup_func_t cleanup_func,
-        size_t samples_per_buf)
+aresult_t receiver_cleanup(struct receiver **prx)
 {
     aresult_t ret = A_OK;
 
-    double *lpf_taps = NULL,
-           *resample_filter_taps CAL_CLEANUP(free_double_array) = NULL;
-
-    size_t lpf_nr_taps = 0,
-           arr_ctr = 0;
-    int decimation_factor = 0,
-        nr_samp_bufs = 0,
-        sample_rate = 0,
-        center_freq = 0;
-    int16_t *resample_int_filter_taps CAL_CLEANUP(free_i16_array) = NULL;
+    struct receiver *rx = NULL;
+    struct demod_thread *cur = NULL,
+                        *tmp = NULL;
 
-    struct config channels,
-                  channel;
+    TSL_ASSERT_ARG(NULL != prx);
+    TSL_ASSERT_ARG(NULL != *prx);
 
-    struct frame_alloc *sample_buf_alloc = NULL;
+    rx = *prx;
 
-    TSL_ASSERT_ARG(NULL != rx);
-    TSL_ASSERT_ARG(NULL != cfg);
-    TSL_ASSERT_ARG(NULL != rx_func);
-    TSL_ASSERT_ARG(NULL != cleanup_func);
-    TSL_ASSERT_ARG(0 != samples_per_buf);
+    /* Stop setting up channels first, the setup threads link channels to the receiver */
+    if (NULL != rx->setup) {
+        _receiver_setup_delete(&rx->setup);
+    }
 
-    rx->muted = true;
-    rx->samp_alloc = sample_buf_alloc;
-    rx->cleanup_func = cleanup_func;
-    rx->thread_func = rx_func;
+    /* Clean up the receiver state */
+    TSL_BUG_IF_FAILED(rx->cleanup_func(rx));
 
-    if (FAILED(ret = config_get_integer(cfg, &nr_samp_bufs, "nrSampBufs"))) {
-        MFM_MSG(SEV_INFO, "DEFAULT-SAMP-BUFS", "Setting sample buffer count to 64");
-        nr_samp_bufs = 64;
+    /* Shut down the worker thread */
+    if (true == rx->started) {
+        TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&rx->wthr));
+        TSL_BUG_IF_FAILED(worker_thread_delete(&rx->wthr));
+        rx->started = false;
     }
 
-    if (FAILED(ret = config_get_integer(cfg, &sample_rate, "sampleRateHz"))) {
-        MFM_MSG(SEV_INFO, "NO-SAMPLE-RATE", "Need to specify a sample rate, in Hertz.");
-        goto done;
+    /* Nothing more will be delivered, so the recorder can write out what it has and let go */
+    if (NULL != rx->recorder) {
+        TSL_BUG_IF_FAILED(iq_recorder_delete(&rx->recorder));
     }
 
-    if (FAILED(ret = config_get_integer(cfg, &center_freq, "centerFreqHz"))) {
-        MFM_MSG(SEV_INFO, "NO-CENTER-FREQ", "You forgot to specify a center frequency, in Hz.");
-        goto done;
+    /* Stop the channelizer, but hold on to its buffers until the demodulators let go of them */
+    if (NULL != rx->chan) {
+        TSL_BUG_IF_FAILED(channelizer_stop(rx->chan));
     }
 
-    MFM_MSG(SEV_INFO, "SAMPLE-RATE", "Sample rate is set to %u Hz", sample_rate);
-    MFM_MSG(SEV_INFO, "CENTER-FREQ", "Center Frequency is %u Hz", center_freq);
+    /* The worker pool has to be gone before its demodulators are */
+    TSL_BUG_ON(NULL != rx->pool);
 
-    /*
-     * Create the memory frame allocator for sample buffers
-     */
-    TSL_BUG_IF_FAILED(frame_alloc_new(&rx->samp_alloc,
-                sizeof(struct sample_buf) +
-                    samples_per_buf * sizeof(int16_t) * 2,
-                nr_samp_bufs));
+    list_for_each_type_safe(cur, tmp, &rx->demod_threads, dt_node) {
+        list_del(&cur->dt_node);
+        TSL_BUG_IF_FAILED(demod_thread_delete(&cur));
+    }
 
-    /* Grab the decimation factor and other parameters first, just to validate them. */
-    if (FAILED(ret = config_get_integer(cfg, &decimation_factor, "decimationFactor"))) {
-        decimation_factor = 1;
-        MFM_MSG(SEV_INFO, "NO-DECIMATION", "Not decimating the output signal: using full bandwidth.");
-        ret = A_E_INVAL;
-        goto done;
+    if (NULL != rx->chan) {
+        TSL_BUG_IF_FAILED(channelizer_delete(&rx->chan));
     }
 
-    if (0 >= decimation_factor) {
-        MFM_MSG(SEV_ERROR, "BAD-DECIMATION-FACTOR", "Decimation factor of '%d' is not valid.",
-                decimation_factor);
-        ret = A_E_INVAL;
-        goto done;
+    if (NULL != rx->lpf_taps) {
+        TFREE(rx->lpf_taps);
     }
 
-    /* Check that there's a filter specified */
-    if (FAILED(ret = config_get_float_array(cfg, &lpf_taps, &lpf_nr_taps, "lpfTaps"))) {
-        MFM_MSG(SEV_ERROR, "BAD-FILTER-TAPS", "Need to provide a baseband filter with at least two filter taps as 'lpfTaps'.");
-        goto done;
+    if (NULL != rx->demod_cores) {
+        TFREE(rx->demod_cores);
     }
 
-    if (1 >= lpf_nr_taps) {
-        MFM_MSG(SEV_ERROR, "INSUFF-FILTER-TAPS", "Not enough filter taps for the low-pass filter.");
-        ret = A_E_INVAL;
-        goto done;
+    pthread_mutex_destroy(&rx->demod_lock);
+
+    if (NULL != rx->samp_alloc && false == rx->samp_alloc_shared) {
+        MFM_MSG(SEV_INFO, "SAMP-BUF-USAGE", "Sample buffers: %zu of %zu in flight at most, %zu allocation failures",
+                atomic_load(&rx->samp_alloc->high_water), rx->samp_alloc->nr_bufs,
+                atomic_load(&rx->samp_alloc->nr_alloc_fails));
+        if (0 != atomic_load(&rx->samp_alloc->nr_alloc_fails)) {
+            MFM_MSG(SEV_INFO, "SAMP-BUF-HINT", "Consider increasing nrSampBufs.");
+        }
+        TSL_BUG_IF_FAILED(sample_buf_pool_delete(&rx->samp_alloc));
     }
 
-    list_init(&rx->demod_threads);
+    return ret;
+}
 
-    /* Create the demodulator threads, walking the list of channels to be processed. */
-    if (FAILED(ret = config_get(cfg, &channels, "channels"))) {
-        MFM_MSG(SEV_ERROR, "MISSING-CHANNELS", "Need to specify at least one channel to demodulate.");
-        ret = A_E_INVAL;
+aresult_t receiver_demod_pool_new(struct demod_pool **ppool, struct receiver *const *rxs, size_t nr_rxs,
+        struct config *cfg)
+{
+    aresult_t ret = A_OK;
+
+    struct demod_pool *pool = NULL;
+    struct demod_thread **demods = NULL,
+                        *dthr = NULL;
+    int *demod_nodes = NULL,
+        nr_workers = 0;
+    double *cores_cfg = NULL;
+    unsigned *cores = NULL;
+    size_t nr_cores = 0,
+           nr_demods = 0,
+           idx = 0;
+
+    TSL_ASSERT_ARG(NULL != ppool);
+    TSL_ASSERT_ARG(NULL != rxs);
+    TSL_ASSERT_ARG(0 != nr_rxs);
+    TSL_ASSERT_ARG(NULL != cfg);
+
+    *ppool = NULL;
+
+    /* Service all the channels with a fixed-size pool of threads, rather than a thread apiece */
+    if (FAILED(config_get_integer(cfg, &nr_workers, "demodWorkerThreads")) || 0 == nr_workers) {
         goto done;
     }
 
-    CONFIG_ARRAY_FOR_EACH(channel, &channels, ret, arr_ctr) {
-        const char *fifo_name = NULL,
-                   *signal_debug = NULL;
-        int nb_center_freq = -1;
-        struct demod_thread *dmt = NULL;
-        double channel_gain = 1.0,
-               channel_gain_db = 0.0;
+    if (0 > nr_workers) {
+        MFM_MSG(SEV_ERROR, "BAD-WORKER-THREADS", "Demodulator worker thread count of '%d' is not valid.",
+                nr_workers);
+        ret = A_E_INVAL;
+        goto done;
+    }
 
-        if (FAILED(ret = config_get_string(&channel, &fifo_name, "outFifo"))) {
-            MFM_MSG(SEV_ERROR, "MISSING-FIFO-ID", "Missing output FIFO filename, aborting.");
+    if (!FAILED(config_get_float_array(cfg, &cores_cfg, &nr_cores, "demodCores"))) {
+        if (FAILED(ret = TCALLOC((void **)&cores, nr_cores, sizeof(unsigned)))) {
             goto done;
         }
 
-        if (FAILED(ret = config_get_integer(&channel, &nb_center_freq, "chanCenterFreq"))) {
-            MFM_MSG(SEV_ERROR, "MISSING-CENTER-FREQ", "Missing output channel center frequency.");
-            goto done;
+        for (size_t i = 0; i < nr_cores; i++) {
+            if (0 > cores_cfg[i]) {
+                MFM_MSG(SEV_ERROR, "BAD-DEMOD-CORE", "CPU core '%f' is not valid.", cores_cfg[i]);
+                ret = A_E_INVAL;
+                goto done;
+            }
+            cores[i] = (unsigned)cores_cfg[i];
         }
+    }
 
-        if (!FAILED(ret = config_get_string(&channel, &signal_debug, "signalDebugFile"))) {
-            MFM_MSG(SEV_INFO, "WRITING-SIGNAL-DEBUG", "The channel at frequency %d will have raw I/Q written to '%s'",
-                    nb_center_freq, signal_debug);
-        }
+    for (size_t i = 0; i < nr_rxs; i++) {
+        TSL_BUG_ON(NULL != rxs[i]->pool);
+        nr_demods += rxs[i]->nr_demod_threads;
+    }
 
-        if (!FAILED(ret = config_get_float(&channel, &channel_gain_db, "dBGain"))) {
-            /* Convert the gain to linear units */
-            channel_gain = pow(10.0, channel_gain_db/10.0);
-            DIAG("Setting input channel gain to: %f (%f dB)", channel_gain, channel_gain_db);
-        }
+    if (0 == nr_demods) {
+        MFM_MSG(SEV_WARNING, "NO-DEMODS", "No channels to demodulate, not creating a worker pool.");
+        goto done;
+    }
 
-        DIAG("Center Frequency: %d Hz FIFO: %s", nb_center_freq, fifo_name);
+    if (FAILED(ret = TCALLOC((void **)&demods, nr_demods, sizeof(struct demod_thread *)))) {
+        goto done;
+    }
 
-        /* Create demodulator thread object */
-        if (FAILED(ret = demod_thread_new(&dmt, -1, (int32_t)nb_center_freq - center_freq,
-                        sample_rate, fifo_name, decimation_factor, lpf_taps, lpf_nr_taps,
-                        signal_debug,
-                        channel_gain)))
-        {
-            MFM_MSG(SEV_ERROR, "FAILED-DEMOD-THREAD", "Failed to create demodulator thread, aborting.");
-            goto done;
+    if (FAILED(ret = TCALLOC((void **)&demod_nodes, nr_demods, sizeof(int)))) {
+        goto done;
+    }
+
+    /* Keep each demodulator near the memory its receiver's sample buffers live in */
+    for (size_t i = 0; i < nr_rxs; i++) {
+        list_for_each_type(dthr, &rxs[i]->demod_threads, dt_node) {
+            TSL_BUG_ON(idx >= nr_demods);
+            demods[idx] = dthr;
+            demod_nodes[idx] = rxs[i]->samp_buf_numa_node;
+            idx++;
         }
+    }
 
-        list_init(&dmt->dt_node);
-        list_append(&rx->demod_threads, &dmt->dt_node);
-        rx->nr_demod_threads++;
+    TSL_BUG_ON(idx != nr_demods);
 
-        MFM_MSG(SEV_INFO, "CHANNEL", "[%zu]: %4.5f MHz Gain: %f dB -> [%s]%s%s",
-                rx->nr_demod_threads, (double)nb_center_freq/1e6, channel_gain_db, fifo_name,
-                (NULL != signal_debug ? " DEBUG: " : ""),
-                (NULL != signal_debug ? signal_debug : ""));
-    }
-    if (FAILED(ret)) {
-        MFM_MSG(SEV_ERROR, "CHANNEL-SETUP-FAILURE", "Error reading array of channels, aborting.");
+    if (FAILED(ret = demod_pool_new(&pool, nr_workers, demods, demod_nodes, nr_demods, cores, nr_cores))) {
+        MFM_MSG(SEV_ERROR, "FAILED-DEMOD-POOL", "Failed to create demodulator worker pool, aborting.");
         goto done;
     }
 
+    for (size_t i = 0; i < nr_rxs; i++) {
+        rxs[i]->pool = pool;
+    }
+
+    *ppool = pool;
+
 done:
-    if (NULL != lpf_taps) {
-        TFREE(lpf_taps);
+    if (NULL != cores_cfg) {
+        TFREE(cores_cfg);
+    }
+
+    if (NULL != cores) {
+        TFREE(cores);
+    }
+
+    if (NULL != demods) {
+        TFREE(demods);
+    }
+
+    if (NULL != demod_nodes) {
+        TFREE(demod_nodes);
     }
 
     return ret;
 }
 
-static
-aresult_t _receiver_worker_thread(struct worker_thread *wthr)
+aresult_t receiver_demod_pool_delete(struct demod_pool **ppool, struct receiver *const *rxs, size_t nr_rxs)
 {
-    struct receiver *rx = BL_CONTAINER_OF(wthr, struct receiver, wthr);
+    TSL_ASSERT_ARG(NULL != ppool);
+    TSL_ASSERT_ARG(NULL != rxs);
 
-    TSL_BUG_ON(NULL == rx->thread_func);
+    for (size_t i = 0; i < nr_rxs; i++) {
+        if (rxs[i]->pool == *ppool) {
+            rxs[i]->pool = NULL;
+        }
+    }
 
-    return rx->thread_func(rx);
+    if (NULL != *ppool) {
+        TSL_BUG_IF_FAILED(demod_pool_delete(ppool));
+    }
+
+    return A_OK;
 }
 
-aresult_t receiver_start(struct receiver *rx)
+bool receiver_covers(struct receiver *rx, int freq_hz)
+{
+    int64_t offset_hz = (int64_t)freq_hz - rx->center_freq_hz;
+
+    TSL_BUG_ON(NULL == rx);
+
+    return llabs(offset_hz) < (int64_t)rx->demod_sample_rate / 2;
+}
+
+aresult_t receiver_channel_add(struct receiver *rx, struct config *channel)
 {
     aresult_t ret = A_OK;
 
+    struct demod_thread *dmt = NULL;
+    int center_freq_hz = 0;
+    size_t idx = 0;
+
     TSL_ASSERT_ARG(NULL != rx);
+    TSL_ASSERT_ARG(NULL != channel);
 
-    if (FAILED(ret = worker_thread_new(&rx->wthr, _receiver_worker_thread, WORKER_THREAD_CPU_MASK_ANY))) {
-        MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start worker thread, aborting.");
+    /* Pool workers and the channelizer both work from a fixed set of channels */
+    if (NULL != rx->pool || NULL != rx->chan) {
+        MFM_MSG(SEV_ERROR, "CANT-ADD-CHANNEL", "Channels can only be added to receivers without a channelizer, "
+                "whose demodulators have their own threads.");
+        ret = A_E_BUSY;
+        goto done;
+    }
+
+    if (FAILED(ret = config_get_integer(channel, &center_freq_hz, "chanCenterFreq"))) {
+        MFM_MSG(SEV_ERROR, "MISSING-CENTER-FREQ", "Missing output channel center frequency.");
+        goto done;
+    }
+
+    if (false == receiver_covers(rx, center_freq_hz)) {
+        MFM_MSG(SEV_ERROR, "CHANNEL-OUT-OF-BAND", "Channel at %d Hz is outside the %u Hz around %d Hz this receiver covers.",
+                center_freq_hz, rx->demod_sample_rate, rx->center_freq_hz);
+        ret = A_E_INVAL;
         goto done;
     }
 
+    pthread_mutex_lock(&rx->demod_lock);
+    idx = rx->nr_demod_threads;
+    pthread_mutex_unlock(&rx->demod_lock);
+
+    /* Everything expensive happens here, while the receiver carries on delivering */
+    if (FAILED(ret = _receiver_channel_new(rx, channel, false, idx, &dmt))) {
+        goto done;
+    }
+
+    if (FAILED(ret = _receiver_channel_attach(rx, dmt))) {
+        goto done;
+    }
+
+    dmt = NULL;
+
 done:
+    if (NULL != dmt) {
+        TSL_BUG_IF_FAILED(demod_thread_delete(&dmt));
+    }
+
     return ret;
 }
 
-aresult_t receiver_cleanup(struct receiver **prx)
+aresult_t receiver_channel_remove(struct receiver *rx, int center_freq_hz)
 {
     aresult_t ret = A_OK;
 
-    struct receiver *rx = NULL;
     struct demod_thread *cur = NULL,
-                        *tmp = NULL;
+                        *found = NULL;
 
-    TSL_ASSERT_ARG(NULL != prx);
-    TSL_ASSERT_ARG(NULL != *prx);
+    TSL_ASSERT_ARG(NULL != rx);
 
-    rx = *prx;
+    pthread_mutex_lock(&rx->demod_lock);
 
-    /* Clean up the receiver state */
-    TSL_BUG_IF_FAILED(rx->cleanup_func(rx));
+    list_for_each_type(cur, &rx->demod_threads, dt_node) {
+        if (cur->center_freq_hz == center_freq_hz) {
+            found = cur;
+            break;
+        }
+    }
 
-    /* Shut down the worker thread */
-    TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&rx->wthr));
-    TSL_BUG_IF_FAILED(worker_thread_delete(&rx->wthr));
+    /* Only complain about being unable to remove a channel we actually have */
+    if (NULL != found && (NULL != rx->pool || NULL != rx->chan)) {
+        pthread_mutex_unlock(&rx->demod_lock);
+        MFM_MSG(SEV_ERROR, "CANT-REMOVE-CHANNEL", "Channels can only be removed from receivers without a channelizer, "
+                "whose demodulators have their own threads.");
+        ret = A_E_BUSY;
+        goto done;
+    }
 
-    list_for_each_type_safe(cur, tmp, &rx->demod_threads, dt_node) {
-        list_del(&cur->dt_node);
-        TSL_BUG_IF_FAILED(demod_thread_delete(&cur));
+    if (NULL != found) {
+        list_del(&found->dt_node);
+        rx->nr_demod_threads--;
+    }
+
+    pthread_mutex_unlock(&rx->demod_lock);
+
+    if (NULL == found) {
+        ret = A_E_NOTFOUND;
+        goto done;
     }
 
-    TSL_BUG_IF_FAILED(frame_alloc_delete(&rx->samp_alloc));
+    /* Nothing can deliver to it any more, so it's safe to tear down. Queued buffers are released. */
+    MFM_MSG(SEV_INFO, "CHANNEL-REMOVED", "Removed channel at %4.5f MHz", (double)center_freq_hz/1e6);
+    TSL_BUG_IF_FAILED(demod_thread_delete(&found));
 
+done:
     return ret;
 }
 
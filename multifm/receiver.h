@@ -4,10 +4,19 @@
 #include <tsl/worker_thread.h>
 #include <tsl/list.h>
 
-struct frame_alloc;
+#include <multifm/demod.h>
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct sample_buf_pool;
 struct receiver;
 struct config;
 struct sample_buf;
+struct channelizer;
+struct demod_pool;
+struct iq_recorder;
+struct receiver_setup;
 
 typedef aresult_t (*receiver_cleanup_func_t)(struct receiver *rx);
 typedef aresult_t (*receiver_rx_thread_func_t)(struct receiver *rx);
@@ -32,15 +41,151 @@ struct receiver {
      */
     size_t nr_demod_threads;
 
+    /**
+     * Protects demod_threads, nr_demod_threads and demods_started, since channels can be added
+     * and removed while the receiver is running. Held while delivering a sample buffer.
+     */
+    pthread_mutex_t demod_lock;
+
+    /**
+     * Whether receiver_start has started the demodulators. Channels linked in after this are
+     * started as they're linked.
+     */
+    bool demods_started;
+
+    /**
+     * The channels still being set up in the background, once receiver_init has returned. NULL
+     * if every channel was ready in time. See receiver_init.
+     */
+    struct receiver_setup *setup;
+
     /**
      * Number of failed sample buffer allocations
      */
     size_t nr_samp_buf_alloc_fails;
 
     /**
-     * Frame allocator of sample buffers
+     * Sequence number of the last sample buffer delivered, see receiver_sample_buf_deliver
+     */
+    uint64_t last_seq;
+
+    /**
+     * Which channels are being shed to keep the more important ones going. Only touched by the
+     * thread delivering sample buffers to the demodulators: the channelizer, if there is one,
+     * otherwise the receiver thread.
+     */
+    struct demod_shed shed;
+
+    /**
+     * Pool of sample buffers. A driver running several receivers off one device can set this
+     * before calling receiver_init, to share one receiver's pool with the others. The sharing
+     * receivers must be cleaned up before the one that owns the pool.
+     */
+    struct sample_buf_pool *samp_alloc;
+
+    /**
+     * Whether the sample buffer pool belongs to another receiver
+     */
+    bool samp_alloc_shared;
+
+    /**
+     * The number of receivers that will draw on this receiver's sample buffer pool, including
+     * itself. The pool holds nrSampBufs buffers for each. Set by the driver before calling
+     * receiver_init; 0 is treated as 1.
+     */
+    unsigned nr_samp_buf_users;
+
+    /**
+     * Configuration specific to this receiver, consulted before the process-wide configuration
+     * (i.e. the device stanza, or one RX chain of a multi-channel radio). Set by the driver before
+     * calling receiver_init, may be NULL. Only used during receiver_init, which clears it.
+     */
+    struct config *local_cfg;
+
+    /**
+     * Whether sample buffer pools for this receiver should be backed by hugepages
+     */
+    bool samp_buf_hugepages;
+
+    /**
+     * The NUMA node sample buffer pools for this receiver are allocated on, or -1 for any
+     */
+    int samp_buf_numa_node;
+
+    /**
+     * The CPU core the receiver thread is pinned to, or WORKER_THREAD_CPU_MASK_ANY
+     */
+    unsigned rx_core;
+
+    /**
+     * The rate the device delivers samples at, in Hz, before any input decimation
+     */
+    unsigned sample_rate_hz;
+
+    /**
+     * The frequency the receiver is tuned to, in Hz
+     */
+    int center_freq_hz;
+
+    /**
+     * The sample rate the demodulator threads see, and the decimation their filter applies
+     */
+    unsigned demod_sample_rate;
+    unsigned demod_decimation;
+
+    /**
+     * The channel filter prototype, kept for the channels added after receiver_init
+     */
+    double *lpf_taps;
+    size_t lpf_nr_taps;
+
+    /**
+     * If not 0, the demodulator threads filter with a multi-stage decimator (see
+     * filter/multistage_fir.h): a CIC decimating by cic_decimation, half-band stages decimating by
+     * hb_decimation, then a final FIR of cic_nr_comp_taps taps, or a length picked from the
+     * prototype if 0.
+     */
+    unsigned cic_decimation;
+    unsigned hb_decimation;
+    size_t cic_nr_comp_taps;
+
+    /**
+     * The batch size (batchSamples) and latency target in milliseconds (batchLatencyTargetMs, 0
+     * for a fixed batch size) of channels that don't set their own
+     */
+    int batch_len;
+    int batch_latency_ms;
+
+    /**
+     * CPU cores to spread the demodulator threads across, round-robin. May be NULL.
+     */
+    unsigned *demod_cores;
+    size_t nr_demod_cores;
+
+    /**
+     * Decimation the driver applies to the device samples before delivering sample buffers.
+     * Set by the driver before calling receiver_init; 0 is treated as 1. The channels see a
+     * sample rate of sampleRateHz divided by this.
+     */
+    unsigned input_decimation;
+
+    /**
+     * Shared channelizer stage, if one is configured. When present, sample buffers are
+     * delivered to the channelizer rather than directly to the demodulator threads.
+     */
+    struct channelizer *chan;
+
+    /**
+     * Worker pool servicing the demodulators, if configured. Otherwise each demodulator
+     * has its own thread. Shared by every receiver in the process, see receiver_demod_pool_new.
      */
-    struct frame_alloc *samp_alloc;
+    struct demod_pool *pool;
+
+    /**
+     * Records every delivered sample buffer to disk, if iqRecordFile is configured. Written from
+     * its own thread, so a slow disk never holds up the receiver.
+     */
+    struct iq_recorder *recorder;
 
     /**
      * The worker thread for this receiver. Mandatory, each receiver must live in
@@ -48,6 +193,12 @@ struct receiver {
      */
     struct worker_thread wthr;
 
+    /**
+     * Whether the worker thread has been started. A receiver can be cleaned up without ever
+     * being started, i.e. if another device fails to initialize.
+     */
+    bool started;
+
     /**
      * Function called to clean up the receiver state
      */
@@ -64,6 +215,12 @@ struct receiver {
  * framework. Call `receiver_start` to kick off the receiver thread. This
  * assumes receiver is already initialized with memory allocated by the driver.
  *
+ * Channels are set up on several threads at once. A receiver that can change its channels
+ * while running (see receiver_channel_add) returns as soon as its first channel is ready, so
+ * capture can start; the rest are linked in, and started, as each is ready. A channel that
+ * fails after that stops the rest from being set up, and is reported by receiver_setup_status,
+ * so a bad configuration still stops multifm.
+ *
  * \param rx The receiver structure. Preallocated, usually embedded in a specific
  *           receiver type.
  * \param cfg The configuration for the overall receiver. Includes demodulation
@@ -78,11 +235,70 @@ aresult_t receiver_init(struct receiver *rx, struct config *cfg,
         receiver_rx_thread_func_t rx_func, receiver_cleanup_func_t cleanup_func,
         size_t samples_per_buf);
 
+/**
+ * Look up an integer receiver parameter, preferring the receiver's own configuration over the
+ * process-wide configuration, the same way receiver_init does. For drivers that need a parameter
+ * (i.e. the sample rate) before calling receiver_init.
+ *
+ * \param local_cfg The receiver's own configuration. May be NULL.
+ * \param cfg The process-wide configuration
+ * \param pval The value, returned by reference
+ * \param key The key to look up
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t receiver_config_get_integer(struct config *local_cfg, struct config *cfg, int *pval, const char *key);
+
+/**
+ * Create the worker pool servicing the demodulators of all the given receivers, if the
+ * configuration asks for one (demodWorkerThreads, and optionally demodCores). Call after every
+ * receiver has been initialized, and start the pool before the receivers.
+ *
+ * \param ppool The new pool, returned by reference. Set to NULL if no pool is configured.
+ * \param rxs The receivers whose demodulators are to be serviced by the pool
+ * \param nr_rxs The number of receivers
+ * \param cfg The process-wide configuration
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t receiver_demod_pool_new(struct demod_pool **ppool, struct receiver *const *rxs, size_t nr_rxs,
+        struct config *cfg);
+
+/**
+ * Tear down the worker pool created by receiver_demod_pool_new. Must be called before the
+ * receivers are cleaned up.
+ *
+ * \param ppool The pool. Passed by reference, set to NULL on success.
+ * \param rxs The receivers serviced by the pool
+ * \param nr_rxs The number of receivers
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t receiver_demod_pool_delete(struct demod_pool **ppool, struct receiver *const *rxs, size_t nr_rxs);
+
 /**
  * Start the receiver thread.
  */
 aresult_t receiver_start(struct receiver *rx);
 
+/**
+ * Wait for every channel receiver_init left to be set up in the background.
+ *
+ * \param rx The receiver
+ *
+ * \return A_OK if every channel was set up, the error a channel failed with otherwise.
+ */
+aresult_t receiver_setup_wait(struct receiver *rx);
+
+/**
+ * Check on the channels receiver_init left to be set up in the background, without waiting.
+ *
+ * \param rx The receiver
+ *
+ * \return A_OK if no channel has failed so far, the error a channel failed with otherwise.
+ */
+aresult_t receiver_setup_status(struct receiver *rx);
+
 /**
  * Cleanup any hidden allocations in the receiver structure, and tear-down the
  * demodulation threads. Also terminates the receiver thread, and forces the 
@@ -99,19 +315,76 @@ aresult_t receiver_cleanup(struct receiver **prx);
  */
 aresult_t receiver_sample_buf_alloc(struct receiver *rx, struct sample_buf **pbuf);
 
+/**
+ * Stamp a sample buffer with the time its first sample was captured. Call as soon as the device
+ * hands over the samples, for drivers that don't get a time stamp from the device.
+ *
+ * \param rx The receiver state
+ * \param buf The sample buffer
+ * \param nr_raw_samples The number of samples the device just handed over, at the device rate
+ *                       (i.e. before any input decimation)
+ */
+void receiver_sample_buf_stamp(struct receiver *rx, struct sample_buf *buf, size_t nr_raw_samples);
+
+/**
+ * Check if a frequency is within the band this receiver's channels can be tuned to.
+ *
+ * \param rx The receiver state
+ * \param freq_hz The frequency, in Hz
+ *
+ * \return true if a channel at this frequency can be demodulated, false otherwise
+ */
+bool receiver_covers(struct receiver *rx, int freq_hz);
+
+/**
+ * Add a channel to a running receiver, without interrupting the capture. The demodulator is
+ * built and started before it is linked to the receiver, so the receiver thread only waits for
+ * the link to be made. Only receivers without a channelizer or demodulator worker pool can
+ * change their channels.
+ *
+ * \param rx The receiver state
+ * \param channel The channel configuration, in the same form as an entry in "channels"
+ *
+ * \return A_OK on success, A_E_BUSY if the receiver can't change its channels, an error code otherwise.
+ */
+aresult_t receiver_channel_add(struct receiver *rx, struct config *channel);
+
+/**
+ * Remove a channel from a running receiver. Any sample buffers queued for the channel are
+ * released.
+ *
+ * \param rx The receiver state
+ * \param center_freq_hz The center frequency of the channel, as given by chanCenterFreq
+ *
+ * \return A_OK on success, A_E_NOTFOUND if there is no such channel, A_E_BUSY if the receiver
+ *         has the channel but can't change its channels, an error code otherwise.
+ */
+aresult_t receiver_channel_remove(struct receiver *rx, int center_freq_hz);
+
 /**
  * Unmute/Mute the receiver
  */
 aresult_t receiver_set_mute(struct receiver *rx, bool mute);
 
 /**
- * Deliver a filled sample buffer to the receiver's listeners.
+ * Deliver a filled sample buffer to the receiver's listeners. The buffer is given the next
+ * sequence number, and when tracing, the time it has spent since capture is recorded.
  *
  * \param rx The receiver state
  * \param buf The buffer of samples to be delivered.
  */
 aresult_t receiver_sample_buf_deliver(struct receiver *rx, struct sample_buf *buf);
 
+/**
+ * Check if every consumer of this receiver's sample buffers has room for another one. Sources
+ * that can be paused (i.e. files) use this to slow down, rather than have buffers dropped.
+ *
+ * \param rx The receiver state
+ *
+ * \return true if a sample buffer can be delivered without being dropped, false otherwise
+ */
+bool receiver_can_deliver(struct receiver *rx);
+
 /**
  * Check if this receiver is still scheduled to be running
  *
@@ -24,6 +24,9 @@
 #include <multifm/multifm.h>
 
 #include <filter/sample_buf.h>
+#include <filter/sample_trace.h>
+#include <filter/sample_convert.h>
+#include <filter/halfband.h>
 
 #include <config/engine.h>
 
@@ -31,19 +34,17 @@
 #include <tsl/errors.h>
 #include <tsl/diag.h>
 
-#include <errno.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <string.h>
 
-#ifdef _USE_ARM_NEON
-#include <arm_neon.h>
-#endif
-
 #include <rtl-sdr.h>
 
-#define RTL_SDR_CONVERSION_SHIFT        7
+/**
+ * The default number of samples in each buffer librtlsdr hands us, unless the device sets
+ * samplesPerBuffer. USB transfers are in multiples of 512 bytes, so buffers are kept to a
+ * multiple of RTL_SDR_SAMPLES_ALIGN samples.
+ */
 #define RTL_SDR_DEFAULT_NR_SAMPLES      (16 * 32 * 512/2)
+#define RTL_SDR_SAMPLES_ALIGN           (512/2)
 
 static
 aresult_t _rtl_sdr_worker_thread_delete(struct receiver *rx)
@@ -64,10 +65,7 @@ aresult_t _rtl_sdr_worker_thread_delete(struct receiver *rx)
         thr->dev = NULL;
     }
 
-    if (0 <= thr->dump_fd) {
-        close(thr->dump_fd);
-        thr->dump_fd = -1;
-    }
+    TSL_BUG_IF_FAILED(halfband_decimator_cleanup(&thr->hb));
 
     TFREE(thr);
 
@@ -90,6 +88,8 @@ void __rtl_sdr_worker_read_async_cb(unsigned char *buf, uint32_t len, void *ctx)
     struct rtl_sdr_thread *thr = ctx;
     struct sample_buf *sbuf = NULL;
     int16_t *sbuf_ptr = NULL;
+    size_t nr_samples = 0;
+    uint64_t callback_ns = sample_trace_now_ns();
 
     if (true == thr->rx.muted) {
         DIAG("Worker is muted.");
@@ -97,61 +97,28 @@ void __rtl_sdr_worker_read_async_cb(unsigned char *buf, uint32_t len, void *ctx)
         goto done;
     }
 
-    if (0 <= thr->dump_fd) {
-        if (0 > write(thr->dump_fd, buf, len)) {
-            DIAG("Failed to write %u bytes to the RTL-SDR dump file.", len);
-        }
-    }
-
     if (FAILED(receiver_sample_buf_alloc(&thr->rx, &sbuf))) {
         goto done;
     }
 
-    sbuf_ptr = (int16_t *)sbuf->data_buf;
-
-    /* Up-convert the u8 samples to Q.15, subtract 127 from the unsigned sample to get actual power */
-#ifdef _USE_ARM_NEON
-    int16x8_t samples,
-              sub_const  = { 127, 127, 127, 127, 127, 127, 127, 127 };
-    uint8x8_t raw_samples;
-    for (size_t i = 0; i < len/8; i++) {
-        size_t offs = i * 8;
-
-        __builtin_prefetch(buf + offs);
-
-        /* Load as unsigned 8b */
-        raw_samples = vld1_u8(buf + offs);
-
-        /* Convert to s16 - we can get away with the reinterpret because all values are [0, 255] */
-        samples = vreinterpretq_s16_u16(vmovl_u8(raw_samples));
-
-        /* subtract 127 */
-        samples = vsubq_s16(samples, sub_const);
-
-        /* Shift left by 7 */
-        samples = vqshlq_n_s16(samples, RTL_SDR_CONVERSION_SHIFT);
-
-        /* Store in the output buffer at the appropriate location */
-        vst1q_s16(sbuf_ptr + offs, samples);
-    }
-
-    /* If there's a remainder because the sample count is not divisible by 8, process the remainder */
-    size_t buf_offs = len & ~(8 - 1);
+    receiver_sample_buf_stamp(&thr->rx, sbuf, len / 2);
 
-    for (size_t i = 0; i < len % 8; i++) {
-        sbuf_ptr[i + buf_offs] = ((int16_t)buf[i + buf_offs] - 127) << RTL_SDR_CONVERSION_SHIFT;
-    }
+    sbuf_ptr = (int16_t *)sbuf->data_buf;
 
-#else /* Works for any architecture */
-    for (size_t i = 0; i < len; i++) {
-        sbuf_ptr[i] = ((int16_t)buf[i] - 127) << RTL_SDR_CONVERSION_SHIFT;
-    }
-#endif
+    /*
+     * Up-convert the u8 samples to Q.15. If we're decimating, this happens a cache-sized chunk
+     * at a time on the way into the half-band filters, so only the decimated samples are written
+     * to the sample buffer.
+     */
+    TSL_BUG_IF_FAILED(halfband_decimator_process_u8(&thr->hb, buf, len / 2, sbuf_ptr, &nr_samples));
 
-    sbuf->nr_samples = len / 2;
+    sbuf->nr_samples = nr_samples;
 
     TSL_BUG_IF_FAILED(receiver_sample_buf_deliver(&thr->rx, sbuf));
 
+    /* The buffer might be gone by now, but delivering it handed out the last sequence number */
+    sample_trace_record(SAMPLE_TRACE_CALLBACK, thr->rx.last_seq, callback_ns, sample_trace_now_ns());
+
 done:
     return;
 }
@@ -167,7 +134,9 @@ aresult_t _rtl_sdr_worker_thread(struct receiver *rx)
     DIAG("Starting RTL-SDR worker thread");
 
     /* We will turn control of this thread over to libusb/librtlsdr */
-    if (0 != (rtl_ret = rtlsdr_read_async(thr->dev, __rtl_sdr_worker_read_async_cb, thr, 0, 0))) {
+    if (0 != (rtl_ret = rtlsdr_read_async(thr->dev, __rtl_sdr_worker_read_async_cb, thr, 0,
+                    thr->nr_samples * 2)))
+    {
         MFM_MSG(SEV_WARNING, "UNCLEAN-TERM", "The RTL-SDR Async Reader terminated with an error (%d).", rtl_ret);
     }
 
@@ -307,21 +276,21 @@ char *__rtl_sdr_tuner_names[] = {
  */
 aresult_t rtl_sdr_worker_thread_new(
         struct receiver **pthr,
-        struct config *cfg)
+        struct config *cfg,
+        struct config *device)
 {
     aresult_t ret = A_OK;
 
     struct rtl_sdr_thread *thr = NULL;
     struct rtlsdr_dev *dev = NULL;
-    struct config device = CONFIG_INIT_EMPTY;
-    const char *rtl_dump_file = NULL;
     int dev_idx = -1,
         rret = 0,
         ppm_corr = 0,
         rtl_ret = 0,
-        dump_file_fd = -1,
+        hb_decimation = 1,
         sample_rate = 0,
-        center_freq = 0;
+        center_freq = 0,
+        nr_samples = RTL_SDR_DEFAULT_NR_SAMPLES;
     bool test_mode = false;
     double if_gain_db = 0.0,
            gain_db = 1.0;
@@ -329,24 +298,23 @@ aresult_t rtl_sdr_worker_thread_new(
 
 
     TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(NULL != device);
     TSL_ASSERT_ARG(NULL != pthr);
 
     *pthr = NULL;
 
-    TSL_BUG_IF_FAILED(config_get(cfg, &device, "device"));
-
-    if (FAILED(ret = config_get_integer(cfg, &sample_rate, "sampleRateHz"))) {
+    if (FAILED(ret = receiver_config_get_integer(device, cfg, &sample_rate, "sampleRateHz"))) {
         MFM_MSG(SEV_INFO, "NO-SAMPLE-RATE", "Need to specify a sample rate, in Hertz.");
         goto done;
     }
 
-    if (FAILED(ret = config_get_integer(cfg, &center_freq, "centerFreqHz"))) {
+    if (FAILED(ret = receiver_config_get_integer(device, cfg, &center_freq, "centerFreqHz"))) {
         MFM_MSG(SEV_INFO, "NO-CENTER-FREQ", "You forgot to specify a center frequency, in Hz.");
         goto done;
     }
 
     /* Figure out which RTL-SDR device we want. */
-    if (FAILED(ret = config_get_integer(&device, &dev_idx, "deviceIndex"))) {
+    if (FAILED(ret = config_get_integer(device, &dev_idx, "deviceIndex"))) {
         MFM_MSG(SEV_ERROR, "NO-DEV-SPEC", "Need to specify a 'deviceIndex' entry in configuration");
         goto done;
     }
@@ -384,7 +352,7 @@ aresult_t rtl_sdr_worker_thread_new(
     }
 
     /* Set the gain, in deci-decibels */
-    if (!FAILED(config_get_float(&device, &gain_db, "dBGainLNA"))) {
+    if (!FAILED(config_get_float(device, &gain_db, "dBGainLNA"))) {
         /* Set the receiver gain based on the value in config */
         TSL_BUG_IF_FAILED(__rtl_sdr_worker_set_gain(dev, gain_db * 10));
     } else {
@@ -393,7 +361,7 @@ aresult_t rtl_sdr_worker_thread_new(
     }
 
     if (tuner_type == RTLSDR_TUNER_E4000) {
-        if (!FAILED(config_get_float(&device, &if_gain_db, "dbGainIF"))) {
+        if (!FAILED(config_get_float(device, &if_gain_db, "dbGainIF"))) {
             TSL_BUG_IF_FAILED(__rtl_sdr_worker_e4000_set_if_gain(dev, if_gain_db * 10));
         }
     }
@@ -401,7 +369,7 @@ aresult_t rtl_sdr_worker_thread_new(
     DIAG("LNA gain set to: %f", (double)rtlsdr_get_tuner_gain(dev)/10.0);
 
     /* Set the PPM correction, if specified */
-    if (FAILED(config_get_integer(&device, &ppm_corr, "ppmCorrection"))) {
+    if (FAILED(config_get_integer(device, &ppm_corr, "ppmCorrection"))) {
         ppm_corr = 0;
     }
 
@@ -416,20 +384,6 @@ aresult_t rtl_sdr_worker_thread_new(
 
     MFM_MSG(SEV_INFO, "FREQ-CORR", "Set frequency correction to %d PPM", ppm_corr);
 
-    /* Debug option: Dump the raw samples from the RTL SDR to a file on disk */
-    if (!FAILED(config_get_string(&device, &rtl_dump_file, "iqDumpFile"))) {
-        /* Open the file, exclusive */
-        if (0 > (dump_file_fd = open(rtl_dump_file, O_RDWR | O_CREAT | O_EXCL, 0666))) {
-            int errnum = errno;
-            MFM_MSG(SEV_INFO, "DUMP-FILE-FAIL", "Failed to create dump file '%s' - reason: '%s' (%d)",
-                    rtl_dump_file, strerror(errnum), errnum);
-            ret = A_E_INVAL;
-            goto done;
-        }
-        MFM_MSG(SEV_INFO, "DUMP-TO-FILE", "Dumping raw I-Q samples as 8-bit interleaved to '%s'",
-                rtl_dump_file);
-    }
-
     /* Reset the endpoint */
     TSL_BUG_ON(0 != rtlsdr_reset_buffer(dev));
 
@@ -443,6 +397,18 @@ aresult_t rtl_sdr_worker_thread_new(
         }
     }
 
+    /* Optionally decimate on the way in, so every channel sees fewer samples */
+    if (FAILED(config_get_integer(device, &hb_decimation, "halfBandDecimation"))) {
+        hb_decimation = 1;
+    }
+
+    /* Smaller buffers get samples to the channels sooner, bigger ones cost less per sample */
+    if (!FAILED(receiver_config_get_integer(device, cfg, &nr_samples, "samplesPerBuffer")) && 0 >= nr_samples) {
+        MFM_MSG(SEV_ERROR, "BAD-SAMPLES-PER-BUFFER", "samplesPerBuffer must be a positive number of samples.");
+        ret = A_E_INVAL;
+        goto done;
+    }
+
     /* Create the worker thread context */
     if (FAILED(TZAALLOC(thr, SYS_CACHE_LINE_LENGTH))) {
         ret = A_E_NOMEM;
@@ -450,27 +416,38 @@ aresult_t rtl_sdr_worker_thread_new(
     }
 
     thr->dev = dev;
-    thr->dump_fd = dump_file_fd;
+    thr->nr_samples = (nr_samples + RTL_SDR_SAMPLES_ALIGN - 1) & ~(RTL_SDR_SAMPLES_ALIGN - 1);
+
+    if (0 >= hb_decimation || FAILED(ret = halfband_decimator_init(&thr->hb, hb_decimation))) {
+        MFM_MSG(SEV_ERROR, "BAD-HALF-BAND-DECIMATION", "Half-band decimation of %d is not supported, must be "
+                "1, 2, 4 or 8.", hb_decimation);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (1 != hb_decimation) {
+        MFM_MSG(SEV_INFO, "HALF-BAND-DECIMATION", "Decimating RTL-SDR samples by %d with half-band filters",
+                hb_decimation);
+    }
+
+    thr->rx.input_decimation = hb_decimation;
+    thr->rx.local_cfg = device;
 
     /* Initialize the worker thread */
     TSL_BUG_IF_FAILED(receiver_init(&thr->rx, cfg, _rtl_sdr_worker_thread, _rtl_sdr_worker_thread_delete,
-                RTL_SDR_DEFAULT_NR_SAMPLES));
+                thr->nr_samples / hb_decimation + 1));
 
     /* The caller can start the thread at its leisure now */
     *pthr = &thr->rx;
 
 done:
     if (FAILED(ret)) {
-        if (0 <= dump_file_fd) {
-            close(dump_file_fd);
-            dump_file_fd = -1;
-        }
-
         if (NULL != dev) {
             rtlsdr_close(dev);
             dev = NULL;
         }
         if (NULL != thr) {
+            halfband_decimator_cleanup(&thr->hb);
             TFREE(thr);
         }
     }
@@ -2,6 +2,8 @@
 
 #include <multifm/receiver.h>
 
+#include <filter/halfband.h>
+
 struct rtlsdr_dev;
 struct config;
 
@@ -20,13 +22,25 @@ struct rtl_sdr_thread {
     struct rtlsdr_dev *dev;
 
     /**
-     * File descriptor to dump raw samples to
+     * Half-band decimator applied as the raw samples are converted, if any
+     */
+    struct halfband_decimator hb;
+
+    /**
+     * The number of samples librtlsdr hands us at a time, before any decimation
      */
-    int dump_fd;
+    size_t nr_samples;
 };
 
 /**
- * Create a new
+ * Create a new RTL-SDR receiver.
+ *
+ * \param pthr The new receiver, returned by reference
+ * \param cfg The process-wide configuration
+ * \param device The device stanza. Receiver parameters (i.e. centerFreqHz, channels) given here
+ *               take precedence over the process-wide configuration.
+ *
+ * \return A_OK on success, an error code otherwise.
  */
-aresult_t rtl_sdr_worker_thread_new(struct receiver **pthr, struct config *cfg);
+aresult_t rtl_sdr_worker_thread_new(struct receiver **pthr, struct config *cfg, struct config *device);
 
@@ -0,0 +1,360 @@
+/*
+ *  sample_buf_pool.c - Pool of sample buffers, optionally backed by hugepages
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/sample_buf_pool.h>
+#include <multifm/multifm.h>
+
+#include <filter/sample_buf.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SAMPLE_BUF_POOL_HUGEPAGE_SIZE       (2ul << 20)
+
+/**
+ * Marks the end of the free list
+ */
+#define SAMPLE_BUF_POOL_EMPTY               UINT32_MAX
+
+/**
+ * From the kernel's mempolicy.h; we don't want to drag in libnuma just for this
+ */
+#define SAMPLE_BUF_POOL_MPOL_PREFERRED      1
+
+static inline
+uint64_t _sample_buf_pool_head(uint32_t gen, uint32_t idx)
+{
+    return ((uint64_t)gen << 32) | idx;
+}
+
+static
+void _sample_buf_pool_push(struct sample_buf_pool *pool, uint32_t idx)
+{
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_relaxed),
+             new_head = 0;
+
+    do {
+        atomic_store_explicit(&pool->next[idx], (uint32_t)head, memory_order_relaxed);
+        new_head = _sample_buf_pool_head((uint32_t)(head >> 32) + 1, idx);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, new_head,
+                memory_order_release, memory_order_relaxed));
+}
+
+static
+uint32_t _sample_buf_pool_pop(struct sample_buf_pool *pool)
+{
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_acquire),
+             new_head = 0;
+    uint32_t idx = 0;
+
+    do {
+        idx = (uint32_t)head;
+
+        if (SAMPLE_BUF_POOL_EMPTY == idx) {
+            break;
+        }
+
+        /* If another thread got here first, next may be stale, but then the generation will have moved on */
+        new_head = _sample_buf_pool_head((uint32_t)(head >> 32) + 1,
+                atomic_load_explicit(&pool->next[idx], memory_order_relaxed));
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, new_head,
+                memory_order_acquire, memory_order_acquire));
+
+    return idx;
+}
+
+static
+aresult_t _sample_buf_pool_release(struct sample_buf *buf)
+{
+    TSL_BUG_ON(NULL == buf);
+    TSL_BUG_ON(atomic_load(&buf->refcount) != 0);
+
+    return sample_buf_pool_free(buf->priv, buf);
+}
+
+/**
+ * Map the pool's memory, placing it on the given NUMA node, and fault it all in now.
+ */
+static
+aresult_t _sample_buf_pool_map(struct sample_buf_pool *pool, size_t len, bool use_hugepages, int numa_node)
+{
+    aresult_t ret = A_OK;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *region = MAP_FAILED;
+
+    /* The memory policy has to be set before the pages are faulted in */
+    if (0 > numa_node) {
+        flags |= MAP_POPULATE;
+    }
+
+    if (true == use_hugepages) {
+        size_t huge_len = (len + SAMPLE_BUF_POOL_HUGEPAGE_SIZE - 1) & ~(SAMPLE_BUF_POOL_HUGEPAGE_SIZE - 1);
+
+        if (MAP_FAILED != (region = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0))) {
+            pool->hugepages = true;
+            len = huge_len;
+        } else {
+            int errnum = errno;
+            MFM_MSG(SEV_WARNING, "NO-HUGEPAGES", "Unable to map %zu bytes of hugepages for sample buffers: %s (%d). "
+                    "Falling back to regular pages.", huge_len, strerror(errnum), errnum);
+        }
+    }
+
+    if (MAP_FAILED == region) {
+        if (MAP_FAILED == (region = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0))) {
+            int errnum = errno;
+            MFM_MSG(SEV_FATAL, "NO-MEM", "Unable to map %zu bytes for sample buffers: %s (%d)",
+                    len, strerror(errnum), errnum);
+            ret = A_E_NOMEM;
+            goto done;
+        }
+    }
+
+    pool->region = region;
+    pool->region_len = len;
+
+    if (0 <= numa_node) {
+        unsigned long node_mask[4] = { 0 };
+
+        if ((size_t)numa_node >= sizeof(node_mask) * 8) {
+            MFM_MSG(SEV_ERROR, "BAD-NUMA-NODE", "NUMA node %d is out of range.", numa_node);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        node_mask[numa_node / (sizeof(unsigned long) * 8)] |= 1ul << (numa_node % (sizeof(unsigned long) * 8));
+
+        if (0 > syscall(SYS_mbind, region, len, SAMPLE_BUF_POOL_MPOL_PREFERRED, node_mask,
+                    sizeof(node_mask) * 8, 0))
+        {
+            int errnum = errno;
+            MFM_MSG(SEV_WARNING, "CANT-SET-NUMA-NODE", "Unable to place sample buffers on NUMA node %d: %s (%d)",
+                    numa_node, strerror(errnum), errnum);
+        }
+
+        /* Now fault everything in, on the preferred node */
+        memset(region, 0, len);
+    }
+
+    if (0 > mlock(region, len)) {
+        int errnum = errno;
+        MFM_MSG(SEV_WARNING, "CANT-MLOCK", "Unable to lock %zu bytes of sample buffers in memory: %s (%d). "
+                "Check RLIMIT_MEMLOCK.", len, strerror(errnum), errnum);
+    } else {
+        pool->locked = true;
+    }
+
+done:
+    return ret;
+}
+
+aresult_t sample_buf_pool_new(struct sample_buf_pool **ppool, size_t buf_bytes, size_t nr_bufs,
+        bool use_hugepages, int numa_node)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf_pool *pool = NULL;
+
+    TSL_ASSERT_ARG(NULL != ppool);
+    TSL_ASSERT_ARG(sizeof(struct sample_buf) <= buf_bytes);
+    TSL_ASSERT_ARG(0 != nr_bufs);
+    TSL_ASSERT_ARG(SAMPLE_BUF_POOL_EMPTY > nr_bufs);
+
+    *ppool = NULL;
+
+    if (FAILED(ret = TZAALLOC(pool, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    pool->nr_bufs = nr_bufs;
+    pool->buf_stride = (buf_bytes + SYS_CACHE_LINE_LENGTH - 1) & ~((size_t)SYS_CACHE_LINE_LENGTH - 1);
+
+    if (FAILED(ret = TCALLOC((void **)&pool->next, nr_bufs, sizeof(_Atomic uint32_t)))) {
+        goto done;
+    }
+
+    if (FAILED(ret = _sample_buf_pool_map(pool, pool->buf_stride * nr_bufs, use_hugepages, numa_node))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_bufs; i++) {
+        atomic_init(&pool->next[i], i + 1 == nr_bufs ? SAMPLE_BUF_POOL_EMPTY : (uint32_t)(i + 1));
+    }
+
+    atomic_init(&pool->free_head, _sample_buf_pool_head(0, 0));
+    atomic_init(&pool->nr_in_flight, 0);
+    atomic_init(&pool->high_water, 0);
+    atomic_init(&pool->nr_alloc_fails, 0);
+
+    MFM_MSG(SEV_INFO, "SAMPLE-BUF-POOL", "%zu sample buffers of %zu bytes (%zu bytes total%s%s)",
+            nr_bufs, buf_bytes, pool->region_len,
+            pool->hugepages ? ", hugepages" : "",
+            pool->locked ? ", locked" : "");
+
+    *ppool = pool;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != pool) {
+            if (NULL != pool->region) {
+                munmap(pool->region, pool->region_len);
+            }
+
+            if (NULL != pool->next) {
+                TFREE(pool->next);
+            }
+
+            TFREE(pool);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t sample_buf_pool_alloc(struct sample_buf_pool *pool, struct sample_buf **pbuf)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf *buf = NULL;
+    uint32_t idx = 0;
+    size_t nr_in_flight = 0,
+           high_water = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != pool);
+    TSL_ASSERT_ARG_DEBUG(NULL != pbuf);
+
+    *pbuf = NULL;
+
+    if (SAMPLE_BUF_POOL_EMPTY == (idx = _sample_buf_pool_pop(pool))) {
+        atomic_fetch_add_explicit(&pool->nr_alloc_fails, 1, memory_order_relaxed);
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    /* Track the high water mark, so the pool can be sized from real usage */
+    nr_in_flight = atomic_fetch_add_explicit(&pool->nr_in_flight, 1, memory_order_relaxed) + 1;
+    high_water = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+    while (nr_in_flight > high_water &&
+            !atomic_compare_exchange_weak_explicit(&pool->high_water, &high_water, nr_in_flight,
+                memory_order_relaxed, memory_order_relaxed));
+
+    buf = (struct sample_buf *)(pool->region + (size_t)idx * pool->buf_stride);
+    buf->release = _sample_buf_pool_release;
+    buf->priv = pool;
+
+    *pbuf = buf;
+
+done:
+    return ret;
+}
+
+aresult_t sample_buf_pool_free(struct sample_buf_pool *pool, struct sample_buf *buf)
+{
+    aresult_t ret = A_OK;
+
+    size_t offs = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != pool);
+    TSL_ASSERT_ARG_DEBUG(NULL != buf);
+
+    offs = (uint8_t *)buf - pool->region;
+
+    TSL_BUG_ON(offs >= pool->buf_stride * pool->nr_bufs);
+    TSL_BUG_ON(0 != offs % pool->buf_stride);
+
+    atomic_fetch_sub_explicit(&pool->nr_in_flight, 1, memory_order_relaxed);
+
+    _sample_buf_pool_push(pool, offs / pool->buf_stride);
+
+    return ret;
+}
+
+aresult_t sample_buf_pool_delete(struct sample_buf_pool **ppool)
+{
+    aresult_t ret = A_OK;
+
+    struct sample_buf_pool *pool = NULL;
+
+    TSL_ASSERT_ARG(NULL != ppool);
+    TSL_ASSERT_ARG(NULL != *ppool);
+
+    pool = *ppool;
+
+    if (0 != atomic_load(&pool->nr_in_flight)) {
+        MFM_MSG(SEV_WARNING, "SAMPLE-BUFS-IN-FLIGHT", "Destroying sample buffer pool with %zu buffers still in use.",
+                atomic_load(&pool->nr_in_flight));
+    }
+
+    if (NULL != pool->region) {
+        munmap(pool->region, pool->region_len);
+    }
+
+    if (NULL != pool->next) {
+        TFREE(pool->next);
+    }
+
+    TFREE(pool);
+
+    *ppool = NULL;
+
+    return ret;
+}
+
+int sample_buf_pool_cpu_node(unsigned cpu)
+{
+    char path[64];
+    DIR *dir = NULL;
+    struct dirent *ent = NULL;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+
+    if (NULL == (dir = opendir(path))) {
+        goto done;
+    }
+
+    /* The CPU's directory has a nodeN link for the NUMA node it belongs to */
+    while (NULL != (ent = readdir(dir))) {
+        if (!strncmp(ent->d_name, "node", 4) && '\0' != ent->d_name[4]) {
+            node = atoi(&ent->d_name[4]);
+            break;
+        }
+    }
+
+    closedir(dir);
+
+done:
+    return node;
+}
+
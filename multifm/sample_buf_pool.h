@@ -0,0 +1,124 @@
+#pragma once
+
+#include <tsl/cal.h>
+#include <tsl/result.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct sample_buf;
+
+/**
+ * A fixed-size pool of sample buffers, carved out of a single mapping that is touched and
+ * locked at startup. Optionally backed by hugepages, and placed on a particular NUMA node.
+ * Buffers can be allocated and released from any thread without taking a lock.
+ */
+struct sample_buf_pool {
+    /**
+     * Head of the free list: the index of the first free buffer in the low 32 bits, and a
+     * generation count in the high 32 bits, to avoid ABA.
+     */
+    _Atomic uint64_t free_head CAL_CACHE_ALIGNED;
+
+    /**
+     * The number of buffers currently allocated
+     */
+    atomic_size_t nr_in_flight CAL_CACHE_ALIGNED;
+
+    /**
+     * The most buffers that have ever been allocated at once
+     */
+    atomic_size_t high_water;
+
+    /**
+     * The number of allocations that failed because the pool was empty
+     */
+    atomic_size_t nr_alloc_fails;
+
+    /**
+     * For each buffer, the index of the next buffer in the free list
+     */
+    _Atomic uint32_t *next;
+
+    /**
+     * The mapping holding all the buffers
+     */
+    uint8_t *region;
+
+    /**
+     * Length of the mapping, in bytes
+     */
+    size_t region_len;
+
+    /**
+     * Distance between the start of consecutive buffers, in bytes
+     */
+    size_t buf_stride;
+
+    /**
+     * The number of buffers in the pool
+     */
+    size_t nr_bufs;
+
+    /**
+     * Whether or not the mapping is backed by hugepages
+     */
+    bool hugepages;
+
+    /**
+     * Whether or not the mapping is locked in memory
+     */
+    bool locked;
+};
+
+/**
+ * Create a new sample buffer pool.
+ *
+ * \param ppool The new pool, returned by reference
+ * \param buf_bytes The size of each buffer, including the struct sample_buf header
+ * \param nr_bufs The number of buffers in the pool
+ * \param use_hugepages Try to back the pool with 2MB hugepages. Falls back to regular pages,
+ *                      with a warning, if none are available.
+ * \param numa_node The NUMA node to allocate the pool on, or -1 for the default policy
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_buf_pool_new(struct sample_buf_pool **ppool, size_t buf_bytes, size_t nr_bufs,
+        bool use_hugepages, int numa_node);
+
+/**
+ * Allocate a sample buffer from the pool. The buffer's release function and private data are
+ * set up so that sample_buf_decref returns it to the pool.
+ *
+ * \param pool The pool
+ * \param pbuf The buffer, returned by reference
+ *
+ * \return A_OK on success, A_E_NOMEM if the pool is empty.
+ */
+aresult_t sample_buf_pool_alloc(struct sample_buf_pool *pool, struct sample_buf **pbuf);
+
+/**
+ * Return a sample buffer to the pool, without going through its reference count.
+ */
+aresult_t sample_buf_pool_free(struct sample_buf_pool *pool, struct sample_buf *buf);
+
+/**
+ * Destroy a sample buffer pool. All buffers must have been returned to the pool.
+ *
+ * \param ppool The pool, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t sample_buf_pool_delete(struct sample_buf_pool **ppool);
+
+/**
+ * Look up the NUMA node a CPU belongs to.
+ *
+ * \param cpu The CPU
+ *
+ * \return The NUMA node, or -1 if it can't be determined.
+ */
+int sample_buf_pool_cpu_node(unsigned cpu);
+
@@ -0,0 +1,164 @@
+/*
+ *  spsc_ring.c - Lock-free single producer, single consumer ring with sleeping consumers
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/spsc_ring.h>
+#include <multifm/multifm.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+aresult_t spsc_ring_init(struct spsc_ring *ring, size_t nr_slots)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != ring);
+    TSL_ASSERT_ARG(0 != nr_slots);
+    TSL_ASSERT_ARG(0 == (nr_slots & (nr_slots - 1)));
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->waiting, false);
+    ring->nr_wakeups = 0;
+    ring->mask = nr_slots - 1;
+    ring->slots = NULL;
+
+    if (0 > (ring->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "CANT-CREATE-EVENTFD", "Failed to create eventfd for ring: %s (%d)",
+                strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&ring->slots, nr_slots, sizeof(void *)))) {
+        goto done;
+    }
+
+done:
+    if (FAILED(ret)) {
+        if (0 <= ring->wake_fd) {
+            close(ring->wake_fd);
+            ring->wake_fd = -1;
+        }
+    }
+
+    return ret;
+}
+
+aresult_t spsc_ring_cleanup(struct spsc_ring *ring)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != ring);
+
+    if (NULL != ring->slots) {
+        TFREE(ring->slots);
+    }
+
+    if (0 <= ring->wake_fd) {
+        close(ring->wake_fd);
+        ring->wake_fd = -1;
+    }
+
+    return ret;
+}
+
+aresult_t spsc_ring_wake(struct spsc_ring *ring)
+{
+    aresult_t ret = A_OK;
+
+    uint64_t one = 1;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+
+    ring->nr_wakeups++;
+
+    /* If the counter would overflow, the consumer has plenty of wakeups pending already */
+    if (0 > write(ring->wake_fd, &one, sizeof(one)) && EAGAIN != errno) {
+        int errnum = errno;
+        PANIC("Failed to wake ring consumer. Reason: %s (%d)", strerror(errnum), errnum);
+    }
+
+    return ret;
+}
+
+bool spsc_ring_prepare_wait(struct spsc_ring *ring)
+{
+    TSL_BUG_ON(NULL == ring);
+
+    atomic_store_explicit(&ring->waiting, true, memory_order_relaxed);
+
+    /* Pairs with the fence in spsc_ring_push */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    /* Make sure nothing arrived while we were getting ready to sleep */
+    return spsc_ring_empty(ring);
+}
+
+aresult_t spsc_ring_finish_wait(struct spsc_ring *ring)
+{
+    aresult_t ret = A_OK;
+
+    uint64_t count = 0;
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+
+    atomic_store_explicit(&ring->waiting, false, memory_order_relaxed);
+
+    /* Drain any pending wakeups; spurious wakeups are harmless */
+    if (0 > read(ring->wake_fd, &count, sizeof(count)) && EAGAIN != errno) {
+        int errnum = errno;
+        PANIC("Failed to read ring eventfd. Reason: %s (%d)", strerror(errnum), errnum);
+    }
+
+    return ret;
+}
+
+aresult_t spsc_ring_wait(struct spsc_ring *ring, int timeout_ms)
+{
+    aresult_t ret = A_OK;
+
+    struct pollfd pfd = { .fd = ring->wake_fd, .events = POLLIN };
+
+    TSL_ASSERT_ARG_DEBUG(NULL != ring);
+
+    if (true == spsc_ring_prepare_wait(ring)) {
+        if (0 > poll(&pfd, 1, timeout_ms)) {
+            int errnum = errno;
+            if (EINTR != errnum) {
+                PANIC("Failed to wait on ring eventfd. Reason: %s (%d)", strerror(errnum), errnum);
+            }
+        }
+    }
+
+    TSL_BUG_IF_FAILED(spsc_ring_finish_wait(ring));
+
+    return ret;
+}
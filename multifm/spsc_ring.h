@@ -0,0 +1,183 @@
+#pragma once
+
+#include <tsl/result.h>
+#include <tsl/cal.h>
+#include <tsl/errors.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A lock-free single-producer, single-consumer ring of pointers. The consumer only sleeps
+ * (on an eventfd) when it has found the ring empty, and the producer only makes a system call
+ * to wake it if it has actually gone to sleep. While the consumer is busy, the producer can
+ * push any number of items without entering the kernel.
+ */
+struct spsc_ring {
+    /**
+     * The index of the next slot to be consumed. Only written by the consumer.
+     */
+    atomic_size_t head CAL_CACHE_ALIGNED;
+
+    /**
+     * The index of the next slot to be filled. Only written by the producer.
+     */
+    atomic_size_t tail CAL_CACHE_ALIGNED;
+
+    /**
+     * Set by the consumer when it is about to sleep waiting for the ring to be filled.
+     */
+    atomic_bool waiting CAL_CACHE_ALIGNED;
+
+    /**
+     * The number of times the producer had to wake the consumer
+     */
+    size_t nr_wakeups;
+
+    /**
+     * The eventfd the consumer sleeps on
+     */
+    int wake_fd;
+
+    /**
+     * The number of slots, less one. The number of slots is always a power of 2.
+     */
+    size_t mask;
+
+    /**
+     * The ring slots
+     */
+    void **slots;
+};
+
+/**
+ * Initialize a SPSC ring.
+ *
+ * \param ring The ring to initialize
+ * \param nr_slots The number of slots in the ring. Must be a power of 2.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t spsc_ring_init(struct spsc_ring *ring, size_t nr_slots);
+
+/**
+ * Release the resources held by a SPSC ring. Any items still in the ring are discarded; it
+ * is up to the caller to drain the ring first, if needed.
+ */
+aresult_t spsc_ring_cleanup(struct spsc_ring *ring);
+
+/**
+ * Wake the consumer of the ring. Called by spsc_ring_push, only when the consumer is
+ * waiting.
+ */
+aresult_t spsc_ring_wake(struct spsc_ring *ring);
+
+/**
+ * Announce the consumer is about to sleep, for consumers waiting on more than one ring at a
+ * time (i.e. by polling wake_fd for several rings). The consumer must not sleep if this
+ * returns false, and must call spsc_ring_finish_wait once it wakes up, either way.
+ *
+ * \return true if the ring is still empty and it is safe to sleep, false otherwise.
+ */
+bool spsc_ring_prepare_wait(struct spsc_ring *ring);
+
+/**
+ * Finish waiting on a ring, clearing the waiting state and any pending wakeups.
+ */
+aresult_t spsc_ring_finish_wait(struct spsc_ring *ring);
+
+/**
+ * Wait for the ring to have at least one item in it, or the timeout to elapse. Must only be
+ * called by the consumer.
+ *
+ * \param ring The ring
+ * \param timeout_ms The longest time to wait, in milliseconds
+ *
+ * \return A_OK on success, an error code otherwise. Returning successfully does not guarantee
+ *         the ring is not empty.
+ */
+aresult_t spsc_ring_wait(struct spsc_ring *ring, int timeout_ms);
+
+/**
+ * Push an item on to the ring, waking the consumer if it is sleeping. Must only be called by
+ * the producer.
+ *
+ * \param ring The ring
+ * \param item The item to push. Must not be NULL.
+ *
+ * \return A_OK on success, A_E_BUSY if the ring is full.
+ */
+static inline
+aresult_t spsc_ring_push(struct spsc_ring *ring, void *item)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed),
+           head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail - head > ring->mask) {
+        return A_E_BUSY;
+    }
+
+    ring->slots[tail & ring->mask] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    /* Pairs with the fence in spsc_ring_prepare_wait: either we see the consumer waiting, or it sees our item */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&ring->waiting, memory_order_relaxed)) {
+        return spsc_ring_wake(ring);
+    }
+
+    return A_OK;
+}
+
+/**
+ * Pop an item from the ring. Must only be called by the consumer.
+ *
+ * \param ring The ring
+ * \param pitem The item, returned by reference. Set to NULL if the ring is empty.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+static inline
+aresult_t spsc_ring_pop(struct spsc_ring *ring, void **pitem)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed),
+           tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    *pitem = NULL;
+
+    if (head == tail) {
+        return A_OK;
+    }
+
+    *pitem = ring->slots[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return A_OK;
+}
+
+/**
+ * Check if the ring is empty. Only meaningful when called by the consumer.
+ */
+static inline
+bool spsc_ring_empty(struct spsc_ring *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_relaxed) ==
+        atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/**
+ * Get the number of items waiting in the ring. Can be called from any thread, but is only a
+ * snapshot, which may already be stale.
+ */
+static inline
+size_t spsc_ring_depth(struct spsc_ring *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed),
+           tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    /* The two loads aren't atomic together, so the consumer may appear to be ahead */
+    return tail - head > ring->mask + 1 ? 0 : tail - head;
+}
+
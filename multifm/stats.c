@@ -0,0 +1,480 @@
+/*
+ *  stats.c - Runtime counters for the receiver and demodulators, exported over a UNIX socket
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <multifm/stats.h>
+#include <multifm/receiver.h>
+#include <multifm/demod.h>
+#include <multifm/channelizer.h>
+#include <multifm/sample_buf_pool.h>
+#include <multifm/spsc_ring.h>
+#include <multifm/multifm.h>
+
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/list.h>
+#include <tsl/safe_alloc.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * How often the stats thread wakes up to update the sample rates, in milliseconds
+ */
+#define STATS_SAMPLE_INTERVAL_MS        1000
+
+/**
+ * The longest we'll wait on a client that isn't reading its stats, in milliseconds
+ */
+#define STATS_CLIENT_TIMEOUT_MS         1000
+
+static
+void _stats_server_dump_pool(FILE *fp, struct sample_buf_pool *pool)
+{
+    if (NULL == pool) {
+        fprintf(fp, "null");
+        return;
+    }
+
+    fprintf(fp, "{\"inFlight\":%zu,\"highWater\":%zu,\"total\":%zu,\"allocFails\":%zu}",
+            atomic_load_explicit(&pool->nr_in_flight, memory_order_relaxed),
+            atomic_load_explicit(&pool->high_water, memory_order_relaxed),
+            pool->nr_bufs,
+            atomic_load_explicit(&pool->nr_alloc_fails, memory_order_relaxed));
+}
+
+/**
+ * A copy of one channel's counters, taken under the receiver's demod_lock
+ */
+struct stats_channel_snapshot {
+    int offset_hz;
+    size_t queue_depth;
+    double demod_sample_rate;
+    uint64_t nr_bufs;
+    uint64_t nr_demod_samples;
+    uint64_t nr_pcm_samples;
+    uint64_t total_process_ns;
+    uint64_t max_process_ns;
+    uint64_t nr_dropped_samples;
+    uint64_t nr_ring_full_drops;
+    uint64_t nr_gated_samples;
+    uint64_t batch_len;
+    enum demod_priority priority;
+    uint64_t nr_shed_bufs;
+    uint64_t nr_filter_drops;
+};
+
+/**
+ * Copy the counters of every channel on a receiver into the scratch snapshots. The lock is only
+ * held while copying: the capture thread takes it for every buffer it delivers, so nothing that
+ * can block (like writing to a client) may happen under it.
+ *
+ * \return The number of channels copied
+ */
+static
+size_t _stats_server_snapshot(struct stats_server *srv, struct receiver *rx)
+{
+    struct demod_thread *dthr = NULL;
+    size_t nr_snaps = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&rx->demod_lock);
+
+        nr_snaps = 0;
+
+        list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+            nr_snaps++;
+        }
+
+        if (nr_snaps <= srv->nr_snaps_max) {
+            break;
+        }
+
+        /* Channels were added since we last grew, so make room without the lock held */
+        pthread_mutex_unlock(&rx->demod_lock);
+
+        if (NULL != srv->snaps) {
+            TFREE(srv->snaps);
+            srv->nr_snaps_max = 0;
+        }
+
+        if (FAILED(TCALLOC((void **)&srv->snaps, nr_snaps, sizeof(struct stats_channel_snapshot)))) {
+            return 0;
+        }
+
+        srv->nr_snaps_max = nr_snaps;
+    }
+
+    nr_snaps = 0;
+
+    list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+        struct demod_stats *st = &dthr->stats;
+        struct stats_channel_snapshot *snap = &srv->snaps[nr_snaps++];
+
+        snap->offset_hz = dthr->offset_hz;
+        snap->queue_depth = spsc_ring_depth(&dthr->ring);
+        snap->demod_sample_rate = st->demod_sample_rate;
+        snap->nr_bufs = stats_counter_read(&st->nr_bufs);
+        snap->nr_demod_samples = stats_counter_read(&st->nr_demod_samples);
+        snap->nr_pcm_samples = stats_counter_read(&st->nr_pcm_samples);
+        snap->total_process_ns = stats_counter_read(&st->total_process_ns);
+        snap->max_process_ns = stats_counter_read(&st->max_process_ns);
+        snap->nr_dropped_samples = stats_counter_read(&st->nr_dropped_samples);
+        snap->nr_ring_full_drops = stats_counter_read(&st->nr_ring_full_drops);
+        snap->nr_gated_samples = stats_counter_read(&st->nr_gated_samples);
+        snap->batch_len = stats_counter_read(&st->batch_len);
+        snap->priority = dthr->priority;
+        snap->nr_shed_bufs = stats_counter_read(&st->nr_shed_bufs);
+        snap->nr_filter_drops = stats_counter_read(&st->nr_filter_drops);
+    }
+
+    pthread_mutex_unlock(&rx->demod_lock);
+
+    return nr_snaps;
+}
+
+/**
+ * Write the current state of all counters, as a single line JSON document.
+ */
+static
+void _stats_server_dump(struct stats_server *srv, FILE *fp)
+{
+    fprintf(fp, "{\"receivers\":[");
+
+    for (size_t i = 0; i < srv->nr_rxs; i++) {
+        struct receiver *rx = srv->rxs[i];
+        size_t nr_snaps = 0;
+
+        fprintf(fp, "%s{\"sampBufs\":", 0 == i ? "" : ",");
+        _stats_server_dump_pool(fp, rx->samp_alloc);
+
+        if (NULL != rx->chan) {
+            fprintf(fp, ",\"channelizer\":{\"queueDepth\":%zu,\"sampBufs\":", spsc_ring_depth(&rx->chan->ring));
+            _stats_server_dump_pool(fp, rx->chan->samp_alloc);
+            fprintf(fp, "}");
+        }
+
+        fprintf(fp, ",\"channels\":[");
+
+        nr_snaps = _stats_server_snapshot(srv, rx);
+
+        for (size_t j = 0; j < nr_snaps; j++) {
+            struct stats_channel_snapshot *snap = &srv->snaps[j];
+
+            fprintf(fp, "%s{\"offsetHz\":%d,\"queueDepth\":%zu,\"samplesPerSec\":%.0f,"
+                    "\"buffers\":%" PRIu64 ",\"demodSamples\":%" PRIu64 ",\"pcmSamples\":%" PRIu64 ","
+                    "\"avgProcessUs\":%.1f,\"maxProcessUs\":%.1f,"
+                    "\"droppedPcmSamples\":%" PRIu64 ",\"ringFullDrops\":%" PRIu64 ",\"gatedSamples\":%" PRIu64 ","
+                    "\"batchSamples\":%" PRIu64 ",\"priority\":%d,\"shedBufs\":%" PRIu64 ",\"filterDrops\":%" PRIu64 "}",
+                    0 == j ? "" : ",",
+                    snap->offset_hz,
+                    snap->queue_depth,
+                    snap->demod_sample_rate,
+                    snap->nr_bufs,
+                    snap->nr_demod_samples,
+                    snap->nr_pcm_samples,
+                    0 == snap->nr_bufs ? 0.0 : (double)snap->total_process_ns / (double)snap->nr_bufs / 1000.0,
+                    (double)snap->max_process_ns / 1000.0,
+                    snap->nr_dropped_samples,
+                    snap->nr_ring_full_drops,
+                    snap->nr_gated_samples,
+                    snap->batch_len,
+                    (int)snap->priority,
+                    snap->nr_shed_bufs,
+                    snap->nr_filter_drops);
+        }
+
+        fprintf(fp, "]}");
+    }
+
+    fprintf(fp, "]}\n");
+}
+
+/**
+ * Recalculate the per-channel sample rates, from the change in counters since the last update.
+ */
+static
+void _stats_server_sample(struct stats_server *srv, uint64_t now_ns)
+{
+    double elapsed = (double)(now_ns - srv->last_sample_ns) / 1e9;
+
+    for (size_t i = 0; i < srv->nr_rxs; i++) {
+        struct receiver *rx = srv->rxs[i];
+        struct demod_thread *dthr = NULL;
+
+        pthread_mutex_lock(&rx->demod_lock);
+
+        list_for_each_type(dthr, &rx->demod_threads, dt_node) {
+            struct demod_stats *st = &dthr->stats;
+            uint64_t nr_samples = stats_counter_read(&st->nr_demod_samples);
+
+            st->demod_sample_rate = (double)(nr_samples - st->last_demod_samples) / elapsed;
+            st->last_demod_samples = nr_samples;
+        }
+
+        pthread_mutex_unlock(&rx->demod_lock);
+    }
+
+    srv->last_sample_ns = now_ns;
+}
+
+static
+void _stats_server_serve_client(struct stats_server *srv)
+{
+    int client_fd = -1;
+    FILE *fp = NULL;
+    struct timeval tv = {
+        .tv_sec = STATS_CLIENT_TIMEOUT_MS / 1000,
+        .tv_usec = (STATS_CLIENT_TIMEOUT_MS % 1000) * 1000,
+    };
+
+    if (0 > (client_fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC))) {
+        int errnum = errno;
+        if (EAGAIN != errnum && EINTR != errnum) {
+            MFM_MSG(SEV_WARNING, "STATS-ACCEPT-FAILED", "Failed to accept stats client: %s (%d)",
+                    strerror(errnum), errnum);
+        }
+        goto done;
+    }
+
+    /* Don't let a client that never reads stall the stats thread */
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (NULL == (fp = fdopen(client_fd, "w"))) {
+        close(client_fd);
+        goto done;
+    }
+
+    _stats_server_dump(srv, fp);
+    fclose(fp);
+
+done:
+    return;
+}
+
+static
+aresult_t _stats_server_thread(struct worker_thread *wthr)
+{
+    aresult_t ret = A_OK;
+
+    struct stats_server *srv = BL_CONTAINER_OF(wthr, struct stats_server, wthr);
+
+    while (worker_thread_is_running(wthr)) {
+        struct pollfd pfd = { .fd = srv->listen_fd, .events = POLLIN };
+        uint64_t now_ns = 0;
+        int nr_ready = 0;
+
+        nr_ready = poll(&pfd, -1 == srv->listen_fd ? 0 : 1, STATS_SAMPLE_INTERVAL_MS);
+
+        now_ns = stats_now_ns();
+
+        if (now_ns - srv->last_sample_ns >= STATS_SAMPLE_INTERVAL_MS * 1000000ull) {
+            _stats_server_sample(srv, now_ns);
+        }
+
+        if (0 != srv->log_interval_secs &&
+                now_ns - srv->last_log_ns >= srv->log_interval_secs * 1000000000ull)
+        {
+            _stats_server_dump(srv, stderr);
+            srv->last_log_ns = now_ns;
+        }
+
+        if (0 < nr_ready && (pfd.revents & POLLIN)) {
+            _stats_server_serve_client(srv);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Create the listening socket for the stats server, replacing anything already at the path.
+ */
+static
+aresult_t _stats_server_listen(struct stats_server *srv, const char *sock_path)
+{
+    aresult_t ret = A_OK;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    size_t path_len = strlen(sock_path);
+
+    if (path_len >= sizeof(addr.sun_path)) {
+        MFM_MSG(SEV_ERROR, "STATS-PATH-TOO-LONG", "Stats socket path '%s' is too long.", sock_path);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    memcpy(addr.sun_path, sock_path, path_len + 1);
+
+    if (FAILED(ret = TCALLOC((void **)&srv->sock_path, path_len + 1, 1))) {
+        goto done;
+    }
+
+    memcpy(srv->sock_path, sock_path, path_len + 1);
+
+    if (0 > (srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "STATS-SOCKET-FAILED", "Unable to create stats socket: %s (%d)",
+                strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    unlink(sock_path);
+
+    if (0 > bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "STATS-BIND-FAILED", "Unable to bind stats socket to '%s': %s (%d)",
+                sock_path, strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (0 > listen(srv->listen_fd, 8)) {
+        int errnum = errno;
+        MFM_MSG(SEV_ERROR, "STATS-LISTEN-FAILED", "Unable to listen on stats socket: %s (%d)",
+                strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    MFM_MSG(SEV_INFO, "STATS-SOCKET", "Serving stats on '%s'", sock_path);
+
+done:
+    return ret;
+}
+
+aresult_t stats_server_new(struct stats_server **psrv, struct receiver *const *rxs, size_t nr_rxs,
+        const char *sock_path, unsigned log_interval_secs)
+{
+    aresult_t ret = A_OK;
+
+    struct stats_server *srv = NULL;
+
+    TSL_ASSERT_ARG(NULL != psrv);
+    TSL_ASSERT_ARG(NULL != rxs);
+    TSL_ASSERT_ARG(0 != nr_rxs);
+    TSL_ASSERT_ARG((NULL != sock_path && '\0' != *sock_path) || 0 != log_interval_secs);
+
+    *psrv = NULL;
+
+    if (FAILED(ret = TZAALLOC(srv, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    srv->listen_fd = -1;
+    srv->log_interval_secs = log_interval_secs;
+
+    if (FAILED(ret = TCALLOC((void **)&srv->rxs, nr_rxs, sizeof(struct receiver *)))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_rxs; i++) {
+        TSL_BUG_ON(NULL == rxs[i]);
+        srv->rxs[i] = rxs[i];
+    }
+
+    srv->nr_rxs = nr_rxs;
+
+    if (NULL != sock_path && '\0' != *sock_path) {
+        if (FAILED(ret = _stats_server_listen(srv, sock_path))) {
+            goto done;
+        }
+    }
+
+    srv->last_sample_ns = srv->last_log_ns = stats_now_ns();
+
+    if (FAILED(ret = worker_thread_new(&srv->wthr, _stats_server_thread, WORKER_THREAD_CPU_MASK_ANY))) {
+        MFM_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start stats thread, aborting.");
+        goto done;
+    }
+
+    *psrv = srv;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != srv) {
+            if (-1 != srv->listen_fd) {
+                close(srv->listen_fd);
+                unlink(srv->sock_path);
+            }
+
+            if (NULL != srv->sock_path) {
+                TFREE(srv->sock_path);
+            }
+
+            if (NULL != srv->rxs) {
+                TFREE(srv->rxs);
+            }
+
+            TFREE(srv);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t stats_server_delete(struct stats_server **psrv)
+{
+    aresult_t ret = A_OK;
+
+    struct stats_server *srv = NULL;
+
+    TSL_ASSERT_ARG(NULL != psrv);
+    TSL_ASSERT_ARG(NULL != *psrv);
+
+    srv = *psrv;
+
+    TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&srv->wthr));
+    TSL_BUG_IF_FAILED(worker_thread_delete(&srv->wthr));
+
+    if (-1 != srv->listen_fd) {
+        close(srv->listen_fd);
+        unlink(srv->sock_path);
+    }
+
+    if (NULL != srv->sock_path) {
+        TFREE(srv->sock_path);
+    }
+
+    if (NULL != srv->rxs) {
+        TFREE(srv->rxs);
+    }
+
+    if (NULL != srv->snaps) {
+        TFREE(srv->snaps);
+    }
+
+    TFREE(srv);
+
+    *psrv = NULL;
+
+    return ret;
+}
+
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <tsl/cal.h>
+#include <tsl/result.h>
+#include <tsl/worker_thread.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+struct receiver;
+struct stats_channel_snapshot;
+
+/**
+ * Runtime counters for a single demodulator. Each group of counters has exactly one writer,
+ * and lives on its own cache line, so updating them costs no more than a plain increment. The
+ * stats thread reads them without any synchronization beyond relaxed loads.
+ */
+struct demod_stats {
+    /**
+     * Number of sample buffers processed. Written by the demodulator.
+     */
+    _Atomic uint64_t nr_bufs CAL_CACHE_ALIGNED;
+
+    /**
+     * Number of filtered baseband samples handed to the demodulator
+     */
+    _Atomic uint64_t nr_demod_samples;
+
+    /**
+     * Number of PCM samples generated
+     */
+    _Atomic uint64_t nr_pcm_samples;
+
+    /**
+     * Number of PCM samples dropped because the consumer wasn't there, or wasn't keeping up
+     */
+    _Atomic uint64_t nr_dropped_samples;
+
+    /**
+     * Total time spent processing sample buffers, in nanoseconds
+     */
+    _Atomic uint64_t total_process_ns;
+
+    /**
+     * Longest time spent processing a single sample buffer, in nanoseconds
+     */
+    _Atomic uint64_t max_process_ns;
+
+    /**
+     * Number of filtered baseband samples skipped, rather than demodulated, because the channel's
+     * energy gate was closed
+     */
+    _Atomic uint64_t nr_gated_samples;
+
+    /**
+     * The current batch size, in filtered baseband samples
+     */
+    _Atomic uint64_t batch_len;
+
+    /**
+     * Number of sample buffers dropped because the channel filter couldn't take them
+     */
+    _Atomic uint64_t nr_filter_drops;
+
+    /**
+     * Number of sample buffers dropped because the demodulator's ring was full. Written by the
+     * thread delivering sample buffers.
+     */
+    _Atomic uint64_t nr_ring_full_drops CAL_CACHE_ALIGNED;
+
+    /**
+     * Number of sample buffers dropped to make room for more important channels. Written by the
+     * thread delivering sample buffers.
+     */
+    _Atomic uint64_t nr_shed_bufs;
+
+    /**
+     * Demodulated sample count at the last rate update. Only touched by the stats thread.
+     */
+    uint64_t last_demod_samples CAL_CACHE_ALIGNED;
+
+    /**
+     * Demodulated sample rate over the last update interval. Only touched by the stats thread.
+     */
+    double demod_sample_rate;
+};
+
+/**
+ * Add to a counter. Only safe when called from the counter's single writer.
+ */
+static inline
+void stats_counter_add(_Atomic uint64_t *ctr, uint64_t val)
+{
+    atomic_store_explicit(ctr, atomic_load_explicit(ctr, memory_order_relaxed) + val, memory_order_relaxed);
+}
+
+/**
+ * Raise a counter to at least the given value. Only safe when called from the counter's single writer.
+ */
+static inline
+void stats_counter_max(_Atomic uint64_t *ctr, uint64_t val)
+{
+    if (atomic_load_explicit(ctr, memory_order_relaxed) < val) {
+        atomic_store_explicit(ctr, val, memory_order_relaxed);
+    }
+}
+
+/**
+ * Read a counter, from any thread
+ */
+static inline
+uint64_t stats_counter_read(_Atomic uint64_t *ctr)
+{
+    return atomic_load_explicit(ctr, memory_order_relaxed);
+}
+
+/**
+ * Get the current monotonic time, in nanoseconds
+ */
+static inline
+uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * A thread that periodically samples the counters of a receiver and its demodulators. The
+ * latest snapshot is served as a JSON document to anyone who connects to a UNIX socket, and can
+ * be written to stderr as a single line of JSON at a fixed interval.
+ */
+struct stats_server {
+    /**
+     * The receivers being monitored
+     */
+    struct receiver **rxs;
+
+    /**
+     * The number of receivers being monitored
+     */
+    size_t nr_rxs;
+
+    /**
+     * The listening UNIX socket, or -1 if stats are only logged
+     */
+    int listen_fd;
+
+    /**
+     * The path the socket is bound to
+     */
+    char *sock_path;
+
+    /**
+     * How often to write the stats to stderr, in seconds. 0 to never do so.
+     */
+    unsigned log_interval_secs;
+
+    /**
+     * The time the rates were last updated at
+     */
+    uint64_t last_sample_ns;
+
+    /**
+     * The time the stats were last written to stderr
+     */
+    uint64_t last_log_ns;
+
+    /**
+     * Scratch space for a copy of every channel's counters, so they can be formatted and written
+     * without holding a receiver's demod_lock. Only touched by the stats thread.
+     */
+    struct stats_channel_snapshot *snaps;
+
+    /**
+     * The number of entries snaps has room for
+     */
+    size_t nr_snaps_max;
+
+    /**
+     * The stats thread
+     */
+    struct worker_thread wthr;
+};
+
+/**
+ * Create and start a stats server for the given receivers. Channels added to the receivers
+ * later on are picked up as they appear.
+ *
+ * \param psrv The new stats server, returned by reference
+ * \param rxs The receivers to monitor
+ * \param nr_rxs The number of receivers in rxs
+ * \param sock_path The path to create the UNIX socket at, or NULL to not serve stats over a socket
+ * \param log_interval_secs How often to write the stats to stderr, or 0 to never do so
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t stats_server_new(struct stats_server **psrv, struct receiver *const *rxs, size_t nr_rxs,
+        const char *sock_path, unsigned log_interval_secs);
+
+/**
+ * Stop and destroy a stats server, removing its socket.
+ *
+ * \param psrv The stats server, passed by reference. Set to NULL on success.
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t stats_server_delete(struct stats_server **psrv);
+
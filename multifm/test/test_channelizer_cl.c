@@ -0,0 +1,188 @@
+/*
+ * The OpenCL channelizer has to come up with the same channels as the CPU filter bank, however
+ * its input is split into dispatches. Only built when there is an OpenCL to build against, and
+ * skipped when there's no device to run it on.
+ */
+#include <multifm/channelizer_cl.h>
+
+#include <filter/pfb_channelizer.h>
+
+#include <config/engine.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_CL_NR_CHANNELS         16
+#define TEST_CL_TAPS_PER_BRANCH     8
+#define TEST_CL_NR_TAPS             (TEST_CL_NR_CHANNELS * TEST_CL_TAPS_PER_BRANCH)
+#define TEST_CL_NR_SAMPLES          (48 * 1024 + 5)
+
+/**
+ * The most samples appended between dispatches
+ */
+#define TEST_CL_MAX_IN              2048
+
+/**
+ * The device works in float, and sums the DFT directly where the CPU does an FFT, so the two
+ * can round a sample differently
+ */
+#define TEST_CL_TOLERANCE           2
+
+static
+int16_t test_cl_in[2 * TEST_CL_NR_SAMPLES];
+
+static
+aresult_t test_channelizer_cl_setup(void)
+{
+    uint32_t lcg = 0xc0ffeeul;
+
+    /* Noise at about half scale, so nothing saturates, but every bit of the input matters */
+    for (size_t i = 0; i < 2 * TEST_CL_NR_SAMPLES; i++) {
+        lcg = lcg * 1664525ul + 1013904223ul;
+        test_cl_in[i] = (int16_t)((int32_t)(lcg >> 16) - 32768) / 2;
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_channelizer_cl_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * Collect the oldest dispatch, appending its output to that of the dispatches before it
+ */
+static
+aresult_t _test_cl_collect(struct channelizer_cl *cl, int16_t **out, size_t max_out, size_t *pnr_out)
+{
+    aresult_t ret = A_OK;
+
+    int16_t *chan_out[TEST_CL_NR_CHANNELS];
+    size_t nr_out = 0;
+
+    /* Every dispatch could be the largest, so there has to be room for one more of those */
+    TSL_BUG_ON(*pnr_out + channelizer_cl_max_outputs(cl) > max_out);
+
+    for (size_t k = 0; k < TEST_CL_NR_CHANNELS; k++) {
+        chan_out[k] = &out[k][2 * *pnr_out];
+    }
+
+    if (FAILED(ret = channelizer_cl_collect(cl, chan_out, &nr_out))) {
+        goto done;
+    }
+
+    *pnr_out += nr_out;
+
+done:
+    return ret;
+}
+
+/**
+ * Feed the same noise to the CPU filter bank in one go, and to the OpenCL channelizer in
+ * appends of random size, dispatched at random points, with both slots kept in flight as the
+ * channelizer stage does. Every channel has to come out the same, so what each dispatch
+ * carries over into the next has to be exactly right.
+ */
+TEST_DECLARE_UNIT(test_matches_cpu, channelizer_cl)
+{
+    aresult_t ret = A_OK;
+
+    struct config *cfg = NULL;
+    struct channelizer_cl *cl = NULL;
+    struct pfb_channelizer *pfb = NULL;
+    double taps[TEST_CL_NR_TAPS];
+    int16_t *ref[TEST_CL_NR_CHANNELS] = { NULL },
+            *out[TEST_CL_NR_CHANNELS] = { NULL };
+    size_t max_ref = 0,
+           max_out = 0,
+           nr_ref = 0,
+           nr_out = 0,
+           offset = 0;
+    uint32_t lcg = 0x5eedul;
+
+    TEST_ASSERT_OK(pfb_channelizer_design_prototype(taps, TEST_CL_NR_TAPS, TEST_CL_NR_CHANNELS));
+
+    TEST_ASSERT_OK(config_new(&cfg));
+
+    if (A_E_NOTFOUND == (ret = channelizer_cl_new(&cl, cfg, TEST_CL_NR_CHANNELS, taps, TEST_CL_NR_TAPS,
+                    TEST_CL_MAX_IN)))
+    {
+        TEST_INF("No OpenCL device to run on, skipping");
+        config_delete(&cfg);
+        return A_OK;
+    }
+
+    TEST_ASSERT_OK(ret);
+
+    TEST_ASSERT_OK(pfb_channelizer_new(&pfb, TEST_CL_NR_CHANNELS, taps, TEST_CL_NR_TAPS));
+
+    max_ref = pfb_channelizer_max_outputs(pfb, TEST_CL_NR_SAMPLES);
+    max_out = max_ref + channelizer_cl_max_outputs(cl);
+
+    for (size_t k = 0; k < TEST_CL_NR_CHANNELS; k++) {
+        TEST_ASSERT_OK(TCALLOC((void **)&ref[k], max_ref, 2 * sizeof(int16_t)));
+        TEST_ASSERT_OK(TCALLOC((void **)&out[k], max_out, 2 * sizeof(int16_t)));
+    }
+
+    TEST_ASSERT_OK(pfb_channelizer_process(pfb, test_cl_in, TEST_CL_NR_SAMPLES, ref, max_ref, &nr_ref));
+
+    while (offset < TEST_CL_NR_SAMPLES) {
+        size_t nr_in = 0;
+
+        lcg = lcg * 1664525ul + 1013904223ul;
+        nr_in = BL_MIN2(1 + (lcg >> 8) % 700, TEST_CL_NR_SAMPLES - offset);
+
+        /* Dispatch when the batch is full, and now and then before that */
+        if (nr_in > channelizer_cl_space(cl) || 0 == (lcg >> 4) % 5) {
+            TEST_ASSERT_OK(channelizer_cl_dispatch(cl));
+        }
+
+        if (CHANNELIZER_CL_NR_SLOTS == channelizer_cl_nr_pending(cl)) {
+            TEST_ASSERT_OK(_test_cl_collect(cl, out, max_out, &nr_out));
+        }
+
+        TEST_ASSERT_OK(channelizer_cl_append(cl, &test_cl_in[2 * offset], nr_in));
+        offset += nr_in;
+    }
+
+    TEST_ASSERT_OK(channelizer_cl_dispatch(cl));
+
+    while (0 != channelizer_cl_nr_pending(cl)) {
+        TEST_ASSERT_OK(_test_cl_collect(cl, out, max_out, &nr_out));
+    }
+
+    TEST_ASSERT_EQUALS(nr_out, nr_ref);
+
+    for (size_t k = 0; k < TEST_CL_NR_CHANNELS; k++) {
+        for (size_t i = 0; i < 2 * nr_ref; i++) {
+            int diff = (int)out[k][i] - (int)ref[k][i];
+
+            if (diff > TEST_CL_TOLERANCE || diff < -TEST_CL_TOLERANCE) {
+                TEST_ERR("Channel %zu, sample %zu (%s): got %d, expected %d", k, i / 2, i & 1 ? "Q" : "I",
+                        out[k][i], ref[k][i]);
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < TEST_CL_NR_CHANNELS; k++) {
+        TFREE(ref[k]);
+        TFREE(out[k]);
+    }
+
+    TEST_ASSERT_OK(pfb_channelizer_delete(&pfb));
+    TEST_ASSERT_OK(channelizer_cl_delete(&cl));
+    config_delete(&cfg);
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(channelizer_cl, test_channelizer_cl_cleanup, test_channelizer_cl_setup, NULL, NULL);
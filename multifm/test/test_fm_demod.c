@@ -0,0 +1,177 @@
+/*
+ * The vector discriminators are only worth having if they agree with the scalar one, so they're
+ * checked against _fm_demod_sample directly. That means building fm_demod.c into the test.
+ */
+#include <multifm/fm_demod.c>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define TEST_NR_SAMPLES             4099
+
+static
+int16_t test_fm_demod_in[2 * TEST_NR_SAMPLES];
+
+static
+int16_t test_fm_demod_out[TEST_NR_SAMPLES];
+
+static
+int16_t test_fm_demod_ref[TEST_NR_SAMPLES];
+
+/**
+ * Batch sizes to feed the demodulator, so the vector path starts and stops at every offset, and
+ * a single sample batch (all carried over, nothing vectorised) is covered too
+ */
+static const
+size_t test_fm_demod_batches[] = { 1, 2, 3, 4, 5, 7, 8, 9, 16, 31, 64, 1, 127, 256, 1000 };
+
+#if defined(_USE_ARM_NEON) && !defined(__aarch64__)
+/* ARMv7 has no vector divide, so the differentiator there only comes within an LSB, see _fm_demod_differentiate_x4 */
+#define TEST_FM_DEMOD_DIFF_TOLERANCE    1
+#else
+#define TEST_FM_DEMOD_DIFF_TOLERANCE    0
+#endif
+
+static
+aresult_t test_fm_demod_setup(void)
+{
+    uint32_t lfsr = 0xdeadbeeful;
+
+    /* Full scale noise, so every wrap and saturation in the discriminators gets exercised */
+    for (size_t i = 0; i < 2 * TEST_NR_SAMPLES; i++) {
+        lfsr = lfsr * 1664525ul + 1013904223ul;
+        test_fm_demod_in[i] = (int16_t)(lfsr >> 16);
+    }
+
+    /* Plus the most extreme values, back to back */
+    for (size_t i = 0; i < 16; i++) {
+        test_fm_demod_in[2 * (100 + i)    ] = 0 == (i & 1) ? INT16_MIN : INT16_MAX;
+        test_fm_demod_in[2 * (100 + i) + 1] = 0 == (i & 2) ? INT16_MIN : INT16_MAX;
+        test_fm_demod_in[2 * (200 + i)    ] = INT16_MIN;
+        test_fm_demod_in[2 * (200 + i) + 1] = INT16_MIN;
+        test_fm_demod_in[2 * (300 + i)    ] = 0;
+        test_fm_demod_in[2 * (300 + i) + 1] = 0 == (i & 1) ? 0 : 1;
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_fm_demod_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * Compare an output with the scalar reference, within the tolerance for the discriminator
+ */
+static
+aresult_t _test_fm_demod_compare(enum multifm_fm_discriminator disc, const int16_t *out, const int16_t *ref,
+        size_t nr_samples)
+{
+    int tolerance = MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE == disc ? TEST_FM_DEMOD_DIFF_TOLERANCE : 0;
+
+    for (size_t i = 0; i < nr_samples; i++) {
+        int diff = (int)out[i] - (int)ref[i];
+
+        if (diff > tolerance || diff < -tolerance) {
+            TEST_ERR("Discriminator %d, sample %zu: got %d, expected %d", (int)disc, i, out[i], ref[i]);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Calculate the scalar reference for the whole input, as if it were one batch following a
+ * sample of 0
+ */
+static
+void _test_fm_demod_reference(enum multifm_fm_discriminator disc)
+{
+    test_fm_demod_ref[0] = _fm_demod_sample(disc, test_fm_demod_in[0], test_fm_demod_in[1], 0, 0);
+
+    for (size_t i = 1; i < TEST_NR_SAMPLES; i++) {
+        test_fm_demod_ref[i] = _fm_demod_sample(disc, test_fm_demod_in[2 * i], test_fm_demod_in[2 * i + 1],
+                test_fm_demod_in[2 * (i - 1)], test_fm_demod_in[2 * (i - 1) + 1]);
+    }
+}
+
+/**
+ * The vector path on its own, against the scalar one, sample for sample
+ */
+TEST_DECLARE_UNIT(test_vector_matches_scalar, fm_demod)
+{
+    static const enum multifm_fm_discriminator discs[] = {
+        MULTIFM_FM_DISCRIMINATOR_ATAN2,
+        MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE,
+    };
+
+    for (size_t d = 0; d < BL_ARRAY_ENTRIES(discs); d++) {
+        size_t nr_done = 0;
+
+        _test_fm_demod_reference(discs[d]);
+
+        memset(test_fm_demod_out, 0, sizeof(test_fm_demod_out));
+
+        /* out[i] is the step from in[i] to in[i + 1], so it lines up with ref[i + 1] */
+        nr_done = _fm_demod_process_vector(discs[d], test_fm_demod_in, test_fm_demod_out, TEST_NR_SAMPLES - 1);
+
+        TEST_ASSERT_EQUALS(nr_done <= TEST_NR_SAMPLES - 1, true);
+        TEST_ASSERT_OK(_test_fm_demod_compare(discs[d], test_fm_demod_out, test_fm_demod_ref + 1, nr_done));
+    }
+
+    return A_OK;
+}
+
+/**
+ * Feed the demodulator in batches of awkward sizes. The first sample of each batch comes from the
+ * sample carried over from the last one, the rest from the vector path and the scalar tail, and
+ * all of it has to come out as if it were one long batch.
+ */
+TEST_DECLARE_UNIT(test_batch_boundaries, fm_demod)
+{
+    static const enum multifm_fm_discriminator discs[] = {
+        MULTIFM_FM_DISCRIMINATOR_ATAN2,
+        MULTIFM_FM_DISCRIMINATOR_DIFFERENTIATE,
+    };
+
+    for (size_t d = 0; d < BL_ARRAY_ENTRIES(discs); d++) {
+        struct demod_base *demod = NULL;
+        size_t offset = 0,
+               batch = 0;
+
+        _test_fm_demod_reference(discs[d]);
+
+        memset(test_fm_demod_out, 0, sizeof(test_fm_demod_out));
+
+        TEST_ASSERT_OK(multifm_fm_demod_init(&demod, discs[d]));
+
+        while (offset < TEST_NR_SAMPLES) {
+            size_t nr_samples = BL_MIN2(test_fm_demod_batches[batch], TEST_NR_SAMPLES - offset),
+                   nr_out_samples = 0,
+                   nr_out_bytes = 0;
+
+            TEST_ASSERT_OK(demod->process(demod, test_fm_demod_in + 2 * offset, nr_samples,
+                        test_fm_demod_out + offset, &nr_out_samples, &nr_out_bytes));
+            TEST_ASSERT_EQUALS(nr_out_samples, nr_samples);
+            TEST_ASSERT_EQUALS(nr_out_bytes, nr_samples * sizeof(int16_t));
+
+            offset += nr_samples;
+            batch = (batch + 1) % BL_ARRAY_ENTRIES(test_fm_demod_batches);
+        }
+
+        TEST_ASSERT_OK(_test_fm_demod_compare(discs[d], test_fm_demod_out, test_fm_demod_ref, TEST_NR_SAMPLES));
+
+        TEST_ASSERT_OK(demod->cleanup(&demod));
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(fm_demod, test_fm_demod_cleanup, test_fm_demod_setup, NULL, NULL);
+
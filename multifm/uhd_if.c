@@ -11,10 +11,15 @@
 #include <tsl/diag.h>
 #include <tsl/assert.h>
 
+#include <stdatomic.h>
 #include <string.h>
 
 #define UHD_FAILED(x) (!!((x) != UHD_ERROR_NONE))
 
+/**
+ * The default number of samples received into each sample buffer, unless the device sets
+ * samplesPerBuffer
+ */
 #define MAX_BUF_SAMPS   (16 * 1024)
 
 static
@@ -49,15 +54,23 @@ aresult_t _uhd_rx_worker_thread(struct receiver *rx)
     }
 
     while (receiver_thread_running(rx)) {
-        size_t nr_samps = 0;
-        TSL_BUG_IF_FAILED(receiver_sample_buf_alloc(rx, &buf));
-        buf->nr_samples = 0;
+        size_t nr_samps = 0,
+               nr_filled = 0;
+        int16_t *samps = NULL;
+
+        /* The pool may be shared with other RX chains; if it's dry, keep draining the streamer anyway */
+        if (FAILED(receiver_sample_buf_alloc(rx, &buf))) {
+            buf = NULL;
+            samps = uw->drop_buf;
+        } else {
+            samps = (int16_t *)buf->data_buf;
+        }
 
-        while (NULL != buf) {
-            void *buf_offs = buf->data_buf + 2 * sizeof(int16_t) * buf->nr_samples;
+        while (nr_filled < uw->samples_per_buf) {
+            void *buf_offs = samps + 2 * nr_filled;
             uhd_rx_metadata_error_code_t error_code;
 
-            if (UHD_FAILED(uhd_rx_streamer_recv(uw->rx_stream, &buf_offs, MAX_BUF_SAMPS - buf->nr_samples,
+            if (UHD_FAILED(uhd_rx_streamer_recv(uw->rx_stream, &buf_offs, uw->samples_per_buf - nr_filled,
                             &meta, 5.0, false, &nr_samps)))
             {
                 UHD_MSG(SEV_FATAL, "RECEIVE-ERROR", "Failure while receiving USRP samples, aborting.");
@@ -72,21 +85,44 @@ aresult_t _uhd_rx_worker_thread(struct receiver *rx)
             }
 
             if (error_code != UHD_RX_METADATA_ERROR_CODE_NONE) {
-                UHD_MSG(SEV_FATAL, "RX-ERROR-CODE", "Receive error code received: %d", error_code);
+                UHD_MSG(SEV_FATAL, "RX-ERROR-CODE", "Receive error code received on channel %zu: %d",
+                        uw->channel, error_code);
                 ret = A_E_INVAL;
                 goto done;
             }
 
-            buf->nr_samples += nr_samps;
-
-            if (buf->nr_samples == MAX_BUF_SAMPS) {
-                TSL_BUG_IF_FAILED(receiver_sample_buf_deliver(rx, buf));
-                buf = NULL;
+            /* The device time of the first sample, which runs on host monotonic time */
+            if (0 == nr_filled && NULL != buf) {
+                bool has_time = false;
+                int64_t full_secs = 0;
+                double frac_secs = 0.0;
+
+                if (!UHD_FAILED(uhd_rx_metadata_has_time_spec(meta, &has_time)) && true == has_time &&
+                        !UHD_FAILED(uhd_rx_metadata_time_spec(meta, &full_secs, &frac_secs)) && 0 <= full_secs)
+                {
+                    buf->start_time_ns = (uint64_t)full_secs * 1000000000ull + (uint64_t)(frac_secs * 1e9);
+                } else {
+                    receiver_sample_buf_stamp(rx, buf, nr_samps);
+                }
             }
+
+            nr_filled += nr_samps;
         } /* end iterating to fill buffer */
+
+        if (NULL != buf) {
+            buf->nr_samples = nr_filled;
+            TSL_BUG_IF_FAILED(receiver_sample_buf_deliver(rx, buf));
+            buf = NULL;
+        }
     } /* end infinite loop while thread is running */
 
 done:
+    if (NULL != buf) {
+        /* Never delivered, so hand it straight back to the pool */
+        atomic_store(&buf->refcount, 1);
+        TSL_BUG_IF_FAILED(sample_buf_decref(buf));
+    }
+
     if (NULL != meta) {
         uhd_rx_metadata_free(&meta);
     }
@@ -94,6 +130,37 @@ done:
     return ret;
 }
 
+/**
+ * Drop a reference to a USRP, releasing it if no RX chains are left using it.
+ */
+static
+aresult_t _uhd_device_put(struct uhd_device *dev)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != dev);
+    TSL_BUG_ON(0 == dev->nr_refs);
+
+    if (0 != --dev->nr_refs) {
+        goto done;
+    }
+
+    if (NULL != dev->dev_hdl) {
+        if (UHD_FAILED(uhd_usrp_free(&dev->dev_hdl))) {
+            UHD_MSG(SEV_FATAL, "CLEANUP-FAIL", "Failed to release USRP handle, aborting.");
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        dev->dev_hdl = NULL;
+    }
+
+    TFREE(dev);
+
+done:
+    return ret;
+}
+
 static
 aresult_t _uhd_cleanup(struct receiver *rx)
 {
@@ -115,14 +182,16 @@ aresult_t _uhd_cleanup(struct receiver *rx)
         uw->rx_stream = NULL;
     }
 
-    if (NULL != uw->dev_hdl) {
-        if (UHD_FAILED(uhd_usrp_free(&uw->dev_hdl))) {
-            UHD_MSG(SEV_FATAL, "CLEANUP-FAIL", "Failed to release USRP handle, aborting.");
-            ret = A_E_INVAL;
+    if (NULL != uw->drop_buf) {
+        TFREE(uw->drop_buf);
+    }
+
+    if (NULL != uw->dev) {
+        if (FAILED(ret = _uhd_device_put(uw->dev))) {
             goto done;
         }
 
-        uw->dev_hdl = NULL;
+        uw->dev = NULL;
     }
 
 done:
@@ -139,14 +208,14 @@ aresult_t _uhd_set_channel_gain(struct uhd_worker_thread *uthr, size_t channel,
     TSL_ASSERT_ARG(NULL != uthr);
     TSL_ASSERT_ARG(0.0 <= gain_db);
 
-    if (UHD_FAILED(uhd_usrp_set_rx_gain(uthr->dev_hdl, gain_db, channel, gain_name))) {
+    if (UHD_FAILED(uhd_usrp_set_rx_gain(uthr->dev->dev_hdl, gain_db, channel, gain_name))) {
         UHD_MSG(SEV_FATAL, "FAILED-TO-SET-GAIN", "Failed to set RX gain '%s' for channel %zu to %f",
                 gain_name, channel, gain_db);
         ret = A_E_INVAL;
         goto done;
     }
 
-    if (UHD_FAILED(uhd_usrp_get_rx_gain(uthr->dev_hdl, channel, gain_name, &set_gain ))) {
+    if (UHD_FAILED(uhd_usrp_get_rx_gain(uthr->dev->dev_hdl, channel, gain_name, &set_gain ))) {
         UHD_MSG(SEV_FATAL, "FAILED-TO-GET-GAIN", "Failed to get RX gain '%s' for channel %zu",
                 gain_name, channel);
         ret = A_E_INVAL;
@@ -176,17 +245,17 @@ aresult_t _uhd_tune_channel(struct uhd_worker_thread *uthr, size_t channel, uint
 
     memset(&tune_req, 0, sizeof(tune_req));
 
-    TSL_BUG_ON(NULL == uthr->dev_hdl);
+    TSL_BUG_ON(NULL == uthr->dev->dev_hdl);
 
     DIAG("Setting sampling rate to %zu Hz", rx_rate);
 
-    if (UHD_FAILED(uhd_usrp_set_rx_rate(uthr->dev_hdl, d_rate, channel))) {
+    if (UHD_FAILED(uhd_usrp_set_rx_rate(uthr->dev->dev_hdl, d_rate, channel))) {
         ret = A_E_INVAL;
         UHD_MSG(SEV_FATAL, "FAILED-SET-RX-RATE", "Failed to set receive rate, aborting.");
         goto done;
     }
 
-    if (UHD_FAILED(uhd_usrp_get_rx_rate(uthr->dev_hdl, channel, &d_rate))) {
+    if (UHD_FAILED(uhd_usrp_get_rx_rate(uthr->dev->dev_hdl, channel, &d_rate))) {
         ret = A_E_INVAL;
         UHD_MSG(SEV_FATAL, "FAILED-GET-RX-RATE", "Failed to retrieve receive rate, aborting.");
         goto done;
@@ -202,14 +271,14 @@ aresult_t _uhd_tune_channel(struct uhd_worker_thread *uthr, size_t channel, uint
         .dsp_freq_policy = UHD_TUNE_REQUEST_POLICY_AUTO,
     };
 
-    if (UHD_FAILED(uhd_usrp_set_rx_freq(uthr->dev_hdl, &tune_req, channel, &tune_result))) {
+    if (UHD_FAILED(uhd_usrp_set_rx_freq(uthr->dev->dev_hdl, &tune_req, channel, &tune_result))) {
         ret = A_E_INVAL;
         UHD_MSG(SEV_FATAL, "FAILED-TO-SET-CENTER-FREQ", "Could not set center frequency to %f Hz, aborting",
                 d_freq);
         goto done;
     }
 
-    TSL_BUG_ON(UHD_FAILED(uhd_usrp_get_rx_freq(uthr->dev_hdl, channel, &d_freq)));
+    TSL_BUG_ON(UHD_FAILED(uhd_usrp_get_rx_freq(uthr->dev->dev_hdl, channel, &d_freq)));
 
     UHD_MSG(SEV_INFO, "RX-TUNING", "Requested center frequency %zu Hz, got %zu Hz", freq_hz, (uint64_t)d_freq);
 
@@ -227,7 +296,7 @@ aresult_t _uhd_dump_antenna_names(struct uhd_worker_thread *uthr, size_t channel
     size_t ct = 0;
 
     TSL_ASSERT_ARG(NULL != uthr);
-    TSL_BUG_ON(NULL == uthr->dev_hdl);
+    TSL_BUG_ON(NULL == uthr->dev->dev_hdl);
 
     DIAG("Getting gains for channel %zu...", channel);
 
@@ -237,7 +306,7 @@ aresult_t _uhd_dump_antenna_names(struct uhd_worker_thread *uthr, size_t channel
         goto done;
     }
 
-    if (UHD_FAILED(uhd_usrp_get_rx_antennas(uthr->dev_hdl, channel, &names))) {
+    if (UHD_FAILED(uhd_usrp_get_rx_antennas(uthr->dev->dev_hdl, channel, &names))) {
         UHD_MSG(SEV_INFO, "CANNOT-GET-ANTENNAS", "Could not get list of antenna names from device, aborting.");
         ret = A_E_INVAL;
         goto done;
@@ -270,7 +339,7 @@ aresult_t _uhd_dump_gain_names(struct uhd_worker_thread *uthr, size_t channel)
     size_t ct = 0;
 
     TSL_ASSERT_ARG(NULL != uthr);
-    TSL_BUG_ON(NULL == uthr->dev_hdl);
+    TSL_BUG_ON(NULL == uthr->dev->dev_hdl);
 
     DIAG("Getting gains for channel %zu...", channel);
 
@@ -280,7 +349,7 @@ aresult_t _uhd_dump_gain_names(struct uhd_worker_thread *uthr, size_t channel)
         goto done;
     }
 
-    if (UHD_FAILED(uhd_usrp_get_rx_gain_names(uthr->dev_hdl, channel, &names))) {
+    if (UHD_FAILED(uhd_usrp_get_rx_gain_names(uthr->dev->dev_hdl, channel, &names))) {
         UHD_MSG(SEV_INFO, "CANNOT-GET-GAINS", "Could not get list of gain names from device, aborting.");
         ret = A_E_INVAL;
         goto done;
@@ -305,58 +374,73 @@ done:
     return ret;
 }
 
-aresult_t uhd_worker_thread_new(struct receiver **pthr, struct config *cfg)
+/**
+ * Set up one RX chain of a USRP, and the receiver that processes its samples.
+ *
+ * \param puthr The new RX chain, returned by reference
+ * \param dev The device the chain belongs to. The chain takes a reference to it.
+ * \param cfg The process-wide configuration
+ * \param device The device stanza
+ * \param chain The stanza for this RX chain, or NULL if the device only has the one
+ * \param chain_idx The index of this chain in the list of chains
+ * \param owner The receiver whose sample buffer pool is to be shared, or NULL if this one owns it
+ * \param nr_chains The total number of chains sharing the sample buffer pool
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+static
+aresult_t _uhd_chain_new(struct uhd_worker_thread **puthr, struct uhd_device *dev, struct config *cfg,
+        struct config *device, struct config *chain, size_t chain_idx, struct receiver *owner, unsigned nr_chains)
 {
     aresult_t ret = A_OK;
 
     struct uhd_worker_thread *uthr = NULL;
-
-    const char *dev_str = NULL,
-               *antenna = NULL;
-    struct config device = CONFIG_INIT_EMPTY,
-                  gains = CONFIG_INIT_EMPTY,
+    const char *antenna = NULL;
+    struct config gains = CONFIG_INIT_EMPTY,
                   gain_config = CONFIG_INIT_EMPTY;
     uhd_stream_args_t sa;
     int channel = 0,
         sample_rate = 0,
-        center_freq = 0;
+        center_freq = 0,
+        buf_samples = MAX_BUF_SAMPS;
     size_t chan_t = 0,
            cnt = 0,
            samps_per_buf = 0;
     char str[128];
+    struct config *local_cfg = NULL != chain ? chain : device;
 
-    TSL_ASSERT_ARG(NULL != pthr);
+    TSL_ASSERT_ARG(NULL != puthr);
+    TSL_ASSERT_ARG(NULL != dev);
     TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(NULL != device);
 
-    *pthr = NULL;
+    *puthr = NULL;
 
     memset(&sa, 0, sizeof(sa));
 
-    /* Grab the config */
-    if (FAILED(ret = config_get(cfg, &device, "device"))) {
-        UHD_MSG(SEV_FATAL, "MISSING-DEVICE", "Missing device specification stanza, aborting.");
-        goto done;
+    /* Hardware settings not specified for the chain come from the device stanza */
+    if ((NULL == chain || FAILED(config_get_integer(chain, &channel, "channelId"))) &&
+            FAILED(config_get_integer(device, &channel, "channelId")))
+    {
+        UHD_MSG(SEV_INFO, "DEFAULT-CHANNEL", "No receive channel specified, defaulting to %zu", chain_idx);
+        channel = chain_idx;
     }
 
-    if (FAILED(ret = config_get_string(&device, &dev_str, "deviceId"))) {
-        UHD_MSG(SEV_FATAL, "MISSING-DEVICE-ID", "Need to specify deviceId in device stanza, aborting.");
+    /* Look up the tuning the same way receiver_init will */
+    if (FAILED(ret = receiver_config_get_integer(local_cfg, cfg, &sample_rate, "sampleRateHz"))) {
+        UHD_MSG(SEV_FATAL, "NO-SAMPLE-RATE", "Need to specify sampleRateHz in configuration");
         goto done;
     }
 
-    if (FAILED(config_get_integer(&device, &channel, "channelId"))) {
-        UHD_MSG(SEV_INFO, "DEFAULT-CHANNEL", "No receive channel specified, defaulting to 0");
-        channel = 0;
-    }
-
-    DIAG("Device ID: [%s] Channel: %d", dev_str, channel);
-
-    if (FAILED(ret = config_get_integer(cfg, &sample_rate, "sampleRateHz"))) {
-        UHD_MSG(SEV_FATAL, "NO-SAMPLE-RATE", "Need to specify sampleRateHz in configuration");
+    if (FAILED(ret = receiver_config_get_integer(local_cfg, cfg, &center_freq, "centerFreqHz"))) {
+        UHD_MSG(SEV_FATAL, "NO-CENTER-FREQ", "Need to specify centerFreqHz in configuration");
         goto done;
     }
 
-    if (FAILED(ret = config_get_integer(cfg, &center_freq, "centerFreqHz"))) {
-        UHD_MSG(SEV_FATAL, "NO-CENTER-FREQ", "Need to specify centerFreqHz in configuration");
+    /* Every chain on the device can share a sample buffer pool, so they all get the same size */
+    if (!FAILED(receiver_config_get_integer(device, cfg, &buf_samples, "samplesPerBuffer")) && 0 >= buf_samples) {
+        UHD_MSG(SEV_FATAL, "BAD-SAMPLES-PER-BUFFER", "samplesPerBuffer must be a positive number of samples.");
+        ret = A_E_INVAL;
         goto done;
     }
 
@@ -365,28 +449,31 @@ aresult_t uhd_worker_thread_new(struct receiver **pthr, struct config *cfg)
         goto done;
     }
 
-    /* Open the USRP, create the RX handle */
-    if (UHD_FAILED(uhd_usrp_make(&uthr->dev_hdl, dev_str))) {
-        UHD_MSG(SEV_FATAL, "FAILED-CREATION", "Failed to create USRP device, with configuration string %s",
-                dev_str);
-        ret = A_E_INVAL;
+    uthr->dev = dev;
+    dev->nr_refs++;
+    uthr->channel = channel;
+    uthr->samples_per_buf = buf_samples;
+
+    if (FAILED(ret = TACALLOC(&uthr->drop_buf, uthr->samples_per_buf, 2 * sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
         goto done;
     }
 
-    if (!UHD_FAILED(uhd_usrp_get_rx_antenna(uthr->dev_hdl, channel, str, sizeof(str) - 1))) {
+    if (!UHD_FAILED(uhd_usrp_get_rx_antenna(uthr->dev->dev_hdl, channel, str, sizeof(str) - 1))) {
         DIAG("Channel %d label: [%s]", channel, str);
     }
 
-    if (FAILED(ret = config_get_string(&device, &antenna, "antenna"))) {
+    if ((NULL == chain || FAILED(config_get_string(chain, &antenna, "antenna"))) &&
+            FAILED(ret = config_get_string(device, &antenna, "antenna")))
+    {
         UHD_MSG(SEV_FATAL, "NO-ANTENNA", "Need to specify an antenna, aborting");
         TSL_BUG_IF_FAILED(_uhd_dump_antenna_names(uthr, channel));
         goto done;
     }
 
-    UHD_MSG(SEV_INFO, "OPENED-DEVICE", "Opened USRP [%s] Channel: %d", dev_str, channel);
+    UHD_MSG(SEV_INFO, "OPENED-CHANNEL", "Opened USRP Channel: %d", channel);
 
     /* Set the input antenna */
-    if (UHD_FAILED(uhd_usrp_set_rx_antenna(uthr->dev_hdl, antenna, channel))) {
+    if (UHD_FAILED(uhd_usrp_set_rx_antenna(uthr->dev->dev_hdl, antenna, channel))) {
         UHD_MSG(SEV_FATAL, "NO-RX-ANTENNA", "Failed to set channel %d to input from antenna %s",
                 channel, antenna);
         ret = A_E_INVAL;
@@ -406,7 +493,9 @@ aresult_t uhd_worker_thread_new(struct receiver **pthr, struct config *cfg)
     }
 
     /* Set up the gain(s) */
-    if (FAILED(ret = config_get(&device, &gains, "gain"))) {
+    if ((NULL == chain || FAILED(config_get(chain, &gains, "gain"))) &&
+            FAILED(ret = config_get(device, &gains, "gain")))
+    {
         UHD_MSG(SEV_FATAL, "NO-GAINS", "No gains have been specified for channel %d", channel);
         TSL_BUG_IF_FAILED(_uhd_dump_gain_names(uthr, channel));
         goto done;
@@ -433,7 +522,7 @@ aresult_t uhd_worker_thread_new(struct receiver **pthr, struct config *cfg)
         }
     }
 
-    /* Get the RX stream */
+    /* Get the RX stream, for just this chain */
     chan_t = channel;
     sa.cpu_format = "sc16";
     sa.otw_format = "sc16";
@@ -441,8 +530,8 @@ aresult_t uhd_worker_thread_new(struct receiver **pthr, struct config *cfg)
     sa.channel_list = &chan_t;
     sa.args = "";
 
-    if (UHD_FAILED(uhd_usrp_get_rx_stream(uthr->dev_hdl, &sa, uthr->rx_stream))) {
-        UHD_MSG(SEV_FATAL, "FAILED-GET-RX-STREAM", "Failed to get rx stream for specified USRP device.");
+    if (UHD_FAILED(uhd_usrp_get_rx_stream(uthr->dev->dev_hdl, &sa, uthr->rx_stream))) {
+        UHD_MSG(SEV_FATAL, "FAILED-GET-RX-STREAM", "Failed to get rx stream for channel %d of USRP device.", channel);
         ret = A_E_INVAL;
         goto done;
     }
@@ -455,13 +544,22 @@ aresult_t uhd_worker_thread_new(struct receiver **pthr, struct config *cfg)
 
     UHD_MSG(SEV_INFO, "SAMPLES-PER-BUFFER", "Maximum samples per buffer: %zu", samps_per_buf);
 
+    /* The chain's own stanza, or the device's, overrides the top level for channels and so on */
+    uthr->rx.local_cfg = local_cfg;
+
+    /* All the chains draw from one pool of sample buffers */
+    if (NULL != owner) {
+        uthr->rx.samp_alloc = owner->samp_alloc;
+    } else {
+        uthr->rx.nr_samp_buf_users = nr_chains;
+    }
+
     /* Initialize the receiver subsystem */
     DIAG("Initializing the receiver subsystem.");
-    TSL_BUG_IF_FAILED(receiver_init(&uthr->rx, cfg, _uhd_rx_worker_thread, _uhd_cleanup, MAX_BUF_SAMPS));
-
-    DIAG("We're all set up!");
+    TSL_BUG_IF_FAILED(receiver_init(&uthr->rx, cfg, _uhd_rx_worker_thread, _uhd_cleanup,
+                uthr->samples_per_buf));
 
-    *pthr = &uthr->rx;
+    *puthr = uthr;
 
 done:
     if (FAILED(ret)) {
@@ -470,13 +568,138 @@ done:
                 uhd_rx_streamer_free(&uthr->rx_stream);
                 uthr->rx_stream = NULL;
             }
-            if (NULL != uthr->dev_hdl) {
-                uhd_usrp_free(&uthr->dev_hdl);
-                uthr->dev_hdl = NULL;
+
+            if (NULL != uthr->drop_buf) {
+                TFREE(uthr->drop_buf);
             }
+
+            _uhd_device_put(uthr->dev);
+
             TFREE(uthr);
         }
+    }
+
+    return ret;
+}
+
+aresult_t uhd_worker_thread_new(struct receiver **prxs, size_t max_rxs, size_t *pnr_rxs, struct config *cfg,
+        struct config *device)
+{
+    aresult_t ret = A_OK;
+
+    struct uhd_device *dev = NULL;
+    const char *dev_str = NULL,
+               *subdev = NULL;
+    struct config chains = CONFIG_INIT_EMPTY,
+                  chain = CONFIG_INIT_EMPTY;
+    size_t nr_chains = 0,
+           cnt = 0;
+    uint64_t now_ns = 0;
+
+    TSL_ASSERT_ARG(NULL != prxs);
+    TSL_ASSERT_ARG(0 != max_rxs);
+    TSL_ASSERT_ARG(NULL != pnr_rxs);
+    TSL_ASSERT_ARG(NULL != cfg);
+    TSL_ASSERT_ARG(NULL != device);
+
+    *pnr_rxs = 0;
+
+    if (FAILED(ret = config_get_string(device, &dev_str, "deviceId"))) {
+        UHD_MSG(SEV_FATAL, "MISSING-DEVICE-ID", "Need to specify deviceId in device stanza, aborting.");
+        goto done;
+    }
+
+    /* Several RX chains can be listed, each with its own center frequency and channels */
+    if (!FAILED(config_get(device, &chains, "chains"))) {
+        CONFIG_ARRAY_FOR_EACH(chain, &chains, ret, cnt) {
+            nr_chains++;
+        }
+        ret = A_OK;
+
+        if (0 == nr_chains || max_rxs < nr_chains) {
+            UHD_MSG(SEV_FATAL, "BAD-CHAINS", "Need between 1 and %zu RX chains, got %zu, aborting.",
+                    max_rxs, nr_chains);
+            ret = A_E_INVAL;
+            goto done;
+        }
+    }
+
+    DIAG("Device ID: [%s] Chains: %zu", dev_str, nr_chains);
+
+    if (FAILED(ret = TZAALLOC(dev, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    /* Our own reference, dropped once every chain holds its own */
+    dev->nr_refs = 1;
+
+    /* Open the USRP */
+    if (UHD_FAILED(uhd_usrp_make(&dev->dev_hdl, dev_str))) {
+        UHD_MSG(SEV_FATAL, "FAILED-CREATION", "Failed to create USRP device, with configuration string %s",
+                dev_str);
+        ret = A_E_INVAL;
+        goto done;
+    }
 
+    /* Daughterboard frontends to map onto the channels, i.e. "A:A A:B" for both chains of a B210 */
+    if (!FAILED(config_get_string(device, &subdev, "subdevSpec"))) {
+        uhd_subdev_spec_handle spec = NULL;
+
+        if (UHD_FAILED(uhd_subdev_spec_make(&spec, subdev))) {
+            UHD_MSG(SEV_FATAL, "BAD-SUBDEV-SPEC", "Subdevice specification [%s] is not valid, aborting.", subdev);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (UHD_FAILED(uhd_usrp_set_rx_subdev_spec(dev->dev_hdl, spec, 0))) {
+            UHD_MSG(SEV_FATAL, "FAILED-SUBDEV-SPEC", "Failed to set subdevice specification [%s], aborting.", subdev);
+            uhd_subdev_spec_free(&spec);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        uhd_subdev_spec_free(&spec);
+    }
+
+    UHD_MSG(SEV_INFO, "OPENED-DEVICE", "Opened USRP [%s]", dev_str);
+
+    /* Run the device clock on host monotonic time, so receive metadata can stamp sample buffers */
+    now_ns = sample_buf_now_ns();
+    if (UHD_FAILED(uhd_usrp_set_time_now(dev->dev_hdl, (int64_t)(now_ns / 1000000000ull),
+                    (double)(now_ns % 1000000000ull) / 1e9, 0)))
+    {
+        UHD_MSG(SEV_WARNING, "FAILED-SET-TIME", "Failed to set the USRP time, sample buffers will be stamped on arrival.");
+    }
+
+    if (0 == nr_chains) {
+        struct uhd_worker_thread *uthr = NULL;
+
+        if (FAILED(ret = _uhd_chain_new(&uthr, dev, cfg, device, NULL, 0, NULL, 1))) {
+            goto done;
+        }
+
+        prxs[(*pnr_rxs)++] = &uthr->rx;
+    } else {
+        CONFIG_ARRAY_FOR_EACH(chain, &chains, ret, cnt) {
+            struct uhd_worker_thread *uthr = NULL;
+
+            if (FAILED(ret = _uhd_chain_new(&uthr, dev, cfg, device, &chain, cnt,
+                            0 == cnt ? NULL : prxs[0], nr_chains)))
+            {
+                goto done;
+            }
+
+            prxs[(*pnr_rxs)++] = &uthr->rx;
+        }
+        ret = A_OK;
+    }
+
+    DIAG("We're all set up!");
+
+done:
+    if (NULL != dev) {
+        /* If no chains were set up, this releases the device */
+        _uhd_device_put(dev);
     }
 
     return ret;
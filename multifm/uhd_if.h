@@ -2,12 +2,25 @@
 
 #include <tsl/result.h>
 
+#include <stddef.h>
+
 struct receiver;
 struct config;
 
 
 /**
- * Create a new UHD receiver thread
+ * Create the UHD receiver threads, one for each RX chain listed in the device stanza's
+ * `chains` array, or a single one if there is no such array.
+ *
+ * \param prxs Array the new receivers are returned in
+ * \param max_rxs The number of entries in prxs
+ * \param pnr_rxs The number of receivers created, returned by reference
+ * \param cfg The process-wide configuration
+ * \param device The device stanza. Receiver parameters given in a chain's stanza, or else in the
+ *               device stanza if there are no chains, take precedence over the process-wide
+ *               configuration.
+ *
+ * \return A_OK on success, an error code otherwise.
  */
-aresult_t uhd_worker_thread_new(struct receiver **pthr, struct config *cfg);
-
+aresult_t uhd_worker_thread_new(struct receiver **prxs, size_t max_rxs, size_t *pnr_rxs, struct config *cfg,
+        struct config *device);
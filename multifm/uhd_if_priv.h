@@ -8,11 +8,48 @@
 
 #define UHD_MSG(sev, sys, msg, ...)     MESSAGE("UHD", sev, sys, msg, ##__VA_ARGS__)
 
+/**
+ * A USRP, shared by the receivers streaming from each of its RX chains
+ */
+struct uhd_device {
+    uhd_usrp_handle dev_hdl;
+
+    /**
+     * The number of RX chains still using the device. The last one to be cleaned up releases it.
+     */
+    unsigned nr_refs;
+};
+
+/**
+ * A receiver streaming from a single RX chain of a USRP
+ */
 struct uhd_worker_thread {
     struct receiver rx;
-    uhd_usrp_handle dev_hdl;
+
+    /**
+     * The device this RX chain belongs to
+     */
+    struct uhd_device *dev;
+
+    /**
+     * The streamer for this RX chain. Each chain has its own, received from on its own thread.
+     */
     uhd_rx_streamer_handle rx_stream;
-    size_t *channels;
-    size_t nr_channels;
+
+    /**
+     * The channel index of this RX chain on the device
+     */
+    size_t channel;
+
+    /**
+     * Samples are received into this when there are no free sample buffers, so the streamer
+     * is always drained and the radio doesn't overflow.
+     */
+    void *drop_buf;
+
+    /**
+     * The number of samples received into each sample buffer
+     */
+    size_t samples_per_buf;
 };
 
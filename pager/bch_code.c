@@ -24,7 +24,15 @@
 #include <tsl/safe_alloc.h>
 
 #include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of bits in a syndrome as used by the table decoder: S1 and S3, 5 bits each
+ */
+#define BCH_CODE_SYNDROME_BITS          10
 
 struct bch_code {
     int *p;          // coefficients of primitive polynomial used to generate GF(2**5)
@@ -36,6 +44,16 @@ struct bch_code {
     int *index_of;   // antilog table of GF(2**5)
     int *g;          // coefficients of generator polynomial, g(x) [n - k + 1]=[11]
     int *bb;         // coefficients of redundancy polynomial ( x**(10) i(x) ) modulo g(x)
+
+    /*
+     * Tables for the fast decoder. The syndrome of a received word is linear in its bits, so it
+     * is the XOR of the syndromes of each byte of the word, looked up in syn_byte. S2 and S4
+     * follow from S1 for a binary code, so S1 and S3 (in polynomial form) are all that is kept.
+     * err_pattern maps each syndrome to the 1- or 2-bit error that produces it, or 0 if no
+     * such error does.
+     */
+    uint16_t syn_byte[4][256];
+    uint32_t err_pattern[1 << BCH_CODE_SYNDROME_BITS];
 };
 
 static
@@ -304,7 +322,7 @@ int bch_code_decode(struct bch_code *bch_code_data, int recd[])
 }
 #endif
 
-int bch_code_decode(struct bch_code *bch_code_data, uint32_t *precd)
+int bch_code_decode_reference(const struct bch_code *bch_code_data, uint32_t *precd)
 {
     TSL_BUG_ON(NULL == bch_code_data);
     TSL_BUG_ON(NULL == precd);
@@ -397,6 +415,94 @@ int bch_code_decode(struct bch_code *bch_code_data, uint32_t *precd)
     return retval;
 }
 
+/**
+ * The syndrome of a received word, as an index into err_pattern
+ */
+static inline
+unsigned _bch_code_syndrome(const struct bch_code *bch_code_data, uint32_t recd)
+{
+    return bch_code_data->syn_byte[0][recd & 0xff] ^
+           bch_code_data->syn_byte[1][(recd >> 8) & 0xff] ^
+           bch_code_data->syn_byte[2][(recd >> 16) & 0xff] ^
+           bch_code_data->syn_byte[3][(recd >> 24) & 0xff];
+}
+
+int bch_code_decode(const struct bch_code *bch_code_data, uint32_t *precd)
+{
+    unsigned syn = 0;
+    uint32_t err = 0;
+
+    TSL_BUG_ON(NULL == bch_code_data);
+    TSL_BUG_ON(NULL == precd);
+
+    syn = _bch_code_syndrome(bch_code_data, *precd & ((1ul << bch_code_data->n) - 1));
+
+    /* Most words come through clean */
+    if (0 == syn) {
+        return 0;
+    }
+
+    err = bch_code_data->err_pattern[syn];
+
+    if (0 == err) {
+        /* More errors than we can correct */
+        return 1;
+    }
+
+    *precd ^= err;
+
+    return 0;
+}
+
+/**
+ * Build the tables for the fast decoder, from the Galois field tables
+ */
+static
+void _bch_code_build_tables(struct bch_code *bch_code_data)
+{
+    int n = bch_code_data->n,
+        m = bch_code_data->m;
+    uint16_t syn_bit[32];
+
+    /* Bit (n - 1 - j) of a word is the coefficient of x^j, as in the reference decoder */
+    for (int j = 0; j < n; j++) {
+        syn_bit[n - 1 - j] = bch_code_data->alpha_to[j] |
+            (bch_code_data->alpha_to[(3 * j) % n] << m);
+    }
+
+    for (int i = n; i < 32; i++) {
+        syn_bit[i] = 0;
+    }
+
+    for (int b = 0; b < 4; b++) {
+        for (int v = 0; v < 256; v++) {
+            uint16_t syn = 0;
+
+            for (int i = 0; i < 8; i++) {
+                if (v & (1 << i)) {
+                    syn ^= syn_bit[8 * b + i];
+                }
+            }
+
+            bch_code_data->syn_byte[b][v] = syn;
+        }
+    }
+
+    memset(bch_code_data->err_pattern, 0, sizeof(bch_code_data->err_pattern));
+
+    /* The code has distance 5, so every 1 and 2 bit error has a syndrome of its own */
+    for (int i = 0; i < n; i++) {
+        TSL_BUG_ON(0 != bch_code_data->err_pattern[syn_bit[i]]);
+        bch_code_data->err_pattern[syn_bit[i]] = 1ul << i;
+
+        for (int j = i + 1; j < n; j++) {
+            uint16_t syn = syn_bit[i] ^ syn_bit[j];
+            TSL_BUG_ON(0 != bch_code_data->err_pattern[syn]);
+            bch_code_data->err_pattern[syn] = (1ul << i) | (1ul << j);
+        }
+    }
+}
+
 /*
  * Example usage BCH(31,21,5)
  *
@@ -418,6 +524,12 @@ aresult_t bch_code_new(struct bch_code **pcode, const int p[], int m, int n, int
 
     struct bch_code *bch_code_data=NULL;
 
+    TSL_ASSERT_ARG(NULL != pcode);
+    /* The fast decoder only handles double error correcting codes that fit in a word */
+    TSL_ASSERT_ARG(2 == t);
+    TSL_ASSERT_ARG(n < 32);
+    TSL_ASSERT_ARG(2 * m <= BCH_CODE_SYNDROME_BITS);
+
     if (FAILED(ret = TZAALLOC(bch_code_data, SYS_CACHE_LINE_LENGTH))) {
         goto done;
     }
@@ -453,6 +565,7 @@ aresult_t bch_code_new(struct bch_code **pcode, const int p[], int m, int n, int
 
         generate_gf(bch_code_data);          /* generate the Galois Field GF(2**m) */
         gen_poly(bch_code_data);             /* Compute the generator polynomial of BCH code */
+        _bch_code_build_tables(bch_code_data);
     }
 
     *pcode = bch_code_data;
@@ -461,6 +574,47 @@ done:
     return ret;
 }
 
+/**
+ * The code shared by every pager decoder, built the first time it is asked for
+ */
+static
+_Atomic(struct bch_code *) _bch_code_pager = NULL;
+
+aresult_t bch_code_get_pager(const struct bch_code **pcode)
+{
+    aresult_t ret = A_OK;
+
+    /* BCH Generator Polynomial */
+    static const int poly[6] = { 1, 0, 1, 0, 0, 1 };
+    struct bch_code *code = NULL,
+                    *expected = NULL;
+
+    TSL_ASSERT_ARG(NULL != pcode);
+
+    *pcode = NULL;
+
+    code = atomic_load_explicit(&_bch_code_pager, memory_order_acquire);
+
+    if (NULL == code) {
+        if (FAILED(ret = bch_code_new(&code, poly, 5, 31, 21, 2))) {
+            goto done;
+        }
+
+        /* If another thread got there first, use its copy instead */
+        if (false == atomic_compare_exchange_strong_explicit(&_bch_code_pager, &expected, code,
+                    memory_order_acq_rel, memory_order_acquire))
+        {
+            bch_code_delete(&code);
+            code = expected;
+        }
+    }
+
+    *pcode = code;
+
+done:
+    return ret;
+}
+
 void bch_code_delete(struct bch_code **pbch_code_data)
 {
     struct bch_code *bch_code_data = NULL;
@@ -2,10 +2,43 @@
 
 #include <tsl/result.h>
 
+#include <stdint.h>
+
 struct bch_code;
 
 aresult_t bch_code_new(struct bch_code **pcode, const int p[], int m, int n, int k, int t);
 void bch_code_delete(struct bch_code **bch_code_data);
+
+/**
+ * Get the BCH(31, 21) code, with t = 2, used by POCSAG and FLEX. There is one copy for the whole
+ * process, built the first time it is asked for and never freed. Decoding only reads the code,
+ * so any number of decoders can use it at once, from any thread; don't encode with it.
+ *
+ * \param pcode The code, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t bch_code_get_pager(const struct bch_code **pcode);
 void bch_code_encode(struct bch_code *bch_code_data, int data[]);
-int bch_code_decode(struct bch_code *bch_code_data, uint32_t *precd);
+
+/**
+ * Check a received word, correcting up to 2 bit errors in place. Bit (n - 1 - j) of the word is
+ * the coefficient of x^j; any bits above bit (n - 1) are left alone. The syndrome is found with
+ * 4 table lookups, and the error, if there is one, with one more.
+ *
+ * \param bch_code_data The BCH code
+ * \param precd The received word, corrected in place
+ *
+ * \return 0 if the word is good (after correction), non-zero if it has more errors than can be
+ *         corrected
+ */
+int bch_code_decode(const struct bch_code *bch_code_data, uint32_t *precd);
+
+/**
+ * Check and correct a received word the long way, by solving for the error locator polynomial.
+ * Corrects and rejects the same words as bch_code_decode, except for words with S1 = 0 but
+ * S3 != 0 (at least 3 errors), which this lets through uncorrected. Kept to check the fast
+ * decoder against.
+ */
+int bch_code_decode_reference(const struct bch_code *bch_code_data, uint32_t *precd);
 
@@ -0,0 +1,622 @@
+/*
+ *  pager_bench.c - Throughput and decode rate benchmarks for the FLEX and POCSAG decoders
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pager/bench/pager_synth.h>
+
+#include <pager/pager.h>
+#include <pager/pager_pocsag.h>
+
+#include <filter/sample_buf.h>
+
+#include <app/app.h>
+
+#include <tsl/diag.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/safe_alloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#define PB_MSG(sev, sys, msg, ...) MESSAGE("PAGER-BENCH", sev, sys, msg, ##__VA_ARGS__)
+
+/**
+ * The number of samples handed to the decoder at a time, as the decoder app reads them
+ */
+#define PAGER_BENCH_CHUNK_SAMPLES   1024
+
+/**
+ * The sample rates the decoders are run at
+ */
+#define PAGER_BENCH_FLEX_RATE       16000
+#define PAGER_BENCH_POCSAG_RATE     38400
+
+/**
+ * The longest message text generated
+ */
+#define PAGER_BENCH_MAX_TEXT        64
+
+/**
+ * The protocols benchmarked
+ */
+enum pager_bench_protocol {
+    PAGER_BENCH_FLEX,
+    PAGER_BENCH_POCSAG,
+};
+
+/**
+ * One signal to decode
+ */
+struct pager_bench_case {
+    /**
+     * The name of the benchmark, i.e. the decoder being measured
+     */
+    const char *bench;
+
+    enum pager_bench_protocol protocol;
+    unsigned baud;
+
+    /**
+     * 2 or 4 level FSK (FLEX only)
+     */
+    unsigned fsk_levels;
+
+    unsigned sample_rate;
+};
+
+static const
+struct pager_bench_case pager_bench_cases[] = {
+    { "flex", PAGER_BENCH_FLEX, 1600, 2, PAGER_BENCH_FLEX_RATE },
+    { "flex", PAGER_BENCH_FLEX, 3200, 2, PAGER_BENCH_FLEX_RATE },
+    { "flex", PAGER_BENCH_FLEX, 3200, 4, PAGER_BENCH_FLEX_RATE },
+    { "flex", PAGER_BENCH_FLEX, 6400, 4, PAGER_BENCH_FLEX_RATE },
+    { "pocsag", PAGER_BENCH_POCSAG, 512, 2, PAGER_BENCH_POCSAG_RATE },
+    { "pocsag", PAGER_BENCH_POCSAG, 1200, 2, PAGER_BENCH_POCSAG_RATE },
+    { "pocsag", PAGER_BENCH_POCSAG, 2400, 2, PAGER_BENCH_POCSAG_RATE },
+};
+
+/**
+ * The messages sent, and how many of them came back out of the decoder on the current pass.
+ * The decoders' callbacks carry no private state, so this is shared with them.
+ */
+struct pager_bench_state {
+    struct pager_synth_msg *msgs;
+    char (*texts)[PAGER_BENCH_MAX_TEXT];
+    size_t nr_msgs;
+
+    /**
+     * The next message expected out of the decoder. Messages come out in the order they were
+     * sent, so anything before this was either decoded or lost.
+     */
+    size_t next_msg;
+
+    /**
+     * Messages decoded that match one sent, and all messages decoded
+     */
+    size_t nr_matched;
+    size_t nr_decoded;
+};
+
+static
+struct pager_bench_state bench_state;
+
+/**
+ * The minimum time to run each case for, in nanoseconds
+ */
+static
+uint64_t min_run_ns = 200000000ull;
+
+/**
+ * Only run benchmarks whose name contains this, if set
+ */
+static
+const char *bench_match = NULL;
+
+/**
+ * The number of messages sent in each case
+ */
+static
+size_t nr_bench_msgs = 64;
+
+/**
+ * RMS noise added to the signal, as a fraction of the symbol level
+ */
+static
+double noise_level = 0.0;
+
+/**
+ * Transmitter symbol clock error, in parts per million
+ */
+static
+double clock_ppm = 0.0;
+
+/**
+ * Where to write the JSON report, if anywhere
+ */
+static
+FILE *json_out = NULL;
+
+/**
+ * Where to write the human readable table of results. Moved to stderr if the JSON report is
+ * going to stdout.
+ */
+static
+FILE *table_out = NULL;
+
+/**
+ * Whether a result has been written to the JSON report yet
+ */
+static
+bool json_first = true;
+
+/**
+ * Match a decoded message against the messages sent, from the next one expected onwards. Padding
+ * the protocol leaves on the end of the message (ETX for POCSAG alphanumeric messages, spaces for
+ * numeric) is ignored.
+ */
+static
+void _pager_bench_on_msg(uint32_t capcode, const char *data, size_t data_len)
+{
+    struct pager_bench_state *st = &bench_state;
+
+    while (0 != data_len && ('\x03' == data[data_len - 1] || ' ' == data[data_len - 1] ||
+                '\0' == data[data_len - 1]))
+    {
+        data_len--;
+    }
+
+    st->nr_decoded++;
+
+    for (size_t i = st->next_msg; i < st->nr_msgs; i++) {
+        const struct pager_synth_msg *msg = &st->msgs[i];
+
+        if (msg->capcode == capcode && strlen(msg->text) == data_len && !memcmp(msg->text, data, data_len)) {
+            st->nr_matched++;
+            st->next_msg = i + 1;
+            break;
+        }
+    }
+}
+
+static
+aresult_t _pager_bench_flex_on_alnum(struct pager_flex *flex, uint16_t baud, uint8_t phase, uint8_t cycle_no,
+        uint8_t frame_no, uint64_t cap_code, bool fragmented, bool maildrop, uint8_t seq_num,
+        const char *message_bytes, size_t message_len)
+{
+    _pager_bench_on_msg((uint32_t)cap_code, message_bytes, message_len);
+    return A_OK;
+}
+
+static
+aresult_t _pager_bench_flex_on_num(struct pager_flex *flex, uint16_t baud, uint8_t phase, uint8_t cycle_no,
+        uint8_t frame_no, uint64_t cap_code, const char *message_bytes, size_t message_len)
+{
+    _pager_bench_on_msg((uint32_t)cap_code, message_bytes, message_len);
+    return A_OK;
+}
+
+static
+aresult_t _pager_bench_pocsag_on_msg(struct pager_pocsag *pocsag, uint16_t baud_rate, uint32_t capcode,
+        const char *data, size_t data_len, uint8_t function)
+{
+    _pager_bench_on_msg(capcode, data, data_len);
+    return A_OK;
+}
+
+/**
+ * Make up the messages to send: varied lengths and capcodes, with every fourth POCSAG message
+ * numeric.
+ */
+static
+aresult_t _pager_bench_msgs_init(struct pager_bench_state *st, const struct pager_bench_case *cs)
+{
+    aresult_t ret = A_OK;
+
+    memset(st, 0, sizeof(*st));
+
+    if (FAILED(ret = TCALLOC((void **)&st->msgs, nr_bench_msgs, sizeof(struct pager_synth_msg)))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TCALLOC((void **)&st->texts, nr_bench_msgs, PAGER_BENCH_MAX_TEXT))) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_bench_msgs; i++) {
+        struct pager_synth_msg *msg = &st->msgs[i];
+
+        msg->capcode = 100000 + 37 * i;
+        msg->numeric = PAGER_BENCH_POCSAG == cs->protocol && 3 == i % 4;
+
+        if (true == msg->numeric) {
+            snprintf(st->texts[i], PAGER_BENCH_MAX_TEXT, "555-%04u", (unsigned)((i * 131) % 10000));
+        } else {
+            snprintf(st->texts[i], PAGER_BENCH_MAX_TEXT, "%u: call ext %u re ticket %u%s", (unsigned)(i % 10000),
+                    (unsigned)(1000 + (i * 7) % 9000), (unsigned)((i * 7919) % 1000000),
+                    0 == i % 3 ? ", urgent, partial outage" : "");
+        }
+
+        msg->text = st->texts[i];
+    }
+
+    st->nr_msgs = nr_bench_msgs;
+
+done:
+    return ret;
+}
+
+static
+void _pager_bench_msgs_cleanup(struct pager_bench_state *st)
+{
+    if (NULL != st->msgs) {
+        TFREE(st->msgs);
+    }
+
+    if (NULL != st->texts) {
+        TFREE(st->texts);
+    }
+}
+
+/**
+ * Render the signal for a case: a quarter second of noise, the messages, then another quarter
+ * second of noise to let the decoder finish.
+ */
+static
+aresult_t _pager_bench_render(struct pager_synth **psynth, const struct pager_bench_case *cs,
+        const struct pager_bench_state *st)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_synth *synth = NULL;
+    size_t max_samples = 0,
+           nr_sent = 0;
+    unsigned frame_no = 0;
+
+    if (PAGER_BENCH_FLEX == cs->protocol) {
+        /* At worst, a 1.875 second frame for each message */
+        max_samples = (st->nr_msgs + 2) * (cs->sample_rate * 15 / 8);
+    } else {
+        /* At worst, every message in a batch of its own, plus idles up to its frame */
+        max_samples = (st->nr_msgs * ((PAGER_BENCH_MAX_TEXT * 7 / 20 + 18) * 32) + 1024) *
+            (size_t)cs->sample_rate / cs->baud;
+    }
+
+    max_samples += cs->sample_rate;
+
+    if (FAILED(ret = pager_synth_new(&synth, cs->sample_rate, max_samples, noise_level, clock_ppm, 0x5eed))) {
+        goto done;
+    }
+
+    if (FAILED(ret = pager_synth_gap(synth, cs->sample_rate / 4))) {
+        goto done;
+    }
+
+    if (PAGER_BENCH_FLEX == cs->protocol) {
+        while (nr_sent < st->nr_msgs) {
+            size_t nr_frame = 0;
+
+            if (FAILED(ret = pager_synth_flex_frame(synth, cs->baud, cs->fsk_levels, 0, frame_no++ % 128,
+                            &st->msgs[nr_sent], st->nr_msgs - nr_sent, &nr_frame)))
+            {
+                goto done;
+            }
+
+            nr_sent += nr_frame;
+        }
+    } else if (FAILED(ret = pager_synth_pocsag(synth, cs->baud, st->msgs, st->nr_msgs))) {
+        goto done;
+    }
+
+    if (FAILED(ret = pager_synth_gap(synth, cs->sample_rate / 4))) {
+        goto done;
+    }
+
+    *psynth = synth;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != synth) {
+            pager_synth_delete(&synth);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Decode the whole signal once, with a fresh decoder
+ */
+static
+aresult_t _pager_bench_pass(const struct pager_bench_case *cs, const struct pager_synth *synth)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_flex *flex = NULL;
+    struct pager_pocsag *pocsag = NULL;
+
+    bench_state.next_msg = 0;
+    bench_state.nr_matched = 0;
+    bench_state.nr_decoded = 0;
+
+    if (PAGER_BENCH_FLEX == cs->protocol) {
+        if (FAILED(ret = pager_flex_new(&flex, 0, _pager_bench_flex_on_alnum, _pager_bench_flex_on_num, NULL))) {
+            goto done;
+        }
+    } else if (FAILED(ret = pager_pocsag_new_rate(&pocsag, 0, cs->sample_rate, _pager_bench_pocsag_on_msg,
+                    _pager_bench_pocsag_on_msg, false)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < synth->nr_samples; i += PAGER_BENCH_CHUNK_SAMPLES) {
+        size_t nr_samples = synth->nr_samples - i;
+
+        if (nr_samples > PAGER_BENCH_CHUNK_SAMPLES) {
+            nr_samples = PAGER_BENCH_CHUNK_SAMPLES;
+        }
+
+        if (NULL != flex) {
+            ret = pager_flex_on_pcm(flex, &synth->pcm[i], nr_samples);
+        } else {
+            ret = pager_pocsag_on_pcm(pocsag, &synth->pcm[i], nr_samples);
+        }
+
+        if (FAILED(ret)) {
+            goto done;
+        }
+    }
+
+done:
+    if (NULL != flex) {
+        pager_flex_delete(&flex);
+    }
+
+    if (NULL != pocsag) {
+        pager_pocsag_delete(&pocsag);
+    }
+
+    return ret;
+}
+
+/**
+ * Decode a case's signal until at least the minimum run time has elapsed, then report the
+ * throughput and how many of the messages sent were decoded.
+ */
+static
+aresult_t _pager_bench_run(const struct pager_bench_case *cs)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_synth *synth = NULL;
+    char variant[32];
+    uint64_t start_ns = 0,
+             elapsed_ns = 0,
+             nr_samples = 0,
+             nr_decoded = 0;
+    size_t nr_matched = 0;
+    double samples_per_sec = 0.0,
+           msgs_per_sec = 0.0,
+           success = 0.0;
+
+    if (PAGER_BENCH_FLEX == cs->protocol) {
+        snprintf(variant, sizeof(variant), "%u/%u", cs->baud, cs->fsk_levels);
+    } else {
+        snprintf(variant, sizeof(variant), "%u", cs->baud);
+    }
+
+    if (FAILED(ret = _pager_bench_msgs_init(&bench_state, cs))) {
+        goto done;
+    }
+
+    if (FAILED(ret = _pager_bench_render(&synth, cs, &bench_state))) {
+        goto done;
+    }
+
+    /* Warm up, and find out how many messages make it through; every pass decodes the same */
+    if (FAILED(ret = _pager_bench_pass(cs, synth))) {
+        goto done;
+    }
+
+    nr_matched = bench_state.nr_matched;
+
+    start_ns = sample_buf_now_ns();
+
+    do {
+        if (FAILED(ret = _pager_bench_pass(cs, synth))) {
+            goto done;
+        }
+
+        nr_samples += synth->nr_samples;
+        nr_decoded += bench_state.nr_decoded;
+
+        elapsed_ns = sample_buf_now_ns() - start_ns;
+    } while (elapsed_ns < min_run_ns);
+
+    samples_per_sec = (double)nr_samples * 1e9 / (double)elapsed_ns;
+    msgs_per_sec = (double)nr_decoded * 1e9 / (double)elapsed_ns;
+    success = 100.0 * (double)nr_matched / (double)bench_state.nr_msgs;
+
+    fprintf(table_out, "%-8s %-8s %6u %6zu %6zu %8.1f%% %10.3f %10.1f %12.1f\n", cs->bench, variant,
+            cs->sample_rate, bench_state.nr_msgs, nr_matched, success, samples_per_sec / 1e6,
+            samples_per_sec / (double)cs->sample_rate, msgs_per_sec);
+
+    if (NULL != json_out) {
+        fprintf(json_out, "%s\n    { \"bench\": \"%s\", \"variant\": \"%s\", \"baud\": %u, \"fsk_levels\": %u, "
+                "\"sample_rate\": %u, \"messages_sent\": %zu, \"messages_decoded\": %zu, \"success_pct\": %.2f, "
+                "\"samples\": %llu, \"elapsed_ns\": %llu, \"samples_per_sec\": %.1f, \"realtime_channels\": %.1f, "
+                "\"messages_per_sec\": %.1f }",
+                true == json_first ? "" : ",", cs->bench, variant, cs->baud, cs->fsk_levels, cs->sample_rate,
+                bench_state.nr_msgs, nr_matched, success, (unsigned long long)nr_samples,
+                (unsigned long long)elapsed_ns, samples_per_sec, samples_per_sec / (double)cs->sample_rate,
+                msgs_per_sec);
+        json_first = false;
+    }
+
+done:
+    if (FAILED(ret)) {
+        PB_MSG(SEV_ERROR, "BENCH-FAILED", "Benchmark %s (%s) failed", cs->bench, variant);
+    }
+
+    if (NULL != synth) {
+        pager_synth_delete(&synth);
+    }
+
+    _pager_bench_msgs_cleanup(&bench_state);
+
+    return ret;
+}
+
+static
+bool _pager_bench_wanted(const char *bench)
+{
+    return NULL == bench_match || NULL != strstr(bench, bench_match);
+}
+
+static
+void _usage(const char *appname)
+{
+    PB_MSG(SEV_INFO, "USAGE", "%s [-t min time per case, ms] [-b benchmark] [-N messages] [-n noise] [-c clock ppm] "
+            "[-j json output file]", appname);
+    PB_MSG(SEV_INFO, "USAGE", "        -b      Only run benchmarks whose name contains this string (flex or pocsag)");
+    PB_MSG(SEV_INFO, "USAGE", "        -N      Number of messages to send in each case (default 64)");
+    PB_MSG(SEV_INFO, "USAGE", "        -n      RMS noise to add, as a fraction of the symbol level (default 0)");
+    PB_MSG(SEV_INFO, "USAGE", "        -c      Transmitter symbol clock error, in parts per million (default 0)");
+    PB_MSG(SEV_INFO, "USAGE", "        -j      Write the results as JSON to this file, or - for stdout");
+    exit(EXIT_SUCCESS);
+}
+
+static
+void _set_options(int argc, char * const argv[])
+{
+    int arg = -1;
+    const char *json_file = NULL;
+
+    while ((arg = getopt(argc, argv, "t:b:N:n:c:j:h")) != -1) {
+        switch (arg) {
+        case 't':
+            min_run_ns = strtoull(optarg, NULL, 0) * 1000000ull;
+            break;
+        case 'b':
+            bench_match = optarg;
+            break;
+        case 'N':
+            nr_bench_msgs = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            noise_level = strtod(optarg, NULL);
+            break;
+        case 'c':
+            clock_ppm = strtod(optarg, NULL);
+            break;
+        case 'j':
+            json_file = optarg;
+            break;
+        case 'h':
+            _usage(argv[0]);
+            break;
+        }
+    }
+
+    if (0 == min_run_ns) {
+        PB_MSG(SEV_FATAL, "BAD-TIME", "Minimum time per case must be a non-zero number of milliseconds.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (0 == nr_bench_msgs) {
+        PB_MSG(SEV_FATAL, "BAD-MESSAGES", "Must send at least one message.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (noise_level < 0.0) {
+        PB_MSG(SEV_FATAL, "BAD-NOISE", "Noise level must not be negative.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (clock_ppm <= -1e6) {
+        PB_MSG(SEV_FATAL, "BAD-CLOCK", "Clock error must be more than -1000000 ppm.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (NULL != json_file) {
+        if (!strcmp(json_file, "-")) {
+            json_out = stdout;
+        } else if (NULL == (json_out = fopen(json_file, "w"))) {
+            PB_MSG(SEV_FATAL, "BAD-JSON-FILE", "Failed to open %s for writing", json_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int main(int argc, char * const argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    struct utsname uts;
+
+    TSL_BUG_IF_FAILED(app_init("pager_bench", NULL));
+
+    _set_options(argc, argv);
+
+    if (0 != uname(&uts)) {
+        strcpy(uts.machine, "unknown");
+    }
+
+    PB_MSG(SEV_INFO, "STARTING", "Pager benchmarks, version %s, %s, %zu messages, noise %.3f, clock %+.1f ppm",
+            _VC_VERSION, uts.machine, nr_bench_msgs, noise_level, clock_ppm);
+
+    if (NULL != json_out) {
+        fprintf(json_out, "{ \"version\": \"%s\", \"machine\": \"%s\", \"min_run_ns\": %llu, \"messages\": %zu, "
+                "\"noise\": %.4f, \"clock_ppm\": %.2f, \"results\": [", _VC_VERSION, uts.machine,
+                (unsigned long long)min_run_ns, nr_bench_msgs, noise_level, clock_ppm);
+    }
+
+    /* Keep the JSON on stdout parseable */
+    table_out = stdout == json_out ? stderr : stdout;
+
+    fprintf(table_out, "%-8s %-8s %6s %6s %6s %9s %10s %10s %12s\n", "bench", "variant", "rate", "sent", "got",
+            "success", "Msample/s", "realtime", "messages/s");
+
+    for (size_t i = 0; i < sizeof(pager_bench_cases)/sizeof(pager_bench_cases[0]); i++) {
+        if (false == _pager_bench_wanted(pager_bench_cases[i].bench)) {
+            continue;
+        }
+
+        if (FAILED(_pager_bench_run(&pager_bench_cases[i]))) {
+            goto done;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    if (NULL != json_out) {
+        fprintf(json_out, "\n] }\n");
+        if (stdout != json_out) {
+            fclose(json_out);
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,697 @@
+/*
+ *  pager_synth.c - Synthetic FLEX and POCSAG signals, for benchmarking the decoders
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pager/bench/pager_synth.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+#include <tsl/diag.h>
+#include <tsl/assert.h>
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * Generator polynomial of the BCH(31, 21) code: x^10 + x^9 + x^8 + x^6 + x^5 + x^3 + 1
+ */
+#define PAGER_SYNTH_BCH_POLY                0x769u
+
+#define PAGER_SYNTH_POCSAG_PREAMBLE_BITS    576
+#define PAGER_SYNTH_POCSAG_SYNC             0x7cd215d8ul
+#define PAGER_SYNTH_POCSAG_IDLE             0x7a89c197ul
+#define PAGER_SYNTH_POCSAG_BATCH_WORDS      16
+
+/**
+ * POCSAG function bits for alphanumeric and numeric messages
+ */
+#define PAGER_SYNTH_POCSAG_FUNC_ALPHA       3
+#define PAGER_SYNTH_POCSAG_FUNC_NUMERIC     0
+
+/**
+ * End of text, padding out alphanumeric messages
+ */
+#define PAGER_SYNTH_ETX                     0x03
+
+#define PAGER_SYNTH_FLEX_SYNC_BAUD          1600
+#define PAGER_SYNTH_FLEX_BS1                0xaaaaaaaaul
+#define PAGER_SYNTH_FLEX_SYNC_B             0x5555u
+#define PAGER_SYNTH_FLEX_SYNC_C             0xed84u
+#define PAGER_SYNTH_FLEX_PHASE_WORDS        88
+#define PAGER_SYNTH_FLEX_BLOCK_WORDS        8
+#define PAGER_SYNTH_FLEX_SHORT_ADDR_BASE    32768
+#define PAGER_SYNTH_FLEX_SHORT_ADDR_MAX     0x1e0000ul
+#define PAGER_SYNTH_FLEX_MSG_ALPHANUMERIC   0x5
+#define PAGER_SYNTH_FLEX_PHASE_MAX          4
+
+/**
+ * Cut-off of the receive filter, in multiples of the symbol rate
+ */
+#define PAGER_SYNTH_LPF_SYMBOL_RATES        2.0
+
+/**
+ * A FLEX coding, as the decoder knows it
+ */
+struct pager_synth_flex_coding {
+    unsigned baud;
+    unsigned fsk_levels;
+
+    /**
+     * The code sent in the A word of sync 1
+     */
+    uint16_t seq_a;
+
+    /**
+     * Symbols of comma in sync 2
+     */
+    unsigned comma_symbols;
+
+    unsigned nr_phases;
+};
+
+static const
+struct pager_synth_flex_coding _pager_synth_flex_codings[] = {
+    { .baud = 1600, .fsk_levels = 2, .seq_a = 0x78f3, .comma_symbols = 4, .nr_phases = 1 },
+    { .baud = 3200, .fsk_levels = 2, .seq_a = 0x84e7, .comma_symbols = 24, .nr_phases = 2 },
+    { .baud = 3200, .fsk_levels = 4, .seq_a = 0x4f97, .comma_symbols = 12, .nr_phases = 2 },
+    { .baud = 6400, .fsk_levels = 4, .seq_a = 0x215f, .comma_symbols = 32, .nr_phases = 4 },
+};
+
+/**
+ * Even parity, and the BCH(31, 21) check bits, for 21 bits of data. Bit 0 of the data is the
+ * first sent, the coefficient of x^30.
+ */
+static
+uint32_t _pager_synth_bch_encode(uint32_t data)
+{
+    uint32_t poly = 0,
+             word = data & 0x1fffff;
+
+    for (size_t i = 0; i < 21; i++) {
+        poly |= ((word >> i) & 1) << (30 - i);
+    }
+
+    for (int deg = 30; deg >= 10; deg--) {
+        if (poly & (1ul << deg)) {
+            poly ^= PAGER_SYNTH_BCH_POLY << (deg - 10);
+        }
+    }
+
+    for (size_t j = 0; j < 10; j++) {
+        word |= ((poly >> j) & 1) << (30 - j);
+    }
+
+    return word | (uint32_t)(__builtin_popcount(word) & 1) << 31;
+}
+
+static
+uint64_t _pager_synth_rand(struct pager_synth *synth)
+{
+    synth->rand_state ^= synth->rand_state << 13;
+    synth->rand_state ^= synth->rand_state >> 7;
+    synth->rand_state ^= synth->rand_state << 17;
+
+    return synth->rand_state;
+}
+
+/**
+ * A standard normal variate, by Box-Muller
+ */
+static
+double _pager_synth_gauss(struct pager_synth *synth)
+{
+    double u1 = ((double)(_pager_synth_rand(synth) >> 11) + 1.0) / 9007199254740993.0,
+           u2 = (double)(_pager_synth_rand(synth) >> 11) / 9007199254740992.0;
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static
+void _pager_synth_set_symbol_rate(struct pager_synth *synth, unsigned symbol_rate)
+{
+    synth->lpf_alpha = 1.0 - exp(-2.0 * M_PI * PAGER_SYNTH_LPF_SYMBOL_RATES * symbol_rate /
+            (double)synth->sample_rate);
+}
+
+/**
+ * Render a sample at a level between -1 and 1, through the filter and with noise added
+ */
+static
+void _pager_synth_emit(struct pager_synth *synth, double level)
+{
+    double v = 0.0;
+
+    synth->lpf_y += synth->lpf_alpha * (level - synth->lpf_y);
+    v = (synth->lpf_y + synth->noise * _pager_synth_gauss(synth)) * PAGER_SYNTH_LEVEL;
+
+    if (v > INT16_MAX) {
+        v = INT16_MAX;
+    } else if (v < INT16_MIN) {
+        v = INT16_MIN;
+    }
+
+    synth->pcm[synth->nr_samples++] = (int16_t)lrint(v);
+}
+
+/**
+ * Render one symbol at a level between -1 and 1
+ */
+static
+aresult_t _pager_synth_symbol(struct pager_synth *synth, unsigned symbol_rate, double level)
+{
+    aresult_t ret = A_OK;
+
+    synth->next_symbol += (double)synth->sample_rate / ((double)symbol_rate * synth->clock_scale);
+
+    while ((double)synth->nr_samples + 0.5 < synth->next_symbol) {
+        if (synth->nr_samples == synth->max_samples) {
+            ret = A_E_NOMEM;
+            goto done;
+        }
+
+        _pager_synth_emit(synth, level);
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Render bits as 2FSK, a bit 1 at the given level and a 0 at its negative
+ */
+static
+aresult_t _pager_synth_bits(struct pager_synth *synth, unsigned baud, double one_level, uint32_t bits,
+        unsigned nr_bits, bool lsb_first)
+{
+    aresult_t ret = A_OK;
+
+    for (unsigned i = 0; i < nr_bits; i++) {
+        unsigned bit = lsb_first ? (bits >> i) & 1 : (bits >> (nr_bits - 1 - i)) & 1;
+
+        if (FAILED(ret = _pager_synth_symbol(synth, baud, bit ? one_level : -one_level))) {
+            goto done;
+        }
+    }
+
+done:
+    return ret;
+}
+
+aresult_t pager_synth_new(struct pager_synth **psynth, unsigned sample_rate, size_t max_samples, double noise,
+        double clock_ppm, uint64_t seed)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_synth *synth = NULL;
+
+    TSL_ASSERT_ARG(NULL != psynth);
+    TSL_ASSERT_ARG(0 != sample_rate);
+    TSL_ASSERT_ARG(0 != max_samples);
+    TSL_ASSERT_ARG(noise >= 0.0);
+    TSL_ASSERT_ARG(clock_ppm > -1e6);
+
+    *psynth = NULL;
+
+    if (FAILED(ret = TZAALLOC(synth, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&synth->pcm, max_samples, sizeof(int16_t), SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    synth->max_samples = max_samples;
+    synth->sample_rate = sample_rate;
+    synth->noise = noise;
+    synth->clock_scale = 1.0 + clock_ppm * 1e-6;
+
+    /* xorshift gets stuck on 0 */
+    synth->rand_state = 0 == seed ? 0x9e3779b97f4a7c15ull : seed;
+
+    *psynth = synth;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != synth) {
+            pager_synth_delete(&synth);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pager_synth_delete(struct pager_synth **psynth)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_synth *synth = NULL;
+
+    TSL_ASSERT_ARG(NULL != psynth);
+    TSL_ASSERT_ARG(NULL != *psynth);
+
+    synth = *psynth;
+
+    if (NULL != synth->pcm) {
+        TFREE(synth->pcm);
+    }
+
+    TFREE(synth);
+    *psynth = NULL;
+
+    return ret;
+}
+
+aresult_t pager_synth_gap(struct pager_synth *synth, size_t nr_samples)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != synth);
+
+    if (synth->nr_samples + nr_samples > synth->max_samples) {
+        ret = A_E_NOMEM;
+        goto done;
+    }
+
+    /* The carrier is gone, so the filter settles on nothing; the next symbol starts after the gap */
+    for (size_t i = 0; i < nr_samples; i++) {
+        _pager_synth_emit(synth, 0.0);
+    }
+
+    synth->next_symbol = (double)synth->nr_samples;
+
+done:
+    return ret;
+}
+
+/**
+ * A POCSAG transmission under construction, a code word at a time
+ */
+struct pager_synth_pocsag_tx {
+    struct pager_synth *synth;
+    unsigned baud;
+
+    /**
+     * The position of the next code word in its batch
+     */
+    unsigned batch_word;
+};
+
+/**
+ * Send a POCSAG code word, starting a batch with the sync word first if need be.
+ */
+static
+aresult_t _pager_synth_pocsag_word(struct pager_synth_pocsag_tx *tx, uint32_t word, bool lsb_first)
+{
+    aresult_t ret = A_OK;
+
+    /* A bit 1 is sent as a negative swing */
+    if (0 == tx->batch_word) {
+        if (FAILED(ret = _pager_synth_bits(tx->synth, tx->baud, -1.0, PAGER_SYNTH_POCSAG_SYNC, 32, false))) {
+            goto done;
+        }
+    }
+
+    if (FAILED(ret = _pager_synth_bits(tx->synth, tx->baud, -1.0, word, 32, lsb_first))) {
+        goto done;
+    }
+
+    tx->batch_word = (tx->batch_word + 1) % PAGER_SYNTH_POCSAG_BATCH_WORDS;
+
+done:
+    return ret;
+}
+
+static
+aresult_t _pager_synth_pocsag_idle(struct pager_synth_pocsag_tx *tx)
+{
+    return _pager_synth_pocsag_word(tx, PAGER_SYNTH_POCSAG_IDLE, false);
+}
+
+/**
+ * The 4 bit code for a numeric character, or -1 if it can't be sent
+ */
+static
+int _pager_synth_pocsag_bcd(char c)
+{
+    static const char *charmap = "0123456789XU -[]";
+    const char *p = NULL;
+
+    if ('\0' == c || NULL == (p = strchr(charmap, c))) {
+        return -1;
+    }
+
+    return p - charmap;
+}
+
+aresult_t pager_synth_pocsag(struct pager_synth *synth, unsigned baud, const struct pager_synth_msg *msgs,
+        size_t nr_msgs)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_synth_pocsag_tx tx = { .synth = synth, .baud = baud, .batch_word = 0 };
+
+    TSL_ASSERT_ARG(NULL != synth);
+    TSL_ASSERT_ARG(512 == baud || 1200 == baud || 2400 == baud);
+    TSL_ASSERT_ARG(0 == nr_msgs || NULL != msgs);
+    TSL_ASSERT_ARG(synth->sample_rate >= 2 * baud);
+
+    _pager_synth_set_symbol_rate(synth, baud);
+
+    for (size_t i = 0; i < PAGER_SYNTH_POCSAG_PREAMBLE_BITS; i++) {
+        if (FAILED(ret = _pager_synth_symbol(synth, baud, i & 1 ? 1.0 : -1.0))) {
+            goto done;
+        }
+    }
+
+    for (size_t m = 0; m < nr_msgs; m++) {
+        const struct pager_synth_msg *msg = &msgs[m];
+        size_t len = 0;
+        unsigned frame = msg->capcode & 0x7,
+                 bits_per_char = true == msg->numeric ? 4 : 7;
+        uint32_t acc = 0;
+        unsigned nr_acc = 0;
+
+        TSL_ASSERT_ARG(NULL != msg->text);
+        TSL_ASSERT_ARG(msg->capcode < (1ul << 21));
+
+        if ((len = strlen(msg->text)) > PAGER_SYNTH_MAX_MSG_LEN) {
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        /* The address goes in the frame its low 3 bits pick; idle up to it */
+        while (tx.batch_word / 2 != frame) {
+            if (FAILED(ret = _pager_synth_pocsag_idle(&tx))) {
+                goto done;
+            }
+        }
+
+        if (FAILED(ret = _pager_synth_pocsag_word(&tx, _pager_synth_bch_encode(
+                            ((msg->capcode >> 3) << 1) |
+                            (uint32_t)(true == msg->numeric ? PAGER_SYNTH_POCSAG_FUNC_NUMERIC :
+                                PAGER_SYNTH_POCSAG_FUNC_ALPHA) << 19), true)))
+        {
+            goto done;
+        }
+
+        /* Characters are packed least significant bit first, 20 bits to a code word, and the last
+         * code word is padded out with ETX (or spaces, for numeric messages)
+         */
+        for (size_t c = 0; c < len || 0 != nr_acc; c++) {
+            int code = 0;
+
+            if (c < len) {
+                code = true == msg->numeric ? _pager_synth_pocsag_bcd(msg->text[c]) : msg->text[c] & 0x7f;
+                if (code < 0) {
+                    ret = A_E_INVAL;
+                    goto done;
+                }
+            } else {
+                code = true == msg->numeric ? _pager_synth_pocsag_bcd(' ') : PAGER_SYNTH_ETX;
+            }
+
+            acc |= (uint32_t)code << nr_acc;
+            nr_acc += bits_per_char;
+
+            if (nr_acc >= 20) {
+                if (FAILED(ret = _pager_synth_pocsag_word(&tx,
+                                _pager_synth_bch_encode(1 | (acc & 0xfffff) << 1), true)))
+                {
+                    goto done;
+                }
+
+                /* Carry over what didn't fit, unless it's only padding */
+                nr_acc = c < len ? nr_acc - 20 : 0;
+                acc = 0 == nr_acc ? 0 : (uint32_t)code >> (bits_per_char - nr_acc);
+            }
+        }
+    }
+
+    /* End the last message, and fill out its batch */
+    do {
+        if (FAILED(ret = _pager_synth_pocsag_idle(&tx))) {
+            goto done;
+        }
+    } while (0 != tx.batch_word);
+
+done:
+    return ret;
+}
+
+/**
+ * The FLEX checksum nibble that makes the nibbles of the 21 data bits sum to 0xf
+ */
+static
+uint32_t _pager_synth_flex_checksum(uint32_t word)
+{
+    unsigned sum = 0;
+
+    word &= 0x1ffff0;
+
+    for (size_t nibble = 0; nibble < 6; nibble++) {
+        sum += (word >> (4 * nibble)) & 0xf;
+    }
+
+    return word | ((0xf - sum) & 0xf);
+}
+
+/**
+ * Fill in the words of a phase with as many messages as fit. The phase is laid out as the BIW,
+ * then an address word for each message, then a vector word for each, then the messages.
+ */
+static
+aresult_t _pager_synth_flex_phase(uint32_t *words, const struct pager_synth_msg *msgs, size_t nr_msgs,
+        size_t *pnr_sent)
+{
+    aresult_t ret = A_OK;
+
+    size_t nr_fit = 0,
+           nr_used = 1,
+           msg_word = 0;
+
+    /* Work out how many messages fit */
+    while (nr_fit < nr_msgs) {
+        const struct pager_synth_msg *msg = &msgs[nr_fit];
+        size_t len = strlen(msg->text),
+               nr_msg_words = 2 + (len > 2 ? (len - 2 + 2) / 3 : 0);
+
+        if (true == msg->numeric || len > PAGER_SYNTH_MAX_MSG_LEN || 0 == msg->capcode ||
+                msg->capcode > PAGER_SYNTH_FLEX_SHORT_ADDR_MAX - PAGER_SYNTH_FLEX_SHORT_ADDR_BASE)
+        {
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        /* The vector start word field is 6 bits */
+        if (nr_used + 2 + nr_msg_words > PAGER_SYNTH_FLEX_PHASE_WORDS || 1 + nr_fit + 1 > 63) {
+            break;
+        }
+
+        nr_used += 2 + nr_msg_words;
+        nr_fit++;
+    }
+
+    for (size_t i = 0; i < PAGER_SYNTH_FLEX_PHASE_WORDS; i++) {
+        words[i] = _pager_synth_bch_encode(0x1fffff);
+    }
+
+    /* BIW: no extra BIWs, vectors start after the addresses */
+    words[0] = _pager_synth_bch_encode(_pager_synth_flex_checksum((uint32_t)(1 + nr_fit) << 10));
+
+    msg_word = 1 + 2 * nr_fit;
+
+    for (size_t m = 0; m < nr_fit; m++) {
+        const struct pager_synth_msg *msg = &msgs[m];
+        size_t len = strlen(msg->text),
+               nr_msg_words = 2 + (len > 2 ? (len - 2 + 2) / 3 : 0),
+               c = 0;
+
+        words[1 + m] = _pager_synth_bch_encode(msg->capcode + PAGER_SYNTH_FLEX_SHORT_ADDR_BASE);
+        words[1 + nr_fit + m] = _pager_synth_bch_encode(_pager_synth_flex_checksum(
+                    PAGER_SYNTH_FLEX_MSG_ALPHANUMERIC << 4 | (uint32_t)msg_word << 7 |
+                    (uint32_t)nr_msg_words << 14));
+
+        /* Status word: not fragmented, the first (and only) fragment */
+        words[msg_word] = _pager_synth_bch_encode(3ul << 11);
+
+        /* Three characters to a word, except the first, which skips the first 7 bits */
+        for (size_t w = 1; w < nr_msg_words; w++) {
+            uint32_t data = 0;
+
+            for (size_t j = 1 == w ? 1 : 0; j < 3; j++) {
+                data |= (uint32_t)(c < len ? msg->text[c] & 0x7f : PAGER_SYNTH_ETX) << (7 * j);
+                c++;
+            }
+
+            words[msg_word + w] = _pager_synth_bch_encode(data);
+        }
+
+        msg_word += nr_msg_words;
+    }
+
+    *pnr_sent = nr_fit;
+
+done:
+    return ret;
+}
+
+/**
+ * A 4FSK level for a pair of bits: the first picks the sign, the second an inner level
+ */
+static
+double _pager_synth_flex_4fsk_level(unsigned outer_bit, unsigned inner_bit)
+{
+    double mag = inner_bit ? 1.0 / 3.0 : 1.0;
+
+    return outer_bit ? mag : -mag;
+}
+
+aresult_t pager_synth_flex_frame(struct pager_synth *synth, unsigned baud, unsigned fsk_levels, uint8_t cycle_no,
+        uint8_t frame_no, const struct pager_synth_msg *msgs, size_t nr_msgs, size_t *pnr_sent)
+{
+    aresult_t ret = A_OK;
+
+    const struct pager_synth_flex_coding *coding = NULL;
+    uint32_t phase_words[PAGER_SYNTH_FLEX_PHASE_MAX][PAGER_SYNTH_FLEX_PHASE_WORDS];
+    uint32_t a = 0,
+             fiw = 0;
+    unsigned symbol_rate = 0;
+    size_t nr_sent = 0;
+
+    TSL_ASSERT_ARG(NULL != synth);
+    TSL_ASSERT_ARG(0 == nr_msgs || NULL != msgs);
+    TSL_ASSERT_ARG(cycle_no < 15);
+    TSL_ASSERT_ARG(frame_no < 128);
+    TSL_ASSERT_ARG(NULL != pnr_sent);
+
+    *pnr_sent = 0;
+
+    for (size_t i = 0; i < sizeof(_pager_synth_flex_codings)/sizeof(_pager_synth_flex_codings[0]); i++) {
+        if (baud == _pager_synth_flex_codings[i].baud && fsk_levels == _pager_synth_flex_codings[i].fsk_levels) {
+            coding = &_pager_synth_flex_codings[i];
+        }
+    }
+
+    if (NULL == coding) {
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    symbol_rate = baud / (fsk_levels / 2);
+
+    /* Fill the phases in turn */
+    for (size_t p = 0; p < coding->nr_phases; p++) {
+        size_t nr_phase_sent = 0;
+
+        if (FAILED(ret = _pager_synth_flex_phase(phase_words[p], &msgs[nr_sent], nr_msgs - nr_sent,
+                        &nr_phase_sent)))
+        {
+            goto done;
+        }
+
+        nr_sent += nr_phase_sent;
+    }
+
+    /* Sync 1, always at 1600 baud 2FSK, a bit 1 being a positive swing */
+    _pager_synth_set_symbol_rate(synth, PAGER_SYNTH_FLEX_SYNC_BAUD);
+
+    a = (uint32_t)coding->seq_a << 16 | (uint16_t)~coding->seq_a;
+    fiw = _pager_synth_bch_encode(_pager_synth_flex_checksum((uint32_t)cycle_no << 4 | (uint32_t)frame_no << 8));
+
+    if (FAILED(ret = _pager_synth_bits(synth, PAGER_SYNTH_FLEX_SYNC_BAUD, 1.0, PAGER_SYNTH_FLEX_BS1, 32, false)) ||
+            FAILED(ret = _pager_synth_bits(synth, PAGER_SYNTH_FLEX_SYNC_BAUD, 1.0, a, 32, false)) ||
+            FAILED(ret = _pager_synth_bits(synth, PAGER_SYNTH_FLEX_SYNC_BAUD, 1.0, PAGER_SYNTH_FLEX_SYNC_B, 16, false)) ||
+            FAILED(ret = _pager_synth_bits(synth, PAGER_SYNTH_FLEX_SYNC_BAUD, 1.0, ~a, 32, false)) ||
+            FAILED(ret = _pager_synth_bits(synth, PAGER_SYNTH_FLEX_SYNC_BAUD, 1.0, fiw, 32, true)))
+    {
+        goto done;
+    }
+
+    /* Sync 2, at the coding's symbol rate: comma, C, inverted comma, inverted C */
+    _pager_synth_set_symbol_rate(synth, symbol_rate);
+
+    for (size_t half = 0; half < 2; half++) {
+        uint16_t c = 0 == half ? PAGER_SYNTH_FLEX_SYNC_C : (uint16_t)~PAGER_SYNTH_FLEX_SYNC_C;
+
+        for (size_t i = 0; i < coding->comma_symbols; i++) {
+            if (FAILED(ret = _pager_synth_symbol(synth, symbol_rate, (i + half) & 1 ? -1.0 : 1.0))) {
+                goto done;
+            }
+        }
+
+        if (2 == fsk_levels) {
+            ret = _pager_synth_bits(synth, symbol_rate, 1.0, c, 16, false);
+        } else {
+            for (int i = 14; i >= 0 && !FAILED(ret); i -= 2) {
+                ret = _pager_synth_symbol(synth, symbol_rate,
+                        _pager_synth_flex_4fsk_level((c >> (i + 1)) & 1, (c >> i) & 1));
+            }
+        }
+
+        if (FAILED(ret)) {
+            goto done;
+        }
+    }
+
+    /* The blocks: each phase's words are sent 8 at a time, a bit of each in turn from the least
+     * significant up. The phases are spread over the symbols as the decoder takes them apart.
+     */
+    for (size_t blk = 0; blk < PAGER_SYNTH_FLEX_PHASE_WORDS / PAGER_SYNTH_FLEX_BLOCK_WORDS; blk++) {
+        for (size_t n = 0; n < 32 * PAGER_SYNTH_FLEX_BLOCK_WORDS; n++) {
+            unsigned bits[PAGER_SYNTH_FLEX_PHASE_MAX];
+
+            for (size_t p = 0; p < coding->nr_phases; p++) {
+                bits[p] = (phase_words[p][blk * PAGER_SYNTH_FLEX_BLOCK_WORDS + n % 8] >> (n / 8)) & 1;
+            }
+
+            switch (coding->nr_phases) {
+            case 1:
+                ret = _pager_synth_symbol(synth, symbol_rate, bits[0] ? 1.0 : -1.0);
+                break;
+            case 2:
+                if (2 == fsk_levels) {
+                    if (FAILED(ret = _pager_synth_symbol(synth, symbol_rate, bits[0] ? 1.0 : -1.0))) {
+                        break;
+                    }
+                    ret = _pager_synth_symbol(synth, symbol_rate, bits[1] ? 1.0 : -1.0);
+                } else {
+                    ret = _pager_synth_symbol(synth, symbol_rate, _pager_synth_flex_4fsk_level(bits[0], bits[1]));
+                }
+                break;
+            case 4:
+                if (FAILED(ret = _pager_synth_symbol(synth, symbol_rate,
+                                _pager_synth_flex_4fsk_level(bits[0], bits[1]))))
+                {
+                    break;
+                }
+                ret = _pager_synth_symbol(synth, symbol_rate, _pager_synth_flex_4fsk_level(bits[2], bits[3]));
+                break;
+            }
+
+            if (FAILED(ret)) {
+                goto done;
+            }
+        }
+    }
+
+    *pnr_sent = nr_sent;
+
+done:
+    return ret;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Synthetic pager signals: messages encoded as FLEX or POCSAG and rendered as the PCM an FM
+ * discriminator would put out, for driving the decoders without a radio.
+ *
+ * Symbols are rendered as flat levels at a fraction of full scale, band limited by a single pole
+ * low pass (standing in for the receiver's post-discriminator filter) and with Gaussian noise
+ * added. The transmitter's symbol clock can be made fast or slow, to exercise clock recovery.
+ *
+ * Code words are built the way the decoders read them back, with the first bit sent in bit 0
+ * and the BCH(31, 21) check bits above the data.
+ */
+
+/**
+ * Peak level of a rendered symbol
+ */
+#define PAGER_SYNTH_LEVEL                   8000
+
+/**
+ * The longest message the generator will encode
+ */
+#define PAGER_SYNTH_MAX_MSG_LEN             200
+
+/**
+ * A message to send
+ */
+struct pager_synth_msg {
+    /**
+     * The capcode to send the message to. FLEX only sends short addresses, so capcodes from 1 to
+     * 1933312; POCSAG capcodes are 21 bits.
+     */
+    uint32_t capcode;
+
+    /**
+     * Send as a numeric message (POCSAG only), rather than alphanumeric
+     */
+    bool numeric;
+
+    /**
+     * The message
+     */
+    const char *text;
+};
+
+/**
+ * A generator, and the samples it has rendered so far
+ */
+struct pager_synth {
+    /**
+     * The samples rendered
+     */
+    int16_t *pcm;
+    size_t nr_samples;
+    size_t max_samples;
+
+    unsigned sample_rate;
+
+    /**
+     * The transmitter's symbol rate relative to nominal
+     */
+    double clock_scale;
+
+    /**
+     * RMS noise, as a fraction of PAGER_SYNTH_LEVEL
+     */
+    double noise;
+
+    /**
+     * Where the next symbol starts, in samples since the first sample
+     */
+    double next_symbol;
+
+    /**
+     * Low pass filter state and coefficient
+     */
+    double lpf_y;
+    double lpf_alpha;
+
+    uint64_t rand_state;
+};
+
+/**
+ * Create a generator.
+ *
+ * \param psynth The generator, returned by reference
+ * \param sample_rate The sample rate to render at
+ * \param max_samples The most samples to render
+ * \param noise RMS noise to add, as a fraction of the symbol level. 0 for none.
+ * \param clock_ppm How fast the transmitter's symbol clock runs, in parts per million. Negative
+ *                  for slow.
+ * \param seed Seed for the noise
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_synth_new(struct pager_synth **psynth, unsigned sample_rate, size_t max_samples, double noise,
+        double clock_ppm, uint64_t seed);
+
+/**
+ * Destroy a generator, and the samples rendered.
+ *
+ * \param psynth The generator, passed by reference. Set to NULL.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_synth_delete(struct pager_synth **psynth);
+
+/**
+ * Render a stretch of nothing but noise.
+ *
+ * \param synth The generator
+ * \param nr_samples The number of samples
+ *
+ * \return A_OK on success, A_E_NOMEM if there isn't room for them
+ */
+aresult_t pager_synth_gap(struct pager_synth *synth, size_t nr_samples);
+
+/**
+ * Render a POCSAG transmission: the preamble, then as many batches as it takes to send every
+ * message, each ended by the next address or an idle code word.
+ *
+ * \param synth The generator
+ * \param baud 512, 1200 or 2400
+ * \param msgs The messages
+ * \param nr_msgs The number of messages
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_synth_pocsag(struct pager_synth *synth, unsigned baud, const struct pager_synth_msg *msgs,
+        size_t nr_msgs);
+
+/**
+ * Render a FLEX frame, with as many of the messages as fit in it. The FLEX decoder only takes
+ * 16000 Hz samples.
+ *
+ * \param synth The generator
+ * \param baud 1600, 3200 or 6400
+ * \param fsk_levels 2 or 4; 1600 baud is always 2, 6400 always 4
+ * \param cycle_no The cycle number, from 0 to 14
+ * \param frame_no The frame number, from 0 to 127
+ * \param msgs The messages
+ * \param nr_msgs The number of messages
+ * \param pnr_sent The number of messages sent in the frame, from the start of msgs
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_synth_flex_frame(struct pager_synth *synth, unsigned baud, unsigned fsk_levels, uint8_t cycle_no,
+        uint8_t frame_no, const struct pager_synth_msg *msgs, size_t nr_msgs, size_t *pnr_sent);
@@ -114,3 +114,103 @@ aresult_t mm_process(struct mueller_muller *mm, const int16_t *samples, size_t n
     return ret;
 }
 
+void mm_restart(struct mueller_muller *mm, float next_offset)
+{
+    TSL_BUG_ON(NULL == mm);
+
+    mm->w = mm->ideal_step_size;
+    mm->m = 0.0f;
+    mm->next_offset = next_offset;
+    mm->last_sample = 0.0f;
+    mm->last_input = 0.0f;
+    mm->level = 0.0f;
+}
+
+/**
+ * How quickly the signal level estimate follows the signal, per decision
+ */
+#define MM_LEVEL_GAIN           (1.0f/16.0f)
+
+aresult_t mm_recover(struct mueller_muller *mm, const int16_t *samples, size_t nr_samples, int16_t *decisions,
+        size_t nr_decisions, size_t *pnr_decisions_out, size_t *pnr_consumed)
+{
+    aresult_t ret = A_OK;
+
+    float pos = 0.0f,
+          w = 0.0f,
+          level = 0.0f,
+          last_sample = 0.0f;
+    size_t cur_decision = 0,
+           consumed = 0;
+
+    TSL_ASSERT_ARG(NULL != mm);
+    TSL_ASSERT_ARG(NULL != samples);
+    TSL_ASSERT_ARG(NULL != decisions);
+    TSL_ASSERT_ARG(NULL != pnr_decisions_out);
+    TSL_ASSERT_ARG(NULL != pnr_consumed);
+
+    pos = mm->next_offset;
+    w = mm->w;
+    level = mm->level;
+    last_sample = mm->last_sample;
+
+    /* pos is never before the last sample of the previous block, kept in last_input */
+    while (cur_decision < nr_decisions && pos + 1.0f < (float)nr_samples) {
+        float base = floorf(pos),
+              mu = pos - base,
+              x0 = base < 0.0f ? mm->last_input : (float)samples[(size_t)base],
+              x1 = (float)samples[(size_t)(base + 1.0f)],
+              sample = x0 + mu * (x1 - x0),
+              w_error = 0.0f;
+
+        decisions[cur_decision++] = (int16_t)sample;
+
+        if (0.0f == level) {
+            level = fabsf(sample);
+        } else {
+            level += (fabsf(sample) - level) * MM_LEVEL_GAIN;
+        }
+
+        if (level < 1.0f) {
+            level = 1.0f;
+        }
+
+        w_error = (_mm_get_sign(last_sample) * sample - _mm_get_sign(sample) * last_sample) / level;
+
+        w += w_error * mm->kw;
+
+        if (mm->error_min > w) {
+            w = mm->error_min;
+        } else if (mm->error_max < w) {
+            w = mm->error_max;
+        }
+
+        pos += w + mm->km * w_error;
+        last_sample = sample;
+    }
+
+    if (cur_decision < nr_decisions) {
+        /* Out of samples: everything is consumed */
+        consumed = nr_samples;
+    } else {
+        /* Stopped early: consume up to the next decision */
+        consumed = pos > 0.0f ? (size_t)pos : 0;
+        if (consumed > nr_samples) {
+            consumed = nr_samples;
+        }
+    }
+
+    if (0 != consumed) {
+        mm->last_input = samples[consumed - 1];
+    }
+
+    mm->next_offset = pos - (float)consumed;
+    mm->w = w;
+    mm->level = level;
+    mm->last_sample = last_sample;
+
+    *pnr_decisions_out = cur_decision;
+    *pnr_consumed = consumed;
+
+    return ret;
+}
@@ -9,8 +9,8 @@
 /**
  * State for a Mueller-Muller clock recovery.
  *
- * This is a soft-decision block, but it does not interpolate the samples. Thus, the
- * caller must slice the ouputs per their requirements.
+ * This is a soft-decision block, so the caller must slice the outputs per their requirements.
+ * mm_process takes the nearest sample; mm_recover interpolates between samples.
  *
  * TODO: make this fixed point. Using an int32_t is probably enough overkill for error
  * accumulation to not murder us.
@@ -53,6 +53,16 @@ struct mueller_muller {
      */
     float ideal_step_size;
 
+    /**
+     * The last input sample of the previous block, for interpolating across blocks (mm_recover)
+     */
+    float last_input;
+
+    /**
+     * Running estimate of the signal level, to normalize the timing error (mm_recover)
+     */
+    float level;
+
 #ifdef _MM_DEBUG
     /**
      * Total samples processed
@@ -95,3 +105,35 @@ aresult_t mm_init(struct mueller_muller *mm, float kp, float km, float samples_p
  */
 aresult_t mm_process(struct mueller_muller *mm, const int16_t *samples, size_t nr_samples, int16_t *decisions,
         size_t nr_decisions, size_t *pnr_decisions_out);
+
+/**
+ * Restart clock recovery at a known bit boundary, such as the end of a sync word, keeping the
+ * gains and limits.
+ *
+ * \param mm The Mueller-Muller Clock Recovery instance
+ * \param next_offset Where in the next block of samples the next decision is to be made
+ */
+void mm_restart(struct mueller_muller *mm, float next_offset);
+
+/**
+ * Recover decisions from a block of samples, interpolating between samples, and stopping after
+ * nr_decisions. Unlike mm_process, both control loops are driven by the timing error, normalized
+ * to the level of the signal, so the gains don't depend on the signal level and the loop holds
+ * lock down to 2 samples per bit.
+ *
+ * The rate (omega) is updated by kw times the normalized timing error each decision, and the
+ * phase (mu) by km times it.
+ *
+ * \param mm The Mueller-Muller Clock Recovery instance
+ * \param samples Raw PCM samples to process
+ * \param nr_samples The number of samples
+ * \param decisions Soft bit decisions, returned by reference
+ * \param nr_decisions The most decisions to make
+ * \param pnr_decisions_out The number of decisions made
+ * \param pnr_consumed The number of samples consumed. All of them, unless nr_decisions was
+ *                     reached first; the rest should be passed in next time.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t mm_recover(struct mueller_muller *mm, const int16_t *samples, size_t nr_samples, int16_t *decisions,
+        size_t nr_decisions, size_t *pnr_decisions_out, size_t *pnr_consumed);
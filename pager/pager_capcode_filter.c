@@ -0,0 +1,210 @@
+/*
+ *  pager_capcode_filter.c - Sets of capcodes to keep or drop messages for
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pager/pager_capcode_filter.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+#include <tsl/diag.h>
+#include <tsl/assert.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static
+int _pager_capcode_filter_compare(const void *a, const void *b)
+{
+    uint64_t ca = *(const uint64_t *)a,
+             cb = *(const uint64_t *)b;
+
+    return ca < cb ? -1 : (ca > cb);
+}
+
+aresult_t pager_capcode_filter_new(struct pager_capcode_filter **pfilter, const uint64_t *capcodes,
+        size_t nr_capcodes, bool deny)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_capcode_filter *filter = NULL;
+    size_t nr_unique = 0;
+
+    TSL_ASSERT_ARG(NULL != pfilter);
+    TSL_ASSERT_ARG(0 == nr_capcodes || NULL != capcodes);
+
+    *pfilter = NULL;
+
+    if (FAILED(ret = TZAALLOC(filter, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    filter->deny = deny;
+
+    if (0 != nr_capcodes) {
+        if (FAILED(ret = TACALLOC((void **)&filter->capcodes, nr_capcodes, sizeof(uint64_t),
+                        SYS_CACHE_LINE_LENGTH)))
+        {
+            goto done;
+        }
+
+        memcpy(filter->capcodes, capcodes, nr_capcodes * sizeof(uint64_t));
+        qsort(filter->capcodes, nr_capcodes, sizeof(uint64_t), _pager_capcode_filter_compare);
+
+        for (size_t i = 0; i < nr_capcodes; i++) {
+            if (0 == nr_unique || filter->capcodes[nr_unique - 1] != filter->capcodes[i]) {
+                filter->capcodes[nr_unique++] = filter->capcodes[i];
+            }
+        }
+    }
+
+    filter->nr_capcodes = nr_unique;
+
+    *pfilter = filter;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != filter) {
+            pager_capcode_filter_delete(&filter);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pager_capcode_filter_load(struct pager_capcode_filter **pfilter, const char *file_name, bool deny)
+{
+    aresult_t ret = A_OK;
+
+    FILE *fp = NULL;
+    char line[128];
+    uint64_t *capcodes = NULL;
+    size_t nr_capcodes = 0,
+           max_capcodes = 0,
+           line_no = 0;
+
+    TSL_ASSERT_ARG(NULL != pfilter);
+    TSL_ASSERT_ARG(NULL != file_name);
+
+    *pfilter = NULL;
+
+    if (NULL == (fp = fopen(file_name, "r"))) {
+        int errnum = errno;
+        DIAG("Failed to open capcode file '%s': %s (%d)", file_name, strerror(errnum), errnum);
+        ret = A_E_NOTFOUND;
+        goto done;
+    }
+
+    while (NULL != fgets(line, sizeof(line), fp)) {
+        char *cur = line,
+             *end = NULL;
+        unsigned long long capcode = 0;
+
+        line_no++;
+
+        if (NULL != (end = strchr(line, '#'))) {
+            *end = '\0';
+        }
+
+        while (isspace((unsigned char)*cur)) {
+            cur++;
+        }
+
+        if ('\0' == *cur) {
+            continue;
+        }
+
+        errno = 0;
+        capcode = strtoull(cur, &end, 10);
+
+        while (isspace((unsigned char)*end)) {
+            end++;
+        }
+
+        if (0 != errno || end == cur || '\0' != *end) {
+            DIAG("%s:%zu: not a capcode", file_name, line_no);
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        if (nr_capcodes == max_capcodes) {
+            uint64_t *new_capcodes = NULL;
+
+            max_capcodes = 0 == max_capcodes ? 1024 : max_capcodes * 2;
+
+            if (FAILED(ret = TCALLOC((void **)&new_capcodes, max_capcodes, sizeof(uint64_t)))) {
+                goto done;
+            }
+
+            if (NULL != capcodes) {
+                memcpy(new_capcodes, capcodes, nr_capcodes * sizeof(uint64_t));
+                TFREE(capcodes);
+            }
+
+            capcodes = new_capcodes;
+        }
+
+        capcodes[nr_capcodes++] = capcode;
+    }
+
+    if (FAILED(ret = pager_capcode_filter_new(pfilter, capcodes, nr_capcodes, deny))) {
+        goto done;
+    }
+
+    DIAG("Loaded %zu capcodes to %s from '%s'", (*pfilter)->nr_capcodes, true == deny ? "drop" : "keep",
+            file_name);
+
+done:
+    if (NULL != fp) {
+        fclose(fp);
+    }
+
+    if (NULL != capcodes) {
+        TFREE(capcodes);
+    }
+
+    return ret;
+}
+
+aresult_t pager_capcode_filter_delete(struct pager_capcode_filter **pfilter)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_capcode_filter *filter = NULL;
+
+    TSL_ASSERT_ARG(NULL != pfilter);
+
+    if (NULL == *pfilter) {
+        goto done;
+    }
+
+    filter = *pfilter;
+
+    if (NULL != filter->capcodes) {
+        TFREE(filter->capcodes);
+    }
+
+    TFREE(filter);
+    *pfilter = NULL;
+
+done:
+    return ret;
+}
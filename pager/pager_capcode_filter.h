@@ -0,0 +1,98 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A set of capcodes to decode messages for (an allow list), or not to (a deny list). Checked as
+ * soon as an address is decoded, so the message words for an unwanted capcode are never
+ * corrected, decoded or written out.
+ *
+ * Once built a filter is only read, so one filter can be shared by any number of decoders, on any
+ * number of threads.
+ */
+struct pager_capcode_filter {
+    /**
+     * The capcodes, sorted, without duplicates
+     */
+    uint64_t *capcodes;
+
+    /**
+     * The number of capcodes
+     */
+    size_t nr_capcodes;
+
+    /**
+     * Whether the capcodes are the ones to drop, rather than the ones to keep
+     */
+    bool deny;
+};
+
+/**
+ * Create a capcode filter from a list of capcodes.
+ *
+ * \param pfilter The new filter, returned by reference
+ * \param capcodes The capcodes, in any order
+ * \param nr_capcodes The number of capcodes
+ * \param deny Drop messages for the capcodes, rather than keeping only them
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_capcode_filter_new(struct pager_capcode_filter **pfilter, const uint64_t *capcodes,
+        size_t nr_capcodes, bool deny);
+
+/**
+ * Create a capcode filter from a file listing one capcode per line. Blank lines, and anything
+ * after a '#', are ignored.
+ *
+ * \param pfilter The new filter, returned by reference
+ * \param file_name The file to read
+ * \param deny Drop messages for the capcodes, rather than keeping only them
+ *
+ * \return A_OK on success, A_E_NOTFOUND if the file can't be opened, A_E_INVAL if a line isn't a
+ *         capcode, an error code otherwise
+ */
+aresult_t pager_capcode_filter_load(struct pager_capcode_filter **pfilter, const char *file_name, bool deny);
+
+/**
+ * Destroy a capcode filter. No decoder may still be using it.
+ *
+ * \param pfilter The filter, passed by reference. Set to NULL.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_capcode_filter_delete(struct pager_capcode_filter **pfilter);
+
+/**
+ * Check whether messages for a capcode should be decoded.
+ *
+ * \param filter The filter. NULL lets every capcode through.
+ * \param capcode The capcode
+ *
+ * \return true if the message should be decoded, false to skip it
+ */
+static inline
+bool pager_capcode_filter_wanted(const struct pager_capcode_filter *filter, uint64_t capcode)
+{
+    const uint64_t *base = NULL;
+    size_t len = 0;
+
+    if (NULL == filter) {
+        return true;
+    }
+
+    base = filter->capcodes;
+    len = filter->nr_capcodes;
+
+    /* Binary search, halving the range without branching on the comparison */
+    while (len > 1) {
+        size_t half = len / 2;
+        base = base[half] <= capcode ? base + half : base;
+        len -= half;
+    }
+
+    return (0 != len && *base == capcode) != filter->deny;
+}
@@ -0,0 +1,429 @@
+/*
+ *  pager_decode_pool.c - Worker threads for decoding pager frames off the sample thread
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This file is a part of The Standard Library (TSL)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pager/pager_decode_pool.h>
+#include <pager/pager_priv.h>
+
+#include <tsl/cal.h>
+#include <tsl/errors.h>
+#include <tsl/assert.h>
+#include <tsl/diag.h>
+#include <tsl/panic.h>
+#include <tsl/safe_alloc.h>
+#include <tsl/worker_thread.h>
+
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * How long an idle worker sleeps before checking whether it should shut down, in milliseconds
+ */
+#define PAGER_DECODE_POOL_IDLE_TIMEOUT_MS   100
+
+/**
+ * A slot in the job queue. The sequence number says whose turn it is: a producer may fill the
+ * slot when it equals the position being pushed, and a consumer may empty it when it is one past
+ * the position being popped.
+ */
+struct pager_decode_pool_slot {
+    atomic_size_t seq;
+    struct pager_decode_job *job;
+};
+
+struct pager_decode_pool_worker {
+    struct worker_thread wthr;
+    struct pager_decode_pool *pool;
+
+    /**
+     * Whether or not the worker thread was started
+     */
+    bool started;
+};
+
+/**
+ * A bounded, lock-free, multi-producer multi-consumer queue of jobs, and the threads that work
+ * through it. Workers only sleep (on a semaphore eventfd) once they've found the queue empty,
+ * and producers only make a system call when a worker is asleep.
+ */
+struct pager_decode_pool {
+    /**
+     * The next position to be pushed. Shared by the producers.
+     */
+    atomic_size_t push_pos CAL_CACHE_ALIGNED;
+
+    /**
+     * The next position to be popped. Shared by the consumers.
+     */
+    atomic_size_t pop_pos CAL_CACHE_ALIGNED;
+
+    /**
+     * The number of workers asleep, or about to be
+     */
+    atomic_size_t nr_sleeping CAL_CACHE_ALIGNED;
+
+    /**
+     * The number of jobs that found the queue full, and were done by the submitter
+     */
+    atomic_size_t nr_overflows;
+
+    /**
+     * The eventfd idle workers sleep on, counting wakeups
+     */
+    int wake_fd;
+
+    /**
+     * The number of slots, less one. The number of slots is always a power of 2.
+     */
+    size_t mask;
+
+    struct pager_decode_pool_slot *slots;
+
+    struct pager_decode_pool_worker *workers;
+    size_t nr_workers;
+};
+
+static
+bool _pager_decode_pool_push(struct pager_decode_pool *pool, struct pager_decode_job *job)
+{
+    size_t pos = atomic_load_explicit(&pool->push_pos, memory_order_relaxed);
+    struct pager_decode_pool_slot *slot = NULL;
+
+    for (;;) {
+        size_t seq = 0;
+        intptr_t dif = 0;
+
+        slot = &pool->slots[pos & pool->mask];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (0 == dif) {
+            if (atomic_compare_exchange_weak_explicit(&pool->push_pos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        } else if (dif < 0) {
+            /* The slot from a lap ago hasn't been emptied yet, so the queue is full */
+            return false;
+        } else {
+            pos = atomic_load_explicit(&pool->push_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->job = job;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+static
+struct pager_decode_job *_pager_decode_pool_pop(struct pager_decode_pool *pool)
+{
+    size_t pos = atomic_load_explicit(&pool->pop_pos, memory_order_relaxed);
+    struct pager_decode_pool_slot *slot = NULL;
+    struct pager_decode_job *job = NULL;
+
+    for (;;) {
+        size_t seq = 0;
+        intptr_t dif = 0;
+
+        slot = &pool->slots[pos & pool->mask];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (0 == dif) {
+            if (atomic_compare_exchange_weak_explicit(&pool->pop_pos, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        } else if (dif < 0) {
+            /* Nothing has been pushed here yet */
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&pool->pop_pos, memory_order_relaxed);
+        }
+    }
+
+    job = slot->job;
+    atomic_store_explicit(&slot->seq, pos + pool->mask + 1, memory_order_release);
+
+    return job;
+}
+
+static
+void _pager_decode_pool_job_run(struct pager_decode_job *job)
+{
+    job->work(job);
+    atomic_store_explicit(&job->done, true, memory_order_release);
+}
+
+/**
+ * Sleep until a job is pushed, or the idle timeout elapses
+ */
+static
+void _pager_decode_pool_sleep(struct pager_decode_pool *pool)
+{
+    struct pollfd pfd = { .fd = pool->wake_fd, .events = POLLIN };
+    uint64_t count = 0;
+
+    if (0 > poll(&pfd, 1, PAGER_DECODE_POOL_IDLE_TIMEOUT_MS)) {
+        int errnum = errno;
+        if (EINTR != errnum) {
+            PANIC("Failed to wait for decode work. Reason: %s (%d)", strerror(errnum), errnum);
+        }
+    }
+
+    /* Take one wakeup, if there is one left; another worker may have beaten us to it */
+    if (0 > read(pool->wake_fd, &count, sizeof(count)) && EAGAIN != errno) {
+        int errnum = errno;
+        PANIC("Failed to read decode pool eventfd. Reason: %s (%d)", strerror(errnum), errnum);
+    }
+}
+
+static
+aresult_t _pager_decode_pool_work(struct worker_thread *wthr)
+{
+    struct pager_decode_pool_worker *wkr = BL_CONTAINER_OF(wthr, struct pager_decode_pool_worker, wthr);
+    struct pager_decode_pool *pool = wkr->pool;
+
+    while (worker_thread_is_running(wthr)) {
+        struct pager_decode_job *job = NULL;
+
+        if (NULL != (job = _pager_decode_pool_pop(pool))) {
+            _pager_decode_pool_job_run(job);
+            continue;
+        }
+
+        atomic_fetch_add_explicit(&pool->nr_sleeping, 1, memory_order_relaxed);
+
+        /* Pairs with the fence in pager_decode_pool_run */
+        atomic_thread_fence(memory_order_seq_cst);
+
+        /* Make sure nothing arrived while we were getting ready to sleep */
+        if (NULL != (job = _pager_decode_pool_pop(pool))) {
+            atomic_fetch_sub_explicit(&pool->nr_sleeping, 1, memory_order_relaxed);
+            _pager_decode_pool_job_run(job);
+            continue;
+        }
+
+        _pager_decode_pool_sleep(pool);
+
+        atomic_fetch_sub_explicit(&pool->nr_sleeping, 1, memory_order_relaxed);
+    }
+
+    return A_OK;
+}
+
+void pager_decode_pool_run(struct pager_decode_pool *pool, struct pager_decode_job *job)
+{
+    uint64_t one = 1;
+
+    TSL_BUG_ON(NULL == job);
+    TSL_BUG_ON(NULL == job->work);
+
+    atomic_store_explicit(&job->done, false, memory_order_relaxed);
+
+    if (NULL == pool) {
+        _pager_decode_pool_job_run(job);
+        return;
+    }
+
+    if (false == _pager_decode_pool_push(pool, job)) {
+        /* The workers are this far behind, so waiting for them wouldn't be any faster */
+        atomic_fetch_add_explicit(&pool->nr_overflows, 1, memory_order_relaxed);
+        _pager_decode_pool_job_run(job);
+        return;
+    }
+
+    /* Pairs with the fence in _pager_decode_pool_work */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (0 != atomic_load_explicit(&pool->nr_sleeping, memory_order_relaxed)) {
+        if (0 > write(pool->wake_fd, &one, sizeof(one)) && EAGAIN != errno) {
+            int errnum = errno;
+            PANIC("Failed to wake decode pool worker. Reason: %s (%d)", strerror(errnum), errnum);
+        }
+    }
+}
+
+void pager_decode_pool_wait(struct pager_decode_pool *pool, struct pager_decode_job *job)
+{
+    TSL_BUG_ON(NULL == job);
+
+    while (false == pager_decode_job_done(job)) {
+        struct pager_decode_job *other = NULL;
+
+        if (NULL != pool && NULL != (other = _pager_decode_pool_pop(pool))) {
+            _pager_decode_pool_job_run(other);
+        } else {
+            /* Our job is on a worker already */
+            sched_yield();
+        }
+    }
+}
+
+aresult_t pager_decode_pool_new(struct pager_decode_pool **ppool, size_t nr_workers, size_t nr_jobs)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_decode_pool *pool = NULL;
+    size_t nr_slots = 1;
+
+    TSL_ASSERT_ARG(NULL != ppool);
+    TSL_ASSERT_ARG(0 != nr_workers);
+    TSL_ASSERT_ARG(0 != nr_jobs);
+
+    *ppool = NULL;
+
+    while (nr_slots < nr_jobs) {
+        nr_slots <<= 1;
+    }
+
+    if (FAILED(ret = TZAALLOC(pool, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    pool->wake_fd = -1;
+    pool->mask = nr_slots - 1;
+    atomic_init(&pool->push_pos, 0);
+    atomic_init(&pool->pop_pos, 0);
+    atomic_init(&pool->nr_sleeping, 0);
+    atomic_init(&pool->nr_overflows, 0);
+
+    if (FAILED(ret = TACALLOC((void **)&pool->slots, nr_slots, sizeof(struct pager_decode_pool_slot),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr_slots; i++) {
+        atomic_init(&pool->slots[i].seq, i);
+    }
+
+    if (0 > (pool->wake_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC))) {
+        int errnum = errno;
+        PAG_MSG(SEV_ERROR, "CANT-CREATE-EVENTFD", "Failed to create eventfd for decode pool: %s (%d)",
+                strerror(errnum), errnum);
+        ret = A_E_INVAL;
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&pool->workers, nr_workers, sizeof(struct pager_decode_pool_worker),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    pool->nr_workers = nr_workers;
+
+    for (size_t i = 0; i < nr_workers; i++) {
+        struct pager_decode_pool_worker *wkr = &pool->workers[i];
+
+        wkr->pool = pool;
+
+        if (FAILED(ret = worker_thread_new(&wkr->wthr, _pager_decode_pool_work, WORKER_THREAD_CPU_MASK_ANY))) {
+            PAG_MSG(SEV_ERROR, "THREAD-START-FAIL", "Failed to start decode pool worker thread %zu, aborting.", i);
+            goto done;
+        }
+
+        wkr->started = true;
+    }
+
+    *ppool = pool;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != pool) {
+            pager_decode_pool_delete(&pool);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pager_decode_pool_delete(struct pager_decode_pool **ppool)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_decode_pool *pool = NULL;
+    uint64_t wakeups = 0;
+
+    TSL_ASSERT_ARG(NULL != ppool);
+
+    if (NULL == *ppool) {
+        goto done;
+    }
+
+    pool = *ppool;
+
+    if (NULL != pool->workers) {
+        for (size_t i = 0; i < pool->nr_workers; i++) {
+            if (true == pool->workers[i].started) {
+                TSL_BUG_IF_FAILED(worker_thread_request_shutdown(&pool->workers[i].wthr));
+            }
+        }
+
+        /* Wake everyone up, rather than waiting out the idle timeout */
+        wakeups = pool->nr_workers;
+        if (0 <= pool->wake_fd && 0 > write(pool->wake_fd, &wakeups, sizeof(wakeups))) {
+            DIAG("Failed to wake decode pool workers, they'll exit at the idle timeout");
+        }
+
+        for (size_t i = 0; i < pool->nr_workers; i++) {
+            if (true == pool->workers[i].started) {
+                TSL_BUG_IF_FAILED(worker_thread_delete(&pool->workers[i].wthr));
+                pool->workers[i].started = false;
+            }
+        }
+
+        TFREE(pool->workers);
+    }
+
+    if (0 != atomic_load(&pool->nr_overflows)) {
+        PAG_MSG(SEV_INFO, "DECODE-POOL", "%zu jobs were run by the thread handing them over, with the decode queue full",
+                atomic_load(&pool->nr_overflows));
+    }
+
+    /* Nobody uses the pool any more, so no jobs can be left in the queue */
+    TSL_BUG_ON(atomic_load(&pool->push_pos) != atomic_load(&pool->pop_pos));
+
+    if (0 <= pool->wake_fd) {
+        close(pool->wake_fd);
+    }
+
+    if (NULL != pool->slots) {
+        TFREE(pool->slots);
+    }
+
+    TFREE(pool);
+
+    *ppool = NULL;
+
+done:
+    return ret;
+}
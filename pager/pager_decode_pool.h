@@ -0,0 +1,82 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pager_decode_job;
+struct pager_decode_pool;
+
+/**
+ * Decode a job. Called on a pool worker thread, or on the thread that submitted the job. Must
+ * only touch the job itself, and anything else that doesn't change while the job is pending.
+ */
+typedef void (*pager_decode_job_func_t)(struct pager_decode_job *job);
+
+/**
+ * A unit of decoding work: a FLEX frame or a POCSAG batch, embedded in the protocol decoder's
+ * own record of the work.
+ */
+struct pager_decode_job {
+    /**
+     * The function that does the work
+     */
+    pager_decode_job_func_t work;
+
+    /**
+     * Set once the work is done, after which the submitter owns the job again
+     */
+    atomic_bool done;
+};
+
+/**
+ * Create a pool of threads that decode FLEX frames and POCSAG batches handed over by any number
+ * of decoders, so the threads receiving the samples carry on acquiring symbols while earlier
+ * frames are decoded. The worker threads are started right away.
+ *
+ * \param ppool The new pool, returned by reference
+ * \param nr_workers The number of worker threads
+ * \param nr_jobs The most jobs that can be waiting for a worker. Rounded up to a power of 2.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_decode_pool_new(struct pager_decode_pool **ppool, size_t nr_workers, size_t nr_jobs);
+
+/**
+ * Stop the worker threads, and destroy the pool. Every decoder using the pool must have been
+ * deleted, or detached from it, first.
+ *
+ * \param ppool The pool, passed by reference. Set to NULL.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_decode_pool_delete(struct pager_decode_pool **ppool);
+
+/**
+ * Hand a job to the pool. If there is no pool, or no room in its queue, the job is done right
+ * away, on the calling thread. Either way, the job is done once pager_decode_job_done says so.
+ *
+ * \param pool The pool, or NULL
+ * \param job The job. Its work function must be set.
+ */
+void pager_decode_pool_run(struct pager_decode_pool *pool, struct pager_decode_job *job);
+
+/**
+ * Wait for a job handed to pager_decode_pool_run to be done. The waiting thread helps out with
+ * other jobs in the queue, rather than sitting idle.
+ *
+ * \param pool The pool the job was handed to, or NULL
+ * \param job The job
+ */
+void pager_decode_pool_wait(struct pager_decode_pool *pool, struct pager_decode_job *job);
+
+/**
+ * Check if a job is done, and its results can be used.
+ */
+static inline
+bool pager_decode_job_done(struct pager_decode_job *job)
+{
+    return atomic_load_explicit(&job->done, memory_order_acquire);
+}
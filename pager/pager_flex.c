@@ -23,6 +23,11 @@
 #include <pager/pager_flex.h>
 #include <pager/pager_flex_priv.h>
 #include <pager/bch_code.h>
+#include <pager/pager_capcode_filter.h>
+#include <pager/pager_flex_reasm.h>
+#include <pager/pager_decode_pool.h>
+
+#include <filter/cycle_counter.h>
 
 #include <tsl/errors.h>
 #include <tsl/diag.h>
@@ -39,6 +44,10 @@
 
 static inline int8_t _pager_flex_slice_2fsk(struct pager_flex *flex, int16_t sample);
 static inline int8_t _pager_flex_slice_4fsk(struct pager_flex *flex, int16_t sample);
+static void _pager_flex_slice_block_2fsk(struct pager_flex *flex, const int16_t *samples, size_t stride,
+        int8_t *symbols, size_t nr_symbols);
+static void _pager_flex_slice_block_4fsk(struct pager_flex *flex, const int16_t *samples, size_t stride,
+        int8_t *symbols, size_t nr_symbols);
 
 /**
  * Sync codes indicating the FSK mode used for SYNC 2 and beyond.
@@ -53,6 +62,7 @@ struct pager_flex_coding _pager_codings[] = {
         .sync_2_samples = 4,
         .sym_bits = 1,
         .slice = _pager_flex_slice_2fsk,
+        .slice_block = _pager_flex_slice_block_2fsk,
         .sample_fudge = 0,
         .symbols_per_block = 2816,
         .nr_phases = 1,
@@ -65,6 +75,7 @@ struct pager_flex_coding _pager_codings[] = {
         .sync_2_samples = 24,
         .sym_bits = 1,
         .slice = _pager_flex_slice_2fsk,
+        .slice_block = _pager_flex_slice_block_2fsk,
         .sample_fudge = 2,
         .symbols_per_block = 5632,
         .nr_phases = 2,
@@ -77,6 +88,7 @@ struct pager_flex_coding _pager_codings[] = {
         .sync_2_samples = 12,
         .sym_bits = 2,
         .slice = _pager_flex_slice_4fsk,
+        .slice_block = _pager_flex_slice_block_4fsk,
         .sample_fudge = 0,
         .symbols_per_block = 2816,
         .nr_phases = 2,
@@ -89,6 +101,7 @@ struct pager_flex_coding _pager_codings[] = {
         .sync_2_samples = 32,
         .sym_bits = 2,
         .slice = _pager_flex_slice_4fsk,
+        .slice_block = _pager_flex_slice_block_4fsk,
         .sample_fudge = 2,
         .symbols_per_block = 5632,
         .nr_phases = 4,
@@ -170,6 +183,55 @@ int8_t _pager_flex_slice_4fsk(struct pager_flex *flex, int16_t sample)
     }
 }
 
+/**
+ * Slice a run of 2FSK symbols. Same as _pager_flex_slice_2fsk, but without branches, so the
+ * compiler can unroll and vectorize it.
+ *
+ * \param flex The FLEX pager state
+ * \param samples The first sample to slice
+ * \param stride The distance between the samples to slice
+ * \param symbols The symbols, returned by reference
+ * \param nr_symbols The number of symbols to slice
+ */
+static
+void _pager_flex_slice_block_2fsk(struct pager_flex *flex, const int16_t *samples, size_t stride,
+        int8_t *symbols, size_t nr_symbols)
+{
+#ifdef _TSL_DEBUG
+    TSL_BUG_ON(NULL == flex);
+#endif
+
+    for (size_t i = 0; i < nr_symbols; i++) {
+        symbols[i] = samples[i * stride] >= 0;
+    }
+}
+
+/**
+ * Slice a run of 4FSK symbols. Same as _pager_flex_slice_4fsk: bit 1 of the symbol is the sign,
+ * and bit 0 is set for the inner levels.
+ *
+ * \param flex The FLEX pager state
+ * \param samples The first sample to slice
+ * \param stride The distance between the samples to slice
+ * \param symbols The symbols, returned by reference
+ * \param nr_symbols The number of symbols to slice
+ */
+static
+void _pager_flex_slice_block_4fsk(struct pager_flex *flex, const int16_t *samples, size_t stride,
+        int8_t *symbols, size_t nr_symbols)
+{
+    int16_t delta = flex->sample_delta;
+    int32_t threshold = flex->sample_range/4;
+
+    for (size_t i = 0; i < nr_symbols; i++) {
+        /* Wraps the same way the single sample slicer does */
+        int32_t sample = (int16_t)(samples[i * stride] - delta),
+                mag = sample < 0 ? -sample : sample;
+
+        symbols[i] = ((sample >= 0) << 1) | (mag <= threshold);
+    }
+}
+
 static
 void _pager_flex_block_reset(struct pager_flex_block *block)
 {
@@ -183,8 +245,8 @@ void _pager_flex_block_reset(struct pager_flex_block *block)
 
     for (size_t i = 0; i < PAGER_FLEX_PHASE_MAX; i++) {
         struct pager_flex_phase *ph = &block->phase[i];
-        ph->cur_bit = 0;
-        ph->cur_word = 0;
+        memset(ph->block_bits, 0, sizeof(ph->block_bits));
+        ph->nr_block_bits = 0;
         ph->base_word = 0;
     }
 
@@ -525,14 +587,14 @@ void _pager_flex_sync2_update(struct pager_flex *flex, int16_t sample)
 }
 
 static
-aresult_t _pager_flex_decode_address(struct pager_flex *flex, uint32_t *addr, uint64_t *pcapcode, size_t *pnr_words)
+aresult_t _pager_flex_decode_address(struct pager_flex_frame *frm, uint32_t *addr, uint64_t *pcapcode, size_t *pnr_words)
 {
     aresult_t ret = A_OK;
 
     uint32_t addr_first = 0,
              addr_second = 0;
 
-    TSL_ASSERT_ARG_DEBUG(NULL != flex);
+    TSL_ASSERT_ARG_DEBUG(NULL != frm);
     TSL_ASSERT_ARG_DEBUG(NULL != addr);
     TSL_ASSERT_ARG_DEBUG(NULL != pcapcode);
     TSL_ASSERT_ARG_DEBUG(NULL != pnr_words);
@@ -541,7 +603,7 @@ aresult_t _pager_flex_decode_address(struct pager_flex *flex, uint32_t *addr, ui
     *pnr_words = 0;
 
     /* Correct the first word */
-    if (bch_code_decode(flex->bch, &addr[0])) {
+    if (pager_stats_bch_decode(&frm->stats, frm->bch, &addr[0])) {
         ret = A_E_INVAL;
         goto done;
     }
@@ -556,7 +618,7 @@ aresult_t _pager_flex_decode_address(struct pager_flex *flex, uint32_t *addr, ui
         *pnr_words = 0;
     } else {
         /* Correct the second word */
-        if (bch_code_decode(flex->bch, &addr[1])) {
+        if (pager_stats_bch_decode(&frm->stats, frm->bch, &addr[1])) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -587,6 +649,38 @@ char *__pager_flex_type_code[] = {
     [0x7] = "NNM",
 };
 
+/**
+ * Keep the message in the frame's message buffer, to be handed over once the frame is delivered.
+ *
+ * \return The message record, to fill in the details for the message type, or NULL if the frame
+ *         has no room left for the message
+ */
+static
+struct pager_flex_frame_msg *_pager_flex_frame_add_msg(struct pager_flex_frame *frm, enum pager_flex_frame_msg_type type,
+        uint8_t phase, uint64_t capcode)
+{
+    struct pager_flex_frame_msg *msg = NULL;
+
+    if (PAGER_FLEX_FRAME_MSGS == frm->nr_msgs || frm->text_len + frm->msg_len > PAGER_FLEX_FRAME_TEXT_BYTES) {
+        frm->nr_dropped++;
+        return NULL;
+    }
+
+    msg = &frm->msgs[frm->nr_msgs++];
+    memset(msg, 0, sizeof(*msg));
+
+    msg->type = type;
+    msg->capcode = capcode;
+    msg->phase = phase;
+    msg->text_offs = frm->text_len;
+    msg->text_len = frm->msg_len;
+
+    memcpy(&frm->text[frm->text_len], frm->msg_buf, frm->msg_len);
+    frm->text_len += frm->msg_len;
+
+    return msg;
+}
+
 /**
  * Parse an alphanumeric vector. If long_word is -1, all words come from the words array. Otherwise, we'll
  * start with the long_word for processing the message body.
@@ -595,11 +689,11 @@ char *__pager_flex_type_code[] = {
  * special footwork around the long word.
  */
 static
-aresult_t _pager_flex_decode_alphanumeric(struct pager_flex *flex, uint8_t phase, uint64_t capcode, uint32_t long_word, uint32_t *words, size_t nr_words)
+aresult_t _pager_flex_decode_alphanumeric(struct pager_flex_frame *frm, uint8_t phase, uint64_t capcode, uint32_t long_word, uint32_t *words, size_t nr_words)
 {
     aresult_t ret = A_OK;
 
-    struct pager_flex_coding *coding = NULL;
+    struct pager_flex_frame_msg *msg = NULL;
     size_t first_char_word = 1;
     int skip_word = 0;
     uint32_t status_word = 0;
@@ -607,14 +701,10 @@ aresult_t _pager_flex_decode_alphanumeric(struct pager_flex *flex, uint8_t phase
     bool maildrop = false,
          fragment = false;
 
-    TSL_ASSERT_ARG_DEBUG(NULL != flex);
+    TSL_ASSERT_ARG_DEBUG(NULL != frm);
     TSL_ASSERT_ARG_DEBUG(NULL != words);
     TSL_ASSERT_ARG_DEBUG(0 != nr_words);
 
-    coding = flex->sync.coding;
-
-    TSL_BUG_ON(NULL == coding);
-
     if (0xfffffffful != long_word) {
         first_char_word = 0;
         status_word = long_word;
@@ -622,7 +712,7 @@ aresult_t _pager_flex_decode_alphanumeric(struct pager_flex *flex, uint8_t phase
         first_char_word = 1;
         status_word = words[0];
 
-        if (bch_code_decode(flex->bch, &status_word)) {
+        if (pager_stats_bch_decode(&frm->stats, frm->bch, &status_word)) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -644,7 +734,7 @@ aresult_t _pager_flex_decode_alphanumeric(struct pager_flex *flex, uint8_t phase
     /* Iterate through the packed 7-bit ASCII characters */
     for (size_t i = first_char_word; i < nr_words; i++) {
         uint32_t codeword = words[i];
-        if (bch_code_decode(flex->bch, &codeword)) {
+        if (pager_stats_bch_decode(&frm->stats, frm->bch, &codeword)) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -656,25 +746,28 @@ aresult_t _pager_flex_decode_alphanumeric(struct pager_flex *flex, uint8_t phase
         for (size_t j = skip_word; j < 3; j++) {
             uint8_t ch = codeword & 0x7f;
             if (ch != 0x3) {
-                flex->msg_buf[flex->msg_len++] = ch;
+                frm->msg_buf[frm->msg_len++] = ch;
             } else {
                 break;
             }
 
-            if (flex->msg_len == 255) {
+            if (frm->msg_len == 255) {
                 break;
             }
             codeword >>= 7;
         }
         skip_word = 0;
 
-        if (flex->msg_len == 255) {
+        if (frm->msg_len == 255) {
             break;
         }
     }
 
-    ret = flex->on_alnum_msg(flex, coding->baud, phase, flex->cycle_id, flex->frame_id, capcode,
-            fragment, maildrop, seq_num, flex->msg_buf, flex->msg_len);
+    if (NULL != (msg = _pager_flex_frame_add_msg(frm, PAGER_FLEX_FRAME_MSG_ALNUM, phase, capcode))) {
+        msg->fragment = fragment;
+        msg->maildrop = maildrop;
+        msg->seq_num = seq_num;
+    }
 
 done:
     return ret;
@@ -707,11 +800,10 @@ char __pager_flex_num_lut[] = {
  * Decode a numeric message.
  */
 static
-aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uint64_t capcode, uint32_t long_word, uint32_t *words, size_t nr_words)
+aresult_t _pager_flex_decode_numeric(struct pager_flex_frame *frm, uint8_t phase, uint64_t capcode, uint32_t long_word, uint32_t *words, size_t nr_words)
 {
     aresult_t ret = A_OK;
 
-    struct pager_flex_coding *coding = NULL;
     uint32_t cur_word = 0,
              next_word = 0;
     size_t nr_bits = 0,
@@ -719,13 +811,9 @@ aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uin
            next_word_offs = 0,
            next_word_bits = 21;
 
-    TSL_ASSERT_ARG_DEBUG(NULL != flex);
+    TSL_ASSERT_ARG_DEBUG(NULL != frm);
     TSL_ASSERT_ARG_DEBUG(0 != capcode);
 
-    coding = flex->sync.coding;
-
-    TSL_BUG_ON(NULL == coding);
-
     nr_bits = nr_words * 21;
 
     if (long_word != 0xfffffffful) {
@@ -737,7 +825,7 @@ aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uin
     } else {
         /* Check the BCH code for cur_word */
         cur_word = words[0];
-        if (bch_code_decode(flex->bch, &cur_word)) {
+        if (pager_stats_bch_decode(&frm->stats, frm->bch, &cur_word)) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -750,7 +838,7 @@ aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uin
 
     if (next_word_offs < nr_words) {
         next_word = words[next_word_offs];
-        if (bch_code_decode(flex->bch, &next_word)) {
+        if (pager_stats_bch_decode(&frm->stats, frm->bch, &next_word)) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -765,8 +853,8 @@ aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uin
         size_t rem_bits = cur_word_bits & ~0x3;
 
         for (size_t i = 0; i < rem_bits; i += 4) {
-            flex->msg_buf[flex->msg_len++] = __pager_flex_num_lut[cur_word & 0xf];
-            if (flex->msg_len == 255) {
+            frm->msg_buf[frm->msg_len++] = __pager_flex_num_lut[cur_word & 0xf];
+            if (frm->msg_len == 255) {
                 break;
             }
             cur_word >>= 4;
@@ -774,7 +862,7 @@ aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uin
             nr_bits -= 4;
         }
 
-        if (flex->msg_len == 255) {
+        if (frm->msg_len == 255) {
             break;
         }
 
@@ -807,7 +895,7 @@ aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uin
             next_word_offs++;
             if (next_word_offs < nr_words) {
                 next_word = words[next_word_offs];
-                if (bch_code_decode(flex->bch, &next_word)) {
+                if (pager_stats_bch_decode(&frm->stats, frm->bch, &next_word)) {
                     ret = A_E_INVAL;
                     goto done;
                 }
@@ -816,8 +904,7 @@ aresult_t _pager_flex_decode_numeric(struct pager_flex *flex, uint8_t phase, uin
         }
     } while (0 != nr_bits);
 
-    ret = flex->on_num_msg(flex, coding->baud, phase, flex->cycle_id, flex->frame_id,
-            capcode, flex->msg_buf, flex->msg_len);
+    _pager_flex_frame_add_msg(frm, PAGER_FLEX_FRAME_MSG_NUM, phase, capcode);
 
 done:
     return ret;
@@ -827,20 +914,15 @@ done:
  * Decode a tone message. Tone messages can also contain a short numeric message.
  */
 static
-aresult_t _pager_flex_decode_tone(struct pager_flex *flex, uint8_t phase, uint64_t capcode, uint32_t first_word, uint32_t second_word)
+aresult_t _pager_flex_decode_tone(struct pager_flex_frame *frm, uint8_t phase, uint64_t capcode, uint32_t first_word, uint32_t second_word)
 {
     aresult_t ret = A_OK;
 
-    struct pager_flex_coding *coding = NULL;
     uint8_t type = 0;
 
-    TSL_ASSERT_ARG_DEBUG(NULL != flex);
+    TSL_ASSERT_ARG_DEBUG(NULL != frm);
     TSL_ASSERT_ARG_DEBUG(0 != capcode);
 
-    coding = flex->sync.coding;
-
-    TSL_BUG_ON(NULL == coding);
-
     first_word &= 0x1fffff;
 
     type = (first_word >> 7) & 0x3;
@@ -850,25 +932,25 @@ aresult_t _pager_flex_decode_tone(struct pager_flex *flex, uint8_t phase, uint64
         /* Parse the first word */
         first_word >>=9;
         for (int i = 0; i < 3; i++) {
-            flex->msg_buf[flex->msg_len++] = __pager_flex_num_lut[first_word & 0xf];
+            frm->msg_buf[frm->msg_len++] = __pager_flex_num_lut[first_word & 0xf];
             first_word >>= 4;
         }
         if (0xfffffffful != second_word) {
             second_word &= 0x1fffff;
             for (int i = 0; i < 5; i++) {
-                flex->msg_buf[flex->msg_len++] = __pager_flex_num_lut[second_word & 0xf];
+                frm->msg_buf[frm->msg_len++] = __pager_flex_num_lut[second_word & 0xf];
                 second_word >>= 4;
             }
         }
 
-        /* Deliver the message as a normal alphanumeric message */
-        ret = flex->on_num_msg(flex, coding->baud, phase, flex->cycle_id, flex->frame_id, capcode, flex->msg_buf, flex->msg_len);
+        /* Deliver the message as a normal numeric message */
+        _pager_flex_frame_add_msg(frm, PAGER_FLEX_FRAME_MSG_NUM, phase, capcode);
         break;
     case PAGER_FLEX_SHORT_TYPE_8_SOURCES:
-        PAG_MSG(SEV_INFO, "TONE", "%02u/%03u/%c [ %9"PRIu64"] Sourced Tone: [%08x, %08x]", flex->cycle_id, flex->frame_id, phase + 'A', capcode, first_word, second_word);
+        PAG_MSG(SEV_INFO, "TONE", "%02u/%03u/%c [ %9"PRIu64"] Sourced Tone: [%08x, %08x]", frm->cycle_id, frm->frame_id, phase + 'A', capcode, first_word, second_word);
         break;
     case PAGER_FLEX_SHORT_TYPE_SOURCES_AND_NUM:
-        PAG_MSG(SEV_INFO, "TONE", "%02u/%03u/%c [ %9"PRIu64"] Sequenced Tone: [%08x, %08x]", flex->cycle_id, flex->frame_id, phase + 'A', capcode, first_word, second_word);
+        PAG_MSG(SEV_INFO, "TONE", "%02u/%03u/%c [ %9"PRIu64"] Sequenced Tone: [%08x, %08x]", frm->cycle_id, frm->frame_id, phase + 'A', capcode, first_word, second_word);
         break;
 
     case PAGER_FLEX_SHORT_TYPE_UNUSED:
@@ -883,15 +965,15 @@ done:
 }
 
 static
-aresult_t _pager_flex_decode_short_instruction_vec(struct pager_flex *flex, uint8_t phase, uint64_t capcode, uint32_t vec_word)
+aresult_t _pager_flex_decode_short_instruction_vec(struct pager_flex_frame *frm, uint8_t phase, uint64_t capcode, uint32_t vec_word)
 {
     aresult_t ret = A_OK;
 
-    struct pager_flex_coding *coding = NULL;
+    struct pager_flex_frame_msg *msg = NULL;
     unsigned siv_type = 0,
              siv_data = 0;
 
-    TSL_ASSERT_ARG_DEBUG(NULL != flex);
+    TSL_ASSERT_ARG_DEBUG(NULL != frm);
 
     vec_word &= 0x7fffff;
 
@@ -900,8 +982,6 @@ aresult_t _pager_flex_decode_short_instruction_vec(struct pager_flex *flex, uint
         goto done;
     }
 
-    coding = flex->sync.coding;
-
     /* Middle 3 bits represent the instruction type */
     siv_type = (vec_word >> 7) & 0x7;
 
@@ -912,19 +992,19 @@ aresult_t _pager_flex_decode_short_instruction_vec(struct pager_flex *flex, uint
     case PAGER_FLEX_SIV_TEMP_ADDRESS_ACTIVATION:
         break;
     case PAGER_FLEX_SIV_SYSTEM_EVENT:
-        PAG_MSG(SEV_INFO, "SIV", "%02u/%03u/%c - [%9"PRIu64"] System Event (data = %08x)", flex->cycle_id, flex->frame_id, phase + 'A', capcode, siv_data);
+        PAG_MSG(SEV_INFO, "SIV", "%02u/%03u/%c - [%9"PRIu64"] System Event (data = %08x)", frm->cycle_id, frm->frame_id, phase + 'A', capcode, siv_data);
         break;
     case PAGER_FLEX_SIV_RESERVED_TEST:
-        PAG_MSG(SEV_INFO, "SIV", "%02u/%03u/%c - [%9"PRIu64"] Reserved Test (data = %08x)", flex->cycle_id, flex->frame_id, phase + 'A', capcode, siv_data);
+        PAG_MSG(SEV_INFO, "SIV", "%02u/%03u/%c - [%9"PRIu64"] Reserved Test (data = %08x)", frm->cycle_id, frm->frame_id, phase + 'A', capcode, siv_data);
         break;
     default:
-        PAG_MSG(SEV_INFO, "SIV", "%02u/%03u/%c - [%9"PRIu64"] Unknown SIV %u (data = %08x)", flex->cycle_id, flex->frame_id, phase + 'A', capcode,
+        PAG_MSG(SEV_INFO, "SIV", "%02u/%03u/%c - [%9"PRIu64"] Unknown SIV %u (data = %08x)", frm->cycle_id, frm->frame_id, phase + 'A', capcode,
                 siv_type, siv_data);
     }
 
-    if (NULL != flex->on_siv_msg) {
-        flex->on_siv_msg(flex, coding->baud, phase, flex->cycle_id, flex->frame_id, capcode,
-                siv_type, siv_data);
+    if (NULL != (msg = _pager_flex_frame_add_msg(frm, PAGER_FLEX_FRAME_MSG_SIV, phase, capcode))) {
+        msg->siv_type = siv_type;
+        msg->siv_data = siv_data;
     }
 
 
@@ -936,7 +1016,7 @@ done:
  * Decode a FLEX vector information word, and emit a 
  */
 static
-aresult_t _pager_flex_decode_vector(struct pager_flex *flex, uint8_t phase, uint64_t capcode, uint32_t *vec, size_t nr_vec_words, uint32_t *base)
+aresult_t _pager_flex_decode_vector(struct pager_flex_frame *frm, uint8_t phase, uint64_t capcode, uint32_t *vec, size_t nr_vec_words, uint32_t *base)
 {
     aresult_t ret = A_OK;
     uint32_t vec_word = 0,
@@ -946,17 +1026,17 @@ aresult_t _pager_flex_decode_vector(struct pager_flex *flex, uint8_t phase, uint
     size_t word_length = 0,
            word_start = 0;
 
-    TSL_ASSERT_ARG_DEBUG(NULL != flex);
+    TSL_ASSERT_ARG_DEBUG(NULL != frm);
     TSL_ASSERT_ARG_DEBUG(NULL != vec);
     TSL_ASSERT_ARG_DEBUG(0 != capcode);
     TSL_ASSERT_ARG_DEBUG(0 != nr_vec_words);
 
     /* Erase any previous message */
-    flex->msg_len = 0;
+    frm->msg_len = 0;
 
     /* Fix the vector words we'll need, first */
     for (size_t i = 0; i < nr_vec_words; i++) {
-        if (bch_code_decode(flex->bch, &vec[i])) {
+        if (pager_stats_bch_decode(&frm->stats, frm->bch, &vec[i])) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -983,7 +1063,7 @@ aresult_t _pager_flex_decode_vector(struct pager_flex *flex, uint8_t phase, uint
 
     switch (vec_type) {
     case PAGER_FLEX_MESSAGE_TONE:
-        if (FAILED(_pager_flex_decode_tone(flex, phase, capcode, vec_word, vec_long_word))) {
+        if (FAILED(_pager_flex_decode_tone(frm, phase, capcode, vec_word, vec_long_word))) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -994,7 +1074,7 @@ aresult_t _pager_flex_decode_vector(struct pager_flex *flex, uint8_t phase, uint
         if (2 == nr_vec_words) {
             word_length -= 1;
         }
-        if (FAILED(_pager_flex_decode_numeric(flex, phase, capcode, vec_long_word, base + word_start, word_length))) {
+        if (FAILED(_pager_flex_decode_numeric(frm, phase, capcode, vec_long_word, base + word_start, word_length))) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -1005,13 +1085,13 @@ aresult_t _pager_flex_decode_vector(struct pager_flex *flex, uint8_t phase, uint
             word_length -= 1;
         }
 
-        if (FAILED(_pager_flex_decode_alphanumeric(flex, phase, capcode, vec_long_word, base + word_start, word_length))) {
+        if (FAILED(_pager_flex_decode_alphanumeric(frm, phase, capcode, vec_long_word, base + word_start, word_length))) {
             ret = A_E_INVAL;
             goto done;
         }
         break;
     case PAGER_FLEX_MESSAGE_SPECIAL_INSTRUCTION:
-        if (FAILED(_pager_flex_decode_short_instruction_vec(flex, phase, capcode, vec_word))) {
+        if (FAILED(_pager_flex_decode_short_instruction_vec(frm, phase, capcode, vec_word))) {
             ret = A_E_INVAL;
             goto done;
         }
@@ -1020,7 +1100,7 @@ aresult_t _pager_flex_decode_vector(struct pager_flex *flex, uint8_t phase, uint
     case PAGER_FLEX_MESSAGE_SECURE:
     case PAGER_FLEX_MESSAGE_HEX:
     case PAGER_FLEX_MESSAGE_NUMBERED_NUMERIC:
-        PAG_MSG(SEV_INFO, "UNSUPP-MSG", "%02u/%03u/%c [%9"PRIu64 "] Unsupported Message: %s", flex->cycle_id, flex->frame_id, phase + 'A', capcode,  __pager_flex_type_code[vec_type]);
+        PAG_MSG(SEV_INFO, "UNSUPP-MSG", "%02u/%03u/%c [%9"PRIu64 "] Unsupported Message: %s", frm->cycle_id, frm->frame_id, phase + 'A', capcode,  __pager_flex_type_code[vec_type]);
         break;
     default:
         /* Shouldn't get here, but just in case... */
@@ -1039,13 +1119,13 @@ done:
 #define PAGER_FLEX_BIW_COUNTRY              7
 
 static
-void __pager_flex_decode_extra_biw(struct pager_flex *flex, uint32_t biw)
+void __pager_flex_decode_extra_biw(struct pager_flex_frame *frm, uint32_t biw)
 {
     uint32_t add_biw = biw & 0x7ffffffful;
 
-    TSL_BUG_ON(NULL == flex);
+    TSL_BUG_ON(NULL == frm);
 
-    if (0 == bch_code_decode(flex->bch, &add_biw)) {
+    if (0 == pager_stats_bch_decode(&frm->stats, frm->bch, &add_biw)) {
         add_biw &= 0x1fffff;
         /* Perform Checksum */
         if (0xf != __pager_flex_calc_word_checksum(add_biw)) {
@@ -1086,10 +1166,9 @@ void __pager_flex_decode_extra_biw(struct pager_flex *flex, uint32_t biw)
 }
 
 static
-void _pager_flex_phase_process(struct pager_flex *flex, unsigned phase_id)
+void _pager_flex_phase_process(struct pager_flex_frame *frm, unsigned phase_id)
 {
-    struct pager_flex_block *blk = NULL;
-    struct pager_flex_phase *phs = NULL;
+    uint32_t *phase_words = NULL;
     uint32_t biw = 0;
     uint8_t biw_vsw = 0,
             biw_eob = 0;
@@ -1103,31 +1182,27 @@ void _pager_flex_phase_process(struct pager_flex *flex, unsigned phase_id)
     size_t addr_start = 1;
 
 #ifdef _TSL_DEBUG
-    TSL_BUG_ON(NULL == flex);
+    TSL_BUG_ON(NULL == frm);
     TSL_BUG_ON(phase_id >= PAGER_FLEX_PHASE_MAX);
 #endif
 
-    blk = &flex->block;
-    phs = &blk->phase[phase_id];
+    phase_words = frm->phase_words[phase_id];
 
-    TSL_BUG_ON(0 == phs->base_word);
-    if (0 != phs->cur_bit) {
-        DIAG("WARNING: current bit ID is %u", phs->cur_bit);
-    }
+    TSL_BUG_ON(0 == frm->nr_phase_words[phase_id]);
 
-    DIAG("PHASE %u: %u words", phase_id, phs->cur_word);
+    DIAG("PHASE %u: %u words", phase_id, frm->nr_phase_words[phase_id]);
 
     /* Grab the BIW, and correct it */
-    biw = phs->phase_words[0] & 0x7ffffffful;
-    if (bch_code_decode(flex->bch, &biw)) {
+    biw = phase_words[0] & 0x7ffffffful;
+    if (pager_stats_bch_decode(&frm->stats, frm->bch, &biw)) {
         /* Skip processing the rest of this phase */
-        PAG_MSG(SEV_INFO, "BAD-BIW", "%02u/%03u/%c: Skipping (could not correct BIW %08x)", flex->cycle_id, flex->frame_id,
+        PAG_MSG(SEV_INFO, "BAD-BIW", "%02u/%03u/%c: Skipping (could not correct BIW %08x)", frm->cycle_id, frm->frame_id,
                 phase_id + 'A', biw);
         goto done;
     }
 
     if (0xf != __pager_flex_calc_word_checksum(biw)) {
-        PAG_MSG(SEV_INFO, "BAD-BIW", "%02u/%03u/%c: Skipping - bad checksum (for BIW %08x)", flex->cycle_id, flex->frame_id,
+        PAG_MSG(SEV_INFO, "BAD-BIW", "%02u/%03u/%c: Skipping - bad checksum (for BIW %08x)", frm->cycle_id, frm->frame_id,
                 phase_id + 'A', biw);
         goto done;
     }
@@ -1145,17 +1220,17 @@ void _pager_flex_phase_process(struct pager_flex *flex, unsigned phase_id)
 
     /* Check the sanity of the BIW fields we extracted */
     if (biw_eob > biw_vsw) {
-        PAG_MSG(SEV_INFO, "BAD-BIW", "%02u/%03u/%c: Skipping BIW - bad vector count count of %u (EoB = %u)", flex->cycle_id,
-                flex->frame_id, phase_id + 'A', biw_vsw, biw_eob);
+        PAG_MSG(SEV_INFO, "BAD-BIW", "%02u/%03u/%c: Skipping BIW - bad vector count count of %u (EoB = %u)", frm->cycle_id,
+                frm->frame_id, phase_id + 'A', biw_vsw, biw_eob);
         goto done;
     }
 
     if (0 != biw_eob) {
         /* TODO: walk any additional Block Information Words */
         PAG_MSG(SEV_INFO, "BLOCK", "%02u/%02u/%c BIW end of block = %u",
-                flex->cycle_id, flex->frame_id, phase_id + 'A', biw_eob);
+                frm->cycle_id, frm->frame_id, phase_id + 'A', biw_eob);
         for (size_t i = 1; i < biw_eob; i++) {
-            __pager_flex_decode_extra_biw(flex, phs->phase_words[i]);
+            __pager_flex_decode_extra_biw(frm, phase_words[i]);
         }
     }
 
@@ -1163,7 +1238,7 @@ void _pager_flex_phase_process(struct pager_flex *flex, unsigned phase_id)
 
     if (addr_start == biw_vsw) {
         DIAG("No Data in %02u/%02u/%c",
-            flex->cycle_id, flex->frame_id, phase_id + 'A');
+            frm->cycle_id, frm->frame_id, phase_id + 'A');
     }
 
     /* Walk the address words, and decode them */
@@ -1173,20 +1248,27 @@ void _pager_flex_phase_process(struct pager_flex *flex, unsigned phase_id)
         uint64_t capcode = 0;
         size_t nr_words = 0;
 
-        if (FAILED_UNLIKELY(_pager_flex_decode_address(flex, &phs->phase_words[i], &capcode, &nr_words))) {
+        if (FAILED_UNLIKELY(_pager_flex_decode_address(frm, &phase_words[i], &capcode, &nr_words))) {
             /* TODO: we can probably inspect the following address word, figure out if it's the upper half
              * of a long address word, and continue, skipping the bad record. For now, easy mode.
              */
             PAG_MSG(SEV_WARNING, "BCH-ERROR", "%02u/%03u/%c Address could not be corrected",
-                    flex->cycle_id, flex->frame_id, phase_id + 'A');
+                    frm->cycle_id, frm->frame_id, phase_id + 'A');
             goto done;
         }
 
+        /* Not wanted, so don't bother with the vector or the message */
+        if (false == pager_capcode_filter_wanted(frm->capcode_filter, capcode)) {
+            frm->stats.nr_filtered++;
+            i += nr_words;
+            continue;
+        }
+
         /* Decode per what the vector word indicates */
-        if (FAILED_UNLIKELY(_pager_flex_decode_vector(flex, phase_id, capcode, &phs->phase_words[vec_offs], nr_words + 1, phs->phase_words))) {
+        if (FAILED_UNLIKELY(_pager_flex_decode_vector(frm, phase_id, capcode, &phase_words[vec_offs], nr_words + 1, phase_words))) {
             /* TODO: increment an error counter */
             PAG_MSG(SEV_WARNING, "BCH-ERROR", "%02u/%03u/%c [%9"PRIu64 "] Uncorrectable Error",
-                    flex->cycle_id, flex->frame_id, phase_id + 'A', capcode);
+                    frm->cycle_id, frm->frame_id, phase_id + 'A', capcode);
         }
 
         /* Add the number of additional words consumed to i */
@@ -1197,36 +1279,243 @@ done:
     return;
 }
 
+/**
+ * Decode each phase of a received frame. Run as a decode job, possibly on a decode pool worker,
+ * so must only touch the frame.
+ */
+static
+void _pager_flex_frame_decode(struct pager_decode_job *job)
+{
+    struct pager_flex_frame *frm = BL_CONTAINER_OF(job, struct pager_flex_frame, job);
+
+    for (unsigned i = 0; i < PAGER_FLEX_PHASE_MAX; i++) {
+        if (frm->phase_mask & (1 << i)) {
+            _pager_flex_phase_process(frm, i);
+        }
+    }
+}
+
+/**
+ * Transpose an 8x8 bit matrix, held a row per byte: bit j of byte i moves to bit i of byte j.
+ */
+static inline
+uint64_t _pager_flex_transpose_8x8(uint64_t x)
+{
+    uint64_t t = 0;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+    x ^= t ^ (t << 28);
+
+    return x;
+}
+
+/**
+ * De-interleave a block of a phase. FLEX sends the 8 words of a block a bit at a time, round
+ * robin, least significant bit first, so bit n of the block is bit (n / 8) of word (n % 8).
+ * Taking the 256 bits as 32 rows of 8, that is a transpose, done as four 8x8 transposes, each of
+ * which gives one byte of every word.
+ */
+static
+void _pager_flex_phase_deinterleave(const uint64_t *block_bits, uint32_t *words)
+{
+    for (size_t w = 0; w < PAGER_FLEX_BLOCK_WORDS; w++) {
+        words[w] = 0;
+    }
+
+    for (size_t q = 0; q < PAGER_FLEX_BLOCK_BITS / 64; q++) {
+        uint64_t t = _pager_flex_transpose_8x8(block_bits[q]);
+
+        for (size_t w = 0; w < PAGER_FLEX_BLOCK_WORDS; w++) {
+            words[w] |= (uint32_t)((t >> (8 * w)) & 0xff) << (8 * q);
+        }
+    }
+}
+
 static
 void _pager_flex_phase_append_bit(struct pager_flex_phase *phase, bool bit)
 {
 #ifdef _TSL_DEBUG
     TSL_BUG_ON(NULL == phase);
 #endif
-    phase->phase_words[phase->base_word + phase->cur_word] >>= 1;
-    phase->phase_words[phase->base_word + phase->cur_word] |= ((uint32_t)(!!bit)) << 31;
+    phase->block_bits[phase->nr_block_bits / 64] |= (uint64_t)(!!bit) << (phase->nr_block_bits % 64);
+    phase->nr_block_bits++;
+
+    /* The whole block is in, so unpack its words and start on the next block */
+    if (PAGER_FLEX_BLOCK_BITS == phase->nr_block_bits) {
+#ifdef _TSL_DEBUG
+        TSL_BUG_ON(phase->base_word + PAGER_FLEX_BLOCK_WORDS > PAGER_FLEX_PHASE_WORDS);
+#endif
+        _pager_flex_phase_deinterleave(phase->block_bits, &phase->phase_words[phase->base_word]);
+        memset(phase->block_bits, 0, sizeof(phase->block_bits));
+        phase->base_word += PAGER_FLEX_BLOCK_WORDS;
+        phase->nr_block_bits = 0;
+    }
+}
+
+/**
+ * Hand the messages decoded from a frame to the callbacks, and count the frame's BCH errors.
+ */
+static
+void _pager_flex_frame_deliver(struct pager_flex *flex, struct pager_flex_frame *frm)
+{
+    flex->deliver_frame = frm;
+
+    for (size_t i = 0; i < frm->nr_msgs; i++) {
+        aresult_t ret = A_OK;
+        struct pager_flex_frame_msg *msg = &frm->msgs[i];
+        const char *text = &frm->text[msg->text_offs];
+
+        switch (msg->type) {
+        case PAGER_FLEX_FRAME_MSG_ALNUM:
+            if (NULL != flex->reasm) {
+                ret = pager_flex_reasm_add(flex->reasm, flex->reasm_frame, msg->capcode, msg->phase, msg->fragment,
+                        msg->maildrop, msg->seq_num, text, msg->text_len);
+            } else {
+                ret = flex->on_alnum_msg(flex, frm->baud, msg->phase, frm->cycle_id, frm->frame_id, msg->capcode,
+                        msg->fragment, msg->maildrop, msg->seq_num, text, msg->text_len);
+            }
+            break;
+        case PAGER_FLEX_FRAME_MSG_NUM:
+            ret = flex->on_num_msg(flex, frm->baud, msg->phase, frm->cycle_id, frm->frame_id, msg->capcode,
+                    text, msg->text_len);
+            break;
+        case PAGER_FLEX_FRAME_MSG_SIV:
+            if (NULL != flex->on_siv_msg) {
+                ret = flex->on_siv_msg(flex, frm->baud, msg->phase, frm->cycle_id, frm->frame_id, msg->capcode,
+                        msg->siv_type, msg->siv_data);
+            }
+            break;
+        }
+
+        if (FAILED(ret)) {
+            DIAG("%02u/%03u/%c [%9"PRIu64"] Failed to hand over message", frm->cycle_id, frm->frame_id,
+                    msg->phase + 'A', msg->capcode);
+        }
+    }
+
+    flex->deliver_frame = NULL;
+
+    if (0 != frm->nr_dropped) {
+        PAG_MSG(SEV_WARNING, "FRAME-FULL", "%02u/%03u: Dropped %zu messages that didn't fit in the frame buffer",
+                frm->cycle_id, frm->frame_id, frm->nr_dropped);
+    }
+
+    pager_stats_add(&flex->stats, &frm->stats);
+}
+
+/**
+ * Hand over the messages from received frames, oldest first, as long as they've been decoded.
+ *
+ * \param flex The FLEX pager state
+ * \param wait Wait for every frame still being decoded, rather than stopping at the first
+ */
+static
+void _pager_flex_frames_deliver(struct pager_flex *flex, bool wait)
+{
+    while (flex->frame_head != flex->frame_tail) {
+        struct pager_flex_frame *frm = &flex->frames[flex->frame_head % PAGER_FLEX_NR_FRAMES];
 
-    phase->cur_word = (phase->cur_word + 1) % 8;
+        if (false == pager_decode_job_done(&frm->job)) {
+            if (false == wait) {
+                break;
+            }
+
+            pager_decode_pool_wait(flex->pool, &frm->job);
+        }
+
+        _pager_flex_frame_deliver(flex, frm);
+        flex->frame_head++;
+    }
+}
+
+/**
+ * The phases carried by a coding, a bit per phase
+ */
+static
+uint8_t _pager_flex_coding_phase_mask(const struct pager_flex_coding *coding)
+{
+    switch (coding->nr_phases) {
+    case 1:
+        return 1 << PAGER_FLEX_PHASE_A;
+    case 2:
+        return (1 << PAGER_FLEX_PHASE_A) | (1 << PAGER_FLEX_PHASE_C);
+    case 4:
+        return (1 << PAGER_FLEX_PHASE_A) | (1 << PAGER_FLEX_PHASE_B) | (1 << PAGER_FLEX_PHASE_C) |
+            (1 << PAGER_FLEX_PHASE_D);
+    default:
+        PANIC("Unknown number of phases for FLEX coding: %u", coding->nr_phases);
+    }
+}
 
-    /* Update the state of the phase tracker */
-    if (0 == phase->cur_word) {
-        phase->cur_bit++;
+/**
+ * Take a copy of the block just received, and hand it over to be decoded. Without a decode pool
+ * the frame is decoded, and its messages handed over, before this returns.
+ */
+static
+void _pager_flex_frame_submit(struct pager_flex *flex)
+{
+    struct pager_flex_coding *coding = flex->sync.coding;
+    struct pager_flex_frame *frm = NULL;
+
+    if (PAGER_FLEX_NR_FRAMES == flex->frame_tail - flex->frame_head) {
+        /* Every frame is in use, so the oldest has to be finished before we can carry on */
+        struct pager_flex_frame *oldest = &flex->frames[flex->frame_head % PAGER_FLEX_NR_FRAMES];
+        pager_decode_pool_wait(flex->pool, &oldest->job);
+        _pager_flex_frames_deliver(flex, false);
     }
 
-    /* Start decoding the next block */
-    if (32 == phase->cur_bit) {
-        phase->base_word += 8;
-        phase->cur_bit = 0;
-        phase->cur_word = 0;
+    frm = &flex->frames[flex->frame_tail % PAGER_FLEX_NR_FRAMES];
+
+    frm->job.work = _pager_flex_frame_decode;
+    frm->bch = flex->bch;
+    frm->capcode_filter = flex->capcode_filter;
+    frm->baud = coding->baud;
+    frm->cycle_id = flex->cycle_id;
+    frm->frame_id = flex->frame_id;
+    frm->phase_mask = _pager_flex_coding_phase_mask(coding);
+
+    for (size_t i = 0; i < PAGER_FLEX_PHASE_MAX; i++) {
+        struct pager_flex_phase *phs = &flex->block.phase[i];
+
+        frm->nr_phase_words[i] = 0;
+
+        if (0 == (frm->phase_mask & (1 << i))) {
+            continue;
+        }
+
+        if (0 != phs->nr_block_bits) {
+            DIAG("WARNING: %u bits of a partial block left over", phs->nr_block_bits);
+        }
+
+        frm->nr_phase_words[i] = phs->base_word;
+        memcpy(frm->phase_words[i], phs->phase_words, phs->base_word * sizeof(uint32_t));
     }
+
+    memset(&frm->stats, 0, sizeof(frm->stats));
+    frm->msg_len = 0;
+    frm->nr_msgs = 0;
+    frm->text_len = 0;
+    frm->nr_dropped = 0;
+
+    flex->frame_tail++;
+
+    pager_decode_pool_run(flex->pool, &frm->job);
+
+    _pager_flex_frames_deliver(flex, false);
 }
 
+/**
+ * Add a sliced symbol to the block, and process the block if it is complete
+ */
 static
-void _pager_flex_block_update(struct pager_flex *flex, int16_t sample)
+void _pager_flex_block_update(struct pager_flex *flex, int8_t symbol)
 {
     struct pager_flex_block *blk = NULL;
     struct pager_flex_coding *coding = NULL;
-    int8_t symbol = 0;
 #ifdef _TSL_DEBUG
     TSL_BUG_ON(NULL == flex);
 #endif
@@ -1236,8 +1525,6 @@ void _pager_flex_block_update(struct pager_flex *flex, int16_t sample)
     TSL_BUG_ON(NULL == coding);
 #endif
 
-    symbol = coding->slice(flex, sample);
-
     /* Put the symbol bit(s) in the right phase */
     switch (coding->nr_phases) {
     case 1:
@@ -1270,7 +1557,7 @@ void _pager_flex_block_update(struct pager_flex *flex, int16_t sample)
         TSL_BUG_ON(2 != coding->sym_bits);
         if (false == blk->phase_ff) {
 #ifdef _DUMP_SAMPLE_CODES
-        fprintf(stderr, "%d %d %d (sample = %d)\n", !!(symbol & 2), !!(symbol & 1), symbol, sample - flex->sample_delta);
+        fprintf(stderr, "%d %d %d\n", !!(symbol & 2), !!(symbol & 1), symbol);
 #endif
             _pager_flex_phase_append_bit(&blk->phase[PAGER_FLEX_PHASE_A], !!(symbol & 2));
             _pager_flex_phase_append_bit(&blk->phase[PAGER_FLEX_PHASE_B], !!(symbol & 1));
@@ -1287,28 +1574,60 @@ void _pager_flex_block_update(struct pager_flex *flex, int16_t sample)
     blk->nr_symbols++;
 
     if (blk->nr_symbols == coding->symbols_per_block) {
-        /* Process the block data, one phase at a time */
-        switch (coding->nr_phases) {
-        case 1:
-            _pager_flex_phase_process(flex, PAGER_FLEX_PHASE_A);
-            break;
-        case 2:
-            _pager_flex_phase_process(flex, PAGER_FLEX_PHASE_A);
-            _pager_flex_phase_process(flex, PAGER_FLEX_PHASE_C);
-            break;
-        case 4:
-            _pager_flex_phase_process(flex, PAGER_FLEX_PHASE_A);
-            _pager_flex_phase_process(flex, PAGER_FLEX_PHASE_B);
-            _pager_flex_phase_process(flex, PAGER_FLEX_PHASE_C);
-            _pager_flex_phase_process(flex, PAGER_FLEX_PHASE_D);
-            break;
-        }
+        /* Hand the block data over to be decoded */
+        _pager_flex_frame_submit(flex);
 
         /* Reset to the idle/Sync 1 search state */
         _pager_flex_reset_sync(flex);
     }
 }
 
+/**
+ * Receive block symbols from a run of samples. The sample skip is fixed for the whole block, so
+ * the samples to slice can be picked out up front and sliced in runs, rather than going through
+ * the state machine one sample at a time.
+ *
+ * \param flex The FLEX pager state
+ * \param pcm_samples The samples
+ * \param nr_samples The number of samples
+ *
+ * \return The number of samples consumed. Fewer than nr_samples only if the block was completed,
+ *         in which case the rest belong to the hunt for the next sync.
+ */
+static
+size_t _pager_flex_block_run(struct pager_flex *flex, const int16_t *pcm_samples, size_t nr_samples)
+{
+    struct pager_flex_coding *coding = flex->sync.coding;
+    size_t stride = flex->skip + 1,
+           offset = flex->skip_count;
+    int8_t symbols[PAGER_FLEX_BLOCK_RUN_SYMBOLS];
+
+    while (offset < nr_samples) {
+        size_t nr_symbols = (nr_samples - offset + stride - 1) / stride;
+
+        nr_symbols = BL_MIN2(nr_symbols, (size_t)(coding->symbols_per_block - flex->block.nr_symbols));
+        nr_symbols = BL_MIN2(nr_symbols, (size_t)PAGER_FLEX_BLOCK_RUN_SYMBOLS);
+
+        coding->slice_block(flex, &pcm_samples[offset], stride, symbols, nr_symbols);
+
+        for (size_t i = 0; i < nr_symbols; i++) {
+            _pager_flex_block_update(flex, symbols[i]);
+        }
+
+        offset += nr_symbols * stride;
+
+        if (PAGER_FLEX_STATE_BLOCK != flex->state) {
+            /* The block is done; the sample after the last symbol starts the search for sync */
+            return offset - stride + 1;
+        }
+    }
+
+    /* Carry the distance to the next symbol over to the next buffer */
+    flex->skip_count = offset - nr_samples;
+
+    return nr_samples;
+}
+
 static
 bool _pager_flex_handle_fiw(struct pager_flex *flex)
 {
@@ -1320,7 +1639,7 @@ bool _pager_flex_handle_fiw(struct pager_flex *flex)
     uint8_t fiw_cksum = 0;
 
     /* Handle the FIW for this frame */
-    if (0 != bch_code_decode(flex->bch, &fiw)) {
+    if (0 != pager_stats_bch_decode(&flex->stats, flex->bch, &fiw)) {
         /* Reset the sync state -- we couldn't correct the FIW */
         PAG_MSG(SEV_INFO, "BAD-FIW", "FIW %08x could not be corrected with BCH(31, 23).", fiw);
         return false;
@@ -1344,14 +1663,63 @@ bool _pager_flex_handle_fiw(struct pager_flex *flex)
     return 0xf == fiw_cksum;
 }
 
+/**
+ * Frames in a FLEX hour: 15 cycles of 128 frames
+ */
+#define PAGER_FLEX_FRAMES_PER_HOUR          (15 * 128)
+
+/**
+ * Hand a reassembled (or abandoned) message to the alphanumeric callback. Messages that time out
+ * are handed over at the start of a later frame, with that frame's cycle and frame numbers.
+ */
+static
+aresult_t _pager_flex_on_reasm_msg(void *priv, uint64_t capcode, uint8_t phase, bool complete, bool maildrop,
+        uint8_t seq_num, const char *message, size_t message_len)
+{
+    struct pager_flex *flex = priv;
+    const struct pager_flex_frame *frm = flex->deliver_frame;
+
+    if (NULL != frm) {
+        /* Completed by a fragment from the frame being handed over */
+        return flex->on_alnum_msg(flex, frm->baud, phase, frm->cycle_id, frm->frame_id, capcode, !complete,
+                maildrop, seq_num, message, message_len);
+    }
+
+    return flex->on_alnum_msg(flex, NULL != flex->sync.coding ? flex->sync.coding->baud : 0, phase,
+            flex->cycle_id, flex->frame_id, capcode, !complete, maildrop, seq_num, message, message_len);
+}
+
+/**
+ * Move the reassembly clock on to the frame in the FIW just decoded
+ */
+static
+void _pager_flex_reasm_tick(struct pager_flex *flex)
+{
+    int16_t frame = flex->cycle_id * 128 + flex->frame_id;
+
+    if (frame >= PAGER_FLEX_FRAMES_PER_HOUR) {
+        /* Not a valid cycle number */
+        return;
+    }
+
+    if (flex->reasm_last_frame >= 0) {
+        flex->reasm_frame += (frame - flex->reasm_last_frame + PAGER_FLEX_FRAMES_PER_HOUR) %
+            PAGER_FLEX_FRAMES_PER_HOUR;
+    }
+
+    flex->reasm_last_frame = frame;
+
+    if (FAILED(pager_flex_reasm_tick(flex->reasm, flex->reasm_frame))) {
+        DIAG("Failed to hand over timed out messages");
+    }
+}
+
 aresult_t pager_flex_new(struct pager_flex **pflex, uint32_t freq_hz, pager_flex_on_alnum_msg_func_t on_aln_msg,
         pager_flex_on_num_msg_func_t on_num_msg, pager_flex_on_siv_msg_func_t on_siv_msg)
 {
     aresult_t ret = A_OK;
 
     struct pager_flex *flex = NULL;
-    /* BCH Generator Polynomial */
-    int poly[6] = { 1, 0, 1, 0, 0, 1 };
 
     TSL_ASSERT_ARG(NULL != pflex);
     TSL_ASSERT_ARG(NULL != on_aln_msg);
@@ -1361,7 +1729,9 @@ aresult_t pager_flex_new(struct pager_flex **pflex, uint32_t freq_hz, pager_flex
         goto done;
     }
 
-    TSL_BUG_IF_FAILED(bch_code_new(&flex->bch, poly, 5, 31, 21, 2));
+    if (FAILED(ret = bch_code_get_pager(&flex->bch))) {
+        goto done;
+    }
 
     flex->freq_hz = freq_hz;
     flex->on_alnum_msg = on_aln_msg;
@@ -1373,6 +1743,12 @@ aresult_t pager_flex_new(struct pager_flex **pflex, uint32_t freq_hz, pager_flex
     *pflex = flex;
 
 done:
+    if (FAILED(ret)) {
+        if (NULL != flex) {
+            TFREE(flex);
+        }
+    }
+
     return ret;
 }
 
@@ -1387,10 +1763,10 @@ aresult_t pager_flex_delete(struct pager_flex **pflex)
 
     flex = *pflex;
 
-    /* Cleanup the flex demod context */
-    if (NULL != flex->bch) {
-        bch_code_delete(&flex->bch);
-    }
+    /* Hand over whatever is left of the frames still being decoded */
+    _pager_flex_frames_deliver(flex, true);
+
+    pager_flex_reasm_delete(&flex->reasm);
 
     TFREE(flex);
     *pflex = NULL;
@@ -1398,15 +1774,88 @@ aresult_t pager_flex_delete(struct pager_flex **pflex)
     return ret;
 }
 
+aresult_t pager_flex_get_stats(struct pager_flex *flex, struct pager_stats *stats)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != flex);
+    TSL_ASSERT_ARG(NULL != stats);
+
+    *stats = flex->stats;
+
+    return ret;
+}
+
+aresult_t pager_flex_set_capcode_filter(struct pager_flex *flex, const struct pager_capcode_filter *filter)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != flex);
+
+    flex->capcode_filter = filter;
+
+    return ret;
+}
+
+aresult_t pager_flex_set_decode_pool(struct pager_flex *flex, struct pager_decode_pool *pool)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != flex);
+
+    /* Frames already handed to the old pool have to be finished there */
+    _pager_flex_frames_deliver(flex, true);
+
+    flex->pool = pool;
+
+    return ret;
+}
+
+aresult_t pager_flex_set_reassembly(struct pager_flex *flex, size_t nr_messages, unsigned timeout_frames)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != flex);
+
+    /* Messages from frames still being decoded belong to the old reassembler */
+    _pager_flex_frames_deliver(flex, true);
+
+    pager_flex_reasm_delete(&flex->reasm);
+
+    flex->reasm_frame = 0;
+    flex->reasm_last_frame = -1;
+
+    if (0 == nr_messages) {
+        goto done;
+    }
+
+    ret = pager_flex_reasm_new(&flex->reasm, nr_messages, timeout_frames, _pager_flex_on_reasm_msg, flex);
+
+done:
+    return ret;
+}
+
 aresult_t pager_flex_on_pcm(struct pager_flex *flex, const int16_t *pcm_samples, size_t nr_samples)
 {
     aresult_t ret = A_OK;
 
+    size_t i = 0;
+
+    CYCLE_COUNT_START(cycles);
+
     TSL_ASSERT_ARG(NULL != flex);
     TSL_ASSERT_ARG(NULL != pcm_samples);
     TSL_ASSERT_ARG(0 != nr_samples);
 
-    for (size_t i = 0; i < nr_samples; i++) {
+    /* Hand over anything the decode pool finished since we were last here */
+    _pager_flex_frames_deliver(flex, false);
+
+    while (i < nr_samples) {
+        if (PAGER_FLEX_STATE_BLOCK == flex->state) {
+            i += _pager_flex_block_run(flex, &pcm_samples[i], nr_samples - i);
+            continue;
+        }
+
         if (0 == flex->skip_count) {
             flex->skip_count = flex->skip;
             switch (flex->state) {
@@ -1417,12 +1866,20 @@ aresult_t pager_flex_on_pcm(struct pager_flex *flex, const int16_t *pcm_samples,
                 if (PAGER_FLEX_SYNC_STATE_SYNCED == flex->sync.state) {
                     if (_pager_flex_handle_fiw(flex)) {
                         DIAG("PAGER_FLEX_STATE_SYNC_1 -> PAGER_FLEX_STATE_SYNC_2");
+                        flex->stats.nr_syncs++;
+
+                        if (NULL != flex->reasm) {
+                            /* Fragments from earlier frames have to be in before time moves on */
+                            _pager_flex_frames_deliver(flex, true);
+                            _pager_flex_reasm_tick(flex);
+                        }
 
                         flex->state = PAGER_FLEX_STATE_SYNC_2;
                         flex->skip = flex->sync.coding->sample_skip;
                         flex->skip_count = flex->skip + flex->sync.coding->sample_fudge;
                     } else {
                         /*  Reset sync state */
+                        flex->stats.nr_frame_rejects++;
                         _pager_flex_reset_sync(flex);
                     }
                 }
@@ -1441,16 +1898,19 @@ aresult_t pager_flex_on_pcm(struct pager_flex *flex, const int16_t *pcm_samples,
                 break;
 
             case PAGER_FLEX_STATE_BLOCK:
-                /* Update and accumulate block state */
-                _pager_flex_block_update(flex, pcm_samples[i]);
-                break;
+                /* Handled a run of samples at a time, above */
+                PANIC("Block samples should be handled by _pager_flex_block_run");
             }
         } else {
             /* Skip this sample, decrement the skip counter */
             flex->skip_count--;
         }
+
+        i++;
     }
 
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_FLEX_ON_PCM, cycles);
+
     return ret;
 }
 
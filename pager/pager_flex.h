@@ -6,6 +6,9 @@
 #include <stdbool.h>
 
 struct pager_flex;
+struct pager_stats;
+struct pager_capcode_filter;
+struct pager_decode_pool;
 
 /**
  * Callback type. This is registered with each pager_flex, and is called whenever there is an alphanumeric page to process.
@@ -114,3 +117,56 @@ aresult_t pager_flex_delete(struct pager_flex **pflex);
  */
 aresult_t pager_flex_on_pcm(struct pager_flex *flex, const int16_t *pcm_samples, size_t nr_samples);
 
+/**
+ * Get a copy of the sync and BCH counters for a FLEX decoder.
+ *
+ * \param flex The FLEX decoder
+ * \param stats The counters, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_get_stats(struct pager_flex *flex, struct pager_stats *stats);
+
+/**
+ * Only decode messages for some capcodes. A message for any other capcode is skipped as soon as
+ * its address is decoded: its vector and message words are never corrected or decoded.
+ *
+ * \param flex The FLEX decoder
+ * \param filter The capcodes to decode, NULL for all of them. Must outlive the decoder.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_set_capcode_filter(struct pager_flex *flex, const struct pager_capcode_filter *filter);
+
+/**
+ * Reassemble fragmented alphanumeric messages. Each message is handed to the alphanumeric callback
+ * once, with fragmented set only if some of it went missing: its next fragment didn't arrive in
+ * time, a fragment came out of sequence, or it was pushed out to make room for a newer message.
+ * Memory used is fixed by nr_messages, however busy the channel.
+ *
+ * Messages still being reassembled when the decoder is deleted are dropped.
+ *
+ * \param flex The FLEX decoder
+ * \param nr_messages The most messages to reassemble at once, 0 to hand over each fragment as it
+ *                    arrives (the default)
+ * \param timeout_frames How many frames (1.875 seconds each) to wait for the next fragment of a
+ *                       message, from 1 to 63
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_set_reassembly(struct pager_flex *flex, size_t nr_messages, unsigned timeout_frames);
+
+/**
+ * Decode received frames on a pool of worker threads, so the thread feeding the decoder samples
+ * carries on acquiring symbols while a frame's words are corrected and its messages decoded.
+ * The callbacks are still called from the thread calling pager_flex_on_pcm, in the order the
+ * frames were received, though a frame's messages may only be handed over on a later call. The
+ * sync and BCH counters for a frame are updated as its messages are handed over.
+ *
+ * \param flex The FLEX decoder
+ * \param pool The decode pool, NULL to decode each frame as soon as it is received (the default).
+ *             Must outlive the decoder, or be detached first.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_set_decode_pool(struct pager_flex *flex, struct pager_decode_pool *pool);
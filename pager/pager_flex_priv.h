@@ -1,9 +1,16 @@
 #pragma once
 
+#include <pager/pager_stats.h>
+#include <pager/pager_decode_pool.h>
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct pager_flex;
 struct bch_code;
+struct pager_capcode_filter;
+struct pager_flex_reasm;
 
 enum pager_flex_modulation {
     PAGER_FLEX_MODULATION_2FSK,
@@ -174,6 +181,16 @@ struct pager_flex_sync_2 {
  */
 #define PAGER_FLEX_PHASE_WORDS          88
 
+/**
+ * Number of words in an interleaved block of a phase
+ */
+#define PAGER_FLEX_BLOCK_WORDS          8
+
+/**
+ * Number of bits in an interleaved block of a phase
+ */
+#define PAGER_FLEX_BLOCK_BITS           (PAGER_FLEX_BLOCK_WORDS * 32)
+
 /**
  * A phase of FLEX data. Each phase contains 88 words, across 11 blocks.
  */
@@ -184,17 +201,18 @@ struct pager_flex_phase {
     uint32_t phase_words[PAGER_FLEX_PHASE_WORDS];
 
     /**
-     * Current bit within the current word
+     * Bits of the block being received, in the order received. These are de-interleaved into
+     * phase_words once the whole block is in.
      */
-    uint8_t cur_bit;
+    uint64_t block_bits[PAGER_FLEX_BLOCK_BITS / 64];
 
     /**
-     * The current word being filled in
+     * Number of bits of the current block received so far
      */
-    uint8_t cur_word;
+    uint16_t nr_block_bits;
 
     /**
-     * The base word, to determine within phase_words where cur_word is relative to.
+     * The first word of the current block within phase_words
      */
     uint8_t base_word;
 };
@@ -205,6 +223,11 @@ struct pager_flex_phase {
 #define PAGER_FLEX_PHASE_D              3
 #define PAGER_FLEX_PHASE_MAX            4
 
+/**
+ * The most symbols sliced at once while receiving a block
+ */
+#define PAGER_FLEX_BLOCK_RUN_SYMBOLS    64
+
 /**
  * State for the block accumulation state
  */
@@ -225,6 +248,122 @@ struct pager_flex_block {
     bool phase_ff;
 };
 
+/**
+ * The kinds of message a decoded frame can carry
+ */
+enum pager_flex_frame_msg_type {
+    PAGER_FLEX_FRAME_MSG_ALNUM,
+    PAGER_FLEX_FRAME_MSG_NUM,
+    PAGER_FLEX_FRAME_MSG_SIV,
+};
+
+/**
+ * A message decoded from a frame, waiting to be handed to the callbacks
+ */
+struct pager_flex_frame_msg {
+    enum pager_flex_frame_msg_type type;
+    uint64_t capcode;
+    uint8_t phase;
+
+    /**
+     * Alphanumeric messages only: the fragment flag, the maildrop flag and the sequence number
+     */
+    bool fragment;
+    bool maildrop;
+    uint8_t seq_num;
+
+    /**
+     * SIV messages only: the instruction type and the instruction data
+     */
+    uint8_t siv_type;
+    uint16_t siv_data;
+
+    /**
+     * Where the message body starts in the frame's text, and its length
+     */
+    uint16_t text_offs;
+    uint16_t text_len;
+};
+
+/**
+ * The most messages kept from one frame. Every address word in every phase could carry one.
+ */
+#define PAGER_FLEX_FRAME_MSGS           (PAGER_FLEX_PHASE_MAX * 64)
+
+/**
+ * The most bytes of message bodies kept from one frame
+ */
+#define PAGER_FLEX_FRAME_TEXT_BYTES     8192
+
+/**
+ * The number of received frames that can be waiting to be decoded, or to have their messages
+ * handed over
+ */
+#define PAGER_FLEX_NR_FRAMES            4
+
+/**
+ * A received frame: the raw words of each of its phases, for decoding as a job on a decode
+ * pool, and the messages the decoding produced, handed to the callbacks on the thread feeding
+ * the decoder samples, in the order the frames were received.
+ */
+struct pager_flex_frame {
+    /**
+     * The decoding job. Everything below is owned by the job while it is not done.
+     */
+    struct pager_decode_job job;
+
+    const struct bch_code *bch;
+    const struct pager_capcode_filter *capcode_filter;
+
+    uint16_t baud;
+    uint8_t cycle_id;
+    uint8_t frame_id;
+
+    /**
+     * The phases this frame's coding carries, a bit per phase
+     */
+    uint8_t phase_mask;
+
+    /**
+     * The number of words received in each phase
+     */
+    uint8_t nr_phase_words[PAGER_FLEX_PHASE_MAX];
+
+    /**
+     * Raw words, de-interleaved, for each phase. Corrected in place while decoding.
+     */
+    uint32_t phase_words[PAGER_FLEX_PHASE_MAX][PAGER_FLEX_PHASE_WORDS];
+
+    /**
+     * BCH and filter counters from decoding, added to the decoder's own on delivery
+     */
+    struct pager_stats stats;
+
+    /**
+     * Message buffer, for decoding a message body
+     */
+    char msg_buf[256];
+
+    /**
+     * Current length of the valid message in the message buffer
+     */
+    size_t msg_len;
+
+    struct pager_flex_frame_msg msgs[PAGER_FLEX_FRAME_MSGS];
+    size_t nr_msgs;
+
+    /**
+     * The bodies of the messages, back to back
+     */
+    char text[PAGER_FLEX_FRAME_TEXT_BYTES];
+    size_t text_len;
+
+    /**
+     * Messages decoded that didn't fit in msgs or text
+     */
+    size_t nr_dropped;
+};
+
 /**
  * A FLEX pager decoder.
  *
@@ -274,7 +413,50 @@ struct pager_flex {
     /**
      * State for the BCH Error Corrector for the BCH(31, 23) code FLEX uses
      */
-    struct bch_code *bch;
+    const struct bch_code *bch;
+
+    /**
+     * The capcodes to decode messages for, NULL for all of them
+     */
+    const struct pager_capcode_filter *capcode_filter;
+
+    /**
+     * Reassembly of fragmented alphanumeric messages, NULL to hand over each fragment
+     */
+    struct pager_flex_reasm *reasm;
+
+    /**
+     * Frames seen since reassembly was turned on, counting any frames missed between FIWs
+     */
+    uint64_t reasm_frame;
+
+    /**
+     * The cycle and frame of the last FIW, as a frame number within the hour; -1 before the first
+     */
+    int16_t reasm_last_frame;
+
+    /**
+     * Sync and BCH counters
+     */
+    struct pager_stats stats;
+
+    /**
+     * The pool decoding received frames, NULL to decode them on the thread receiving samples
+     */
+    struct pager_decode_pool *pool;
+
+    /**
+     * Received frames, oldest first. Frames from frame_head up to frame_tail are either being
+     * decoded, or waiting for their messages to be handed over.
+     */
+    struct pager_flex_frame frames[PAGER_FLEX_NR_FRAMES];
+    size_t frame_head;
+    size_t frame_tail;
+
+    /**
+     * The frame whose messages are being handed over, if any
+     */
+    const struct pager_flex_frame *deliver_frame;
 
     /**
      * The current state of the FLEX receiver
@@ -310,16 +492,6 @@ struct pager_flex {
      * The current frame number
      */
     uint8_t frame_id;
-
-    /**
-     * Message buffer (for ASCII decoding message bodies)
-     */
-    char msg_buf[256];
-
-    /**
-     * Current length of the valid message in the message buffer.
-     */
-    size_t msg_len;
 };
 
 /**
@@ -327,6 +499,13 @@ struct pager_flex {
  */
 typedef int8_t (*pager_flex_slice_sym_func_t)(struct pager_flex *flex, int16_t sample);
 
+/**
+ * Slice a run of symbols, taking one sample every stride samples. Gives the same symbols as
+ * the matching pager_flex_slice_sym_func_t, one at a time.
+ */
+typedef void (*pager_flex_slice_block_func_t)(struct pager_flex *flex, const int16_t *samples, size_t stride,
+        int8_t *symbols, size_t nr_symbols);
+
 struct pager_flex_coding {
     /**
      * The identifier A-code sequence
@@ -377,6 +556,11 @@ struct pager_flex_coding {
      * Slicer function
      */
     pager_flex_slice_sym_func_t slice;
+
+    /**
+     * Slicer function for a run of block symbols
+     */
+    pager_flex_slice_block_func_t slice_block;
 };
 
 /**
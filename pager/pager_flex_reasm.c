@@ -0,0 +1,490 @@
+/*
+ *  pager_flex_reasm.c - Reassembly of fragmented FLEX alphanumeric messages
+ *
+ *  Copyright (c)2017 Phil Vachon <phil@security-embedded.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pager/pager_flex_reasm.h>
+
+#include <tsl/safe_alloc.h>
+#include <tsl/errors.h>
+#include <tsl/diag.h>
+#include <tsl/assert.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+/**
+ * Index of no entry, ending a list
+ */
+#define PAGER_FLEX_REASM_NONE               UINT32_MAX
+
+/**
+ * Sequence number of the first fragment of a message
+ */
+#define PAGER_FLEX_REASM_FIRST_SEQ          3
+
+/**
+ * A message being reassembled
+ */
+struct pager_flex_reasm_entry {
+    /**
+     * The capcode the message is for
+     */
+    uint64_t capcode;
+
+    /**
+     * The frame count at which the message stops waiting for its next fragment
+     */
+    uint64_t deadline;
+
+    /**
+     * Next entry with the same hash, or the next free entry
+     */
+    uint32_t hash_next;
+
+    /**
+     * Neighbours on the timeout wheel slot
+     */
+    uint32_t wheel_prev;
+    uint32_t wheel_next;
+
+    /**
+     * The sequence number of the first fragment held
+     */
+    uint8_t first_seq;
+
+    /**
+     * The sequence number the next fragment should have
+     */
+    uint8_t next_seq;
+
+    uint8_t phase;
+    bool maildrop;
+
+    /**
+     * Whether anything had to be dropped from the message
+     */
+    bool truncated;
+
+    size_t len;
+    char buf[PAGER_FLEX_REASM_MAX_LEN];
+};
+
+struct pager_flex_reasm {
+    /**
+     * The arena: every message is reassembled in one of these
+     */
+    struct pager_flex_reasm_entry *entries;
+    size_t nr_entries;
+
+    /**
+     * The entries not in use, linked through hash_next
+     */
+    uint32_t free_head;
+
+    /**
+     * Hash of capcode to the entries in use; nr_buckets is a power of 2
+     */
+    uint32_t *buckets;
+    size_t nr_buckets;
+
+    /**
+     * Timeout wheel: each slot holds the entries whose deadline falls on it, oldest first
+     */
+    uint32_t wheel_head[PAGER_FLEX_REASM_WHEEL_SLOTS];
+    uint32_t wheel_tail[PAGER_FLEX_REASM_WHEEL_SLOTS];
+
+    /**
+     * The last frame count the wheel was moved forward to
+     */
+    uint64_t now;
+
+    unsigned timeout_frames;
+
+    pager_flex_reasm_on_msg_func_t on_msg;
+    void *priv;
+};
+
+static inline
+size_t _pager_flex_reasm_hash(struct pager_flex_reasm *reasm, uint64_t capcode)
+{
+    return (size_t)((capcode * 0x9e3779b97f4a7c15ull) >> 32) & (reasm->nr_buckets - 1);
+}
+
+static inline
+size_t _pager_flex_reasm_slot(uint64_t frame)
+{
+    return frame & (PAGER_FLEX_REASM_WHEEL_SLOTS - 1);
+}
+
+static
+uint32_t _pager_flex_reasm_find(struct pager_flex_reasm *reasm, uint64_t capcode)
+{
+    uint32_t idx = reasm->buckets[_pager_flex_reasm_hash(reasm, capcode)];
+
+    while (PAGER_FLEX_REASM_NONE != idx && reasm->entries[idx].capcode != capcode) {
+        idx = reasm->entries[idx].hash_next;
+    }
+
+    return idx;
+}
+
+static
+void _pager_flex_reasm_wheel_insert(struct pager_flex_reasm *reasm, uint32_t idx)
+{
+    struct pager_flex_reasm_entry *entry = &reasm->entries[idx];
+    size_t slot = _pager_flex_reasm_slot(entry->deadline);
+
+    entry->wheel_next = PAGER_FLEX_REASM_NONE;
+    entry->wheel_prev = reasm->wheel_tail[slot];
+
+    if (PAGER_FLEX_REASM_NONE == reasm->wheel_tail[slot]) {
+        reasm->wheel_head[slot] = idx;
+    } else {
+        reasm->entries[reasm->wheel_tail[slot]].wheel_next = idx;
+    }
+
+    reasm->wheel_tail[slot] = idx;
+}
+
+static
+void _pager_flex_reasm_wheel_remove(struct pager_flex_reasm *reasm, uint32_t idx)
+{
+    struct pager_flex_reasm_entry *entry = &reasm->entries[idx];
+    size_t slot = _pager_flex_reasm_slot(entry->deadline);
+
+    if (PAGER_FLEX_REASM_NONE == entry->wheel_prev) {
+        reasm->wheel_head[slot] = entry->wheel_next;
+    } else {
+        reasm->entries[entry->wheel_prev].wheel_next = entry->wheel_next;
+    }
+
+    if (PAGER_FLEX_REASM_NONE == entry->wheel_next) {
+        reasm->wheel_tail[slot] = entry->wheel_prev;
+    } else {
+        reasm->entries[entry->wheel_next].wheel_prev = entry->wheel_prev;
+    }
+}
+
+/**
+ * Take an entry off the hash and the wheel, and put it back on the free list
+ */
+static
+void _pager_flex_reasm_release(struct pager_flex_reasm *reasm, uint32_t idx)
+{
+    struct pager_flex_reasm_entry *entry = &reasm->entries[idx];
+    uint32_t *link = &reasm->buckets[_pager_flex_reasm_hash(reasm, entry->capcode)];
+
+    while (*link != idx) {
+        TSL_BUG_ON(PAGER_FLEX_REASM_NONE == *link);
+        link = &reasm->entries[*link].hash_next;
+    }
+
+    *link = entry->hash_next;
+
+    _pager_flex_reasm_wheel_remove(reasm, idx);
+
+    entry->hash_next = reasm->free_head;
+    reasm->free_head = idx;
+}
+
+/**
+ * Hand over a message, whole or not, and release its entry
+ */
+static
+aresult_t _pager_flex_reasm_deliver(struct pager_flex_reasm *reasm, uint32_t idx, bool complete)
+{
+    struct pager_flex_reasm_entry *entry = &reasm->entries[idx];
+
+    _pager_flex_reasm_release(reasm, idx);
+
+    return reasm->on_msg(reasm->priv, entry->capcode, entry->phase, complete && !entry->truncated,
+            entry->maildrop, entry->first_seq, entry->buf, entry->len);
+}
+
+/**
+ * Find the entry closest to its deadline, to make room for a new message
+ */
+static
+uint32_t _pager_flex_reasm_oldest(struct pager_flex_reasm *reasm)
+{
+    for (size_t i = 1; i <= PAGER_FLEX_REASM_WHEEL_SLOTS; i++) {
+        uint32_t idx = reasm->wheel_head[_pager_flex_reasm_slot(reasm->now + i)];
+
+        if (PAGER_FLEX_REASM_NONE != idx) {
+            return idx;
+        }
+    }
+
+    return PAGER_FLEX_REASM_NONE;
+}
+
+static
+void _pager_flex_reasm_append(struct pager_flex_reasm_entry *entry, const char *fragment, size_t fragment_len)
+{
+    size_t room = PAGER_FLEX_REASM_MAX_LEN - entry->len;
+
+    if (fragment_len > room) {
+        fragment_len = room;
+        entry->truncated = true;
+    }
+
+    memcpy(&entry->buf[entry->len], fragment, fragment_len);
+    entry->len += fragment_len;
+}
+
+aresult_t pager_flex_reasm_new(struct pager_flex_reasm **preasm, size_t nr_messages, unsigned timeout_frames,
+        pager_flex_reasm_on_msg_func_t on_msg, void *priv)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_flex_reasm *reasm = NULL;
+
+    TSL_ASSERT_ARG(NULL != preasm);
+    TSL_ASSERT_ARG(0 != nr_messages);
+    TSL_ASSERT_ARG(nr_messages < PAGER_FLEX_REASM_NONE / 2);
+    TSL_ASSERT_ARG(0 != timeout_frames);
+    TSL_ASSERT_ARG(timeout_frames < PAGER_FLEX_REASM_WHEEL_SLOTS);
+    TSL_ASSERT_ARG(NULL != on_msg);
+
+    *preasm = NULL;
+
+    if (FAILED(ret = TZAALLOC(reasm, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&reasm->entries, nr_messages, sizeof(struct pager_flex_reasm_entry),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    reasm->nr_entries = nr_messages;
+
+    /* At least twice as many buckets as entries, to keep the chains short */
+    reasm->nr_buckets = 1;
+    while (reasm->nr_buckets < 2 * nr_messages) {
+        reasm->nr_buckets <<= 1;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&reasm->buckets, reasm->nr_buckets, sizeof(uint32_t),
+                    SYS_CACHE_LINE_LENGTH)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < reasm->nr_buckets; i++) {
+        reasm->buckets[i] = PAGER_FLEX_REASM_NONE;
+    }
+
+    for (size_t i = 0; i < PAGER_FLEX_REASM_WHEEL_SLOTS; i++) {
+        reasm->wheel_head[i] = PAGER_FLEX_REASM_NONE;
+        reasm->wheel_tail[i] = PAGER_FLEX_REASM_NONE;
+    }
+
+    for (size_t i = 0; i < nr_messages; i++) {
+        reasm->entries[i].hash_next = i + 1 == nr_messages ? PAGER_FLEX_REASM_NONE : i + 1;
+    }
+
+    reasm->free_head = 0;
+    reasm->timeout_frames = timeout_frames;
+    reasm->on_msg = on_msg;
+    reasm->priv = priv;
+
+    *preasm = reasm;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != reasm) {
+            pager_flex_reasm_delete(&reasm);
+        }
+    }
+
+    return ret;
+}
+
+aresult_t pager_flex_reasm_delete(struct pager_flex_reasm **preasm)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_flex_reasm *reasm = NULL;
+
+    TSL_ASSERT_ARG(NULL != preasm);
+
+    if (NULL == *preasm) {
+        goto done;
+    }
+
+    reasm = *preasm;
+
+    if (NULL != reasm->buckets) {
+        TFREE(reasm->buckets);
+    }
+
+    if (NULL != reasm->entries) {
+        TFREE(reasm->entries);
+    }
+
+    TFREE(reasm);
+    *preasm = NULL;
+
+done:
+    return ret;
+}
+
+aresult_t pager_flex_reasm_add(struct pager_flex_reasm *reasm, uint64_t now, uint64_t capcode, uint8_t phase,
+        bool more, bool maildrop, uint8_t seq_num, const char *fragment, size_t fragment_len)
+{
+    aresult_t ret = A_OK;
+
+    uint32_t idx = PAGER_FLEX_REASM_NONE;
+    struct pager_flex_reasm_entry *entry = NULL;
+
+    TSL_ASSERT_ARG(NULL != reasm);
+    TSL_ASSERT_ARG(NULL != fragment || 0 == fragment_len);
+    TSL_ASSERT_ARG(seq_num <= PAGER_FLEX_REASM_FIRST_SEQ);
+
+    if (FAILED(ret = pager_flex_reasm_tick(reasm, now))) {
+        goto done;
+    }
+
+    idx = _pager_flex_reasm_find(reasm, capcode);
+
+    if (PAGER_FLEX_REASM_NONE != idx) {
+        entry = &reasm->entries[idx];
+
+        if (PAGER_FLEX_REASM_FIRST_SEQ != seq_num && entry->next_seq == seq_num) {
+            /* The next fragment of a message being reassembled */
+            _pager_flex_reasm_append(entry, fragment, fragment_len);
+
+            if (false == more) {
+                ret = _pager_flex_reasm_deliver(reasm, idx, true);
+                goto done;
+            }
+
+            entry->next_seq = seq_num >= 2 ? 0 : seq_num + 1;
+
+            _pager_flex_reasm_wheel_remove(reasm, idx);
+            entry->deadline = reasm->now + reasm->timeout_frames + 1;
+            _pager_flex_reasm_wheel_insert(reasm, idx);
+            goto done;
+        }
+
+        /* Out of sequence, or a new message: the one being reassembled won't get any more */
+        if (FAILED(ret = _pager_flex_reasm_deliver(reasm, idx, false))) {
+            goto done;
+        }
+    }
+
+    if (PAGER_FLEX_REASM_FIRST_SEQ != seq_num || false == more) {
+        /* Either a whole message, or a fragment whose start we didn't see */
+        ret = reasm->on_msg(reasm->priv, capcode, phase,
+                PAGER_FLEX_REASM_FIRST_SEQ == seq_num && false == more, maildrop, seq_num,
+                fragment, fragment_len);
+        goto done;
+    }
+
+    if (PAGER_FLEX_REASM_NONE == reasm->free_head) {
+        idx = _pager_flex_reasm_oldest(reasm);
+        TSL_BUG_ON(PAGER_FLEX_REASM_NONE == idx);
+
+        DIAG("Reassembly arena full, handing over the message for capcode %" PRIu64 " early",
+                reasm->entries[idx].capcode);
+
+        if (FAILED(ret = _pager_flex_reasm_deliver(reasm, idx, false))) {
+            goto done;
+        }
+    }
+
+    idx = reasm->free_head;
+    entry = &reasm->entries[idx];
+    reasm->free_head = entry->hash_next;
+
+    entry->capcode = capcode;
+    entry->deadline = reasm->now + reasm->timeout_frames + 1;
+    entry->first_seq = seq_num;
+    entry->next_seq = 0;
+    entry->phase = phase;
+    entry->maildrop = maildrop;
+    entry->truncated = false;
+    entry->len = 0;
+
+    _pager_flex_reasm_append(entry, fragment, fragment_len);
+
+    entry->hash_next = reasm->buckets[_pager_flex_reasm_hash(reasm, capcode)];
+    reasm->buckets[_pager_flex_reasm_hash(reasm, capcode)] = idx;
+
+    _pager_flex_reasm_wheel_insert(reasm, idx);
+
+done:
+    return ret;
+}
+
+aresult_t pager_flex_reasm_tick(struct pager_flex_reasm *reasm, uint64_t now)
+{
+    aresult_t ret = A_OK;
+
+    uint64_t nr_steps = 0;
+
+    TSL_ASSERT_ARG(NULL != reasm);
+
+    if (now <= reasm->now) {
+        goto done;
+    }
+
+    /* Every deadline is within a lap of the wheel, so there's never more than one lap to walk */
+    nr_steps = now - reasm->now;
+    if (nr_steps > PAGER_FLEX_REASM_WHEEL_SLOTS) {
+        nr_steps = PAGER_FLEX_REASM_WHEEL_SLOTS;
+    }
+
+    for (uint64_t i = 1; i <= nr_steps; i++) {
+        size_t slot = _pager_flex_reasm_slot(reasm->now + i);
+
+        while (PAGER_FLEX_REASM_NONE != reasm->wheel_head[slot] &&
+                reasm->entries[reasm->wheel_head[slot]].deadline <= now)
+        {
+            if (FAILED(ret = _pager_flex_reasm_deliver(reasm, reasm->wheel_head[slot], false))) {
+                goto done;
+            }
+        }
+    }
+
+    reasm->now = now;
+
+done:
+    return ret;
+}
+
+aresult_t pager_flex_reasm_flush(struct pager_flex_reasm *reasm)
+{
+    aresult_t ret = A_OK;
+
+    uint32_t idx = PAGER_FLEX_REASM_NONE;
+
+    TSL_ASSERT_ARG(NULL != reasm);
+
+    while (PAGER_FLEX_REASM_NONE != (idx = _pager_flex_reasm_oldest(reasm))) {
+        if (FAILED(ret = _pager_flex_reasm_deliver(reasm, idx, false))) {
+            goto done;
+        }
+    }
+
+done:
+    return ret;
+}
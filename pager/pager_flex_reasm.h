@@ -0,0 +1,112 @@
+#pragma once
+
+#include <tsl/result.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Reassembly of fragmented FLEX alphanumeric messages, with bounded memory.
+ *
+ * The first fragment of a message has sequence number 3; those after it count 0, 1, 2, 0, 1, ...
+ * and every fragment but the last has its fragment (continued) flag set. A message being
+ * reassembled lives in a fixed size arena, keyed by its capcode, and on a timeout wheel with one
+ * slot per FLEX frame. A message whose next fragment doesn't arrive before its timeout, that is
+ * interrupted by a fragment out of sequence, or that is evicted to make room for a new message,
+ * is handed over as it is, marked incomplete.
+ *
+ * Time is counted in FLEX frames (1.875 seconds each), as a count that only goes forward.
+ */
+struct pager_flex_reasm;
+
+/**
+ * The longest timeout, in frames. Also the number of slots on the timeout wheel.
+ */
+#define PAGER_FLEX_REASM_WHEEL_SLOTS        64
+
+/**
+ * The longest message reassembled. Anything past this is dropped, and the message is marked
+ * incomplete.
+ */
+#define PAGER_FLEX_REASM_MAX_LEN            2048
+
+/**
+ * Called with each message, whole or not.
+ *
+ * \param priv The state passed to pager_flex_reasm_new
+ * \param capcode The capcode the message was for
+ * \param phase The phase the first fragment came on
+ * \param complete false if fragments are missing
+ * \param maildrop The maildrop flag, from the first fragment
+ * \param seq_num The sequence number of the first fragment held: 3 unless the start of the
+ *                message was missed
+ * \param message The message
+ * \param message_len The length of the message, in bytes
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+typedef aresult_t (*pager_flex_reasm_on_msg_func_t)(void *priv, uint64_t capcode, uint8_t phase, bool complete,
+        bool maildrop, uint8_t seq_num, const char *message, size_t message_len);
+
+/**
+ * Create a reassembler.
+ *
+ * \param preasm The reassembler, returned by reference
+ * \param nr_messages The most messages to reassemble at once
+ * \param timeout_frames How many frames to wait for the next fragment of a message, from 1 to
+ *                       PAGER_FLEX_REASM_WHEEL_SLOTS - 1
+ * \param on_msg Called with each message
+ * \param priv Passed to on_msg
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_reasm_new(struct pager_flex_reasm **preasm, size_t nr_messages, unsigned timeout_frames,
+        pager_flex_reasm_on_msg_func_t on_msg, void *priv);
+
+/**
+ * Destroy a reassembler. Messages still being reassembled are dropped; call pager_flex_reasm_flush
+ * first to get them.
+ *
+ * \param preasm The reassembler, passed by reference. Set to NULL.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_reasm_delete(struct pager_flex_reasm **preasm);
+
+/**
+ * Add a fragment. A message that isn't fragmented at all is handed straight over.
+ *
+ * \param reasm The reassembler
+ * \param now The current frame count
+ * \param capcode The capcode the fragment is for
+ * \param phase The phase the fragment came on
+ * \param more The fragment flag: more fragments follow this one
+ * \param maildrop The maildrop flag
+ * \param seq_num The fragment's sequence number
+ * \param fragment The fragment's characters
+ * \param fragment_len The number of characters
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_reasm_add(struct pager_flex_reasm *reasm, uint64_t now, uint64_t capcode, uint8_t phase,
+        bool more, bool maildrop, uint8_t seq_num, const char *fragment, size_t fragment_len);
+
+/**
+ * Move time forward, handing over any message that has waited too long for its next fragment.
+ *
+ * \param reasm The reassembler
+ * \param now The current frame count
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_reasm_tick(struct pager_flex_reasm *reasm, uint64_t now);
+
+/**
+ * Hand over every message still being reassembled, as incomplete.
+ *
+ * \param reasm The reassembler
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_flex_reasm_flush(struct pager_flex_reasm *reasm);
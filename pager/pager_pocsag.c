@@ -23,6 +23,10 @@
 #include <pager/pager_pocsag_priv.h>
 #include <pager/mueller_muller.h>
 #include <pager/bch_code.h>
+#include <pager/pager_capcode_filter.h>
+#include <pager/pager_decode_pool.h>
+
+#include <filter/cycle_counter.h>
 
 #include <tsl/safe_alloc.h>
 #include <tsl/errors.h>
@@ -35,6 +39,30 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+
+/**
+ * Clock recovery loop gains, scaled by the number of samples per bit. The phase gain pulls in a
+ * full bit of timing error over about 40 bits; the rate gain tracks a transmitter whose bit clock
+ * is off by up to PAGER_POCSAG_MM_MAX_DRIFT.
+ */
+#define PAGER_POCSAG_MM_KM              0.025f
+#define PAGER_POCSAG_MM_KW              0.000625f
+#define PAGER_POCSAG_MM_MAX_DRIFT       0.01f
+
+/**
+ * Time constant of the smoothing ahead of clock recovery, in bits. Sampled well above the baud
+ * rate, a bit is flat but for a sample or two at either end, and the timing error the clock
+ * recovery sees is mostly noise; smoothing spreads the edges across the bit.
+ */
+#define PAGER_POCSAG_RX_SMOOTH          0.25f
+
+/**
+ * The most bits recovered from the clock at once
+ */
+#define PAGER_POCSAG_RECEIVE_BITS       64
+
+static void _pager_pocsag_batches_deliver(struct pager_pocsag *pocsag, bool wait);
 
 static
 bool __pager_pocsag_check_sync_word(uint32_t word)
@@ -66,34 +94,55 @@ void _pager_pocsag_batch_reset(struct pager_pocsag_batch *batch)
     memset(batch->current_batch, 0, sizeof(batch->current_batch));
     batch->current_batch_word = 0;
     batch->current_batch_word_bit = 0;
-    batch->cur_sample_skip = 0;
     batch->bit_count = 0;
 }
 
 static
 void _pager_pocsag_sync_search_reset(struct pager_pocsag_sync_search *sync)
 {
-    sync->cur_sample_skip = 0;
     sync->nr_sync_bits = 0;
     sync->sync_word = 0;
 }
 
+/**
+ * Start recovering the bit clock at the baud rate a sync word was found at. The first bit of the
+ * batch is a bit after the middle of the eye, which ended on the last sample consumed, delayed
+ * by the smoothing.
+ */
 static
-aresult_t _pager_pocsag_baud_on_sample(struct pager_pocsag *pocsag, struct pager_pocsag_baud_detect *det, int16_t sample)
+void _pager_pocsag_clock_start(struct pager_pocsag *pocsag, struct pager_pocsag_baud_detect *det)
 {
-    aresult_t ret = A_OK;
+    float spb = det->bit_samples,
+          tau = spb * PAGER_POCSAG_RX_SMOOTH,
+          offset = spb - (float)det->nr_eye_matches / 2.0f - 1.5f + tau;
 
-    int bit = 0;
+    pocsag->rx_smooth_gain = 1.0f - expf(-1.0f / tau);
+    pocsag->rx_smooth = 0.0f;
 
-    TSL_ASSERT_ARG_DEBUG(NULL != pocsag);
-    TSL_ASSERT_ARG_DEBUG(NULL != det);
+    TSL_BUG_IF_FAILED(mm_init(&pocsag->mm, PAGER_POCSAG_MM_KW * spb, PAGER_POCSAG_MM_KM * spb, spb,
+                spb * (1.0f - PAGER_POCSAG_MM_MAX_DRIFT), spb * (1.0f + PAGER_POCSAG_MM_MAX_DRIFT)));
+    mm_restart(&pocsag->mm, offset < 0.0f ? 0.0f : offset);
+}
 
-    bit = sample < 0 ? 1 : 0;
+/**
+ * Track the eye of a sync word at one baud rate: a run of consecutive samples, each of which ends
+ * a near match of the sync word. A run longer than half a bit is a sync.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param det The baud rate detector
+ * \param match Whether the sync word matched, ending at this sample
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+static
+aresult_t _pager_pocsag_baud_on_sample(struct pager_pocsag *pocsag, struct pager_pocsag_baud_detect *det, bool match)
+{
+    aresult_t ret = A_OK;
 
-    det->eye_detect[det->cur_word] <<= 1;
-    det->eye_detect[det->cur_word] |= bit;
+    TSL_ASSERT_ARG_DEBUG(NULL != pocsag);
+    TSL_ASSERT_ARG_DEBUG(NULL != det);
 
-    if (__pager_pocsag_check_sync_word(det->eye_detect[det->cur_word])) {
+    if (true == match) {
         det->nr_eye_matches++;
     } else {
         /* Check if our eye is open wide enough */
@@ -101,83 +150,246 @@ aresult_t _pager_pocsag_baud_on_sample(struct pager_pocsag *pocsag, struct pager
             /* Advance the state */
             DIAG("SEARCH -> SYNCHRONIZED: Initial Sync Found, skip = %u, matches = %u",
                     (unsigned)det->samples_per_bit, (unsigned)det->nr_eye_matches);
-            pocsag->sample_skip = det->samples_per_bit;
             pocsag->baud_rate = det->baud_rate;
             _pager_pocsag_batch_reset(&pocsag->batch);
-            pocsag->batch.cur_sample_skip = det->nr_eye_matches/2;
+            _pager_pocsag_clock_start(pocsag, det);
             pocsag->cur_state = PAGER_POCSAG_STATE_SYNCHRONIZED;
+            pocsag->stats.nr_syncs++;
         } else {
             /* No eye. */
             det->nr_eye_matches = 0;
         }
     }
-    det->cur_word = (det->cur_word + 1) % det->samples_per_bit;
 
     return ret;
 }
 
+/**
+ * Get 64 bits from a bit array, starting at any bit
+ */
+static inline
+uint64_t _pager_pocsag_corr_bits(const uint64_t *bits, size_t offset)
+{
+    size_t word = offset / 64,
+           shift = offset % 64;
+
+    if (0 == shift) {
+        return bits[word];
+    }
+
+    return (bits[word] >> shift) | (bits[word + 1] << (64 - shift));
+}
+
+/**
+ * Check every sample being tested for the end of a sync word at one baud rate, all at once. Bit i
+ * of the sync word is compared against the samples i bit times earlier, 64 at a time, and the
+ * mismatches counted in a 3 bit counter per sample, spread across c0, c1 and c2.
+ *
+ * \param bits The sliced samples
+ * \param det The baud rate detector, with the offset of each bit
+ * \param lanes A mask of the samples to test
+ *
+ * \return A mask of the samples that end a word no more than 4 bits off the sync word
+ */
+static
+uint64_t _pager_pocsag_corr_match(const uint64_t *bits, const struct pager_pocsag_baud_detect *det, uint64_t lanes)
+{
+    uint64_t c0 = 0,
+             c1 = 0,
+             c2 = 0,
+             over = 0;
+
+    for (size_t i = 0; i < PAGER_POCSAG_SYNC_BITS; i++) {
+        uint64_t diff = _pager_pocsag_corr_bits(bits, PAGER_POCSAG_CORR_HISTORY - det->tap_offsets[i]),
+                 carry = 0;
+
+        if (0 != ((POCSAG_SYNC_CODEWORD >> i) & 1)) {
+            diff = ~diff;
+        }
+
+        carry = c0 & diff;
+        c0 ^= diff;
+        diff = c1 & carry;
+        c1 ^= carry;
+        carry = c2 & diff;
+        c2 ^= diff;
+        over |= carry;
+
+        /* Noise is usually more than 7 bits off everywhere well before the last bit */
+        if (0 == (lanes & ~over)) {
+            return 0;
+        }
+    }
+
+    /* No more than 4: under 8, and either under 4 or exactly 4 */
+    return lanes & ~over & (~c2 | ~(c1 | c0));
+}
+
+/**
+ * Drop the oldest samples from the sync correlator's bits
+ */
+static
+void _pager_pocsag_corr_slide(uint64_t *bits, size_t nr_bits)
+{
+    size_t words = nr_bits / 64,
+           shift = nr_bits % 64;
+
+    for (size_t i = 0; i < PAGER_POCSAG_CORR_WORDS; i++) {
+        uint64_t lo = i + words < PAGER_POCSAG_CORR_WORDS ? bits[i + words] : 0,
+                 hi = i + words + 1 < PAGER_POCSAG_CORR_WORDS ? bits[i + words + 1] : 0;
+
+        bits[i] = 0 == shift ? lo : (lo >> shift) | (hi << (64 - shift));
+    }
+}
+
+/**
+ * Search a run of samples for a sync word at any of the baud rates, up to 64 samples at a time.
+ * The samples are sliced once, then every sample offset is checked at every baud rate with word
+ * wide operations, rather than keeping a shift register per sample offset. The eye is only
+ * tracked sample by sample where something matched, or a match was in progress.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param pcm_samples The samples
+ * \param nr_samples The number of samples
+ *
+ * \return The number of samples consumed. If a sync was found, the sample it was found at is
+ *         the last consumed.
+ */
+static
+size_t _pager_pocsag_sync_correlate(struct pager_pocsag *pocsag, const int16_t *pcm_samples, size_t nr_samples)
+{
+    struct pager_pocsag_baud_detect *dets[3] = { pocsag->baud_512, pocsag->baud_1200, pocsag->baud_2400 };
+    uint64_t matches[3],
+             lanes = 0,
+             sliced = 0;
+    size_t nr_lanes = BL_MIN2(nr_samples, (size_t)PAGER_POCSAG_CORR_LANES);
+    bool idle = true;
+
+    lanes = PAGER_POCSAG_CORR_LANES == nr_lanes ? ~0ull : (1ull << nr_lanes) - 1;
+
+    for (size_t i = 0; i < nr_lanes; i++) {
+        sliced |= (uint64_t)(pcm_samples[i] < 0) << i;
+    }
+
+    pocsag->corr_bits[PAGER_POCSAG_CORR_HISTORY / 64] = sliced;
+
+    for (size_t d = 0; d < 3; d++) {
+        matches[d] = _pager_pocsag_corr_match(pocsag->corr_bits, dets[d], lanes);
+
+        if (0 != matches[d] || 0 != dets[d]->nr_eye_matches) {
+            idle = false;
+        }
+    }
+
+    if (false == idle) {
+        for (size_t i = 0; i < nr_lanes; i++) {
+            for (size_t d = 0; d < 3; d++) {
+                TSL_BUG_IF_FAILED(_pager_pocsag_baud_on_sample(pocsag, dets[d], !!((matches[d] >> i) & 1)));
+            }
+
+            if (pocsag->cur_state == PAGER_POCSAG_STATE_SYNCHRONIZED) {
+                return i + 1;
+            }
+        }
+    }
+
+    _pager_pocsag_corr_slide(pocsag->corr_bits, nr_lanes);
+
+    return nr_lanes;
+}
+
 static
 void _pager_pocsag_baud_reset(struct pager_pocsag_baud_detect *det)
 {
     TSL_BUG_ON(NULL == det);
-    memset(det->eye_detect, 0, sizeof(uint32_t) * det->samples_per_bit);
-    det->cur_word = 0;
     det->nr_eye_matches = 0;
 }
 
 static
 void _pager_pocsag_baud_search_reset(struct pager_pocsag *pocsag)
 {
+    /* Samples from before the search started don't count */
+    memset(pocsag->corr_bits, 0, sizeof(pocsag->corr_bits));
+
     _pager_pocsag_baud_reset(pocsag->baud_512);
-    pocsag->baud_512->samples_per_bit = 75;
-    pocsag->baud_512->baud_rate = 512;
     _pager_pocsag_baud_reset(pocsag->baud_1200);
-    pocsag->baud_1200->samples_per_bit = 32;
-    pocsag->baud_1200->baud_rate = 1200;
     _pager_pocsag_baud_reset(pocsag->baud_2400);
-    pocsag->baud_2400->samples_per_bit = 16;
-    pocsag->baud_2400->baud_rate = 2400;
+}
+
+/**
+ * Set up a baud rate detector for a sample rate. Where the sample rate isn't a whole multiple of
+ * the baud rate, each bit of the sync word is still tested at the nearest sample.
+ */
+static
+void _pager_pocsag_baud_init(struct pager_pocsag_baud_detect *det, uint16_t baud_rate, uint32_t sample_rate)
+{
+    TSL_BUG_ON(NULL == det);
+
+    det->baud_rate = baud_rate;
+    det->bit_samples = (float)sample_rate / (float)baud_rate;
+    det->samples_per_bit = lrintf(det->bit_samples);
+
+    for (size_t i = 0; i < PAGER_POCSAG_SYNC_BITS; i++) {
+        det->tap_offsets[i] = lrintf((float)i * det->bit_samples);
+        TSL_BUG_ON(det->tap_offsets[i] > PAGER_POCSAG_CORR_HISTORY);
+    }
 }
 
 aresult_t pager_pocsag_new(struct pager_pocsag **ppocsag, uint32_t freq_hz,
         pager_pocsag_on_numeric_msg_func_t on_numeric,
         pager_pocsag_on_alpha_msg_func_t on_alpha,
         bool skip_bch_decode)
+{
+    return pager_pocsag_new_rate(ppocsag, freq_hz, POCSAG_PAGER_BASE_BAUD_RATE, on_numeric, on_alpha,
+            skip_bch_decode);
+}
+
+aresult_t pager_pocsag_new_rate(struct pager_pocsag **ppocsag, uint32_t freq_hz, uint32_t sample_rate,
+        pager_pocsag_on_numeric_msg_func_t on_numeric,
+        pager_pocsag_on_alpha_msg_func_t on_alpha,
+        bool skip_bch_decode)
 {
     aresult_t ret = A_OK;
 
-    /* BCH Generator Polynomial */
-    static const int poly[6] = { 1, 0, 1, 0, 0, 1 };
     struct pager_pocsag *pocsag = NULL;
 
     TSL_ASSERT_ARG(NULL != ppocsag);
+    TSL_ASSERT_ARG(sample_rate >= PAGER_POCSAG_SAMPLE_RATE_MIN);
+    TSL_ASSERT_ARG(sample_rate <= PAGER_POCSAG_SAMPLE_RATE_MAX);
 
     if (FAILED(ret = TZAALLOC(pocsag, SYS_CACHE_LINE_LENGTH))) {
         goto done;
     }
 
     if (FAILED(ret = TACALLOC((void **)&pocsag->baud_512, 1,
-                    sizeof(struct pager_pocsag_baud_detect) + 75 * sizeof(uint32_t), SYS_CACHE_LINE_LENGTH)))
+                    sizeof(struct pager_pocsag_baud_detect), SYS_CACHE_LINE_LENGTH)))
     {
         goto done;
     }
 
     if (FAILED(ret = TACALLOC((void **)&pocsag->baud_1200, 1,
-                    sizeof(struct pager_pocsag_baud_detect) + 32 * sizeof(uint32_t), SYS_CACHE_LINE_LENGTH)))
+                    sizeof(struct pager_pocsag_baud_detect), SYS_CACHE_LINE_LENGTH)))
     {
         goto done;
     }
 
     if (FAILED(ret = TACALLOC((void **)&pocsag->baud_2400, 1,
-                    sizeof(struct pager_pocsag_baud_detect) + 16 * sizeof(uint32_t), SYS_CACHE_LINE_LENGTH)))
+                    sizeof(struct pager_pocsag_baud_detect), SYS_CACHE_LINE_LENGTH)))
     {
         goto done;
     }
 
-    TSL_BUG_IF_FAILED(bch_code_new(&pocsag->bch, poly, 5, 31, 21, 2));
+    if (FAILED(ret = bch_code_get_pager(&pocsag->bch))) {
+        goto done;
+    }
 
     pocsag->on_numeric = on_numeric;
     pocsag->on_alpha = on_alpha;
+    pocsag->sample_rate = sample_rate;
+
+    _pager_pocsag_baud_init(pocsag->baud_512, 512, sample_rate);
+    _pager_pocsag_baud_init(pocsag->baud_1200, 1200, sample_rate);
+    _pager_pocsag_baud_init(pocsag->baud_2400, 2400, sample_rate);
 
     _pager_pocsag_baud_search_reset(pocsag);
     _pager_pocsag_message_decode_reset(&pocsag->decoder);
@@ -198,9 +410,6 @@ done:
             if (NULL != pocsag->baud_2400) {
                 TFREE(pocsag->baud_2400);
             }
-            if (NULL != pocsag->bch) {
-                bch_code_delete(&pocsag->bch);
-            }
             TFREE(pocsag);
         }
     }
@@ -218,6 +427,9 @@ aresult_t pager_pocsag_delete(struct pager_pocsag **ppocsag)
 
     pocsag = *ppocsag;
 
+    /* Decode whatever is left of the batches still being corrected */
+    _pager_pocsag_batches_deliver(pocsag, true);
+
     if (NULL != pocsag->baud_512) {
         TFREE(pocsag->baud_512);
     }
@@ -227,9 +439,6 @@ aresult_t pager_pocsag_delete(struct pager_pocsag **ppocsag)
     if (NULL != pocsag->baud_2400) {
         TFREE(pocsag->baud_2400);
     }
-    if (NULL != pocsag->bch) {
-        bch_code_delete(&pocsag->bch);
-    }
 
     TFREE(pocsag);
 
@@ -251,6 +460,12 @@ aresult_t _pager_pocsag_message_decode_deliver(struct pager_pocsag *pocsag, stru
         goto done;
     }
 
+    if (PAGER_POCSAG_MESSAGE_TYPE_FILTERED == decode->msg_type) {
+        /* Nobody wants it */
+        _pager_pocsag_message_decode_reset(decode);
+        goto done;
+    }
+
     if (decode->next_byte_alpha != 0) {
         char last_c = decode->message_alpha[decode->next_byte_alpha - 1];
         /* Favour messages that ended with a traditional "end of message" character */
@@ -316,22 +531,47 @@ char _pager_pocsag_numeric_message_charmap[16] = {
     [15] = ']',
 };
 
+/**
+ * BCH correct the codewords of a received batch. Run as a decode job, possibly on a decode pool
+ * worker, so must only touch the batch.
+ */
 static
-aresult_t _pager_pocsag_process_batch(struct pager_pocsag *pocsag, struct pager_pocsag_batch *batch)
+void _pager_pocsag_batch_correct(struct pager_decode_job *job)
+{
+    struct pager_pocsag_batch_job *bj = BL_CONTAINER_OF(job, struct pager_pocsag_batch_job, job);
+
+    bj->nr_good = 0;
+
+    for (size_t z = 0; z < PAGER_POCSAG_BATCH_BITS/32; z++) {
+        uint32_t corrected = bj->words[z] & 0x7ffffffful;
+
+        if (pager_stats_bch_decode(&bj->stats, bj->bch, &corrected)) {
+            break;
+        }
+
+        bj->words[z] = corrected;
+        bj->nr_good++;
+    }
+}
+
+static
+aresult_t _pager_pocsag_process_batch(struct pager_pocsag *pocsag, struct pager_pocsag_batch_job *bj)
 {
     aresult_t ret = A_OK;
 
     struct pager_pocsag_message_decode *decode = NULL;
 
     TSL_ASSERT_ARG_DEBUG(NULL != pocsag);
-    TSL_ASSERT_ARG_DEBUG(NULL != batch);
+    TSL_ASSERT_ARG_DEBUG(NULL != bj);
 
     decode = &pocsag->decoder;
 
+    pager_stats_add(&pocsag->stats, &bj->stats);
+
     for (size_t z = 0; z < PAGER_POCSAG_BATCH_BITS/32; z++) {
-        uint32_t corrected = batch->current_batch[z] & 0x7ffffffful;
+        uint32_t corrected = bj->words[z];
 
-        if (bch_code_decode(pocsag->bch, &corrected)) {
+        if (z == bj->nr_good) {
             /* We're stuck. POCSAG is too fragile to try to continue decoding, so we have to
              * discard the (rest) of the batch.
              */
@@ -362,6 +602,11 @@ aresult_t _pager_pocsag_process_batch(struct pager_pocsag *pocsag, struct pager_
             decode->function = (corrected >> 19) & 0x3;
             decode->cap_code = (((corrected >> 1) & ((1 << 18) - 1)) << 3) + ((z >> 1) & 0x7);
             DIAG("  ADDR: %u Function %u (raw = 0x%08x)", decode->cap_code, decode->function, corrected);
+
+            if (false == pager_capcode_filter_wanted(pocsag->capcode_filter, decode->cap_code)) {
+                decode->msg_type = PAGER_POCSAG_MESSAGE_TYPE_FILTERED;
+                pocsag->stats.nr_filtered++;
+            }
         } else if (decode->msg_type == PAGER_POCSAG_MESSAGE_TYPE_UNKNOWN) {
             uint32_t val = (corrected >> 1) & 0xfffffu;
 
@@ -431,114 +676,279 @@ done:
     return ret;
 }
 
+/**
+ * Decode received batches, oldest first, as long as their codewords have been corrected.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param wait Wait for every batch still being corrected, rather than stopping at the first
+ */
+static
+void _pager_pocsag_batches_deliver(struct pager_pocsag *pocsag, bool wait)
+{
+    while (pocsag->batch_head != pocsag->batch_tail) {
+        struct pager_pocsag_batch_job *bj = &pocsag->batches[pocsag->batch_head % PAGER_POCSAG_NR_BATCHES];
+
+        if (false == pager_decode_job_done(&bj->job)) {
+            if (false == wait) {
+                break;
+            }
+
+            pager_decode_pool_wait(pocsag->pool, &bj->job);
+        }
+
+        if (FAILED_UNLIKELY(_pager_pocsag_process_batch(pocsag, bj))) {
+            DIAG("Failed to process batch -- likely a multi-bit error occurred.");
+            pocsag->stats.nr_frame_rejects++;
+        }
+
+        pocsag->batch_head++;
+    }
+}
+
+/**
+ * Take a copy of the batch just received, and hand it over to be corrected. Without a decode
+ * pool the batch is corrected, and decoded, before this returns.
+ */
+static
+void _pager_pocsag_batch_submit(struct pager_pocsag *pocsag, struct pager_pocsag_batch *batch)
+{
+    struct pager_pocsag_batch_job *bj = NULL;
+
+    if (PAGER_POCSAG_NR_BATCHES == pocsag->batch_tail - pocsag->batch_head) {
+        /* Every batch is in use, so the oldest has to be finished before we can carry on */
+        struct pager_pocsag_batch_job *oldest = &pocsag->batches[pocsag->batch_head % PAGER_POCSAG_NR_BATCHES];
+        pager_decode_pool_wait(pocsag->pool, &oldest->job);
+        _pager_pocsag_batches_deliver(pocsag, false);
+    }
+
+    bj = &pocsag->batches[pocsag->batch_tail % PAGER_POCSAG_NR_BATCHES];
+
+    bj->job.work = _pager_pocsag_batch_correct;
+    bj->bch = pocsag->bch;
+    memcpy(bj->words, batch->current_batch, sizeof(bj->words));
+    memset(&bj->stats, 0, sizeof(bj->stats));
+
+    pocsag->batch_tail++;
+
+    pager_decode_pool_run(pocsag->pool, &bj->job);
+
+    _pager_pocsag_batches_deliver(pocsag, false);
+}
+
+aresult_t pager_pocsag_get_stats(struct pager_pocsag *pocsag, struct pager_stats *stats)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != pocsag);
+    TSL_ASSERT_ARG(NULL != stats);
+
+    *stats = pocsag->stats;
+
+    return ret;
+}
+
+/**
+ * Add a bit to the batch being received, processing the batch once it is complete.
+ */
+static
+void _pager_pocsag_batch_on_bit(struct pager_pocsag *pocsag, uint32_t bit)
+{
+    struct pager_pocsag_batch *batch = &pocsag->batch;
+
+    batch->current_batch[batch->current_batch_word] |= bit << batch->current_batch_word_bit;
+    batch->current_batch_word_bit++;
+    batch->bit_count++;
+
+    if (batch->current_batch_word_bit == 32) {
+        batch->current_batch_word_bit = 0;
+        batch->current_batch_word++;
+        if (batch->current_batch_word == PAGER_POCSAG_BATCH_BITS/32) {
+            /* Process the batch */
+            _pager_pocsag_batch_submit(pocsag, batch);
+
+            /* Switch to sync search state */
+            DIAG("BATCH_RECEIVE -> SEARCH_SYNCWORD (bit count = %u)", (unsigned)batch->bit_count);
+            pocsag->cur_state = PAGER_POCSAG_STATE_SEARCH_SYNCWORD;
+
+            batch->current_batch_word_bit = 0;
+            batch->current_batch_word = 0;
+
+            _pager_pocsag_sync_search_reset(&pocsag->sync);
+        }
+    }
+}
+
+/**
+ * Add a bit to the sync word expected after a batch. Once all of it has arrived, either receive
+ * the next batch or go back to searching for a sync at every baud rate.
+ */
+static
+void _pager_pocsag_sync_on_bit(struct pager_pocsag *pocsag, uint32_t bit)
+{
+    struct pager_pocsag_sync_search *sync = &pocsag->sync;
+
+    sync->sync_word <<= 1;
+    sync->sync_word |= bit;
+    sync->nr_sync_bits++;
+
+    if (sync->nr_sync_bits == PAGER_POCSAG_SYNC_BITS) {
+        if (false == __pager_pocsag_check_sync_word(sync->sync_word)) {
+            /* Search for the next sync word from scratch */
+            DIAG("SEARCH_SYNCWORD -> SEARCH (got %08x)", sync->sync_word);
+            pocsag->cur_state = PAGER_POCSAG_STATE_SEARCH;
+            _pager_pocsag_baud_search_reset(pocsag);
+            /* The message being decoded may carry on in batches still being corrected */
+            _pager_pocsag_batches_deliver(pocsag, true);
+            TSL_BUG_IF_FAILED(_pager_pocsag_message_decode_deliver(pocsag, &pocsag->decoder));
+        } else {
+            DIAG("SEARCH_SYNCWORD -> BATCH_RECEIVE");
+            pocsag->cur_state = PAGER_POCSAG_STATE_BATCH_RECEIVE;
+            _pager_pocsag_batch_reset(&pocsag->batch);
+        }
+    }
+}
+
+/**
+ * Receive the bits of a batch, or of the sync word after one, recovering the bit clock from the
+ * samples rather than counting a fixed number of samples per bit. This tolerates transmitters
+ * whose bit clock is a little off, and sample rates that aren't a multiple of the baud rate.
+ *
+ * No more bits are taken than are left in the batch or sync word, so the state only changes on
+ * the last bit; the samples after it are left for the next state.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param pcm_samples The smoothed samples
+ * \param nr_samples The number of samples
+ *
+ * \return The number of samples consumed
+ */
+static
+size_t _pager_pocsag_receive_bits(struct pager_pocsag *pocsag, const int16_t *pcm_samples, size_t nr_samples)
+{
+    int16_t decisions[PAGER_POCSAG_RECEIVE_BITS];
+    size_t nr_bits = 0,
+           nr_decisions = 0,
+           consumed = 0;
+    bool in_batch = PAGER_POCSAG_STATE_BATCH_RECEIVE == pocsag->cur_state;
+
+    if (true == in_batch) {
+        nr_bits = PAGER_POCSAG_BATCH_BITS - pocsag->batch.bit_count;
+    } else {
+        nr_bits = PAGER_POCSAG_SYNC_BITS - pocsag->sync.nr_sync_bits;
+    }
+
+    nr_bits = BL_MIN2(nr_bits, (size_t)PAGER_POCSAG_RECEIVE_BITS);
+
+    TSL_BUG_IF_FAILED(mm_recover(&pocsag->mm, pcm_samples, nr_samples, decisions, nr_bits,
+                &nr_decisions, &consumed));
+
+    for (size_t i = 0; i < nr_decisions; i++) {
+        uint32_t bit = decisions[i] < 0 ? 1 : 0;
+
+        if (true == in_batch) {
+            _pager_pocsag_batch_on_bit(pocsag, bit);
+        } else {
+            _pager_pocsag_sync_on_bit(pocsag, bit);
+        }
+    }
+
+    return consumed;
+}
+
+/**
+ * Smooth up to PAGER_POCSAG_RX_SAMPLES samples, and receive bits from them until they run out or
+ * the sync is lost.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param pcm_samples The samples
+ * \param nr_samples The number of samples
+ *
+ * \return The number of samples consumed
+ */
+static
+size_t _pager_pocsag_receive(struct pager_pocsag *pocsag, const int16_t *pcm_samples, size_t nr_samples)
+{
+    size_t nr_smoothed = BL_MIN2(nr_samples, (size_t)PAGER_POCSAG_RX_SAMPLES),
+           consumed = 0;
+    float smooth = pocsag->rx_smooth,
+          gain = pocsag->rx_smooth_gain;
+
+    for (size_t i = 0; i < nr_smoothed; i++) {
+        smooth += ((float)pcm_samples[i] - smooth) * gain;
+        pocsag->rx_samples[i] = (int16_t)smooth;
+    }
+
+    pocsag->rx_smooth = smooth;
+
+    while (consumed < nr_smoothed && PAGER_POCSAG_STATE_SEARCH != pocsag->cur_state) {
+        consumed += _pager_pocsag_receive_bits(pocsag, &pocsag->rx_samples[consumed], nr_smoothed - consumed);
+    }
+
+    return consumed;
+}
+
+aresult_t pager_pocsag_set_capcode_filter(struct pager_pocsag *pocsag, const struct pager_capcode_filter *filter)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != pocsag);
+
+    pocsag->capcode_filter = filter;
+
+    return ret;
+}
+
+aresult_t pager_pocsag_set_decode_pool(struct pager_pocsag *pocsag, struct pager_decode_pool *pool)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != pocsag);
+
+    /* Batches already handed to the old pool have to be finished there */
+    _pager_pocsag_batches_deliver(pocsag, true);
+
+    pocsag->pool = pool;
+
+    return ret;
+}
+
 aresult_t pager_pocsag_on_pcm(struct pager_pocsag *pocsag, const int16_t *pcm_samples, size_t nr_samples)
 {
     aresult_t ret = A_OK;
 
     size_t next_sample = 0;
-    struct pager_pocsag_batch *batch = NULL;
-    struct pager_pocsag_sync_search *sync = NULL;
+
+    CYCLE_COUNT_START(cycles);
 
     TSL_ASSERT_ARG(NULL != pocsag);
     TSL_ASSERT_ARG(NULL != pcm_samples);
     TSL_ASSERT_ARG(0 != nr_samples);
 
-    batch = &pocsag->batch;
-    sync = &pocsag->sync;
-
     DIAG("Starting block, length %zu", nr_samples);
 
+    /* Decode anything the decode pool finished correcting since we were last here */
+    _pager_pocsag_batches_deliver(pocsag, false);
+
     while (nr_samples > next_sample) {
         switch (pocsag->cur_state) {
         case PAGER_POCSAG_STATE_SEARCH:
-            for (size_t i = 0; nr_samples > next_sample; i++) {
-                TSL_BUG_IF_FAILED(_pager_pocsag_baud_on_sample(pocsag, pocsag->baud_512,
-                            pcm_samples[next_sample]));
-                TSL_BUG_IF_FAILED(_pager_pocsag_baud_on_sample(pocsag, pocsag->baud_1200,
-                            pcm_samples[next_sample]));
-                TSL_BUG_IF_FAILED(_pager_pocsag_baud_on_sample(pocsag, pocsag->baud_2400,
-                            pcm_samples[next_sample]));
-
-                next_sample++;
-                if (pocsag->cur_state == PAGER_POCSAG_STATE_SYNCHRONIZED) {
-                    break;
-                }
+            while (nr_samples > next_sample && pocsag->cur_state == PAGER_POCSAG_STATE_SEARCH) {
+                next_sample += _pager_pocsag_sync_correlate(pocsag, &pcm_samples[next_sample],
+                        nr_samples - next_sample);
             }
             break;
         case PAGER_POCSAG_STATE_SYNCHRONIZED:
             pocsag->cur_state = PAGER_POCSAG_STATE_BATCH_RECEIVE;
             DIAG("SYNCHRONIZED -> BATCH_RECEIVE");
         case PAGER_POCSAG_STATE_BATCH_RECEIVE:
-            DIAG("BATCH_RECEIVE: starting with %zu samples", nr_samples - next_sample);
-            for (size_t i = 0; nr_samples > next_sample; i++) {
-                if (++batch->cur_sample_skip == pocsag->sample_skip) {
-                    int sample = pcm_samples[next_sample];
-                    uint32_t bit = sample < 0 ? 1 : 0;
-                    batch->current_batch[batch->current_batch_word] |= bit << batch->bit_count;
-                    batch->current_batch_word_bit++;
-                    batch->bit_count++;
-                    batch->cur_sample_skip = 0;
-
-                    if (batch->current_batch_word_bit == 32) {
-                        batch->current_batch_word_bit = 0;
-                        batch->current_batch_word++;
-                        if (batch->current_batch_word == PAGER_POCSAG_BATCH_BITS/32) {
-                            /* Process the batch */
-                            if (FAILED_UNLIKELY(_pager_pocsag_process_batch(pocsag, batch))) {
-                                DIAG("Failed to process batch -- likely a multi-bit error occurred.");
-                            }
-
-                            /* Switch to sync search state */
-                            DIAG("BATCH_RECEIVE -> SEARCH_SYNCWORD (bit count = %u)", (unsigned)batch->bit_count);
-                            pocsag->cur_state = PAGER_POCSAG_STATE_SEARCH_SYNCWORD;
-
-                            batch->current_batch_word_bit = 0;
-                            batch->current_batch_word = 0;
-
-                            _pager_pocsag_sync_search_reset(sync);
-                            next_sample++;
-                            break;
-                        }
-                    }
-                }
-
-                next_sample++;
-            }
-            break;
         case PAGER_POCSAG_STATE_SEARCH_SYNCWORD:
-            DIAG("SEARCH_SYNCWORD: Skipping at rate %u", (unsigned)pocsag->sample_skip);
-            for (size_t i = 0; nr_samples > next_sample; i++) {
-                if (++sync->cur_sample_skip == pocsag->sample_skip) {
-                    int sample = pcm_samples[next_sample];
-
-                    sync->cur_sample_skip = 0;
-                    sync->sync_word <<= 1;
-                    sync->sync_word |= (sample < 0 ? 1 : 0);
-                    sync->nr_sync_bits++;
-
-                    if (sync->nr_sync_bits == 32) {
-                        if (false == __pager_pocsag_check_sync_word(sync->sync_word)) {
-                            /* Search for the next sync word from scratch */
-                            DIAG("SEARCH_SYNCWORD -> SEARCH (got %08x)", sync->sync_word);
-                            pocsag->cur_state = PAGER_POCSAG_STATE_SEARCH;
-                            pocsag->sample_skip = 0;
-                            _pager_pocsag_baud_search_reset(pocsag);
-                            TSL_BUG_IF_FAILED(_pager_pocsag_message_decode_deliver(pocsag, &pocsag->decoder));
-                        } else {
-                            DIAG("SEARCH_SYNCWORD -> BATCH_RECEIVE");
-                            pocsag->cur_state = PAGER_POCSAG_STATE_BATCH_RECEIVE;
-                            _pager_pocsag_batch_reset(batch);
-                        }
-                        next_sample++;
-                        break;
-                    }
-                }
-                next_sample++;
-            }
+            next_sample += _pager_pocsag_receive(pocsag, &pcm_samples[next_sample],
+                    nr_samples - next_sample);
             break;
         }
     }
 
+    CYCLE_COUNT_STOP(CYCLE_COUNTER_POCSAG_ON_PCM, cycles);
+
     return ret;
 }
-
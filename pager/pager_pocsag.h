@@ -4,6 +4,16 @@
 #include <stdbool.h>
 
 struct pager_pocsag;
+struct pager_stats;
+struct pager_capcode_filter;
+struct pager_decode_pool;
+
+/**
+ * The sample rates a POCSAG decoder can run at: from 2 samples per bit at 2400 baud, to the
+ * default rate.
+ */
+#define PAGER_POCSAG_SAMPLE_RATE_MIN    4800
+#define PAGER_POCSAG_SAMPLE_RATE_MAX    38400
 
 typedef aresult_t (*pager_pocsag_on_numeric_msg_func_t)(
         struct pager_pocsag *pocsag,
@@ -22,7 +32,7 @@ typedef aresult_t (*pager_pocsag_on_alpha_msg_func_t)(
         uint8_t function);
 
 /**
- * Create a new POCSAG decoder.
+ * Create a new POCSAG decoder, for PCM samples at 38400 Hz.
  *
  * \param ppocsag The new POCSAG pager decoder, returned by reference.
  * \param freq_hz The center frequency of this channel
@@ -35,6 +45,24 @@ typedef aresult_t (*pager_pocsag_on_alpha_msg_func_t)(
 aresult_t pager_pocsag_new(struct pager_pocsag **ppocsag, uint32_t freq_hz, pager_pocsag_on_numeric_msg_func_t on_numeric,
         pager_pocsag_on_alpha_msg_func_t on_alpha, bool skip_bch_decode);
 
+/**
+ * Create a new POCSAG decoder for PCM samples at any rate from 4800 Hz (2 samples per bit at
+ * 2400 baud) to 38400 Hz. The bit clock is recovered from the signal, so the sample rate need not
+ * be a multiple of the baud rates.
+ *
+ * \param ppocsag The new POCSAG pager decoder, returned by reference.
+ * \param freq_hz The center frequency of this channel
+ * \param sample_rate The sample rate of the PCM samples, in Hz
+ * \param on_numeric Function called when a numeric page has been successfully decoded.
+ * \param on_alpha Function called when an alphanumeric page has been successfully decoded.
+ * \param skip_bch_decode Skip BCH checks (not recommended)
+ *
+ * \return A_OK on success, an error code otherwise.
+ */
+aresult_t pager_pocsag_new_rate(struct pager_pocsag **ppocsag, uint32_t freq_hz, uint32_t sample_rate,
+        pager_pocsag_on_numeric_msg_func_t on_numeric, pager_pocsag_on_alpha_msg_func_t on_alpha,
+        bool skip_bch_decode);
+
 /**
  * Destroy a POCSAG decoder.
  *
@@ -55,3 +83,39 @@ aresult_t pager_pocsag_delete(struct pager_pocsag **ppocsag);
  */
 aresult_t pager_pocsag_on_pcm(struct pager_pocsag *pocsag, const int16_t *pcm_samples, size_t nr_samples);
 
+/**
+ * Get a copy of the sync and BCH counters for a POCSAG decoder.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param stats The counters, returned by reference
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_pocsag_get_stats(struct pager_pocsag *pocsag, struct pager_stats *stats);
+
+/**
+ * Only decode messages for some capcodes. The message words for any other capcode are still
+ * BCH checked, since that's how the next address word is found, but are never decoded into
+ * characters or delivered.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param filter The capcodes to decode, NULL for all of them. Must outlive the decoder.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_pocsag_set_capcode_filter(struct pager_pocsag *pocsag, const struct pager_capcode_filter *filter);
+
+/**
+ * BCH correct received batches on a pool of worker threads, so the thread feeding the decoder
+ * samples carries on receiving bits while a batch is corrected. Messages are still assembled
+ * from the corrected codewords, and handed to the callbacks, on the thread calling
+ * pager_pocsag_on_pcm, in the order the batches were received, though possibly only on a later
+ * call. The BCH counters for a batch are updated once it has been decoded.
+ *
+ * \param pocsag The POCSAG decoder
+ * \param pool The decode pool, NULL to correct each batch as soon as it is received (the
+ *             default). Must outlive the decoder, or be detached first.
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t pager_pocsag_set_decode_pool(struct pager_pocsag *pocsag, struct pager_decode_pool *pool);
@@ -2,6 +2,9 @@
 
 #include <pager/pager_pocsag.h>
 #include <pager/bch_code.h>
+#include <pager/pager_stats.h>
+#include <pager/mueller_muller.h>
+#include <pager/pager_decode_pool.h>
 
 #define PAGER_POCSAG_BATCH_BITS         512
 #define PAGER_POCSAG_SYNC_BITS          32
@@ -45,11 +48,37 @@ enum pager_pocsag_state {
  */
 #define POCSAG_IDLE_CODEWORD            0x6983915eu
 
-#define POCSAG_PAGER_BASE_BAUD_RATE     38400
+/**
+ * The default sample rate, and the highest supported. The lowest rate at which every baud rate
+ * has a whole number of samples per bit.
+ */
+#define POCSAG_PAGER_BASE_BAUD_RATE     PAGER_POCSAG_SAMPLE_RATE_MAX
 #define POCSAG_PAGER_BAUD_512_SAMPLES   (POCSAG_PAGER_BASE_BAUD_RATE/512)
 #define POCSAG_PAGER_BAUD_1200_SAMPLES  (POCSAG_PAGER_BASE_BAUD_RATE/1200)
 #define POCSAG_PAGER_BAUD_2400_SAMPLES  (POCSAG_PAGER_BASE_BAUD_RATE/2400)
 
+/**
+ * Number of samples the sync correlator tests at once, one per bit of a word
+ */
+#define PAGER_POCSAG_CORR_LANES         64
+
+/**
+ * Number of past samples the sync correlator keeps. A sync word at 512 baud spans 31 bit times
+ * before its last bit; rounded up to a whole number of words.
+ */
+#define PAGER_POCSAG_CORR_HISTORY       ((((PAGER_POCSAG_SYNC_BITS - 1) * POCSAG_PAGER_BAUD_512_SAMPLES) + 63) & ~63)
+
+/**
+ * Number of words of sliced samples the sync correlator keeps: the history, then the samples
+ * being tested
+ */
+#define PAGER_POCSAG_CORR_WORDS         ((PAGER_POCSAG_CORR_HISTORY + PAGER_POCSAG_CORR_LANES) / 64)
+
+/**
+ * Number of samples smoothed at once for clock recovery
+ */
+#define PAGER_POCSAG_RX_SAMPLES         512
+
 #define POCSAG_PAGER_MAX_ALNUM_LEN      42
 #define POCSAG_PAGER_MAX_NUM_LEN        75
 
@@ -58,6 +87,11 @@ enum pager_pocsag_message_type {
     PAGER_POCSAG_MESSAGE_TYPE_UNKNOWN = 1,
     PAGER_POCSAG_MESSAGE_TYPE_ALPHA = 2,
     PAGER_POCSAG_MESSAGE_TYPE_NUMERIC = 3,
+
+    /**
+     * For a capcode the capcode filter doesn't want; the message words are skipped
+     */
+    PAGER_POCSAG_MESSAGE_TYPE_FILTERED = 4,
 };
 
 /**
@@ -140,40 +174,35 @@ struct pager_pocsag_message_decode {
  */
 struct pager_pocsag_baud_detect {
     /**
-     * The number of samples per bit, also the number of words in the 
+     * The number of samples per bit, rounded to the nearest sample
      */
     uint32_t samples_per_bit;
 
     /**
-     * The baud rate
+     * The exact number of samples per bit, at the decoder's sample rate
      */
-    uint16_t baud_rate;
+    float bit_samples;
 
     /**
-     * The current word being processed
+     * How many samples before the last bit of a word each bit is, rounded to the nearest sample
      */
-    uint32_t cur_word;
+    uint16_t tap_offsets[PAGER_POCSAG_SYNC_BITS];
 
     /**
-     * Number of samples in the eye that match
+     * The baud rate
      */
-    uint32_t nr_eye_matches;
+    uint16_t baud_rate;
 
     /**
-     * Sync word eye detection
+     * Number of samples in the eye that match
      */
-    uint32_t eye_detect[];
+    uint32_t nr_eye_matches;
 };
 
 /**
  * Batch word collection state
  */
 struct pager_pocsag_batch {
-    /**
-     * The slice bit count
-     */
-    uint16_t cur_sample_skip;
-
     /**
      * The current batch. Filled in by the baud block when it has
      * found a synchronization word.
@@ -197,14 +226,44 @@ struct pager_pocsag_batch {
 };
 
 /**
- * Sync search state, for after receiving a batch
+ * The number of received batches that can be waiting to be corrected, or to be decoded
  */
-struct pager_pocsag_sync_search {
+#define PAGER_POCSAG_NR_BATCHES         8
+
+/**
+ * A received batch, whose codewords are BCH corrected as a job on a decode pool. The corrected
+ * codewords are decoded into messages on the thread feeding the decoder samples, in the order
+ * the batches were received, since a message can span any number of batches.
+ */
+struct pager_pocsag_batch_job {
+    /**
+     * The correction job. Everything below is owned by the job while it is not done.
+     */
+    struct pager_decode_job job;
+
+    const struct bch_code *bch;
+
     /**
-     * The current skipped sample ID
+     * The codewords, as received, then corrected in place
      */
-    uint16_t cur_sample_skip;
+    uint32_t words[PAGER_POCSAG_BATCH_BITS/32];
 
+    /**
+     * The number of codewords corrected. Correction stops at the first codeword that can't be
+     * corrected, since the rest of the batch can't be trusted.
+     */
+    size_t nr_good;
+
+    /**
+     * BCH counters from correction, added to the decoder's own when the batch is decoded
+     */
+    struct pager_stats stats;
+};
+
+/**
+ * Sync search state, for after receiving a batch
+ */
+struct pager_pocsag_sync_search {
     /**
      * Number of sync bits captured
      */
@@ -221,9 +280,9 @@ struct pager_pocsag_sync_search {
  */
 struct pager_pocsag {
     /**
-     * The rate to skip samples at
+     * The sample rate of the PCM samples
      */
-    uint16_t sample_skip;
+    uint32_t sample_rate;
 
     /**
      * The current baud rate, if any
@@ -270,6 +329,28 @@ struct pager_pocsag {
      */
     struct pager_pocsag_baud_detect *baud_2400;
 
+    /**
+     * Sliced samples for the sync correlator, a bit per sample, oldest first. The samples being
+     * tested start at bit PAGER_POCSAG_CORR_HISTORY.
+     */
+    uint64_t corr_bits[PAGER_POCSAG_CORR_WORDS];
+
+    /**
+     * Clock recovery for receiving batches, and the sync words between them, once synchronized
+     */
+    struct mueller_muller mm;
+
+    /**
+     * Smoothing ahead of clock recovery: the gain and the filter state
+     */
+    float rx_smooth_gain;
+    float rx_smooth;
+
+    /**
+     * Smoothed samples for clock recovery
+     */
+    int16_t rx_samples[PAGER_POCSAG_RX_SAMPLES];
+
     /**
      * Message decoder state
      */
@@ -278,7 +359,30 @@ struct pager_pocsag {
     /**
      * State for BCH(31, 21) code
      */
-    struct bch_code *bch;
+    const struct bch_code *bch;
+
+    /**
+     * The capcodes to decode messages for, NULL for all of them
+     */
+    const struct pager_capcode_filter *capcode_filter;
+
+    /**
+     * Sync and BCH counters
+     */
+    struct pager_stats stats;
+
+    /**
+     * The pool correcting received batches, NULL to correct them on the thread receiving samples
+     */
+    struct pager_decode_pool *pool;
+
+    /**
+     * Received batches, oldest first. Batches from batch_head up to batch_tail are either being
+     * corrected, or waiting to be decoded.
+     */
+    struct pager_pocsag_batch_job batches[PAGER_POCSAG_NR_BATCHES];
+    size_t batch_head;
+    size_t batch_tail;
 
     /**
      * Current state of the wire protocol handling
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <pager/bch_code.h>
+
+#include <stdint.h>
+
+/**
+ * Counters kept by a pager protocol decoder, to tell a weak or noisy signal apart from a decoder
+ * that isn't keeping up. Only updated by the thread feeding the decoder samples; read them with
+ * pager_flex_get_stats or pager_pocsag_get_stats from that same thread.
+ */
+struct pager_stats {
+    /**
+     * Number of times sync was acquired
+     */
+    uint64_t nr_syncs;
+
+    /**
+     * Number of frames (FLEX) or batches (POCSAG) abandoned, after sync was acquired, because a
+     * codeword we couldn't do without couldn't be corrected
+     */
+    uint64_t nr_frame_rejects;
+
+    /**
+     * Number of codewords that passed the BCH check as received
+     */
+    uint64_t nr_bch_clean;
+
+    /**
+     * Number of codewords with bit errors the BCH code corrected
+     */
+    uint64_t nr_bch_corrected;
+
+    /**
+     * Number of codewords with more bit errors than the BCH code can correct
+     */
+    uint64_t nr_bch_failed;
+
+    /**
+     * Number of messages skipped because the capcode filter didn't want them
+     */
+    uint64_t nr_filtered;
+};
+
+/**
+ * Check, and correct if needed, a BCH(31, 21) codeword, counting the outcome.
+ *
+ * \param stats The counters to update
+ * \param bch The BCH code
+ * \param pword The codeword, corrected in place
+ *
+ * \return 0 if the codeword is good (after correction), non-zero otherwise, as bch_code_decode
+ */
+static inline
+int pager_stats_bch_decode(struct pager_stats *stats, const struct bch_code *bch, uint32_t *pword)
+{
+    uint32_t received = *pword;
+    int ret = bch_code_decode(bch, pword);
+
+    if (0 != ret) {
+        stats->nr_bch_failed++;
+    } else if (received != *pword) {
+        stats->nr_bch_corrected++;
+    } else {
+        stats->nr_bch_clean++;
+    }
+
+    return ret;
+}
+
+/**
+ * Add one set of counters to another.
+ *
+ * \param stats The counters to add to
+ * \param from The counters to add
+ */
+static inline
+void pager_stats_add(struct pager_stats *stats, const struct pager_stats *from)
+{
+    stats->nr_syncs += from->nr_syncs;
+    stats->nr_frame_rejects += from->nr_frame_rejects;
+    stats->nr_bch_clean += from->nr_bch_clean;
+    stats->nr_bch_corrected += from->nr_bch_corrected;
+    stats->nr_bch_failed += from->nr_bch_failed;
+    stats->nr_filtered += from->nr_filtered;
+}
@@ -0,0 +1,170 @@
+#include <pager/bch_code.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The POCSAG idle and sync codewords, as the POCSAG decoder hands them over: in the order they
+ * were received from bit 0 up, with the parity bit (bit 31) masked off
+ */
+#define TEST_BCH_CODE_IDLE              0x6983915eul
+#define TEST_BCH_CODE_SYNC              0x1ba84b3eul
+
+#define TEST_BCH_CODE_NR_RANDOM         262144
+
+static
+const int test_bch_code_poly[6] = { 1, 0, 1, 0, 0, 1 };
+
+static
+aresult_t test_bch_code_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_bch_code_cleanup(void)
+{
+    return A_OK;
+}
+
+/**
+ * A small xorshift, so the words tested are the same every run
+ */
+static
+uint32_t _test_bch_code_rand(uint32_t *pstate)
+{
+    uint32_t x = *pstate;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    *pstate = x;
+
+    return x;
+}
+
+/**
+ * Flip every 1- and 2-bit combination in a codeword, and check both decoders restore it
+ */
+static
+aresult_t _test_bch_code_correct_all(struct bch_code *bch, uint32_t codeword)
+{
+    for (int i = 0; i < 31; i++) {
+        for (int j = i; j < 31; j++) {
+            uint32_t err = (1ul << i) | (1ul << j),
+                     fast = codeword ^ err,
+                     ref = codeword ^ err;
+
+            TEST_ASSERT_EQUALS(bch_code_decode(bch, &fast), 0);
+            TEST_ASSERT_EQUALS(fast, codeword);
+            TEST_ASSERT_EQUALS(bch_code_decode_reference(bch, &ref), 0);
+            TEST_ASSERT_EQUALS(ref, codeword);
+        }
+    }
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_codewords, bch_code)
+{
+    struct bch_code *bch = NULL;
+    uint32_t word = 0;
+
+    TEST_ASSERT_OK(bch_code_new(&bch, test_bch_code_poly, 5, 31, 21, 2));
+    TEST_ASSERT_NOT_NULL(bch);
+
+    /* Codewords pass through untouched */
+    word = TEST_BCH_CODE_IDLE;
+    TEST_ASSERT_EQUALS(bch_code_decode(bch, &word), 0);
+    TEST_ASSERT_EQUALS(word, TEST_BCH_CODE_IDLE);
+
+    word = TEST_BCH_CODE_SYNC;
+    TEST_ASSERT_EQUALS(bch_code_decode(bch, &word), 0);
+    TEST_ASSERT_EQUALS(word, TEST_BCH_CODE_SYNC);
+
+    /* The code is linear, so the sum of two codewords is one too */
+    word = 0;
+    TEST_ASSERT_EQUALS(bch_code_decode(bch, &word), 0);
+    TEST_ASSERT_EQUALS(word, 0);
+
+    TEST_ASSERT_OK(_test_bch_code_correct_all(bch, TEST_BCH_CODE_IDLE));
+    TEST_ASSERT_OK(_test_bch_code_correct_all(bch, TEST_BCH_CODE_SYNC));
+    TEST_ASSERT_OK(_test_bch_code_correct_all(bch, TEST_BCH_CODE_IDLE ^ TEST_BCH_CODE_SYNC));
+
+    /* The parity bit above the codeword is left alone */
+    word = (1ul << 31) | TEST_BCH_CODE_IDLE | (1ul << 7);
+    TEST_ASSERT_EQUALS(bch_code_decode(bch, &word), 0);
+    TEST_ASSERT_EQUALS(word, (1ul << 31) | TEST_BCH_CODE_IDLE);
+
+    bch_code_delete(&bch);
+    TEST_ASSERT_EQUALS(bch, NULL);
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_against_reference, bch_code)
+{
+    struct bch_code *bch = NULL;
+    uint32_t state = 0x1badcafeul;
+    size_t nr_corrected = 0,
+           nr_rejected = 0;
+
+    TEST_ASSERT_OK(bch_code_new(&bch, test_bch_code_poly, 5, 31, 21, 2));
+
+    for (size_t i = 0; i < TEST_BCH_CODE_NR_RANDOM; i++) {
+        uint32_t word = _test_bch_code_rand(&state) & 0x7ffffffful,
+                 fast = word,
+                 ref = word;
+        int fast_ret = bch_code_decode(bch, &fast),
+            ref_ret = bch_code_decode_reference(bch, &ref);
+
+        if (0 == fast_ret) {
+            /* Anything the fast decoder corrects, the reference corrects the same way */
+            TEST_ASSERT_EQUALS(ref_ret, 0);
+            TEST_ASSERT_EQUALS(fast, ref);
+            nr_corrected++;
+        } else {
+            /* Rejected words are left as they were... */
+            TEST_ASSERT_EQUALS(fast, word);
+
+            /* ...and the reference either rejects them too, or lets them through untouched */
+            TEST_ASSERT_EQUALS(ref, word);
+            nr_rejected++;
+        }
+    }
+
+    TEST_INF("Random words: %zu corrected, %zu rejected", nr_corrected, nr_rejected);
+
+    /* About half of all words are within 2 bits of a codeword: 2^21 * 497 of 2^31 */
+    TEST_ASSERT_EQUALS(nr_corrected > TEST_BCH_CODE_NR_RANDOM / 4, true);
+    TEST_ASSERT_EQUALS(nr_rejected > TEST_BCH_CODE_NR_RANDOM / 4, true);
+
+    bch_code_delete(&bch);
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_shared, bch_code)
+{
+    const struct bch_code *shared = NULL,
+                          *again = NULL;
+    uint32_t word = TEST_BCH_CODE_SYNC ^ (1ul << 3) ^ (1ul << 29);
+
+    TEST_ASSERT_OK(bch_code_get_pager(&shared));
+    TEST_ASSERT_NOT_NULL(shared);
+
+    /* Every caller gets the same copy */
+    TEST_ASSERT_OK(bch_code_get_pager(&again));
+    TEST_ASSERT_EQUALS(shared, again);
+
+    TEST_ASSERT_EQUALS(bch_code_decode(shared, &word), 0);
+    TEST_ASSERT_EQUALS(word, TEST_BCH_CODE_SYNC);
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(bch_code, test_bch_code_cleanup, test_bch_code_setup, NULL, NULL);
@@ -0,0 +1,108 @@
+#include <pager/pager_capcode_filter.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static
+aresult_t test_capcode_filter_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_capcode_filter_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_allow, capcode_filter)
+{
+    struct pager_capcode_filter *filter = NULL;
+    const uint64_t capcodes[] = { 1234567, 42, 2000000000ull, 42, 7 };
+
+    TEST_ASSERT_OK(pager_capcode_filter_new(&filter, capcodes, sizeof(capcodes)/sizeof(capcodes[0]), false));
+    TEST_ASSERT_NOT_NULL(filter);
+
+    /* Sorted, without the duplicate */
+    TEST_ASSERT_EQUALS(filter->nr_capcodes, 4);
+
+    for (size_t i = 0; i < sizeof(capcodes)/sizeof(capcodes[0]); i++) {
+        TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, capcodes[i]), true);
+    }
+
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 0), false);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 8), false);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 1234568), false);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 3000000000ull), false);
+
+    /* No filter wants everything */
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(NULL, 8), true);
+
+    TEST_ASSERT_OK(pager_capcode_filter_delete(&filter));
+    TEST_ASSERT_EQUALS(filter, NULL);
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_deny, capcode_filter)
+{
+    struct pager_capcode_filter *filter = NULL;
+    const uint64_t capcodes[] = { 100, 200 };
+
+    TEST_ASSERT_OK(pager_capcode_filter_new(&filter, capcodes, 2, true));
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 100), false);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 200), false);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 150), true);
+    TEST_ASSERT_OK(pager_capcode_filter_delete(&filter));
+
+    /* An empty deny list drops nothing, an empty allow list keeps nothing */
+    TEST_ASSERT_OK(pager_capcode_filter_new(&filter, NULL, 0, true));
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 150), true);
+    TEST_ASSERT_OK(pager_capcode_filter_delete(&filter));
+
+    TEST_ASSERT_OK(pager_capcode_filter_new(&filter, NULL, 0, false));
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 150), false);
+    TEST_ASSERT_OK(pager_capcode_filter_delete(&filter));
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_load, capcode_filter)
+{
+    struct pager_capcode_filter *filter = NULL;
+    char file_name[] = "/tmp/test_capcode_filter_XXXXXX";
+    int fd = -1;
+    FILE *fp = NULL;
+
+    TEST_ASSERT_EQUALS(0 <= (fd = mkstemp(file_name)), true);
+    TEST_ASSERT_NOT_NULL(fp = fdopen(fd, "w"));
+    fprintf(fp, "# Hospital paging\n1234567\n\n  42   # the front desk\n");
+    fclose(fp);
+
+    TEST_ASSERT_OK(pager_capcode_filter_load(&filter, file_name, false));
+    TEST_ASSERT_EQUALS(filter->nr_capcodes, 2);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 42), true);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 1234567), true);
+    TEST_ASSERT_EQUALS(pager_capcode_filter_wanted(filter, 43), false);
+    TEST_ASSERT_OK(pager_capcode_filter_delete(&filter));
+
+    /* Anything that isn't a capcode is refused */
+    TEST_ASSERT_NOT_NULL(fp = fopen(file_name, "w"));
+    fprintf(fp, "42\nfront desk\n");
+    fclose(fp);
+
+    TEST_ASSERT_EQUALS(pager_capcode_filter_load(&filter, file_name, false), A_E_INVAL);
+    TEST_ASSERT_EQUALS(filter, NULL);
+
+    unlink(file_name);
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(capcode_filter, test_capcode_filter_cleanup, test_capcode_filter_setup, NULL, NULL);
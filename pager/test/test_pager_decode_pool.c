@@ -0,0 +1,113 @@
+#include <pager/pager_decode_pool.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define TEST_DECODE_POOL_JOBS       64
+
+struct test_decode_job {
+    struct pager_decode_job job;
+    uint32_t in;
+    uint32_t out;
+};
+
+/**
+ * Something that takes long enough for the workers to fall behind
+ */
+static
+uint32_t _test_decode_pool_scramble(uint32_t x)
+{
+    for (size_t i = 0; i < 4096; i++) {
+        x = x * 1103515245ul + 12345ul;
+    }
+
+    return x;
+}
+
+static
+void _test_decode_pool_work(struct pager_decode_job *job)
+{
+    struct test_decode_job *tj = BL_CONTAINER_OF(job, struct test_decode_job, job);
+
+    tj->out = _test_decode_pool_scramble(tj->in);
+}
+
+static
+struct test_decode_job jobs[TEST_DECODE_POOL_JOBS];
+
+static
+aresult_t _test_decode_pool_run(struct pager_decode_pool *pool, size_t nr_rounds)
+{
+    for (size_t round = 0; round < nr_rounds; round++) {
+        for (size_t i = 0; i < TEST_DECODE_POOL_JOBS; i++) {
+            jobs[i].job.work = _test_decode_pool_work;
+            jobs[i].in = round * TEST_DECODE_POOL_JOBS + i;
+            jobs[i].out = 0;
+            pager_decode_pool_run(pool, &jobs[i].job);
+        }
+
+        /* Wait in the order the jobs were handed over, as the decoders do */
+        for (size_t i = 0; i < TEST_DECODE_POOL_JOBS; i++) {
+            pager_decode_pool_wait(pool, &jobs[i].job);
+            TEST_ASSERT_EQUALS(pager_decode_job_done(&jobs[i].job), true);
+            TEST_ASSERT_EQUALS(jobs[i].out, _test_decode_pool_scramble(jobs[i].in));
+        }
+    }
+
+    return A_OK;
+}
+
+static
+aresult_t test_decode_pool_setup(void)
+{
+    return A_OK;
+}
+
+static
+aresult_t test_decode_pool_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_inline, decode_pool)
+{
+    /* Without a pool, each job is done before pager_decode_pool_run returns */
+    jobs[0].job.work = _test_decode_pool_work;
+    jobs[0].in = 42;
+    pager_decode_pool_run(NULL, &jobs[0].job);
+    TEST_ASSERT_EQUALS(pager_decode_job_done(&jobs[0].job), true);
+    TEST_ASSERT_EQUALS(jobs[0].out, _test_decode_pool_scramble(42));
+
+    return _test_decode_pool_run(NULL, 2);
+}
+
+TEST_DECLARE_UNIT(test_workers, decode_pool)
+{
+    struct pager_decode_pool *pool = NULL;
+
+    TEST_ASSERT_OK(pager_decode_pool_new(&pool, 3, 32));
+    TEST_ASSERT_NOT_NULL(pool);
+
+    TEST_ASSERT_OK(_test_decode_pool_run(pool, 64));
+
+    /* The workers have gone to sleep by now, and have to be woken for more work */
+    usleep(200 * 1000);
+    TEST_ASSERT_OK(_test_decode_pool_run(pool, 4));
+
+    TEST_ASSERT_OK(pager_decode_pool_delete(&pool));
+    TEST_ASSERT_EQUALS(pool, NULL);
+
+    /* Full queue: the jobs that don't fit are done on the submitting thread */
+    TEST_ASSERT_OK(pager_decode_pool_new(&pool, 1, 2));
+    TEST_ASSERT_OK(_test_decode_pool_run(pool, 4));
+    TEST_ASSERT_OK(pager_decode_pool_delete(&pool));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(decode_pool, test_decode_pool_cleanup, test_decode_pool_setup, NULL, NULL);
@@ -1,11 +1,92 @@
 #include <pager/pager.h>
+#include <pager/pager_stats.h>
+#include <pager/pager_decode_pool.h>
+#include <pager/bench/pager_synth.h>
+#include <pager/test/test_pool_hold.h>
 
 #include <test/assert.h>
 #include <test/framework.h>
 
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * The sample rate the synthesized signals are decoded at
+ */
+#define TEST_FLEX_SAMPLE_RATE       16000
+
+/**
+ * The messages sent for each coding: around 14 fit in a 6400 baud frame, so even at that rate
+ * there are more frames back to back than the decoder keeps in flight (PAGER_FLEX_NR_FRAMES)
+ */
+#define TEST_FLEX_NR_MSGS           96
+
+/**
+ * The longest chunk of samples handed to the decoder at once
+ */
+#define TEST_FLEX_MAX_CHUNK         4096
+
+/**
+ * A message as it came out of the decoder
+ */
+struct test_flex_msg {
+    uint64_t cap_code;
+    uint8_t phase;
+    uint8_t frame_no;
+    char text[PAGER_SYNTH_MAX_MSG_LEN + 1];
+};
+
+/**
+ * The messages decoded, in the order they were delivered
+ */
+struct test_flex_log {
+    struct test_flex_msg msgs[TEST_FLEX_NR_MSGS];
+    size_t nr_msgs;
+
+    /**
+     * Messages that didn't fit in msgs, or were delivered through the numeric callback
+     */
+    size_t nr_unexpected;
+};
+
+/**
+ * The decoder's callbacks carry no private state, so the log is shared with them
+ */
+static
+struct test_flex_log test_flex_log;
+
+/**
+ * What came out of the decoder with no pool, to compare the pool's output with
+ */
+static
+struct test_flex_log test_flex_log_inline;
+
+static
+char test_flex_texts[TEST_FLEX_NR_MSGS][PAGER_SYNTH_MAX_MSG_LEN + 1];
+
+static
+struct pager_synth_msg test_flex_msgs[TEST_FLEX_NR_MSGS];
+
 static
 aresult_t test_pager_flex_setup(void)
 {
+    /* Different lengths and capcodes, with every printable character turning up somewhere, so a
+     * bit landing in the wrong place in the deinterleaver can't go unnoticed
+     */
+    for (size_t i = 0; i < TEST_FLEX_NR_MSGS; i++) {
+        int len = snprintf(test_flex_texts[i], sizeof(test_flex_texts[i]), "%zu: ", i);
+
+        for (size_t c = 0; c < 20 + (i * 13) % 40; c++) {
+            test_flex_texts[i][len++] = ' ' + (char)((i * 31 + c * 7) % 95);
+        }
+
+        test_flex_texts[i][len] = '\0';
+
+        test_flex_msgs[i].capcode = 1 + (uint32_t)((i * 96661ul) % 1933312ul);
+        test_flex_msgs[i].numeric = false;
+        test_flex_msgs[i].text = test_flex_texts[i];
+    }
+
     return A_OK;
 }
 
@@ -56,5 +137,283 @@ TEST_DECLARE_UNIT(test_smoke, flex)
     return A_OK;
 }
 
+static
+aresult_t _test_flex_log_on_alnum(struct pager_flex *flex, uint16_t baud, uint8_t phase, uint8_t cycle_no,
+        uint8_t frame_no, uint64_t cap_code, bool fragmented, bool maildrop, uint8_t seq_num,
+        const char *message_bytes, size_t message_len)
+{
+    struct test_flex_log *log = &test_flex_log;
+    struct test_flex_msg *msg = NULL;
+
+    if (log->nr_msgs == TEST_FLEX_NR_MSGS || message_len > PAGER_SYNTH_MAX_MSG_LEN) {
+        log->nr_unexpected++;
+        return A_OK;
+    }
+
+    /* The last word of the message is padded out with ETX */
+    while (0 != message_len && ('\x03' == message_bytes[message_len - 1] ||
+                '\0' == message_bytes[message_len - 1]))
+    {
+        message_len--;
+    }
+
+    msg = &log->msgs[log->nr_msgs++];
+
+    msg->cap_code = cap_code;
+    msg->phase = phase;
+    msg->frame_no = frame_no;
+    memcpy(msg->text, message_bytes, message_len);
+    msg->text[message_len] = '\0';
+
+    return A_OK;
+}
+
+static
+aresult_t _test_flex_log_on_num(struct pager_flex *flex, uint16_t baud, uint8_t phase, uint8_t cycle_no,
+        uint8_t frame_no, uint64_t cap_code, const char *message_bytes, size_t message_len)
+{
+    test_flex_log.nr_unexpected++;
+    return A_OK;
+}
+
+/**
+ * Render the test messages at the given coding: a quarter second of noise, as many frames back
+ * to back as it takes to send them all, then another quarter second of noise.
+ */
+static
+aresult_t _test_flex_render(struct pager_synth **psynth, unsigned baud, unsigned fsk_levels, size_t *pnr_frames)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_synth *synth = NULL;
+    size_t nr_sent = 0,
+           nr_frames = 0;
+
+    /* At worst, a 1.875 second frame for each message */
+    if (FAILED(ret = pager_synth_new(&synth, TEST_FLEX_SAMPLE_RATE,
+                    (TEST_FLEX_NR_MSGS + 1) * (TEST_FLEX_SAMPLE_RATE * 15 / 8) + TEST_FLEX_SAMPLE_RATE,
+                    0.0, 0.0, 0xf1e7)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = pager_synth_gap(synth, TEST_FLEX_SAMPLE_RATE / 4))) {
+        goto done;
+    }
+
+    while (nr_sent < TEST_FLEX_NR_MSGS) {
+        size_t nr_frame = 0;
+
+        if (FAILED(ret = pager_synth_flex_frame(synth, baud, fsk_levels, 0, (uint8_t)(nr_frames + 17),
+                        &test_flex_msgs[nr_sent], TEST_FLEX_NR_MSGS - nr_sent, &nr_frame)))
+        {
+            goto done;
+        }
+
+        if (0 == nr_frame) {
+            ret = A_E_INVAL;
+            goto done;
+        }
+
+        nr_sent += nr_frame;
+        nr_frames++;
+    }
+
+    if (FAILED(ret = pager_synth_gap(synth, TEST_FLEX_SAMPLE_RATE / 4))) {
+        goto done;
+    }
+
+    *psynth = synth;
+    *pnr_frames = nr_frames;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != synth) {
+            pager_synth_delete(&synth);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Decode a synthesized signal, handing it to the decoder in chunks of random size so blocks and
+ * sync words end up split across calls at every offset. Frames are decoded on the pool, if one
+ * is given.
+ */
+static
+aresult_t _test_flex_decode(const struct pager_synth *synth, struct pager_decode_pool *pool, uint32_t seed,
+        struct pager_stats *stats)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_flex *flex = NULL;
+    uint32_t lcg = seed;
+    size_t offset = 0;
+
+    memset(&test_flex_log, 0, sizeof(test_flex_log));
+
+    TSL_BUG_IF_FAILED(pager_flex_new(&flex, 929612500ul, _test_flex_log_on_alnum, _test_flex_log_on_num, NULL));
+    TSL_BUG_IF_FAILED(pager_flex_set_decode_pool(flex, pool));
+
+    while (offset < synth->nr_samples) {
+        size_t nr_samples = 0;
+
+        lcg = lcg * 1664525ul + 1013904223ul;
+        nr_samples = BL_MIN2(1 + (lcg >> 8) % TEST_FLEX_MAX_CHUNK, synth->nr_samples - offset);
+
+        if (FAILED(ret = pager_flex_on_pcm(flex, &synth->pcm[offset], nr_samples))) {
+            goto done;
+        }
+
+        offset += nr_samples;
+    }
+
+    /* Finish the frames still on the pool, so their counts are in the stats */
+    TSL_BUG_IF_FAILED(pager_flex_set_decode_pool(flex, NULL));
+    TSL_BUG_IF_FAILED(pager_flex_get_stats(flex, stats));
+
+done:
+    TSL_BUG_IF_FAILED(pager_flex_delete(&flex));
+    return ret;
+}
+
+/**
+ * Check every message came out, in the order it was sent, with the text intact, and that every
+ * phase of the coding carried some of them
+ */
+static
+aresult_t _test_flex_check_log(unsigned baud, unsigned fsk_levels, size_t nr_frames)
+{
+    const struct test_flex_log *log = &test_flex_log;
+    /* 3200 baud carries phases A and C, 6400 baud all four */
+    unsigned phases = 1600 == baud ? 0x1 : 3200 == baud ? 0x5 : 0xf,
+             phases_seen = 0;
+
+    if (0 != log->nr_unexpected || TEST_FLEX_NR_MSGS != log->nr_msgs) {
+        TEST_ERR("%u baud %uFSK: %zu messages decoded of %d, %zu unexpected", baud, fsk_levels,
+                log->nr_msgs, TEST_FLEX_NR_MSGS, log->nr_unexpected);
+        return A_E_INVAL;
+    }
+
+    for (size_t i = 0; i < TEST_FLEX_NR_MSGS; i++) {
+        const struct test_flex_msg *msg = &log->msgs[i];
+
+        if (msg->cap_code != test_flex_msgs[i].capcode || 0 != strcmp(msg->text, test_flex_msgs[i].text)) {
+            TEST_ERR("%u baud %uFSK, message %zu: got %llu '%s', expected %u '%s'", baud, fsk_levels, i,
+                    (unsigned long long)msg->cap_code, msg->text, test_flex_msgs[i].capcode,
+                    test_flex_msgs[i].text);
+            return A_E_INVAL;
+        }
+
+        if (msg->frame_no < 17 || msg->frame_no >= 17 + nr_frames || msg->phase > 3) {
+            TEST_ERR("%u baud %uFSK, message %zu: unexpected frame %u phase %u", baud, fsk_levels, i,
+                    msg->frame_no, msg->phase);
+            return A_E_INVAL;
+        }
+
+        phases_seen |= 1u << msg->phase;
+    }
+
+    if (phases != phases_seen) {
+        TEST_ERR("%u baud %uFSK: messages only came out of phases %x", baud, fsk_levels, phases_seen);
+        return A_E_INVAL;
+    }
+
+    return A_OK;
+}
+
+/**
+ * Decode several frames back to back at each coding, from a clean synthesized signal. This runs
+ * the whole receive path: sync, the symbol slicer, the block deinterleaver for every phase, BCH
+ * and the message decode.
+ */
+TEST_DECLARE_UNIT(test_synth_frames, flex)
+{
+    static const unsigned codings[][2] = {
+        { 1600, 2 },
+        { 3200, 2 },
+        { 3200, 4 },
+        { 6400, 4 },
+    };
+
+    for (size_t i = 0; i < BL_ARRAY_ENTRIES(codings); i++) {
+        struct pager_synth *synth = NULL;
+        struct pager_stats stats;
+        size_t nr_frames = 0;
+
+        TEST_ASSERT_OK(_test_flex_render(&synth, codings[i][0], codings[i][1], &nr_frames));
+        TEST_ASSERT_EQUALS(nr_frames >= 2, true);
+
+        TEST_ASSERT_OK(_test_flex_decode(synth, NULL, 0x1234 + i, &stats));
+        TEST_ASSERT_OK(_test_flex_check_log(codings[i][0], codings[i][1], nr_frames));
+
+        /* The signal is clean, so a single bit the BCH code had to put right is a deinterleaver bug */
+        TEST_ASSERT_EQUALS(stats.nr_syncs, nr_frames);
+        TEST_ASSERT_EQUALS(stats.nr_frame_rejects, 0);
+        TEST_ASSERT_EQUALS(stats.nr_bch_corrected, 0);
+        TEST_ASSERT_EQUALS(stats.nr_bch_failed, 0);
+
+        pager_synth_delete(&synth);
+    }
+
+    return A_OK;
+}
+
+/**
+ * Decoding frames on a pool has to give exactly what decoding them inline does: the same
+ * messages, delivered in the same order, and the same counts. The burst is longer than the ring
+ * of frames in flight, so with the workers held up the ring fills, and the decoder has to finish
+ * the oldest frame itself to make room.
+ */
+TEST_DECLARE_UNIT(test_synth_frames_pool, flex)
+{
+    static const unsigned codings[][2] = {
+        { 1600, 2 },
+        { 3200, 2 },
+        { 3200, 4 },
+        { 6400, 4 },
+    };
+
+    aresult_t ret = A_OK;
+
+    struct pager_decode_pool *pool = NULL;
+
+    TEST_ASSERT_OK(pager_decode_pool_new(&pool, 3, 32));
+
+    for (size_t i = 0; i < BL_ARRAY_ENTRIES(codings); i++) {
+        struct pager_synth *synth = NULL;
+        struct pager_stats stats_inline,
+                           stats_pool;
+        size_t nr_frames = 0;
+
+        TEST_ASSERT_OK(_test_flex_render(&synth, codings[i][0], codings[i][1], &nr_frames));
+        TEST_ASSERT_EQUALS(nr_frames > 4, true);
+
+        TEST_ASSERT_OK(_test_flex_decode(synth, NULL, 0x5678 + i, &stats_inline));
+        TEST_ASSERT_OK(_test_flex_check_log(codings[i][0], codings[i][1], nr_frames));
+        test_flex_log_inline = test_flex_log;
+
+        /* Different chunks, too: where the signal is split mustn't matter either */
+        TEST_ASSERT_OK(_test_flex_decode(synth, pool, 0x9abc + i, &stats_pool));
+        TEST_ASSERT_EQUALS(memcmp(&test_flex_log, &test_flex_log_inline, sizeof(test_flex_log)), 0);
+        TEST_ASSERT_EQUALS(memcmp(&stats_pool, &stats_inline, sizeof(stats_pool)), 0);
+
+        /* Let the workers go before checking, or a failure leaves the pool stuck */
+        TEST_ASSERT_OK(test_pool_hold(pool, 3));
+        ret = _test_flex_decode(synth, pool, 0xdef0 + i, &stats_pool);
+        test_pool_release(pool);
+        TEST_ASSERT_OK(ret);
+        TEST_ASSERT_EQUALS(memcmp(&test_flex_log, &test_flex_log_inline, sizeof(test_flex_log)), 0);
+        TEST_ASSERT_EQUALS(memcmp(&stats_pool, &stats_inline, sizeof(stats_pool)), 0);
+
+        pager_synth_delete(&synth);
+    }
+
+    TEST_ASSERT_OK(pager_decode_pool_delete(&pool));
+
+    return A_OK;
+}
+
 TEST_DECLARE_SUITE(flex, test_pager_flex_cleanup, test_pager_flex_setup, NULL, NULL);
 
@@ -0,0 +1,137 @@
+#include <pager/pager_flex_reasm.h>
+
+#include <test/assert.h>
+#include <test/framework.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The last message handed over, and how many there have been
+ */
+static
+struct {
+    uint64_t capcode;
+    bool complete;
+    uint8_t seq_num;
+    char msg[PAGER_FLEX_REASM_MAX_LEN + 1];
+    size_t len;
+    unsigned nr_msgs;
+} _test_reasm_last;
+
+static
+aresult_t _test_reasm_on_msg(void *priv, uint64_t capcode, uint8_t phase, bool complete, bool maildrop,
+        uint8_t seq_num, const char *message, size_t message_len)
+{
+    _test_reasm_last.capcode = capcode;
+    _test_reasm_last.complete = complete;
+    _test_reasm_last.seq_num = seq_num;
+    memcpy(_test_reasm_last.msg, message, message_len);
+    _test_reasm_last.msg[message_len] = '\0';
+    _test_reasm_last.len = message_len;
+    _test_reasm_last.nr_msgs++;
+
+    return A_OK;
+}
+
+static
+aresult_t test_flex_reasm_setup(void)
+{
+    memset(&_test_reasm_last, 0, sizeof(_test_reasm_last));
+    return A_OK;
+}
+
+static
+aresult_t test_flex_reasm_cleanup(void)
+{
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_in_order, flex_reasm)
+{
+    struct pager_flex_reasm *reasm = NULL;
+
+    TEST_ASSERT_OK(pager_flex_reasm_new(&reasm, 4, 4, _test_reasm_on_msg, NULL));
+
+    /* A message that isn't fragmented goes straight through */
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 0, 100, 0, false, false, 3, "HELLO", 5));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, 1);
+    TEST_ASSERT_EQUALS(_test_reasm_last.complete, true);
+
+    /* Fragments interleaved across two capcodes, over several frames */
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 1, 200, 0, true, false, 3, "ONE ", 4));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 1, 300, 1, true, false, 3, "ABC", 3));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 3, 200, 0, true, false, 0, "TWO ", 4));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 5, 200, 0, true, false, 1, "THREE ", 6));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 5, 300, 1, false, false, 0, "DEF", 3));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, 2);
+    TEST_ASSERT_EQUALS(_test_reasm_last.capcode, 300);
+    TEST_ASSERT_EQUALS(_test_reasm_last.complete, true);
+    TEST_ASSERT_EQUALS(0 == strcmp(_test_reasm_last.msg, "ABCDEF"), true);
+
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 6, 200, 0, true, false, 2, "FOUR ", 5));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 7, 200, 0, false, false, 0, "FIVE", 4));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, 3);
+    TEST_ASSERT_EQUALS(_test_reasm_last.capcode, 200);
+    TEST_ASSERT_EQUALS(_test_reasm_last.complete, true);
+    TEST_ASSERT_EQUALS(_test_reasm_last.seq_num, 3);
+    TEST_ASSERT_EQUALS(0 == strcmp(_test_reasm_last.msg, "ONE TWO THREE FOUR FIVE"), true);
+
+    /* Nothing left over */
+    TEST_ASSERT_OK(pager_flex_reasm_flush(reasm));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, 3);
+
+    TEST_ASSERT_OK(pager_flex_reasm_delete(&reasm));
+    TEST_ASSERT_EQUALS(reasm, NULL);
+
+    return A_OK;
+}
+
+TEST_DECLARE_UNIT(test_incomplete, flex_reasm)
+{
+    struct pager_flex_reasm *reasm = NULL;
+    unsigned nr_msgs = _test_reasm_last.nr_msgs;
+
+    TEST_ASSERT_OK(pager_flex_reasm_new(&reasm, 2, 4, _test_reasm_on_msg, NULL));
+
+    /* Times out: still waiting 4 frames on, given up at 5 */
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 10, 100, 0, true, false, 3, "LOST", 4));
+    TEST_ASSERT_OK(pager_flex_reasm_tick(reasm, 14));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, nr_msgs);
+    TEST_ASSERT_OK(pager_flex_reasm_tick(reasm, 15));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, nr_msgs + 1);
+    TEST_ASSERT_EQUALS(_test_reasm_last.complete, false);
+    TEST_ASSERT_EQUALS(0 == strcmp(_test_reasm_last.msg, "LOST"), true);
+
+    /* A fragment out of sequence ends the message, and is handed over on its own */
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 20, 100, 0, true, false, 3, "AB", 2));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 20, 100, 0, true, false, 1, "CD", 2));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, nr_msgs + 3);
+    TEST_ASSERT_EQUALS(_test_reasm_last.complete, false);
+    TEST_ASSERT_EQUALS(_test_reasm_last.seq_num, 1);
+    TEST_ASSERT_EQUALS(0 == strcmp(_test_reasm_last.msg, "CD"), true);
+
+    /* A full arena pushes out the message closest to timing out */
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 21, 1, 0, true, false, 3, "X", 1));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 22, 2, 0, true, false, 3, "Y", 1));
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 22, 3, 0, true, false, 3, "Z", 1));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, nr_msgs + 4);
+    TEST_ASSERT_EQUALS(_test_reasm_last.capcode, 1);
+    TEST_ASSERT_EQUALS(_test_reasm_last.complete, false);
+
+    /* A long gap between frames times out everything */
+    TEST_ASSERT_OK(pager_flex_reasm_tick(reasm, 1000));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, nr_msgs + 6);
+
+    TEST_ASSERT_OK(pager_flex_reasm_add(reasm, 1000, 4, 0, true, false, 3, "W", 1));
+    TEST_ASSERT_OK(pager_flex_reasm_flush(reasm));
+    TEST_ASSERT_EQUALS(_test_reasm_last.nr_msgs, nr_msgs + 7);
+    TEST_ASSERT_EQUALS(_test_reasm_last.capcode, 4);
+
+    TEST_ASSERT_OK(pager_flex_reasm_delete(&reasm));
+
+    return A_OK;
+}
+
+TEST_DECLARE_SUITE(flex_reasm, test_flex_reasm_cleanup, test_flex_reasm_setup, NULL, NULL);
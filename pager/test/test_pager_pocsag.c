@@ -1,4 +1,8 @@
 #include <pager/pager_pocsag.h>
+#include <pager/pager_stats.h>
+#include <pager/pager_decode_pool.h>
+#include <pager/bench/pager_synth.h>
+#include <pager/test/test_pool_hold.h>
 
 #include <test/assert.h>
 #include <test/framework.h>
@@ -10,6 +14,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 static
 const int16_t *samples = NULL;
@@ -193,10 +198,470 @@ aresult_t _test_pocsag_on_num_message_simple_cb(
 TEST_DECLARE_UNIT(test_one_shot, pocsag)
 {
     struct pager_pocsag *pocsag = NULL;
+    struct pager_stats st;
 
     TEST_ASSERT_OK(pager_pocsag_new(&pocsag, 929612500ul, _test_pocsag_on_num_message_simple_cb, _test_pocsag_on_message_simple_cb, false));
     TEST_ASSERT_OK(pager_pocsag_on_pcm(pocsag, samples, nr_samples));
+
+    /* The recording has messages in it, so sync was found and codewords were checked */
+    TEST_ASSERT_OK(pager_pocsag_get_stats(pocsag, &st));
+    TEST_ASSERT_EQUALS(0 != st.nr_syncs, true);
+    TEST_ASSERT_EQUALS(0 != st.nr_bch_clean + st.nr_bch_corrected, true);
+    TEST_INF("Syncs: %llu, batch rejects: %llu, BCH clean/corrected/failed: %llu/%llu/%llu",
+            (unsigned long long)st.nr_syncs, (unsigned long long)st.nr_frame_rejects,
+            (unsigned long long)st.nr_bch_clean, (unsigned long long)st.nr_bch_corrected,
+            (unsigned long long)st.nr_bch_failed);
+
+    TEST_ASSERT_OK(pager_pocsag_delete(&pocsag));
+
+    return A_OK;
+}
+
+/**
+ * Render a bit stream as NRZ samples at an arbitrary number of samples per bit, with a 1 as a
+ * negative sample, and the bits MSB first from each word.
+ */
+static
+size_t _test_pocsag_render_words(int16_t *out, const uint32_t *words, size_t nr_words, double samples_per_bit)
+{
+    size_t nr_bits = nr_words * 32,
+           nr_out = (size_t)(nr_bits * samples_per_bit);
+
+    for (size_t i = 0; i < nr_out; i++) {
+        size_t bit = (size_t)(((double)i + 0.5) / samples_per_bit);
+
+        if (bit >= nr_bits) {
+            bit = nr_bits - 1;
+        }
+
+        out[i] = (words[bit / 32] >> (31 - bit % 32)) & 1 ? -8000 : 8000;
+    }
+
+    return nr_out;
+}
+
+#define TEST_POCSAG_PREAMBLE_WORDS      18
+#define TEST_POCSAG_BATCHES             2
+
+TEST_DECLARE_UNIT(test_low_rate, pocsag)
+{
+    struct pager_pocsag *pocsag = NULL;
+    struct pager_stats st;
+    uint32_t words[TEST_POCSAG_PREAMBLE_WORDS + TEST_POCSAG_BATCHES * 17 + 1];
+    int16_t *pcm = NULL;
+    size_t nr_words = 0,
+           nr_pcm = 0;
+
+    /* 1200 baud at 7200 Hz is 6 samples per bit; make the transmitter's bit clock 0.2% slow */
+    double samples_per_bit = 6.0 * 1.002;
+
+    for (size_t i = 0; i < TEST_POCSAG_PREAMBLE_WORDS; i++) {
+        words[nr_words++] = 0xaaaaaaaaul;
+    }
+
+    for (size_t i = 0; i < TEST_POCSAG_BATCHES; i++) {
+        words[nr_words++] = 0x7cd215d8ul;
+        for (size_t j = 0; j < 16; j++) {
+            words[nr_words++] = 0x7a89c197ul;
+        }
+    }
+
+    /* Something that isn't a sync word, to end the transmission */
+    words[nr_words++] = 0x55555555ul;
+
+    TEST_ASSERT_OK(TCALLOC((void **)&pcm, (size_t)(nr_words * 32 * samples_per_bit) + 1, sizeof(int16_t)));
+    nr_pcm = _test_pocsag_render_words(pcm, words, nr_words, samples_per_bit);
+
+    TEST_ASSERT_OK(pager_pocsag_new_rate(&pocsag, 929612500ul, 7200, _test_pocsag_on_num_message_simple_cb,
+                _test_pocsag_on_message_simple_cb, false));
+
+    /* Feed it in odd sized chunks, to cross block boundaries mid-bit */
+    for (size_t off = 0; off < nr_pcm; off += 97) {
+        TEST_ASSERT_OK(pager_pocsag_on_pcm(pocsag, &pcm[off], nr_pcm - off < 97 ? nr_pcm - off : 97));
+    }
+
+    /* One sync, then every idle codeword of both batches received without an error */
+    TEST_ASSERT_OK(pager_pocsag_get_stats(pocsag, &st));
+    TEST_ASSERT_EQUALS(st.nr_syncs, 1);
+    TEST_ASSERT_EQUALS(st.nr_frame_rejects, 0);
+    TEST_ASSERT_EQUALS(st.nr_bch_clean, TEST_POCSAG_BATCHES * 16);
+
+    TEST_ASSERT_OK(pager_pocsag_delete(&pocsag));
+    TFREE(pcm);
+
+    return A_OK;
+}
+
+/**
+ * Chunk sizes to feed the sync search, so words straddle its 64 sample blocks every which way
+ */
+static const
+size_t _test_pocsag_chunks[] = { 97, 1, 63, 65, 211, 13 };
+
+/**
+ * Bits to flip in the sync word, spread out so no shift of the preamble and sync word together
+ * comes any closer to a sync word than the errors themselves
+ */
+static const
+unsigned _test_pocsag_error_bits[] = { 3, 10, 16, 23, 29 };
+
+/**
+ * Send a single batch at 38400 Hz, with nr_errors bits of its sync word flipped, and count the
+ * syncs found.
+ */
+static
+aresult_t _test_pocsag_sync_with_errors(unsigned baud_rate, size_t nr_errors, uint64_t *pnr_syncs)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_pocsag *pocsag = NULL;
+    struct pager_stats st;
+    uint32_t words[TEST_POCSAG_PREAMBLE_WORDS + 17 + 1];
+    int16_t *pcm = NULL;
+    size_t nr_words = 0,
+           nr_pcm = 0,
+           chunk = 0;
+    double samples_per_bit = 38400.0 / (double)baud_rate;
+    uint32_t sync = 0x7cd215d8ul;
+
+    for (size_t i = 0; i < nr_errors; i++) {
+        sync ^= 1ul << _test_pocsag_error_bits[i];
+    }
+
+    for (size_t i = 0; i < TEST_POCSAG_PREAMBLE_WORDS; i++) {
+        words[nr_words++] = 0xaaaaaaaaul;
+    }
+
+    words[nr_words++] = sync;
+
+    for (size_t j = 0; j < 16; j++) {
+        words[nr_words++] = 0x7a89c197ul;
+    }
+
+    words[nr_words++] = 0x55555555ul;
+
+    TEST_ASSERT_OK(TCALLOC((void **)&pcm, (size_t)(nr_words * 32 * samples_per_bit) + 1, sizeof(int16_t)));
+    nr_pcm = _test_pocsag_render_words(pcm, words, nr_words, samples_per_bit);
+
+    TEST_ASSERT_OK(pager_pocsag_new(&pocsag, 929612500ul, _test_pocsag_on_num_message_simple_cb,
+                _test_pocsag_on_message_simple_cb, false));
+
+    for (size_t off = 0; off < nr_pcm; chunk = (chunk + 1) % BL_ARRAY_ENTRIES(_test_pocsag_chunks)) {
+        size_t nr = BL_MIN2(_test_pocsag_chunks[chunk], nr_pcm - off);
+
+        TEST_ASSERT_OK(pager_pocsag_on_pcm(pocsag, &pcm[off], nr));
+        off += nr;
+    }
+
+    TEST_ASSERT_OK(pager_pocsag_get_stats(pocsag, &st));
+    *pnr_syncs = st.nr_syncs;
+
     TEST_ASSERT_OK(pager_pocsag_delete(&pocsag));
+    TFREE(pcm);
+
+    return ret;
+}
+
+/**
+ * A sync word is found with up to 4 bits in error, at every baud rate, and not with 5.
+ */
+TEST_DECLARE_UNIT(test_sync_errors, pocsag)
+{
+    static const unsigned baud_rates[] = { 512, 1200, 2400 };
+
+    for (size_t b = 0; b < BL_ARRAY_ENTRIES(baud_rates); b++) {
+        for (size_t nr_errors = 0; nr_errors <= 5; nr_errors++) {
+            uint64_t nr_syncs = 0;
+
+            TEST_ASSERT_OK(_test_pocsag_sync_with_errors(baud_rates[b], nr_errors, &nr_syncs));
+
+            if (nr_syncs != (nr_errors <= 4 ? 1 : 0)) {
+                TEST_ERR("%u baud, %zu bit errors: got %llu syncs", baud_rates[b], nr_errors,
+                        (unsigned long long)nr_syncs);
+                return A_E_INVAL;
+            }
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * The sample rate the synthesized signals are decoded at
+ */
+#define TEST_POCSAG_SYNTH_RATE          38400
+
+/**
+ * The messages sent: long enough, between them, to run more batches back to back than the
+ * decoder keeps in flight (PAGER_POCSAG_NR_BATCHES)
+ */
+#define TEST_POCSAG_SYNTH_MSGS          24
+
+/**
+ * The longest chunk of samples handed to the decoder at once
+ */
+#define TEST_POCSAG_SYNTH_MAX_CHUNK     4096
+
+/**
+ * A message as it came out of the decoder
+ */
+struct test_pocsag_msg {
+    uint32_t capcode;
+    uint8_t function;
+    char text[PAGER_SYNTH_MAX_MSG_LEN + 1];
+};
+
+/**
+ * The messages decoded, in the order they were delivered
+ */
+struct test_pocsag_log {
+    struct test_pocsag_msg msgs[TEST_POCSAG_SYNTH_MSGS + 2];
+    size_t nr_msgs;
+
+    /**
+     * Messages that didn't fit in msgs
+     */
+    size_t nr_unexpected;
+};
+
+static
+struct test_pocsag_log test_pocsag_log;
+
+/**
+ * What came out of the decoder with no pool, to compare the pool's output with
+ */
+static
+struct test_pocsag_log test_pocsag_log_inline;
+
+static
+char test_pocsag_texts[TEST_POCSAG_SYNTH_MSGS][PAGER_SYNTH_MAX_MSG_LEN + 1];
+
+/**
+ * The messages sent. The last two are short, with capcodes in frames 5 and 7, so the very last
+ * one always ends on the last code word of a batch, and the batch after it is all idle.
+ */
+static
+struct pager_synth_msg test_pocsag_msgs[TEST_POCSAG_SYNTH_MSGS + 2];
+
+static
+aresult_t _test_pocsag_log_on_msg(struct pager_pocsag *pocsag, uint16_t baud_rate, uint32_t capcode,
+        const char *data, size_t data_len, uint8_t function)
+{
+    struct test_pocsag_log *log = &test_pocsag_log;
+    struct test_pocsag_msg *msg = NULL;
+
+    /* The last code word is padded out with ETX */
+    while (0 != data_len && ('\x03' == data[data_len - 1] || '\0' == data[data_len - 1])) {
+        data_len--;
+    }
+
+    if (BL_ARRAY_ENTRIES(log->msgs) == log->nr_msgs || data_len > PAGER_SYNTH_MAX_MSG_LEN) {
+        log->nr_unexpected++;
+        return A_OK;
+    }
+
+    msg = &log->msgs[log->nr_msgs++];
+
+    msg->capcode = capcode;
+    msg->function = function;
+    memcpy(msg->text, data, data_len);
+    msg->text[data_len] = '\0';
+
+    return A_OK;
+}
+
+static
+void _test_pocsag_synth_msgs_init(void)
+{
+    for (size_t i = 0; i < TEST_POCSAG_SYNTH_MSGS; i++) {
+        struct pager_synth_msg *msg = &test_pocsag_msgs[i];
+
+        /* All alphanumeric: the decoder only guesses at which a message is, and short numeric
+         * messages can pass for alphanumeric ones
+         */
+        msg->capcode = 100000 + 37 * i;
+        msg->numeric = false;
+
+        /* Up to 3 batches long */
+        snprintf(test_pocsag_texts[i], sizeof(test_pocsag_texts[i]), "%zu: call ext %u re ticket %u%s%s", i,
+                (unsigned)(1000 + (i * 7) % 9000), (unsigned)((i * 7919) % 1000000),
+                0 == i % 3 ? ", urgent, partial outage in the east wing" : "",
+                0 == i % 5 ? ", all staff to report to the front desk" : "");
+
+        msg->text = test_pocsag_texts[i];
+    }
+
+    test_pocsag_msgs[TEST_POCSAG_SYNTH_MSGS] = (struct pager_synth_msg){ .capcode = 8 * 1234 + 5, .text = "hi" };
+    test_pocsag_msgs[TEST_POCSAG_SYNTH_MSGS + 1] = (struct pager_synth_msg){ .capcode = 8 * 4321 + 7, .text = "ok" };
+}
+
+/**
+ * Render the test messages: a quarter second of noise, the transmission, then another quarter
+ * second of noise. If cut_last is set, the last batch, which is all idle, is left out, so the
+ * last message is still waiting for the end of it when sync is lost.
+ */
+static
+aresult_t _test_pocsag_synth_render(struct pager_synth **psynth, unsigned baud, bool cut_last)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_synth *synth = NULL;
+    size_t samples_per_batch = 17 * 32 * (TEST_POCSAG_SYNTH_RATE / baud);
+
+    /* At worst, every message in a batch of its own, plus idles up to its frame */
+    if (FAILED(ret = pager_synth_new(&synth, TEST_POCSAG_SYNTH_RATE,
+                    ((TEST_POCSAG_SYNTH_MSGS + 2) * ((PAGER_SYNTH_MAX_MSG_LEN * 7 / 20 + 18) * 32) + 1024) *
+                    (size_t)(TEST_POCSAG_SYNTH_RATE / baud) + TEST_POCSAG_SYNTH_RATE, 0.0, 0.0, 0x9c5a)))
+    {
+        goto done;
+    }
+
+    if (FAILED(ret = pager_synth_gap(synth, TEST_POCSAG_SYNTH_RATE / 4)) ||
+            FAILED(ret = pager_synth_pocsag(synth, baud, test_pocsag_msgs, TEST_POCSAG_SYNTH_MSGS + 2)))
+    {
+        goto done;
+    }
+
+    if (true == cut_last) {
+        synth->nr_samples -= samples_per_batch;
+    }
+
+    if (FAILED(ret = pager_synth_gap(synth, TEST_POCSAG_SYNTH_RATE / 4))) {
+        goto done;
+    }
+
+    *psynth = synth;
+
+done:
+    if (FAILED(ret)) {
+        if (NULL != synth) {
+            pager_synth_delete(&synth);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Decode a synthesized signal in chunks of random size, with batches corrected on the pool if
+ * one is given.
+ */
+static
+aresult_t _test_pocsag_synth_decode(const struct pager_synth *synth, struct pager_decode_pool *pool,
+        uint32_t seed, struct pager_stats *stats)
+{
+    aresult_t ret = A_OK;
+
+    struct pager_pocsag *pocsag = NULL;
+    uint32_t lcg = seed;
+    size_t offset = 0;
+
+    memset(&test_pocsag_log, 0, sizeof(test_pocsag_log));
+
+    TSL_BUG_IF_FAILED(pager_pocsag_new_rate(&pocsag, 929612500ul, TEST_POCSAG_SYNTH_RATE, _test_pocsag_log_on_msg,
+                _test_pocsag_log_on_msg, false));
+    TSL_BUG_IF_FAILED(pager_pocsag_set_decode_pool(pocsag, pool));
+
+    while (offset < synth->nr_samples) {
+        size_t nr = 0;
+
+        lcg = lcg * 1664525ul + 1013904223ul;
+        nr = BL_MIN2(1 + (lcg >> 8) % TEST_POCSAG_SYNTH_MAX_CHUNK, synth->nr_samples - offset);
+
+        if (FAILED(ret = pager_pocsag_on_pcm(pocsag, &synth->pcm[offset], nr))) {
+            goto done;
+        }
+
+        offset += nr;
+    }
+
+    /* Finish the batches still on the pool, so their counts are in the stats */
+    TSL_BUG_IF_FAILED(pager_pocsag_set_decode_pool(pocsag, NULL));
+    TSL_BUG_IF_FAILED(pager_pocsag_get_stats(pocsag, stats));
+
+done:
+    TSL_BUG_IF_FAILED(pager_pocsag_delete(&pocsag));
+    return ret;
+}
+
+/**
+ * Check every message came out, in the order it was sent, with the text intact
+ */
+static
+aresult_t _test_pocsag_synth_check_log(unsigned baud)
+{
+    const struct test_pocsag_log *log = &test_pocsag_log;
+
+    if (0 != log->nr_unexpected || TEST_POCSAG_SYNTH_MSGS + 2 != log->nr_msgs) {
+        TEST_ERR("%u baud: %zu messages decoded of %d, %zu unexpected", baud, log->nr_msgs,
+                TEST_POCSAG_SYNTH_MSGS + 2, log->nr_unexpected);
+        return A_E_INVAL;
+    }
+
+    for (size_t i = 0; i < TEST_POCSAG_SYNTH_MSGS + 2; i++) {
+        const struct test_pocsag_msg *msg = &log->msgs[i];
+
+        if (msg->capcode != test_pocsag_msgs[i].capcode || 0 != strcmp(msg->text, test_pocsag_msgs[i].text)) {
+            TEST_ERR("%u baud, message %zu: got %u '%s', expected %u '%s'", baud, i, msg->capcode, msg->text,
+                    test_pocsag_msgs[i].capcode, test_pocsag_msgs[i].text);
+            return A_E_INVAL;
+        }
+    }
+
+    return A_OK;
+}
+
+/**
+ * Correcting batches on a pool has to give exactly what correcting them inline does: the same
+ * messages, in the same order, and the same counts. The transmission runs more batches than the
+ * ring of batches in flight, and with the workers held up the ring fills. When the last batch
+ * is cut off, sync is lost with the last message still pending, and it has to come out after
+ * everything in the batches still in flight.
+ */
+TEST_DECLARE_UNIT(test_synth_pool, pocsag)
+{
+    static const unsigned baud_rates[] = { 512, 1200, 2400 };
+
+    aresult_t ret = A_OK;
+
+    struct pager_decode_pool *pool = NULL;
+
+    _test_pocsag_synth_msgs_init();
+
+    TEST_ASSERT_OK(pager_decode_pool_new(&pool, 3, 32));
+
+    for (size_t i = 0; i < 2 * BL_ARRAY_ENTRIES(baud_rates); i++) {
+        unsigned baud = baud_rates[i / 2];
+        bool cut_last = 1 == i % 2;
+        struct pager_synth *synth = NULL;
+        struct pager_stats stats_inline,
+                           stats_pool;
+
+        TEST_ASSERT_OK(_test_pocsag_synth_render(&synth, baud, cut_last));
+
+        TEST_ASSERT_OK(_test_pocsag_synth_decode(synth, NULL, 0x1234 + i, &stats_inline));
+        TEST_ASSERT_OK(_test_pocsag_synth_check_log(baud));
+        TEST_ASSERT_EQUALS(stats_inline.nr_syncs, 1);
+        TEST_ASSERT_EQUALS(stats_inline.nr_frame_rejects, 0);
+        TEST_ASSERT_EQUALS(stats_inline.nr_bch_clean > 16 * 8, true);
+        test_pocsag_log_inline = test_pocsag_log;
+
+        TEST_ASSERT_OK(_test_pocsag_synth_decode(synth, pool, 0x5678 + i, &stats_pool));
+        TEST_ASSERT_EQUALS(memcmp(&test_pocsag_log, &test_pocsag_log_inline, sizeof(test_pocsag_log)), 0);
+        TEST_ASSERT_EQUALS(memcmp(&stats_pool, &stats_inline, sizeof(stats_pool)), 0);
+
+        /* Let the workers go before checking, or a failure leaves the pool stuck */
+        TEST_ASSERT_OK(test_pool_hold(pool, 3));
+        ret = _test_pocsag_synth_decode(synth, pool, 0x9abc + i, &stats_pool);
+        test_pool_release(pool);
+        TEST_ASSERT_OK(ret);
+        TEST_ASSERT_EQUALS(memcmp(&test_pocsag_log, &test_pocsag_log_inline, sizeof(test_pocsag_log)), 0);
+        TEST_ASSERT_EQUALS(memcmp(&stats_pool, &stats_inline, sizeof(stats_pool)), 0);
+
+        pager_synth_delete(&synth);
+    }
+
+    TEST_ASSERT_OK(pager_decode_pool_delete(&pool));
 
     return A_OK;
 }
@@ -0,0 +1,65 @@
+#include <pager/test/test_pool_hold.h>
+
+#include <tsl/assert.h>
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+static
+struct pager_decode_job test_pool_hold_jobs[TEST_POOL_HOLD_MAX_WORKERS];
+
+static
+size_t test_pool_nr_hold_jobs = 0;
+
+static
+atomic_bool test_pool_held;
+
+static
+atomic_size_t test_pool_nr_held;
+
+static
+void _test_pool_hold_work(struct pager_decode_job *job)
+{
+    atomic_fetch_add(&test_pool_nr_held, 1);
+
+    while (true == atomic_load(&test_pool_held)) {
+        sched_yield();
+    }
+}
+
+aresult_t test_pool_hold(struct pager_decode_pool *pool, size_t nr_workers)
+{
+    aresult_t ret = A_OK;
+
+    TSL_ASSERT_ARG(NULL != pool);
+    TSL_ASSERT_ARG(0 != nr_workers && nr_workers <= TEST_POOL_HOLD_MAX_WORKERS);
+
+    atomic_store(&test_pool_held, true);
+    atomic_store(&test_pool_nr_held, 0);
+
+    for (size_t i = 0; i < nr_workers; i++) {
+        test_pool_hold_jobs[i].work = _test_pool_hold_work;
+        pager_decode_pool_run(pool, &test_pool_hold_jobs[i]);
+    }
+
+    test_pool_nr_hold_jobs = nr_workers;
+
+    /* A worker stuck on one job can't take another, so each ends up with one */
+    while (atomic_load(&test_pool_nr_held) < nr_workers) {
+        sched_yield();
+    }
+
+    return ret;
+}
+
+void test_pool_release(struct pager_decode_pool *pool)
+{
+    atomic_store(&test_pool_held, false);
+
+    for (size_t i = 0; i < test_pool_nr_hold_jobs; i++) {
+        pager_decode_pool_wait(pool, &test_pool_hold_jobs[i]);
+    }
+
+    test_pool_nr_hold_jobs = 0;
+}
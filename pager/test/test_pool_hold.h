@@ -0,0 +1,31 @@
+#pragma once
+
+#include <pager/pager_decode_pool.h>
+
+#include <tsl/result.h>
+
+#include <stddef.h>
+
+/**
+ * The most workers test_pool_hold can tie up
+ */
+#define TEST_POOL_HOLD_MAX_WORKERS      8
+
+/**
+ * Tie up every worker in a pool until test_pool_release, so jobs handed to it pile up in its
+ * queue. Anything waiting on one of those jobs has to run it itself. Returns once every worker
+ * is held.
+ *
+ * \param pool The pool
+ * \param nr_workers The number of workers the pool was created with
+ *
+ * \return A_OK on success, an error code otherwise
+ */
+aresult_t test_pool_hold(struct pager_decode_pool *pool, size_t nr_workers);
+
+/**
+ * Let the workers tied up by test_pool_hold go, and wait for them to be free again.
+ *
+ * \param pool The pool passed to test_pool_hold
+ */
+void test_pool_release(struct pager_decode_pool *pool);
@@ -39,15 +39,33 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #define RES_MSG(sev, sys, msg, ...) MESSAGE("RESAMPLER", sev, sys, msg, ##__VA_ARGS__)
 
+/**
+ * The number of sample buffers the polyphase FIR can hold at once
+ */
+#define RES_FIR_BUFS                2
+
+/**
+ * The most buffers that can be filled by one readv, or written by one writev
+ */
+#define RES_MAX_BATCH               16
+
 static
 unsigned interpolate = 1;
 
 static
 unsigned decimate = 1;
 
+/**
+ * The output to input sample rate ratio, if resampling with a fractional resampler rather than
+ * a polyphase FIR. 0 otherwise.
+ */
+static
+double resample_ratio = 0.0;
+
 static
 unsigned input_sample_rate = 0;
 
@@ -69,12 +87,46 @@ struct polyphase_fir *pfir = NULL;
 static
 bool dc_blocker = false;
 
+/**
+ * Whether the input is interleaved complex I/Q, rather than real samples
+ */
+static
+bool complex_samples = false;
+
+/**
+ * The most samples read into a single sample buffer
+ */
+static
+size_t read_samples = 16384;
+
+/**
+ * The most samples written out by a single write
+ */
+static
+size_t write_samples = 16384;
+
+/**
+ * The number of sample buffers to fill with one readv, and output chunks to drain with one
+ * writev. 1 means plain read and write calls.
+ */
+static
+size_t batch = 1;
+
 static
 void _usage(const char *appname)
 {
-    RES_MSG(SEV_INFO, "USAGE", "%s -I [interpolate] -D [decimate] -F [filter file] -S [sample rate] [-b] [in_fifo] [out_fifo]",
+    RES_MSG(SEV_INFO, "USAGE", "%s -I [interpolate] -D [decimate] -F [filter file] -S [sample rate] [-b] [-c] "
+            "[-r read samples] [-w write samples] [-v batch] [in_fifo] [out_fifo]",
             appname);
+    RES_MSG(SEV_INFO, "USAGE", "        -R      Resample by an arbitrary ratio of output to input rate, such as");
+    RES_MSG(SEV_INFO, "USAGE", "                38400/25000, in place of -I, -D and -F");
     RES_MSG(SEV_INFO, "USAGE", "        -b      Enable DC blocking filter");
+    RES_MSG(SEV_INFO, "USAGE", "        -c      Input and output are complex 16-bit I/Q, rather than real samples");
+    RES_MSG(SEV_INFO, "USAGE", "        -r      Most samples to read at once (default: %zu)", read_samples);
+    RES_MSG(SEV_INFO, "USAGE", "        -w      Most samples to write at once (default: %zu)", write_samples);
+    RES_MSG(SEV_INFO, "USAGE", "        -v      Fill up to this many buffers per readv, and drain up to this many");
+    RES_MSG(SEV_INFO, "USAGE", "                output chunks per writev (default: 1, plain read/write; max: %d)",
+            RES_MAX_BATCH);
     exit(EXIT_SUCCESS);
 }
 
@@ -86,7 +138,7 @@ void _set_options(int argc, char * const argv[])
     struct config *cfg CAL_CLEANUP(config_delete) = NULL;
     double *filter_coeffs_f = NULL;
 
-    while ((arg = getopt(argc, argv, "I:D:S:F:bh")) != -1) {
+    while ((arg = getopt(argc, argv, "I:D:R:S:F:r:w:v:bch")) != -1) {
         switch (arg) {
         case 'I':
             interpolate = strtoll(optarg, NULL, 0);
@@ -94,6 +146,13 @@ void _set_options(int argc, char * const argv[])
         case 'D':
             decimate = strtoll(optarg, NULL, 0);
             break;
+        case 'R':
+            if (FAILED(polyphase_fir_parse_ratio(optarg, &resample_ratio))) {
+                RES_MSG(SEV_FATAL, "BAD-RATIO", "Resampling ratio must be between %f and %f, got '%s'",
+                        POLYPHASE_FIR_FRAC_RATIO_MIN, POLYPHASE_FIR_FRAC_RATIO_MAX, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'S':
             input_sample_rate = strtoll(optarg, NULL, 0);
             break;
@@ -104,6 +163,18 @@ void _set_options(int argc, char * const argv[])
             dc_blocker = true;
             RES_MSG(SEV_INFO, "DC-BLOCKER-ENABLED", "Enabling DC Blocking Filter.");
             break;
+        case 'c':
+            complex_samples = true;
+            break;
+        case 'r':
+            read_samples = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            write_samples = strtoull(optarg, NULL, 0);
+            break;
+        case 'v':
+            batch = strtoull(optarg, NULL, 0);
+            break;
         case 'h':
             _usage(argv[0]);
             break;
@@ -120,34 +191,54 @@ void _set_options(int argc, char * const argv[])
         exit(EXIT_FAILURE);
     }
 
-    if (0 == decimate) {
+    if (0 == interpolate) {
         RES_MSG(SEV_FATAL, "BAD-INTERPOLATION", "Interpolation factor must be a non-zero integer.");
         exit(EXIT_FAILURE);
     }
 
-    if (NULL == filter_file) {
-        RES_MSG(SEV_FATAL, "BAD-FILTER-FILE", "Need to specify a filter JSON file.");
+    if (0 == read_samples || 0 == write_samples) {
+        RES_MSG(SEV_FATAL, "BAD-IO-SIZE", "Read and write sizes must be a non-zero number of samples.");
         exit(EXIT_FAILURE);
     }
 
-    RES_MSG(SEV_INFO, "CONFIG", "Resampling: %u/%u from %u to %f", interpolate, decimate, input_sample_rate,
-            ((double)interpolate/(double)decimate)*(double)input_sample_rate);
-    RES_MSG(SEV_INFO, "CONFIG", "Loading filter coefficients from '%s'", filter_file);
+    if (0 == batch || RES_MAX_BATCH < batch) {
+        RES_MSG(SEV_FATAL, "BAD-BATCH", "Batch size must be between 1 and %d.", RES_MAX_BATCH);
+        exit(EXIT_FAILURE);
+    }
 
-    TSL_BUG_IF_FAILED(config_new(&cfg));
+    if (true == complex_samples && true == dc_blocker) {
+        RES_MSG(SEV_FATAL, "BAD-DC-BLOCKER", "The DC blocking filter only works on real samples.");
+        exit(EXIT_FAILURE);
+    }
 
-    if (FAILED(config_add(cfg, filter_file))) {
-        RES_MSG(SEV_INFO, "BAD-CONFIG", "Configuration file '%s' cannot be processed, aborting.",
-                filter_file);
+    if (NULL == filter_file && 0.0 == resample_ratio) {
+        RES_MSG(SEV_FATAL, "BAD-FILTER-FILE", "Need to specify a filter JSON file, or a resampling ratio.");
         exit(EXIT_FAILURE);
     }
 
-    TSL_BUG_IF_FAILED(config_get_float_array(cfg, &filter_coeffs_f, &nr_filter_coeffs, "lpfCoeffs"));
-    TSL_BUG_IF_FAILED(TCALLOC((void **)&filter_coeffs, sizeof(int16_t) * nr_filter_coeffs, (size_t)1));
+    if (0.0 != resample_ratio) {
+        RES_MSG(SEV_INFO, "CONFIG", "Resampling: fractional %f from %u to %f", resample_ratio, input_sample_rate,
+                resample_ratio * (double)input_sample_rate);
+    } else {
+        RES_MSG(SEV_INFO, "CONFIG", "Resampling: %u/%u from %u to %f", interpolate, decimate, input_sample_rate,
+                ((double)interpolate/(double)decimate)*(double)input_sample_rate);
+        RES_MSG(SEV_INFO, "CONFIG", "Loading filter coefficients from '%s'", filter_file);
+
+        TSL_BUG_IF_FAILED(config_new(&cfg));
+
+        if (FAILED(config_add(cfg, filter_file))) {
+            RES_MSG(SEV_INFO, "BAD-CONFIG", "Configuration file '%s' cannot be processed, aborting.",
+                    filter_file);
+            exit(EXIT_FAILURE);
+        }
+
+        TSL_BUG_IF_FAILED(config_get_float_array(cfg, &filter_coeffs_f, &nr_filter_coeffs, "lpfCoeffs"));
+        TSL_BUG_IF_FAILED(TCALLOC((void **)&filter_coeffs, sizeof(int16_t) * nr_filter_coeffs, (size_t)1));
 
-    for (size_t i = 0; i < nr_filter_coeffs; i++) {
-        double q15 = 1 << Q_15_SHIFT;
-        filter_coeffs[i] = (int16_t)(filter_coeffs_f[i] * q15);
+        for (size_t i = 0; i < nr_filter_coeffs; i++) {
+            double q15 = 1 << Q_15_SHIFT;
+            filter_coeffs[i] = (int16_t)(filter_coeffs_f[i] * q15);
+        }
     }
 
     if (0 > (out_fifo = open(argv[optind + 1], O_WRONLY))) {
@@ -161,66 +252,159 @@ void _set_options(int argc, char * const argv[])
     }
 }
 
+/**
+ * Sample buffers not currently being read into, waiting to be filtered, or held by the FIR.
+ * Every buffer is allocated at startup and recycled through here.
+ */
+static
+struct sample_buf *free_bufs[RES_FIR_BUFS + RES_MAX_BATCH];
+
 static
-aresult_t _free_sample_buf(struct sample_buf *buf)
+size_t nr_free_bufs = 0;
+
+/**
+ * Buffers that have been read into, but not yet handed to the FIR, oldest first
+ */
+static
+struct sample_buf *pending_bufs[RES_MAX_BATCH];
+
+static
+size_t nr_pending_bufs = 0;
+
+static
+size_t pending_head = 0;
+
+/**
+ * Output chunks, each of write_samples samples, and how far each has been filled
+ */
+static
+int16_t *output_buf = NULL;
+
+static
+size_t output_fill[RES_MAX_BATCH];
+
+static
+size_t output_chunk = 0;
+
+static
+aresult_t _release_sample_buf(struct sample_buf *buf)
 {
     TSL_BUG_ON(NULL == buf);
-    TFREE(buf);
+    TSL_BUG_ON(nr_free_bufs >= RES_FIR_BUFS + batch);
+
+    free_bufs[nr_free_bufs++] = buf;
+
     return A_OK;
 }
 
-#define NR_SAMPLES                  1024
-
+/**
+ * Allocate every sample buffer we'll ever need, and the output chunks
+ */
 static
-aresult_t _alloc_sample_buf(struct sample_buf **pbuf)
+aresult_t _pool_init(void)
 {
     aresult_t ret = A_OK;
 
-    struct sample_buf *buf = NULL;
+    const size_t sample_bytes = (true == complex_samples ? 2 : 1) * sizeof(int16_t);
 
-    TSL_ASSERT_ARG(NULL != pbuf);
+    for (size_t i = 0; i < RES_FIR_BUFS + batch; i++) {
+        struct sample_buf *buf = NULL;
 
-    if (FAILED(ret = TCALLOC((void **)&buf, NR_SAMPLES * sizeof(int16_t) + sizeof(struct sample_buf), 1ul))) {
-        goto done;
-    }
+        if (FAILED(ret = TACALLOC((void **)&buf, 1, sizeof(struct sample_buf) + read_samples * sample_bytes,
+                        SYS_CACHE_LINE_LENGTH)))
+        {
+            goto done;
+        }
 
-    buf->refcount = 0;
-    buf->sample_type = COMPLEX_INT_16;
-    buf->sample_buf_bytes = NR_SAMPLES * sizeof(int16_t);
-    buf->nr_samples = 0;
-    buf->release = _free_sample_buf;
-    buf->priv = NULL;
+        buf->sample_type = true == complex_samples ? COMPLEX_INT_16 : REAL_INT_16;
+        buf->sample_buf_bytes = read_samples * sample_bytes;
+        buf->release = _release_sample_buf;
 
-    *pbuf = buf;
+        free_bufs[nr_free_bufs++] = buf;
+    }
+
+    if (FAILED(ret = TACALLOC((void **)&output_buf, batch * write_samples, sample_bytes, SYS_CACHE_LINE_LENGTH))) {
+        goto done;
+    }
 
 done:
     return ret;
 }
 
 static
-int16_t output_buf[NR_SAMPLES];
+void _pool_cleanup(void)
+{
+    /* Make sure any buffers still held by the FIR are back in the pool */
+    polyphase_fir_delete(&pfir);
+
+    while (0 != nr_pending_bufs) {
+        free_bufs[nr_free_bufs++] = pending_bufs[pending_head];
+        pending_head = (pending_head + 1) % RES_MAX_BATCH;
+        nr_pending_bufs--;
+    }
+
+    for (size_t i = 0; i < nr_free_bufs; i++) {
+        TFREE(free_bufs[i]);
+    }
+    nr_free_bufs = 0;
+
+    if (NULL != output_buf) {
+        TFREE(output_buf);
+    }
+}
 
+/**
+ * Fill as many free sample buffers as we're allowed to with a single read (or readv), and queue
+ * them up for the FIR. Blocks until at least one sample is available.
+ */
 static
-aresult_t process_fir(void)
+aresult_t _read_samples(void)
 {
-    int ret = A_OK;
+    aresult_t ret = A_OK;
 
-    struct dc_blocker blck;
+    const size_t sample_bytes = (true == complex_samples ? 2 : 1) * sizeof(int16_t);
+    struct iovec iov[RES_MAX_BATCH];
+    struct sample_buf *bufs[RES_MAX_BATCH];
+    size_t nr_bufs = BL_MIN2(batch, nr_free_bufs),
+           remain = 0;
+    ssize_t op_ret = 0;
+
+    TSL_BUG_ON(0 == nr_bufs);
+
+    for (size_t i = 0; i < nr_bufs; i++) {
+        bufs[i] = free_bufs[--nr_free_bufs];
+        bufs[i]->refcount = 1;
+        bufs[i]->nr_samples = 0;
+        iov[i].iov_base = bufs[i]->data_buf;
+        iov[i].iov_len = bufs[i]->sample_buf_bytes;
+    }
 
-    TSL_BUG_IF_FAILED(dc_blocker_init(&blck, 0.9999));
+    if (1 == nr_bufs) {
+        op_ret = read(in_fifo, iov[0].iov_base, iov[0].iov_len);
+    } else {
+        op_ret = readv(in_fifo, iov, nr_bufs);
+    }
 
-    do {
-        int op_ret = 0;
-        struct sample_buf *read_buf = NULL;
-        size_t new_samples = 0;
-        bool full = false;
+    if (0 >= op_ret) {
+        int errnum = errno;
+        ret = A_E_INVAL;
+        RES_MSG(SEV_FATAL, "READ-FIFO-FAIL", "Failed to read from input fifo: %s (%d)",
+                strerror(errnum), errnum);
+        goto done;
+    }
 
-        TSL_BUG_IF_FAILED(polyphase_fir_full(pfir, &full));
+    DIAG("Read %zd bytes from input FIFO into %zu buffers", op_ret, nr_bufs);
 
-        if (false == full) {
-            TSL_BUG_IF_FAILED(_alloc_sample_buf(&read_buf));
+    /* Buffers fill in order, so only the last one touched can hold a partial sample */
+    remain = op_ret;
+    for (size_t i = 0; i < nr_bufs && 0 != remain; i++) {
+        size_t nr_bytes = BL_MIN2(remain, iov[i].iov_len);
 
-            if (0 >= (op_ret = read(in_fifo, read_buf->data_buf, read_buf->sample_buf_bytes))) {
+        /* Don't split a sample across buffers */
+        while (0 != nr_bytes % sample_bytes) {
+            ssize_t rem_ret = read(in_fifo, (uint8_t *)iov[i].iov_base + nr_bytes, sample_bytes - nr_bytes % sample_bytes);
+
+            if (0 >= rem_ret) {
                 int errnum = errno;
                 ret = A_E_INVAL;
                 RES_MSG(SEV_FATAL, "READ-FIFO-FAIL", "Failed to read from input fifo: %s (%d)",
@@ -228,26 +412,61 @@ aresult_t process_fir(void)
                 goto done;
             }
 
-            DIAG("Read %d bytes from input FIFO", op_ret);
+            nr_bytes += rem_ret;
+        }
+
+        bufs[i]->nr_samples = nr_bytes / sample_bytes;
+        remain -= BL_MIN2(remain, nr_bytes);
+    }
+
+done:
+    /* Queue up what was filled, and put back what wasn't */
+    for (size_t i = 0; i < nr_bufs; i++) {
+        if (0 != bufs[i]->nr_samples) {
+            pending_bufs[(pending_head + nr_pending_bufs) % RES_MAX_BATCH] = bufs[i];
+            nr_pending_bufs++;
+        } else {
+            free_bufs[nr_free_bufs++] = bufs[i];
+        }
+    }
 
-            TSL_BUG_ON((1 & op_ret) != 0);
+    return ret;
+}
 
-            read_buf->nr_samples = op_ret/sizeof(int16_t);
+/**
+ * Write out every output chunk filled so far, with a single write (or writev) where possible.
+ */
+static
+aresult_t _write_samples(void)
+{
+    aresult_t ret = A_OK;
 
-            TSL_BUG_IF_FAILED(polyphase_fir_push_sample_buf(pfir, read_buf));
+    const size_t sample_bytes = (true == complex_samples ? 2 : 1) * sizeof(int16_t);
+    struct iovec iov[RES_MAX_BATCH];
+    size_t nr_iov = 0,
+           first = 0;
+
+    for (size_t i = 0; i <= output_chunk && i < batch; i++) {
+        if (0 == output_fill[i]) {
+            continue;
         }
 
-        /* Filter the samples */
-        TSL_BUG_IF_FAILED(polyphase_fir_process(pfir, output_buf, NR_SAMPLES, &new_samples));
-        TSL_BUG_ON(0 == new_samples);
+        iov[nr_iov].iov_base = &output_buf[i * write_samples * sample_bytes / sizeof(int16_t)];
+        iov[nr_iov].iov_len = output_fill[i] * sample_bytes;
+        nr_iov++;
+    }
+
+    /* Wait until we're back out of data to write, in case the FIFO takes a partial write */
+    while (first < nr_iov) {
+        ssize_t op_ret = 0;
 
-        /* Apply DC blocker, if asked */
-        if (true == dc_blocker) {
-            TSL_BUG_IF_FAILED(dc_blocker_apply(&blck, output_buf, new_samples));
+        if (1 == nr_iov - first) {
+            op_ret = write(out_fifo, iov[first].iov_base, iov[first].iov_len);
+        } else {
+            op_ret = writev(out_fifo, &iov[first], nr_iov - first);
         }
 
-        /* Write them out */
-        if (0 > (op_ret = write(out_fifo, output_buf, new_samples * sizeof(int16_t)))) {
+        if (0 > op_ret) {
             int errnum = errno;
             ret = A_E_INVAL;
             RES_MSG(SEV_FATAL, "WRITE-FIFO-FAIL", "Failed to write to output fifo: %s (%d)",
@@ -255,7 +474,81 @@ aresult_t process_fir(void)
             goto done;
         }
 
-        DIAG("Wrote %d bytes to output FIFO", op_ret);
+        DIAG("Wrote %zd bytes to output FIFO", op_ret);
+
+        while (first < nr_iov && (size_t)op_ret >= iov[first].iov_len) {
+            op_ret -= iov[first].iov_len;
+            first++;
+        }
+
+        if (first < nr_iov) {
+            iov[first].iov_base = (uint8_t *)iov[first].iov_base + op_ret;
+            iov[first].iov_len -= op_ret;
+        }
+    }
+
+    memset(output_fill, 0, sizeof(output_fill));
+    output_chunk = 0;
+
+done:
+    return ret;
+}
+
+static
+aresult_t process_fir(void)
+{
+    int ret = A_OK;
+
+    struct dc_blocker blck;
+    const size_t sample_vals = true == complex_samples ? 2 : 1;
+
+    TSL_BUG_IF_FAILED(dc_blocker_init(&blck, 0.9999));
+
+    do {
+        size_t new_samples = 0;
+        bool full = false;
+
+        TSL_BUG_IF_FAILED(polyphase_fir_full(pfir, &full));
+
+        if (false == full) {
+            if (0 == nr_pending_bufs && FAILED(ret = _read_samples())) {
+                goto done;
+            }
+
+            TSL_BUG_IF_FAILED(polyphase_fir_push_sample_buf(pfir, pending_bufs[pending_head]));
+            pending_head = (pending_head + 1) % RES_MAX_BATCH;
+            nr_pending_bufs--;
+        }
+
+        /* Filter everything we can, a chunk at a time */
+        do {
+            int16_t *out = &output_buf[(output_chunk * write_samples + output_fill[output_chunk]) * sample_vals];
+
+            TSL_BUG_IF_FAILED(polyphase_fir_process(pfir, out, write_samples - output_fill[output_chunk],
+                        &new_samples));
+
+            /* Apply DC blocker, if asked */
+            if (true == dc_blocker && 0 != new_samples) {
+                TSL_BUG_IF_FAILED(dc_blocker_apply(&blck, out, new_samples));
+            }
+
+            output_fill[output_chunk] += new_samples;
+
+            if (write_samples == output_fill[output_chunk]) {
+                if (batch == output_chunk + 1) {
+                    if (FAILED(ret = _write_samples())) {
+                        goto done;
+                    }
+                } else {
+                    output_chunk++;
+                }
+            }
+        } while (0 != new_samples);
+
+        /* Once we have to wait on the input, send on everything we have */
+        if (0 == nr_pending_bufs && FAILED(ret = _write_samples())) {
+            goto done;
+        }
     } while (app_running());
 
 done:
@@ -270,7 +563,17 @@ int main(int argc, char * const argv[])
     TSL_BUG_IF_FAILED(app_sigint_catch(NULL));
 
     _set_options(argc, argv);
-    TSL_BUG_IF_FAILED(polyphase_fir_new(&pfir, nr_filter_coeffs, filter_coeffs, interpolate, decimate));
+    TSL_BUG_IF_FAILED(_pool_init());
+
+    if (0.0 != resample_ratio) {
+        TSL_BUG_IF_FAILED(true == complex_samples ?
+                polyphase_fir_new_fractional_complex(&pfir, resample_ratio) :
+                polyphase_fir_new_fractional(&pfir, resample_ratio));
+    } else if (true == complex_samples) {
+        TSL_BUG_IF_FAILED(polyphase_fir_new_complex(&pfir, nr_filter_coeffs, filter_coeffs, interpolate, decimate));
+    } else {
+        TSL_BUG_IF_FAILED(polyphase_fir_new(&pfir, nr_filter_coeffs, filter_coeffs, interpolate, decimate));
+    }
 
     RES_MSG(SEV_INFO, "STARTING", "Starting polyphase resampler");
 
@@ -282,7 +585,7 @@ int main(int argc, char * const argv[])
     ret = EXIT_SUCCESS;
 
 done:
-    polyphase_fir_delete(&pfir);
+    _pool_cleanup();
     return ret;
 }
 